@@ -40,7 +40,8 @@ struct PARTICLEINFO
   unsigned char         cipType;
 };
 
-void GetParticleDistanceAndAngle( vtkPolyData*, unsigned int, const cipThinPlateSplineSurface&, double*, double* );
+void GetParticleDistancesAndAngles( vtkPolyData*, const std::vector< unsigned int >&, const cipThinPlateSplineSurface&,
+                                    std::vector< double >*, std::vector< double >* );
 void TallyParticleInfo( vtkPolyData*, std::vector< cipThinPlateSplineSurface >, std::map< unsigned int, PARTICLEINFO >* );
 void ClassifyParticles( std::map< unsigned int, PARTICLEINFO >*, std::vector< cipThinPlateSplineSurface >, double, double, double );
 void WriteParticlesToFile( vtkSmartPointer< vtkPolyData >, std::map< unsigned int, PARTICLEINFO >, std::string, unsigned char );
@@ -138,44 +139,41 @@ int main( int argc, char *argv[] )
   return 0;
 }
 
-void GetParticleDistanceAndAngle( vtkPolyData* particles, unsigned int whichParticle, const cipThinPlateSplineSurface& tps,
-                                  double* distance, double* angle ) 
+// Computes the distance and angle of each of the specified particles
+// with respect to the TPS surface. The closest points on the surface
+// are computed for all the particles in one batch.
+void GetParticleDistancesAndAngles( vtkPolyData* particles, const std::vector< unsigned int >& whichParticles,
+                                    const cipThinPlateSplineSurface& tps, std::vector< double >* distances,
+                                    std::vector< double >* angles )
 {
-  cipParticleToThinPlateSplineSurfaceMetric particleToTPSMetric;
-    particleToTPSMetric.SetThinPlateSplineSurface( tps );
+  std::vector< cip::PointType > positions;
+  for ( unsigned int i=0; i<whichParticles.size(); i++ )
+    {
+    cip::PointType position(3);
+      position[0] = particles->GetPoint(whichParticles[i])[0];
+      position[1] = particles->GetPoint(whichParticles[i])[1];
+      position[2] = particles->GetPoint(whichParticles[i])[2];
+
+    positions.push_back( position );
+    }
 
-  cipNewtonOptimizer< 2 >* newtonOptimizer = new cipNewtonOptimizer< 2 >();
-    newtonOptimizer->SetMetric( particleToTPSMetric );
+  std::vector< cip::PointType > tpsPoints;
+  cip::GetClosestPointsOnThinPlateSplineSurface( tps, positions, tpsPoints, *distances );
 
-  cip::PointType position(3);
   cip::VectorType normal(3);
   cip::VectorType orientation(3);
 
-  cipNewtonOptimizer< 2 >::PointType* domainParams  = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-  cipNewtonOptimizer< 2 >::PointType* optimalParams = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-
-  position[0] = particles->GetPoint(whichParticle)[0];
-  position[1] = particles->GetPoint(whichParticle)[1];
-  position[2] = particles->GetPoint(whichParticle)[2];
-
-  orientation[0] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple(whichParticle)[0];
-  orientation[1] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple(whichParticle)[1];
-  orientation[2] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple(whichParticle)[2];
-
-  particleToTPSMetric.SetParticle( position );
-
-  (*domainParams)[0] = position[0];
-  (*domainParams)[1] = position[1];
-
-  newtonOptimizer->SetInitialParameters( domainParams );
-  newtonOptimizer->Update();
-  newtonOptimizer->GetOptimalParameters( optimalParams );
-
-  *distance = vcl_sqrt( newtonOptimizer->GetOptimalValue() );
+  angles->resize( whichParticles.size() );
+  for ( unsigned int i=0; i<whichParticles.size(); i++ )
+    {
+    orientation[0] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple(whichParticles[i])[0];
+    orientation[1] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple(whichParticles[i])[1];
+    orientation[2] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple(whichParticles[i])[2];
 
-  tps.GetSurfaceNormal( (*optimalParams)[0], (*optimalParams)[1], normal );
+    tps.GetSurfaceNormal( tpsPoints[i][0], tpsPoints[i][1], normal );
 
-  *angle = cip::GetAngleBetweenVectors( normal, orientation, true );
+    (*angles)[i] = cip::GetAngleBetweenVectors( normal, orientation, true );
+    }
 }
 
 // 'tpsVec' has either one (left) or two (right) elements. The
@@ -185,59 +183,52 @@ void GetParticleDistanceAndAngle( vtkPolyData* particles, unsigned int whichPart
 void TallyParticleInfo( vtkPolyData* particles, std::vector< cipThinPlateSplineSurface > tpsVec, 
 			std::map< unsigned int, PARTICLEINFO >* particleToInfoMap )
 {
-  if ( tpsVec.size() == 1 )
+  std::vector< unsigned int > allParticles;
+  for ( unsigned int i=0; i<particles->GetNumberOfPoints(); i++ )
     {
-    // Dealing with the left lung
-    for ( unsigned int i=0; i<particles->GetNumberOfPoints(); i++ )
-      {
-      PARTICLEINFO pInfo;
+    allParticles.push_back( i );
+    }
+
+  // The distance and angle with respect to the first surface (the
+  // left oblique or the right oblique) are needed for every particle
+  std::vector< double > distances, angles;
+  GetParticleDistancesAndAngles( particles, allParticles, tpsVec[0], &distances, &angles );
 
-      double distance, angle;
-      GetParticleDistanceAndAngle( particles, i, tpsVec[0], &distance, &angle );
+  for ( unsigned int i=0; i<particles->GetNumberOfPoints(); i++ )
+    {
+    PARTICLEINFO pInfo;
 
-      pInfo.distance.push_back( distance );
-      pInfo.angle.push_back( angle );
+    pInfo.distance.push_back( distances[i] );
+    pInfo.angle.push_back( angles[i] );
 
-      (*particleToInfoMap)[i] = pInfo;
-      }
+    (*particleToInfoMap)[i] = pInfo;
     }
-  else
+
+  if ( tpsVec.size() == 2 )
     {
-    // Dealing with the right lung
+    // Dealing with the right lung. The right horizontal is only
+    // considered for particles where it is above the right oblique.
     double roSurfaceHeight, rhSurfaceHeight;
+
+    std::vector< unsigned int > rhParticles;
     for ( unsigned int i=0; i<particles->GetNumberOfPoints(); i++ )
       {
-      PARTICLEINFO pInfo;
-
       roSurfaceHeight = tpsVec[0].GetSurfaceHeight( particles->GetPoint(i)[0], particles->GetPoint(i)[1] );
       rhSurfaceHeight = tpsVec[1].GetSurfaceHeight( particles->GetPoint(i)[0], particles->GetPoint(i)[1] ); 
 
-      if ( roSurfaceHeight > rhSurfaceHeight )
+      if ( roSurfaceHeight <= rhSurfaceHeight )
         {
-        double distance, angle;
-        GetParticleDistanceAndAngle( particles, i, tpsVec[0], &distance, &angle );
-
-        pInfo.distance.push_back( distance );
-        pInfo.angle.push_back( angle );
-
-        (*particleToInfoMap)[i] = pInfo;
+        rhParticles.push_back( i );
         }
-      else
-        {
-        double roDistance, roAngle;
-        GetParticleDistanceAndAngle( particles, i, tpsVec[0], &roDistance, &roAngle );
-
-        pInfo.distance.push_back( roDistance );
-        pInfo.angle.push_back( roAngle );
-
-        double rhDistance, rhAngle;
-        GetParticleDistanceAndAngle( particles, i, tpsVec[1], &rhDistance, &rhAngle );
+      }
 
-        pInfo.distance.push_back( rhDistance );
-        pInfo.angle.push_back( rhAngle );
+    std::vector< double > rhDistances, rhAngles;
+    GetParticleDistancesAndAngles( particles, rhParticles, tpsVec[1], &rhDistances, &rhAngles );
 
-        (*particleToInfoMap)[i] = pInfo;
-        }
+    for ( unsigned int i=0; i<rhParticles.size(); i++ )
+      {
+      (*particleToInfoMap)[rhParticles[i]].distance.push_back( rhDistances[i] );
+      (*particleToInfoMap)[rhParticles[i]].angle.push_back( rhAngles[i] );
       }
     }
 }
@@ -7,6 +7,7 @@
 #include "vtkImageMathematics.h"
 #include "vtkComputeAirwayWall.h"
 #include "vtkComputeAirwayWallPolyData.h"
+#include "vtkMultiThreader.h"
 #include "itkImageToVTKImageFilter.h"
 #include <vtksys/SystemTools.hxx>
 #include "cipHelper.h"
@@ -136,6 +137,15 @@ int main( int argc, char *argv[] )
     {
       filter->SaveAirwayImageOff();
     }
+
+  if (threads == 0)
+    {
+      filter->SetNumberOfThreads(vtkMultiThreader::GetGlobalDefaultNumberOfThreads());
+    }
+  else
+    {
+      filter->SetNumberOfThreads(threads);
+    }
     
   filter->Update();
   
@@ -365,6 +365,26 @@ int main( int argc, char *argv[] )
   
   std::cout<<sigmaMinimum<<" "<<sigmaMaximum<<" "<<numberOfSigmaSteps<<std::endl;
   
+  // Read the label map restricting the fused computation, if any
+  cip::LabelMapReaderType::Pointer labelMapReader = cip::LabelMapReaderType::New();
+  if ( fused && labelMapFileName.compare( "NA" ) != 0 )
+    {
+      std::cout << "Reading label map..." << std::endl;
+      labelMapReader->SetFileName( labelMapFileName );
+      try
+	{
+	labelMapReader->Update();
+	}
+      catch ( itk::ExceptionObject &excp )
+	{
+	std::cerr << "Exception caught reading label map:";
+	std::cerr << excp << std::endl;
+	return cip::LABELMAPREADFAILURE;
+	}
+      
+      multiScaleFilter->SetMaskImage( labelMapReader->GetOutput() );
+    }
+  
   // Finish Filter set up before execution
   multiScaleFilter->SetSigmaMinimum( sigmaMinimum );
   multiScaleFilter->SetSigmaMaximum( sigmaMaximum );
@@ -373,6 +393,8 @@ int main( int argc, char *argv[] )
   multiScaleFilter->SetGenerateScalesOutput( generateScalesOutput );
   multiScaleFilter->SetSigmaStepMethod( sigmaStepMethod );
   multiScaleFilter->SetRescale( rescale );
+  multiScaleFilter->SetUseFusedComputation( fused );
+  multiScaleFilter->SetNumberOfSlicesPerSlab( slabSlices );
   multiScaleFilter->SetInput( ctImage );  
   try
     {
@@ -19,6 +19,9 @@
  *  -l <string>,  --labelMapFileName <string>
  *    (required)  Input label map file name
  * 
+ *  --threads <int>
+ *    Number of threads used. Default all (0)
+ * 
  *  --,  --ignore_rest
  *    Ignores the rest of the labeled arguments following this flag.
  * 
@@ -41,28 +44,10 @@
 #include "cipHelper.h"
 #include "itkImage.h"
 #include "itkImageFileReader.h"
-#include "itkImageRegionIterator.h"
+#include "cipLabelIntensityStatistics.h"
 #include <iostream>
 #include <fstream>
-#include <limits.h>
-
-namespace
-{
 
-   typedef itk::ImageRegionIterator< cip::LabelMapType > LabelMapIteratorType;
-   typedef itk::ImageRegionIterator< cip::CTType >       CTIteratorType;
-
-   struct STATS
-   {
-     double mean;
-     double median;
-     double std;
-     short  min;
-     short  max;
-     std::list< short > HUs;
-   };
-
-}
 int main( int argc, char *argv[] )
 {
   PARSE_ARGS;
@@ -104,128 +89,44 @@ int main( int argc, char *argv[] )
     }
 
   //
-  // Get a list of the labels present in the label map 
+  // Accumulate the statistics of every label present in the label
+  // map in a single pass
   //
-  std::cout << "Determing structures in label map..." << std::endl;
-  std::list< unsigned short > labelsList;
-
-  LabelMapIteratorType lIt( labelMapReader->GetOutput(), labelMapReader->GetOutput()->GetBufferedRegion() );
-
-  while ( !lIt.IsAtEnd() )
+  std::cout << "Computing statistics..." << std::endl;
+  cipLabelIntensityStatistics statistics;
+  if ( threads > 0 )
     {
-    if ( lIt.Get() != 0 )
-      {
-      labelsList.push_back( lIt.Get() );
-      }
-
-    ++lIt;
+    statistics.SetNumberOfThreads( threads );
     }
-  labelsList.unique();
-  labelsList.sort();
-  labelsList.unique();
-
-  //
-  // Now collect the CT values for each region-type pair for
-  // subsequent stats computation
-  //
-  std::map< unsigned short, STATS > labelToStatsMap;
-
-  CTIteratorType cIt( ctReader->GetOutput(), ctReader->GetOutput()->GetBufferedRegion() );
 
-  lIt.GoToBegin();
-  while ( !cIt.IsAtEnd() )
+  try
     {
-    if ( lIt.Get() != 0 )
-      {
-      labelToStatsMap[lIt.Get()].HUs.push_back( cIt.Get() );
-      }
-
-    ++lIt;
-    ++cIt;
+    statistics.AddImage( ctReader->GetOutput(), labelMapReader->GetOutput() );
     }
-
-  //
-  // Now compute the stats for each label
-  //
-  std::cout << "Computing statistics..." << std::endl;
-  
-  //
-  // Compute the stats for each label
-  // 
-  std::map< unsigned short, STATS >::iterator mapIt = labelToStatsMap.begin();
-
-  while ( mapIt != labelToStatsMap.end() )
+  catch ( cip::ExceptionObject &excp )
     {
-    //
-    // Need to sort in order to compute the median
-    //
-    mapIt->second.HUs.sort();
-
-    double meanAccum = 0.0;
-    mapIt->second.min = SHRT_MAX;
-    mapIt->second.max = SHRT_MIN;
-    
-    std::list< short >::iterator listIt = mapIt->second.HUs.begin();
-
-    unsigned int counter = 0;
-    while ( listIt != mapIt->second.HUs.end() )
-      {
-      if ( *listIt < mapIt->second.min )
-        {
-        mapIt->second.min = *listIt;
-        }
-      if ( *listIt > mapIt->second.max )
-        {
-        mapIt->second.max = *listIt;
-        }
-
-      meanAccum += *listIt;
-
-      if ( counter <= mapIt->second.HUs.size()/2 )
-        {
-        mapIt->second.median = *listIt;
-        }
-
-      counter++;
-      ++listIt;
-      }
-
-    mapIt->second.mean = meanAccum/static_cast< double >( mapIt->second.HUs.size() );
-
-    //
-    // Finally, compute the standard deviation
-    //
-    double stdAccum = 0.0;
-
-    listIt = mapIt->second.HUs.begin();
-    while ( listIt != mapIt->second.HUs.end() )
-      {
-      stdAccum += pow( *listIt - mapIt->second.mean, 2.0 );
-
-      ++listIt;
-      }
-    mapIt->second.std = sqrt( stdAccum/static_cast< double >( mapIt->second.HUs.size() ) );
+    std::cerr << "Exception caught computing statistics:";
+    std::cerr << excp << std::endl;
 
-    ++mapIt;
+    return cip::EXITFAILURE;
     }
 
+  const std::vector< unsigned short >& labels = statistics.GetLabels();
+
   //
   // Now print the results
   //
   cip::ChestConventions conventions;
 
-  mapIt = labelToStatsMap.begin();
-  while ( mapIt != labelToStatsMap.end() )
+  for ( unsigned int i=0; i<labels.size(); i++ )
     {
-    std::cout << conventions.GetChestRegionNameFromValue( mapIt->first ) << "\t";
-    std::cout << conventions.GetChestTypeNameFromValue( mapIt->first ) << ":" << std::endl;
-    std::cout << "Mean:\t"   << mapIt->second.mean   << std::endl;
-    std::cout << "STD:\t"    << mapIt->second.std    << std::endl;
-    std::cout << "Min:\t"    << mapIt->second.min    << std::endl;
-    std::cout << "Max:\t"    << mapIt->second.max    << std::endl;
-    std::cout << "Median:\t" << mapIt->second.median << std::endl;
-
-    ++mapIt;
+    std::cout << conventions.GetChestRegionNameFromValue( labels[i] ) << "\t";
+    std::cout << conventions.GetChestTypeNameFromValue( labels[i] ) << ":" << std::endl;
+    std::cout << "Mean:\t"   << statistics.GetMean( labels[i] )   << std::endl;
+    std::cout << "STD:\t"    << statistics.GetSTD( labels[i] )    << std::endl;
+    std::cout << "Min:\t"    << statistics.GetMin( labels[i] )    << std::endl;
+    std::cout << "Max:\t"    << statistics.GetMax( labels[i] )    << std::endl;
+    std::cout << "Median:\t" << statistics.GetMedian( labels[i] ) << std::endl;
     }
 
   // Print the results to file if the user has specified an output
@@ -243,18 +144,16 @@ int main( int argc, char *argv[] )
     //file << labelMapFileName << ",";
 
     // First write the header
-    mapIt = labelToStatsMap.begin();
-    while ( mapIt != labelToStatsMap.end() )
+    for ( unsigned int i=0; i<labels.size(); i++ )
       {
-	file << labelMapFileName << ",";
-      std::string regionName = conventions.GetChestRegionNameFromValue( mapIt->first );
-      std::string typeName   = conventions.GetChestTypeNameFromValue( mapIt->first );
-      file << regionName << "," << typeName << "," << mapIt->second.mean << ",";
-      file << mapIt->second.std <<",";
-      file << mapIt->second.min <<",";
-      file << mapIt->second.max <<",";
-      file << mapIt->second.median << std::endl;
-      ++mapIt;
+      file << labelMapFileName << ",";
+      std::string regionName = conventions.GetChestRegionNameFromValue( labels[i] );
+      std::string typeName   = conventions.GetChestTypeNameFromValue( labels[i] );
+      file << regionName << "," << typeName << "," << statistics.GetMean( labels[i] ) << ",";
+      file << statistics.GetSTD( labels[i] ) <<",";
+      file << statistics.GetMin( labels[i] ) <<",";
+      file << statistics.GetMax( labels[i] ) <<",";
+      file << statistics.GetMedian( labels[i] ) << std::endl;
       }
     
     file.close();
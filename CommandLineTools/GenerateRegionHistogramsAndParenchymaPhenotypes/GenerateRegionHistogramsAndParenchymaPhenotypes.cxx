@@ -54,16 +54,13 @@
 #include "itkImage.h"
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
-#include "itkImageRegionIterator.h"
 #include "cipChestConventions.h"
 #include "cipHelper.h"
+#include "cipRegionHistograms.h"
 #include "GenerateRegionHistogramsAndParenchymaPhenotypesCLP.h"
 
 namespace
 {
-typedef itk::ImageRegionIterator< cip::CTType >       CTIteratorType;
-typedef itk::ImageRegionIterator< cip::LabelMapType > LabelMapIteratorType;
-
 struct PARENCHYMAPHENOTYPES
 {
   int    countBelow950;
@@ -108,80 +105,37 @@ struct PARENCHYMAPHENOTYPES
         phenotypes->intensityMean = 0.0;
     }
     
-    unsigned int GetHistogramNumberOfCounts( std::map< short, unsigned int > histogram, short minBin, short maxBin )
-    {
-        unsigned int numCounts = 0;
-        
-        for ( short i = minBin; i<=maxBin; i++ )
-        {
-            numCounts += histogram[i];
-        }
-        
-        return numCounts;
-    }
-    
-    double GetHistogramSkewness( std::map< short, unsigned int > histogram, double mean, short minBin, short maxBin )
-    {
-        unsigned int numCounts = GetHistogramNumberOfCounts( histogram, minBin, maxBin );
-        
-        double numeratorSum   = 0.0;
-        double denominatorSum = 0.0;
-        
-        for ( short i=minBin; i<=maxBin; i++ )
-        {
-            for ( unsigned int j=0; j<histogram[i]; j++ )
-            {
-                numeratorSum   += pow( (static_cast< double >( i ) - mean), 3 );
-                denominatorSum += pow( (static_cast< double >( i ) - mean), 2 );
-            }
-        }
-        
-        double skewness = ((1.0/static_cast<double>(numCounts))*numeratorSum)/pow( (1.0/static_cast<double>(numCounts))*denominatorSum, 1.5 );
-        
-        return skewness;
-    }
-    
-    double GetHistogramKurtosis( std::map< short, unsigned int > histogram, double mean, short minBin, short maxBin )
+    enum HISTOGRAMINDEX
     {
-        unsigned int numCounts = GetHistogramNumberOfCounts( histogram, minBin, maxBin );
-        
-        double numeratorSum   = 0.0;
-        double denominatorSum = 0.0;
-        
-        for ( short i=minBin; i<=maxBin; i++ )
-        {
-            for ( unsigned int j=0; j<histogram[i]; j++ )
-            {
-                numeratorSum   += pow( (static_cast< double >(i) - mean), 4 );
-                denominatorSum += pow( (static_cast< double >(i) - mean), 2 );
-            }
-        }
-        
-        double kurtosis = ((1.0/static_cast<double>(numCounts))*numeratorSum)/pow( (1.0/static_cast<double>(numCounts))*denominatorSum, 2 );
-        
-        return kurtosis;
-    }
-
+        WHOLELUNGHISTOGRAM = 0,
+        LEFTLUNGHISTOGRAM,
+        RIGHTLUNGHISTOGRAM,
+        LULHISTOGRAM,
+        LLLHISTOGRAM,
+        RULHISTOGRAM,
+        RMLHISTOGRAM,
+        RLLHISTOGRAM,
+        LUTHISTOGRAM,
+        LMTHISTOGRAM,
+        LLTHISTOGRAM,
+        RUTHISTOGRAM,
+        RMTHISTOGRAM,
+        RLTHISTOGRAM,
+        UTHISTOGRAM,
+        MTHISTOGRAM,
+        LTHISTOGRAM,
+        NUMBEROFHISTOGRAMS
+    };
     
-    double GetHistogramSTD( std::map< short, unsigned int > histogram, double mean, short minBin, short maxBin )
+    void ComputeParenchymaPhenotypesSubset( PARENCHYMAPHENOTYPES* phenotypes, const cipRegionHistograms& histograms, unsigned int whichHistogram, double voxelVolume )
     {
-        unsigned int counts = 0;
-        double histSTD = 0.0;
-        
-        for ( short i=minBin; i<=maxBin; i++ )
-        {
-            counts += histogram[i];
-            
-            histSTD += static_cast< double >( histogram[i] )*std::pow( static_cast< double >(i) - mean, 2 );
-        }
+        const unsigned int* histogram = histograms.GetHistogram( whichHistogram );
+        short minBin = histograms.GetMinBin();
+        short maxBin = histograms.GetMaxBin();
         
-        histSTD = vcl_sqrt( histSTD/static_cast< double >( counts ) );
+        phenotypes->totalVoxels = histograms.GetNumberOfCounts( whichHistogram );
+        phenotypes->volume      = static_cast< double >( phenotypes->totalVoxels )*voxelVolume;
         
-        return histSTD;
-    }
-    
-    void ComputeParenchymaPhenotypesSubset( PARENCHYMAPHENOTYPES* phenotypes, std::map< short, unsigned int > histogram, double voxelVolume, short minBin, short maxBin)
-    {
         unsigned int tenthPercentileCounter     = 0;
         unsigned int fifteenthPercentileCounter = 0;
         unsigned int medianCounter              = 0;
@@ -189,28 +143,30 @@ struct PARENCHYMAPHENOTYPES
         
         for ( int i=minBin; i<=maxBin; i++ )
         {
-            phenotypes->intensityMean += static_cast< double >(i)*static_cast< double >( histogram[i] )/static_cast< double >( phenotypes->totalVoxels );
-            phenotypes->mass += static_cast< double >( histogram[i] )*(voxelVolume/1000.0)*(static_cast< double >(i)+1000.0)/1000.0;
+            unsigned int count = histogram[i - minBin];
+            
+            phenotypes->intensityMean += static_cast< double >(i)*static_cast< double >( count )/static_cast< double >( phenotypes->totalVoxels );
+            phenotypes->mass += static_cast< double >( count )*(voxelVolume/1000.0)*(static_cast< double >(i)+1000.0)/1000.0;
             
-            if ( histogram[i] > modeCounter )
+            if ( count > modeCounter )
             {
-                modeCounter = histogram[i];
+                modeCounter = count;
                 phenotypes->mode = i;
             }
             
-            tenthPercentileCounter += histogram[i];
+            tenthPercentileCounter += count;
             if ( static_cast< double >( tenthPercentileCounter )/static_cast< double >( phenotypes->totalVoxels ) <= 0.1 )
             {
                 phenotypes->tenthPercentileHU = i;
             }
             
-            fifteenthPercentileCounter += histogram[i];
+            fifteenthPercentileCounter += count;
             if ( static_cast< double >( fifteenthPercentileCounter )/static_cast< double >( phenotypes->totalVoxels ) <= 0.15 )
             {
                 phenotypes->fifteenthPercentileHU = i;
             }
             
-            medianCounter += histogram[i];
+            medianCounter += count;
             if ( static_cast< double >( medianCounter )/static_cast< double >( phenotypes->totalVoxels ) <= 0.5 )
             {
                 phenotypes->median = i;
@@ -218,333 +174,107 @@ struct PARENCHYMAPHENOTYPES
             
             if ( i<-950 )
             {
-                phenotypes->countBelow950 += histogram[i];
+                phenotypes->countBelow950 += count;
             }
             if ( i<-925 )
             {
-                phenotypes->countBelow925 += histogram[i];
+                phenotypes->countBelow925 += count;
             }
             if ( i<-910 )
             {
-                phenotypes->countBelow910 += histogram[i];
+                phenotypes->countBelow910 += count;
             }
             if ( i<-905 )
             {
-                phenotypes->countBelow905 += histogram[i];
+                phenotypes->countBelow905 += count;
             }
             if ( i<-900 )
             {
-                phenotypes->countBelow900 += histogram[i];
+                phenotypes->countBelow900 += count;
             }
             if ( i<-875 )
             {
-                phenotypes->countBelow875 += histogram[i];
+                phenotypes->countBelow875 += count;
             }
             if ( i<-856 )
             {
-                phenotypes->countBelow856 += histogram[i];
+                phenotypes->countBelow856 += count;
             }
             if ( i>0 )
             {
-                phenotypes->countAbove0 += histogram[i];
+                phenotypes->countAbove0 += count;
             }
             if ( i>-600 )
             {
-                phenotypes->countAbove600 += histogram[i];
+                phenotypes->countAbove600 += count;
             }
             if ( i>-250 )
             {
-                phenotypes->countAbove250 += histogram[i];
+                phenotypes->countAbove250 += count;
             }
         }
         
-        phenotypes->skewness      = GetHistogramSkewness( histogram, phenotypes->intensityMean, minBin, maxBin );
-        phenotypes->kurtosis      = GetHistogramKurtosis( histogram, phenotypes->intensityMean, minBin, maxBin );
-        phenotypes->intensitySTD  = GetHistogramSTD( histogram, phenotypes->intensityMean, minBin, maxBin );
+        phenotypes->skewness      = histograms.GetSkewness( whichHistogram, phenotypes->intensityMean );
+        phenotypes->kurtosis      = histograms.GetKurtosis( whichHistogram, phenotypes->intensityMean );
+        phenotypes->intensitySTD  = histograms.GetSTD( whichHistogram, phenotypes->intensityMean );
     }
     
-    
-       
-    
-
-    
-    
-    double GetHistogramMean( std::map< short, unsigned int > histogram, short minBin, short maxBin )
+    unsigned int GetHistogramBit( HISTOGRAMINDEX whichHistogram )
     {
-        unsigned int numCounts = GetHistogramNumberOfCounts( histogram, minBin, maxBin );
-        
-        double mean = 0.0;
-        
-        for ( short i = minBin; i<=maxBin; i++ )
-        {
-            mean += (static_cast<double>(histogram[i])/static_cast< double >(numCounts))*static_cast< double >(i);
-        }
-        
-        return mean;
+        return 1u << static_cast< unsigned int >( whichHistogram );
     }
     
-    
-
-
-    
-    
-    void UpdateAllHistogramsAndPhenotypes( cip::CTType::Pointer ctImage, cip::LabelMapType::Pointer labelMap,
-                                          PARENCHYMAPHENOTYPES* wholeLungPhenotypes, PARENCHYMAPHENOTYPES* leftLungPhenotypes, PARENCHYMAPHENOTYPES* rightLungPhenotypes, PARENCHYMAPHENOTYPES* lulLungPhenotypes,
-                                          PARENCHYMAPHENOTYPES* lllLungPhenotypes, PARENCHYMAPHENOTYPES* rulLungPhenotypes, PARENCHYMAPHENOTYPES* rmlLungPhenotypes, PARENCHYMAPHENOTYPES* rllLungPhenotypes,
-                                          PARENCHYMAPHENOTYPES* lutLungPhenotypes, PARENCHYMAPHENOTYPES* lmtLungPhenotypes, PARENCHYMAPHENOTYPES* lltLungPhenotypes, PARENCHYMAPHENOTYPES* rutLungPhenotypes,
-                                          PARENCHYMAPHENOTYPES* rmtLungPhenotypes, PARENCHYMAPHENOTYPES* rltLungPhenotypes, PARENCHYMAPHENOTYPES* utLungPhenotypes, PARENCHYMAPHENOTYPES* mtLungPhenotypes,
-                                          PARENCHYMAPHENOTYPES* ltLungPhenotypes,
-                                          std::map< short, unsigned int >* wholeLungHistogram, std::map< short, unsigned int >* leftLungHistogram, std::map< short, unsigned int >* rightLungHistogram,
-                                          std::map< short, unsigned int >* lulLungHistogram, std::map< short, unsigned int >* lllLungHistogram, std::map< short, unsigned int >* rulLungHistogram,
-                                          std::map< short, unsigned int >* rmlLungHistogram, std::map< short, unsigned int >* rllLungHistogram, std::map< short, unsigned int >* lutLungHistogram,
-                                          std::map< short, unsigned int >* lmtLungHistogram, std::map< short, unsigned int >* lltLungHistogram, std::map< short, unsigned int >* rutLungHistogram,
-                                          std::map< short, unsigned int >* rmtLungHistogram, std::map< short, unsigned int >* rltLungHistogram, std::map< short, unsigned int >* utLungHistogram,
-                                          std::map< short, unsigned int >* mtLungHistogram, std::map< short, unsigned int >* ltLungHistogram,
-                                          double voxelVolume, short minBin, short maxBin )
+    // Every defined chest region contributes to the whole lung histogram
+    // and to the histograms of the lung, lobe and third it belongs to
+    void SetAllRegionHistogramMasks( cipRegionHistograms* histograms )
     {
-        cip::ChestConventions conventions;
-        
-        unsigned char lungRegion;
+        histograms->ClearChestRegionHistogramMasks();
         
-        CTIteratorType cIt( ctImage, ctImage->GetBufferedRegion() );
-        LabelMapIteratorType lIt( labelMap, labelMap->GetBufferedRegion() );
-        
-        cIt.GoToBegin();
-        lIt.GoToBegin();
-        while ( !cIt.IsAtEnd() )
+        for ( unsigned int r=0; r<256; r++ )
         {
-            if (cIt.Get() < minBin || cIt.Get() > maxBin)
-            {
-                ++cIt;
-                ++lIt;
-                continue;
-            }
-            
-            if ( lIt.Get() != 0 )
+            if ( r != static_cast< unsigned int >( cip::UNDEFINEDREGION ) )
             {
-                lungRegion = conventions.GetChestRegionFromValue( lIt.Get() );
-                
-                if ( lungRegion != static_cast< unsigned char >( cip::UNDEFINEDREGION ) )
-                {
-                    (*wholeLungHistogram)[cIt.Get()]++;
-                    wholeLungPhenotypes->totalVoxels++;
-                    wholeLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::LEFTLUNG ) ||
-                    lungRegion == static_cast< unsigned char >( cip::LEFTSUPERIORLOBE ) ||
-                    lungRegion == static_cast< unsigned char >( cip::LEFTINFERIORLOBE ) ||
-                    lungRegion == static_cast< unsigned char >( cip::LEFTLOWERTHIRD ) ||
-                    lungRegion == static_cast< unsigned char >( cip::LEFTMIDDLETHIRD ) ||
-                    lungRegion == static_cast< unsigned char >( cip::LEFTUPPERTHIRD ) )
-                {
-                    (*leftLungHistogram)[cIt.Get()]++;
-                    leftLungPhenotypes->totalVoxels++;
-                    leftLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTLUNG ) ||
-                    lungRegion == static_cast< unsigned char >( cip::RIGHTSUPERIORLOBE ) ||
-                    lungRegion == static_cast< unsigned char >( cip::RIGHTMIDDLELOBE ) ||
-                    lungRegion == static_cast< unsigned char >( cip::RIGHTINFERIORLOBE ) ||
-                    lungRegion == static_cast< unsigned char >( cip::RIGHTLOWERTHIRD ) ||
-                    lungRegion == static_cast< unsigned char >( cip::RIGHTMIDDLETHIRD ) ||
-                    lungRegion == static_cast< unsigned char >( cip::RIGHTUPPERTHIRD ) )
-                {
-                    (*rightLungHistogram)[cIt.Get()]++;
-                    rightLungPhenotypes->totalVoxels++;
-                    rightLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::LEFTSUPERIORLOBE ) )
-                {
-                    (*lulLungHistogram)[cIt.Get()]++;
-                    lulLungPhenotypes->totalVoxels++;
-                    lulLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::LEFTINFERIORLOBE ) )
-                {
-                    (*lllLungHistogram)[cIt.Get()]++;
-                    lllLungPhenotypes->totalVoxels++;
-                    lllLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTSUPERIORLOBE ) )
-                {
-                    (*rulLungHistogram)[cIt.Get()]++;
-                    rulLungPhenotypes->totalVoxels++;
-                    rulLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTMIDDLELOBE ) )
-                {
-                    (*rmlLungHistogram)[cIt.Get()]++;
-                    rmlLungPhenotypes->totalVoxels++;
-                    rmlLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTINFERIORLOBE ) )
-                {
-                    (*rllLungHistogram)[cIt.Get()]++;
-                    rllLungPhenotypes->totalVoxels++;
-                    rllLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTUPPERTHIRD ) ||
-                    lungRegion == static_cast< unsigned char >( cip::LEFTUPPERTHIRD ) ||
-                    lungRegion == static_cast< unsigned char >( cip::UPPERTHIRD ) )
-                {
-                    (*utLungHistogram)[cIt.Get()]++;
-                    utLungPhenotypes->totalVoxels++;
-                    utLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTMIDDLETHIRD ) ||
-                    lungRegion == static_cast< unsigned char >( cip::LEFTMIDDLETHIRD ) ||
-                    lungRegion == static_cast< unsigned char >( cip::MIDDLETHIRD ) )
-                {
-                    (*mtLungHistogram)[cIt.Get()]++;
-                    mtLungPhenotypes->totalVoxels++;
-                    mtLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTLOWERTHIRD ) ||
-                    lungRegion == static_cast< unsigned char >( cip::LEFTLOWERTHIRD ) ||
-                    lungRegion == static_cast< unsigned char >( cip::LOWERTHIRD ))
-                {
-                    (*ltLungHistogram)[cIt.Get()]++;
-                    ltLungPhenotypes->totalVoxels++;
-                    ltLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::LEFTUPPERTHIRD ) )
-                {
-                    (*lutLungHistogram)[cIt.Get()]++;
-                    lutLungPhenotypes->totalVoxels++;
-                    lutLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::LEFTMIDDLETHIRD ) )
-                {
-                    (*lmtLungHistogram)[cIt.Get()]++;
-                    lmtLungPhenotypes->totalVoxels++;
-                    lmtLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::LEFTLOWERTHIRD ) )
-                {
-                    (*lltLungHistogram)[cIt.Get()]++;
-                    lltLungPhenotypes->totalVoxels++;
-                    lltLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTUPPERTHIRD ) )
-                {
-                    (*rutLungHistogram)[cIt.Get()]++;
-                    rutLungPhenotypes->totalVoxels++;
-                    rutLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTMIDDLETHIRD ) )
-                {
-                    (*rmtLungHistogram)[cIt.Get()]++;
-                    rmtLungPhenotypes->totalVoxels++;
-                    rmtLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTLOWERTHIRD ) )
-                {
-                    (*rltLungHistogram)[cIt.Get()]++;
-                    rltLungPhenotypes->totalVoxels++;
-                    rltLungPhenotypes->volume += voxelVolume;
-                }
+                histograms->SetChestRegionHistogramMask( static_cast< unsigned char >( r ), GetHistogramBit( WHOLELUNGHISTOGRAM ) );
             }
-            
-            ++cIt;
-            ++lIt;
         }
+        
+        unsigned int whole = GetHistogramBit( WHOLELUNGHISTOGRAM );
+        unsigned int left  = whole | GetHistogramBit( LEFTLUNGHISTOGRAM );
+        unsigned int right = whole | GetHistogramBit( RIGHTLUNGHISTOGRAM );
+        
+        histograms->SetChestRegionHistogramMask( cip::LEFTLUNG,          left );
+        histograms->SetChestRegionHistogramMask( cip::RIGHTLUNG,         right );
+        histograms->SetChestRegionHistogramMask( cip::LEFTSUPERIORLOBE,  left | GetHistogramBit( LULHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::LEFTINFERIORLOBE,  left | GetHistogramBit( LLLHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::RIGHTSUPERIORLOBE, right | GetHistogramBit( RULHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::RIGHTMIDDLELOBE,   right | GetHistogramBit( RMLHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::RIGHTINFERIORLOBE, right | GetHistogramBit( RLLHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::LEFTUPPERTHIRD,    left | GetHistogramBit( UTHISTOGRAM ) | GetHistogramBit( LUTHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::LEFTMIDDLETHIRD,   left | GetHistogramBit( MTHISTOGRAM ) | GetHistogramBit( LMTHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::LEFTLOWERTHIRD,    left | GetHistogramBit( LTHISTOGRAM ) | GetHistogramBit( LLTHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::RIGHTUPPERTHIRD,   right | GetHistogramBit( UTHISTOGRAM ) | GetHistogramBit( RUTHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::RIGHTMIDDLETHIRD,  right | GetHistogramBit( MTHISTOGRAM ) | GetHistogramBit( RMTHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::RIGHTLOWERTHIRD,   right | GetHistogramBit( LTHISTOGRAM ) | GetHistogramBit( RLTHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::UPPERTHIRD,        whole | GetHistogramBit( UTHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::MIDDLETHIRD,       whole | GetHistogramBit( MTHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::LOWERTHIRD,        whole | GetHistogramBit( LTHISTOGRAM ) );
     }
-	
-	
-    void UpdateLobeHistogramsAndPhenotypes( cip::CTType::Pointer ctImage, cip::LabelMapType::Pointer labelMap,
-                                           PARENCHYMAPHENOTYPES* lulLungPhenotypes, PARENCHYMAPHENOTYPES* lllLungPhenotypes, PARENCHYMAPHENOTYPES* rulLungPhenotypes, PARENCHYMAPHENOTYPES* rmlLungPhenotypes, PARENCHYMAPHENOTYPES* rllLungPhenotypes,
-                                           std::map< short, unsigned int >* lulLungHistogram, std::map< short, unsigned int >* lllLungHistogram, std::map< short, unsigned int >* rulLungHistogram,
-                                           std::map< short, unsigned int >* rmlLungHistogram, std::map< short, unsigned int >* rllLungHistogram, double voxelVolume, short minBin, short maxBin )
+    
+    // Only the lobe histograms are updated. Used when the whole lung,
+    // lung and third histograms come from the partial lung label map
+    void SetLobeRegionHistogramMasks( cipRegionHistograms* histograms )
     {
-        cip::ChestConventions conventions;
-        
-        unsigned char lungRegion;
+        histograms->ClearChestRegionHistogramMasks();
         
-        CTIteratorType cIt( ctImage, ctImage->GetBufferedRegion() );
-        LabelMapIteratorType lIt( labelMap, labelMap->GetBufferedRegion() );
-		
-        cIt.GoToBegin();
-        lIt.GoToBegin();
-        while ( !cIt.IsAtEnd() )
-        {
-            
-            if (cIt.Get() < minBin || cIt.Get() > maxBin)
-            {
-                ++cIt;
-                ++lIt;
-                continue;
-            }
-            
-            if ( lIt.Get() != 0 )
-            {
-                lungRegion = conventions.GetChestRegionFromValue( lIt.Get() );
-                
-                if ( lungRegion == static_cast< unsigned char >( cip::LEFTSUPERIORLOBE ) )
-                {
-                    (*lulLungHistogram)[cIt.Get()]++;
-                    lulLungPhenotypes->totalVoxels++;
-                    lulLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::LEFTINFERIORLOBE ) )
-                {
-                    (*lllLungHistogram)[cIt.Get()]++;
-                    lllLungPhenotypes->totalVoxels++;
-                    lllLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTSUPERIORLOBE ) )
-                {
-                    (*rulLungHistogram)[cIt.Get()]++;
-                    rulLungPhenotypes->totalVoxels++;
-                    rulLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTMIDDLELOBE ) )
-                {
-                    (*rmlLungHistogram)[cIt.Get()]++;
-                    rmlLungPhenotypes->totalVoxels++;
-                    rmlLungPhenotypes->volume += voxelVolume;
-                }
-                if ( lungRegion == static_cast< unsigned char >( cip::RIGHTINFERIORLOBE ) )
-                {
-                    (*rllLungHistogram)[cIt.Get()]++;
-                    rllLungPhenotypes->totalVoxels++;
-                    rllLungPhenotypes->volume += voxelVolume;
-                }
-            }
-            
-            ++cIt;
-            ++lIt;
-        }
+        histograms->SetChestRegionHistogramMask( cip::LEFTSUPERIORLOBE,  GetHistogramBit( LULHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::LEFTINFERIORLOBE,  GetHistogramBit( LLLHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::RIGHTSUPERIORLOBE, GetHistogramBit( RULHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::RIGHTMIDDLELOBE,   GetHistogramBit( RMLHISTOGRAM ) );
+        histograms->SetChestRegionHistogramMask( cip::RIGHTINFERIORLOBE, GetHistogramBit( RLLHISTOGRAM ) );
     }
     
 } //end namespace
 
-    /*
-
-void InitializeParenchymaPhenotypes( PARENCHYMAPHENOTYPES* );
-void ComputeParenchymaPhenotypesSubset( PARENCHYMAPHENOTYPES*, std::map< short, unsigned int >, double, short, short);
-double GetHistogramKurtosis( std::map< short, unsigned int >, double, short, short );
-double GetHistogramSkewness( std::map< short, unsigned int >, double, short, short );
-unsigned int GetHistogramNumberOfCounts( std::map< short, unsigned int >, short, short );
-double GetHistogramSTD( std::map< short, unsigned int >, double, short, short );
-void UpdateAllHistogramsAndPhenotypes( cip::CTType::Pointer ctImage, cip::LabelMapType::Pointer labelMap,
-                                    PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*,
-                                    PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*,
-                                    PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*,
-                                    PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*, PARENCHYMAPHENOTYPES*,
-                                    PARENCHYMAPHENOTYPES*,
-                                    std::map< short, unsigned int >*, std::map< short, unsigned int >*, std::map< short, unsigned int >*,
-                                    std::map< short, unsigned int >*, std::map< short, unsigned int >*, std::map< short, unsigned int >*,
-                                    std::map< short, unsigned int >*, std::map< short, unsigned int >*, std::map< short, unsigned int >*,
-                                    std::map< short, unsigned int >*, std::map< short, unsigned int >*, std::map< short, unsigned int >*,
-                                    std::map< short, unsigned int >*, std::map< short, unsigned int >*, std::map< short, unsigned int >*,
-                                    std::map< short, unsigned int >*, std::map< short, unsigned int >*, double, short minBin, short maxBin );
-void UpdateLobeHistogramsAndPhenotypes( cip::CTType::Pointer ctImage, cip::LabelMapType::Pointer labelMap,
-                                        PARENCHYMAPHENOTYPES* , PARENCHYMAPHENOTYPES* , PARENCHYMAPHENOTYPES* , PARENCHYMAPHENOTYPES* , PARENCHYMAPHENOTYPES* ,
-                                        std::map< short, unsigned int >* , std::map< short, unsigned int >* , std::map< short, unsigned int >* ,
-                                        std::map< short, unsigned int >* , std::map< short, unsigned int >* , double, short minBin, short maxBin);
-
-*/
-
 int main( int argc, char *argv[] )
 {
     
@@ -618,7 +348,7 @@ int main( int argc, char *argv[] )
     }
 
   //
-  // Define the phenotype and histogram containers
+  // Define the phenotype containers
   //
   PARENCHYMAPHENOTYPES wholeLungPhenotypes;   InitializeParenchymaPhenotypes( &wholeLungPhenotypes );
   PARENCHYMAPHENOTYPES leftLungPhenotypes;    InitializeParenchymaPhenotypes( &leftLungPhenotypes );
@@ -638,67 +368,21 @@ int main( int argc, char *argv[] )
   PARENCHYMAPHENOTYPES mtLungPhenotypes;      InitializeParenchymaPhenotypes( &mtLungPhenotypes );
   PARENCHYMAPHENOTYPES ltLungPhenotypes;      InitializeParenchymaPhenotypes( &ltLungPhenotypes );
 
-  std::map< short, unsigned int > wholeLungHistogram;
-  std::map< short, unsigned int > leftLungHistogram;
-  std::map< short, unsigned int > rightLungHistogram;
-  std::map< short, unsigned int > lulLungHistogram;
-  std::map< short, unsigned int > lllLungHistogram;
-  std::map< short, unsigned int > rulLungHistogram;
-  std::map< short, unsigned int > rmlLungHistogram;
-  std::map< short, unsigned int > rllLungHistogram;
-  std::map< short, unsigned int > lutLungHistogram;
-  std::map< short, unsigned int > lmtLungHistogram;
-  std::map< short, unsigned int > lltLungHistogram;
-  std::map< short, unsigned int > rutLungHistogram;
-  std::map< short, unsigned int > rmtLungHistogram;
-  std::map< short, unsigned int > rltLungHistogram;
-  std::map< short, unsigned int > utLungHistogram;
-  std::map< short, unsigned int > mtLungHistogram;
-  std::map< short, unsigned int > ltLungHistogram;
-
   //
-  // Initialize the histograms
+  // Compute the histograms. Each labeled voxel updates the histograms
+  // of all the regions it belongs to in a single pass.
   //
-  for ( int i = minBin; i<=maxBin; i++ )
+  cipRegionHistograms histograms( minBin, maxBin, NUMBEROFHISTOGRAMS );
+  if ( threads > 0 )
     {
-    wholeLungHistogram[i] = 0;
-    leftLungHistogram[i]  = 0;
-    rightLungHistogram[i] = 0;
-    lulLungHistogram[i]   = 0;
-    lllLungHistogram[i]   = 0;
-    rulLungHistogram[i]   = 0;
-    rmlLungHistogram[i]   = 0;
-    rllLungHistogram[i]   = 0;
-    lutLungHistogram[i]   = 0;
-    lmtLungHistogram[i]   = 0;
-    lltLungHistogram[i]   = 0;
-    rutLungHistogram[i]   = 0;
-    rmtLungHistogram[i]   = 0;
-    rltLungHistogram[i]   = 0;
-    utLungHistogram[i]    = 0;
-    mtLungHistogram[i]    = 0;
-    ltLungHistogram[i]    = 0;
+    histograms.SetNumberOfThreads( threads );
     }
 
-  //
-  // Compute the histograms
-  //
   if ( strcmp( partialLungLabelMapFileName.c_str(), "NA") != 0 )
     {
     std::cout << "Computing histograms with partial lung label map..." << std::endl;
-    UpdateAllHistogramsAndPhenotypes( ctReader->GetOutput(), partialLungLabelMapReader->GetOutput(),
-                                   &wholeLungPhenotypes, &leftLungPhenotypes, &rightLungPhenotypes, &lulLungPhenotypes,
-                                   &lllLungPhenotypes, &rulLungPhenotypes, &rmlLungPhenotypes, &rllLungPhenotypes,
-                                   &lutLungPhenotypes, &lmtLungPhenotypes, &lltLungPhenotypes, &rutLungPhenotypes,
-                                   &rmtLungPhenotypes, &rltLungPhenotypes, &utLungPhenotypes, &mtLungPhenotypes,
-                                   &ltLungPhenotypes,
-                                   &wholeLungHistogram, &leftLungHistogram, &rightLungHistogram,
-                                   &lulLungHistogram, &lllLungHistogram, &rulLungHistogram,
-                                   &rmlLungHistogram, &rllLungHistogram, &lutLungHistogram,
-                                   &lmtLungHistogram, &lltLungHistogram, &rutLungHistogram,
-                                   &rmtLungHistogram, &rltLungHistogram, &utLungHistogram,
-                                   &mtLungHistogram, &ltLungHistogram,
-                                   voxelVolume, minBin, maxBin);
+    SetAllRegionHistogramMasks( &histograms );
+    histograms.AddImage( ctReader->GetOutput(), partialLungLabelMapReader->GetOutput() );
     }
 
   if ( strcmp( lungLobeLabelMapFileName.c_str(), "NA") != 0 )
@@ -707,29 +391,14 @@ int main( int argc, char *argv[] )
     //If partial lung lablemap mask is not provided, we have to compute all the regional metrics.
     if ( strcmp( partialLungLabelMapFileName.c_str(), "NA") == 0 )
       {
-      UpdateAllHistogramsAndPhenotypes( ctReader->GetOutput(), lungLobeLabelMapReader->GetOutput(),
-                                        &wholeLungPhenotypes, &leftLungPhenotypes, &rightLungPhenotypes, &lulLungPhenotypes,
-                                        &lllLungPhenotypes, &rulLungPhenotypes, &rmlLungPhenotypes, &rllLungPhenotypes,
-                                        &lutLungPhenotypes, &lmtLungPhenotypes, &lltLungPhenotypes, &rutLungPhenotypes,
-                                        &rmtLungPhenotypes, &rltLungPhenotypes, &utLungPhenotypes, &mtLungPhenotypes,
-                                        &ltLungPhenotypes,
-                                        &wholeLungHistogram, &leftLungHistogram, &rightLungHistogram,
-                                        &lulLungHistogram, &lllLungHistogram, &rulLungHistogram,
-                                        &rmlLungHistogram, &rllLungHistogram, &lutLungHistogram,
-                                        &lmtLungHistogram, &lltLungHistogram, &rutLungHistogram,
-                                        &rmtLungHistogram, &rltLungHistogram, &utLungHistogram,
-                                        &mtLungHistogram, &ltLungHistogram,
-                                        voxelVolume, minBin, maxBin);
+      SetAllRegionHistogramMasks( &histograms );
       } 
     else 
       {
       // Just compute lobe-based specific metrics. The general metrics were computed above
-      UpdateLobeHistogramsAndPhenotypes( ctReader->GetOutput(), lungLobeLabelMapReader->GetOutput(),
-                                         &lulLungPhenotypes,&lllLungPhenotypes, &rulLungPhenotypes,
-                                         &rmlLungPhenotypes, &rllLungPhenotypes,
-                                         &lulLungHistogram, &lllLungHistogram, &rulLungHistogram,
-                                         &rmlLungHistogram, &rllLungHistogram,voxelVolume, minBin, maxBin);
+      SetLobeRegionHistogramMasks( &histograms );
       }
+    histograms.AddImage( ctReader->GetOutput(), lungLobeLabelMapReader->GetOutput() );
     }
   
   //
@@ -746,24 +415,12 @@ int main( int argc, char *argv[] )
 
     for ( int i=minBin; i<=maxBin; i++ )
       {
-      histogramFile << i << ",";
-      histogramFile << wholeLungHistogram[i] << ",";
-      histogramFile << leftLungHistogram[i]  << ",";
-      histogramFile << rightLungHistogram[i] << ",";
-      histogramFile << lulLungHistogram[i]   << ",";
-      histogramFile << lllLungHistogram[i]   << ",";
-      histogramFile << rulLungHistogram[i]   << ",";
-      histogramFile << rmlLungHistogram[i]   << ",";
-      histogramFile << rllLungHistogram[i]   << ",";
-      histogramFile << lutLungHistogram[i]   << ",";
-      histogramFile << lmtLungHistogram[i]   << ",";
-      histogramFile << lltLungHistogram[i]   << ",";
-      histogramFile << rutLungHistogram[i]   << ",";
-      histogramFile << rmtLungHistogram[i]   << ",";
-      histogramFile << rltLungHistogram[i]   << ",";
-      histogramFile << utLungHistogram[i]    << ",";
-      histogramFile << mtLungHistogram[i]    << ",";
-      histogramFile << ltLungHistogram[i]    << std::endl;
+      histogramFile << i;
+      for ( unsigned int h=0; h<NUMBEROFHISTOGRAMS; h++ )
+        {
+        histogramFile << "," << histograms.GetCount( h, static_cast< short >( i ) );
+        }
+      histogramFile << std::endl;
       }
     histogramFile.close();
     }
@@ -774,24 +431,23 @@ int main( int argc, char *argv[] )
   if ( strcmp(phenotypesFileName.c_str(), "NA") != 0 )
   {
     std::cout << "Computing parenchyma phenotypes..." << std::endl;
-    ComputeParenchymaPhenotypesSubset( &wholeLungPhenotypes, wholeLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &leftLungPhenotypes,  leftLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &rightLungPhenotypes, rightLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &lulLungPhenotypes,   lulLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &lllLungPhenotypes,   lllLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &rulLungPhenotypes,   rulLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &rmlLungPhenotypes,   rmlLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &rllLungPhenotypes,   rllLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &lutLungPhenotypes,   lutLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &lmtLungPhenotypes,   lmtLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &lltLungPhenotypes,   lltLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &rutLungPhenotypes,   rutLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &rmtLungPhenotypes,   rmtLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &rltLungPhenotypes,   rltLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &utLungPhenotypes,    utLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &mtLungPhenotypes,    mtLungHistogram, voxelVolume, minBin, maxBin );
-    ComputeParenchymaPhenotypesSubset( &ltLungPhenotypes,    ltLungHistogram, voxelVolume, minBin, maxBin );
-
+    ComputeParenchymaPhenotypesSubset( &wholeLungPhenotypes, histograms, WHOLELUNGHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &leftLungPhenotypes,  histograms, LEFTLUNGHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &rightLungPhenotypes, histograms, RIGHTLUNGHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &lulLungPhenotypes,   histograms, LULHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &lllLungPhenotypes,   histograms, LLLHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &rulLungPhenotypes,   histograms, RULHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &rmlLungPhenotypes,   histograms, RMLHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &rllLungPhenotypes,   histograms, RLLHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &lutLungPhenotypes,   histograms, LUTHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &lmtLungPhenotypes,   histograms, LMTHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &lltLungPhenotypes,   histograms, LLTHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &rutLungPhenotypes,   histograms, RUTHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &rmtLungPhenotypes,   histograms, RMTHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &rltLungPhenotypes,   histograms, RLTHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &utLungPhenotypes,    histograms, UTHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &mtLungPhenotypes,    histograms, MTHISTOGRAM, voxelVolume );
+    ComputeParenchymaPhenotypesSubset( &ltLungPhenotypes,    histograms, LTHISTOGRAM, voxelVolume );
     //
     // Write phenotypes to file
     //
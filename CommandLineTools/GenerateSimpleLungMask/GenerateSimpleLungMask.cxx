@@ -123,6 +123,10 @@ int main( int argc, char * argv[] ){
     lungMask->SetInputData( vol );
     lungMask->SetTracheaLabel(1);
     lungMask->SetRasToVtk(rasTovtk);
+    if ( threads > 0 )
+      {
+      lungMask->SetNumberOfThreads( threads );
+      }
     lungMask->Update();
 
   // upsample
@@ -53,8 +53,6 @@
 #include "vtkPolyDataReader.h"
 #include "vtkPolyDataWriter.h"
 #include "vtkGraphToPolyData.h"
-#include "vtkExtractSelectedGraph.h"
-#include "vtkBoostKruskalMinimumSpanningTree.h"
 #include "vtkMutableUndirectedGraph.h"
 #include "vtkDataSetAttributes.h"
 #include "vtkDoubleArray.h"
@@ -63,7 +61,6 @@
 #include "ReadParticlesWriteConnectedParticlesCLP.h"
 
 vtkSmartPointer<vtkMutableUndirectedGraph> GetMinimumSpanningTree(vtkSmartPointer<vtkPolyData>, double, std::string);
-bool GetEdgeWeight(unsigned int, unsigned int, vtkSmartPointer<vtkPolyData>, double*, double, std::string);
 
 int main( int argc, char *argv[] )
 {
@@ -129,60 +126,6 @@ int main( int argc, char *argv[] )
 vtkSmartPointer<vtkMutableUndirectedGraph> GetMinimumSpanningTree(vtkSmartPointer<vtkPolyData> particles, double distanceThreshold, 
                                                                   std::string particlesType)
 { 
-  // Now create the weighted graph that will be passed to the minimum 
-  // spanning tree filter
-  std::map<unsigned int, unsigned int> particleIDToNodeIDMap;
-  std::map<unsigned int, unsigned int> nodeIDToParticleIDMap;
-
-  vtkSmartPointer<vtkMutableUndirectedGraph> weightedGraph =  
-    vtkSmartPointer<vtkMutableUndirectedGraph>::New();
-
-  for (unsigned int i=0; i<particles->GetNumberOfPoints(); i++)
-    {
-    vtkIdType nodeID = weightedGraph->AddVertex();
-
-    particleIDToNodeIDMap[i]      = nodeID;
-    nodeIDToParticleIDMap[nodeID] = i;
-    }
-
-  vtkSmartPointer<vtkDoubleArray> edgeWeights = vtkSmartPointer<vtkDoubleArray>::New();
-    edgeWeights->SetNumberOfComponents(1);
-    edgeWeights->SetName("Weights");
-
-  for (unsigned int i=0; i<particles->GetNumberOfPoints(); i++)
-    {
-    for (unsigned int j=i+1; j<particles->GetNumberOfPoints(); j++)
-      {
-      double weight;
-	  
-      if (GetEdgeWeight(i, j, particles, &weight, distanceThreshold, particlesType))
-        {
-        weightedGraph->AddEdge(particleIDToNodeIDMap[i], particleIDToNodeIDMap[j]);
-        edgeWeights->InsertNextValue(weight);
-        }
-      }
-    }
-
-  weightedGraph->GetEdgeData()->AddArray(edgeWeights);
-  weightedGraph->SetPoints(particles->GetPoints());
-
-  vtkSmartPointer<vtkBoostKruskalMinimumSpanningTree> minimumSpanningTreeFilter = 
-    vtkSmartPointer<vtkBoostKruskalMinimumSpanningTree>::New();
-    minimumSpanningTreeFilter->SetInputData(weightedGraph);
-    minimumSpanningTreeFilter->SetEdgeWeightArrayName("Weights");
-    minimumSpanningTreeFilter->Update();
-
-  vtkSmartPointer<vtkExtractSelectedGraph> extractSelection = vtkSmartPointer<vtkExtractSelectedGraph>::New();
-    extractSelection->SetInputData(0, weightedGraph);
-    extractSelection->SetInputData(1, minimumSpanningTreeFilter->GetOutput()) ;
-    extractSelection->Update();
-
-  return vtkMutableUndirectedGraph::SafeDownCast(extractSelection->GetOutput());
-}
-
-bool GetEdgeWeight(unsigned int particleID1, unsigned int particleID2, vtkSmartPointer<vtkPolyData> particles, double* weight, 
-                   double distanceThreshold, std::string particlesType)
-{
   std::string vecName;
   if (particlesType.compare("vessel") == 0)
     {
@@ -196,52 +139,41 @@ bool GetEdgeWeight(unsigned int particleID1, unsigned int particleID2, vtkSmartP
   // Used in the function for determing what weight to assign to each edge
   double edgeWeightAngleSigma = 1.0;
 
-  // Determine the vector connecting the two particles
-  double point1[3];
-    point1[0] = particles->GetPoint(particleID1)[0];
-    point1[1] = particles->GetPoint(particleID1)[1];
-    point1[2] = particles->GetPoint(particleID1)[2];
+  // Get the edges of the weighted graph. Only particles within the
+  // distance threshold of each other are connected.
+  std::vector<unsigned int> edgeParticles;
+  std::vector<double>       edgeWeights;
+  cip::GetParticleGraphEdges(particles, vecName, distanceThreshold, edgeWeightAngleSigma, &edgeParticles, &edgeWeights);
 
-  double point2[3];
-    point2[0] = particles->GetPoint(particleID2)[0];
-    point2[1] = particles->GetPoint(particleID2)[1];
-    point2[2] = particles->GetPoint(particleID2)[2];
+  std::vector<unsigned int> treeEdges;
+  cip::GetMinimumSpanningForestEdges(particles->GetNumberOfPoints(), edgeParticles, edgeWeights, &treeEdges);
 
-  cip::VectorType connectingVec(3);
-    connectingVec[0] = point1[0] - point2[0];
-    connectingVec[1] = point1[1] - point2[1];
-    connectingVec[2] = point1[2] - point2[2];
-
-  double connectorMagnitude = cip::GetVectorMagnitude(connectingVec);
+  // Now create the graph holding the particles and the minimum spanning
+  // tree edges (with their weights). Node IDs are particle IDs.
+  vtkSmartPointer<vtkMutableUndirectedGraph> minimumSpanningTree =  
+    vtkSmartPointer<vtkMutableUndirectedGraph>::New();
 
-  if (connectorMagnitude > distanceThreshold)
+  for (unsigned int i=0; i<particles->GetNumberOfPoints(); i++)
     {
-    return false;
+    minimumSpanningTree->AddVertex();
     }
 
-  cip::VectorType particle1Hevec2(3);
-    particle1Hevec2[0] = particles->GetPointData()->GetArray(vecName.c_str())->GetTuple(particleID1)[0];
-    particle1Hevec2[1] = particles->GetPointData()->GetArray(vecName.c_str())->GetTuple(particleID1)[1];
-    particle1Hevec2[2] = particles->GetPointData()->GetArray(vecName.c_str())->GetTuple(particleID1)[2];
+  vtkSmartPointer<vtkDoubleArray> treeEdgeWeights = vtkSmartPointer<vtkDoubleArray>::New();
+    treeEdgeWeights->SetNumberOfComponents(1);
+    treeEdgeWeights->SetName("Weights");
 
-  cip::VectorType particle2Hevec2(3);
-    particle2Hevec2[0] = particles->GetPointData()->GetArray(vecName.c_str())->GetTuple(particleID2)[0];
-    particle2Hevec2[1] = particles->GetPointData()->GetArray(vecName.c_str())->GetTuple(particleID2)[1];
-    particle2Hevec2[2] = particles->GetPointData()->GetArray(vecName.c_str())->GetTuple(particleID2)[2];
-
-  double angle1 = cip::GetAngleBetweenVectors(particle1Hevec2, connectingVec, true);
-  double angle2 = cip::GetAngleBetweenVectors(particle2Hevec2, connectingVec, true);
-
-  if (angle1 < angle2)
+  for (unsigned int k=0; k<treeEdges.size(); k++)
     {
-    *weight = connectorMagnitude*(1.0 + exp(-pow((90.0 - angle1)/edgeWeightAngleSigma, 2)));
-    }
-  else
-    {
-    *weight = connectorMagnitude*(1.0 + exp(-pow((90.0 - angle2)/edgeWeightAngleSigma, 2)));
+    unsigned int e = treeEdges[k];
+
+    minimumSpanningTree->AddEdge(edgeParticles[2*e], edgeParticles[2*e + 1]);
+    treeEdgeWeights->InsertNextValue(edgeWeights[e]);
     }
 
-  return true;
+  minimumSpanningTree->GetEdgeData()->AddArray(treeEdgeWeights);
+  minimumSpanningTree->SetPoints(particles->GetPoints());
+
+  return minimumSpanningTree;
 }
 
 #endif
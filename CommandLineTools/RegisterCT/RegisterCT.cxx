@@ -44,6 +44,10 @@
 #include "itkRigid2DTransform.h"
 #include "itkMatrixOffsetTransformBase.h"
 #include "itkMeanSquaresImageToImageMetric.h"
+#include "itkMeanSquaresImageToImageMetricv4.h"
+#include "itkRegularStepGradientDescentOptimizerv4.h"
+#include "itkCommand.h"
+#include "itkTimeProbe.h"
 #include "itkBinaryThresholdImageFilter.h"
 #include "RegisterCTCLP.h"
 #include "cipChestConventions.h"
@@ -72,6 +76,17 @@ namespace
     std::string image_type;
     int transformationIndex;
   };
+
+  // Settings of the multi-resolution registration mode, shared by the
+  // rigid and affine stages
+  struct MULTIRESOLUTION_PARAMETERS
+  {
+    std::vector< unsigned int > shrinkFactors;
+    std::vector< double >       smoothingSigmas;
+    std::string                 samplingStrategy;
+    double                      samplingPercentage;
+    unsigned int                numberOfThreads;
+  };
   
   template <unsigned int TDimension> typename itk::Image< unsigned short, TDimension >::Pointer ReadLabelMapFromFile( std::string labelMapFileName )
   {
@@ -176,7 +191,200 @@ namespace
     xmlFreeDoc(doc);
     
   }
-  
+
+  MULTIRESOLUTION_PARAMETERS GetMultiResolutionParameters( const std::vector< int >& shrinkFactors, const std::vector< float >& smoothingSigmas,
+							   std::string samplingStrategy, float samplingPercentage, int numberOfThreads )
+  {
+    if ( shrinkFactors.size() == 0 || shrinkFactors.size() != smoothingSigmas.size() )
+      {
+	throw cip::ExceptionObject( __FILE__, __LINE__, "RegisterCT::main()", "There must be one smoothing sigma per shrink factor" );
+      }
+    if ( samplingPercentage <= 0 || samplingPercentage > 1 )
+      {
+	throw cip::ExceptionObject( __FILE__, __LINE__, "RegisterCT::main()", "The sampling percentage must be in (0, 1]" );
+      }
+
+    MULTIRESOLUTION_PARAMETERS parameters;
+    for ( unsigned int i=0; i<shrinkFactors.size(); i++ )
+      {
+	if ( shrinkFactors[i] < 1 || smoothingSigmas[i] < 0 )
+	  {
+	    throw cip::ExceptionObject( __FILE__, __LINE__, "RegisterCT::main()", "Invalid shrink factor or smoothing sigma" );
+	  }
+	parameters.shrinkFactors.push_back( static_cast< unsigned int >( shrinkFactors[i] ) );
+	parameters.smoothingSigmas.push_back( smoothingSigmas[i] );
+      }
+    parameters.samplingStrategy   = samplingStrategy;
+    parameters.samplingPercentage = samplingPercentage;
+    parameters.numberOfThreads    = numberOfThreads > 0 ? static_cast< unsigned int >( numberOfThreads ) : 0;
+
+    return parameters;
+  }
+
+  // Reports the time spent at each level of a multi-resolution
+  // registration. The registration invokes a MultiResolutionIterationEvent
+  // when it starts a level; the time of the last level is reported by
+  // 'EndLevel'.
+  template < class TRegistration >
+  class RegistrationLevelObserver : public itk::Command
+  {
+  public:
+    typedef RegistrationLevelObserver   Self;
+    typedef itk::Command                Superclass;
+    typedef itk::SmartPointer< Self >   Pointer;
+    itkNewMacro( Self );
+
+    void Execute( itk::Object* caller, const itk::EventObject& event )
+    {
+      this->Execute( (const itk::Object*)caller, event );
+    }
+
+    void Execute( const itk::Object* caller, const itk::EventObject& event )
+    {
+      if ( !itk::MultiResolutionIterationEvent().CheckEvent( &event ) )
+	{
+	  return;
+	}
+
+      this->EndLevel();
+
+      const TRegistration* registration = static_cast< const TRegistration* >( caller );
+
+      m_Level = registration->GetCurrentLevel();
+      std::cout << "  Level " << m_Level << ": shrink factor " << m_Parameters->shrinkFactors[m_Level];
+      std::cout << ", smoothing sigma " << m_Parameters->smoothingSigmas[m_Level] << std::endl;
+
+      m_Probe = itk::TimeProbe();
+      m_Probe.Start();
+      m_LevelStarted = true;
+    }
+
+    void SetParameters( const MULTIRESOLUTION_PARAMETERS* parameters )
+    {
+      m_Parameters = parameters;
+    }
+
+    void EndLevel()
+    {
+      if ( m_LevelStarted )
+	{
+	  m_Probe.Stop();
+	  std::cout << "  Level " << m_Level << " time: " << m_Probe.GetTotal() << " s" << std::endl;
+	  m_LevelStarted = false;
+	}
+    }
+
+  protected:
+    RegistrationLevelObserver()
+      : m_Parameters( NULL ), m_Level( 0 ), m_LevelStarted( false )
+    {
+    }
+
+  private:
+    const MULTIRESOLUTION_PARAMETERS* m_Parameters;
+    itk::TimeProbe                    m_Probe;
+    unsigned int                      m_Level;
+    bool                              m_LevelStarted;
+  };
+
+  // Registers the moving image to the fixed image over an image pyramid
+  // with the ITKv4 registration framework, starting from (and updating)
+  // the specified transform. The mean squares metric and its gradient
+  // are evaluated in parallel on a sample of the fixed image voxels at
+  // each level. The optimizer settings are those of the single
+  // resolution registration; the optimizer restarts at every level.
+  template < class TImage, class TTransform >
+  void RunMultiResolutionRegistration( TImage* fixedImage, TImage* movingImage, TTransform* transform,
+				       const itk::RegularStepGradientDescentOptimizer::ScalesType& scales,
+				       double maxStepLength, double minStepLength, unsigned int numberOfIterations,
+				       const MULTIRESOLUTION_PARAMETERS& parameters )
+  {
+    typedef itk::MeanSquaresImageToImageMetricv4< TImage, TImage >       MetricType;
+    typedef itk::RegularStepGradientDescentOptimizerv4< double >         OptimizerType;
+    typedef itk::ImageRegistrationMethodv4< TImage, TImage, TTransform > RegistrationType;
+    typedef RegistrationLevelObserver< RegistrationType >                ObserverType;
+
+    typename MetricType::Pointer metric = MetricType::New();
+    if ( parameters.numberOfThreads > 0 )
+      {
+	metric->SetMaximumNumberOfThreads( parameters.numberOfThreads );
+      }
+
+    typename OptimizerType::ScalesType optimizerScales( scales.size() );
+    for ( unsigned int i=0; i<scales.size(); i++ )
+      {
+	optimizerScales[i] = scales[i];
+      }
+
+    typename OptimizerType::Pointer optimizer = OptimizerType::New();
+      optimizer->SetScales( optimizerScales );
+      optimizer->SetLearningRate( maxStepLength );
+      optimizer->SetMinimumStepLength( minStepLength );
+      optimizer->SetNumberOfIterations( numberOfIterations );
+
+    unsigned int numberOfLevels = parameters.shrinkFactors.size();
+
+    typename RegistrationType::ShrinkFactorsArrayType shrinkFactors( numberOfLevels );
+    typename RegistrationType::SmoothingSigmasArrayType smoothingSigmas( numberOfLevels );
+    for ( unsigned int i=0; i<numberOfLevels; i++ )
+      {
+	shrinkFactors[i]   = parameters.shrinkFactors[i];
+	smoothingSigmas[i] = parameters.smoothingSigmas[i];
+      }
+
+    typename RegistrationType::Pointer registration = RegistrationType::New();
+      registration->SetFixedImage( fixedImage );
+      registration->SetMovingImage( movingImage );
+      registration->SetMetric( metric );
+      registration->SetOptimizer( optimizer );
+      registration->SetInitialTransform( transform );
+      registration->SetNumberOfLevels( numberOfLevels );
+      registration->SetShrinkFactorsPerLevel( shrinkFactors );
+      registration->SetSmoothingSigmasPerLevel( smoothingSigmas );
+      registration->SetSmoothingSigmasAreSpecifiedInPhysicalUnits( false );
+    if ( parameters.numberOfThreads > 0 )
+      {
+	registration->SetNumberOfThreads( parameters.numberOfThreads );
+      }
+
+    if ( parameters.samplingStrategy == "Random" )
+      {
+	registration->SetMetricSamplingStrategy( RegistrationType::RANDOM );
+	registration->SetMetricSamplingPercentage( parameters.samplingPercentage );
+      }
+    else if ( parameters.samplingStrategy == "Regular" )
+      {
+	registration->SetMetricSamplingStrategy( RegistrationType::REGULAR );
+	registration->SetMetricSamplingPercentage( parameters.samplingPercentage );
+      }
+    else
+      {
+	registration->SetMetricSamplingStrategy( RegistrationType::NONE );
+      }
+
+    typename ObserverType::Pointer observer = ObserverType::New();
+      observer->SetParameters( &parameters );
+    registration->AddObserver( itk::MultiResolutionIterationEvent(), observer );
+
+    itk::TimeProbe probe;
+    probe.Start();
+    try
+      {
+	registration->Update();
+      }
+    catch( itk::ExceptionObject &excp )
+      {
+	std::cerr << "Exception caught while executing registration:" << std::endl;
+	std::cerr << excp << std::endl;
+      }
+    observer->EndLevel();
+    probe.Stop();
+
+    std::cout << "Optimizer stop condition = " << optimizer->GetStopConditionDescription() << std::endl;
+    std::cout << "Registration time: " << probe.GetTotal() << " s" << std::endl;
+
+    transform->SetParameters( registration->GetOutput()->Get()->GetParameters() );
+  }
   
 } //end namespace
 
@@ -248,6 +456,22 @@ int DoIT2(int argc, char * argv[])
   }
   }
   */
+  MULTIRESOLUTION_PARAMETERS multiResolutionParameters;
+  if ( multiResolution )
+    {
+      try
+	{
+	  multiResolutionParameters = GetMultiResolutionParameters( shrinkFactors, smoothingSigmas, samplingStrategy,
+								    samplingPercentage, numberOfThreads );
+	}
+      catch ( cip::ExceptionObject &exep )
+	{
+	  std::cerr << "Error: Invalid multi-resolution parameters" << std::endl;
+	  std::cerr << exep << std::endl;
+	  return cip::EXITFAILURE;
+	}
+    }
+
   //Read in fixed image label map from file and subsample
   typename  LabelMapType::Pointer fixedLabelMap = LabelMapType::New();
   typename  LabelMapType::Pointer movingLabelMap =LabelMapType::New();
@@ -388,34 +612,43 @@ int DoIT2(int argc, char * argv[])
     rigid_optimizer->SetMinimumStepLength(0.001);
     rigid_optimizer->SetNumberOfIterations(1000);
   
-  typename CTRegistrationType::Pointer registration = CTRegistrationType::New();
-  
-  std::cout<< " setting registration parameters "<<std::endl;
-  typename ShortImageType::RegionType fixedRegion = fixedCT->GetBufferedRegion();
-  
-  registration->SetMetric( nc_metric );
-  registration->SetFixedImage(fixedCT  ); 
-  registration->SetMovingImage(movingCT); 
-  registration->SetOptimizer( rigid_optimizer );
-  registration->SetInterpolator( CTinterpolator );
-  registration->SetTransform( rigidTransform );   
-  registration->SetInitialTransformParameters( rigidTransform->GetParameters());    
-  try
+  if ( multiResolution )
     {
-      registration->Initialize();
-      registration->Update();
+      std::cout << "Starting multi-resolution CT rigid registration..." << std::endl;
+      RunMultiResolutionRegistration< ShortImageType, RigidTransformType >( fixedCT, movingCT, rigidTransform, rigidOptimizerScales,
+									    0.2, 0.001, 1000, multiResolutionParameters );
     }
-  catch( itk::ExceptionObject &excp )
+  else
     {
-      std::cerr << "Exception caught while executing registration:" << std::endl;
-      std::cerr << excp << std::endl;
+      typename CTRegistrationType::Pointer registration = CTRegistrationType::New();
+
+      std::cout<< " setting registration parameters "<<std::endl;
+      typename ShortImageType::RegionType fixedRegion = fixedCT->GetBufferedRegion();
+
+      registration->SetMetric( nc_metric );
+      registration->SetFixedImage(fixedCT  ); 
+      registration->SetMovingImage(movingCT); 
+      registration->SetOptimizer( rigid_optimizer );
+      registration->SetInterpolator( CTinterpolator );
+      registration->SetTransform( rigidTransform );   
+      registration->SetInitialTransformParameters( rigidTransform->GetParameters());    
+      try
+	{
+	  registration->Initialize();
+	  registration->Update();
+	}
+      catch( itk::ExceptionObject &excp )
+	{
+	  std::cerr << "Exception caught while executing registration:" << std::endl;
+	  std::cerr << excp << std::endl;
+	}
+
+      std::cout << "Optimizer stop condition = "
+		  << registration->GetOptimizer()->GetStopConditionDescription()
+		  << std::endl;
+
+      rigidTransform->SetParameters( registration->GetLastTransformParameters() );
     }
-  
-  std::cout << "Optimizer stop condition = "
-	    << registration->GetOptimizer()->GetStopConditionDescription()
-	    << std::endl;
-  
-  rigidTransform->SetParameters( registration->GetLastTransformParameters() );
    
   // Now for the affine registration
     
@@ -424,12 +657,6 @@ int DoIT2(int argc, char * argv[])
     affineTransform->SetTranslation( rigidTransform->GetTranslation() );  
     affineTransform->SetMatrix( rigidTransform->GetMatrix() );  
   
-  typename CTRegistrationType::Pointer registration_affine = CTRegistrationType::New();  
-    registration_affine->SetMetric( nc_metric );
-    registration_affine->SetFixedImage(fixedCT  ); 
-    registration_affine->SetMovingImage(movingCT); 
-  
-  OptimizerType::Pointer affine_optimizer = OptimizerType::New();
   OptimizerScalesType optimizerScales(affineTransform->GetNumberOfParameters());
   
   optimizerScales[0] = 1.0;
@@ -439,30 +666,45 @@ int DoIT2(int argc, char * argv[])
   translationScale = 1/1000.0;
   optimizerScales[4]  = translationScale;
   optimizerScales[5] = translationScale;
-    
-  affine_optimizer->SetScales( optimizerScales );
-  affine_optimizer->SetMaximumStepLength( 0.2000  );
-  affine_optimizer->SetMinimumStepLength( 0.0001 );
-  affine_optimizer->SetNumberOfIterations( 300);
-  registration_affine->SetOptimizer( affine_optimizer );
-  registration_affine->SetInterpolator( CTinterpolator );  
-  registration_affine->SetTransform( affineTransform );
-  registration_affine->SetInitialTransformParameters( affineTransform->GetParameters() );
-    
-  std::cout << "Starting CT affine registration..." << std::endl;
-  
-  try
+
+  if ( multiResolution )
     {
-      registration_affine->Initialize();
-      registration_affine->Update();
+      std::cout << "Starting multi-resolution CT affine registration..." << std::endl;
+      RunMultiResolutionRegistration< ShortImageType, AffineTransformType >( fixedCT, movingCT, affineTransform, optimizerScales,
+									     0.2, 0.0001, 300, multiResolutionParameters );
     }
-  catch( itk::ExceptionObject &excp )
+  else
     {
-      std::cerr << "Exception caught while executing registration:" << std::endl;
-      std::cerr << excp << std::endl;
-    }  
-  
-  affineTransform->SetParameters( registration_affine->GetLastTransformParameters());
+      typename CTRegistrationType::Pointer registration_affine = CTRegistrationType::New();  
+	registration_affine->SetMetric( nc_metric );
+	registration_affine->SetFixedImage(fixedCT  ); 
+	registration_affine->SetMovingImage(movingCT); 
+
+      OptimizerType::Pointer affine_optimizer = OptimizerType::New();
+      affine_optimizer->SetScales( optimizerScales );
+      affine_optimizer->SetMaximumStepLength( 0.2000  );
+      affine_optimizer->SetMinimumStepLength( 0.0001 );
+      affine_optimizer->SetNumberOfIterations( 300);
+      registration_affine->SetOptimizer( affine_optimizer );
+      registration_affine->SetInterpolator( CTinterpolator );  
+      registration_affine->SetTransform( affineTransform );
+      registration_affine->SetInitialTransformParameters( affineTransform->GetParameters() );
+
+      std::cout << "Starting CT affine registration..." << std::endl;
+
+      try
+	{
+	  registration_affine->Initialize();
+	  registration_affine->Update();
+	}
+      catch( itk::ExceptionObject &excp )
+	{
+	  std::cerr << "Exception caught while executing registration:" << std::endl;
+	  std::cerr << excp << std::endl;
+	}  
+
+      affineTransform->SetParameters( registration_affine->GetLastTransformParameters());
+    }
   
   std::cout << "Writing final transform..." << std::endl;
   
@@ -625,6 +867,22 @@ int DoIT3(int argc, char * argv[])
   }
   }
   */
+  MULTIRESOLUTION_PARAMETERS multiResolutionParameters;
+  if ( multiResolution )
+    {
+      try
+	{
+	  multiResolutionParameters = GetMultiResolutionParameters( shrinkFactors, smoothingSigmas, samplingStrategy,
+								    samplingPercentage, numberOfThreads );
+	}
+      catch ( cip::ExceptionObject &exep )
+	{
+	  std::cerr << "Error: Invalid multi-resolution parameters" << std::endl;
+	  std::cerr << exep << std::endl;
+	  return cip::EXITFAILURE;
+	}
+    }
+
   //Read in fixed image label map from file and subsample
   typename LabelMapType::Pointer fixedLabelMap = LabelMapType::New();
   typename LabelMapType::Pointer movingLabelMap =LabelMapType::New();
@@ -773,35 +1031,44 @@ int DoIT3(int argc, char * argv[])
     rigid_optimizer->SetMinimumStepLength(0.001);
     rigid_optimizer->SetNumberOfIterations(1000);  
   
-  typename ShortImageType::RegionType fixedRegion = fixedCT->GetBufferedRegion();
-  
-  typename CTRegistrationType::Pointer registration = CTRegistrationType::New();
-    registration->SetMetric( nc_metric );
-    registration->SetFixedImage(fixedCT  ); 
-    registration->SetMovingImage(movingCT); 
-    registration->SetOptimizer( rigid_optimizer );
-    registration->SetInterpolator( CTinterpolator );
-    registration->SetTransform( rigidTransform );
-    registration->SetInitialTransformParameters( rigidTransform->GetParameters()); 
-  
-  std::cout<< "  registering "<<std::endl;
-  try
+  if ( multiResolution )
     {
-      registration->Initialize();
-      registration->Update();
+      std::cout << "Starting multi-resolution CT rigid registration..." << std::endl;
+      RunMultiResolutionRegistration< ShortImageType, RigidTransformType3D >( fixedCT, movingCT, rigidTransform, rigidOptimizerScales,
+									      0.2, 0.001, 1000, multiResolutionParameters );
     }
-  catch( itk::ExceptionObject &excp )
+  else
     {
-      std::cerr << "ExceptionObject caught while executing registration" <<
-        std::endl;
-      std::cerr << excp << std::endl;
+      typename ShortImageType::RegionType fixedRegion = fixedCT->GetBufferedRegion();
+
+      typename CTRegistrationType::Pointer registration = CTRegistrationType::New();
+	registration->SetMetric( nc_metric );
+	registration->SetFixedImage(fixedCT  ); 
+	registration->SetMovingImage(movingCT); 
+	registration->SetOptimizer( rigid_optimizer );
+	registration->SetInterpolator( CTinterpolator );
+	registration->SetTransform( rigidTransform );
+	registration->SetInitialTransformParameters( rigidTransform->GetParameters()); 
+
+      std::cout<< "  registering "<<std::endl;
+      try
+	{
+	  registration->Initialize();
+	  registration->Update();
+	}
+      catch( itk::ExceptionObject &excp )
+	{
+	  std::cerr << "ExceptionObject caught while executing registration" <<
+	    std::endl;
+	  std::cerr << excp << std::endl;
+	}
+
+      std::cout << "Optimizer stop condition = "
+		<< registration->GetOptimizer()->GetStopConditionDescription()
+		<< std::endl;
+
+      rigidTransform->SetParameters( registration->GetLastTransformParameters() );
     }
-  
-  std::cout << "Optimizer stop condition = "
-	    << registration->GetOptimizer()->GetStopConditionDescription()
-	    << std::endl;
-  
-  rigidTransform->SetParameters( registration->GetLastTransformParameters() );
     
   // Now for the affine registration
     
@@ -810,12 +1077,6 @@ int DoIT3(int argc, char * argv[])
     affineTransform->SetTranslation( rigidTransform->GetTranslation() );  
     affineTransform->SetMatrix( rigidTransform->GetMatrix() );  
   
-  typename CTRegistrationType::Pointer registration_affine = CTRegistrationType::New();  
-    registration_affine->SetMetric( nc_metric );
-    registration_affine->SetFixedImage(fixedCT  ); 
-    registration_affine->SetMovingImage(movingCT); 
-  
-  OptimizerType::Pointer affine_optimizer = OptimizerType::New();
   OptimizerScalesType optimizerScales(affineTransform->GetNumberOfParameters());    
   
   optimizerScales[0] = 1.0;
@@ -830,31 +1091,46 @@ int DoIT3(int argc, char * argv[])
   optimizerScales[9]  = translationScale;
   optimizerScales[10] = translationScale;
   optimizerScales[11] = translationScale;
-  translationScale = 1/1000.0;  
-  
-  affine_optimizer->SetScales( optimizerScales );
-  affine_optimizer->SetMaximumStepLength( 0.2000  );
-  affine_optimizer->SetMinimumStepLength( 0.0001 );
-  affine_optimizer->SetNumberOfIterations( 300);//300 );
-  registration_affine->SetOptimizer( affine_optimizer );
-  registration_affine->SetInterpolator( CTinterpolator );
-  registration_affine->SetTransform( affineTransform );
-  registration_affine->SetInitialTransformParameters( affineTransform->GetParameters() );
-  
-  std::cout << "Starting CT affine registration..." << std::endl;
-  try
+  translationScale = 1/1000.0;
+
+  if ( multiResolution )
     {
-      registration_affine->Initialize();
-      registration_affine->Update();
+      std::cout << "Starting multi-resolution CT affine registration..." << std::endl;
+      RunMultiResolutionRegistration< ShortImageType, AffineTransformType >( fixedCT, movingCT, affineTransform, optimizerScales,
+									     0.2, 0.0001, 300, multiResolutionParameters );
     }
-  catch( itk::ExceptionObject &excp )
+  else
     {
-      std::cerr << "ExceptionObject caught while executing registration" <<
-        std::endl;
-      std::cerr << excp << std::endl;
+      typename CTRegistrationType::Pointer registration_affine = CTRegistrationType::New();  
+	registration_affine->SetMetric( nc_metric );
+	registration_affine->SetFixedImage(fixedCT  ); 
+	registration_affine->SetMovingImage(movingCT); 
+
+      OptimizerType::Pointer affine_optimizer = OptimizerType::New();
+      affine_optimizer->SetScales( optimizerScales );
+      affine_optimizer->SetMaximumStepLength( 0.2000  );
+      affine_optimizer->SetMinimumStepLength( 0.0001 );
+      affine_optimizer->SetNumberOfIterations( 300);//300 );
+      registration_affine->SetOptimizer( affine_optimizer );
+      registration_affine->SetInterpolator( CTinterpolator );
+      registration_affine->SetTransform( affineTransform );
+      registration_affine->SetInitialTransformParameters( affineTransform->GetParameters() );
+
+      std::cout << "Starting CT affine registration..." << std::endl;
+      try
+	{
+	  registration_affine->Initialize();
+	  registration_affine->Update();
+	}
+      catch( itk::ExceptionObject &excp )
+	{
+	  std::cerr << "ExceptionObject caught while executing registration" <<
+	    std::endl;
+	  std::cerr << excp << std::endl;
+	}
+
+      affineTransform->SetParameters( registration_affine->GetLastTransformParameters());
     }
-    
-  affineTransform->SetParameters( registration_affine->GetLastTransformParameters());
   std::cout << "Writing final transform" << std::endl;
   
   if ( strcmp(outputTransformFileName.c_str(), "NA") != 0 )
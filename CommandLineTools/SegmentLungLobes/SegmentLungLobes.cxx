@@ -287,6 +287,7 @@ int main( int argc, char *argv[] )
     }
   lobeSegmenter->SetInput( leftLungRightLungReader->GetOutput() );
   lobeSegmenter->SetThinPlateSplineSurfaceFromPointsLambda( lambda );
+  lobeSegmenter->SetThinPlateSplineSurfaceApproximationTolerance( tpsTolerance );
   lobeSegmenter->Update();
   
   std::cout << "Writing lung lobe label map..." << std::endl;
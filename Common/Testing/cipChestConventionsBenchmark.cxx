@@ -0,0 +1,170 @@
+/**
+ *  Times the chest conventions lookups against the implementations
+ *  they replaced: the region relationship (hierarchy walk / ancestor
+ *  table), the region name lookup (linear search / name map), and the
+ *  construction of the conventions (local object / shared instance).
+ *  The optional argument is the number of repetitions (200 by
+ *  default). This program is not run by ctest: the timings depend on
+ *  the machine and the build type, and cipChestConventionsTEST already
+ *  checks that the lookups give the same results.
+ */
+
+#include "cipChestConventions.h"
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+
+// The hierarchy walk and the name search as they were implemented
+// before the ancestor table and the name maps were introduced. They
+// are timed against the current lookups.
+bool LegacyCheckSubordinateSuperiorChestRegionRelationship( std::map< unsigned char, unsigned char >& hierarchy,
+                                                            unsigned char subordinate, unsigned char superior )
+{
+  if ( subordinate == superior )
+    {
+      return true;
+    }
+  if ( subordinate == (unsigned char)( cip::UNDEFINEDREGION ) ||
+       superior == (unsigned char)( cip::UNDEFINEDREGION ) )
+    {
+      return false;
+    }
+
+  unsigned char subordinateTemp = subordinate;
+  while ( hierarchy.find(subordinateTemp) != hierarchy.end() )
+    {
+      if ( hierarchy[subordinateTemp] == superior )
+	{
+	  return true;
+	}
+      subordinateTemp = hierarchy[subordinateTemp];
+    }
+
+  return false;
+}
+
+unsigned char LegacyGetChestRegionValueFromName( const cip::ChestConventions& conventions, std::string regionString )
+{
+  std::string upperRegionString( regionString );
+  std::transform(upperRegionString.begin(), upperRegionString.end(), upperRegionString.begin(), ::toupper);
+
+  for ( int i=0; i<conventions.GetNumberOfEnumeratedChestRegions(); i++ )
+    {
+      std::string upperChestRegionName( conventions.ChestRegionNames[i] );
+      std::transform(upperChestRegionName.begin(), upperChestRegionName.end(), upperChestRegionName.begin(), ::toupper);
+
+      if ( !upperRegionString.compare(upperChestRegionName) )
+	{
+	  return conventions.ChestRegions[i];
+	}
+    }
+
+  return (unsigned char)( cip::UNDEFINEDREGION );
+}
+
+int main( int argc, char* argv[] )
+{
+  unsigned int numberOfRepetitions = 200;
+  if ( argc > 1 )
+    {
+    numberOfRepetitions = static_cast< unsigned int >( std::atoi( argv[1] ) );
+    }
+
+  cip::ChestConventions conventions;
+  const cip::ChestConventions& instance = cip::ChestConventions::GetInstance();
+
+  std::map< unsigned char, unsigned char > hierarchy = conventions.ChestRegionHierarchyMap;
+
+  std::vector< std::string > names;
+  for ( unsigned int i=0; i<conventions.GetNumberOfEnumeratedChestRegions(); i++ )
+    {
+      std::string lowerName( conventions.ChestRegionNames[i] );
+      std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), ::tolower);
+
+      names.push_back( conventions.ChestRegionNames[i] );
+      names.push_back( lowerName );
+    }
+  names.push_back( "NotARegion" );
+  names.push_back( "" );
+
+  unsigned int legacyCount = 0;
+  std::clock_t start = std::clock();
+  for ( unsigned int n=0; n<numberOfRepetitions; n++ )
+    {
+      for ( unsigned int sub=0; sub<256; sub++ )
+	{
+	  for ( unsigned int sup=0; sup<256; sup++ )
+	    {
+	      legacyCount += LegacyCheckSubordinateSuperiorChestRegionRelationship( hierarchy, (unsigned char)(sub), (unsigned char)(sup) );
+	    }
+	}
+    }
+  double legacyRelationshipTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  unsigned int tableCount = 0;
+  start = std::clock();
+  for ( unsigned int n=0; n<numberOfRepetitions; n++ )
+    {
+      for ( unsigned int sub=0; sub<256; sub++ )
+	{
+	  for ( unsigned int sup=0; sup<256; sup++ )
+	    {
+	      tableCount += instance.CheckSubordinateSuperiorChestRegionRelationship( (unsigned char)(sub), (unsigned char)(sup) );
+	    }
+	}
+    }
+  double tableRelationshipTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  unsigned int legacyNameSum = 0;
+  start = std::clock();
+  for ( unsigned int n=0; n<numberOfRepetitions; n++ )
+    {
+      for ( unsigned int i=0; i<names.size(); i++ )
+	{
+	  legacyNameSum += LegacyGetChestRegionValueFromName( conventions, names[i] );
+	}
+    }
+  double legacyNameTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  unsigned int mapNameSum = 0;
+  start = std::clock();
+  for ( unsigned int n=0; n<numberOfRepetitions; n++ )
+    {
+      for ( unsigned int i=0; i<names.size(); i++ )
+	{
+	  mapNameSum += instance.GetChestRegionValueFromName( names[i] );
+	}
+    }
+  double mapNameTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  start = std::clock();
+  for ( unsigned int n=0; n<numberOfRepetitions; n++ )
+    {
+      cip::ChestConventions local;
+      legacyCount += local.GetNumberOfEnumeratedChestRegions();
+    }
+  double constructionTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  start = std::clock();
+  for ( unsigned int n=0; n<numberOfRepetitions; n++ )
+    {
+      tableCount += cip::ChestConventions::GetInstance().GetNumberOfEnumeratedChestRegions();
+    }
+  double instanceTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  if ( legacyCount != tableCount || legacyNameSum != mapNameSum )
+    {
+      std::cout << "The lookups give different results" << std::endl;
+      return 1;
+    }
+
+  std::cout << "Region relationship (hierarchy walk / ancestor table): ";
+  std::cout << legacyRelationshipTime << " s / " << tableRelationshipTime << " s" << std::endl;
+  std::cout << "Region name lookup (linear search / name map):         ";
+  std::cout << legacyNameTime << " s / " << mapNameTime << " s" << std::endl;
+  std::cout << "Conventions (construction / shared instance):          ";
+  std::cout << constructionTime << " s / " << instanceTime << " s" << std::endl;
+
+  return 0;
+}
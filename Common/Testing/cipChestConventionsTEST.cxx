@@ -0,0 +1,112 @@
+#include "cipChestConventions.h"
+#include <algorithm>
+
+// The hierarchy walk and the name search as they were implemented
+// before the ancestor table and the name maps were introduced. They
+// are used as reference for the results.
+bool LegacyCheckSubordinateSuperiorChestRegionRelationship( std::map< unsigned char, unsigned char >& hierarchy,
+                                                            unsigned char subordinate, unsigned char superior )
+{
+  if ( subordinate == superior )
+    {
+      return true;
+    }
+  if ( subordinate == (unsigned char)( cip::UNDEFINEDREGION ) ||
+       superior == (unsigned char)( cip::UNDEFINEDREGION ) )
+    {
+      return false;
+    }
+
+  unsigned char subordinateTemp = subordinate;
+  while ( hierarchy.find(subordinateTemp) != hierarchy.end() )
+    {
+      if ( hierarchy[subordinateTemp] == superior )
+	{
+	  return true;
+	}
+      subordinateTemp = hierarchy[subordinateTemp];
+    }
+
+  return false;
+}
+
+unsigned char LegacyGetChestRegionValueFromName( const cip::ChestConventions& conventions, std::string regionString )
+{
+  std::string upperRegionString( regionString );
+  std::transform(upperRegionString.begin(), upperRegionString.end(), upperRegionString.begin(), ::toupper);
+
+  for ( int i=0; i<conventions.GetNumberOfEnumeratedChestRegions(); i++ )
+    {
+      std::string upperChestRegionName( conventions.ChestRegionNames[i] );
+      std::transform(upperChestRegionName.begin(), upperChestRegionName.end(), upperChestRegionName.begin(), ::toupper);
+
+      if ( !upperRegionString.compare(upperChestRegionName) )
+	{
+	  return conventions.ChestRegions[i];
+	}
+    }
+
+  return (unsigned char)( cip::UNDEFINEDREGION );
+}
+
+int main( int argc, char* argv[] )
+{
+  cip::ChestConventions conventions;
+  const cip::ChestConventions& instance = cip::ChestConventions::GetInstance();
+
+  std::map< unsigned char, unsigned char > hierarchy = conventions.ChestRegionHierarchyMap;
+
+  // The ancestor table must agree with the hierarchy walk for every
+  // pair of region values
+  for ( unsigned int sub=0; sub<256; sub++ )
+    {
+      for ( unsigned int sup=0; sup<256; sup++ )
+	{
+	  bool expected = LegacyCheckSubordinateSuperiorChestRegionRelationship( hierarchy, (unsigned char)(sub), (unsigned char)(sup) );
+	  if ( conventions.CheckSubordinateSuperiorChestRegionRelationship( (unsigned char)(sub), (unsigned char)(sup) ) != expected ||
+	       instance.CheckSubordinateSuperiorChestRegionRelationship( (unsigned char)(sub), (unsigned char)(sup) ) != expected )
+	    {
+	      std::cout << "FAILED: relationship " << sub << " " << sup << std::endl;
+	      return 1;
+	    }
+	}
+    }
+
+  // The name lookups must agree with the linear search, including
+  // for lower case and unknown names
+  std::vector< std::string > names;
+  for ( unsigned int i=0; i<conventions.GetNumberOfEnumeratedChestRegions(); i++ )
+    {
+      std::string lowerName( conventions.ChestRegionNames[i] );
+      std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), ::tolower);
+
+      names.push_back( conventions.ChestRegionNames[i] );
+      names.push_back( lowerName );
+    }
+  names.push_back( "NotARegion" );
+  names.push_back( "" );
+
+  for ( unsigned int i=0; i<names.size(); i++ )
+    {
+      unsigned char expected = LegacyGetChestRegionValueFromName( conventions, names[i] );
+      if ( conventions.GetChestRegionValueFromName( names[i] ) != expected ||
+	   instance.GetChestRegionValueFromName( names[i] ) != expected )
+	{
+	  std::cout << "FAILED: region name " << names[i] << std::endl;
+	  return 1;
+	}
+    }
+
+  for ( unsigned int i=0; i<conventions.GetNumberOfEnumeratedChestTypes(); i++ )
+    {
+      std::string name( conventions.GetChestTypeName( conventions.GetChestType( i ) ) );
+      if ( conventions.GetChestTypeName( conventions.GetChestTypeValueFromName( name ) ) != name )
+	{
+	  std::cout << "FAILED: type name " << name << std::endl;
+	  return 1;
+	}
+    }
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
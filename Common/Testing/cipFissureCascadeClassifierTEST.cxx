@@ -0,0 +1,145 @@
+#include "cipFissureCascadeClassifier.h"
+#include "cipChestConventions.h"
+#include "cipHelper.h"
+#include <iostream>
+
+int main( int argc, char* argv[] )
+{
+  // A synthetic left lung at -950 HU crossed by a one voxel thick
+  // fissure at -830 HU in the plane z = 12 (1 mm voxels, origin at
+  // zero). The left oblique surface model is the same plane.
+  const unsigned int size[3]   = { 16, 16, 56 };
+  const unsigned int fissureZ  = 12;
+
+  const cip::ChestConventions& conventions = cip::ChestConventions::GetInstance();
+  unsigned short leftLungValue =
+    conventions.GetValueFromChestRegionAndType( (unsigned char)(cip::LEFTLUNG), (unsigned char)(cip::UNDEFINEDTYPE) );
+
+  cip::CTType::SizeType imageSize;
+  for ( unsigned int d=0; d<3; d++ )
+    {
+    imageSize[d] = size[d];
+    }
+
+  cip::CTType::Pointer ctImage = cip::CTType::New();
+    ctImage->SetRegions( imageSize );
+    ctImage->Allocate();
+    ctImage->FillBuffer( -950 );
+
+  cip::LabelMapType::Pointer labelMap = cip::LabelMapType::New();
+    labelMap->SetRegions( imageSize );
+    labelMap->Allocate();
+    labelMap->FillBuffer( leftLungValue );
+
+  cip::CTType::IndexType index;
+  for ( unsigned int y=0; y<size[1]; y++ )
+    {
+    for ( unsigned int x=0; x<size[0]; x++ )
+      {
+      index[0] = x;
+      index[1] = y;
+      index[2] = fissureZ;
+      ctImage->SetPixel( index, -830 );
+      }
+    }
+
+  // One fissure voxel is not labeled as lung
+  cip::CTType::IndexType unlabeledIndex;
+    unlabeledIndex[0] = 3;
+    unlabeledIndex[1] = 8;
+    unlabeledIndex[2] = fissureZ;
+  labelMap->SetPixel( unlabeledIndex, 0 );
+
+  std::vector< cip::PointType > surfacePoints;
+  for ( unsigned int j=0; j<5; j++ )
+    {
+    for ( unsigned int i=0; i<5; i++ )
+      {
+      cip::PointType point( 3 );
+        point[0] = 4.0*double( i ) - 0.5;
+        point[1] = 4.0*double( j ) - 0.5;
+        point[2] = double( fissureZ );
+
+      surfacePoints.push_back( point );
+      }
+    }
+  cipThinPlateSplineSurface surface( surfacePoints );
+
+  // The output must not depend on the number of threads or on the
+  // slab size
+  cipFissureCascadeClassifier serialClassifier;
+    serialClassifier.SetLeftObliqueSurface( &surface );
+    serialClassifier.SetNumberOfThreads( 1 );
+    serialClassifier.SetNumberOfSlicesPerSlab( 1 );
+
+  cipFissureCascadeClassifier threadedClassifier;
+    threadedClassifier.SetLeftObliqueSurface( &surface );
+    threadedClassifier.SetNumberOfThreads( 3 );
+    threadedClassifier.SetNumberOfSlicesPerSlab( 5 );
+
+  std::cout << "Enhancing fissures..." << std::endl;
+  cip::CTType::Pointer serialImage   = serialClassifier.Enhance( ctImage, labelMap );
+  cip::CTType::Pointer threadedImage = threadedClassifier.Enhance( ctImage, labelMap );
+
+  const short* serialBuffer   = serialImage->GetBufferPointer();
+  const short* threadedBuffer = threadedImage->GetBufferPointer();
+  for ( unsigned int i=0; i<size[0]*size[1]*size[2]; i++ )
+    {
+    if ( serialBuffer[i] != threadedBuffer[i] )
+      {
+      std::cout << "FAILED: the threaded output differs from the serial output" << std::endl;
+      return 1;
+      }
+    }
+
+  for ( unsigned int s=0; s<serialClassifier.GetNumberOfStages(); s++ )
+    {
+    if ( serialClassifier.GetNumberOfStageCandidates( s ) != threadedClassifier.GetNumberOfStageCandidates( s ) ||
+         serialClassifier.GetNumberOfStageRejections( s ) != threadedClassifier.GetNumberOfStageRejections( s ) )
+      {
+      std::cout << "FAILED: the stage statistics differ between the serial and threaded runs" << std::endl;
+      return 1;
+      }
+    }
+
+  // Every lung voxel below -650 HU is a candidate of the first stage
+  if ( serialClassifier.GetNumberOfStageCandidates( 0 ) != size[0]*size[1]*size[2] - 1 )
+    {
+    std::cout << "FAILED: wrong number of candidates" << std::endl;
+    return 1;
+    }
+
+  // The fissure voxels in the middle of the plane have a probability
+  // close to one, so they keep their CT value
+  index[0] = 8;
+  index[1] = 8;
+  index[2] = fissureZ;
+  if ( serialImage->GetPixel( index ) != -830 )
+    {
+    std::cout << "FAILED: fissure voxel not enhanced (" << serialImage->GetPixel( index ) << ")" << std::endl;
+    return 1;
+    }
+
+  // The unlabeled fissure voxel is not a candidate
+  if ( serialImage->GetPixel( unlabeledIndex ) != -1000 )
+    {
+    std::cout << "FAILED: unlabeled voxel enhanced" << std::endl;
+    return 1;
+    }
+
+  // Far enough from the surface model, the lung voxels are rejected
+  // by the first two stages (their Hessian is zero away from the
+  // fissure and from the image border)
+  for ( unsigned int z=fissureZ + 30; z<size[2] - 8; z++ )
+    {
+    index[2] = z;
+    if ( serialImage->GetPixel( index ) != -1000 )
+      {
+      std::cout << "FAILED: voxel far from the fissure enhanced" << std::endl;
+      return 1;
+      }
+    }
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
@@ -2,6 +2,12 @@
 #include "cipHelper.h"
 #include "itkImageRegionIterator.h"
 #include "cipExceptionObject.h"
+#include "vtkPoints.h"
+#include "vtkPointData.h"
+#include "vtkFloatArray.h"
+#include "cipTestingHelper.h"
+#include <algorithm>
+#include <cmath>
 
 int main( int argc, char* argv[] )
 {
@@ -85,6 +91,242 @@ int main( int argc, char* argv[] )
       }
   }
 
+  // Third test: the particle graph edges must be the same as the ones
+  // found by testing every pair of particles, and the minimum spanning
+  // forest must be the same as the one found by a simple Kruskal
+  // implementation (the edge weights are all different, so the forest
+  // is unique)
+  {
+    std::cout << "Computing particle graph..." << std::endl;
+    const double distanceThreshold = 3.0;
+    const double angleSigma        = 1.0;
+
+    vtkSmartPointer< vtkPoints > points = vtkSmartPointer< vtkPoints >::New();
+    vtkSmartPointer< vtkFloatArray > hevec2 = vtkSmartPointer< vtkFloatArray >::New();
+      hevec2->SetNumberOfComponents( 3 );
+      hevec2->SetName( "hevec2" );
+
+    unsigned int seed = 1;
+    for ( unsigned int i=0; i<1500; i++ )
+      {
+	double values[6];
+	for ( unsigned int k=0; k<6; k++ )
+	  {
+	    seed = 1664525*seed + 1013904223;
+	    values[k] = double( seed >> 8 )/double( 1 << 24 );
+	  }
+	points->InsertNextPoint( 40.0*values[0], 40.0*values[1], 20.0*values[2] );
+	hevec2->InsertNextTuple3( values[3] - 0.5, values[4] - 0.5, values[5] - 0.5 );
+      }
+
+    vtkSmartPointer< vtkPolyData > particles = vtkSmartPointer< vtkPolyData >::New();
+      particles->SetPoints( points );
+      particles->GetPointData()->AddArray( hevec2 );
+
+    std::vector< unsigned int > expectedEdgeParticles;
+    std::vector< double >       expectedEdgeWeights;
+    for ( unsigned int i=0; i<particles->GetNumberOfPoints(); i++ )
+      {
+	for ( unsigned int j=i+1; j<particles->GetNumberOfPoints(); j++ )
+	  {
+	    cip::VectorType connectingVec( 3 );
+	    cip::VectorType vec1( 3 );
+	    cip::VectorType vec2( 3 );
+	    for ( unsigned int d=0; d<3; d++ )
+	      {
+		connectingVec[d] = particles->GetPoint( i )[d] - particles->GetPoint( j )[d];
+		vec1[d] = hevec2->GetTuple( i )[d];
+		vec2[d] = hevec2->GetTuple( j )[d];
+	      }
+
+	    double distance = cip::GetVectorMagnitude( connectingVec );
+	    if ( distance <= distanceThreshold )
+	      {
+		double angle = std::min( cip::GetAngleBetweenVectors( vec1, connectingVec, true ),
+					 cip::GetAngleBetweenVectors( vec2, connectingVec, true ) );
+
+		expectedEdgeParticles.push_back( i );
+		expectedEdgeParticles.push_back( j );
+		expectedEdgeWeights.push_back( distance*(1.0 + std::exp( -std::pow( (90.0 - angle)/angleSigma, 2 ) )) );
+	      }
+	  }
+      }
+
+    for ( unsigned int numberOfThreads=1; numberOfThreads<=4; numberOfThreads += 3 )
+      {
+	std::vector< unsigned int > edgeParticles;
+	std::vector< double >       edgeWeights;
+	cip::GetParticleGraphEdges( particles, "hevec2", distanceThreshold, angleSigma, &edgeParticles, &edgeWeights, numberOfThreads );
+
+	if ( edgeParticles != expectedEdgeParticles || edgeWeights != expectedEdgeWeights )
+	  {
+	    std::cout << "FAILED" << std::endl;
+	    return 1;
+	  }
+      }
+
+    std::cout << "Computing minimum spanning forest..." << std::endl;
+    std::vector< std::pair< double, unsigned int > > sortedEdges;
+    for ( unsigned int e=0; e<expectedEdgeWeights.size(); e++ )
+      {
+	sortedEdges.push_back( std::make_pair( expectedEdgeWeights[e], e ) );
+      }
+    std::sort( sortedEdges.begin(), sortedEdges.end() );
+
+    std::vector< unsigned int > components( particles->GetNumberOfPoints() );
+    for ( unsigned int i=0; i<components.size(); i++ )
+      {
+	components[i] = i;
+      }
+
+    std::vector< unsigned int > expectedForestEdges;
+    for ( unsigned int k=0; k<sortedEdges.size(); k++ )
+      {
+	unsigned int e = sortedEdges[k].second;
+	unsigned int component1 = components[expectedEdgeParticles[2*e]];
+	unsigned int component2 = components[expectedEdgeParticles[2*e + 1]];
+	if ( component1 != component2 )
+	  {
+	    for ( unsigned int i=0; i<components.size(); i++ )
+	      {
+		if ( components[i] == component2 )
+		  {
+		    components[i] = component1;
+		  }
+	      }
+	    expectedForestEdges.push_back( e );
+	  }
+      }
+    std::sort( expectedForestEdges.begin(), expectedForestEdges.end() );
+
+    std::vector< unsigned int > forestEdges;
+    cip::GetMinimumSpanningForestEdges( particles->GetNumberOfPoints(), expectedEdgeParticles, expectedEdgeWeights, &forestEdges );
+
+    if ( forestEdges != expectedForestEdges )
+      {
+	std::cout << "FAILED" << std::endl;
+	return 1;
+      }
+  }
+
+  // Fourth test: the fixed size point type must behave like 'cip::PointType'
+  // and the particle computations must give the same results with both
+  // types. (cipParticlePointTypesBenchmark times the same computations
+  // on larger particle sets.)
+  {
+    std::cout << "Testing fixed size points..." << std::endl;
+    cip::PointType point( 3 );
+      point[0] = 1.0;
+      point[1] = -2.0;
+      point[2] = 0.5;
+
+    cip::Point3 fixedPoint( point );
+    cip::PointType converted = fixedPoint + cip::Vector3( 1.0, 1.0, 1.0 )*2.0 - (-fixedPoint)/2.0;
+
+    if ( converted.size() != 3 || converted[0] != 3.5 || converted[1] != -1.0 || converted[2] != 2.75 ||
+	 cip::Dot( fixedPoint, fixedPoint ) != 5.25 ||
+	 cip::Cross( cip::Vector3( 1.0, 0.0, 0.0 ), cip::Vector3( 0.0, 1.0, 0.0 ) )[2] != 1.0 )
+      {
+	std::cout << "FAILED" << std::endl;
+	return 1;
+      }
+
+    const unsigned int numberOfParticles = 40;
+    const double       angleSigma        = 1.0;
+
+    unsigned int seed = 1;
+    std::vector< double > positions( 3*numberOfParticles );
+    std::vector< double > directions( 3*numberOfParticles );
+    for ( unsigned int i=0; i<3*numberOfParticles; i++ )
+      {
+	positions[i]  = 20.0*GetRandomNumber( seed );
+	directions[i] = GetRandomNumber( seed ) - 0.5;
+      }
+
+    // Edge weights of all the particle pairs, computed as in
+    // 'GetParticleGraphEdges'
+    for ( unsigned int i=0; i<numberOfParticles; i++ )
+      {
+	for ( unsigned int j=i+1; j<numberOfParticles; j++ )
+	  {
+	    cip::VectorType connectingVec( 3 );
+	    cip::VectorType vec1( 3 );
+	    cip::VectorType vec2( 3 );
+	    for ( unsigned int d=0; d<3; d++ )
+	      {
+		connectingVec[d] = positions[3*i + d] - positions[3*j + d];
+		vec1[d] = directions[3*i + d];
+		vec2[d] = directions[3*j + d];
+	      }
+
+	    double angle = std::min( cip::GetAngleBetweenVectors( vec1, connectingVec, true ),
+				     cip::GetAngleBetweenVectors( vec2, connectingVec, true ) );
+	    double weight = cip::GetVectorMagnitude( connectingVec )*(1.0 + std::exp( -std::pow( (90.0 - angle)/angleSigma, 2 ) ));
+
+	    cip::Vector3 fixedConnectingVec = cip::Vector3( &positions[3*i] ) - cip::Vector3( &positions[3*j] );
+	    cip::Vector3 fixedVec1( &directions[3*i] );
+	    cip::Vector3 fixedVec2( &directions[3*j] );
+
+	    double fixedAngle = std::min( cip::GetAngleBetweenVectors( fixedVec1, fixedConnectingVec, true ),
+					  cip::GetAngleBetweenVectors( fixedVec2, fixedConnectingVec, true ) );
+	    double fixedWeight = cip::GetVectorMagnitude( fixedConnectingVec )*(1.0 + std::exp( -std::pow( (90.0 - fixedAngle)/angleSigma, 2 ) ));
+
+	    if ( weight != fixedWeight )
+	      {
+		std::cout << "FAILED: edge weights differ between the point types" << std::endl;
+		return 1;
+	      }
+	  }
+      }
+
+    // Distances and closest points of the particles to a TPS surface
+    std::vector< cip::PointType > surfacePoints;
+    for ( unsigned int i=0; i<20; i++ )
+      {
+	surfacePoints.push_back( cip::PointType( &positions[3*i], &positions[3*i] + 3 ) );
+	surfacePoints.back()[2] = 10.0 + std::sin( surfacePoints.back()[0]/4.0 ) + surfacePoints.back()[1]/10.0;
+      }
+    cipThinPlateSplineSurface surface( surfacePoints );
+
+    std::vector< cip::PointType > particles;
+    std::vector< cip::Point3 >    fixedParticles;
+    for ( unsigned int i=0; i<numberOfParticles; i++ )
+      {
+	particles.push_back( cip::PointType( &positions[3*i], &positions[3*i] + 3 ) );
+	fixedParticles.push_back( cip::Point3( &positions[3*i] ) );
+      }
+
+    for ( unsigned int i=0; i<numberOfParticles; i++ )
+      {
+	if ( cip::GetDistanceToThinPlateSplineSurface( surface, particles[i] ) !=
+	     cip::GetDistanceToThinPlateSplineSurface( surface, fixedParticles[i] ) )
+	  {
+	    std::cout << "FAILED: TPS distances differ between the point types" << std::endl;
+	    return 1;
+	  }
+      }
+
+    std::vector< cip::PointType > closestPoints;
+    std::vector< double >         batchDistances;
+    cip::GetClosestPointsOnThinPlateSplineSurface( surface, particles, closestPoints, batchDistances, 1 );
+
+    std::vector< cip::Point3 > fixedClosestPoints;
+    std::vector< double >      fixedBatchDistances;
+    cip::GetClosestPointsOnThinPlateSplineSurface( surface, fixedParticles, fixedClosestPoints, fixedBatchDistances, 1 );
+
+    bool sameClosestPoints = fixedClosestPoints.size() == closestPoints.size();
+    for ( unsigned int i=0; sameClosestPoints && i<closestPoints.size(); i++ )
+      {
+	sameClosestPoints = closestPoints[i] == cip::PointType( fixedClosestPoints[i] );
+      }
+
+    if ( batchDistances != fixedBatchDistances || !sameClosestPoints )
+      {
+	std::cout << "FAILED: closest points differ between the point types" << std::endl;
+	return 1;
+      }
+  }
+
   std::cout << "PASSED" << std::endl;
   return 0;
 }
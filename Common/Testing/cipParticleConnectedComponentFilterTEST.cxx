@@ -0,0 +1,343 @@
+#include "cipAirwayParticleConnectedComponentFilter.h"
+#include "cipVesselParticleConnectedComponentFilter.h"
+#include "cipFissureParticleConnectedComponentFilter.h"
+#include "vtkPolyData.h"
+#include "vtkPoints.h"
+#include "vtkPointData.h"
+#include "vtkFloatArray.h"
+#include "vtkIdList.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// Particles of a test case. Every particle has a scale and two
+// directions: 'hevec0' (the vessel direction) and 'hevec2' (the
+// airway direction and the fissure normal).
+struct PARTICLES
+{
+  vtkPolyData*   polyData;
+  vtkPoints*     points;
+  vtkFloatArray* scales;
+  vtkFloatArray* hevec0;
+  vtkFloatArray* hevec2;
+};
+
+PARTICLES GetEmptyParticles()
+{
+  PARTICLES particles;
+    particles.polyData = vtkPolyData::New();
+    particles.points   = vtkPoints::New();
+    particles.scales   = vtkFloatArray::New();
+    particles.hevec0   = vtkFloatArray::New();
+    particles.hevec2   = vtkFloatArray::New();
+
+  particles.scales->SetNumberOfComponents( 1 );
+  particles.scales->SetName( "scale" );
+  particles.hevec0->SetNumberOfComponents( 3 );
+  particles.hevec0->SetName( "hevec0" );
+  particles.hevec2->SetNumberOfComponents( 3 );
+  particles.hevec2->SetName( "hevec2" );
+
+  particles.polyData->SetPoints( particles.points );
+  particles.polyData->GetPointData()->AddArray( particles.scales );
+  particles.polyData->GetPointData()->AddArray( particles.hevec0 );
+  particles.polyData->GetPointData()->AddArray( particles.hevec2 );
+
+  return particles;
+}
+
+void DeleteParticles( PARTICLES* particles )
+{
+  particles->polyData->Delete();
+  particles->points->Delete();
+  particles->scales->Delete();
+  particles->hevec0->Delete();
+  particles->hevec2->Delete();
+}
+
+// Adds 'number' particles, 'step' apart from (x, y, z) on, with the
+// same scale and directions
+void AddLine( PARTICLES* particles, double x, double y, double z, const double step[3], unsigned int number,
+              float scale, const double hevec0[3], const double hevec2[3] )
+{
+  for ( unsigned int i=0; i<number; i++ )
+    {
+    particles->points->InsertNextPoint( x + i*step[0], y + i*step[1], z + i*step[2] );
+    particles->scales->InsertNextTuple( &scale );
+    particles->hevec0->InsertNextTuple( hevec0 );
+    particles->hevec2->InsertNextTuple( hevec2 );
+    }
+}
+
+bool IsSamePoint( const double* point1, const double* point2 )
+{
+  return point1[0] == point2[0] && point1[1] == point2[1] && point1[2] == point2[2];
+}
+
+// Checks the filter results against the expected component label of
+// every input particle. The particles are on a grid of half the
+// inter-particle spacing, so every particle has its own data
+// structure voxel and is an internal particle; internal particles
+// are matched to input particles by their points. The component
+// index, the extracted components and the output (the particles of
+// the components with at least the component size threshold
+// particles) must agree with the labels, and particle IDs past the
+// last particle must have no component.
+bool CheckComponents( cipParticleConnectedComponentFilter* filter, vtkPolyData* input,
+                      const std::vector< unsigned int >& expectedLabels, const char* name )
+{
+  unsigned int numberOfParticles = static_cast< unsigned int >( input->GetNumberOfPoints() );
+
+  vtkPolyData* internal = filter->GetInternalInputPolyData();
+  if ( internal->GetNumberOfPoints() != input->GetNumberOfPoints() )
+    {
+    std::cout << "FAILED: " << name << ": wrong number of internal particles" << std::endl;
+    return false;
+    }
+
+  std::vector< unsigned int > labels( numberOfParticles, 0 );
+  std::vector< unsigned int > componentSizes( 1, 0 );
+  for ( unsigned int i=0; i<numberOfParticles; i++ )
+    {
+    unsigned int p = 0;
+    while ( p < numberOfParticles && !IsSamePoint( internal->GetPoint( i ), input->GetPoint( p ) ) )
+      {
+      p++;
+      }
+    if ( p == numberOfParticles )
+      {
+      std::cout << "FAILED: " << name << ": internal particle " << i << " is not an input particle" << std::endl;
+      return false;
+      }
+
+    labels[i] = expectedLabels[p];
+    if ( filter->GetComponentLabelFromParticleID( i ) != labels[i] )
+      {
+      std::cout << "FAILED: " << name << ": particle " << p << " has label " << filter->GetComponentLabelFromParticleID( i );
+      std::cout << " instead of " << labels[i] << std::endl;
+      return false;
+      }
+
+    if ( componentSizes.size() <= labels[i] )
+      {
+      componentSizes.resize( labels[i] + 1, 0 );
+      }
+    componentSizes[labels[i]]++;
+    }
+
+  unsigned int numberOfComponents = static_cast< unsigned int >( componentSizes.size() ) - 1;
+  if ( filter->GetNumberOfComponents() != numberOfComponents )
+    {
+    std::cout << "FAILED: " << name << ": " << filter->GetNumberOfComponents() << " components instead of ";
+    std::cout << numberOfComponents << std::endl;
+    return false;
+    }
+
+  vtkIdList* ids = vtkIdList::New();
+
+  bool passed = true;
+  for ( unsigned int c=1; c<=numberOfComponents && passed; c++ )
+    {
+    filter->GetComponentParticleIDs( c, ids );
+
+    vtkPolyData* component = filter->GetComponent( c );
+
+    if ( ids->GetNumberOfIds() != static_cast< vtkIdType >( componentSizes[c] ) ||
+         component->GetNumberOfPoints() != ids->GetNumberOfIds() )
+      {
+      std::cout << "FAILED: " << name << ": wrong size of component " << c << std::endl;
+      passed = false;
+      }
+
+    for ( vtkIdType k=0; k<ids->GetNumberOfIds() && passed; k++ )
+      {
+      vtkIdType id = ids->GetId( k );
+
+      if ( labels[id] != c || (k > 0 && ids->GetId( k-1 ) >= id) ||
+           !IsSamePoint( component->GetPoint( k ), internal->GetPoint( id ) ) ||
+           filter->GetComponentSizeFromParticleID( id ) != componentSizes[c] )
+        {
+        std::cout << "FAILED: " << name << ": particle " << k << " of component " << c << " differs" << std::endl;
+        passed = false;
+        }
+      }
+
+    component->Delete();
+    }
+
+  ids->Delete();
+
+  if ( !passed )
+    {
+    return false;
+    }
+
+  // The output particles are the internal particles of the large
+  // enough components, in order
+  vtkPolyData* output = filter->GetOutput();
+
+  vtkIdType o = 0;
+  for ( unsigned int i=0; i<numberOfParticles; i++ )
+    {
+    if ( componentSizes[labels[i]] < filter->GetComponentSizeThreshold() )
+      {
+      continue;
+      }
+
+    if ( o >= output->GetNumberOfPoints() || !IsSamePoint( output->GetPoint( o ), internal->GetPoint( i ) ) ||
+         output->GetPointData()->GetArray( "unmergedComponents" )->GetTuple( o )[0] != labels[i] )
+      {
+      std::cout << "FAILED: " << name << ": wrong output particle " << o << std::endl;
+      return false;
+      }
+    o++;
+    }
+
+  if ( output->GetNumberOfPoints() != o || filter->GetNumberOfOutputParticles() != static_cast< unsigned int >( o ) )
+    {
+    std::cout << "FAILED: " << name << ": " << output->GetNumberOfPoints() << " output particles instead of " << o << std::endl;
+    return false;
+    }
+
+  if ( filter->GetComponentLabelFromParticleID( numberOfParticles ) != 0 ||
+       filter->GetComponentSizeFromParticleID( numberOfParticles ) != 0 )
+    {
+    std::cout << "FAILED: " << name << ": wrong component of an out of range particle ID" << std::endl;
+    return false;
+    }
+
+  return true;
+}
+
+int main( int argc, char* argv[] )
+{
+  // The particles are 1 mm apart along their structures, and the data
+  // structure spacing is half the inter-particle spacing. Components
+  // are labeled in the raster order (x fastest, then y, then z) of
+  // their first particle. The direction that a filter does not use is
+  // set across the one it uses, so that using the wrong one changes
+  // the components.
+  const double interParticleSpacing = 1.0;
+
+  const double xAxis[3] = { 1.0, 0.0, 0.0 };
+  const double yAxis[3] = { 0.0, 1.0, 0.0 };
+  const double zAxis[3] = { 0.0, 0.0, 1.0 };
+
+  //
+  // Airway particles directed along x:
+  //  - A: 8 particles of scale 2 from x=0 to x=7 at y=0
+  //  - B: 4 particles of scale 4 from x=8 to x=11 at y=0, in line with
+  //    A but with a scale ratio above the threshold
+  //  - C: 8 particles of scale 2 from x=0 to x=7 at y=1, next to A but
+  //    across the airway direction
+  //  - D: a single particle at (5, 4, 0)
+  // D is below the component size threshold of 3. With a maximum
+  // component size of 3, the lines are cut every third particle.
+  //
+  PARTICLES airways = GetEmptyParticles();
+  AddLine( &airways, 0.0, 0.0, 0.0, xAxis, 8, 2.0f, zAxis, xAxis );
+  AddLine( &airways, 8.0, 0.0, 0.0, xAxis, 4, 4.0f, zAxis, xAxis );
+  AddLine( &airways, 0.0, 1.0, 0.0, xAxis, 8, 2.0f, zAxis, xAxis );
+  AddLine( &airways, 5.0, 4.0, 0.0, xAxis, 1, 2.0f, zAxis, xAxis );
+
+  const unsigned int airwayLabels[2][21] = { { 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3, 4 },
+                                             { 1, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4, 5, 6, 6, 6, 7, 7, 7, 8, 8, 9 } };
+  const unsigned int maximumComponentSizes[2] = { 1000, 3 };
+
+  for ( unsigned int a=0; a<2; a++ )
+    {
+    cipAirwayParticleConnectedComponentFilter airwayFilter;
+      airwayFilter.SetInterParticleSpacing( interParticleSpacing );
+      airwayFilter.SetParticleDistanceThreshold( 1.5 );
+      airwayFilter.SetParticleAngleThreshold( 20.0 );
+      airwayFilter.SetScaleRatioThreshold( 0.25 );
+      airwayFilter.SetComponentSizeThreshold( 3 );
+      airwayFilter.SetMaximumComponentSize( maximumComponentSizes[a] );
+      airwayFilter.SetInput( airways.polyData );
+      airwayFilter.Update();
+
+    if ( !CheckComponents( &airwayFilter, airways.polyData,
+                           std::vector< unsigned int >( airwayLabels[a], airwayLabels[a] + 21 ), "airways" ) )
+      {
+      return 1;
+      }
+    }
+
+  //
+  // Vessel particles along an L: E has 6 particles from x=0 to x=5 at
+  // y=0 directed along x, and F has 5 particles from y=1 to y=5 at
+  // x=6 directed along y. The vector between the corner particles is
+  // at 45 degrees to both directions, so E and F are connected with
+  // an angle threshold of 50 degrees but not of 30 degrees; F is then
+  // below the component size threshold of 6. No particles are
+  // connected when they are below the minimum allowable scale.
+  //
+  PARTICLES vessels = GetEmptyParticles();
+  AddLine( &vessels, 0.0, 0.0, 0.0, xAxis, 6, 1.0f, xAxis, zAxis );
+  AddLine( &vessels, 6.0, 1.0, 0.0, yAxis, 5, 1.0f, yAxis, zAxis );
+
+  const unsigned int vesselLabels[3][11] = { { 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2 },
+                                             { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+                                             { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 } };
+  const double angleThresholds[3] = { 30.0, 50.0, 50.0 };
+  const double minimumScales[3]   = { 0.0, 0.0, 1.5 };
+
+  for ( unsigned int v=0; v<3; v++ )
+    {
+    cipVesselParticleConnectedComponentFilter vesselFilter;
+      vesselFilter.SetInterParticleSpacing( interParticleSpacing );
+      vesselFilter.SetParticleDistanceThreshold( 1.5 );
+      vesselFilter.SetParticleAngleThreshold( angleThresholds[v] );
+      vesselFilter.SetMinimumAllowableScale( minimumScales[v] );
+      vesselFilter.SetComponentSizeThreshold( 6 );
+      vesselFilter.SetInput( vessels.polyData );
+      vesselFilter.Update();
+
+    if ( !CheckComponents( &vesselFilter, vessels.polyData,
+                           std::vector< unsigned int >( vesselLabels[v], vesselLabels[v] + 11 ), "vessels" ) )
+      {
+      return 1;
+      }
+    }
+
+  //
+  // Fissure particles on two 4x4 patches in the planes z=0 and z=1,
+  // with normals along z. The particles of a patch are connected
+  // within the plane, but the vectors between the patches are at most
+  // 55 degrees from the normals, below the default angle threshold of
+  // 70 degrees, so the patches are separate components although they
+  // are only 1 mm apart. The last particle, at (4, 0, 0) with its
+  // normal along x, is in the plane of the first patch but the patch
+  // is not in its plane, so it is a component of its own.
+  //
+  PARTICLES fissures = GetEmptyParticles();
+  for ( unsigned int z=0; z<2; z++ )
+    {
+    for ( unsigned int y=0; y<4; y++ )
+      {
+      AddLine( &fissures, 0.0, double( y ), double( z ), xAxis, 4, 1.0f, xAxis, zAxis );
+      }
+    }
+  AddLine( &fissures, 4.0, 0.0, 0.0, xAxis, 1, 1.0f, zAxis, xAxis );
+
+  std::vector< unsigned int > fissureLabels( 33, 1 );
+  std::fill( fissureLabels.begin() + 16, fissureLabels.end(), 3 );
+  fissureLabels[32] = 2;
+
+  cipFissureParticleConnectedComponentFilter fissureFilter;
+    fissureFilter.SetInterParticleSpacing( interParticleSpacing );
+    fissureFilter.SetInput( fissures.polyData );
+    fissureFilter.Update();
+
+  if ( !CheckComponents( &fissureFilter, fissures.polyData, fissureLabels, "fissures" ) )
+    {
+    return 1;
+    }
+
+  DeleteParticles( &airways );
+  DeleteParticles( &vessels );
+  DeleteParticles( &fissures );
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
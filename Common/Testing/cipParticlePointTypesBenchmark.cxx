@@ -0,0 +1,142 @@
+/**
+ *  Times the particle computations of cipHelper with 'cip::PointType'
+ *  and with the fixed size 'cip::Point3'. The optional argument is the
+ *  number of particles (1000 by default). This program is not run by
+ *  ctest: the timings depend on the machine and the build type, and
+ *  cipHelperTEST already checks that both types give the same results.
+ */
+
+#include "cipHelper.h"
+#include "cipTestingHelper.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+
+int main( int argc, char* argv[] )
+{
+  unsigned int numberOfParticles = 1000;
+  if ( argc > 1 )
+    {
+    numberOfParticles = static_cast< unsigned int >( std::atoi( argv[1] ) );
+    }
+  if ( numberOfParticles < 50 )
+    {
+    std::cerr << "At least 50 particles are needed" << std::endl;
+    return 1;
+    }
+
+  const double angleSigma = 1.0;
+
+  unsigned int seed = 1;
+  std::vector< double > positions( 3*numberOfParticles );
+  std::vector< double > directions( 3*numberOfParticles );
+  for ( unsigned int i=0; i<3*numberOfParticles; i++ )
+    {
+    positions[i]  = 20.0*GetRandomNumber( seed );
+    directions[i] = GetRandomNumber( seed ) - 0.5;
+    }
+
+  // Edge weights of all the particle pairs, computed as in
+  // 'GetParticleGraphEdges'
+  double vectorTypeWeightSum = 0.0;
+  std::clock_t start = std::clock();
+  for ( unsigned int i=0; i<numberOfParticles; i++ )
+    {
+    for ( unsigned int j=i+1; j<numberOfParticles; j++ )
+      {
+      cip::VectorType connectingVec( 3 );
+      cip::VectorType vec1( 3 );
+      cip::VectorType vec2( 3 );
+      for ( unsigned int d=0; d<3; d++ )
+        {
+        connectingVec[d] = positions[3*i + d] - positions[3*j + d];
+        vec1[d] = directions[3*i + d];
+        vec2[d] = directions[3*j + d];
+        }
+
+      double angle = std::min( cip::GetAngleBetweenVectors( vec1, connectingVec, true ),
+                               cip::GetAngleBetweenVectors( vec2, connectingVec, true ) );
+
+      vectorTypeWeightSum += cip::GetVectorMagnitude( connectingVec )*(1.0 + std::exp( -std::pow( (90.0 - angle)/angleSigma, 2 ) ));
+      }
+    }
+  double vectorTypeWeightTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  double vector3WeightSum = 0.0;
+  start = std::clock();
+  for ( unsigned int i=0; i<numberOfParticles; i++ )
+    {
+    for ( unsigned int j=i+1; j<numberOfParticles; j++ )
+      {
+      cip::Vector3 connectingVec = cip::Vector3( &positions[3*i] ) - cip::Vector3( &positions[3*j] );
+      cip::Vector3 vec1( &directions[3*i] );
+      cip::Vector3 vec2( &directions[3*j] );
+
+      double angle = std::min( cip::GetAngleBetweenVectors( vec1, connectingVec, true ),
+                               cip::GetAngleBetweenVectors( vec2, connectingVec, true ) );
+
+      vector3WeightSum += cip::GetVectorMagnitude( connectingVec )*(1.0 + std::exp( -std::pow( (90.0 - angle)/angleSigma, 2 ) ));
+      }
+    }
+  double vector3WeightTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  // Distances and closest points of the particles to a TPS surface
+  std::vector< cip::PointType > surfacePoints;
+  for ( unsigned int i=0; i<50; i++ )
+    {
+    surfacePoints.push_back( cip::PointType( &positions[3*i], &positions[3*i] + 3 ) );
+    surfacePoints.back()[2] = 10.0 + std::sin( surfacePoints.back()[0]/4.0 ) + surfacePoints.back()[1]/10.0;
+    }
+  cipThinPlateSplineSurface surface( surfacePoints );
+
+  std::vector< cip::PointType > particles;
+  std::vector< cip::Point3 >    fixedParticles;
+  for ( unsigned int i=0; i<numberOfParticles; i++ )
+    {
+    particles.push_back( cip::PointType( &positions[3*i], &positions[3*i] + 3 ) );
+    fixedParticles.push_back( cip::Point3( &positions[3*i] ) );
+    }
+
+  double pointTypeDistanceSum = 0.0;
+  start = std::clock();
+  for ( unsigned int i=0; i<numberOfParticles; i++ )
+    {
+    pointTypeDistanceSum += cip::GetDistanceToThinPlateSplineSurface( surface, particles[i] );
+    }
+  double pointTypeDistanceTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  double point3DistanceSum = 0.0;
+  start = std::clock();
+  for ( unsigned int i=0; i<numberOfParticles; i++ )
+    {
+    point3DistanceSum += cip::GetDistanceToThinPlateSplineSurface( surface, fixedParticles[i] );
+    }
+  double point3DistanceTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  std::vector< cip::PointType > closestPoints;
+  std::vector< double >         batchDistances;
+  start = std::clock();
+  cip::GetClosestPointsOnThinPlateSplineSurface( surface, particles, closestPoints, batchDistances, 1 );
+  double pointTypeBatchTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  std::vector< cip::Point3 > fixedClosestPoints;
+  std::vector< double >      fixedBatchDistances;
+  start = std::clock();
+  cip::GetClosestPointsOnThinPlateSplineSurface( surface, fixedParticles, fixedClosestPoints, fixedBatchDistances, 1 );
+  double point3BatchTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  // The sums are printed so that the loops are not optimized away
+  std::cout << numberOfParticles << " particles" << std::endl;
+  std::cout << "Particle pair edge weights (PointType / Point3):      ";
+  std::cout << vectorTypeWeightTime << " s / " << vector3WeightTime << " s";
+  std::cout << " (sums " << vectorTypeWeightSum << " / " << vector3WeightSum << ")" << std::endl;
+  std::cout << "Particle to TPS distances (PointType / Point3):       ";
+  std::cout << pointTypeDistanceTime << " s / " << point3DistanceTime << " s";
+  std::cout << " (sums " << pointTypeDistanceSum << " / " << point3DistanceSum << ")" << std::endl;
+  std::cout << "Batch TPS closest points (PointType / Point3):        ";
+  std::cout << pointTypeBatchTime << " s / " << point3BatchTime << " s" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,402 @@
+#include "cipSphereStencil.h"
+#include "cipCylinderStencil.h"
+#include "cipParticlesToStenciledLabelMapImageFilter.h"
+#include "cipHelper.h"
+#include "cipTestingHelper.h"
+#include "vtkPolyData.h"
+#include "vtkPoints.h"
+#include "vtkPointData.h"
+#include "vtkFloatArray.h"
+#include <cmath>
+#include <iostream>
+
+typedef cipParticlesToStenciledLabelMapImageFilter< cip::LabelMapType > StenciledLabelMapType;
+
+// Compares the scanline extents of the stencil against its pattern
+// test on the rows of a grid of points with the specified step,
+// spanning the bounding box of the pattern and beyond. Every grid
+// point inside the pattern must be within the extent widened to the
+// neighbouring grid points, as the filter widens it, and every grid
+// point well within the extent must be inside the pattern.
+bool CheckScanlineExtents( const cipStencil& stencil, const double center[3], double halfWidth, double step )
+{
+  double direction[3] = { step, 0.0, 0.0 };
+  int numberOfSteps = static_cast< int >( std::ceil( 2.0*halfWidth/step ) ) + 1;
+
+  double point[3];
+  double rowStart[3];
+  double tMin, tMax;
+
+  for ( int k=0; k<numberOfSteps; k++ )
+    {
+    for ( int j=0; j<numberOfSteps; j++ )
+      {
+      rowStart[0] = std::floor( center[0] - halfWidth );
+      rowStart[1] = std::floor( center[1] - halfWidth ) + double( j )*step;
+      rowStart[2] = std::floor( center[2] - halfWidth ) + double( k )*step;
+
+      bool hasExtent = stencil.GetScanlineExtent( rowStart, direction, &tMin, &tMax );
+
+      for ( int i=0; i<numberOfSteps; i++ )
+        {
+        point[0] = rowStart[0] + double( i )*step;
+        point[1] = rowStart[1];
+        point[2] = rowStart[2];
+
+        if ( stencil.IsInsideStencilPattern( point[0], point[1], point[2] ) )
+          {
+          if ( !hasExtent || double( i ) < std::floor( tMin ) || double( i ) > std::ceil( tMax ) )
+            {
+            std::cout << "Point (" << point[0] << ", " << point[1] << ", " << point[2];
+            std::cout << ") inside the pattern but not within the scanline extent" << std::endl;
+            return false;
+            }
+          }
+        else if ( hasExtent && double( i ) > tMin + 1e-6 && double( i ) < tMax - 1e-6 )
+          {
+          std::cout << "Point (" << point[0] << ", " << point[1] << ", " << point[2];
+          std::cout << ") within the scanline extent but outside the pattern" << std::endl;
+          return false;
+          }
+        }
+      }
+    }
+
+  return true;
+}
+
+
+// Checks that a clone has the same pattern and bounding box as the
+// original, around the specified center
+bool CheckClone( const cipStencil& stencil, const cipStencil& clone, const double center[3], double halfWidth )
+{
+  double bbMin[3], bbMax[3], cloneBBMin[3], cloneBBMax[3];
+  stencil.GetStencilBoundingBox( bbMin, bbMax );
+  clone.GetStencilBoundingBox( cloneBBMin, cloneBBMax );
+
+  for ( unsigned int d=0; d<3; d++ )
+    {
+    if ( bbMin[d] != cloneBBMin[d] || bbMax[d] != cloneBBMax[d] )
+      {
+      return false;
+      }
+    }
+
+  for ( double z=center[2]-halfWidth; z<=center[2]+halfWidth; z += 0.5 )
+    {
+    for ( double y=center[1]-halfWidth; y<=center[1]+halfWidth; y += 0.5 )
+      {
+      for ( double x=center[0]-halfWidth; x<=center[0]+halfWidth; x += 0.5 )
+        {
+        if ( stencil.IsInsideStencilPattern( x, y, z ) != clone.IsInsideStencilPattern( x, y, z ) )
+          {
+          return false;
+          }
+        }
+      }
+    }
+
+  return true;
+}
+
+
+// The label map as the filter computed it before the rows were
+// filled from the scanline extents: every voxel of the bounding box
+// region of every particle is tested against the stencil pattern. It
+// is used as reference for the filter output.
+cip::LabelMapType::Pointer GetReferenceLabelMap( cip::LabelMapType::Pointer labelMap, vtkSmartPointer< vtkPolyData > particles,
+                                                 cipStencil* stencil, unsigned short foregroundLabel )
+{
+  cip::LabelMapType::Pointer referenceLabelMap = cip::LabelMapType::New();
+    referenceLabelMap->SetRegions( labelMap->GetBufferedRegion() );
+    referenceLabelMap->SetSpacing( labelMap->GetSpacing() );
+    referenceLabelMap->SetOrigin( labelMap->GetOrigin() );
+    referenceLabelMap->Allocate();
+    referenceLabelMap->FillBuffer( 0 );
+
+  cip::LabelMapType::SizeType size = labelMap->GetBufferedRegion().GetSize();
+
+  vtkDataArray* orientationArray = particles->GetPointData()->GetArray( "hevec0" );
+  vtkDataArray* scaleArray       = particles->GetPointData()->GetArray( "scale" );
+
+  double center[3];
+  double orientation[3];
+  double bbMin[3], bbMax[3];
+
+  cip::LabelMapType::PointType point;
+  cip::LabelMapType::IndexType startIndex, endIndex, index;
+
+  for ( unsigned int i=0; i<particles->GetNumberOfPoints(); i++ )
+    {
+    particles->GetPoint( i, center );
+    orientationArray->GetTuple( i, orientation );
+
+    stencil->SetCenter( center[0], center[1], center[2] );
+    stencil->SetOrientation( orientation[0], orientation[1], orientation[2] );
+    stencil->SetRadius( std::sqrt( 2.0 )*std::sqrt( std::pow( scaleArray->GetTuple1( i ), 2 ) ) );
+    stencil->GetStencilBoundingBox( bbMin, bbMax );
+
+    point[0] = bbMin[0];  point[1] = bbMin[1];  point[2] = bbMin[2];
+    labelMap->TransformPhysicalPointToIndex( point, startIndex );
+
+    point[0] = bbMax[0];  point[1] = bbMax[1];  point[2] = bbMax[2];
+    labelMap->TransformPhysicalPointToIndex( point, endIndex );
+
+    for ( unsigned int d=0; d<3; d++ )
+      {
+      startIndex[d] >= static_cast< long >( size[d] ) ? startIndex[d] = size[d]-1 : false;
+      endIndex[d]   >= static_cast< long >( size[d] ) ? endIndex[d]   = size[d]-1 : false;
+
+      startIndex[d] < 0 ? startIndex[d] = 0 : false;
+      endIndex[d]   < 0 ? endIndex[d]   = 0 : false;
+      }
+
+    for ( index[2]=startIndex[2]; index[2]<=endIndex[2]; index[2]++ )
+      {
+      for ( index[1]=startIndex[1]; index[1]<=endIndex[1]; index[1]++ )
+        {
+        for ( index[0]=startIndex[0]; index[0]<=endIndex[0]; index[0]++ )
+          {
+          referenceLabelMap->TransformIndexToPhysicalPoint( index, point );
+          if ( stencil->IsInsideStencilPattern( point[0], point[1], point[2] ) )
+            {
+            referenceLabelMap->SetPixel( index, foregroundLabel );
+            }
+          }
+        }
+      }
+    }
+
+  return referenceLabelMap;
+}
+
+
+int main( int argc, char* argv[] )
+{
+  // Sphere and oblique cylinder patterns centered on and off the
+  // grid. Squared radii that are whole numbers put grid points on the
+  // surface of the patterns, and rows tangent to them.
+  const double centers[3][3] = { { 0.0, 0.0, 0.0 }, { 0.5, -1.0, 2.0 }, { 0.31, 1.77, -2.45 } };
+
+  std::cout << "Testing scanline extents..." << std::endl;
+  for ( unsigned int c=0; c<3; c++ )
+    {
+    for ( unsigned int k=1; k<=20; k++ )
+      {
+      double radius = std::sqrt( double( k ) );
+
+      cipSphereStencil sphereStencil;
+        sphereStencil.SetRadius( radius );
+        sphereStencil.SetCenter( centers[c][0], centers[c][1], centers[c][2] );
+
+      cipCylinderStencil cylinderStencil;
+        cylinderStencil.SetRadius( radius );
+        cylinderStencil.SetHeight( 2.0*radius + 1.0 );
+        cylinderStencil.SetOrientation( 1.0, 2.0, 2.0 );
+        cylinderStencil.SetCenter( centers[c][0], centers[c][1], centers[c][2] );
+
+      for ( double step=1.0; step>=0.5; step -= 0.5 )
+        {
+        if ( !CheckScanlineExtents( sphereStencil, centers[c], radius + 2.0, step ) )
+          {
+          std::cout << "FAILED: sphere of radius " << radius << std::endl;
+          return 1;
+          }
+        if ( !CheckScanlineExtents( cylinderStencil, centers[c], 2.0*radius + 2.0, step ) )
+          {
+          std::cout << "FAILED: cylinder of radius " << radius << std::endl;
+          return 1;
+          }
+        }
+      }
+    }
+
+  // Spheres through a grid point, with the rows through it tangent
+  // to them. The discriminant of these rows can be slightly negative
+  // from rounding.
+  for ( unsigned int j=1; j<40; j++ )
+    {
+    for ( unsigned int k=1; k<40; k++ )
+      {
+      double center[3] = { 0.0, 0.1*double( j ), 0.07*double( k ) };
+      double radius    = std::sqrt( std::pow( center[1], 2 ) + std::pow( center[2], 2 ) );
+
+      cipSphereStencil sphereStencil;
+        sphereStencil.SetRadius( radius );
+        sphereStencil.SetCenter( center[0], center[1], center[2] );
+
+      if ( !CheckScanlineExtents( sphereStencil, center, radius + 2.0, 1.0 ) )
+        {
+        std::cout << "FAILED: sphere tangent to the grid rows" << std::endl;
+        return 1;
+        }
+      }
+    }
+
+  // A clone matches the original, and is not affected when the
+  // original is set up elsewhere
+  std::cout << "Testing stencil clones..." << std::endl;
+  const double cloneCenter[3] = { 0.3, 0.2, 0.1 };
+
+  cipCylinderStencil cylinderStencil;
+    cylinderStencil.SetRadius( 2.5 );
+    cylinderStencil.SetHeight( 4.0 );
+    cylinderStencil.SetOrientation( 1.0, 2.0, 2.0 );
+    cylinderStencil.SetCenter( cloneCenter[0], cloneCenter[1], cloneCenter[2] );
+
+  cipSphereStencil sphereStencil;
+    sphereStencil.SetRadius( 2.5 );
+    sphereStencil.SetCenter( cloneCenter[0], cloneCenter[1], cloneCenter[2] );
+
+  cipStencil* cylinderClone = cylinderStencil.Clone();
+  cipStencil* sphereClone   = sphereStencil.Clone();
+
+  bool clonesMatch = CheckClone( cylinderStencil, *cylinderClone, cloneCenter, 5.0 ) &&
+    CheckClone( sphereStencil, *sphereClone, cloneCenter, 5.0 );
+
+  cipCylinderStencil movedCylinderStencil;
+    movedCylinderStencil.SetRadius( 2.5 );
+    movedCylinderStencil.SetHeight( 4.0 );
+    movedCylinderStencil.SetOrientation( 1.0, 2.0, 2.0 );
+    movedCylinderStencil.SetCenter( cloneCenter[0], cloneCenter[1], cloneCenter[2] );
+
+  cipSphereStencil movedSphereStencil;
+    movedSphereStencil.SetRadius( 2.5 );
+    movedSphereStencil.SetCenter( cloneCenter[0], cloneCenter[1], cloneCenter[2] );
+
+  cipStencil* movedCylinderClone = movedCylinderStencil.Clone();
+  cipStencil* movedSphereClone   = movedSphereStencil.Clone();
+
+  movedCylinderStencil.SetCenter( 4.0, 4.0, 4.0 );
+  movedCylinderStencil.SetOrientation( 0.0, 0.0, 1.0 );
+  movedCylinderStencil.SetRadius( 1.0 );
+  movedSphereStencil.SetCenter( 4.0, 4.0, 4.0 );
+  movedSphereStencil.SetRadius( 1.0 );
+
+  clonesMatch = clonesMatch && CheckClone( cylinderStencil, *movedCylinderClone, cloneCenter, 5.0 ) &&
+    CheckClone( sphereStencil, *movedSphereClone, cloneCenter, 5.0 );
+
+  delete cylinderClone;
+  delete sphereClone;
+  delete movedCylinderClone;
+  delete movedSphereClone;
+
+  if ( !clonesMatch )
+    {
+    std::cout << "FAILED: clone differs from the original stencil" << std::endl;
+    return 1;
+    }
+
+  // Vessel particles at random positions and orientations, with
+  // random scales, rasterized with cylinders in an image with
+  // anisotropic spacing. The output must not depend on the number of
+  // threads or on the slab size, and must match the voxel by voxel
+  // reference.
+  std::cout << "Testing the stenciled label map filter..." << std::endl;
+  cip::LabelMapType::SizeType size;
+    size[0] = 40;
+    size[1] = 36;
+    size[2] = 30;
+
+  cip::LabelMapType::SpacingType spacing;
+    spacing[0] = 0.7;
+    spacing[1] = 0.8;
+    spacing[2] = 1.25;
+
+  cip::LabelMapType::PointType origin;
+    origin[0] = -3.0;
+    origin[1] = 2.0;
+    origin[2] = -10.0;
+
+  cip::LabelMapType::Pointer labelMap = cip::LabelMapType::New();
+    labelMap->SetRegions( size );
+    labelMap->SetSpacing( spacing );
+    labelMap->SetOrigin( origin );
+    labelMap->Allocate();
+    labelMap->FillBuffer( 0 );
+
+  unsigned int seed = 1;
+
+  vtkSmartPointer< vtkPoints > points = vtkSmartPointer< vtkPoints >::New();
+
+  vtkSmartPointer< vtkFloatArray > orientations = vtkSmartPointer< vtkFloatArray >::New();
+    orientations->SetNumberOfComponents( 3 );
+    orientations->SetName( "hevec0" );
+
+  vtkSmartPointer< vtkFloatArray > scales = vtkSmartPointer< vtkFloatArray >::New();
+    scales->SetNumberOfComponents( 1 );
+    scales->SetName( "scale" );
+
+  for ( unsigned int i=0; i<60; i++ )
+    {
+    double point[3];
+    double orientation[3];
+    for ( unsigned int d=0; d<3; d++ )
+      {
+      point[d]       = origin[d] + (double( size[d] ) + 4.0)*spacing[d]*GetRandomNumber( seed ) - 2.0*spacing[d];
+      orientation[d] = GetRandomNumber( seed ) - 0.5;
+      }
+    points->InsertNextPoint( point );
+    orientations->InsertNextTuple( orientation );
+    scales->InsertNextTuple1( 1.0 + 4.0*GetRandomNumber( seed ) );
+    }
+
+  vtkSmartPointer< vtkPolyData > particles = vtkSmartPointer< vtkPolyData >::New();
+    particles->SetPoints( points );
+    particles->GetPointData()->AddArray( orientations );
+    particles->GetPointData()->AddArray( scales );
+
+  const cip::ChestConventions& conventions = cip::ChestConventions::GetInstance();
+  unsigned short foregroundLabel =
+    conventions.GetValueFromChestRegionAndType( (unsigned char)(cip::UNDEFINEDREGION), (unsigned char)(cip::VESSEL) );
+
+  cipCylinderStencil referenceStencil;
+    referenceStencil.SetHeight( 3.0 );
+
+  cip::LabelMapType::Pointer referenceLabelMap = GetReferenceLabelMap( labelMap, particles, &referenceStencil, foregroundLabel );
+
+  const unsigned int runs[3][2] = { { 1, 1 }, { 3, 4 }, { 2, 100 } };
+  for ( unsigned int r=0; r<3; r++ )
+    {
+    cipCylinderStencil stencil;
+      stencil.SetHeight( 3.0 );
+
+    StenciledLabelMapType::Pointer filter = StenciledLabelMapType::New();
+      filter->SetInput( labelMap );
+      filter->SetStencil( &stencil );
+      filter->SetChestParticleType( cip::VESSEL );
+      filter->SetScaleStencilPatternByParticleScale( true );
+      filter->SetCTPointSpreadFunctionSigma( 0.0 );
+      filter->SetParticlesData( particles );
+      filter->SetNumberOfThreads( runs[r][0] );
+      filter->SetNumberOfSlicesPerSlab( runs[r][1] );
+      filter->Update();
+
+    const unsigned short* outputBuffer    = filter->GetOutput()->GetBufferPointer();
+    const unsigned short* referenceBuffer = referenceLabelMap->GetBufferPointer();
+
+    unsigned int numberOfForegroundVoxels = 0;
+    for ( unsigned int i=0; i<size[0]*size[1]*size[2]; i++ )
+      {
+      if ( outputBuffer[i] != referenceBuffer[i] )
+        {
+        std::cout << "FAILED: output differs from the reference with " << runs[r][0] << " threads and ";
+        std::cout << runs[r][1] << " slices per slab" << std::endl;
+        return 1;
+        }
+      if ( referenceBuffer[i] != 0 )
+        {
+        numberOfForegroundVoxels++;
+        }
+      }
+
+    if ( numberOfForegroundVoxels == 0 )
+      {
+      std::cout << "FAILED: empty output" << std::endl;
+      return 1;
+      }
+    }
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
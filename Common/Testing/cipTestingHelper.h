@@ -0,0 +1,17 @@
+/**
+ *  Helpers shared by the tests and benchmarks in this directory.
+ */
+
+#ifndef __cipTestingHelper_h
+#define __cipTestingHelper_h
+
+// Simple linear congruential generator so that the test data do not
+// depend on the platform's 'rand'. Returns a number in [0, 1) and
+// advances 'seed'.
+inline double GetRandomNumber( unsigned int& seed )
+{
+  seed = 1664525*seed + 1013904223;
+  return double( seed >> 8 )/double( 1 << 24 );
+}
+
+#endif
@@ -0,0 +1,421 @@
+#include "cipThinPlateSplineSurface.h"
+#include "cipHelper.h"
+#include "cipTestingHelper.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <iostream>
+
+cip::PointType GetRandomPoint( unsigned int& seed )
+{
+  cip::PointType point(3);
+    point[0] = 100.0*GetRandomNumber( seed );
+    point[1] = 80.0*GetRandomNumber( seed );
+    point[2] = std::sin( point[0]/10.0 ) + point[1]/20.0 + 0.1*GetRandomNumber( seed );
+
+  return point;
+}
+
+// Largest difference between the TPS vectors of two surfaces,
+// relative to the magnitude of the vectors
+double GetTPSVectorsDifference( const cipThinPlateSplineSurface& surface1, const cipThinPlateSplineSurface& surface2 )
+{
+  double difference = 0.0;
+  double magnitude  = 1.0;
+
+  for ( unsigned int i=0; i<surface1.GetWVector().size(); i++ )
+    {
+    difference = std::max( difference, std::abs( surface1.GetWVector()[i] - surface2.GetWVector()[i] ) );
+    magnitude  = std::max( magnitude, std::abs( surface1.GetWVector()[i] ) );
+    }
+  for ( unsigned int i=0; i<3; i++ )
+    {
+    difference = std::max( difference, std::abs( surface1.GetAVector()[i] - surface2.GetAVector()[i] ) );
+    magnitude  = std::max( magnitude, std::abs( surface1.GetAVector()[i] ) );
+    }
+
+  return difference/magnitude;
+}
+
+int main( int argc, char* argv[] )
+{
+  const double tolerance = 1e-8;
+
+  unsigned int seed = 1;
+
+  std::vector< cip::PointType > points;
+  std::vector< double > weights;
+  for ( unsigned int i=0; i<50; i++ )
+    {
+    points.push_back( GetRandomPoint( seed ) );
+    weights.push_back( 0.1 + GetRandomNumber( seed ) );
+    }
+
+  // Without smoothing the surface interpolates the points, and the
+  // w vector is orthogonal to the affine functions
+  cipThinPlateSplineSurface surface( points );
+
+  double wSum  = 0.0;
+  double wxSum = 0.0;
+  double wySum = 0.0;
+  for ( unsigned int i=0; i<points.size(); i++ )
+    {
+    if ( std::abs( surface.GetSurfaceHeight( points[i][0], points[i][1] ) - points[i][2] ) > 1e-6 )
+      {
+      std::cout << "FAILED: surface does not interpolate point " << i << std::endl;
+      return 1;
+      }
+    wSum  += surface.GetWVector()[i];
+    wxSum += surface.GetWVector()[i]*points[i][0];
+    wySum += surface.GetWVector()[i]*points[i][1];
+    }
+  if ( std::abs( wSum ) > 1e-8 || std::abs( wxSum ) > 1e-6 || std::abs( wySum ) > 1e-6 )
+    {
+    std::cout << "FAILED: w vector does not satisfy the affine constraints" << std::endl;
+    return 1;
+    }
+
+  // Changing lambda on a copy must not affect the original
+  cipThinPlateSplineSurface copy( surface );
+    copy.SetLambda( 0.5 );
+
+  if ( std::abs( surface.GetSurfaceHeight( points[0][0], points[0][1] ) - points[0][2] ) > 1e-6 )
+    {
+    std::cout << "FAILED: copy modified the original surface" << std::endl;
+    return 1;
+    }
+
+  // Adding and removing points (with and without weights) must give
+  // the same TPS vectors as computing them from scratch
+  for ( unsigned int useWeights=0; useWeights<2; useWeights++ )
+    {
+    std::vector< cip::PointType > updatedPoints( points );
+    std::vector< double > updatedWeights( weights );
+
+    cipThinPlateSplineSurface updated;
+      updated.SetLambda( 0.5 );
+      updated.SetSurfacePoints( updatedPoints );
+    if ( useWeights )
+      {
+      updated.SetSurfacePointWeights( &updatedWeights );
+      }
+
+    std::vector< cip::PointType > newPoints;
+    std::vector< double > newWeights;
+    for ( unsigned int i=0; i<5; i++ )
+      {
+      newPoints.push_back( GetRandomPoint( seed ) );
+      newWeights.push_back( 0.1 + GetRandomNumber( seed ) );
+
+      updatedPoints.push_back( newPoints.back() );
+      updatedWeights.push_back( newWeights.back() );
+      }
+    updated.AddSurfacePoints( newPoints, &newWeights );
+
+    for ( unsigned int i=0; i<10; i++ )
+      {
+      unsigned int index = static_cast< unsigned int >( GetRandomNumber( seed )*updatedPoints.size() );
+
+      updated.RemoveSurfacePoint( index );
+      updatedPoints.erase( updatedPoints.begin() + index );
+      updatedWeights.erase( updatedWeights.begin() + index );
+      }
+
+    cipThinPlateSplineSurface reference;
+      reference.SetLambda( 0.5 );
+      reference.SetSurfacePoints( updatedPoints );
+    if ( useWeights )
+      {
+      reference.SetSurfacePointWeights( &updatedWeights );
+      }
+
+    if ( GetTPSVectorsDifference( updated, reference ) > tolerance )
+      {
+      std::cout << "FAILED: updated surface differs from recomputed surface" << std::endl;
+      return 1;
+      }
+
+    updated.SetLambda( 2.0 );
+    reference.SetLambda( 2.0 );
+    if ( GetTPSVectorsDifference( updated, reference ) > tolerance )
+      {
+      std::cout << "FAILED: updated surface differs from recomputed surface after lambda change" << std::endl;
+      return 1;
+      }
+
+    // The removed points are also gone from the input points, and the
+    // surface is evaluated from the remaining ones
+    if ( updated.GetControlPointIndices() != reference.GetControlPointIndices() )
+      {
+      std::cout << "FAILED: wrong control point indices after removing points" << std::endl;
+      return 1;
+      }
+
+    for ( unsigned int i=0; i<points.size(); i++ )
+      {
+      if ( std::abs( updated.GetSurfaceHeight( points[i][0], points[i][1] ) -
+                     reference.GetSurfaceHeight( points[i][0], points[i][1] ) ) > 1e-6 )
+        {
+        std::cout << "FAILED: updated surface height differs after removing points" << std::endl;
+        return 1;
+        }
+      }
+    }
+
+  // The batch evaluation must agree with the point-wise evaluation
+  double gridOrigin[2]     = { -5.0, -3.0 };
+  double gridSpacing[2]    = { 0.7, 0.6 };
+  unsigned int gridSize[2] = { 171, 150 };
+
+  std::vector< double > gridHeights( gridSize[0]*gridSize[1] );
+  surface.GetSurfaceHeightGrid( gridOrigin, gridSpacing, gridSize, &gridHeights[0] );
+
+  std::vector< double > queryX;
+  std::vector< double > queryY;
+  for ( unsigned int j=0; j<gridSize[1]; j++ )
+    {
+    for ( unsigned int i=0; i<gridSize[0]; i++ )
+      {
+      double x = gridOrigin[0] + double( i )*gridSpacing[0];
+      double y = gridOrigin[1] + double( j )*gridSpacing[1];
+
+      if ( std::abs( gridHeights[j*gridSize[0] + i] - surface.GetSurfaceHeight( x, y ) ) > 1e-8 )
+        {
+        std::cout << "FAILED: grid height differs at " << i << " " << j << std::endl;
+        return 1;
+        }
+
+      queryX.push_back( x );
+      queryY.push_back( y );
+      }
+    }
+
+  std::vector< double > heights( queryX.size() );
+  std::vector< double > normalsX( queryX.size() );
+  std::vector< double > normalsY( queryX.size() );
+  std::vector< double > normalsZ( queryX.size() );
+  surface.GetSurfaceHeights( queryX.size(), &queryX[0], &queryY[0], &heights[0] );
+  surface.GetNonNormalizedSurfaceNormals( queryX.size(), &queryX[0], &queryY[0], &normalsX[0], &normalsY[0], &normalsZ[0] );
+
+  cip::VectorType normal(3);
+  for ( unsigned int i=0; i<queryX.size(); i++ )
+    {
+    surface.GetNonNormalizedSurfaceNormal( queryX[i], queryY[i], normal );
+
+    if ( std::abs( heights[i] - gridHeights[i] ) > 1e-8 || std::abs( normalsX[i] - normal[0] ) > 1e-8 ||
+         std::abs( normalsY[i] - normal[1] ) > 1e-8 || normalsZ[i] != normal[2] )
+      {
+      std::cout << "FAILED: batch evaluation differs at query " << i << std::endl;
+      return 1;
+      }
+    }
+
+  // The far-field approximation must stay within the requested error
+  // bound. The accuracy and the timings against the exact evaluation
+  // are reported (the timings are not checked, since they depend on
+  // the machine and the build type).
+  std::vector< cip::PointType > fissurePoints;
+  for ( unsigned int i=0; i<1500; i++ )
+    {
+    cip::PointType point = GetRandomPoint( seed );
+      point[0] *= 2.0;
+      point[1] *= 2.0;
+
+    fissurePoints.push_back( point );
+    }
+
+  cipThinPlateSplineSurface fissure( fissurePoints );
+    fissure.SetLambda( 0.1 );
+    fissure.SetNumberOfThreads( 1 );
+
+  double fissureOrigin[2]     = { 0.0, 0.0 };
+  double fissureSpacing[2]    = { 0.78, 0.63 };
+  unsigned int fissureSize[2] = { 256, 256 };
+
+  std::vector< double > exactHeights( fissureSize[0]*fissureSize[1] );
+  std::vector< double > approximateHeights( fissureSize[0]*fissureSize[1] );
+
+  std::clock_t start = std::clock();
+  fissure.GetSurfaceHeightGrid( fissureOrigin, fissureSpacing, fissureSize, &exactHeights[0] );
+  double exactTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+  std::cout << "Exact evaluation: " << exactTime << " s" << std::endl;
+
+  double approximationTolerances[3] = { 1e-2, 1e-4, 1e-6 };
+  for ( unsigned int t=0; t<3; t++ )
+    {
+    fissure.SetApproximationTolerance( approximationTolerances[t] );
+
+    start = std::clock();
+    fissure.GetSurfaceHeightGrid( fissureOrigin, fissureSpacing, fissureSize, &approximateHeights[0] );
+    double approximateTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+    double maxError = 0.0;
+    for ( unsigned int i=0; i<exactHeights.size(); i++ )
+      {
+      maxError = std::max( maxError, std::abs( exactHeights[i] - approximateHeights[i] ) );
+      }
+
+    std::cout << "Tolerance " << approximationTolerances[t] << ": max error " << maxError;
+    std::cout << ", " << approximateTime << " s" << std::endl;
+
+    if ( maxError > approximationTolerances[t] )
+      {
+      std::cout << "FAILED: approximation error exceeds the tolerance" << std::endl;
+      return 1;
+      }
+    }
+
+  // Closest point queries must not depend on the approximation
+  // tolerance: the optimizer values, derivatives and returned heights
+  // are all evaluated exactly
+  fissure.SetApproximationTolerance( 1e-2 );
+
+  cipThinPlateSplineSurface exactFissure( fissure );
+    exactFissure.SetApproximationTolerance( 0.0 );
+
+  std::vector< cip::PointType > fissureParticles;
+  for ( unsigned int i=0; i<100; i++ )
+    {
+    cip::PointType particle = fissurePoints[i];
+      particle[2] += 10.0*(GetRandomNumber( seed ) - 0.5);
+
+    fissureParticles.push_back( particle );
+    }
+
+  std::vector< cip::PointType > approximateClosestPoints;
+  std::vector< double > approximateDistances;
+  cip::GetClosestPointsOnThinPlateSplineSurface( fissure, fissureParticles, approximateClosestPoints, approximateDistances, 2 );
+
+  for ( unsigned int i=0; i<fissureParticles.size(); i++ )
+    {
+    cip::PointType closestPoint( 3 );
+    cip::PointType exactClosestPoint( 3 );
+    cip::GetClosestPointOnThinPlateSplineSurface( fissure, fissureParticles[i], closestPoint );
+    cip::GetClosestPointOnThinPlateSplineSurface( exactFissure, fissureParticles[i], exactClosestPoint );
+
+    for ( unsigned int j=0; j<3; j++ )
+      {
+      if ( std::abs( closestPoint[j] - exactClosestPoint[j] ) > 1e-10 )
+        {
+        std::cout << "FAILED: closest point depends on the approximation tolerance for particle " << i << std::endl;
+        return 1;
+        }
+      }
+
+    if ( std::abs( closestPoint[2] - exactFissure.GetExactSurfaceHeight( closestPoint[0], closestPoint[1] ) ) > 1e-10 ||
+         std::abs( approximateClosestPoints[i][2] -
+                   exactFissure.GetExactSurfaceHeight( approximateClosestPoints[i][0], approximateClosestPoints[i][1] ) ) > 1e-10 )
+      {
+      std::cout << "FAILED: closest point is not on the exact surface for particle " << i << std::endl;
+      return 1;
+      }
+    }
+
+  // The batch closest point search must agree with the single point
+  // search. The optimizer stops once the gradient magnitude of the
+  // squared distance is below 0.5, so the two searches can stop at
+  // slightly different points.
+  std::vector< cip::PointType > particles;
+  for ( unsigned int i=0; i<2000; i++ )
+    {
+    cip::PointType particle = GetRandomPoint( seed );
+      particle[2] += 10.0*(GetRandomNumber( seed ) - 0.5);
+
+    particles.push_back( particle );
+    }
+
+  for ( unsigned int numberOfThreads=1; numberOfThreads<=4; numberOfThreads += 3 )
+    {
+    std::vector< cip::PointType > closestPoints;
+    std::vector< double > distances;
+    cip::GetClosestPointsOnThinPlateSplineSurface( surface, particles, closestPoints, distances, numberOfThreads );
+
+    if ( closestPoints.size() != particles.size() || distances.size() != particles.size() )
+      {
+      std::cout << "FAILED: wrong number of closest points" << std::endl;
+      return 1;
+      }
+
+    for ( unsigned int i=0; i<particles.size(); i++ )
+      {
+      double singleDistance = cip::GetDistanceToThinPlateSplineSurface( surface, particles[i] );
+
+      double closestPointDistance = std::sqrt( std::pow( closestPoints[i][0] - particles[i][0], 2 ) +
+                                               std::pow( closestPoints[i][1] - particles[i][1], 2 ) +
+                                               std::pow( closestPoints[i][2] - particles[i][2], 2 ) );
+
+      if ( std::abs( distances[i] - singleDistance ) > 0.25 || std::abs( distances[i] - closestPointDistance ) > 1e-6 )
+        {
+        std::cout << "FAILED: batch distance differs for particle " << i << std::endl;
+        return 1;
+        }
+      }
+    }
+
+  // The number of control points is bounded in decimated mode
+  std::vector< cip::PointType > densePoints;
+  for ( unsigned int i=0; i<1000; i++ )
+    {
+    densePoints.push_back( GetRandomPoint( seed ) );
+    }
+
+  cipThinPlateSplineSurface decimated;
+    decimated.SetMaximumNumberOfControlPoints( 100 );
+    decimated.SetSurfacePoints( densePoints );
+
+  if ( decimated.GetNumberSurfacePoints() != 100 || decimated.GetControlPointIndices().size() != 100 )
+    {
+    std::cout << "FAILED: wrong number of control points" << std::endl;
+    return 1;
+    }
+
+  // Removing a control point also removes it from the input points, so
+  // weights given for the remaining input points are matched to the
+  // remaining control points
+  std::vector< double > denseWeights;
+  for ( unsigned int i=0; i<densePoints.size(); i++ )
+    {
+    denseWeights.push_back( 0.1 + GetRandomNumber( seed ) );
+    }
+
+  decimated.SetLambda( 0.5 );
+
+  unsigned int removedIndex = decimated.GetControlPointIndices()[10];
+  decimated.RemoveSurfacePoint( 10 );
+  densePoints.erase( densePoints.begin() + removedIndex );
+  denseWeights.erase( denseWeights.begin() + removedIndex );
+
+  decimated.SetSurfacePointWeights( &denseWeights );
+
+  std::vector< double > controlPointWeights;
+  for ( unsigned int i=0; i<decimated.GetNumberSurfacePoints(); i++ )
+    {
+    unsigned int index = decimated.GetControlPointIndices()[i];
+
+    if ( index >= densePoints.size() || densePoints[index][0] != decimated.GetSurfacePoints()[i][0] ||
+         densePoints[index][1] != decimated.GetSurfacePoints()[i][1] )
+      {
+      std::cout << "FAILED: wrong control point index after removing a point" << std::endl;
+      return 1;
+      }
+    controlPointWeights.push_back( denseWeights[index] );
+    }
+
+  cipThinPlateSplineSurface decimatedReference( decimated.GetSurfacePoints() );
+    decimatedReference.SetLambda( 0.5 );
+    decimatedReference.SetSurfacePointWeights( &controlPointWeights );
+
+  for ( unsigned int i=0; i<densePoints.size(); i++ )
+    {
+    if ( std::abs( decimated.GetSurfaceHeight( densePoints[i][0], densePoints[i][1] ) -
+                   decimatedReference.GetSurfaceHeight( densePoints[i][0], densePoints[i][1] ) ) > 1e-6 )
+      {
+      std::cout << "FAILED: decimated surface height differs after removing a point" << std::endl;
+      return 1;
+      }
+    }
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
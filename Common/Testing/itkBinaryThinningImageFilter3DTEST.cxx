@@ -0,0 +1,541 @@
+#include "itkBinaryThinningImageFilter3D.h"
+#include "itkImage.h"
+#include "cipTestingHelper.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+typedef itk::Image< unsigned short, 3 >                                    ImageType;
+typedef itk::BinaryThinningImageFilter3D< ImageType, ImageType >          ThinningFilterType;
+
+
+
+ImageType::Pointer GetImage( unsigned int sizeX, unsigned int sizeY, unsigned int sizeZ )
+{
+  ImageType::SizeType size;
+    size[0] = sizeX;
+    size[1] = sizeY;
+    size[2] = sizeZ;
+
+  ImageType::Pointer image = ImageType::New();
+    image->SetRegions( size );
+    image->Allocate();
+    image->FillBuffer( 0 );
+
+  return image;
+}
+
+
+// Sets the points of the image within the specified distance of the
+// segment [p1, p2] to the specified value. A segment of zero length
+// gives a ball.
+void FillCapsule( ImageType::Pointer image, const double p1[3], const double p2[3], double radius, unsigned short value )
+{
+  ImageType::SizeType size = image->GetBufferedRegion().GetSize();
+
+  double axis[3] = { p2[0] - p1[0], p2[1] - p1[1], p2[2] - p1[2] };
+  double length2 = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+
+  ImageType::IndexType index;
+  for ( index[2]=0; index[2]<static_cast< long >( size[2] ); index[2]++ )
+    {
+    for ( index[1]=0; index[1]<static_cast< long >( size[1] ); index[1]++ )
+      {
+      for ( index[0]=0; index[0]<static_cast< long >( size[0] ); index[0]++ )
+        {
+        double w[3] = { double( index[0] ) - p1[0], double( index[1] ) - p1[1], double( index[2] ) - p1[2] };
+
+        double t = 0.0;
+        if ( length2 > 0.0 )
+          {
+          t = (w[0]*axis[0] + w[1]*axis[1] + w[2]*axis[2])/length2;
+          t < 0.0 ? t = 0.0 : false;
+          t > 1.0 ? t = 1.0 : false;
+          }
+
+        double distance2 = 0.0;
+        for ( unsigned int d=0; d<3; d++ )
+          {
+          distance2 += std::pow( w[d] - t*axis[d], 2 );
+          }
+
+        if ( distance2 <= radius*radius )
+          {
+          image->SetPixel( index, value );
+          }
+        }
+      }
+    }
+}
+
+
+// Random balls, some of them with holes, some of them cut by the image
+// border
+ImageType::Pointer GetRandomBlobs( unsigned int sizeX, unsigned int sizeY, unsigned int sizeZ, unsigned int numberOfBlobs, 
+                                   unsigned int& seed )
+{
+  ImageType::Pointer image = GetImage( sizeX, sizeY, sizeZ );
+  const double size[3] = { double( sizeX ), double( sizeY ), double( sizeZ ) };
+
+  for ( unsigned int b=0; b<numberOfBlobs; b++ )
+    {
+    double center[3];
+    for ( unsigned int d=0; d<3; d++ )
+      {
+      center[d] = (size[d] + 4.0)*GetRandomNumber( seed ) - 2.0;
+      }
+    double radius = 2.0 + 0.2*size[0]*GetRandomNumber( seed );
+
+    FillCapsule( image, center, center, radius, 1 );
+    if ( GetRandomNumber( seed ) < 0.3 )
+      {
+      FillCapsule( image, center, center, 0.5*radius, 0 );
+      }
+    }
+
+  return image;
+}
+
+
+// Random polylines of tubes of random radii, some of them running out
+// of the image
+ImageType::Pointer GetRandomTubes( unsigned int sizeX, unsigned int sizeY, unsigned int sizeZ, unsigned int numberOfTubes, 
+                                   unsigned int& seed )
+{
+  ImageType::Pointer image = GetImage( sizeX, sizeY, sizeZ );
+  const double size[3] = { double( sizeX ), double( sizeY ), double( sizeZ ) };
+
+  for ( unsigned int t=0; t<numberOfTubes; t++ )
+    {
+    double p1[3], p2[3];
+    for ( unsigned int d=0; d<3; d++ )
+      {
+      p1[d] = (size[d] + 4.0)*GetRandomNumber( seed ) - 2.0;
+      }
+    double radius = 0.5 + 2.5*GetRandomNumber( seed );
+
+    for ( unsigned int s=0; s<4; s++ )
+      {
+      for ( unsigned int d=0; d<3; d++ )
+        {
+        p2[d] = p1[d] + 0.5*size[d]*(GetRandomNumber( seed ) - 0.5);
+        }
+      FillCapsule( image, p1, p2, radius, 1 );
+      for ( unsigned int d=0; d<3; d++ )
+        {
+        p1[d] = p2[d];
+        }
+      }
+    }
+
+  return image;
+}
+
+
+// Foreground points drawn independently with the specified
+// probability, which gives many irregular neighborhoods
+ImageType::Pointer GetRandomNoise( unsigned int sizeX, unsigned int sizeY, unsigned int sizeZ, double probability, 
+                                   unsigned int& seed )
+{
+  ImageType::Pointer image = GetImage( sizeX, sizeY, sizeZ );
+
+  for ( unsigned int i=0; i<sizeX*sizeY*sizeZ; i++ )
+    {
+    if ( GetRandomNumber( seed ) < probability )
+      {
+      image->GetBufferPointer()[i] = 1 + static_cast< unsigned short >( 3.0*GetRandomNumber( seed ) );
+      }
+    }
+
+  return image;
+}
+
+// Sets the points of the box [x0, x1] x [y0, y1] x [z0, z1] to the
+// specified value
+void FillBox( ImageType::Pointer image, long x0, long x1, long y0, long y1, long z0, long z1, unsigned short value )
+{
+  ImageType::IndexType index;
+  for ( index[2]=z0; index[2]<=z1; index[2]++ )
+    {
+    for ( index[1]=y0; index[1]<=y1; index[1]++ )
+      {
+      for ( index[0]=x0; index[0]<=x1; index[0]++ )
+        {
+        image->SetPixel( index, value );
+        }
+      }
+    }
+}
+
+
+// Sets the points on the border of the square [x0, x1] x [y0, y1] of
+// slice z, except for the corners when 'corners' is false
+void FillSquare( ImageType::Pointer image, long x0, long x1, long y0, long y1, long z, bool corners )
+{
+  FillBox( image, x0, x1, y0, y0, z, z, 1 );
+  FillBox( image, x0, x1, y1, y1, z, z, 1 );
+  FillBox( image, x0, x0, y0, y1, z, z, 1 );
+  FillBox( image, x1, x1, y0, y1, z, z, 1 );
+
+  if ( !corners )
+    {
+    FillBox( image, x0, x0, y0, y0, z, z, 0 );
+    FillBox( image, x1, x1, y0, y0, z, z, 0 );
+    FillBox( image, x0, x0, y1, y1, z, z, 0 );
+    FillBox( image, x1, x1, y1, y1, z, z, 0 );
+    }
+}
+
+
+ImageType::Pointer Thin( ImageType::Pointer image, unsigned int numberOfThreads )
+{
+  ThinningFilterType::Pointer thinningFilter = ThinningFilterType::New();
+    thinningFilter->SetInput( image );
+    thinningFilter->SetNumberOfThreads( numberOfThreads );
+    thinningFilter->Update();
+
+  return thinningFilter->GetOutput();
+}
+
+
+// The foreground of the image as a buffer with a background point on
+// every side
+std::vector< unsigned char > GetPaddedForeground( ImageType::Pointer image, unsigned int paddedSize[3] )
+{
+  ImageType::SizeType size = image->GetBufferedRegion().GetSize();
+  for ( unsigned int d=0; d<3; d++ )
+    {
+    paddedSize[d] = size[d] + 2;
+    }
+
+  std::vector< unsigned char > foreground( paddedSize[0]*paddedSize[1]*paddedSize[2], 0 );
+
+  const unsigned short* buffer = image->GetBufferPointer();
+  for ( unsigned int z=0; z<size[2]; z++ )
+    {
+    for ( unsigned int y=0; y<size[1]; y++ )
+      {
+      for ( unsigned int x=0; x<size[0]; x++, buffer++ )
+        {
+        foreground[((z + 1)*paddedSize[1] + y + 1)*paddedSize[0] + x + 1] = *buffer != 0;
+        }
+      }
+    }
+
+  return foreground;
+}
+
+
+// Number of connected components of the points with the specified
+// value in the padded buffer, with 26- or 6-connectivity
+unsigned int GetNumberOfComponents( std::vector< unsigned char > points, const unsigned int size[3], 
+                                    unsigned char value, bool fullyConnected )
+{
+  unsigned int numberOfComponents = 0;
+  std::vector< unsigned int > stack;
+
+  for ( unsigned int seed=0; seed<points.size(); seed++ )
+    {
+    if ( points[seed] != value )
+      {
+      continue;
+      }
+
+    numberOfComponents++;
+    points[seed] = 2;
+    stack.push_back( seed );
+    while ( !stack.empty() )
+      {
+      unsigned int point = stack.back();
+      stack.pop_back();
+
+      int x = point%size[0];
+      int y = (point/size[0])%size[1];
+      int z = point/(size[0]*size[1]);
+      for ( int dz=-1; dz<=1; dz++ )
+        {
+        for ( int dy=-1; dy<=1; dy++ )
+          {
+          for ( int dx=-1; dx<=1; dx++ )
+            {
+            int distance = std::abs( dx ) + std::abs( dy ) + std::abs( dz );
+            if ( distance == 0 || (!fullyConnected && distance > 1) ||
+                 x + dx < 0 || x + dx >= int( size[0] ) || y + dy < 0 || y + dy >= int( size[1] ) ||
+                 z + dz < 0 || z + dz >= int( size[2] ) )
+              {
+              continue;
+              }
+            unsigned int neighbor = ((z + dz)*size[1] + y + dy)*size[0] + x + dx;
+            if ( points[neighbor] == value )
+              {
+              points[neighbor] = 2;
+              stack.push_back( neighbor );
+              }
+            }
+          }
+        }
+      }
+    }
+
+  return numberOfComponents;
+}
+
+
+// Euler characteristic of the union of the (closed) foreground voxels,
+// which is that of the foreground with 26-connectivity: the cells of
+// the union are counted in coordinates where odd values are voxel
+// centers and even values the planes between voxels
+int GetEulerCharacteristic( const std::vector< unsigned char >& foreground, const unsigned int size[3] )
+{
+  int euler = 0;
+
+  unsigned int c[3];
+  for ( c[2]=1; c[2]<2*size[2]; c[2]++ )
+    {
+    for ( c[1]=1; c[1]<2*size[1]; c[1]++ )
+      {
+      for ( c[0]=1; c[0]<2*size[0]; c[0]++ )
+        {
+        // The voxels the cell belongs to
+        unsigned int first[3];
+        unsigned int last[3];
+        unsigned int dimension = 0;
+        for ( unsigned int d=0; d<3; d++ )
+          {
+          if ( c[d]%2 == 1 )
+            {
+            first[d] = last[d] = (c[d] - 1)/2;
+            dimension++;
+            }
+          else
+            {
+            first[d] = c[d]/2 - 1;
+            last[d]  = c[d]/2;
+            }
+          }
+
+        bool inUnion = false;
+        for ( unsigned int z=first[2]; z<=last[2] && !inUnion; z++ )
+          {
+          for ( unsigned int y=first[1]; y<=last[1] && !inUnion; y++ )
+            {
+            for ( unsigned int x=first[0]; x<=last[0] && !inUnion; x++ )
+              {
+              inUnion = foreground[(z*size[1] + y)*size[0] + x] != 0;
+              }
+            }
+          }
+
+        if ( inUnion )
+          {
+          euler += dimension%2 == 0 ? 1 : -1;
+          }
+        }
+      }
+    }
+
+  return euler;
+}
+
+
+// The number of objects, of cavities and the Euler characteristic of
+// the foreground
+void GetTopology( ImageType::Pointer image, unsigned int& numberOfObjects, unsigned int& numberOfCavities, int& euler )
+{
+  unsigned int size[3];
+  std::vector< unsigned char > foreground = GetPaddedForeground( image, size );
+
+  numberOfObjects  = GetNumberOfComponents( foreground, size, 1, true );
+  numberOfCavities = GetNumberOfComponents( foreground, size, 0, false ) - 1;
+  euler            = GetEulerCharacteristic( foreground, size );
+}
+
+
+// Checks that the image is thinned to the expected skeleton
+bool CheckSkeleton( ImageType::Pointer image, ImageType::Pointer expectedSkeleton, const char* name )
+{
+  ImageType::Pointer skeleton = Thin( image, 1 );
+
+  for ( unsigned int i=0; i<image->GetBufferedRegion().GetNumberOfPixels(); i++ )
+    {
+    if ( skeleton->GetBufferPointer()[i] != expectedSkeleton->GetBufferPointer()[i] )
+      {
+      std::cout << "FAILED: " << name << " skeleton differs from the expected one at offset " << i << std::endl;
+      return false;
+      }
+    }
+
+  return true;
+}
+
+
+// Checks that the skeleton is a subset of the image with the same
+// topology, that thinning it again does not change it, and that it
+// does not depend on the number of threads
+bool CheckInvariants( ImageType::Pointer image, const char* name )
+{
+  unsigned int numberOfPixels = image->GetBufferedRegion().GetNumberOfPixels();
+
+  ImageType::Pointer skeleton = Thin( image, 1 );
+
+  unsigned int numberOfSkeletonPoints = 0;
+  for ( unsigned int i=0; i<numberOfPixels; i++ )
+    {
+    unsigned short value = skeleton->GetBufferPointer()[i];
+    if ( value > 1 || (value == 1 && image->GetBufferPointer()[i] == 0) )
+      {
+      std::cout << "FAILED: " << name << " skeleton is not a subset of the image at offset " << i << std::endl;
+      return false;
+      }
+    numberOfSkeletonPoints += value;
+    }
+
+  unsigned int imageObjects, imageCavities, skeletonObjects, skeletonCavities;
+  int imageEuler, skeletonEuler;
+  GetTopology( image, imageObjects, imageCavities, imageEuler );
+  GetTopology( skeleton, skeletonObjects, skeletonCavities, skeletonEuler );
+  if ( skeletonObjects != imageObjects || skeletonCavities != imageCavities || skeletonEuler != imageEuler )
+    {
+    std::cout << "FAILED: " << name << " topology changed: " << imageObjects << " objects, " << imageCavities;
+    std::cout << " cavities, Euler characteristic " << imageEuler << " thinned to " << skeletonObjects << ", ";
+    std::cout << skeletonCavities << ", " << skeletonEuler << std::endl;
+    return false;
+    }
+
+  ImageType::Pointer thinnedSkeleton = Thin( skeleton, 1 );
+  for ( unsigned int i=0; i<numberOfPixels; i++ )
+    {
+    if ( thinnedSkeleton->GetBufferPointer()[i] != skeleton->GetBufferPointer()[i] )
+      {
+      std::cout << "FAILED: " << name << " skeleton changes when it is thinned again" << std::endl;
+      return false;
+      }
+    }
+
+  const unsigned int numberOfThreads[2] = { 2, 4 };
+  for ( unsigned int t=0; t<2; t++ )
+    {
+    ImageType::Pointer threadedSkeleton = Thin( image, numberOfThreads[t] );
+    for ( unsigned int i=0; i<numberOfPixels; i++ )
+      {
+      if ( threadedSkeleton->GetBufferPointer()[i] != skeleton->GetBufferPointer()[i] )
+        {
+        std::cout << "FAILED: " << name << " skeleton differs with " << numberOfThreads[t];
+        std::cout << " threads at offset " << i << std::endl;
+        return false;
+        }
+      }
+    }
+
+  std::cout << name << ": " << numberOfSkeletonPoints << " skeleton points, " << skeletonObjects << " objects, ";
+  std::cout << skeletonCavities << " cavities, Euler characteristic " << skeletonEuler << std::endl;
+
+  return true;
+}
+
+
+int main( int argc, char* argv[] )
+{
+  // Curves are skeletons already
+  ImageType::Pointer point = GetImage( 5, 5, 5 );
+    FillBox( point, 2, 2, 2, 2, 2, 2, 1 );
+  ImageType::Pointer line = GetImage( 11, 5, 5 );
+    FillBox( line, 1, 9, 2, 2, 2, 2, 1 );
+  ImageType::Pointer diagonal = GetImage( 9, 9, 9 );
+  for ( long i=1; i<8; i++ )
+    {
+    FillBox( diagonal, i, i, i, i, i, i, 1 );
+    }
+
+  if ( !CheckSkeleton( point, point, "Point" ) ||
+       !CheckSkeleton( line, line, "Line" ) ||
+       !CheckSkeleton( diagonal, diagonal, "Diagonal" ) )
+    {
+    return 1;
+    }
+
+  // The corners of a 6-connected square are simple points: removing
+  // them leaves the 26-connected loop
+  ImageType::Pointer square = GetImage( 8, 8, 5 );
+    FillSquare( square, 1, 6, 1, 6, 2, true );
+  ImageType::Pointer squareSkeleton = GetImage( 8, 8, 5 );
+    FillSquare( squareSkeleton, 1, 6, 1, 6, 2, false );
+
+  // A box thins to its axis, shortened at both ends by half its width
+  ImageType::Pointer box = GetImage( 11, 5, 5 );
+    FillBox( box, 1, 9, 1, 3, 1, 3, 1 );
+  ImageType::Pointer boxSkeleton = GetImage( 11, 5, 5 );
+    FillBox( boxSkeleton, 2, 8, 2, 2, 2, 2, 1 );
+  ImageType::Pointer wideBox = GetImage( 13, 7, 7 );
+    FillBox( wideBox, 1, 11, 1, 5, 1, 5, 1 );
+  ImageType::Pointer wideBoxSkeleton = GetImage( 13, 7, 7 );
+    FillBox( wideBoxSkeleton, 3, 9, 3, 3, 3, 3, 1 );
+
+  // A square ring three points thick thins to the 26-connected loop of
+  // its middle square
+  ImageType::Pointer ring = GetImage( 11, 11, 5 );
+    FillBox( ring, 1, 9, 1, 9, 1, 3, 1 );
+    FillBox( ring, 4, 6, 4, 6, 1, 3, 0 );
+  ImageType::Pointer ringSkeleton = GetImage( 11, 11, 5 );
+    FillSquare( ringSkeleton, 2, 8, 2, 8, 2, false );
+
+  // The cavity of a hollow cube cannot be opened: of its shell, only
+  // the inside of the faces is left
+  ImageType::Pointer hollowCube = GetImage( 7, 7, 7 );
+    FillBox( hollowCube, 1, 5, 1, 5, 1, 5, 1 );
+    FillBox( hollowCube, 2, 4, 2, 4, 2, 4, 0 );
+  ImageType::Pointer hollowCubeSkeleton = GetImage( 7, 7, 7 );
+    FillBox( hollowCubeSkeleton, 2, 4, 2, 4, 1, 1, 1 );
+    FillBox( hollowCubeSkeleton, 2, 4, 2, 4, 5, 5, 1 );
+    FillBox( hollowCubeSkeleton, 2, 4, 1, 1, 2, 4, 1 );
+    FillBox( hollowCubeSkeleton, 2, 4, 5, 5, 2, 4, 1 );
+    FillBox( hollowCubeSkeleton, 1, 1, 2, 4, 2, 4, 1 );
+    FillBox( hollowCubeSkeleton, 5, 5, 2, 4, 2, 4, 1 );
+
+  if ( !CheckSkeleton( square, squareSkeleton, "Square" ) ||
+       !CheckSkeleton( box, boxSkeleton, "Box" ) ||
+       !CheckSkeleton( wideBox, wideBoxSkeleton, "Wide box" ) ||
+       !CheckSkeleton( ring, ringSkeleton, "Ring" ) ||
+       !CheckSkeleton( hollowCube, hollowCubeSkeleton, "Hollow cube" ) )
+    {
+    return 1;
+    }
+
+  if ( !CheckInvariants( ring, "Ring" ) ||
+       !CheckInvariants( hollowCube, "Hollow cube" ) )
+    {
+    return 1;
+    }
+
+  unsigned int seed = 1;
+
+  // Small images, of odd shapes, several of them
+  for ( unsigned int i=0; i<5; i++ )
+    {
+    if ( !CheckInvariants( GetRandomBlobs( 17, 13, 11, 3, seed ), "Small blobs" ) ||
+         !CheckInvariants( GetRandomTubes( 15, 19, 12, 2, seed ), "Small tubes" ) ||
+         !CheckInvariants( GetRandomNoise( 9, 8, 7, 0.6, seed ), "Noise" ) )
+      {
+      return 1;
+      }
+    }
+
+  // Images with enough border points for the candidates to be found
+  // on several threads
+  if ( !CheckInvariants( GetRandomBlobs( 64, 56, 40, 10, seed ), "Blobs" ) ||
+       !CheckInvariants( GetRandomTubes( 64, 64, 48, 8, seed ), "Tubes" ) ||
+       !CheckInvariants( GetRandomNoise( 32, 32, 24, 0.5, seed ), "Dense noise" ) )
+    {
+    return 1;
+    }
+
+  // A single slice, and a single line
+  if ( !CheckInvariants( GetRandomBlobs( 30, 30, 1, 4, seed ), "Slice" ) ||
+       !CheckInvariants( GetRandomNoise( 40, 1, 1, 0.7, seed ), "Random line" ) )
+    {
+    return 1;
+    }
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
@@ -0,0 +1,382 @@
+#include "itkCIPDijkstraMinCostPathGraphToGraphFilter.h"
+#include "itkCIPDijkstraGraphTraits.h"
+#include "itkGraph.h"
+#include "cipDijkstraMinCostPathFinder.h"
+#include "cipTestingHelper.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+typedef itk::CIPDijkstraGraphTraits< unsigned long, 2 >                      GraphTraitsType;
+typedef itk::Graph< GraphTraitsType >                                        GraphType;
+typedef itk::CIPDijkstraMinCostPathGraphToGraphFilter< GraphType, GraphType > MinPathType;
+
+//
+// Build an 8-connected grid graph with the specified node weights (in
+// raster order). The nodes and edges are created in the order in which
+// 'itk::ImageToGraphFilter' creates them.
+//
+GraphType::Pointer GetGridGraph( int size, const std::vector< unsigned long >& weights )
+{
+  GraphType::Pointer graph = GraphType::New();
+
+  for ( int y=0; y<size; y++ )
+    {
+    for ( int x=0; x<size; x++ )
+      {
+      GraphType::NodePointerType node = graph->CreateNewNode( weights[y*size + x] );
+        node->ImageIndex[0] = x;
+        node->ImageIndex[1] = y;
+      }
+    }
+
+  for ( int y=0; y<size; y++ )
+    {
+    for ( int x=0; x<size; x++ )
+      {
+      for ( int dy=-1; dy<=1; dy++ )
+        {
+        for ( int dx=-1; dx<=1; dx++ )
+          {
+          if ( (dx == 0 && dy == 0) || x+dx < 0 || y+dy < 0 || x+dx >= size || y+dy >= size )
+            {
+            continue;
+            }
+          graph->CreateNewEdge( y*size + x, (y+dy)*size + x + dx );
+          }
+        }
+      }
+    }
+
+  return graph;
+}
+
+//
+// Run the filter on a graph and return the nodes along the path (from
+// the end node back to the start node), as found from their image
+// indices in the grid of the specified size
+//
+bool GetMinCostPath( GraphType::Pointer graph, int size, unsigned long startNode, unsigned long endNode,
+                     std::vector< unsigned long >* pathNodes )
+{
+  MinPathType::Pointer minPathFilter = MinPathType::New();
+    minPathFilter->SetInput( graph );
+    minPathFilter->SetStartNode( startNode );
+    minPathFilter->SetEndNode( endNode );
+    minPathFilter->Update();
+
+  GraphType::Pointer path = minPathFilter->GetOutput();
+
+  pathNodes->clear();
+  for ( unsigned int n=0; n<path->GetTotalNumberOfNodes(); n++ )
+    {
+    pathNodes->push_back( path->GetNode( n ).ImageIndex[1]*size + path->GetNode( n ).ImageIndex[0] );
+
+    if ( path->GetNode( n ).Weight != graph->GetNode( pathNodes->back() ).Weight )
+      {
+      std::cout << "FAILED: path node " << n << " does not have the weight of its graph node" << std::endl;
+      return false;
+      }
+    }
+
+  return true;
+}
+
+//
+// Check that the search recorded on the graph is a Dijkstra search from
+// the start node and that the path is a minimum cost path to the end
+// node, without another search to compare with:
+//  - every edge out of a visited node has been relaxed, so that the
+//    accumulated weight of its target is at most that of its source
+//    plus the target weight (except for the end node, as the search
+//    stops when it is visited)
+//  - every visited node but the start node has an incoming edge from a
+//    visited node along which its accumulated weight was found
+//  - no visited node has a greater accumulated weight than a node that
+//    was reached but not visited
+// Together, these mean that the accumulated weights of the visited
+// nodes are their minimum path costs. The path must go from the end
+// node to the start node along graph edges, with the accumulated
+// weights decreasing by the node weights.
+//
+bool CheckMinCostPath( GraphType::Pointer graph, unsigned long startNode, unsigned long endNode,
+                       const std::vector< unsigned long >& pathNodes )
+{
+  unsigned int numberOfNodes = graph->GetTotalNumberOfNodes();
+
+  if ( !graph->GetNode( startNode ).Visited || !graph->GetNode( endNode ).Visited ||
+       graph->GetNode( startNode ).AccumulatedWeight != graph->GetNode( startNode ).Weight )
+    {
+    std::cout << "FAILED: start or end node not visited" << std::endl;
+    return false;
+    }
+
+  std::vector< bool > foundAlongEdge( numberOfNodes, false );
+  for ( unsigned int e=0; e<graph->GetTotalNumberOfEdges(); e++ )
+    {
+    const GraphType::NodeType& source = graph->GetNode( graph->GetEdge( e ).SourceIdentifier );
+    const GraphType::NodeType& target = graph->GetNode( graph->GetEdge( e ).TargetIdentifier );
+
+    if ( !source.Visited || graph->GetEdge( e ).SourceIdentifier == endNode )
+      {
+      continue;
+      }
+    if ( !target.Added || target.AccumulatedWeight > source.AccumulatedWeight + target.Weight )
+      {
+      std::cout << "FAILED: edge " << e << " out of a visited node was not relaxed" << std::endl;
+      return false;
+      }
+    if ( target.AccumulatedWeight == source.AccumulatedWeight + target.Weight )
+      {
+      foundAlongEdge[graph->GetEdge( e ).TargetIdentifier] = true;
+      }
+    }
+
+  unsigned long maxVisitedWeight = 0;
+  unsigned long minAddedWeight   = std::numeric_limits< unsigned long >::max();
+  for ( unsigned int n=0; n<numberOfNodes; n++ )
+    {
+    if ( graph->GetNode( n ).Visited )
+      {
+      if ( n != startNode && !foundAlongEdge[n] )
+        {
+        std::cout << "FAILED: accumulated weight of node " << n << " not found along an edge" << std::endl;
+        return false;
+        }
+      maxVisitedWeight = std::max( maxVisitedWeight, graph->GetNode( n ).AccumulatedWeight );
+      }
+    else if ( graph->GetNode( n ).Added )
+      {
+      minAddedWeight = std::min( minAddedWeight, graph->GetNode( n ).AccumulatedWeight );
+      }
+    }
+
+  if ( maxVisitedWeight > minAddedWeight )
+    {
+    std::cout << "FAILED: a node was visited before a node with a lower accumulated weight" << std::endl;
+    return false;
+    }
+
+  if ( pathNodes.empty() || pathNodes.front() != endNode || pathNodes.back() != startNode )
+    {
+    std::cout << "FAILED: path does not go from the end node to the start node" << std::endl;
+    return false;
+    }
+
+  for ( unsigned int n=0; n+1<pathNodes.size(); n++ )
+    {
+    const GraphType::NodeType& node     = graph->GetNode( pathNodes[n] );
+    const GraphType::NodeType& previous = graph->GetNode( pathNodes[n+1] );
+
+    bool hasEdge = false;
+    for ( unsigned int e=0; e<previous.OutgoingEdges.size(); e++ )
+      {
+      hasEdge = hasEdge || graph->GetEdge( previous.OutgoingEdges[e] ).TargetIdentifier == pathNodes[n];
+      }
+
+    if ( !hasEdge || !previous.Visited || node.AccumulatedWeight != previous.AccumulatedWeight + node.Weight )
+      {
+      std::cout << "FAILED: path node " << n << " is not reached from the next path node at its accumulated weight" << std::endl;
+      return false;
+      }
+    }
+
+  return true;
+}
+
+//
+// A graph of four nodes of weight 1 in a diamond: node 0 has edges to
+// nodes 1 and 2, which both have an edge to node 3. The edges out of
+// node 0 and into node 3 are created in the order of 'firstNode' and
+// 'secondNode'.
+//
+GraphType::Pointer GetDiamondGraph( unsigned long firstNode, unsigned long secondNode )
+{
+  GraphType::Pointer graph = GraphType::New();
+
+  for ( int n=0; n<4; n++ )
+    {
+    GraphType::NodePointerType node = graph->CreateNewNode( 1 );
+      node->ImageIndex[0] = n;
+      node->ImageIndex[1] = 0;
+    }
+
+  graph->CreateNewEdge( 0, firstNode );
+  graph->CreateNewEdge( 0, secondNode );
+  graph->CreateNewEdge( firstNode, 3 );
+  graph->CreateNewEdge( secondNode, 3 );
+
+  return graph;
+}
+
+int main( int argc, char* argv[] )
+{
+  std::vector< unsigned long > pathNodes;
+
+  //
+  // An 8-connected 9x9 grid graph with a high-cost wall down the middle
+  // column, leaving a single low-cost gap at the bottom. The minimum
+  // cost path from the top left corner to the top right corner must
+  // pass through the gap: going down to the gap and back up takes
+  // (size - 1) diagonal steps on each side of the wall. Many paths have
+  // that cost; with ties going to the node reached first, the path is
+  // the one below.
+  //
+  const int size = 9;
+
+  std::vector< unsigned long > weights( size*size, 1 );
+  for ( int y=0; y<size - 1; y++ )
+    {
+    weights[y*size + size/2] = 1000;
+    }
+
+  const int expectedPath[][2] = { {8,0}, {7,1}, {6,2}, {5,3}, {5,4}, {5,5}, {5,6}, {5,7}, {4,8},
+                                  {3,7}, {2,6}, {1,5}, {0,4}, {0,3}, {0,2}, {0,1}, {0,0} };
+  const unsigned int expectedPathLength = sizeof( expectedPath )/sizeof( expectedPath[0] );
+
+  GraphType::Pointer wallGraph = GetGridGraph( size, weights );
+  if ( !GetMinCostPath( wallGraph, size, 0, size - 1, &pathNodes ) ||
+       !CheckMinCostPath( wallGraph, 0, size - 1, pathNodes ) )
+    {
+    return 1;
+    }
+
+  if ( pathNodes.size() != expectedPathLength ||
+       wallGraph->GetNode( size - 1 ).AccumulatedWeight != static_cast< unsigned long >( 2*(size - 1) + 1 ) )
+    {
+    std::cout << "FAILED: wall path has " << pathNodes.size() << " nodes instead of " << expectedPathLength << std::endl;
+    return 1;
+    }
+
+  for ( unsigned int n=0; n<expectedPathLength; n++ )
+    {
+    if ( pathNodes[n] != static_cast< unsigned long >( expectedPath[n][1]*size + expectedPath[n][0] ) )
+      {
+      std::cout << "FAILED: wall path node " << n << " is not the expected node" << std::endl;
+      return 1;
+      }
+    }
+
+  //
+  // On a grid with uniform weights, the minimum cost of a node is one
+  // more than its chessboard distance to the start node, and a minimum
+  // cost path from the center of a 7x7 grid to a corner takes 3 steps.
+  //
+  const int uniformSize = 7;
+
+  std::vector< unsigned long > uniformWeights( uniformSize*uniformSize, 1 );
+
+  unsigned long center = (uniformSize/2)*uniformSize + uniformSize/2;
+
+  GraphType::Pointer uniformGraph = GetGridGraph( uniformSize, uniformWeights );
+  if ( !GetMinCostPath( uniformGraph, uniformSize, center, 0, &pathNodes ) ||
+       !CheckMinCostPath( uniformGraph, center, 0, pathNodes ) )
+    {
+    return 1;
+    }
+
+  if ( pathNodes.size() != static_cast< unsigned int >( uniformSize/2 + 1 ) )
+    {
+    std::cout << "FAILED: uniform grid path has " << pathNodes.size() << " nodes" << std::endl;
+    return 1;
+    }
+
+  for ( int y=0; y<uniformSize; y++ )
+    {
+    for ( int x=0; x<uniformSize; x++ )
+      {
+      const GraphType::NodeType& node = uniformGraph->GetNode( y*uniformSize + x );
+
+      unsigned long distance = std::max( std::abs( x - uniformSize/2 ), std::abs( y - uniformSize/2 ) );
+      if ( node.Visited && node.AccumulatedWeight != distance + 1 )
+        {
+        std::cout << "FAILED: accumulated weight of uniform grid node " << y*uniformSize + x << std::endl;
+        return 1;
+        }
+      }
+    }
+
+  //
+  // Both paths through the diamond have a cost of 3. Node 3 is reached
+  // from whichever of nodes 1 and 2 is reached first, and so visited
+  // first, and it keeps that source.
+  //
+  for ( unsigned long firstNode=1; firstNode<=2; firstNode++ )
+    {
+    GraphType::Pointer diamondGraph = GetDiamondGraph( firstNode, 3 - firstNode );
+    if ( !GetMinCostPath( diamondGraph, 4, 0, 3, &pathNodes ) ||
+         !CheckMinCostPath( diamondGraph, 0, 3, pathNodes ) )
+      {
+      return 1;
+      }
+
+    if ( pathNodes.size() != 3 || pathNodes[1] != firstNode || diamondGraph->GetNode( 3 ).AccumulatedWeight != 3 )
+      {
+      std::cout << "FAILED: diamond path does not go through node " << firstNode << std::endl;
+      return 1;
+      }
+    }
+
+  //
+  // The edges are directed: node 0 cannot be reached from node 3
+  //
+  bool exceptionThrown = false;
+  try
+    {
+    GetMinCostPath( GetDiamondGraph( 1, 2 ), 4, 3, 0, &pathNodes );
+    }
+  catch ( itk::ExceptionObject& )
+    {
+    exceptionThrown = true;
+    }
+
+  if ( !exceptionThrown )
+    {
+    std::cout << "FAILED: no exception for an end node that cannot be reached" << std::endl;
+    return 1;
+    }
+
+  //
+  // Grids with small random integer weights, so that many paths have
+  // equal costs, between random start and end nodes. The path finder
+  // must find the same paths on the grids set from their weights.
+  //
+  cipDijkstraMinCostPathFinder< unsigned long > pathFinder;
+
+  unsigned int seed = 1;
+  for ( unsigned int i=0; i<50; i++ )
+    {
+    int gridSize = 2 + static_cast< int >( 15*GetRandomNumber( seed ) );
+
+    std::vector< unsigned long > gridWeights( gridSize*gridSize );
+    for ( unsigned int n=0; n<gridWeights.size(); n++ )
+      {
+      gridWeights[n] = 1 + static_cast< unsigned long >( 3*GetRandomNumber( seed ) );
+      }
+
+    unsigned long startNode = static_cast< unsigned long >( gridWeights.size()*GetRandomNumber( seed ) );
+    unsigned long endNode   = static_cast< unsigned long >( gridWeights.size()*GetRandomNumber( seed ) );
+
+    GraphType::Pointer graph = GetGridGraph( gridSize, gridWeights );
+    if ( !GetMinCostPath( graph, gridSize, startNode, endNode, &pathNodes ) ||
+         !CheckMinCostPath( graph, startNode, endNode, pathNodes ) )
+      {
+      std::cout << "FAILED: random grid " << i << std::endl;
+      return 1;
+      }
+
+    pathFinder.SetGridGraph( gridSize, gridSize, &gridWeights[0] );
+    if ( !pathFinder.FindMinCostPath( startNode, endNode ) ||
+         pathFinder.GetPathNodes().size() != pathNodes.size() ||
+         !std::equal( pathNodes.begin(), pathNodes.end(), pathFinder.GetPathNodes().begin() ) )
+      {
+      std::cout << "FAILED: path finder path differs on random grid " << i << std::endl;
+      return 1;
+      }
+    }
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include "cipChestConventions.h"
+#include "cipHelper.h"
+#include "cipExceptionObject.h"
+#include "itkCIPSplitLeftLungRightLungImageFilter.h"
+#include "itkImageRegionIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include <iostream>
+
+// Split the lungs with the specified number of threads and compare the
+// output with the expected label map voxel by voxel
+bool CheckSplit( cip::CTType::Pointer ct, cip::LabelMapType::Pointer labelMap, cip::LabelMapType::Pointer expected,
+                 unsigned int numberOfThreads )
+{
+  typedef itk::CIPSplitLeftLungRightLungImageFilter< cip::CTType >  SplitterType;
+  typedef itk::ImageRegionIterator< cip::LabelMapType >             IteratorType;
+
+  SplitterType::Pointer splitter = SplitterType::New();
+    splitter->SetInput( ct );
+    splitter->SetLungLabelMap( labelMap );
+    splitter->SetNumberOfThreads( numberOfThreads );
+  try
+    {
+    splitter->Update();
+    }
+  catch ( cip::ExceptionObject &excp )
+    {
+    std::cerr << "Exception caught splitting:";
+    std::cerr << excp << std::endl;
+    return false;
+    }
+  catch ( itk::ExceptionObject &excp )
+    {
+    std::cerr << "Exception caught splitting:";
+    std::cerr << excp << std::endl;
+    return false;
+    }
+
+  IteratorType oIt( splitter->GetOutput(), splitter->GetOutput()->GetBufferedRegion() );
+  IteratorType eIt( expected, expected->GetBufferedRegion() );
+
+  for ( oIt.GoToBegin(), eIt.GoToBegin(); !eIt.IsAtEnd(); ++oIt, ++eIt )
+    {
+    if ( oIt.Get() != eIt.Get() )
+      {
+      std::cout << "FAILED: wrong split at " << eIt.GetIndex() << " with " << numberOfThreads << " threads" << std::endl;
+      return false;
+      }
+    }
+
+  return true;
+}
+
+int main( int argc, char* argv[] )
+{
+  // Two box lungs (x from 5 to 27 and from 33 to 55) are separated by
+  // a 5 voxel wide band of tissue, with a brighter ridge down its
+  // middle column (x=30). In three groups of slices, the lungs are
+  // joined by bridges across the band. The groups are more than 11
+  // slices apart, so they are split as separate chains of slices.
+  //
+  // In every row, the ridge is the brightest voxel (the cheapest graph
+  // node), so the min cost path through a slice runs straight down
+  // the ridge. The split erases the voxels within 1 voxel of the path
+  // (x from 29 to 31) in the slice and its neighbors: the bridges are
+  // cut through their middle, and nothing else is erased.
+  cip::CTType::SizeType size;
+    size[0] = 60;
+    size[1] = 40;
+    size[2] = 40;
+
+  cip::CTType::RegionType region;
+    region.SetSize( size );
+
+  cip::CTType::Pointer ct = cip::CTType::New();
+    ct->SetRegions( region );
+    ct->Allocate();
+
+  cip::LabelMapType::Pointer labelMap = cip::LabelMapType::New();
+    labelMap->SetRegions( region );
+    labelMap->Allocate();
+
+  cip::LabelMapType::Pointer expected = cip::LabelMapType::New();
+    expected->SetRegions( region );
+    expected->Allocate();
+
+  // First and last slice and first and last row of each group of
+  // bridges
+  const int bridges[3][4] = { { 3, 6, 10, 12 }, { 19, 21, 20, 23 }, { 34, 35, 28, 29 } };
+
+  const unsigned short lungValue = static_cast< unsigned short >( cip::WHOLELUNG );
+
+  itk::ImageRegionIteratorWithIndex< cip::CTType > ctIt( ct, region );
+  itk::ImageRegionIterator< cip::LabelMapType >    lIt( labelMap, region );
+  itk::ImageRegionIterator< cip::LabelMapType >    eIt( expected, region );
+
+  for ( ctIt.GoToBegin(), lIt.GoToBegin(), eIt.GoToBegin(); !ctIt.IsAtEnd(); ++ctIt, ++lIt, ++eIt )
+    {
+    cip::CTType::IndexType index = ctIt.GetIndex();
+
+    bool inBand   = index[0] >= 28 && index[0] <= 32;
+    bool inLungs  = !inBand && index[0] >= 5 && index[0] <= 55 && index[1] >= 5 && index[1] <= 35;
+    bool inBridge = false;
+    for ( unsigned int b=0; b<3; b++ )
+      {
+      if ( inBand && index[2] >= bridges[b][0] && index[2] <= bridges[b][1] &&
+           index[1] >= bridges[b][2] && index[1] <= bridges[b][3] )
+        {
+        inBridge = true;
+        }
+      }
+
+    short value;
+    if ( inLungs || inBridge )
+      {
+      value = ( index[0] == 30 ) ? -800 : -900;
+      }
+    else
+      {
+      value = ( index[0] == 30 ) ? 200 : 0;
+      }
+    ctIt.Set( value );
+
+    lIt.Set( ( inLungs || inBridge ) ? lungValue : 0 );
+    eIt.Set( ( inLungs || (inBridge && (index[0] == 28 || index[0] == 32)) ) ? lungValue : 0 );
+    }
+
+  // The split must be the same when the chains are split serially and
+  // in parallel
+  for ( unsigned int numberOfThreads=1; numberOfThreads<=4; numberOfThreads += 3 )
+    {
+    if ( !CheckSplit( ct, labelMap, expected, numberOfThreads ) )
+      {
+      return 1;
+      }
+    }
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
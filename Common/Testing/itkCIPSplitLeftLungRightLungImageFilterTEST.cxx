@@ -57,6 +57,44 @@ int main( int argc, char* argv[] )
       std::cerr << excp << std::endl;
     }
 
+  // The split must not depend on the number of threads
+  std::cout << "Splitting serially..." << std::endl;
+  SplitterType::Pointer serialSplitter = SplitterType::New();
+    serialSplitter->SetInput( ctReader->GetOutput() );
+    serialSplitter->SetLungLabelMap( preReader->GetOutput() );
+    serialSplitter->SetNumberOfThreads( 1 );
+  try
+    {
+      serialSplitter->Update();
+    }
+  catch ( cip::ExceptionObject &excp )
+    {
+      std::cerr << "Exception caught splitting:";
+      std::cerr << excp << std::endl;
+    }
+  catch ( itk::ExceptionObject &excp )
+    {
+      std::cerr << "Exception caught splitting:";
+      std::cerr << excp << std::endl;
+    }
+
+  IteratorType sIt( serialSplitter->GetOutput(), serialSplitter->GetOutput()->GetBufferedRegion() );
+  IteratorType pIt( splitter->GetOutput(), splitter->GetOutput()->GetBufferedRegion() );
+
+  sIt.GoToBegin();
+  pIt.GoToBegin();
+  while ( !sIt.IsAtEnd() )
+    {
+      if ( sIt.Get() != pIt.Get() )
+	{
+	  std::cout << "FAILED" << std::endl;
+	  return 1;
+	}
+
+      ++sIt;
+      ++pIt;
+    }
+
   std::cout << "Labeling..." << std::endl;
   LungRegionLabelerType::Pointer labeler = LungRegionLabelerType::New();
     labeler->SetInput( splitter->GetOutput() );
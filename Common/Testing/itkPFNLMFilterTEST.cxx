@@ -0,0 +1,227 @@
+#include "itkPFNLMFilter.h"
+#include "itkImage.h"
+#include "itkImageRegionIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkNumericTraits.h"
+#include "cipTestingHelper.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+typedef itk::Image< short, 3 >                               InputImageType;
+typedef itk::Image< float, 3 >                               OutputImageType;
+typedef itk::PFNLMFilter< InputImageType, OutputImageType > FilterType;
+
+//
+// Filter the input with the parameters used throughout the test
+//
+OutputImageType::Pointer GetFilteredImage( InputImageType::Pointer input, float h, unsigned int numberOfThreads )
+{
+  FilterType::InputImageSizeType rsearch;
+    rsearch[0] = 4;
+    rsearch[1] = 3;
+    rsearch[2] = 2;
+
+  FilterType::InputImageSizeType rcomp;
+    rcomp.Fill( 1 );
+
+  FilterType::Pointer filter = FilterType::New();
+    filter->SetInput( input );
+    filter->SetSigma( 20.0f );
+    filter->SetH( h );
+    filter->SetPSTh( 2.3f );
+    filter->SetRSearch( rsearch );
+    filter->SetRComp( rcomp );
+    filter->SetNumberOfThreads( numberOfThreads );
+    filter->Update();
+
+  return filter->GetOutput();
+}
+
+//
+// Mirror an image along x
+//
+template < class TImage >
+typename TImage::Pointer GetFlippedImage( typename TImage::Pointer image )
+{
+  typename TImage::Pointer flipped = TImage::New();
+    flipped->SetRegions( image->GetBufferedRegion() );
+    flipped->Allocate();
+
+  long sizeX = long( image->GetBufferedRegion().GetSize()[0] );
+
+  itk::ImageRegionIteratorWithIndex< TImage > it( image, image->GetBufferedRegion() );
+  for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+    {
+    typename TImage::IndexType index = it.GetIndex();
+      index[0] = sizeX - 1 - index[0];
+
+    flipped->SetPixel( index, it.Get() );
+    }
+
+  return flipped;
+}
+
+//
+// Largest difference between the two images, relative to the
+// magnitude of the reference values (at least 1). NaN values in either
+// image give an infinite difference.
+//
+double GetRelativeDifference( OutputImageType::Pointer image, OutputImageType::Pointer reference )
+{
+  double difference = 0.0;
+
+  itk::ImageRegionIterator< OutputImageType > it( image, image->GetBufferedRegion() );
+  itk::ImageRegionIterator< OutputImageType > rIt( reference, reference->GetBufferedRegion() );
+  for ( it.GoToBegin(), rIt.GoToBegin(); !it.IsAtEnd(); ++it, ++rIt )
+    {
+    if ( it.Get() != it.Get() || rIt.Get() != rIt.Get() )
+      {
+      return itk::NumericTraits< double >::max();
+      }
+
+    double magnitude = std::max( 1.0, double( std::abs( rIt.Get() ) ) );
+    difference = std::max( difference, std::abs( double( it.Get() ) - double( rIt.Get() ) )/magnitude );
+    }
+
+  return difference;
+}
+
+int main( int argc, char* argv[] )
+{
+  // Outputs that should be equal may still differ by the rounding of
+  // the weighted sums. The sums of a mirrored image are accumulated in
+  // the reverse order along x, which allows for more rounding.
+  const double tolerance       = 1e-5;
+  const double mirrorTolerance = 1e-4;
+
+  // The rows are longer than one block (64 voxels), so that the
+  // segments and their search rows are cut inside the image
+  InputImageType::SizeType size;
+    size[0] = 75;
+    size[1] = 13;
+    size[2] = 9;
+
+  InputImageType::RegionType region;
+    region.SetSize( size );
+
+  InputImageType::Pointer input = InputImageType::New();
+    input->SetRegions( region );
+    input->Allocate();
+
+  OutputImageType::Pointer expected = OutputImageType::New();
+    expected->SetRegions( region );
+    expected->Allocate();
+
+  itk::ImageRegionIteratorWithIndex< InputImageType > it( input, region );
+  itk::ImageRegionIterator< OutputImageType >         eIt( expected, region );
+
+  // A piecewise constant image: two halves along x 2000 HU apart, with
+  // 500 HU more in the last slices. The features of neighbours across
+  // a step differ by far more than the preselection thresholds, so
+  // every voxel is averaged with voxels of its own value only, and the
+  // steps are preserved. The same goes for a constant image.
+  for ( it.GoToBegin(), eIt.GoToBegin(); !it.IsAtEnd(); ++it, ++eIt )
+    {
+    InputImageType::IndexType index = it.GetIndex();
+
+    short value = ( index[0] < 37 ? -1000 : 1000 ) + ( index[2] < 4 ? 0 : 500 );
+    it.Set( value );
+    eIt.Set( float( value ) );
+    }
+
+  for ( unsigned int numberOfThreads=1; numberOfThreads<=4; numberOfThreads += 3 )
+    {
+    if ( GetRelativeDifference( GetFilteredImage( input, 1.2f, numberOfThreads ), expected ) > tolerance )
+      {
+      std::cout << "FAILED: steps of a piecewise constant image are not preserved" << std::endl;
+      return 1;
+      }
+    }
+
+  input->FillBuffer( -500 );
+  expected->FillBuffer( -500.0f );
+
+  if ( GetRelativeDifference( GetFilteredImage( input, 1.2f, 1 ), expected ) > tolerance )
+    {
+    std::cout << "FAILED: constant image is changed" << std::endl;
+    return 1;
+    }
+
+  // Uniform noise of 60 HU around -500 HU. The filter must reduce the
+  // noise substantially without moving the mean, give the same output
+  // for any number of threads, and commute with a mirroring along x
+  // (the search windows and the features are symmetric, but the rows
+  // are cut into blocks from their start).
+  unsigned int seed = 1;
+
+  double inputMean = 0.0;
+  double inputVariance = 0.0;
+  for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+    {
+    short value = short( -500.0 + 60.0*( GetRandomNumber( seed ) - 0.5 ) );
+    it.Set( value );
+
+    inputMean     += value;
+    inputVariance += double( value )*double( value );
+    }
+
+  double numberOfVoxels = double( region.GetNumberOfPixels() );
+
+  inputMean     /= numberOfVoxels;
+  inputVariance  = inputVariance/numberOfVoxels - inputMean*inputMean;
+
+  OutputImageType::Pointer output = GetFilteredImage( input, 1.2f, 1 );
+
+  double outputMean = 0.0;
+  double outputVariance = 0.0;
+  itk::ImageRegionIterator< OutputImageType > oIt( output, region );
+  for ( oIt.GoToBegin(); !oIt.IsAtEnd(); ++oIt )
+    {
+    outputMean     += oIt.Get();
+    outputVariance += double( oIt.Get() )*double( oIt.Get() );
+    }
+
+  outputMean     /= numberOfVoxels;
+  outputVariance  = outputVariance/numberOfVoxels - outputMean*outputMean;
+
+  std::cout << "Noise standard deviation: " << std::sqrt( inputVariance ) << " (input), " << std::sqrt( outputVariance ) << " (output)" << std::endl;
+
+  if ( !( outputVariance < inputVariance/9.0 ) || std::abs( outputMean - inputMean ) > 2.0 )
+    {
+    std::cout << "FAILED: noise is not reduced, or the mean is moved" << std::endl;
+    return 1;
+    }
+
+  if ( GetRelativeDifference( GetFilteredImage( input, 1.2f, 4 ), output ) > tolerance )
+    {
+    std::cout << "FAILED: output depends on the number of threads" << std::endl;
+    return 1;
+    }
+
+  OutputImageType::Pointer flippedOutput =
+    GetFlippedImage< OutputImageType >( GetFilteredImage( GetFlippedImage< InputImageType >( input ), 1.2f, 1 ) );
+
+  if ( GetRelativeDifference( flippedOutput, output ) > mirrorTolerance )
+    {
+    std::cout << "FAILED: output of the mirrored image is not the mirrored output" << std::endl;
+    return 1;
+    }
+
+  // With h=0 the noise normalization is infinite and every neighbour
+  // fails the preselection, so only the center voxel contributes and
+  // the output is the input (and has no NaN)
+  for ( it.GoToBegin(), eIt.GoToBegin(); !it.IsAtEnd(); ++it, ++eIt )
+    {
+    eIt.Set( float( it.Get() ) );
+    }
+
+  if ( GetRelativeDifference( GetFilteredImage( input, 0.0f, 1 ), expected ) > tolerance )
+    {
+    std::cout << "FAILED: rejected neighbours contribute with h=0" << std::endl;
+    return 1;
+    }
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
@@ -0,0 +1,457 @@
+#include "vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter.h"
+#include "cipChestConventions.h"
+#include "cipHelper.h"
+#include "cipTestingHelper.h"
+#include "vtkPoints.h"
+#include "vtkPointData.h"
+#include "vtkFloatArray.h"
+#include <cfloat>
+#include <cmath>
+#include <ctime>
+
+// Particles in a 100 mm cube with random scales, directions and
+// airway generation labels. A few particles have a type that is not
+// one of the filter's states.
+vtkSmartPointer< vtkPolyData > GetRandomParticles( unsigned int numberOfParticles, unsigned int& seed )
+{
+  const unsigned char types[6] = { (unsigned char)( cip::MAINBRONCHUS ), (unsigned char)( cip::UPPERLOBEBRONCHUS ),
+				   (unsigned char)( cip::AIRWAYGENERATION3 ), (unsigned char)( cip::AIRWAYGENERATION4 ),
+				   (unsigned char)( cip::AIRWAYGENERATION5 ), (unsigned char)( cip::UNDEFINEDTYPE ) };
+
+  vtkSmartPointer< vtkPoints > points = vtkSmartPointer< vtkPoints >::New();
+
+  vtkSmartPointer< vtkFloatArray > chestType = vtkSmartPointer< vtkFloatArray >::New();
+    chestType->SetNumberOfComponents( 1 );
+    chestType->SetName( "ChestType" );
+
+  vtkSmartPointer< vtkFloatArray > scale = vtkSmartPointer< vtkFloatArray >::New();
+    scale->SetNumberOfComponents( 1 );
+    scale->SetName( "scale" );
+
+  vtkSmartPointer< vtkFloatArray > hevec2 = vtkSmartPointer< vtkFloatArray >::New();
+    hevec2->SetNumberOfComponents( 3 );
+    hevec2->SetName( "hevec2" );
+
+  for ( unsigned int i=0; i<numberOfParticles; i++ )
+    {
+      double x = 100.0*GetRandomNumber( seed );
+      double y = 100.0*GetRandomNumber( seed );
+      double z = 100.0*GetRandomNumber( seed );
+      points->InsertNextPoint( x, y, z );
+
+      float type = static_cast< float >( types[static_cast< unsigned int >( 6.0*GetRandomNumber( seed ) )] );
+      chestType->InsertNextTuple( &type );
+
+      float particleScale = 0.5 + 2.5*GetRandomNumber( seed );
+      scale->InsertNextTuple( &particleScale );
+
+      double vx = GetRandomNumber( seed ) - 0.5;
+      double vy = GetRandomNumber( seed ) - 0.5;
+      double vz = GetRandomNumber( seed ) - 0.5;
+      hevec2->InsertNextTuple3( vx, vy, vz );
+    }
+
+  vtkSmartPointer< vtkPolyData > particles = vtkSmartPointer< vtkPolyData >::New();
+    particles->SetPoints( points );
+    particles->GetPointData()->AddArray( chestType );
+    particles->GetPointData()->AddArray( scale );
+    particles->GetPointData()->AddArray( hevec2 );
+
+  return particles;
+}
+
+// The kernel density estimation as it was implemented before the atlas
+// indices were introduced (every atlas particle is tested for every
+// input particle). It is used as reference for the KDE labels.
+unsigned char LegacyGetKDELabel( vtkSmartPointer< vtkPolyData > inputParticles, unsigned int p,
+				 std::vector< vtkSmartPointer< vtkPolyData > >& atlases,
+				 std::vector< unsigned char >& states, double roiRadius )
+{
+  const double PI = 3.141592653589793238462;
+  const double emissionDistanceLambda = 0.32679;
+  const double emissionScaleMu        = 0.0;
+  const double emissionScaleSigma     = 0.787;
+  const double emissionAngleLambda    = 0.06;
+
+  float  state;
+  double tmp;
+
+  std::map< unsigned char, double > probabilities;
+  std::map< float, double >         probabilityAccumulatorMap;
+  std::map< float, unsigned int >   counterMap;
+  for ( unsigned int i=0; i<states.size(); i++ )
+    {
+      probabilities[states[i]] = 1e-100;
+      probabilityAccumulatorMap[static_cast< float >( states[i] )] = 1e-100;
+      counterMap[static_cast< float >( states[i] )]                = 0;
+    }
+
+  float scale1 = inputParticles->GetPointData()->GetArray( "scale" )->GetTuple( p )[0];
+
+  float point1[3];
+    point1[0] = inputParticles->GetPoint( p )[0];
+    point1[1] = inputParticles->GetPoint( p )[1];
+    point1[2] = inputParticles->GetPoint( p )[2];
+
+  cip::VectorType particle1Hevec2(3);
+    particle1Hevec2[0] = inputParticles->GetPointData()->GetArray( "hevec2" )->GetTuple( p )[0];
+    particle1Hevec2[1] = inputParticles->GetPointData()->GetArray( "hevec2" )->GetTuple( p )[1];
+    particle1Hevec2[2] = inputParticles->GetPointData()->GetArray( "hevec2" )->GetTuple( p )[2];
+
+  for ( unsigned int a=0; a<atlases.size(); a++ )
+    {
+      for ( unsigned int g=0; g<atlases[a]->GetNumberOfPoints(); g++ )
+	{
+	  state = atlases[a]->GetPointData()->GetArray( "ChestType" )->GetTuple( g )[0];
+
+	  float scale2 = atlases[a]->GetPointData()->GetArray( "scale" )->GetTuple( g )[0];
+
+	  cip::VectorType connectingVec(3);
+	    connectingVec[0] = point1[0] - atlases[a]->GetPoint( g )[0];
+	    connectingVec[1] = point1[1] - atlases[a]->GetPoint( g )[1];
+	    connectingVec[2] = point1[2] - atlases[a]->GetPoint( g )[2];
+
+	  double distance = cip::GetVectorMagnitude( connectingVec );
+
+	  cip::VectorType particle2Hevec2(3);
+	    particle2Hevec2[0] = atlases[a]->GetPointData()->GetArray( "hevec2" )->GetTuple( g )[0];
+	    particle2Hevec2[1] = atlases[a]->GetPointData()->GetArray( "hevec2" )->GetTuple( g )[1];
+	    particle2Hevec2[2] = atlases[a]->GetPointData()->GetArray( "hevec2" )->GetTuple( g )[2];
+
+	  double angle = cip::GetAngleBetweenVectors( particle1Hevec2, particle2Hevec2, true );
+
+	  if ( distance < roiRadius )
+	    {
+	      tmp  = 1.0;
+	      tmp *= 1.0/(sqrt(2.0*PI)*emissionScaleSigma)*exp(-0.5*pow((scale1-scale2-emissionScaleMu)/emissionScaleSigma, 2.0));
+	      tmp *= emissionDistanceLambda*exp( -emissionDistanceLambda*angle );
+	      tmp *= emissionAngleLambda*exp( -emissionAngleLambda*angle );
+
+	      probabilityAccumulatorMap[state] += tmp;
+	      counterMap[state] += 1;
+	    }
+	}
+    }
+
+  for ( unsigned int i=0; i<states.size(); i++ )
+    {
+      state = static_cast< float >( states[i] );
+      if ( counterMap[state] > 0 )
+	{
+	  probabilities[states[i]] = probabilityAccumulatorMap[state]/static_cast< double >( counterMap[state] );
+	}
+    }
+
+  double sum = 0.0;
+  for ( unsigned int i=0; i<states.size(); i++ )
+    {
+      sum += probabilities[states[i]];
+    }
+
+  double maxProb = 0.0;
+  unsigned char best = (unsigned char)( cip::UNDEFINEDTYPE );
+  for ( unsigned int i=0; i<states.size(); i++ )
+    {
+      if ( probabilities[states[i]]/sum > maxProb )
+	{
+	  maxProb = probabilities[states[i]]/sum;
+	  best = states[i];
+	}
+    }
+
+  return best;
+}
+
+// Particles along small trees whose optimal labelings can be worked out
+// by hand. Every particle has a scale of 1 and a direction along x, so
+// that every transition is between particles with the same scale and
+// direction. The particles are:
+//  - 0 to 4: a chain along x, 2 mm apart
+//  - 5 to 9: a chain 5, 6, 7 along x, 2 mm apart, and two branches 8
+//    and 9 from particle 7
+//  - 10: an isolated particle
+// Neighboring particles are 2 to 2.5 mm apart and any other two are
+// more than 4 mm apart. The particles have the type 'types[p]'; labeled
+// with these types they are used as atlas, so that with an ROI radius
+// of 1 mm, the emission probabilities of every particle come from the
+// atlas particle at the same place only.
+vtkSmartPointer< vtkPolyData > GetSmallTreeParticles( const unsigned char* types )
+{
+  const double positions[11][3] = { { 0.0, 0.0, 0.0 }, { 2.0, 0.0, 0.0 }, { 4.0, 0.0, 0.0 }, { 6.0, 0.0, 0.0 }, { 8.0, 0.0, 0.0 },
+				    { 0.0, 20.0, 0.0 }, { 2.0, 20.0, 0.0 }, { 4.0, 20.0, 0.0 }, { 5.5, 22.0, 0.0 }, { 5.5, 18.0, 0.0 },
+				    { 0.0, 40.0, 0.0 } };
+
+  vtkSmartPointer< vtkPoints > points = vtkSmartPointer< vtkPoints >::New();
+
+  vtkSmartPointer< vtkFloatArray > chestType = vtkSmartPointer< vtkFloatArray >::New();
+    chestType->SetNumberOfComponents( 1 );
+    chestType->SetName( "ChestType" );
+
+  vtkSmartPointer< vtkFloatArray > scale = vtkSmartPointer< vtkFloatArray >::New();
+    scale->SetNumberOfComponents( 1 );
+    scale->SetName( "scale" );
+
+  vtkSmartPointer< vtkFloatArray > hevec2 = vtkSmartPointer< vtkFloatArray >::New();
+    hevec2->SetNumberOfComponents( 3 );
+    hevec2->SetName( "hevec2" );
+
+  for ( unsigned int p=0; p<11; p++ )
+    {
+      points->InsertNextPoint( positions[p] );
+
+      float type = static_cast< float >( types[p] );
+      chestType->InsertNextTuple( &type );
+
+      float particleScale = 1.0;
+      scale->InsertNextTuple( &particleScale );
+
+      hevec2->InsertNextTuple3( 1.0, 0.0, 0.0 );
+    }
+
+  vtkSmartPointer< vtkPolyData > particles = vtkSmartPointer< vtkPolyData >::New();
+    particles->SetPoints( points );
+    particles->GetPointData()->AddArray( chestType );
+    particles->GetPointData()->AddArray( scale );
+    particles->GetPointData()->AddArray( hevec2 );
+
+  return particles;
+}
+
+// Log of the emission probability of a state for the small trees, for
+// the state of the atlas particle and for any other state. With the
+// filter's default emission parameters, the atlas particle contributes
+// 'c' to the probability of its state; every state starts at 1e-100.
+double GetSmallTreeEmissionWeight( bool atlasState )
+{
+  const double PI = 3.141592653589793238462;
+
+  double c   = 1.0/(sqrt(2.0*PI)*0.787)*0.32679*0.06;
+  double sum = c + 11.0*1e-100;
+
+  return atlasState ? log( (c + 1e-100)/sum ) : log( 1e-100/sum );
+}
+
+// Log of the probability of a transition for the small trees, out of a
+// state that can only stay the same, with prior 'samePrior', or change
+// to one other state, with prior 1 - 'samePrior'. With the filter's
+// default transition parameters, for particles with the same scale and
+// direction.
+double GetSmallTreeTransitionWeight( double samePrior, bool sameState )
+{
+  const double PI = 3.141592653589793238462;
+
+  double sameLikelihood = 1.0/(sqrt(2.0*PI)*0.1514)*0.13;
+  double diffLikelihood = (0.68/(sqrt(2.0*PI)*0.582)*exp(-0.5*pow(0.0436/0.582, 2.0)) +
+			   0.32/(sqrt(2.0*PI)*0.804)*exp(-0.5*pow(0.8568/0.804, 2.0)))*0.004;
+
+  double same = samePrior*sameLikelihood;
+  double diff = (1.0 - samePrior)*diffLikelihood;
+
+  return log( (sameState ? same : diff)/(same + diff) );
+}
+
+int main( int argc, char* argv[] )
+{
+  unsigned int seed = 1;
+
+  std::vector< vtkSmartPointer< vtkPolyData > > atlases;
+  for ( unsigned int a=0; a<3; a++ )
+    {
+      atlases.push_back( GetRandomParticles( 2000, seed ) );
+    }
+
+  vtkSmartPointer< vtkPolyData > particles = GetRandomParticles( 500, seed );
+
+  std::vector< unsigned char > states;
+    states.push_back( (unsigned char)( cip::TRACHEA ) );
+    states.push_back( (unsigned char)( cip::MAINBRONCHUS ) );
+    states.push_back( (unsigned char)( cip::UPPERLOBEBRONCHUS ) );
+    states.push_back( (unsigned char)( cip::SUPERIORDIVISIONBRONCHUS ) );
+    states.push_back( (unsigned char)( cip::LINGULARBRONCHUS ) );
+    states.push_back( (unsigned char)( cip::MIDDLELOBEBRONCHUS ) );
+    states.push_back( (unsigned char)( cip::INTERMEDIATEBRONCHUS ) );
+    states.push_back( (unsigned char)( cip::LOWERLOBEBRONCHUS ) );
+    states.push_back( (unsigned char)( cip::AIRWAYGENERATION3 ) );
+    states.push_back( (unsigned char)( cip::AIRWAYGENERATION4 ) );
+    states.push_back( (unsigned char)( cip::AIRWAYGENERATION5 ) );
+
+  // The KDE labels must be the same as the ones computed by testing
+  // every atlas particle, with and without an ROI radius and for any
+  // number of threads. The timings are reported but not checked, since
+  // they depend on the machine and the build type.
+  const double roiRadii[2] = { DBL_MAX, 15.0 };
+  for ( unsigned int r=0; r<2; r++ )
+    {
+      std::vector< unsigned char > expectedLabels;
+
+      std::clock_t start = std::clock();
+      for ( unsigned int p=0; p<particles->GetNumberOfPoints(); p++ )
+	{
+	  expectedLabels.push_back( LegacyGetKDELabel( particles, p, atlases, states, roiRadii[r] ) );
+	}
+      double legacyTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+      for ( int numberOfThreads=1; numberOfThreads<=4; numberOfThreads += 3 )
+	{
+	  vtkSmartPointer< vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter > labeler =
+	    vtkSmartPointer< vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter >::New();
+	    labeler->SetInputData( particles );
+	    labeler->SetModeToKDE();
+	    labeler->SetKernelDensityEstimationROIRadius( roiRadii[r] );
+	    labeler->SetNumberOfThreads( numberOfThreads );
+	  for ( unsigned int a=0; a<atlases.size(); a++ )
+	    {
+	      labeler->AddAirwayGenerationLabeledAtlas( atlases[a] );
+	    }
+
+	  start = std::clock();
+	  labeler->Update();
+	  double indexTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+	  vtkDataArray* labels = labeler->GetOutput()->GetPointData()->GetArray( "ChestType" );
+	  for ( unsigned int p=0; p<particles->GetNumberOfPoints(); p++ )
+	    {
+	      if ( static_cast< unsigned char >( labels->GetTuple( p )[0] ) != expectedLabels[p] )
+		{
+		  std::cout << "FAILED: KDE label differs for particle " << p << std::endl;
+		  return 1;
+		}
+	    }
+
+	  std::cout << "ROI radius " << roiRadii[r] << ", " << numberOfThreads << " thread(s) (all atlas particles / atlas index): ";
+	  std::cout << legacyTime << " s / " << indexTime << " s" << std::endl;
+	}
+    }
+
+  // The HMTM labels must not depend on the number of threads used to
+  // decode the subgraphs
+  std::vector< unsigned char > hmtmLabels;
+  for ( int numberOfThreads=1; numberOfThreads<=4; numberOfThreads += 3 )
+    {
+      vtkSmartPointer< vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter > labeler =
+	vtkSmartPointer< vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter >::New();
+	labeler->SetInputData( particles );
+	labeler->SetModeToHMTM();
+	labeler->SetParticleDistanceThreshold( 15.0 );
+	labeler->SetKernelDensityEstimationROIRadius( 15.0 );
+	labeler->SetNumberOfThreads( numberOfThreads );
+      for ( unsigned int a=0; a<atlases.size(); a++ )
+	{
+	  labeler->AddAirwayGenerationLabeledAtlas( atlases[a] );
+	}
+
+      std::clock_t start = std::clock();
+      labeler->Update();
+      double hmtmTime = double( std::clock() - start )/CLOCKS_PER_SEC;
+
+      vtkDataArray* labels = labeler->GetOutput()->GetPointData()->GetArray( "ChestType" );
+      for ( unsigned int p=0; p<particles->GetNumberOfPoints(); p++ )
+	{
+	  unsigned char label = static_cast< unsigned char >( labels->GetTuple( p )[0] );
+	  if ( numberOfThreads == 1 )
+	    {
+	      hmtmLabels.push_back( label );
+	    }
+	  else if ( label != hmtmLabels[p] )
+	    {
+	      std::cout << "FAILED: HMTM label differs for particle " << p << std::endl;
+	      return 1;
+	    }
+	}
+
+      std::cout << "HMTM, " << numberOfThreads << " thread(s): " << hmtmTime << " s" << std::endl;
+    }
+
+  // Label the small trees, every leaf node being tried as root node and
+  // then with the upper lobe bronchus end of the chain as root node.
+  // The labels and scores are worked out by hand:
+  //  - Rooted at its trachea end, the chain is labeled as its atlas,
+  //    since every transition toward the root is allowed. The score is
+  //    that of the transitions from main bronchus to trachea, from main
+  //    bronchus to main bronchus and from upper lobe bronchus to main
+  //    bronchus.
+  //  - Rooted at its upper lobe bronchus end, the chain is labeled as
+  //    trachea: the parent of a trachea particle can only be a trachea
+  //    particle, and it is cheaper to miss the three bronchus emissions
+  //    than the two trachea ones. The trachea transitions have a
+  //    probability of 1.
+  //  - The tree is best rooted at its trachea end. A generation 5
+  //    particle cannot be the child of a main bronchus particle, so
+  //    particle 9 is labeled as main bronchus against its emission, the
+  //    most probable transition from main bronchus.
+  //  - The isolated particle, and the tree when the root node is in the
+  //    chain, are not labeled by the HMTM: they keep their KDE labels
+  //    and have no score.
+  const unsigned char TRACHEA = (unsigned char)( cip::TRACHEA );
+  const unsigned char MAIN    = (unsigned char)( cip::MAINBRONCHUS );
+  const unsigned char UPPER   = (unsigned char)( cip::UPPERLOBEBRONCHUS );
+  const unsigned char LOWER   = (unsigned char)( cip::LOWERLOBEBRONCHUS );
+  const unsigned char GEN5    = (unsigned char)( cip::AIRWAYGENERATION5 );
+
+  const unsigned char UNDEF   = (unsigned char)( cip::UNDEFINEDTYPE );
+
+  const unsigned char atlasTypes[11] = { TRACHEA, TRACHEA, MAIN, MAIN, UPPER, TRACHEA, TRACHEA, MAIN, MAIN, GEN5, LOWER };
+  const unsigned char inputTypes[11] = { UNDEF, UNDEF, UNDEF, UNDEF, UNDEF, UNDEF, UNDEF, UNDEF, UNDEF, UNDEF, UNDEF };
+
+  const unsigned char expectedLabels[2][11] = { { TRACHEA, TRACHEA, MAIN, MAIN, UPPER, TRACHEA, TRACHEA, MAIN, MAIN, MAIN, LOWER },
+						{ TRACHEA, TRACHEA, TRACHEA, TRACHEA, TRACHEA, TRACHEA, TRACHEA, MAIN, MAIN, GEN5, LOWER } };
+
+  const double mainSamePrior  = 0.978555305;
+  const double upperSamePrior = 0.943661972;
+
+  double emissionWeight       = GetSmallTreeEmissionWeight( true );
+  double missedEmissionWeight = GetSmallTreeEmissionWeight( false );
+
+  double chainScore = 5.0*emissionWeight + GetSmallTreeTransitionWeight( mainSamePrior, false ) +
+    GetSmallTreeTransitionWeight( mainSamePrior, true ) + GetSmallTreeTransitionWeight( upperSamePrior, false );
+  double tracheaChainScore = 2.0*emissionWeight + 3.0*missedEmissionWeight;
+  double treeScore = 4.0*emissionWeight + missedEmissionWeight + GetSmallTreeTransitionWeight( mainSamePrior, false ) +
+    2.0*GetSmallTreeTransitionWeight( mainSamePrior, true );
+
+  const double expectedScores[2][3] = { { chainScore, treeScore, -DBL_MAX }, { tracheaChainScore, -DBL_MAX, -DBL_MAX } };
+  const unsigned int particleTrees[11] = { 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 2 };
+
+  vtkSmartPointer< vtkPolyData > smallTreeAtlas     = GetSmallTreeParticles( atlasTypes );
+  vtkSmartPointer< vtkPolyData > smallTreeParticles = GetSmallTreeParticles( inputTypes );
+
+  for ( unsigned int r=0; r<2; r++ )
+    {
+      for ( int numberOfThreads=1; numberOfThreads<=4; numberOfThreads += 3 )
+	{
+	  vtkSmartPointer< vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter > labeler =
+	    vtkSmartPointer< vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter >::New();
+	    labeler->SetInputData( smallTreeParticles );
+	    labeler->SetModeToHMTM();
+	    labeler->SetParticleDistanceThreshold( 3.0 );
+	    labeler->SetKernelDensityEstimationROIRadius( 1.0 );
+	    labeler->SetNumberOfThreads( numberOfThreads );
+	    labeler->AddAirwayGenerationLabeledAtlas( smallTreeAtlas );
+	  if ( r == 1 )
+	    {
+	      labeler->SetParticleRootNodeID( 4 );
+	    }
+	  labeler->Update();
+
+	  vtkDataArray* labels = labeler->GetOutput()->GetPointData()->GetArray( "ChestType" );
+	  for ( unsigned int p=0; p<11; p++ )
+	    {
+	      if ( static_cast< unsigned char >( labels->GetTuple( p )[0] ) != expectedLabels[r][p] )
+		{
+		  std::cout << "FAILED: Small tree label differs for particle " << p << std::endl;
+		  return 1;
+		}
+
+	      double expectedScore = expectedScores[r][particleTrees[p]];
+	      double score         = labeler->GetParticleLabelingScore( p );
+	      if ( std::abs( score - expectedScore ) > 1e-6 )
+		{
+		  std::cout << "FAILED: Small tree labeling score differs for particle " << p << std::endl;
+		  return 1;
+		}
+	    }
+	}
+    }
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
@@ -0,0 +1,192 @@
+#include "vtkComputeAirwayWall.h"
+#include "cipTestingHelper.h"
+#include "vtkSmartPointer.h"
+#include "vtkImageData.h"
+#include "vtkDoubleArray.h"
+#include "vtkPolyData.h"
+#include "vtkPoints.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// A cross section of an airway, as the airway wall solver gets it from
+// vtkComputeAirwayWallPolyData: the lumen and the parenchyma are at
+// -1000 HU and the wall at 0 HU, shifted by 1024. The lumen and wall
+// radii vary with the angle, and a little noise is added, so that every
+// ray gives different radii. The intensity can also decrease linearly
+// with the distance to the center (slope in HU per pixel).
+vtkSmartPointer< vtkImageData > GetAirwayCrossSection( unsigned int& seed, int size, double noise, double slope )
+{
+  vtkSmartPointer< vtkImageData > image = vtkSmartPointer< vtkImageData >::New();
+    image->SetDimensions( size, size, 1 );
+    image->SetSpacing( 0.5, 0.5, 0.5 );
+    image->AllocateScalars( VTK_SHORT, 1 );
+
+  double center = size/2 - 0.5;
+
+  short* pixels = static_cast< short* >( image->GetScalarPointer() );
+  for ( int j=0; j<size; j++ )
+    {
+    for ( int i=0; i<size; i++ )
+      {
+      double x = i - center;
+      double y = j - center;
+      double r = std::sqrt( x*x + y*y );
+      double theta = std::atan2( y, x );
+
+      double innerRadius = 4.0 + 0.5*std::cos( 2.0*theta );
+      double outerRadius = innerRadius + 3.0 + 0.5*std::sin( theta );
+
+      // Smooth steps at the inner and outer wall boundaries
+      double inner = 1.0/( 1.0 + std::exp( -( r - innerRadius )/0.5 ) );
+      double outer = 1.0/( 1.0 + std::exp( -( r - outerRadius )/0.5 ) );
+
+      double value = -1000.0 + 1000.0*( inner - outer ) - slope*r + noise*( GetRandomNumber( seed ) - 0.5 ) + 1024.0;
+
+      pixels[j*size + i] = static_cast< short >( value );
+      }
+    }
+
+  return image;
+}
+
+// Largest difference between two arrays, relative to the magnitude of
+// the reference values (at least 1). Arrays of different sizes, or a
+// NaN in only one of the arrays, give an infinite difference.
+double GetArrayDifference( vtkDataArray* array, vtkDataArray* reference )
+{
+  if ( array->GetNumberOfTuples() != reference->GetNumberOfTuples() ||
+       array->GetNumberOfComponents() != reference->GetNumberOfComponents() )
+    {
+    return VTK_DOUBLE_MAX;
+    }
+
+  double difference = 0.0;
+  for ( vtkIdType i=0; i<array->GetNumberOfTuples(); i++ )
+    {
+    for ( int c=0; c<array->GetNumberOfComponents(); c++ )
+      {
+      double value          = array->GetComponent( i, c );
+      double referenceValue = reference->GetComponent( i, c );
+
+      // Statistics of empty sets of rays may be NaN in both
+      if ( ( value != value ) != ( referenceValue != referenceValue ) )
+        {
+        return VTK_DOUBLE_MAX;
+        }
+      if ( value != referenceValue && value == value )
+        {
+        difference = std::max( difference, std::abs( value - referenceValue )/std::max( 1.0, std::abs( referenceValue ) ) );
+        }
+      }
+    }
+
+  return difference;
+}
+
+double GetContourDifference( vtkPolyData* contour, vtkPolyData* reference )
+{
+  if ( reference->GetPoints() == NULL || contour->GetPoints() == NULL )
+    {
+    return ( reference->GetPoints() == contour->GetPoints() ? 0.0 : VTK_DOUBLE_MAX );
+    }
+
+  return GetArrayDifference( contour->GetPoints()->GetData(), reference->GetPoints()->GetData() );
+}
+
+// Compares the statistics and contours of the ray kernel and of the
+// ray filters for the three single kernel methods
+bool CompareRayKernelAndRayFilters( vtkImageData* image, double alpha, double tolerance,
+                                    vtkSmartPointer< vtkComputeAirwayWall > raySolvers[3] )
+{
+  const char* methodNames[3] = { "FWHM", "ZeroCrossing", "PhaseCongruency" };
+
+  for ( int method=0; method<3; method++ )
+    {
+    vtkSmartPointer< vtkComputeAirwayWall > kernelSolver = vtkSmartPointer< vtkComputeAirwayWall >::New();
+      kernelSolver->SetInputData( image );
+      kernelSolver->SetMethod( method );
+      kernelSolver->SetAlpha( alpha );
+      kernelSolver->UseRayKernelOn();
+      kernelSolver->Update();
+
+    vtkSmartPointer< vtkComputeAirwayWall > raySolver = vtkSmartPointer< vtkComputeAirwayWall >::New();
+      raySolver->SetInputData( image );
+      raySolver->SetMethod( method );
+      raySolver->SetAlpha( alpha );
+      raySolver->UseRayKernelOff();
+      raySolver->Update();
+
+    raySolvers[method] = raySolver;
+
+    double meanDifference   = GetArrayDifference( kernelSolver->GetStatsMean(), raySolver->GetStatsMean() );
+    double minMaxDifference = GetArrayDifference( kernelSolver->GetStatsMinMax(), raySolver->GetStatsMinMax() );
+    double innerDifference  = GetContourDifference( kernelSolver->GetInnerContour(), raySolver->GetInnerContour() );
+    double outerDifference  = GetContourDifference( kernelSolver->GetOuterContour(), raySolver->GetOuterContour() );
+
+    std::cout << methodNames[method] << " (alpha " << alpha << "): mean inner radius " << raySolver->GetStatsMean()->GetComponent( 0, 0 );
+    std::cout << ", mean outer radius " << raySolver->GetStatsMean()->GetComponent( 2, 0 ) << std::endl;
+
+    if ( meanDifference > tolerance || minMaxDifference > tolerance )
+      {
+      std::cout << "FAILED: " << methodNames[method] << " statistics differ between the ray kernel and the ray filters" << std::endl;
+      return false;
+      }
+    if ( innerDifference > tolerance || outerDifference > tolerance )
+      {
+      std::cout << "FAILED: " << methodNames[method] << " contours differ between the ray kernel and the ray filters" << std::endl;
+      return false;
+      }
+    }
+
+  return true;
+}
+
+int main( int argc, char* argv[] )
+{
+  // The ray kernel samples the rays with the same gage kernels and
+  // probe positions as the one-filter-per-ray path, and locates the
+  // wall with the same arithmetic on plain arrays
+  const double tolerance = 1e-6;
+
+  unsigned int seed = 1;
+
+  vtkSmartPointer< vtkComputeAirwayWall > raySolvers[3];
+
+  vtkSmartPointer< vtkImageData > image = GetAirwayCrossSection( seed, 48, 20.0, 0.0 );
+  if ( !CompareRayKernelAndRayFilters( image, 3.0, tolerance, raySolvers ) )
+    {
+    return 1;
+    }
+
+  // The comparison is only meaningful if the wall is found
+  if ( !( raySolvers[0]->GetStatsMean()->GetComponent( 0, 0 ) > 0.0 ) )
+    {
+    std::cout << "FAILED: FWHM does not find the airway wall" << std::endl;
+    return 1;
+    }
+
+  // Without noise and with an intensity that keeps decreasing outwards,
+  // the gradient does not change sign past the outer wall. With a large
+  // alpha the parenchymal attenuation of every ray is then its last
+  // sample, which lies below the lumen. Reading one sample further
+  // would give the first (lumen) sample of the next ray in the kernel
+  // buffers. The image is large enough for the rays and the kernels to
+  // stay inside it.
+  vtkSmartPointer< vtkImageData > rampImage = GetAirwayCrossSection( seed, 80, 0.0, 10.0 );
+  if ( !CompareRayKernelAndRayFilters( rampImage, 1000.0, tolerance, raySolvers ) )
+    {
+    return 1;
+    }
+
+  double meanLA = raySolvers[0]->GetStatsMean()->GetComponent( 34, 0 );
+  double meanPA = raySolvers[0]->GetStatsMean()->GetComponent( 36, 0 );
+  if ( !( raySolvers[0]->GetStatsMean()->GetComponent( 0, 0 ) > 0.0 ) || !( meanPA < meanLA ) )
+    {
+    std::cout << "FAILED: the parenchymal attenuation is not read at the end of the rays" << std::endl;
+    return 1;
+    }
+
+  std::cout << "PASSED" << std::endl;
+  return 0;
+}
@@ -712,6 +712,79 @@ cip::ChestConventions::ChestConventions()
   double* r067 = new double[3]; r067[0] = 0.49; r067[1] = 0.49; r067[2] = 0.87; ChestRegionColors.push_back( r067 ); //HIATUS
   double* r068 = new double[3]; r068[0] = 0.49; r068[1] = 0.49; r068[2] = 0.88; ChestRegionColors.push_back( r068 ); //PECTORALIS
   double* r069 = new double[3]; r069[0] = 0.49; r069[1] = 0.49; r069[2] = 0.89; ChestRegionColors.push_back( r069 ); //SPINALCORD
+
+  this->UpdateChestRegionAncestorTable();
+  this->UpdateChestNameMaps();
+}
+
+const cip::ChestConventions& cip::ChestConventions::GetInstance()
+{
+  static const ChestConventions instance;
+
+  return instance;
+}
+
+void cip::ChestConventions::UpdateChestRegionAncestorTable()
+{
+  for ( unsigned int r=0; r<256; r++ )
+    {
+      for ( unsigned int w=0; w<8; w++ )
+	{
+	  m_ChestRegionAncestors[r][w] = 0;
+	}
+
+      // By convention every region (even the undefined region) is
+      // within itself
+      m_ChestRegionAncestors[r][r >> 5] |= 1u << (r & 31);
+
+      // The undefined region has no ancestors, and no region has the
+      // undefined region as ancestor. The number of hops is bounded
+      // to guard against cycles in the hierarchy map.
+      if ( r == (unsigned int)( UNDEFINEDREGION ) )
+	{
+	  continue;
+	}
+
+      unsigned char current = (unsigned char)( r );
+      for ( unsigned int hop=0; hop<256; hop++ )
+	{
+	  std::map< unsigned char, unsigned char >::const_iterator it = ChestRegionHierarchyMap.find( current );
+	  if ( it == ChestRegionHierarchyMap.end() )
+	    {
+	      break;
+	    }
+
+	  current = it->second;
+	  if ( current != (unsigned char)( UNDEFINEDREGION ) )
+	    {
+	      m_ChestRegionAncestors[r][current >> 5] |= 1u << (current & 31);
+	    }
+	}
+    }
+}
+
+void cip::ChestConventions::UpdateChestNameMaps()
+{
+  m_ChestRegionNameMap.clear();
+  m_ChestTypeNameMap.clear();
+
+  // 'insert' keeps the first entry for a given name, which matches
+  // the first-match behavior of a linear search over the names
+  for ( unsigned int i=0; i<m_NumberOfEnumeratedChestRegions; i++ )
+    {
+      std::string upperName( ChestRegionNames[i] );
+      std::transform(upperName.begin(), upperName.end(), upperName.begin(), ::toupper);
+
+      m_ChestRegionNameMap.insert( std::pair< std::string, unsigned char >( upperName, ChestRegions[i] ) );
+    }
+
+  for ( unsigned int i=0; i<m_NumberOfEnumeratedChestTypes; i++ )
+    {
+      std::string upperName( ChestTypeNames[i] );
+      std::transform(upperName.begin(), upperName.end(), upperName.begin(), ::toupper);
+
+      m_ChestTypeNameMap.insert( std::pair< std::string, unsigned char >( upperName, ChestTypes[i] ) );
+    }
 }
 
 cip::ChestConventions::~ChestConventions()
@@ -739,58 +812,11 @@ unsigned char cip::ChestConventions::GetNumberOfEnumeratedChestTypes() const
 
 /** This method checks if the chest region 'subordinate' is within
  *  the chest region 'superior'. */
-bool cip::ChestConventions::CheckSubordinateSuperiorChestRegionRelationship( unsigned char subordinate, unsigned char superior )
-{
-  // No matter what the superior and subordinate regions are (even
-  // if they are undefined regions), if they are the same then by
-  // convention the subordinate is a subset of the superior, so
-  // return true
-  if ( subordinate == superior )
-    {
-      return true;
-    }
-
-  // The undefined region does not belong to any other
-  // region (except the undefined region itself). Similarly,
-  // nothing belongs to the undefined region (except the undefined
-  // region). So if the above test failed, then we're considering
-  // the relationship between a defined region and and undefined
-  // region. Therefore return false.
-  if ( subordinate == (unsigned char)( UNDEFINEDREGION ) ||
-       superior == (unsigned char)( UNDEFINEDREGION ) )
-    {
-      return false;
-    }
-
-  unsigned char subordinateTemp = subordinate;
-  
-  while ( ChestRegionHierarchyMap.find(subordinateTemp) != ChestRegionHierarchyMap.end() )
-    {
-      if ( ChestRegionHierarchyMap[subordinateTemp] == superior )
-	{
-          return true;
-	}
-      else
-	{
-          subordinateTemp = ChestRegionHierarchyMap[subordinateTemp];
-	}
-    }
-
-  return false;
-}
-
 std::string cip::ChestConventions::GetChestWildCardName() const
 {
   return std::string("WildCard");
 }
 
-/** Given an unsigned short value, this method will compute the
- *  8-bit region value corresponding to the input */
-unsigned char cip::ChestConventions::GetChestRegionFromValue( unsigned short value ) const
-{
-  return value - ((value >> 8) << 8);
-}
-
 /** The 'color' param is assumed to have three components, each in
  *  the interval [0,1]. All chest type colors will be tested until a
  *  color match is found. If no match is found, 'UNDEFINEDTYPYE'
@@ -825,13 +851,6 @@ unsigned char cip::ChestConventions::GetChestRegionFromColor(double* color) cons
   return (unsigned char)(UNDEFINEDTYPE);
 }
 
-/** Given an unsigned short value, this method will compute the
- *  8-bit type value corresponding to the input */
-unsigned char cip::ChestConventions::GetChestTypeFromValue( unsigned short value ) const
-{
-  return (value >> 8);
-}
-
 /** Given an unsigned char value corresponding to a chest type, this
  *  method will return the string name equivalent. */
 std::string cip::ChestConventions::GetChestTypeName( unsigned char whichType ) const
@@ -923,15 +942,6 @@ std::string cip::ChestConventions::GetChestTypeNameFromValue( unsigned short val
   return this->GetChestTypeName(typeValue);
 }
 
-unsigned short cip::ChestConventions::GetValueFromChestRegionAndType( unsigned char region, unsigned char type ) const
-{
-  unsigned short regionValue = (unsigned short) region;
-  unsigned short tmp = (unsigned short) type;
-  unsigned short regionType = (tmp << 8);
-  unsigned short combinedValue = regionValue + regionType;
-  return combinedValue;
-}
-
 /** Given a string identifying one of the enumerated chest regions,
  * this method will return the unsigned char equivalent. If no match
  * is found, the method will retune UNDEFINEDREGION */
@@ -940,15 +950,10 @@ unsigned char cip::ChestConventions::GetChestRegionValueFromName( std::string re
   std::string upperRegionString( regionString );
   std::transform(upperRegionString.begin(), upperRegionString.end(), upperRegionString.begin(), ::toupper);
 
-  for ( int i=0; i<m_NumberOfEnumeratedChestRegions; i++ )
+  std::map< std::string, unsigned char >::const_iterator it = m_ChestRegionNameMap.find( upperRegionString );
+  if ( it != m_ChestRegionNameMap.end() )
     {
-      std::string upperChestRegionName( ChestRegionNames[i] );
-      std::transform(upperChestRegionName.begin(), upperChestRegionName.end(), upperChestRegionName.begin(), ::toupper);
-
-      if ( !upperRegionString.compare(upperChestRegionName) )
-	{
-          return ChestRegions[i];
-	}
+      return it->second;
     }
 
   return (unsigned char)( UNDEFINEDREGION );
@@ -962,15 +967,10 @@ unsigned char cip::ChestConventions::GetChestTypeValueFromName( std::string type
   std::string upperTypeString( typeString );
   std::transform(upperTypeString.begin(), upperTypeString.end(), upperTypeString.begin(), ::toupper);
 
-  for ( int i=0; i<m_NumberOfEnumeratedChestTypes; i++ )
+  std::map< std::string, unsigned char >::const_iterator it = m_ChestTypeNameMap.find( upperTypeString );
+  if ( it != m_ChestTypeNameMap.end() )
     {
-      std::string upperChestTypeName( ChestTypeNames[i] );
-      std::transform(upperChestTypeName.begin(), upperChestTypeName.end(), upperChestTypeName.begin(), ::toupper);
-
-      if ( !upperTypeString.compare(upperChestTypeName) )
-	{
-          return ChestTypes[i];
-	}
+      return it->second;
     }
 
   return (unsigned char)( UNDEFINEDTYPE );
@@ -27,6 +27,105 @@ namespace cip {
   typedef std::vector< double >  PointType;
   typedef std::vector< double >  VectorType;
 
+  /**
+   *  Fixed size 3D point (or vector). Its coordinates are kept in
+   *  place rather than on the heap, so it can be created and copied
+   *  freely in loops over particles. It converts to and from
+   *  'PointType' (which must have at least three elements), so it can
+   *  be passed to functions that take 'PointType' or 'VectorType'.
+   *  Arrays of 'Point3' have the layout of arrays of 3 doubles.
+   */
+  class Point3
+  {
+  public:
+    Point3()
+      {
+        m_Coordinates[0] = m_Coordinates[1] = m_Coordinates[2] = 0.0;
+      }
+    Point3( double x, double y, double z )
+      {
+        m_Coordinates[0] = x;
+        m_Coordinates[1] = y;
+        m_Coordinates[2] = z;
+      }
+    explicit Point3( const double* coordinates )
+      {
+        m_Coordinates[0] = coordinates[0];
+        m_Coordinates[1] = coordinates[1];
+        m_Coordinates[2] = coordinates[2];
+      }
+    Point3( const PointType& point )
+      {
+        m_Coordinates[0] = point[0];
+        m_Coordinates[1] = point[1];
+        m_Coordinates[2] = point[2];
+      }
+
+    operator PointType() const
+      {
+        return PointType( m_Coordinates, m_Coordinates + 3 );
+      }
+
+    double& operator[]( unsigned int i ) { return m_Coordinates[i]; }
+    const double& operator[]( unsigned int i ) const { return m_Coordinates[i]; }
+
+    unsigned int size() const { return 3; }
+
+    double* GetDataPointer() { return m_Coordinates; }
+    const double* GetDataPointer() const { return m_Coordinates; }
+
+    Point3& operator+=( const Point3& p )
+      {
+        m_Coordinates[0] += p.m_Coordinates[0];
+        m_Coordinates[1] += p.m_Coordinates[1];
+        m_Coordinates[2] += p.m_Coordinates[2];
+        return *this;
+      }
+    Point3& operator-=( const Point3& p )
+      {
+        m_Coordinates[0] -= p.m_Coordinates[0];
+        m_Coordinates[1] -= p.m_Coordinates[1];
+        m_Coordinates[2] -= p.m_Coordinates[2];
+        return *this;
+      }
+    Point3& operator*=( double s )
+      {
+        m_Coordinates[0] *= s;
+        m_Coordinates[1] *= s;
+        m_Coordinates[2] *= s;
+        return *this;
+      }
+    Point3& operator/=( double s )
+      {
+        m_Coordinates[0] /= s;
+        m_Coordinates[1] /= s;
+        m_Coordinates[2] /= s;
+        return *this;
+      }
+
+  private:
+    double m_Coordinates[3];
+  };
+
+  typedef Point3 Vector3;
+
+  inline Point3 operator+( Point3 a, const Point3& b ) { return a += b; }
+  inline Point3 operator-( Point3 a, const Point3& b ) { return a -= b; }
+  inline Point3 operator-( const Point3& a ) { return Point3( -a[0], -a[1], -a[2] ); }
+  inline Point3 operator*( Point3 a, double s ) { return a *= s; }
+  inline Point3 operator*( double s, Point3 a ) { return a *= s; }
+  inline Point3 operator/( Point3 a, double s ) { return a /= s; }
+
+  inline double Dot( const Vector3& a, const Vector3& b )
+  {
+    return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+  }
+
+  inline Vector3 Cross( const Vector3& a, const Vector3& b )
+  {
+    return Vector3( a[1]*b[2] - a[2]*b[1], a[2]*b[0] - a[0]*b[2], a[0]*b[1] - a[1]*b[0] );
+  }
+
 /**
  *  Note that chest regions are inherently hierarchical. If you add a
  *  region to the enumerated list below, you should also update the
@@ -236,18 +335,40 @@ public:
   ~ChestConventions();
   ChestConventions();
 
+  /** Get a process-wide instance of the conventions. Constructing a
+   *  ChestConventions object fills all the name, color and hierarchy
+   *  containers, so code that only needs the lookups (in particular
+   *  code called repeatedly) should use this instance instead. The
+   *  instance is created on the first call; make that call before
+   *  starting threads that use it. */
+  static const ChestConventions& GetInstance();
+
   unsigned char GetNumberOfEnumeratedChestRegions() const;
   unsigned char GetNumberOfEnumeratedChestTypes() const;
 
   /** This method checks if the chest region 'subordinate' is within
    *  the chest region 'superior'. It assumes that all chest regions are
    *  within the WHOLELUNG lung region. TODO: extend do deal with
-   *  chest, not just lung */
-  bool CheckSubordinateSuperiorChestRegionRelationship( unsigned char subordinate, unsigned char superior );
+   *  chest, not just lung. The answer is read from a table of region
+   *  ancestors built from 'ChestRegionHierarchyMap' at construction,
+   *  so the cost does not depend on the depth of the hierarchy. */
+  bool CheckSubordinateSuperiorChestRegionRelationship( unsigned char subordinate, unsigned char superior ) const
+    {
+      return ( ( m_ChestRegionAncestors[subordinate][superior >> 5] >> (superior & 31) ) & 1u ) != 0;
+    }
+
+  /** Rebuild the region ancestor table used by
+   *  'CheckSubordinateSuperiorChestRegionRelationship'. This only needs
+   *  to be called if 'ChestRegionHierarchyMap' is modified after
+   *  construction. */
+  void UpdateChestRegionAncestorTable();
 
   /** Given an unsigned short value, this method will compute the
    *  8-bit region value corresponding to the input */
-  unsigned char GetChestRegionFromValue( unsigned short value ) const;
+  unsigned char GetChestRegionFromValue( unsigned short value ) const
+    {
+      return static_cast< unsigned char >( value & 0xFF );
+    }
 
   /** The 'color' param is assumed to have three components, each in
    *  the interval [0,1]. All chest type colors will be tested until a
@@ -263,7 +384,10 @@ public:
 
   /** Given an unsigned short value, this method will compute the
    *  8-bit type value corresponding to the input */
-  unsigned char GetChestTypeFromValue( unsigned short value ) const;
+  unsigned char GetChestTypeFromValue( unsigned short value ) const
+    {
+      return static_cast< unsigned char >( value >> 8 );
+    }
 
   /** A label map voxel value consists of a chest-region designation
    *  and a chest-type designation. For the purposes of representing a
@@ -302,16 +426,21 @@ public:
    *  string name of the corresponding chest type */
   std::string GetChestTypeNameFromValue( unsigned short value ) const;
 
-  unsigned short GetValueFromChestRegionAndType( unsigned char region, unsigned char type ) const;
+  unsigned short GetValueFromChestRegionAndType( unsigned char region, unsigned char type ) const
+    {
+      return static_cast< unsigned short >( (static_cast< unsigned short >( type ) << 8) + region );
+    }
 
   /** Given a string identifying one of the enumerated chest regions,
    * this method will return the unsigned char equivalent. If no match
-   * is found, the method will retune UNDEFINEDREGION */
+   * is found, the method will retune UNDEFINEDREGION. The comparison
+   * is case insensitive. */
   unsigned char GetChestRegionValueFromName( std::string regionString ) const;
 
   /** Given a string identifying one of the enumerated chest types,
    * this method will return the unsigned char equivalent. If no match
-   * is found, the method will retune UNDEFINEDTYPE */
+   * is found, the method will retune UNDEFINEDTYPE. The comparison
+   * is case insensitive. */
   unsigned char GetChestTypeValueFromName( std::string typeString ) const;
 
   /** Get the ith chest region */
@@ -354,8 +483,18 @@ public:
   std::vector< std::string >  HistogramPhenotypeNames;
 
 private:
+  void UpdateChestNameMaps();
+
   unsigned char m_NumberOfEnumeratedChestRegions;
   unsigned char m_NumberOfEnumeratedChestTypes;
+
+  // Bit 'superior' of row 'subordinate' is set if 'superior' is
+  // 'subordinate' itself or one of its ancestors in the hierarchy
+  unsigned int m_ChestRegionAncestors[256][8];
+
+  // Upper case names mapped to region and type values
+  std::map< std::string, unsigned char > m_ChestRegionNameMap;
+  std::map< std::string, unsigned char > m_ChestTypeNameMap;
 };
 
 } // namespace cip
@@ -11,6 +11,7 @@
 #include <iostream>
 #include "vnl/vnl_math.h"
 #include <cfloat>
+#include <cmath>
 #include "cipCylinderStencil.h"
 
 
@@ -27,7 +28,26 @@ cipCylinderStencil::cipCylinderStencil()
 
 cipCylinderStencil::~cipCylinderStencil()
 {
-  delete this->Orientation;
+  delete[] this->Orientation;
+}
+
+
+cipStencil* cipCylinderStencil::Clone() const
+{
+  cipCylinderStencil* clone = new cipCylinderStencil();
+
+  clone->Radius = this->Radius;
+  clone->Height = this->Height;
+
+  for ( unsigned int i=0; i<3; i++ )
+    {
+    clone->Orientation[i]    = this->Orientation[i];
+    clone->Center[i]         = this->Center[i];
+    clone->BoundingBoxMin[i] = this->BoundingBoxMin[i];
+    clone->BoundingBoxMax[i] = this->BoundingBoxMax[i];
+    }
+
+  return clone;
 }
 
 
@@ -56,6 +76,14 @@ bool cipCylinderStencil::IsInsideStencilPattern( double x, double y, double z )
 
   double mag = this->GetVectorMagnitude3D( vec );
 
+  //
+  // The angle is undefined at the center, which is inside
+  //
+  if ( mag == 0.0 )
+    {
+    return true;
+    }
+
   //
   // Now get the angle between this vector and the orientation
   // vector 
@@ -78,6 +106,110 @@ bool cipCylinderStencil::IsInsideStencilPattern( double x, double y, double z )
 }
 
 
+//
+// With 'a' the unit cylinder axis and 'd(t) = point + t*direction -
+// center', the line is inside the cylinder where |a.d(t)| <= height/2
+// (an interval in t) and where |d(t)|^2 - (a.d(t))^2 <= radius^2 (a
+// quadratic inequality in t). The extent is the intersection of the
+// two. As for the sphere, lines that only graze the cylinder because
+// of rounding (a slightly negative discriminant, or cap and radius
+// extents that barely miss each other) get a single point.
+//
+bool cipCylinderStencil::GetScanlineExtent( const double* const point, const double* const direction, 
+                                            double* tMin, double* tMax ) const
+{
+  double axisMag = this->GetVectorMagnitude3D( this->Orientation );
+  if ( axisMag == 0.0 )
+    {
+    return false;
+    }
+
+  double w[3];
+    w[0] = point[0] - this->Center[0];
+    w[1] = point[1] - this->Center[1];
+    w[2] = point[2] - this->Center[2];
+
+  double wAxial = (w[0]*this->Orientation[0] + w[1]*this->Orientation[1] + w[2]*this->Orientation[2])/axisMag;
+  double uAxial = (direction[0]*this->Orientation[0] + direction[1]*this->Orientation[1] + 
+                   direction[2]*this->Orientation[2])/axisMag;
+
+  double lower = -DBL_MAX;
+  double upper = DBL_MAX;
+
+  //
+  // Extent between the two caps
+  //
+  if ( uAxial == 0.0 )
+    {
+    if ( fabs( wAxial ) > this->Height/2.0 )
+      {
+      return false;
+      }
+    }
+  else
+    {
+    double t1 = (-this->Height/2.0 - wAxial)/uAxial;
+    double t2 = ( this->Height/2.0 - wAxial)/uAxial;
+
+    lower = t1 < t2 ? t1 : t2;
+    upper = t1 < t2 ? t2 : t1;
+    }
+
+  //
+  // Extent within the radius. The quadratic term vanishes when the
+  // line is parallel to the axis, in which case the line is either
+  // entirely within the radius or entirely outside of it.
+  //
+  double uu = direction[0]*direction[0] + direction[1]*direction[1] + direction[2]*direction[2];
+  double wu = w[0]*direction[0] + w[1]*direction[1] + w[2]*direction[2];
+  double ww = w[0]*w[0] + w[1]*w[1] + w[2]*w[2];
+
+  double a = uu - uAxial*uAxial;
+  double b = wu - wAxial*uAxial;
+  double c = ww - wAxial*wAxial - this->Radius*this->Radius;
+
+  if ( a <= 1e-12*uu )
+    {
+    if ( c > 0.0 )
+      {
+      return false;
+      }
+    }
+  else
+    {
+    double discriminant = b*b - a*c;
+    if ( discriminant < 0.0 )
+      {
+      if ( discriminant < -1e-10*(b*b + a*(ww + this->Radius*this->Radius)) )
+        {
+        return false;
+        }
+      discriminant = 0.0;
+      }
+
+    double t1 = (-b - sqrt( discriminant ))/a;
+    double t2 = (-b + sqrt( discriminant ))/a;
+
+    t1 > lower ? lower = t1 : false;
+    t2 < upper ? upper = t2 : false;
+    }
+
+  if ( lower > upper )
+    {
+    if ( lower - upper > 1e-10*(1.0 + fabs( lower ) + fabs( upper )) )
+      {
+      return false;
+      }
+    lower = upper = (lower + upper)/2.0;
+    }
+
+  *tMin = lower;
+  *tMax = upper;
+
+  return true;
+}
+
+
 void cipCylinderStencil::GetStencilBoundingBox( double* const bbMin, double* const bbMax ) const
 {
   bbMin[0] = this->BoundingBoxMin[0];
@@ -303,7 +435,7 @@ double cipCylinderStencil::GetAngleBetweenVectors( double vec1[3], double vec2[3
 
   double arg = (vec1[0]*vec2[0] + vec1[1]*vec2[1] + vec1[2]*vec2[2])/(vec1Mag*vec2Mag);
 
-  if ( abs( arg ) > 1.0 )
+  if ( fabs( arg ) > 1.0 )
     {
     arg = 1.0;
     }
@@ -24,6 +24,10 @@ public:
   ~cipCylinderStencil();
   cipCylinderStencil();
 
+  /** Create a copy of this stencil. The caller is responsible for
+   *  deleting it. */
+  cipStencil* Clone() const;
+
   /** Given physical coordinates, x, y, and z, this method will
    *  indicate whether the point is inside the stencil's bounding box
    *  or not. Note that 'SetCenter' must be called before calling this
@@ -37,6 +41,13 @@ public:
    *  method. */
   bool IsInsideStencilPattern( double, double, double ) const; 
 
+  /** Given a line, defined by a physical point and a direction
+   *  vector, compute the range of the line parameter for which the
+   *  line is inside the cylinder. Returns false if the line misses the
+   *  cylinder. Note that 'SetCenter' must be called before calling this
+   *  method. */
+  bool GetScanlineExtent( const double* const, const double* const, double*, double* ) const;
+
   /** Get the bounding box of the stencil. The first argument should
    *  be a 3 element vector to hold the min x, y, and z physical
    *  coordinates of the bounding box. The second argument should be
@@ -59,6 +70,9 @@ public:
   void SetOrientation( double, double, double );  
 
 private:
+  cipCylinderStencil( const cipCylinderStencil& ); //purposely not implemented
+  void operator=( const cipCylinderStencil& ); //purposely not implemented
+
   void   ComputeStencilBoundingBox();
   double GetVectorMagnitude2D( double[2] ) const;
   double GetVectorMagnitude3D( double[3] ) const;
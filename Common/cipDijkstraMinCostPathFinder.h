@@ -0,0 +1,137 @@
+/**
+ *  \class cipDijkstraMinCostPathFinder
+ *  \ingroup common
+ *  \brief Computes the minimum cost path between two nodes of a graph
+ *  whose costs are carried by the nodes, using Dijkstra's algorithm.
+ *
+ *  The graph is stored as a compact adjacency structure: for every
+ *  node, its weight and the range of its outgoing edges in flat arrays
+ *  of edge targets and edge identifiers. 'SetGraph' fills it from an
+ *  'itk::Graph' whose node and edge identifiers are their indices in
+ *  the graph containers (as is the case for graphs created with
+ *  'itk::ImageToGraphFilter'), so that existing graphs can be searched
+ *  without modification.
+ *
+ *  The unvisited nodes are kept in an indexed binary heap, so the
+ *  search is O(E log V). Nodes with equal accumulated costs are taken
+ *  in the order in which they were first reached, which is the order
+ *  in which the linear search of 'itk::CIPDijkstraMinCostPathGraphToGraphFilter'
+ *  used to take them; the paths are therefore the same. The search
+ *  stops as soon as the end node is visited.
+ *
+ *  The buffers are kept between searches so that a finder can be
+ *  reused for many graphs of similar sizes without reallocation.
+ *  Grid graphs can also be set directly from their node weights
+ *  ('SetGridGraph'), without building an 'itk::Graph' first.
+ *
+ *  $Date$
+ *  $Revision$
+ *  $Author$
+ *
+ */
+
+#ifndef __cipDijkstraMinCostPathFinder_h
+#define __cipDijkstraMinCostPathFinder_h
+
+#include <vector>
+
+template < class TWeight >
+class cipDijkstraMinCostPathFinder
+{
+public:
+  typedef TWeight WeightType;
+
+  cipDijkstraMinCostPathFinder();
+  ~cipDijkstraMinCostPathFinder() {};
+
+  /** Fill the adjacency structure from an 'itk::Graph'. The node
+   *  weights and the outgoing edges of every node (in the order in
+   *  which they are stored in the graph) are copied. */
+  template < class TGraph >
+  void SetGraph( TGraph* );
+
+  /** Set an 8-connected graph over a 2D grid of the specified size,
+   *  with one node per grid point (in raster order) and the specified
+   *  node weights. The nodes and edges are in the order in which
+   *  'itk::ImageToGraphFilter' creates them when all the neighbors are
+   *  active, so the paths are the same as on such a graph. The edges
+   *  are only rebuilt when the grid size changes. */
+  void SetGridGraph( unsigned int, unsigned int, const WeightType* );
+
+  unsigned int GetNumberOfNodes() const
+    {
+      return static_cast< unsigned int >( m_NodeWeights.size() );
+    };
+
+  /** Find the minimum cost path from the start node to the end node.
+   *  The cost of a path is the sum of the weights of its nodes,
+   *  including the start and end nodes. Returns false if the end node
+   *  cannot be reached from the start node. */
+  bool FindMinCostPath( unsigned int, unsigned int );
+
+  /** The nodes along the last path found, from the end node back to
+   *  the start node */
+  const std::vector< unsigned int >& GetPathNodes() const
+    {
+      return m_PathNodes;
+    };
+
+  /** The accumulated cost of a node after the last search. Nodes that
+   *  have not been reached have the maximum cost. */
+  WeightType GetAccumulatedWeight( unsigned int node ) const
+    {
+      return m_AccumulatedWeights[node];
+    };
+
+  /** Whether a node was reached (added to the search front) or visited
+   *  (its accumulated cost made final) during the last search */
+  bool GetNodeAdded( unsigned int node ) const
+    {
+      return m_NodeStates[node] != UNREACHED;
+    };
+  bool GetNodeVisited( unsigned int node ) const
+    {
+      return m_NodeStates[node] == VISITED;
+    };
+
+  /** Get the identifier of the edge along which the current minimum
+   *  cost of a node was found. Returns false for nodes without such an
+   *  edge (the start node and the nodes that have not been reached). */
+  bool GetOptimalEdgeIdentifier( unsigned int, unsigned int* ) const;
+
+private:
+  enum NodeState { UNREACHED, ADDED, VISITED };
+
+  bool HasPriority( unsigned int, unsigned int ) const;
+  void MoveUp( unsigned int );
+  void MoveDown( unsigned int );
+  unsigned int PopFront();
+
+  // The graph: the weight of every node and, for the outgoing edges
+  // of node 'n' at positions [m_EdgeOffsets[n], m_EdgeOffsets[n+1]),
+  // their target nodes and their identifiers
+  std::vector< WeightType >   m_NodeWeights;
+  std::vector< unsigned int > m_EdgeOffsets;
+  std::vector< unsigned int > m_EdgeTargets;
+  std::vector< unsigned int > m_EdgeIdentifiers;
+  unsigned int                m_GridSize[2];
+
+  // The search state: for every node, its accumulated cost, the
+  // position (in the edge arrays) of its optimal incoming edge, its
+  // state, the order in which it was reached and its position in the
+  // heap
+  std::vector< WeightType >    m_AccumulatedWeights;
+  std::vector< unsigned int >  m_OptimalEdges;
+  std::vector< unsigned char > m_NodeStates;
+  std::vector< unsigned int >  m_AddedOrder;
+  std::vector< unsigned int >  m_HeapPositions;
+  std::vector< unsigned int >  m_Heap;
+
+  std::vector< unsigned int >  m_PathNodes;
+};
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "cipDijkstraMinCostPathFinder.txx"
+#endif
+
+#endif
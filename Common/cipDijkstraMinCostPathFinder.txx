@@ -0,0 +1,332 @@
+/*
+ * $Date$
+ * $Revision$
+ * $Author$
+ *
+ */
+
+#ifndef __cipDijkstraMinCostPathFinder_txx
+#define __cipDijkstraMinCostPathFinder_txx
+
+#include "cipDijkstraMinCostPathFinder.h"
+#include <algorithm>
+#include <limits>
+
+
+template < class TWeight >
+cipDijkstraMinCostPathFinder< TWeight >
+::cipDijkstraMinCostPathFinder()
+{
+  this->m_EdgeOffsets.push_back( 0 );
+
+  this->m_GridSize[0] = 0;
+  this->m_GridSize[1] = 0;
+}
+
+
+template < class TWeight >
+template < class TGraph >
+void
+cipDijkstraMinCostPathFinder< TWeight >
+::SetGraph( TGraph* graph )
+{
+  unsigned int numberOfNodes = graph->GetTotalNumberOfNodes();
+
+  this->m_NodeWeights.resize( numberOfNodes );
+  this->m_EdgeOffsets.resize( numberOfNodes + 1 );
+  this->m_EdgeTargets.clear();
+  this->m_EdgeIdentifiers.clear();
+
+  for ( unsigned int n=0; n<numberOfNodes; n++ )
+    {
+    typename TGraph::NodePointerType node = graph->GetNodePointer( n );
+
+    this->m_NodeWeights[n] = static_cast< WeightType >( node->Weight );
+    this->m_EdgeOffsets[n] = static_cast< unsigned int >( this->m_EdgeTargets.size() );
+
+    typename TGraph::EdgeIdentifierContainerType::const_iterator eIt;
+    for ( eIt = node->OutgoingEdges.begin(); eIt != node->OutgoingEdges.end(); ++eIt )
+      {
+      this->m_EdgeTargets.push_back( static_cast< unsigned int >( graph->GetEdgePointer( *eIt )->TargetIdentifier ) );
+      this->m_EdgeIdentifiers.push_back( static_cast< unsigned int >( *eIt ) );
+      }
+    }
+
+  this->m_EdgeOffsets[numberOfNodes] = static_cast< unsigned int >( this->m_EdgeTargets.size() );
+
+  this->m_GridSize[0] = 0;
+  this->m_GridSize[1] = 0;
+}
+
+
+template < class TWeight >
+void
+cipDijkstraMinCostPathFinder< TWeight >
+::SetGridGraph( unsigned int sizeX, unsigned int sizeY, const WeightType* weights )
+{
+  unsigned int numberOfNodes = sizeX*sizeY;
+
+  this->m_NodeWeights.assign( weights, weights + numberOfNodes );
+
+  if ( sizeX == this->m_GridSize[0] && sizeY == this->m_GridSize[1] )
+    {
+    return;
+    }
+
+  this->m_EdgeOffsets.resize( numberOfNodes + 1 );
+  this->m_EdgeTargets.clear();
+
+  // The neighbors of a node are taken row by row, from the row above
+  // to the row below, and left to right within a row
+  for ( unsigned int y=0; y<sizeY; y++ )
+    {
+    for ( unsigned int x=0; x<sizeX; x++ )
+      {
+      this->m_EdgeOffsets[y*sizeX + x] = static_cast< unsigned int >( this->m_EdgeTargets.size() );
+
+      for ( int dy=-1; dy<=1; dy++ )
+        {
+        for ( int dx=-1; dx<=1; dx++ )
+          {
+          int nx = static_cast< int >( x ) + dx;
+          int ny = static_cast< int >( y ) + dy;
+
+          if ( (dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= static_cast< int >( sizeX ) || ny >= static_cast< int >( sizeY ) )
+            {
+            continue;
+            }
+
+          this->m_EdgeTargets.push_back( static_cast< unsigned int >( ny )*sizeX + static_cast< unsigned int >( nx ) );
+          }
+        }
+      }
+    }
+
+  this->m_EdgeOffsets[numberOfNodes] = static_cast< unsigned int >( this->m_EdgeTargets.size() );
+
+  // The edges are numbered in the order in which they are created
+  this->m_EdgeIdentifiers.resize( this->m_EdgeTargets.size() );
+  for ( unsigned int e=0; e<this->m_EdgeIdentifiers.size(); e++ )
+    {
+    this->m_EdgeIdentifiers[e] = e;
+    }
+
+  this->m_GridSize[0] = sizeX;
+  this->m_GridSize[1] = sizeY;
+}
+
+
+template < class TWeight >
+bool
+cipDijkstraMinCostPathFinder< TWeight >
+::FindMinCostPath( unsigned int startNode, unsigned int endNode )
+{
+  unsigned int numberOfNodes = this->GetNumberOfNodes();
+
+  this->m_AccumulatedWeights.assign( numberOfNodes, std::numeric_limits< WeightType >::max() );
+  this->m_OptimalEdges.assign( numberOfNodes, std::numeric_limits< unsigned int >::max() );
+  this->m_NodeStates.assign( numberOfNodes, UNREACHED );
+  this->m_AddedOrder.resize( numberOfNodes );
+  this->m_HeapPositions.resize( numberOfNodes );
+  this->m_Heap.clear();
+  this->m_PathNodes.clear();
+
+  if ( startNode >= numberOfNodes || endNode >= numberOfNodes )
+    {
+    return false;
+    }
+
+  unsigned int numberOfAddedNodes = 0;
+
+  this->m_NodeStates[startNode]         = ADDED;
+  this->m_AddedOrder[startNode]         = numberOfAddedNodes++;
+  this->m_AccumulatedWeights[startNode] = this->m_NodeWeights[startNode];
+  this->m_HeapPositions[startNode]      = 0;
+  this->m_Heap.push_back( startNode );
+
+  while ( !this->m_Heap.empty() )
+    {
+    unsigned int visitingNode = this->PopFront();
+
+    this->m_NodeStates[visitingNode] = VISITED;
+
+    if ( visitingNode == endNode )
+      {
+      break;
+      }
+
+    // Investigate all the nodes that the visiting node points to. If
+    // the visiting node accumulated cost plus the pointed to node
+    // weight is less than the pointed to node accumulated cost, the
+    // edge between them becomes the pointed to node optimal edge.
+    WeightType visitingAccumulatedWeight = this->m_AccumulatedWeights[visitingNode];
+
+    for ( unsigned int e=this->m_EdgeOffsets[visitingNode]; e<this->m_EdgeOffsets[visitingNode+1]; e++ )
+      {
+      unsigned int targetNode = this->m_EdgeTargets[e];
+      WeightType   weightSum  = static_cast< WeightType >( visitingAccumulatedWeight + this->m_NodeWeights[targetNode] );
+
+      if ( this->m_NodeStates[targetNode] == UNREACHED )
+        {
+        this->m_NodeStates[targetNode]    = ADDED;
+        this->m_AddedOrder[targetNode]    = numberOfAddedNodes++;
+        this->m_HeapPositions[targetNode] = static_cast< unsigned int >( this->m_Heap.size() );
+        this->m_Heap.push_back( targetNode );
+        }
+
+      if ( weightSum < this->m_AccumulatedWeights[targetNode] )
+        {
+        this->m_AccumulatedWeights[targetNode] = weightSum;
+        this->m_OptimalEdges[targetNode]       = e;
+
+        if ( this->m_NodeStates[targetNode] == ADDED )
+          {
+          this->MoveUp( this->m_HeapPositions[targetNode] );
+          }
+        }
+      }
+    }
+
+  if ( this->m_NodeStates[endNode] != VISITED )
+    {
+    return false;
+    }
+
+  // Back-track from the end node to the start node along the optimal
+  // edges. The source of an edge is found from its position in the
+  // edge arrays.
+  unsigned int currentNode = endNode;
+  this->m_PathNodes.push_back( currentNode );
+
+  while ( currentNode != startNode )
+    {
+    unsigned int edge = this->m_OptimalEdges[currentNode];
+
+    currentNode = static_cast< unsigned int >( std::upper_bound( this->m_EdgeOffsets.begin(), this->m_EdgeOffsets.end(), edge ) -
+                                               this->m_EdgeOffsets.begin() ) - 1;
+
+    this->m_PathNodes.push_back( currentNode );
+    }
+
+  return true;
+}
+
+
+template < class TWeight >
+bool
+cipDijkstraMinCostPathFinder< TWeight >
+::GetOptimalEdgeIdentifier( unsigned int node, unsigned int* edgeIdentifier ) const
+{
+  if ( this->m_OptimalEdges[node] == std::numeric_limits< unsigned int >::max() )
+    {
+    return false;
+    }
+
+  *edgeIdentifier = this->m_EdgeIdentifiers[this->m_OptimalEdges[node]];
+
+  return true;
+}
+
+
+// Nodes with lower accumulated costs come first. Ties go to the node
+// that was reached first.
+template < class TWeight >
+bool
+cipDijkstraMinCostPathFinder< TWeight >
+::HasPriority( unsigned int node1, unsigned int node2 ) const
+{
+  if ( this->m_AccumulatedWeights[node1] < this->m_AccumulatedWeights[node2] )
+    {
+    return true;
+    }
+  if ( this->m_AccumulatedWeights[node2] < this->m_AccumulatedWeights[node1] )
+    {
+    return false;
+    }
+
+  return this->m_AddedOrder[node1] < this->m_AddedOrder[node2];
+}
+
+
+template < class TWeight >
+void
+cipDijkstraMinCostPathFinder< TWeight >
+::MoveUp( unsigned int position )
+{
+  unsigned int node = this->m_Heap[position];
+
+  while ( position > 0 )
+    {
+    unsigned int parentPosition = (position - 1)/2;
+    unsigned int parentNode     = this->m_Heap[parentPosition];
+
+    if ( !this->HasPriority( node, parentNode ) )
+      {
+      break;
+      }
+
+    this->m_Heap[position]            = parentNode;
+    this->m_HeapPositions[parentNode] = position;
+
+    position = parentPosition;
+    }
+
+  this->m_Heap[position]      = node;
+  this->m_HeapPositions[node] = position;
+}
+
+
+template < class TWeight >
+void
+cipDijkstraMinCostPathFinder< TWeight >
+::MoveDown( unsigned int position )
+{
+  unsigned int heapSize = static_cast< unsigned int >( this->m_Heap.size() );
+  unsigned int node     = this->m_Heap[position];
+
+  while ( 2*position + 1 < heapSize )
+    {
+    unsigned int childPosition = 2*position + 1;
+    if ( childPosition + 1 < heapSize && this->HasPriority( this->m_Heap[childPosition + 1], this->m_Heap[childPosition] ) )
+      {
+      childPosition++;
+      }
+
+    unsigned int childNode = this->m_Heap[childPosition];
+    if ( !this->HasPriority( childNode, node ) )
+      {
+      break;
+      }
+
+    this->m_Heap[position]           = childNode;
+    this->m_HeapPositions[childNode] = position;
+
+    position = childPosition;
+    }
+
+  this->m_Heap[position]      = node;
+  this->m_HeapPositions[node] = position;
+}
+
+
+template < class TWeight >
+unsigned int
+cipDijkstraMinCostPathFinder< TWeight >
+::PopFront()
+{
+  unsigned int frontNode = this->m_Heap.front();
+  unsigned int lastNode  = this->m_Heap.back();
+
+  this->m_Heap.pop_back();
+
+  if ( !this->m_Heap.empty() )
+    {
+    this->m_Heap[0]                 = lastNode;
+    this->m_HeapPositions[lastNode] = 0;
+    this->MoveDown( 0 );
+    }
+
+  return frontNode;
+}
+
+#endif
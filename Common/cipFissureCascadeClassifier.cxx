@@ -0,0 +1,735 @@
+/**
+ *
+ *  $Date$
+ *  $Revision$
+ *  $Author$
+ *
+ */
+
+#include "cipFissureCascadeClassifier.h"
+#include "cipExceptionObject.h"
+#include <algorithm>
+#include <cmath>
+
+cipFissureCascadeClassifier::cipFissureCascadeClassifier()
+{
+  this->LeftObliqueSurface     = NULL;
+  this->RightObliqueSurface    = NULL;
+  this->RightHorizontalSurface = NULL;
+
+  this->NumberOfThreads       = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  this->NumberOfSlicesPerSlab = 1;
+
+  this->Clock = itk::RealTimeClock::New();
+
+  for ( unsigned int s=0; s<NUMBEROFSTAGES; s++ )
+    {
+    this->StageCandidates[s] = 0;
+    this->StageRejections[s] = 0;
+    this->StageTimes[s]      = 0.0;
+    }
+}
+
+
+cipFissureCascadeClassifier::~cipFissureCascadeClassifier()
+{
+}
+
+
+void cipFissureCascadeClassifier::SetLeftObliqueSurface( const cipThinPlateSplineSurface* surface )
+{
+  this->LeftObliqueSurface = surface;
+}
+
+
+void cipFissureCascadeClassifier::SetRightObliqueSurface( const cipThinPlateSplineSurface* surface )
+{
+  this->RightObliqueSurface = surface;
+}
+
+
+void cipFissureCascadeClassifier::SetRightHorizontalSurface( const cipThinPlateSplineSurface* surface )
+{
+  this->RightHorizontalSurface = surface;
+}
+
+
+void cipFissureCascadeClassifier::SetNumberOfThreads( unsigned int numberOfThreads )
+{
+  this->NumberOfThreads = numberOfThreads > 0 ? numberOfThreads : 1;
+}
+
+
+void cipFissureCascadeClassifier::SetNumberOfSlicesPerSlab( unsigned int numberOfSlices )
+{
+  this->NumberOfSlicesPerSlab = numberOfSlices > 0 ? numberOfSlices : 1;
+}
+
+
+const char* cipFissureCascadeClassifier::GetStageName( unsigned int stage ) const
+{
+  switch ( stage )
+    {
+    case 0:
+      return "Intensity and shape model";
+    case 1:
+      return "Hessian";
+    case 2:
+      return "Gradient";
+    default:
+      return "";
+    }
+}
+
+
+unsigned long cipFissureCascadeClassifier::GetNumberOfStageCandidates( unsigned int stage ) const
+{
+  return this->StageCandidates[stage];
+}
+
+
+unsigned long cipFissureCascadeClassifier::GetNumberOfStageRejections( unsigned int stage ) const
+{
+  return this->StageRejections[stage];
+}
+
+
+double cipFissureCascadeClassifier::GetStageTime( unsigned int stage ) const
+{
+  return this->StageTimes[stage];
+}
+
+
+cip::CTType::Pointer cipFissureCascadeClassifier::Enhance( cip::CTType::Pointer ctImage, cip::LabelMapType::Pointer labelMap )
+{
+  cip::CTType::RegionType       ctRegion = ctImage->GetBufferedRegion();
+  cip::LabelMapType::RegionType lmRegion = labelMap->GetBufferedRegion();
+
+  if ( ctRegion.GetSize() != lmRegion.GetSize() )
+    {
+    throw cip::ExceptionObject( __FILE__, __LINE__, "cipFissureCascadeClassifier::Enhance()",
+                                "CT image and label map sizes differ" );
+    }
+
+  for ( unsigned int s=0; s<NUMBEROFSTAGES; s++ )
+    {
+    this->StageCandidates[s] = 0;
+    this->StageRejections[s] = 0;
+    this->StageTimes[s]      = 0.0;
+    }
+
+  cip::CTType::Pointer outImage = cip::CTType::New();
+    outImage->SetRegions( ctRegion.GetSize() );
+    outImage->Allocate();
+    outImage->FillBuffer( -1000 );
+    outImage->SetSpacing( ctImage->GetSpacing() );
+    outImage->SetOrigin( ctImage->GetOrigin() );
+
+  bool useLeftLung  = this->LeftObliqueSurface != NULL && this->LeftObliqueSurface->GetNumberSurfacePoints() > 0;
+  bool useRightLung = this->RightObliqueSurface != NULL && this->RightObliqueSurface->GetNumberSurfacePoints() > 0 &&
+    this->RightHorizontalSurface != NULL && this->RightHorizontalSurface->GetNumberSurfacePoints() > 0;
+
+  // Map every possible label value to the surface its voxels are
+  // compared with, so that the candidate selection is a single table
+  // lookup. Right lung voxels are compared with both right surfaces;
+  // they are marked with the oblique surface here.
+  const cip::ChestConventions& conventions = cip::ChestConventions::GetInstance();
+
+  unsigned char regionSurfaces[256];
+  for ( unsigned int r=0; r<256; r++ )
+    {
+    regionSurfaces[r] = NOSURFACE;
+    if ( useLeftLung &&
+         conventions.CheckSubordinateSuperiorChestRegionRelationship( (unsigned char)(r), (unsigned char)(cip::LEFTLUNG) ) )
+      {
+      regionSurfaces[r] = LEFTOBLIQUE;
+      }
+    else if ( useRightLung &&
+              conventions.CheckSubordinateSuperiorChestRegionRelationship( (unsigned char)(r), (unsigned char)(cip::RIGHTLUNG) ) )
+      {
+      regionSurfaces[r] = RIGHTOBLIQUE;
+      }
+    }
+
+  std::vector< unsigned char > labelSurfaces( 65536 );
+  labelSurfaces[0] = NOSURFACE;
+  for ( unsigned int v=1; v<65536; v++ )
+    {
+    labelSurfaces[v] = regionSurfaces[conventions.GetChestRegionFromValue( static_cast< unsigned short >( v ) )];
+    }
+
+  // Find the bounding box of the candidates
+  const short*          ctBuffer    = ctImage->GetBufferPointer();
+  const unsigned short* labelBuffer = labelMap->GetBufferPointer();
+
+  unsigned int size[3];
+  unsigned int boxMin[3];
+  unsigned int boxMax[3];
+  for ( unsigned int d=0; d<3; d++ )
+    {
+    size[d]   = ctRegion.GetSize()[d];
+    boxMin[d] = size[d];
+    boxMax[d] = 0;
+    }
+
+  unsigned long offset = 0;
+  for ( unsigned int z=0; z<size[2]; z++ )
+    {
+    for ( unsigned int y=0; y<size[1]; y++ )
+      {
+      for ( unsigned int x=0; x<size[0]; x++, offset++ )
+        {
+        if ( labelSurfaces[labelBuffer[offset]] == NOSURFACE || ctBuffer[offset] >= -650 )
+          {
+          continue;
+          }
+
+        boxMin[0] = std::min( boxMin[0], x ); boxMax[0] = std::max( boxMax[0], x );
+        boxMin[1] = std::min( boxMin[1], y ); boxMax[1] = std::max( boxMax[1], y );
+        boxMin[2] = std::min( boxMin[2], z ); boxMax[2] = std::max( boxMax[2], z );
+        }
+      }
+    }
+
+  if ( boxMin[0] > boxMax[0] )
+    {
+    return outImage;
+    }
+
+  cip::CTType::RegionType boundingBox;
+  for ( unsigned int d=0; d<3; d++ )
+    {
+    boundingBox.SetIndex( d, ctRegion.GetIndex()[d] + boxMin[d] );
+    boundingBox.SetSize( d, boxMax[d] - boxMin[d] + 1 );
+    }
+
+  // The surface heights and normals over the bounding box columns
+  if ( useLeftLung )
+    {
+    this->ComputeHeightField( this->LeftObliqueSurface, ctImage, boundingBox, this->LeftObliqueHeightField );
+    }
+  if ( useRightLung )
+    {
+    this->ComputeHeightField( this->RightObliqueSurface, ctImage, boundingBox, this->RightObliqueHeightField );
+    this->ComputeHeightField( this->RightHorizontalSurface, ctImage, boundingBox, this->RightHorizontalHeightField );
+    }
+
+  unsigned int numberOfSlabs =
+    (boundingBox.GetSize()[2] + this->NumberOfSlicesPerSlab - 1)/this->NumberOfSlicesPerSlab;
+
+  unsigned int numberOfThreads = std::min( this->NumberOfThreads, numberOfSlabs );
+
+  // The image functions are set up here rather than in the threads
+  unsigned int maxKernelWidth = 100;
+  double variance = 1.0;
+  double maxError = 0.01;
+
+  std::vector< THREADDATA > threadData( numberOfThreads );
+  for ( unsigned int t=0; t<numberOfThreads; t++ )
+    {
+    THREADDATA& data = threadData[t];
+
+    data.hessianFunction = HessianImageFunctionType::New();
+      data.hessianFunction->SetUseImageSpacing( true );
+      data.hessianFunction->SetNormalizeAcrossScale( false );
+      data.hessianFunction->SetInputImage( ctImage );
+      data.hessianFunction->SetMaximumError( maxError );
+      data.hessianFunction->SetMaximumKernelWidth( maxKernelWidth );
+      data.hessianFunction->SetVariance( variance );
+      data.hessianFunction->Initialize();
+
+    // One derivative function per order, so that the kernels are only
+    // computed once
+    for ( unsigned int d=0; d<3; d++ )
+      {
+      unsigned int order[3];
+        order[0] = 0; order[1] = 0; order[2] = 0;
+        order[d] = 1;
+
+      data.derivativeFunctions[d] = DerivativeFunctionType::New();
+        data.derivativeFunctions[d]->SetInputImage( ctImage );
+        data.derivativeFunctions[d]->SetUseImageSpacing( true );
+        data.derivativeFunctions[d]->SetNormalizeAcrossScale( false );
+        data.derivativeFunctions[d]->SetMaximumError( maxError );
+        data.derivativeFunctions[d]->SetMaximumKernelWidth( maxKernelWidth );
+        data.derivativeFunctions[d]->SetVariance( variance );
+        data.derivativeFunctions[d]->SetOrder( order );
+        data.derivativeFunctions[d]->Initialize();
+      }
+
+    for ( unsigned int s=0; s<NUMBEROFSTAGES; s++ )
+      {
+      data.stageCandidates[s] = 0;
+      data.stageRejections[s] = 0;
+      data.stageTimes[s]      = 0.0;
+      }
+    }
+
+  THREADSTRUCT str;
+    str.self           = this;
+    str.ctBuffer       = ctBuffer;
+    str.labelBuffer    = labelBuffer;
+    str.outBuffer      = outImage->GetBufferPointer();
+    str.labelSurfaces  = &labelSurfaces[0];
+    str.boundingBox    = boundingBox;
+    str.bufferedRegion = ctRegion;
+    str.zOrigin        = ctImage->GetOrigin()[2];
+    str.zSpacing       = ctImage->GetSpacing()[2];
+    str.numberOfSlabs  = numberOfSlabs;
+    str.threadData     = &threadData;
+
+  if ( numberOfThreads == 1 )
+    {
+    for ( unsigned int slab=0; slab<numberOfSlabs; slab++ )
+      {
+      this->ProcessSlab( &str, slab*this->NumberOfSlicesPerSlab,
+                         std::min( (slab + 1)*this->NumberOfSlicesPerSlab, (unsigned int)(boundingBox.GetSize()[2]) ),
+                         threadData[0] );
+      }
+    }
+  else
+    {
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+      threader->SetNumberOfThreads( numberOfThreads );
+      threader->SetSingleMethod( cipFissureCascadeClassifier::ThreaderCallback, &str );
+      threader->SingleMethodExecute();
+    }
+
+  for ( unsigned int t=0; t<numberOfThreads; t++ )
+    {
+    for ( unsigned int s=0; s<NUMBEROFSTAGES; s++ )
+      {
+      this->StageCandidates[s] += threadData[t].stageCandidates[s];
+      this->StageRejections[s] += threadData[t].stageRejections[s];
+      this->StageTimes[s]      += threadData[t].stageTimes[s];
+      }
+    }
+
+  return outImage;
+}
+
+
+ITK_THREAD_RETURN_TYPE cipFissureCascadeClassifier::ThreaderCallback( void* arg )
+{
+  itk::MultiThreader::ThreadInfoStruct* info = static_cast< itk::MultiThreader::ThreadInfoStruct* >( arg );
+
+  unsigned int threadId        = info->ThreadID;
+  unsigned int numberOfThreads = info->NumberOfThreads;
+  THREADSTRUCT* str            = static_cast< THREADSTRUCT* >( info->UserData );
+
+  // The slabs are dealt to the threads in turn, which balances the
+  // load as the lung area changes smoothly from slice to slice
+  unsigned int slicesPerSlab  = str->self->NumberOfSlicesPerSlab;
+  unsigned int numberOfSlices = static_cast< unsigned int >( str->boundingBox.GetSize()[2] );
+
+  for ( unsigned int slab=threadId; slab<str->numberOfSlabs; slab += numberOfThreads )
+    {
+    str->self->ProcessSlab( str, slab*slicesPerSlab, std::min( (slab + 1)*slicesPerSlab, numberOfSlices ),
+                            (*str->threadData)[threadId] );
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+void cipFissureCascadeClassifier::ComputeHeightField( const cipThinPlateSplineSurface* surface, const cip::CTType::Pointer ctImage,
+                                                      const cip::CTType::RegionType& boundingBox, HEIGHTFIELD& heightField ) const
+{
+  cip::CTType::PointType start;
+  ctImage->TransformIndexToPhysicalPoint( boundingBox.GetIndex(), start );
+
+  double origin[2];
+    origin[0] = start[0];
+    origin[1] = start[1];
+  double spacing[2];
+    spacing[0] = ctImage->GetSpacing()[0];
+    spacing[1] = ctImage->GetSpacing()[1];
+  unsigned int size[2];
+    size[0] = static_cast< unsigned int >( boundingBox.GetSize()[0] );
+    size[1] = static_cast< unsigned int >( boundingBox.GetSize()[1] );
+
+  unsigned int numberOfColumns = size[0]*size[1];
+
+  heightField.heights.resize( numberOfColumns );
+  surface->GetSurfaceHeightGrid( origin, spacing, size, &heightField.heights[0] );
+
+  std::vector< double > x( numberOfColumns );
+  std::vector< double > y( numberOfColumns );
+  for ( unsigned int j=0; j<size[1]; j++ )
+    {
+    for ( unsigned int i=0; i<size[0]; i++ )
+      {
+      x[j*size[0] + i] = origin[0] + static_cast< double >( i )*spacing[0];
+      y[j*size[0] + i] = origin[1] + static_cast< double >( j )*spacing[1];
+      }
+    }
+
+  std::vector< double > nx( numberOfColumns );
+  std::vector< double > ny( numberOfColumns );
+  std::vector< double > nz( numberOfColumns );
+  surface->GetNonNormalizedSurfaceNormals( numberOfColumns, &x[0], &y[0], &nx[0], &ny[0], &nz[0] );
+
+  heightField.normals.resize( numberOfColumns );
+  for ( unsigned int c=0; c<numberOfColumns; c++ )
+    {
+    double mag = std::sqrt( nx[c]*nx[c] + ny[c]*ny[c] + nz[c]*nz[c] );
+
+    heightField.normals[c] = cip::Vector3( nx[c]/mag, ny[c]/mag, nz[c]/mag );
+    }
+}
+
+
+void cipFissureCascadeClassifier::ProcessSlab( const THREADSTRUCT* str, unsigned int firstSlice, unsigned int lastSlice,
+                                               THREADDATA& data ) const
+{
+  double startTime = this->Clock->GetTimeInSeconds();
+
+  std::vector< FEATUREVECTOR >& candidates = data.candidates;
+  candidates.clear();
+
+  // Select the candidates of the slab
+  unsigned int sizeX   = static_cast< unsigned int >( str->bufferedRegion.GetSize()[0] );
+  unsigned int sizeY   = static_cast< unsigned int >( str->bufferedRegion.GetSize()[1] );
+  unsigned int boxX    = static_cast< unsigned int >( str->boundingBox.GetIndex()[0] - str->bufferedRegion.GetIndex()[0] );
+  unsigned int boxY    = static_cast< unsigned int >( str->boundingBox.GetIndex()[1] - str->bufferedRegion.GetIndex()[1] );
+  unsigned int boxZ    = static_cast< unsigned int >( str->boundingBox.GetIndex()[2] - str->bufferedRegion.GetIndex()[2] );
+  unsigned int boxSizeX = static_cast< unsigned int >( str->boundingBox.GetSize()[0] );
+  unsigned int boxSizeY = static_cast< unsigned int >( str->boundingBox.GetSize()[1] );
+
+  FEATUREVECTOR vec;
+
+  for ( unsigned int z=boxZ + firstSlice; z<boxZ + lastSlice; z++ )
+    {
+    for ( unsigned int y=boxY; y<boxY + boxSizeY; y++ )
+      {
+      unsigned int offset = (z*sizeY + y)*sizeX + boxX;
+      unsigned int column = (y - boxY)*boxSizeX;
+
+      for ( unsigned int x=boxX; x<boxX + boxSizeX; x++, offset++, column++ )
+        {
+        unsigned char surface = str->labelSurfaces[str->labelBuffer[offset]];
+        if ( surface == NOSURFACE || str->ctBuffer[offset] >= -650 )
+          {
+          continue;
+          }
+
+        vec.index[0]  = str->bufferedRegion.GetIndex()[0] + x;
+        vec.index[1]  = str->bufferedRegion.GetIndex()[1] + y;
+        vec.index[2]  = str->bufferedRegion.GetIndex()[2] + z;
+        vec.offset    = offset;
+        vec.column    = column;
+        vec.surface   = surface;
+        vec.intensity = str->ctBuffer[offset];
+
+        candidates.push_back( vec );
+        }
+      }
+    }
+
+  // Each stage keeps its surviving candidates at the front of the
+  // candidates vector. The following probability thresholds correspond
+  // to a 0.995 TPR. Only considering points with at least this
+  // probability of being a fissure reduces computation (additional
+  // features are only computed for the likely candidates).
+  unsigned int numberOfSurvivors = 0;
+  for ( unsigned int c=0; c<candidates.size(); c++ )
+    {
+    double z = str->zOrigin + static_cast< double >( candidates[c].index[2] )*str->zSpacing;
+
+    this->UpdateFeatureVectorWithShapeModelInfo( z, candidates[c] );
+    if ( GetIntensityAndShapeModelFeaturesProbability( candidates[c] ) > 0.111636111749 )
+      {
+      candidates[numberOfSurvivors++] = candidates[c];
+      }
+    }
+
+  data.stageCandidates[0] += candidates.size();
+  data.stageRejections[0] += candidates.size() - numberOfSurvivors;
+  candidates.resize( numberOfSurvivors );
+
+  double stageTime = this->Clock->GetTimeInSeconds();
+  data.stageTimes[0] += stageTime - startTime;
+  startTime = stageTime;
+
+  numberOfSurvivors = 0;
+  for ( unsigned int c=0; c<candidates.size(); c++ )
+    {
+    this->UpdateFeatureVectorWithHessianInfo( data.hessianFunction, candidates[c] );
+    if ( candidates[c].eigenValues[0] < 0 &&
+         GetIntensityShapeModelAndHessianFeaturesProbability( candidates[c] ) > 0.0441242935955 )
+      {
+      candidates[numberOfSurvivors++] = candidates[c];
+      }
+    }
+
+  data.stageCandidates[1] += candidates.size();
+  data.stageRejections[1] += candidates.size() - numberOfSurvivors;
+  candidates.resize( numberOfSurvivors );
+
+  stageTime = this->Clock->GetTimeInSeconds();
+  data.stageTimes[1] += stageTime - startTime;
+  startTime = stageTime;
+
+  for ( unsigned int c=0; c<candidates.size(); c++ )
+    {
+    this->UpdateFeatureVectorWithGradientInfo( data.derivativeFunctions, candidates[c] );
+    double prob = GetIntensityShapeModelHessianAndGradientFeaturesProbability( candidates[c] );
+
+    str->outBuffer[candidates[c].offset] = short(prob*(double(candidates[c].intensity) + 1000.0) - 1000.0);
+    }
+
+  data.stageCandidates[2] += candidates.size();
+
+  data.stageTimes[2] += this->Clock->GetTimeInSeconds() - startTime;
+}
+
+
+void cipFissureCascadeClassifier::UpdateFeatureVectorWithShapeModelInfo( double z, FEATUREVECTOR& vec ) const
+{
+  // The distance to the plane tangent to the surface at the point of
+  // the surface in the voxel's column
+  if ( vec.surface == LEFTOBLIQUE )
+    {
+    const HEIGHTFIELD& lo = this->LeftObliqueHeightField;
+
+    vec.distanceToLobeSurface = std::abs( z - lo.heights[vec.column] )*lo.normals[vec.column][2];
+    }
+  else
+    {
+    const HEIGHTFIELD& ro = this->RightObliqueHeightField;
+    const HEIGHTFIELD& rh = this->RightHorizontalHeightField;
+
+    double roHeight = ro.heights[vec.column];
+    double rhHeight = rh.heights[vec.column];
+
+    double roDist = std::abs( z - roHeight )*ro.normals[vec.column][2];
+    double rhDist = std::abs( z - rhHeight )*rh.normals[vec.column][2];
+
+    if ( rhDist < roDist && rhHeight > roHeight )
+      {
+      vec.distanceToLobeSurface = rhDist;
+      vec.surface = RIGHTHORIZONTAL;
+      }
+    else
+      {
+      vec.distanceToLobeSurface = roDist;
+      vec.surface = RIGHTOBLIQUE;
+      }
+    }
+}
+
+
+void cipFissureCascadeClassifier::UpdateFeatureVectorWithHessianInfo( HessianImageFunctionType* hessianFunction,
+                                                                      FEATUREVECTOR& vec ) const
+{
+  HessianImageFunctionType::TensorType::EigenValuesArrayType eigenValues;
+  HessianImageFunctionType::TensorType::EigenVectorsMatrixType eigenVectors;
+  HessianImageFunctionType::TensorType hessian;
+
+  hessian = hessianFunction->EvaluateAtIndex( vec.index );
+  hessian.ComputeEigenAnalysis( eigenValues, eigenVectors );
+
+  for ( unsigned int i=0; i<3; i++ )
+    {
+    vec.eigenValues[i]    = eigenValues[i];
+    vec.eigenValueMags[i] = std::abs( eigenValues[i] );
+    }
+  std::sort( vec.eigenValues, vec.eigenValues + 3 );
+  std::sort( vec.eigenValueMags, vec.eigenValueMags + 3 );
+
+  cip::Vector3 eigenVector;
+  for ( unsigned int i=0; i<3; i++ )
+    {
+    if ( eigenValues[i] == vec.eigenValues[0] )
+      {
+      eigenVector = cip::Vector3( eigenVectors(i, 0), eigenVectors(i, 1), eigenVectors(i, 2) );
+      }
+    }
+
+  // The normal of the surface in the voxel's column
+  const HEIGHTFIELD* heightField = &this->RightObliqueHeightField;
+  if ( vec.surface == LEFTOBLIQUE )
+    {
+    heightField = &this->LeftObliqueHeightField;
+    }
+  else if ( vec.surface == RIGHTHORIZONTAL )
+    {
+    heightField = &this->RightHorizontalHeightField;
+    }
+
+  vec.angleWithLobeSurfaceNormal = cip::GetAngleBetweenVectors( heightField->normals[vec.column], eigenVector, true );
+
+  // Compute the pMeasaure, as given by equations 2 and 3 in 'Supervised Enhancement Filters :
+  // Application to Fissure Detection in Chest CT Scans' (van Rikxoort):
+  if ( vec.eigenValues[0] < 0 )
+    {
+    vec.pMeasure = (vec.eigenValueMags[2] - vec.eigenValueMags[0])/(vec.eigenValueMags[2] + vec.eigenValueMags[0]);
+    }
+  else
+    {
+    vec.pMeasure = 0;
+    }
+
+  // Compute the fMeasaure, as given by equation 4 in 'Supervised Enhancement Filters :
+  // Application to Fissure Detection in Chest CT Scans' (van Rikxoort):
+  double meanHU = -828.0;
+  double varHU  = 2091.0;
+  vec.fMeasure = std::exp( -std::pow( vec.intensity - meanHU, 2 )/(2*varHU) )*vec.pMeasure;
+}
+
+
+void cipFissureCascadeClassifier::UpdateFeatureVectorWithGradientInfo( DerivativeFunctionType::Pointer* derivativeFunctions,
+                                                                       FEATUREVECTOR& vec ) const
+{
+  vec.gradX = derivativeFunctions[0]->EvaluateAtIndex( vec.index );
+  vec.gradY = derivativeFunctions[1]->EvaluateAtIndex( vec.index );
+  vec.gradZ = derivativeFunctions[2]->EvaluateAtIndex( vec.index );
+
+  double grads[3];
+    grads[0] = vec.gradX;
+    grads[1] = vec.gradY;
+    grads[2] = vec.gradZ;
+  std::sort( grads, grads + 3 );
+
+  vec.gradMin = grads[0];
+  vec.gradMid = grads[1];
+  vec.gradMax = grads[2];
+
+  vec.gradientMagnitude = std::sqrt(std::pow(vec.gradX, 2) + std::pow(vec.gradY, 2) +
+                                    std::pow(vec.gradZ, 2));
+}
+
+
+double cipFissureCascadeClassifier::GetIntensityAndShapeModelFeaturesProbability( const FEATUREVECTOR& vec )
+{
+  double intercept                = 0.93411054;
+  double intensity_co             = -0.00092705723252;
+  double distanceToLobeSurface_co = -0.111715453128;
+
+  double intensity             = double(vec.intensity);
+  double distanceToLobeSurface = vec.distanceToLobeSurface;
+
+  double expArg =
+    intercept +
+    intensity*intensity_co +
+    distanceToLobeSurface*distanceToLobeSurface_co;
+
+  return 1.0/(1.0 + std::exp(-expArg));
+}
+
+
+double cipFissureCascadeClassifier::GetIntensityShapeModelAndHessianFeaturesProbability( const FEATUREVECTOR& vec )
+{
+  double intercept                     = 1.06413733;
+  double eigenValue0_co                = -0.0653800014727;
+  double eigenValue1_co                = 0.0755923725566;
+  double eigenValue2_co                = -0.0782643785069;
+  double eigenValueMag0_co             = -0.0249833783353;
+  double eigenValueMag1_co             = -0.0207810237335;
+  double eigenValueMag2_co             = 0.0252331359284;
+  double intensity_co                  = -6.9407730482e-05;
+  double distanceToLobeSurface_co      = -0.10760811744;
+  double angleWithLobeSurfaceNormal_co = -0.0697038588434;
+  double pMeasure_co                   = 1.2563839066;
+  double fMeasure_co                   = 3.1864152494;
+
+  double intensity                  = double(vec.intensity);
+  double distanceToLobeSurface      = vec.distanceToLobeSurface;
+  double eigenValue0                = vec.eigenValues[0];
+  double eigenValue1                = vec.eigenValues[1];
+  double eigenValue2                = vec.eigenValues[2];
+  double eigenValueMag0             = vec.eigenValueMags[0];
+  double eigenValueMag1             = vec.eigenValueMags[1];
+  double eigenValueMag2             = vec.eigenValueMags[2];
+  double angleWithLobeSurfaceNormal = vec.angleWithLobeSurfaceNormal;
+  double pMeasure                   = vec.pMeasure;
+  double fMeasure                   = vec.fMeasure;
+
+  // The intensity and distance terms appear twice, as in the
+  // expression the coefficients were trained with
+  double expArg =
+    intercept +
+    intensity*intensity_co +
+    distanceToLobeSurface*distanceToLobeSurface_co +
+    eigenValue0*eigenValue0_co +
+    eigenValue1*eigenValue1_co +
+    eigenValue2*eigenValue2_co +
+    eigenValueMag0*eigenValueMag0_co +
+    eigenValueMag1*eigenValueMag1_co +
+    eigenValueMag2*eigenValueMag2_co +
+    intensity*intensity_co +
+    distanceToLobeSurface*distanceToLobeSurface_co +
+    angleWithLobeSurfaceNormal*angleWithLobeSurfaceNormal_co +
+    pMeasure*pMeasure_co +
+    fMeasure*fMeasure_co;
+
+  return 1.0/(1.0 + std::exp(-expArg));
+}
+
+
+double cipFissureCascadeClassifier::GetIntensityShapeModelHessianAndGradientFeaturesProbability( const FEATUREVECTOR& vec )
+{
+  double intercept                     =  0.28011861;
+  double eigenValue0_co                = -0.0940888285617;
+  double eigenValue1_co                =  0.0875079537809;
+  double eigenValue2_co                = -0.0545950818784;
+  double eigenValueMag0_co             = -0.0502639880289;
+  double eigenValueMag1_co             = -0.0128664033151;
+  double eigenValueMag2_co             =  0.0384048373985;
+  double intensity_co                  = -0.000617640861664;
+  double distanceToLobeSurface_co      = -0.0972966395015;
+  double angleWithLobeSurfaceNormal_co = -0.0619096106263;
+  double pMeasure_co                   =  0.859674927159;
+  double fMeasure_co                   =  2.83452260844;
+  double gradX_co                      = -0.00580886202778;
+  double gradY_co                      = -0.000232390016618;
+  double gradZ_co                      = -0.00301265941143;
+  double gradientMagnitude_co          = -0.0282271325883;
+  double gradMin_co                    =  0.0200687184842;
+  double gradMid_co                    =  0.015902780787;
+  double gradMax_co                    = -0.0230877084503;
+
+  double intensity                  = double(vec.intensity);
+  double distanceToLobeSurface      = vec.distanceToLobeSurface;
+  double eigenValue0                = vec.eigenValues[0];
+  double eigenValue1                = vec.eigenValues[1];
+  double eigenValue2                = vec.eigenValues[2];
+  double eigenValueMag0             = vec.eigenValueMags[0];
+  double eigenValueMag1             = vec.eigenValueMags[1];
+  double eigenValueMag2             = vec.eigenValueMags[2];
+  double angleWithLobeSurfaceNormal = vec.angleWithLobeSurfaceNormal;
+  double pMeasure                   = vec.pMeasure;
+  double fMeasure                   = vec.fMeasure;
+  double gradX                      = vec.gradX;
+  double gradY                      = vec.gradY;
+  double gradZ                      = vec.gradZ;
+  double gradientMagnitude          = vec.gradientMagnitude;
+  double gradMin                    = vec.gradMin;
+  double gradMid                    = vec.gradMid;
+  double gradMax                    = vec.gradMax;
+
+  double expArg =
+    intercept +
+    intensity*intensity_co +
+    distanceToLobeSurface*distanceToLobeSurface_co +
+    eigenValue0*eigenValue0_co +
+    eigenValue1*eigenValue1_co +
+    eigenValue2*eigenValue2_co +
+    eigenValueMag0*eigenValueMag0_co +
+    eigenValueMag1*eigenValueMag1_co +
+    eigenValueMag2*eigenValueMag2_co +
+    intensity*intensity_co +
+    distanceToLobeSurface*distanceToLobeSurface_co +
+    angleWithLobeSurfaceNormal*angleWithLobeSurfaceNormal_co +
+    pMeasure*pMeasure_co +
+    fMeasure*fMeasure_co +
+    gradX*gradX_co +
+    gradY*gradY_co +
+    gradZ*gradZ_co +
+    gradientMagnitude*gradientMagnitude_co +
+    gradMin*gradMin_co +
+    gradMid*gradMid_co +
+    gradMax*gradMax_co;
+
+  return 1.0/(1.0 + std::exp(-expArg));
+}
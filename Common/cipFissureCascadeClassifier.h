@@ -0,0 +1,207 @@
+/**
+ *  \class cipFissureCascadeClassifier
+ *  \ingroup common
+ *  \brief This class enhances the lobe boundaries (fissures) of a CT
+ *  image with a cascade of logistic regression classifiers, each
+ *  stage using more (and more expensive) features than the previous
+ *  one.
+ *
+ *  The candidates are the lung voxels below -650 HU for which a lobe
+ *  boundary shape model is available (the left oblique surface for
+ *  the left lung, the right oblique and right horizontal surfaces for
+ *  the right lung). The stages are:
+ *
+ *  0. Intensity and distance to the shape model surface
+ *  1. Stage 0 features, Hessian eigenvalues, angle between the
+ *     Hessian eigenvector and the surface normal, and the p- and
+ *     f-measures (van Rikxoort). Candidates with a non-negative
+ *     smallest eigenvalue are rejected.
+ *  2. Stage 1 features and Gaussian derivatives
+ *
+ *  A candidate is passed to the next stage if its probability is
+ *  above the stage threshold (0.995 TPR). The output is -1000 HU
+ *  except at the candidates surviving all stages, which get their CT
+ *  value scaled by the final probability.
+ *
+ *  Only the bounding box of the candidates is visited. It is split
+ *  into slabs of slices that are distributed over the threads, and
+ *  within a slab each stage is evaluated over all the surviving
+ *  candidates before the next stage starts. The surface heights and
+ *  normals are computed once per column of the bounding box; the
+ *  distance of a voxel to a surface is its distance to the plane
+ *  tangent to the surface above or below it, which is exact for flat
+ *  surfaces and close to the true distance near the surface. The
+ *  image is assumed to be axis aligned, as the shape models are.
+ *
+ *  The number of candidates entering each stage, the number rejected
+ *  by it and the time spent in it (summed over the threads) are
+ *  available after 'Enhance'.
+ *
+ *  $Date$
+ *  $Revision$
+ *  $Author$
+ *
+ */
+
+#ifndef __cipFissureCascadeClassifier_h
+#define __cipFissureCascadeClassifier_h
+
+#include "cipHelper.h"
+#include "cipThinPlateSplineSurface.h"
+#include "itkMultiThreader.h"
+#include "itkRealTimeClock.h"
+#include "itkDiscreteHessianGaussianImageFunction.h"
+#include "itkDiscreteGaussianDerivativeImageFunction.h"
+#include <vector>
+
+class cipFissureCascadeClassifier
+{
+public:
+  typedef itk::DiscreteHessianGaussianImageFunction< cip::CTType >     HessianImageFunctionType;
+  typedef itk::DiscreteGaussianDerivativeImageFunction< cip::CTType >  DerivativeFunctionType;
+
+  cipFissureCascadeClassifier();
+  ~cipFissureCascadeClassifier();
+
+  /** The lobe boundary surfaces. The left lung is only enhanced if
+   *  the left oblique surface is set, and the right lung only if both
+   *  right surfaces are set. The surfaces must outlive 'Enhance'. */
+  void SetLeftObliqueSurface( const cipThinPlateSplineSurface* );
+  void SetRightObliqueSurface( const cipThinPlateSplineSurface* );
+  void SetRightHorizontalSurface( const cipThinPlateSplineSurface* );
+
+  /** Set the number of threads used by 'Enhance'. Defaults to the
+   *  ITK global default number of threads. */
+  void SetNumberOfThreads( unsigned int );
+  unsigned int GetNumberOfThreads() const
+    {
+      return NumberOfThreads;
+    };
+
+  /** Set the number of slices of the slabs processed by the
+   *  threads. The candidates of a slab are held in memory at
+   *  once. Defaults to 1. */
+  void SetNumberOfSlicesPerSlab( unsigned int );
+  unsigned int GetNumberOfSlicesPerSlab() const
+    {
+      return NumberOfSlicesPerSlab;
+    };
+
+  /** Compute the fissure-enhanced image. The CT image and the label
+   *  map must have the same buffered region. */
+  cip::CTType::Pointer Enhance( cip::CTType::Pointer, cip::LabelMapType::Pointer );
+
+  unsigned int GetNumberOfStages() const
+    {
+      return NUMBEROFSTAGES;
+    };
+
+  /** A short description of the specified stage */
+  const char* GetStageName( unsigned int ) const;
+
+  /** The number of candidates evaluated by the specified stage */
+  unsigned long GetNumberOfStageCandidates( unsigned int ) const;
+
+  /** The number of candidates rejected by the specified stage */
+  unsigned long GetNumberOfStageRejections( unsigned int ) const;
+
+  /** The time (in seconds) spent in the specified stage, summed over
+   *  the threads. The time of stage 0 includes the selection of the
+   *  candidates. */
+  double GetStageTime( unsigned int ) const;
+
+private:
+  enum { NUMBEROFSTAGES = 3 };
+  enum { NOSURFACE, LEFTOBLIQUE, RIGHTOBLIQUE, RIGHTHORIZONTAL };
+
+  struct FEATUREVECTOR
+  {
+    cip::CTType::IndexType index;
+    unsigned int           offset;      // in the image buffers
+    unsigned int           column;      // in the bounding box columns
+    unsigned char          surface;
+    short                  intensity;
+    double                 distanceToLobeSurface;
+    double                 angleWithLobeSurfaceNormal;
+    double                 pMeasure;
+    double                 fMeasure;
+    double                 eigenValues[3];
+    double                 eigenValueMags[3];
+    double                 gradX;
+    double                 gradY;
+    double                 gradZ;
+    double                 gradMin;
+    double                 gradMid;
+    double                 gradMax;
+    double                 gradientMagnitude;
+  };
+
+  // The heights and unit normals of a surface over the columns of the
+  // bounding box
+  struct HEIGHTFIELD
+  {
+    std::vector< double >       heights;
+    std::vector< cip::Vector3 > normals;
+  };
+
+  // What a thread owns: the image functions (which are not thread
+  // safe), the candidates buffer and the stage statistics
+  struct THREADDATA
+  {
+    HessianImageFunctionType::Pointer hessianFunction;
+    DerivativeFunctionType::Pointer   derivativeFunctions[3];
+    std::vector< FEATUREVECTOR >      candidates;
+    unsigned long                     stageCandidates[NUMBEROFSTAGES];
+    unsigned long                     stageRejections[NUMBEROFSTAGES];
+    double                            stageTimes[NUMBEROFSTAGES];
+  };
+
+  struct THREADSTRUCT
+  {
+    cipFissureCascadeClassifier* self;
+    const short*                 ctBuffer;
+    const unsigned short*        labelBuffer;
+    short*                       outBuffer;
+    const unsigned char*         labelSurfaces;
+    cip::CTType::RegionType      boundingBox;
+    cip::CTType::RegionType      bufferedRegion;
+    double                       zOrigin;
+    double                       zSpacing;
+    unsigned int                 numberOfSlabs;
+    std::vector< THREADDATA >*   threadData;
+  };
+
+  static ITK_THREAD_RETURN_TYPE ThreaderCallback( void* );
+
+  void ComputeHeightField( const cipThinPlateSplineSurface*, const cip::CTType::Pointer,
+                           const cip::CTType::RegionType&, HEIGHTFIELD& ) const;
+
+  void ProcessSlab( const THREADSTRUCT*, unsigned int, unsigned int, THREADDATA& ) const;
+
+  void UpdateFeatureVectorWithShapeModelInfo( double, FEATUREVECTOR& ) const;
+  void UpdateFeatureVectorWithHessianInfo( HessianImageFunctionType*, FEATUREVECTOR& ) const;
+  void UpdateFeatureVectorWithGradientInfo( DerivativeFunctionType::Pointer*, FEATUREVECTOR& ) const;
+
+  static double GetIntensityAndShapeModelFeaturesProbability( const FEATUREVECTOR& );
+  static double GetIntensityShapeModelAndHessianFeaturesProbability( const FEATUREVECTOR& );
+  static double GetIntensityShapeModelHessianAndGradientFeaturesProbability( const FEATUREVECTOR& );
+
+  const cipThinPlateSplineSurface* LeftObliqueSurface;
+  const cipThinPlateSplineSurface* RightObliqueSurface;
+  const cipThinPlateSplineSurface* RightHorizontalSurface;
+
+  unsigned int NumberOfThreads;
+  unsigned int NumberOfSlicesPerSlab;
+
+  HEIGHTFIELD LeftObliqueHeightField;
+  HEIGHTFIELD RightObliqueHeightField;
+  HEIGHTFIELD RightHorizontalHeightField;
+
+  itk::RealTimeClock::Pointer Clock;
+
+  unsigned long StageCandidates[NUMBEROFSTAGES];
+  unsigned long StageRejections[NUMBEROFSTAGES];
+  double        StageTimes[NUMBEROFSTAGES];
+};
+
+#endif
@@ -39,6 +39,8 @@
 #include "vtkFloatArray.h"
 #include "itkGDCMImageIO.h"
 #include "itkGDCMSeriesFileNames.h"
+#include "itkMultiThreader.h"
+#include <algorithm>
 
 
 cip::CTType::Pointer cip::ReadCTFromDirectory( std::string ctDir )
@@ -395,18 +397,29 @@ cip::CTType::Pointer cip::DownsampleCT(short samplingAmount, cip::CTType::Pointe
 
 double cip::GetVectorMagnitude(const cip::VectorType& vector)
 {
-  double magnitude = vcl_sqrt(std::pow(vector[0], 2) + std::pow(vector[1], 2) + std::pow(vector[2], 2));
+  return cip::GetVectorMagnitude(cip::Vector3(vector));
+}
+
+double cip::GetVectorMagnitude(const cip::Vector3& vector)
+{
+  double magnitude = vcl_sqrt(vector[0]*vector[0] + vector[1]*vector[1] + vector[2]*vector[2]);
 
   return magnitude;
 }
 
 double cip::GetAngleBetweenVectors(const cip::VectorType& vec1, 
 				   const cip::VectorType& vec2, bool returnDegrees)
+{
+  return cip::GetAngleBetweenVectors(cip::Vector3(vec1), cip::Vector3(vec2), returnDegrees);
+}
+
+double cip::GetAngleBetweenVectors(const cip::Vector3& vec1, 
+				   const cip::Vector3& vec2, bool returnDegrees)
 {
   double vec1Mag = cip::GetVectorMagnitude(vec1);
   double vec2Mag = cip::GetVectorMagnitude(vec2);
 
-  double arg = (vec1[0]*vec2[0] + vec1[1]*vec2[1] + vec1[2]*vec2[2])/(vec1Mag*vec2Mag);
+  double arg = cip::Dot(vec1, vec2)/(vec1Mag*vec2Mag);
 
   if ( vcl_abs( arg ) > 1.0 )
     {
@@ -537,7 +550,7 @@ void cip::ViewGraphAsPolyData(vtkSmartPointer< vtkMutableUndirectedGraph > graph
 void cip::DilateLabelMap(cip::LabelMapType::Pointer labelMap, unsigned char region, unsigned char type,
 			 unsigned int kernelRadiusX, unsigned int kernelRadiusY, unsigned int kernelRadiusZ)
 {
-  ChestConventions conventions;
+  const ChestConventions& conventions = ChestConventions::GetInstance();
 
   unsigned short labelMapValue = conventions.GetValueFromChestRegionAndType(region, type);
 
@@ -601,7 +614,7 @@ void cip::DilateLabelMap(cip::LabelMapType::Pointer labelMap, unsigned char regi
 void cip::ErodeLabelMap(cip::LabelMapType::Pointer labelMap, unsigned char region, unsigned char type,
 			unsigned int kernelRadiusX, unsigned int kernelRadiusY, unsigned int kernelRadiusZ)
 {
-  ChestConventions conventions;
+  const ChestConventions& conventions = ChestConventions::GetInstance();
 
   unsigned short labelMapValue = conventions.GetValueFromChestRegionAndType(region, type);
 
@@ -665,7 +678,7 @@ void cip::ErodeLabelMap(cip::LabelMapType::Pointer labelMap, unsigned char regio
 void cip::CloseLabelMap(cip::LabelMapType::Pointer labelMap, unsigned char region, unsigned char type,
 		     unsigned int kernelRadiusX, unsigned int kernelRadiusY, unsigned int kernelRadiusZ)
 {
-  ChestConventions conventions;
+  const ChestConventions& conventions = ChestConventions::GetInstance();
 
   unsigned short labelMapValue = conventions.GetValueFromChestRegionAndType(region, type);
 
@@ -750,7 +763,7 @@ void cip::CloseLabelMap(cip::LabelMapType::Pointer labelMap, unsigned char regio
 void cip::OpenLabelMap(cip::LabelMapType::Pointer labelMap, unsigned char region, unsigned char type,
 		       unsigned int kernelRadiusX, unsigned int kernelRadiusY, unsigned int kernelRadiusZ)
 {
-  ChestConventions conventions;
+  const ChestConventions& conventions = ChestConventions::GetInstance();
 
   unsigned short labelMapValue = conventions.GetValueFromChestRegionAndType(region, type);
 
@@ -886,7 +899,7 @@ void cip::AssertChestRegionChestTypeArrayExistence( vtkSmartPointer< vtkPolyData
 cip::LabelMapType::RegionType cip::GetLabelMapChestRegionChestTypeBoundingBoxRegion(cip::LabelMapType::Pointer labelMap,
 										    unsigned char cipRegion, unsigned char cipType)
 {
-  ChestConventions conventions;
+  const ChestConventions& conventions = ChestConventions::GetInstance();
 
   unsigned short value = conventions.GetValueFromChestRegionAndType(cipRegion, cipType);
 
@@ -1093,17 +1106,19 @@ void cip::GraftPointDataArrays( vtkSmartPointer< vtkPolyData > fromPoly, vtkSmar
 
 double cip::GetDistanceToThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, cip::PointType point )
 {
-  cipNewtonOptimizer< 2 >::PointType* domainParams = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-  (*domainParams)[0] = point[0]; 
-  (*domainParams)[1] = point[1]; 
-  
-  cipParticleToThinPlateSplineSurfaceMetric tpsMetric;
-    tpsMetric.SetThinPlateSplineSurface( tps );
-    tpsMetric.SetParticle( point );
+  return cip::GetDistanceToThinPlateSplineSurface( tps, cip::Point3( point ) );
+}
 
+double cip::GetDistanceToThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, const cip::Point3& point )
+{
+  cipNewtonOptimizer< 2 >::PointType domainParams( 2, 2 );
+    domainParams[0] = point[0]; 
+    domainParams[1] = point[1]; 
+  
   cipNewtonOptimizer< 2 > optimizer;
-    optimizer.SetMetric( tpsMetric );
-    optimizer.SetInitialParameters( domainParams );
+    optimizer.GetMetric().SetThinPlateSplineSurface( tps );
+    optimizer.GetMetric().SetParticle( point );
+    optimizer.SetInitialParameters( &domainParams );
     optimizer.Update();
 
   double distance = vcl_sqrt( optimizer.GetOptimalValue() );
@@ -1111,30 +1126,274 @@ double cip::GetDistanceToThinPlateSplineSurface( const cipThinPlateSplineSurface
   return distance;  
 }
 
-void cip::GetClosestPointOnThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, cip::PointType point, cip::PointType tpsPoint )
+void cip::GetClosestPointOnThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, cip::PointType point, cip::PointType& tpsPoint )
 {
-  cipNewtonOptimizer< 2 >::PointType* optimalParams = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
+  cip::Point3 closestPoint;
+  cip::GetClosestPointOnThinPlateSplineSurface( tps, cip::Point3( point ), closestPoint );
 
-  cipNewtonOptimizer< 2 >::PointType* domainParams = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-  (*domainParams)[0] = point[0]; 
-  (*domainParams)[1] = point[1]; 
-  
-  cipParticleToThinPlateSplineSurfaceMetric tpsMetric;
-    tpsMetric.SetThinPlateSplineSurface( tps );
-    tpsMetric.SetParticle( point );
+  tpsPoint[0] = closestPoint[0];
+  tpsPoint[1] = closestPoint[1];
+  tpsPoint[2] = closestPoint[2];
+}
 
+void cip::GetClosestPointOnThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, const cip::Point3& point, cip::Point3& tpsPoint )
+{
+  cipNewtonOptimizer< 2 >::PointType optimalParams( 2, 2 );
+
+  cipNewtonOptimizer< 2 >::PointType domainParams( 2, 2 );
+    domainParams[0] = point[0]; 
+    domainParams[1] = point[1]; 
+  
   cipNewtonOptimizer< 2 > optimizer;
-    optimizer.SetMetric( tpsMetric );
-    optimizer.SetInitialParameters( domainParams );
+    optimizer.GetMetric().SetThinPlateSplineSurface( tps );
+    optimizer.GetMetric().SetParticle( point );
+    optimizer.SetInitialParameters( &domainParams );
     optimizer.Update();
-    optimizer.GetOptimalParameters( optimalParams );
+    optimizer.GetOptimalParameters( &optimalParams );
+
+  tpsPoint[0] = optimalParams[0];
+  tpsPoint[1] = optimalParams[1];
+  tpsPoint[2] = tps.GetExactSurfaceHeight( tpsPoint[0], tpsPoint[1] );
+}
+
+// Data shared by the threads of 'GetClosestPointsOnThinPlateSplineSurface'.
+// The sorted point indices are split into contiguous chunks, one per
+// requested thread, and each chunk has its own optimizer (and metric).
+// The optimizers are created by the calling thread, before the
+// threads are spawned. 'TPoint' is 'cip::PointType' or
+// 'cip::Point3'.
+template < class TPoint >
+struct CLOSESTPOINTSTHREADSTRUCT
+{
+  const cipThinPlateSplineSurface*         tps;
+  std::vector< cipNewtonOptimizer< 2 >* >* optimizers;     // One per chunk
+  const std::vector< TPoint >*             points;
+  const std::vector< unsigned int >*       order;          // Point indices in spatial order
+  unsigned int                             numberOfChunks;
+  std::vector< TPoint >*                   closestPoints;  // NULL if only the distances are needed
+  std::vector< double >*                   distances;
+};
+
+static void SetClosestPoint( cip::PointType& tpsPoint, double x, double y, double z )
+{
+  tpsPoint.resize( 3 );
+  tpsPoint[0] = x;
+  tpsPoint[1] = y;
+  tpsPoint[2] = z;
+}
+
+static void SetClosestPoint( cip::Point3& tpsPoint, double x, double y, double z )
+{
+  tpsPoint = cip::Point3( x, y, z );
+}
+
+// Interleave the lower 16 bits of 'x' and 'y' (Morton order)
+static unsigned int GetInterleavedBits( unsigned int x, unsigned int y )
+{
+  unsigned int v[2] = { x & 0xffff, y & 0xffff };
+  for ( unsigned int i=0; i<2; i++ )
+    {
+      v[i] = (v[i] | (v[i] << 8)) & 0x00ff00ff;
+      v[i] = (v[i] | (v[i] << 4)) & 0x0f0f0f0f;
+      v[i] = (v[i] | (v[i] << 2)) & 0x33333333;
+      v[i] = (v[i] | (v[i] << 1)) & 0x55555555;
+    }
+
+  return v[0] | (v[1] << 1);
+}
+
+template < class TPoint >
+static void FindClosestPointsInChunk( const CLOSESTPOINTSTHREADSTRUCT< TPoint >& str, unsigned int chunk )
+{
+  unsigned int numberOfPoints = static_cast< unsigned int >( str.order->size() );
+  unsigned int begin = static_cast< unsigned int >( (static_cast< unsigned long >( chunk )*numberOfPoints)/str.numberOfChunks );
+  unsigned int end   = static_cast< unsigned int >( (static_cast< unsigned long >( chunk + 1 )*numberOfPoints)/str.numberOfChunks );
+
+  cipNewtonOptimizer< 2 >& optimizer = *(*str.optimizers)[chunk];
+  cipParticleToThinPlateSplineSurfaceMetric& metric = optimizer.GetMetric();
+
+  cipNewtonOptimizer< 2 >::PointType domainParams( 2, 2 );
+  cipNewtonOptimizer< 2 >::PointType warmStartParams( 2, 2 );
+  cipNewtonOptimizer< 2 >::PointType optimalParams( 2, 2 );
+
+  for ( unsigned int k=begin; k<end; k++ )
+    {
+      unsigned int i = (*str.order)[k];
+      const TPoint& point = (*str.points)[i];
+
+      metric.SetParticle( point );
+
+      domainParams[0] = point[0];
+      domainParams[1] = point[1];
+
+      // Consecutive points are spatially close, so the closest point
+      // of this one is predicted by moving the previous closest point
+      // along with the particle. The prediction is only used if it is
+      // a better start than the point's own x and y coordinates, so
+      // that far apart neighbors do not pull the search away from the
+      // minimum the single point search finds.
+      if ( k > begin )
+	{
+	  const TPoint& previous = (*str.points)[(*str.order)[k-1]];
+
+	  warmStartParams[0] = optimalParams[0] + point[0] - previous[0];
+	  warmStartParams[1] = optimalParams[1] + point[1] - previous[1];
+
+	  if ( metric.GetValue( &warmStartParams ) < metric.GetValue( &domainParams ) )
+	    {
+	      domainParams = warmStartParams;
+	    }
+	}
+
+      optimizer.SetInitialParameters( &domainParams );
+      optimizer.Update();
+      optimizer.GetOptimalParameters( &optimalParams );
+
+      (*str.distances)[i] = vcl_sqrt( optimizer.GetOptimalValue() );
+
+      if ( str.closestPoints != NULL )
+	{
+	  SetClosestPoint( (*str.closestPoints)[i], optimalParams[0], optimalParams[1],
+			   str.tps->GetExactSurfaceHeight( optimalParams[0], optimalParams[1] ) );
+	}
+    }
+}
+
+template < class TPoint >
+static ITK_THREAD_RETURN_TYPE ClosestPointsThreaderCallback( void* arg )
+{
+  itk::MultiThreader::ThreadInfoStruct* info = static_cast< itk::MultiThreader::ThreadInfoStruct* >( arg );
+
+  unsigned int threadId        = info->ThreadID;
+  unsigned int numberOfThreads = info->NumberOfThreads;
+  CLOSESTPOINTSTHREADSTRUCT< TPoint >* str = static_cast< CLOSESTPOINTSTHREADSTRUCT< TPoint >* >( info->UserData );
+
+  for ( unsigned int chunk=threadId; chunk<str->numberOfChunks; chunk += numberOfThreads )
+    {
+      FindClosestPointsInChunk( *str, chunk );
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template < class TPoint >
+static void FindClosestPointsOnThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, const std::vector< TPoint >& points,
+						       std::vector< TPoint >* closestPoints, std::vector< double >& distances,
+						       unsigned int numberOfThreads )
+{
+  unsigned int numberOfPoints = static_cast< unsigned int >( points.size() );
+
+  distances.resize( numberOfPoints );
+  if ( closestPoints != NULL )
+    {
+      closestPoints->resize( numberOfPoints );
+    }
+  if ( numberOfPoints == 0 )
+    {
+      return;
+    }
+
+  // Sort the points along a Morton curve over their xy bounding box
+  double minX = points[0][0];
+  double maxX = points[0][0];
+  double minY = points[0][1];
+  double maxY = points[0][1];
+  for ( unsigned int i=1; i<numberOfPoints; i++ )
+    {
+      minX = std::min( minX, points[i][0] );
+      maxX = std::max( maxX, points[i][0] );
+      minY = std::min( minY, points[i][1] );
+      maxY = std::max( maxY, points[i][1] );
+    }
+
+  double scaleX = maxX > minX ? 65535.0/(maxX - minX) : 0.0;
+  double scaleY = maxY > minY ? 65535.0/(maxY - minY) : 0.0;
+
+  std::vector< std::pair< unsigned int, unsigned int > > keys( numberOfPoints );
+  for ( unsigned int i=0; i<numberOfPoints; i++ )
+    {
+      unsigned int x = static_cast< unsigned int >( (points[i][0] - minX)*scaleX );
+      unsigned int y = static_cast< unsigned int >( (points[i][1] - minY)*scaleY );
+
+      keys[i] = std::make_pair( GetInterleavedBits( x, y ), i );
+    }
+  std::sort( keys.begin(), keys.end() );
+
+  std::vector< unsigned int > order( numberOfPoints );
+  for ( unsigned int i=0; i<numberOfPoints; i++ )
+    {
+      order[i] = keys[i].second;
+    }
+
+  if ( numberOfThreads == 0 )
+    {
+      numberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+    }
+  if ( numberOfThreads > numberOfPoints )
+    {
+      numberOfThreads = numberOfPoints;
+    }
+
+  // The metric is owned by the optimizer, so that setting the surface
+  // here is the only copy of the TPS made per chunk
+  std::vector< cipNewtonOptimizer< 2 >* > optimizers( numberOfThreads );
+  for ( unsigned int i=0; i<numberOfThreads; i++ )
+    {
+      optimizers[i] = new cipNewtonOptimizer< 2 >();
+      optimizers[i]->GetMetric().SetThinPlateSplineSurface( tps );
+    }
+
+  CLOSESTPOINTSTHREADSTRUCT< TPoint > str;
+    str.tps            = &tps;
+    str.optimizers     = &optimizers;
+    str.points         = &points;
+    str.order          = &order;
+    str.numberOfChunks = numberOfThreads;
+    str.closestPoints  = closestPoints;
+    str.distances      = &distances;
+
+  if ( numberOfThreads == 1 )
+    {
+      FindClosestPointsInChunk( str, 0 );
+    }
+  else
+    {
+      itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+        threader->SetNumberOfThreads( numberOfThreads );
+	threader->SetSingleMethod( ClosestPointsThreaderCallback< TPoint >, &str );
+	threader->SingleMethodExecute();
+    }
+
+  for ( unsigned int i=0; i<numberOfThreads; i++ )
+    {
+      delete optimizers[i];
+    }
+}
+
+void cip::GetClosestPointsOnThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, const std::vector< cip::PointType >& points,
+						    std::vector< cip::PointType >& closestPoints, std::vector< double >& distances,
+						    unsigned int numberOfThreads )
+{
+  FindClosestPointsOnThinPlateSplineSurface( tps, points, &closestPoints, distances, numberOfThreads );
+}
+
+void cip::GetClosestPointsOnThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, const std::vector< cip::Point3 >& points,
+						    std::vector< cip::Point3 >& closestPoints, std::vector< double >& distances,
+						    unsigned int numberOfThreads )
+{
+  FindClosestPointsOnThinPlateSplineSurface( tps, points, &closestPoints, distances, numberOfThreads );
+}
 
-  tpsPoint[0] = (*optimalParams)[0];
-  tpsPoint[1] = (*optimalParams)[1];
-  tpsPoint[2] = tps.GetSurfaceHeight( tpsPoint[0], tpsPoint[1] );
+void cip::GetDistancesToThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, const std::vector< cip::PointType >& points,
+						std::vector< double >& distances, unsigned int numberOfThreads )
+{
+  FindClosestPointsOnThinPlateSplineSurface( tps, points, static_cast< std::vector< cip::PointType >* >( NULL ), distances, numberOfThreads );
+}
 
-  delete optimalParams;
-  delete domainParams;
+void cip::GetDistancesToThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, const std::vector< cip::Point3 >& points,
+						std::vector< double >& distances, unsigned int numberOfThreads )
+{
+  FindClosestPointsOnThinPlateSplineSurface( tps, points, static_cast< std::vector< cip::Point3 >* >( NULL ), distances, numberOfThreads );
 }
 
 void cip::TransferFieldDataToFromPointData( vtkSmartPointer< vtkPolyData > inPolyData, vtkSmartPointer< vtkPolyData > outPolyData,
@@ -1237,3 +1496,398 @@ void cip::TransferFieldDataToFromPointData( vtkSmartPointer< vtkPolyData > inPol
 	}
     }  
 }
+
+// Data shared by the threads of 'GetParticleGraphEdges'. The particles
+// are sorted by grid cell, and the occupied cells are split into
+// contiguous chunks, one per requested thread. Each chunk collects the
+// edges of the particles in its cells.
+struct PARTICLEGRAPHTHREADSTRUCT
+{
+  const std::vector< double >*                 points;        // Three entries per particle
+  const std::vector< double >*                 vectors;       // Three entries per particle
+  const std::vector< unsigned int >*           order;         // Particle indices sorted by cell
+  const std::vector< int >*                    cells;         // Occupied cells (three entries per cell), sorted
+  const std::vector< unsigned int >*           cellStarts;    // Start of each cell in 'order', plus the end
+  double                                       distanceThreshold;
+  double                                       angleSigma;
+  unsigned int                                 numberOfChunks;
+  std::vector< std::vector< unsigned int > >*  chunkEdgeParticles;
+  std::vector< std::vector< double > >*        chunkEdgeWeights;
+};
+
+// Orders grid cells (three entries each) by z, then y, then x
+static bool IsCellLess( const int* cell1, const int* cell2 )
+{
+  for ( int d=2; d>=0; d-- )
+    {
+      if ( cell1[d] != cell2[d] )
+	{
+	  return cell1[d] < cell2[d];
+	}
+    }
+
+  return false;
+}
+
+struct PARTICLECELLORDER
+{
+  const int* particleCells;
+
+  bool operator()( unsigned int particle1, unsigned int particle2 ) const
+  {
+    if ( IsCellLess( particleCells + 3*particle1, particleCells + 3*particle2 ) )
+      {
+	return true;
+      }
+    if ( IsCellLess( particleCells + 3*particle2, particleCells + 3*particle1 ) )
+      {
+	return false;
+      }
+
+    return particle1 < particle2;
+  }
+};
+
+// Returns the index of the occupied cell, or the number of occupied
+// cells if the cell is empty
+static unsigned int FindOccupiedCell( const std::vector< int >& cells, const int* cell )
+{
+  unsigned int numberOfCells = static_cast< unsigned int >( cells.size()/3 );
+
+  unsigned int low  = 0;
+  unsigned int high = numberOfCells;
+  while ( low < high )
+    {
+      unsigned int mid = (low + high)/2;
+      if ( IsCellLess( &cells[3*mid], cell ) )
+	{
+	  low = mid + 1;
+	}
+      else
+	{
+	  high = mid;
+	}
+    }
+
+  if ( low < numberOfCells && !IsCellLess( cell, &cells[3*low] ) )
+    {
+      return low;
+    }
+
+  return numberOfCells;
+}
+
+static void GetParticleGraphEdgesInChunk( const PARTICLEGRAPHTHREADSTRUCT& str, unsigned int chunk )
+{
+  unsigned int numberOfCells = static_cast< unsigned int >( str.cells->size()/3 );
+  unsigned int begin = static_cast< unsigned int >( (static_cast< unsigned long >( chunk )*numberOfCells)/str.numberOfChunks );
+  unsigned int end   = static_cast< unsigned int >( (static_cast< unsigned long >( chunk + 1 )*numberOfCells)/str.numberOfChunks );
+
+  std::vector< unsigned int >& edgeParticles = (*str.chunkEdgeParticles)[chunk];
+  std::vector< double >&       edgeWeights   = (*str.chunkEdgeWeights)[chunk];
+
+  cip::Vector3 connectingVec;
+  cip::Vector3 particle1Vec;
+  cip::Vector3 particle2Vec;
+
+  int neighborCell[3];
+
+  for ( unsigned int c=begin; c<end; c++ )
+    {
+      const int* cell = &(*str.cells)[3*c];
+
+      for ( int z=-1; z<=1; z++ )
+	{
+	  for ( int y=-1; y<=1; y++ )
+	    {
+	      for ( int x=-1; x<=1; x++ )
+		{
+		  neighborCell[0] = cell[0] + x;
+		  neighborCell[1] = cell[1] + y;
+		  neighborCell[2] = cell[2] + z;
+
+		  unsigned int n = FindOccupiedCell( *str.cells, neighborCell );
+		  if ( n == numberOfCells )
+		    {
+		      continue;
+		    }
+
+		  // Each pair is tested once, from the cell of the particle
+		  // with the smaller ID
+		  for ( unsigned int a=(*str.cellStarts)[c]; a<(*str.cellStarts)[c+1]; a++ )
+		    {
+		      unsigned int i = (*str.order)[a];
+		      const double* point1 = &(*str.points)[3*i];
+
+		      for ( unsigned int b=(*str.cellStarts)[n]; b<(*str.cellStarts)[n+1]; b++ )
+			{
+			  unsigned int j = (*str.order)[b];
+			  if ( j <= i )
+			    {
+			      continue;
+			    }
+
+			  const double* point2 = &(*str.points)[3*j];
+
+			  connectingVec[0] = point1[0] - point2[0];
+			  connectingVec[1] = point1[1] - point2[1];
+			  connectingVec[2] = point1[2] - point2[2];
+
+			  double connectorMagnitude = cip::GetVectorMagnitude( connectingVec );
+
+			  if ( connectorMagnitude > str.distanceThreshold )
+			    {
+			      continue;
+			    }
+
+			  for ( unsigned int d=0; d<3; d++ )
+			    {
+			      particle1Vec[d] = (*str.vectors)[3*i + d];
+			      particle2Vec[d] = (*str.vectors)[3*j + d];
+			    }
+
+			  double angle1 = cip::GetAngleBetweenVectors( particle1Vec, connectingVec, true );
+			  double angle2 = cip::GetAngleBetweenVectors( particle2Vec, connectingVec, true );
+			  double angle  = angle1 < angle2 ? angle1 : angle2;
+
+			  edgeParticles.push_back( i );
+			  edgeParticles.push_back( j );
+			  edgeWeights.push_back( connectorMagnitude*(1.0 + std::exp( -std::pow( (90.0 - angle)/str.angleSigma, 2 ) )) );
+			}
+		    }
+		}
+	    }
+	}
+    }
+}
+
+static ITK_THREAD_RETURN_TYPE ParticleGraphThreaderCallback( void* arg )
+{
+  itk::MultiThreader::ThreadInfoStruct* info = static_cast< itk::MultiThreader::ThreadInfoStruct* >( arg );
+
+  unsigned int threadId        = info->ThreadID;
+  unsigned int numberOfThreads = info->NumberOfThreads;
+  PARTICLEGRAPHTHREADSTRUCT* str = static_cast< PARTICLEGRAPHTHREADSTRUCT* >( info->UserData );
+
+  for ( unsigned int chunk=threadId; chunk<str->numberOfChunks; chunk += numberOfThreads )
+    {
+      GetParticleGraphEdgesInChunk( *str, chunk );
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void cip::GetParticleGraphEdges( vtkSmartPointer< vtkPolyData > particles, std::string vectorArrayName, double distanceThreshold,
+				 double angleSigma, std::vector< unsigned int >* edgeParticles, std::vector< double >* edgeWeights,
+				 unsigned int numberOfThreads )
+{
+  edgeParticles->clear();
+  edgeWeights->clear();
+
+  unsigned int numberOfParticles = particles->GetNumberOfPoints();
+  if ( numberOfParticles == 0 )
+    {
+      return;
+    }
+
+  vtkDataArray* vectorArray = particles->GetPointData()->GetArray( vectorArrayName.c_str() );
+
+  std::vector< double > points( 3*numberOfParticles );
+  std::vector< double > vectors( 3*numberOfParticles );
+  for ( unsigned int i=0; i<numberOfParticles; i++ )
+    {
+      particles->GetPoint( i, &points[3*i] );
+      vectorArray->GetTuple( i, &vectors[3*i] );
+    }
+
+  // Any pair of particles within the distance threshold lies in the
+  // same or in neighboring grid cells. The cells are made slightly
+  // larger than the threshold to absorb round off, and large enough
+  // that the cell indices do not overflow.
+  double minPoint[3] = { points[0], points[1], points[2] };
+  double maxPoint[3] = { points[0], points[1], points[2] };
+  for ( unsigned int i=1; i<numberOfParticles; i++ )
+    {
+      for ( unsigned int d=0; d<3; d++ )
+	{
+	  minPoint[d] = std::min( minPoint[d], points[3*i + d] );
+	  maxPoint[d] = std::max( maxPoint[d], points[3*i + d] );
+	}
+    }
+
+  double cellSize = distanceThreshold*(1.0 + 1e-6);
+  for ( unsigned int d=0; d<3; d++ )
+    {
+      cellSize = std::max( cellSize, (maxPoint[d] - minPoint[d])*1e-6 );
+    }
+  if ( !(cellSize > 0.0) )
+    {
+      cellSize = 1.0;
+    }
+
+  std::vector< int > particleCells( 3*numberOfParticles );
+  std::vector< unsigned int > order( numberOfParticles );
+  for ( unsigned int i=0; i<numberOfParticles; i++ )
+    {
+      for ( unsigned int d=0; d<3; d++ )
+	{
+	  particleCells[3*i + d] = static_cast< int >( std::floor( (points[3*i + d] - minPoint[d])/cellSize ) );
+	}
+      order[i] = i;
+    }
+
+  PARTICLECELLORDER cellOrder;
+    cellOrder.particleCells = &particleCells[0];
+
+  std::sort( order.begin(), order.end(), cellOrder );
+
+  std::vector< int >          cells;
+  std::vector< unsigned int > cellStarts;
+  for ( unsigned int k=0; k<numberOfParticles; k++ )
+    {
+      const int* cell = &particleCells[3*order[k]];
+
+      if ( k == 0 || IsCellLess( &particleCells[3*order[k-1]], cell ) )
+	{
+	  cells.insert( cells.end(), cell, cell + 3 );
+	  cellStarts.push_back( k );
+	}
+    }
+  cellStarts.push_back( numberOfParticles );
+
+  unsigned int numberOfCells = static_cast< unsigned int >( cellStarts.size() - 1 );
+
+  if ( numberOfThreads == 0 )
+    {
+      numberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+    }
+  if ( numberOfThreads > numberOfCells )
+    {
+      numberOfThreads = numberOfCells;
+    }
+
+  std::vector< std::vector< unsigned int > > chunkEdgeParticles( numberOfThreads );
+  std::vector< std::vector< double > >       chunkEdgeWeights( numberOfThreads );
+
+  PARTICLEGRAPHTHREADSTRUCT str;
+    str.points             = &points;
+    str.vectors            = &vectors;
+    str.order              = &order;
+    str.cells              = &cells;
+    str.cellStarts         = &cellStarts;
+    str.distanceThreshold  = distanceThreshold;
+    str.angleSigma         = angleSigma;
+    str.numberOfChunks     = numberOfThreads;
+    str.chunkEdgeParticles = &chunkEdgeParticles;
+    str.chunkEdgeWeights   = &chunkEdgeWeights;
+
+  if ( numberOfThreads == 1 )
+    {
+      GetParticleGraphEdgesInChunk( str, 0 );
+    }
+  else
+    {
+      itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+        threader->SetNumberOfThreads( numberOfThreads );
+	threader->SetSingleMethod( ParticleGraphThreaderCallback, &str );
+	threader->SingleMethodExecute();
+    }
+
+  // Gather the edges of all chunks in increasing order of their
+  // particle IDs
+  std::vector< std::pair< std::pair< unsigned int, unsigned int >, double > > edges;
+  for ( unsigned int chunk=0; chunk<numberOfThreads; chunk++ )
+    {
+      for ( unsigned int e=0; e<chunkEdgeWeights[chunk].size(); e++ )
+	{
+	  edges.push_back( std::make_pair( std::make_pair( chunkEdgeParticles[chunk][2*e], chunkEdgeParticles[chunk][2*e + 1] ),
+					   chunkEdgeWeights[chunk][e] ) );
+	}
+    }
+  std::sort( edges.begin(), edges.end() );
+
+  edgeParticles->resize( 2*edges.size() );
+  edgeWeights->resize( edges.size() );
+  for ( unsigned int e=0; e<edges.size(); e++ )
+    {
+      (*edgeParticles)[2*e]     = edges[e].first.first;
+      (*edgeParticles)[2*e + 1] = edges[e].first.second;
+      (*edgeWeights)[e]         = edges[e].second;
+    }
+}
+
+struct EDGEWEIGHTORDER
+{
+  const double* weights;
+
+  bool operator()( unsigned int edge1, unsigned int edge2 ) const
+  {
+    return weights[edge1] < weights[edge2];
+  }
+};
+
+// Find the root of the node's set, halving the path along the way
+static unsigned int FindSetRoot( std::vector< unsigned int >& parents, unsigned int node )
+{
+  while ( parents[node] != node )
+    {
+      parents[node] = parents[parents[node]];
+      node = parents[node];
+    }
+
+  return node;
+}
+
+void cip::GetMinimumSpanningForestEdges( unsigned int numberOfNodes, const std::vector< unsigned int >& edgeNodes,
+					 const std::vector< double >& edgeWeights, std::vector< unsigned int >* forestEdges )
+{
+  forestEdges->clear();
+
+  unsigned int numberOfEdges = static_cast< unsigned int >( edgeWeights.size() );
+  if ( numberOfEdges == 0 )
+    {
+      return;
+    }
+
+  std::vector< unsigned int > order( numberOfEdges );
+  for ( unsigned int e=0; e<numberOfEdges; e++ )
+    {
+      order[e] = e;
+    }
+
+  EDGEWEIGHTORDER weightOrder;
+    weightOrder.weights = &edgeWeights[0];
+
+  std::stable_sort( order.begin(), order.end(), weightOrder );
+
+  // Union-find over the nodes, merging the smaller set into the larger
+  std::vector< unsigned int > parents( numberOfNodes );
+  std::vector< unsigned int > setSizes( numberOfNodes, 1 );
+  for ( unsigned int n=0; n<numberOfNodes; n++ )
+    {
+      parents[n] = n;
+    }
+
+  for ( unsigned int k=0; k<numberOfEdges && forestEdges->size()+1 < numberOfNodes; k++ )
+    {
+      unsigned int e = order[k];
+
+      unsigned int root1 = FindSetRoot( parents, edgeNodes[2*e] );
+      unsigned int root2 = FindSetRoot( parents, edgeNodes[2*e + 1] );
+      if ( root1 == root2 )
+	{
+	  continue;
+	}
+
+      if ( setSizes[root1] < setSizes[root2] )
+	{
+	  std::swap( root1, root2 );
+	}
+      parents[root2]    = root1;
+      setSizes[root1]  += setSizes[root2];
+
+      forestEdges->push_back( e );
+    }
+
+  std::sort( forestEdges->begin(), forestEdges->end() );
+}
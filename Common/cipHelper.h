@@ -77,6 +77,11 @@ namespace cip {
    * in radians, but it can also be returned in degrees by setting 'returnDegrees' to 'true'. */
   double GetAngleBetweenVectors(const cip::VectorType& vec1, const cip::VectorType& vec2, bool returnDegrees = false);
 
+  /** Fixed size versions of 'GetVectorMagnitude' and 'GetAngleBetweenVectors'. They give the
+   *  same results as the 'VectorType' versions without allocating. */
+  double GetVectorMagnitude(const cip::Vector3& vector);
+  double GetAngleBetweenVectors(const cip::Vector3& vec1, const cip::Vector3& vec2, bool returnDegrees = false);
+
   /** Render a vtk-style graph for visualization */
   void ViewGraph(vtkSmartPointer< vtkMutableDirectedGraph > graph);
 
@@ -131,8 +136,10 @@ namespace cip {
   void GraftPointDataArrays( vtkSmartPointer< vtkPolyData >, vtkSmartPointer< vtkPolyData > );
   
   /** Given a thin plate spline surface and a point, this function will find the minimum distance
-   *  to the surface */
+   *  to the surface. If an approximation tolerance is set on the surface, the surface heights are
+   *  evaluated with its far-field approximation. */
   double GetDistanceToThinPlateSplineSurface( const cipThinPlateSplineSurface&, cip::PointType );
+  double GetDistanceToThinPlateSplineSurface( const cipThinPlateSplineSurface&, const cip::Point3& );
 
   /**Transfers the contents of a VTK polydata's field data to point data and vice-versa. 
    * Generally, field data applies to a dataset as a whole and need not have a one-to-one 
@@ -145,7 +152,50 @@ namespace cip {
 
   /** Given a thin plate spline surface and some point in 3D space, this function will 
    *  compute the closest point on the surface and set it to tpsPoint. */
-  void GetClosestPointOnThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, cip::PointType point, cip::PointType tpsPoint );
+  void GetClosestPointOnThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, cip::PointType point, cip::PointType& tpsPoint );
+  void GetClosestPointOnThinPlateSplineSurface( const cipThinPlateSplineSurface& tps, const cip::Point3& point, cip::Point3& tpsPoint );
+
+  /** Batch version of 'GetClosestPointOnThinPlateSplineSurface' and 'GetDistanceToThinPlateSplineSurface'
+   *  for a whole set of points (e.g. all the particles of a data set). The closest points and the distances
+   *  are returned in the order of the input points. The points are visited in spatial order, and each
+   *  search starts from the closest point of the previous point (shifted by the offset between the two
+   *  points) whenever that is a better start than the point's own x and y coordinates, so distances
+   *  agree with the single point search up to the optimizer's stopping tolerance. The points are split
+   *  between threads (the ITK global default number of threads is used if the number of threads is
+   *  zero), and each thread reuses a single metric and optimizer. */
+  void GetClosestPointsOnThinPlateSplineSurface( const cipThinPlateSplineSurface&, const std::vector< cip::PointType >&,
+						 std::vector< cip::PointType >&, std::vector< double >&,
+						 unsigned int numberOfThreads = 0 );
+  void GetClosestPointsOnThinPlateSplineSurface( const cipThinPlateSplineSurface&, const std::vector< cip::Point3 >&,
+						 std::vector< cip::Point3 >&, std::vector< double >&,
+						 unsigned int numberOfThreads = 0 );
+
+  /** Batch version of 'GetDistanceToThinPlateSplineSurface'. See 'GetClosestPointsOnThinPlateSplineSurface'. */
+  void GetDistancesToThinPlateSplineSurface( const cipThinPlateSplineSurface&, const std::vector< cip::PointType >&,
+					     std::vector< double >&, unsigned int numberOfThreads = 0 );
+  void GetDistancesToThinPlateSplineSurface( const cipThinPlateSplineSurface&, const std::vector< cip::Point3 >&,
+					     std::vector< double >&, unsigned int numberOfThreads = 0 );
+
+  /** Get the weighted edges of the graph used to define a topology on airway or vessel particles.
+   *  Two particles are connected if they are no farther apart than 'distanceThreshold'. The edge
+   *  weight is the distance between the particles times 1 + exp(-((90 - angle)/angleSigma)^2),
+   *  where 'angle' is the smaller of the angles (in degrees) between each particle's orientation
+   *  vector (the point data array named 'vectorArrayName') and the vector connecting the
+   *  particles. Only particles in neighboring cells of a uniform grid (with cells as large as the
+   *  distance threshold) are tested, and the tests are split between threads (the ITK global
+   *  default number of threads is used if the number of threads is zero). The edges are returned
+   *  in increasing order of their particle IDs (smaller ID first), with two entries per edge in
+   *  'edgeParticles'. */
+  void GetParticleGraphEdges( vtkSmartPointer< vtkPolyData >, std::string vectorArrayName, double distanceThreshold,
+			      double angleSigma, std::vector< unsigned int >* edgeParticles, std::vector< double >* edgeWeights,
+			      unsigned int numberOfThreads = 0 );
+
+  /** Compute the minimum spanning forest of a weighted graph with Kruskal's algorithm. The graph
+   *  has 'numberOfNodes' nodes and its edges are given by 'edgeNodes' (two node IDs per edge)
+   *  and 'edgeWeights'. Edges with equal weights are considered in the order they are given. The
+   *  indices of the forest edges are returned in increasing order. */
+  void GetMinimumSpanningForestEdges( unsigned int numberOfNodes, const std::vector< unsigned int >& edgeNodes,
+				      const std::vector< double >& edgeWeights, std::vector< unsigned int >* forestEdges );
 }  
 
 #endif
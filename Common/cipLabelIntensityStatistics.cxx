@@ -0,0 +1,333 @@
+/**
+ *
+ *  $Date$
+ *  $Revision$
+ *  $Author$
+ *
+ */
+
+#include "cipLabelIntensityStatistics.h"
+#include "cipExceptionObject.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+cipLabelIntensityStatistics::cipLabelIntensityStatistics()
+{
+  this->NumberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+
+  InitializeTable( this->Table );
+}
+
+
+cipLabelIntensityStatistics::~cipLabelIntensityStatistics()
+{
+}
+
+
+void cipLabelIntensityStatistics::SetNumberOfThreads( unsigned int numberOfThreads )
+{
+  this->NumberOfThreads = numberOfThreads > 0 ? numberOfThreads : 1;
+}
+
+
+void cipLabelIntensityStatistics::Reset()
+{
+  InitializeTable( this->Table );
+  this->Labels.clear();
+}
+
+
+void cipLabelIntensityStatistics::InitializeTable( LABELTABLE& table )
+{
+  table.slots.assign( 65536, -1 );
+  table.labels.clear();
+  table.accumulators.clear();
+  table.histograms.clear();
+}
+
+
+int cipLabelIntensityStatistics::AddLabel( unsigned short label, LABELTABLE& table )
+{
+  ACCUMULATOR accumulator;
+    accumulator.count = 0;
+    accumulator.mean  = 0.0;
+    accumulator.m2    = 0.0;
+    accumulator.min   = SHRT_MAX;
+    accumulator.max   = SHRT_MIN;
+
+  int slot = static_cast< int >( table.labels.size() );
+
+  table.slots[label] = slot;
+  table.labels.push_back( label );
+  table.accumulators.push_back( accumulator );
+  table.histograms.push_back( std::vector< unsigned int >( 65536, 0 ) );
+
+  return slot;
+}
+
+
+void cipLabelIntensityStatistics::AddImage( cip::CTType::Pointer ctImage, cip::LabelMapType::Pointer labelMap )
+{
+  cip::CTType::RegionType       ctRegion = ctImage->GetBufferedRegion();
+  cip::LabelMapType::RegionType lmRegion = labelMap->GetBufferedRegion();
+
+  if ( ctRegion.GetSize() != lmRegion.GetSize() )
+    {
+    throw cip::ExceptionObject( __FILE__, __LINE__, "cipLabelIntensityStatistics::AddImage()",
+                                "CT image and label map sizes differ" );
+    }
+
+  unsigned int sliceSize      = ctRegion.GetSize()[0]*ctRegion.GetSize()[1];
+  unsigned int numberOfSlices = ctRegion.GetSize()[2];
+
+  unsigned int numberOfThreads = this->NumberOfThreads;
+  if ( numberOfThreads > numberOfSlices )
+    {
+    numberOfThreads = numberOfSlices > 0 ? numberOfSlices : 1;
+    }
+
+  // Each slab accumulates into its own table, merged below
+  std::vector< LABELTABLE > slabTables( numberOfThreads );
+  for ( unsigned int t=0; t<numberOfThreads; t++ )
+    {
+    InitializeTable( slabTables[t] );
+    }
+
+  THREADSTRUCT str;
+    str.self           = this;
+    str.ctBuffer       = ctImage->GetBufferPointer();
+    str.labelBuffer    = labelMap->GetBufferPointer();
+    str.sliceSize      = sliceSize;
+    str.numberOfSlices = numberOfSlices;
+    str.slabTables     = &slabTables;
+
+  if ( numberOfThreads == 1 )
+    {
+    this->AccumulateSlab( str.ctBuffer, str.labelBuffer, sliceSize*numberOfSlices, slabTables[0] );
+    }
+  else
+    {
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+      threader->SetNumberOfThreads( numberOfThreads );
+      threader->SetSingleMethod( cipLabelIntensityStatistics::ThreaderCallback, &str );
+      threader->SingleMethodExecute();
+    }
+
+  for ( unsigned int t=0; t<numberOfThreads; t++ )
+    {
+    this->MergeTable( slabTables[t] );
+    }
+
+  this->Labels = this->Table.labels;
+  std::sort( this->Labels.begin(), this->Labels.end() );
+}
+
+
+ITK_THREAD_RETURN_TYPE cipLabelIntensityStatistics::ThreaderCallback( void* arg )
+{
+  itk::MultiThreader::ThreadInfoStruct* info = static_cast< itk::MultiThreader::ThreadInfoStruct* >( arg );
+
+  unsigned int threadId        = info->ThreadID;
+  unsigned int numberOfThreads = info->NumberOfThreads;
+  THREADSTRUCT* str            = static_cast< THREADSTRUCT* >( info->UserData );
+
+  // There is one slab per requested thread. The multithreader may run
+  // fewer threads than requested, in which case a thread processes
+  // several slabs (each slab has its own table).
+  unsigned int numberOfSlabs = static_cast< unsigned int >( str->slabTables->size() );
+
+  for ( unsigned int slab=threadId; slab<numberOfSlabs; slab += numberOfThreads )
+    {
+    unsigned int firstSlice = static_cast< unsigned int >( (static_cast< unsigned long >( slab )*str->numberOfSlices)/numberOfSlabs );
+    unsigned int lastSlice  = static_cast< unsigned int >( (static_cast< unsigned long >( slab + 1 )*str->numberOfSlices)/numberOfSlabs );
+    unsigned long offset    = static_cast< unsigned long >( firstSlice )*str->sliceSize;
+
+    str->self->AccumulateSlab( str->ctBuffer + offset, str->labelBuffer + offset,
+                               (lastSlice - firstSlice)*str->sliceSize, (*str->slabTables)[slab] );
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+void cipLabelIntensityStatistics::AccumulateSlab( const short* ct, const unsigned short* labels,
+                                                  unsigned int numberOfVoxels, LABELTABLE& table ) const
+{
+  for ( unsigned int v=0; v<numberOfVoxels; v++ )
+    {
+    unsigned short label = labels[v];
+    if ( label == 0 )
+      {
+      continue;
+      }
+
+    int slot = table.slots[label];
+    if ( slot < 0 )
+      {
+      slot = AddLabel( label, table );
+      }
+
+    short        value       = ct[v];
+    ACCUMULATOR& accumulator = table.accumulators[slot];
+
+    accumulator.count++;
+
+    double delta = value - accumulator.mean;
+    accumulator.mean += delta/static_cast< double >( accumulator.count );
+    accumulator.m2   += delta*(value - accumulator.mean);
+
+    value < accumulator.min ? accumulator.min = value : false;
+    value > accumulator.max ? accumulator.max = value : false;
+
+    table.histograms[slot][static_cast< int >( value ) - SHRT_MIN]++;
+    }
+}
+
+
+void cipLabelIntensityStatistics::MergeTable( const LABELTABLE& from )
+{
+  for ( unsigned int s=0; s<from.labels.size(); s++ )
+    {
+    unsigned short label = from.labels[s];
+
+    int slot = this->Table.slots[label];
+    if ( slot < 0 )
+      {
+      slot = AddLabel( label, this->Table );
+      }
+
+    const ACCUMULATOR& fromAccumulator = from.accumulators[s];
+    ACCUMULATOR&       accumulator     = this->Table.accumulators[slot];
+
+    double count     = static_cast< double >( accumulator.count );
+    double fromCount = static_cast< double >( fromAccumulator.count );
+    double total     = count + fromCount;
+    double delta     = fromAccumulator.mean - accumulator.mean;
+
+    accumulator.mean  += delta*fromCount/total;
+    accumulator.m2    += fromAccumulator.m2 + delta*delta*count*fromCount/total;
+    accumulator.count += fromAccumulator.count;
+
+    fromAccumulator.min < accumulator.min ? accumulator.min = fromAccumulator.min : false;
+    fromAccumulator.max > accumulator.max ? accumulator.max = fromAccumulator.max : false;
+
+    const unsigned int* fromHistogram = &from.histograms[s][0];
+    unsigned int*       histogram     = &this->Table.histograms[slot][0];
+
+    for ( unsigned int i=0; i<65536; i++ )
+      {
+      histogram[i] += fromHistogram[i];
+      }
+    }
+}
+
+
+bool cipLabelIntensityStatistics::HasLabel( unsigned short label ) const
+{
+  return this->Table.slots[label] >= 0;
+}
+
+
+const cipLabelIntensityStatistics::ACCUMULATOR&
+cipLabelIntensityStatistics::GetAccumulator( unsigned short label, const char* method ) const
+{
+  int slot = this->Table.slots[label];
+  if ( slot < 0 )
+    {
+    throw cip::ExceptionObject( __FILE__, __LINE__, method, "No voxel accumulated for label" );
+    }
+
+  return this->Table.accumulators[slot];
+}
+
+
+unsigned long cipLabelIntensityStatistics::GetNumberOfVoxels( unsigned short label ) const
+{
+  return this->GetAccumulator( label, "cipLabelIntensityStatistics::GetNumberOfVoxels()" ).count;
+}
+
+
+double cipLabelIntensityStatistics::GetMean( unsigned short label ) const
+{
+  return this->GetAccumulator( label, "cipLabelIntensityStatistics::GetMean()" ).mean;
+}
+
+
+double cipLabelIntensityStatistics::GetVariance( unsigned short label ) const
+{
+  const ACCUMULATOR& accumulator = this->GetAccumulator( label, "cipLabelIntensityStatistics::GetVariance()" );
+
+  return accumulator.m2/static_cast< double >( accumulator.count );
+}
+
+
+double cipLabelIntensityStatistics::GetSTD( unsigned short label ) const
+{
+  return std::sqrt( this->GetVariance( label ) );
+}
+
+
+short cipLabelIntensityStatistics::GetMin( unsigned short label ) const
+{
+  return this->GetAccumulator( label, "cipLabelIntensityStatistics::GetMin()" ).min;
+}
+
+
+short cipLabelIntensityStatistics::GetMax( unsigned short label ) const
+{
+  return this->GetAccumulator( label, "cipLabelIntensityStatistics::GetMax()" ).max;
+}
+
+
+short cipLabelIntensityStatistics::GetPercentile( unsigned short label, double percentile ) const
+{
+  const ACCUMULATOR& accumulator = this->GetAccumulator( label, "cipLabelIntensityStatistics::GetPercentile()" );
+
+  if ( percentile < 0.0 || percentile > 100.0 )
+    {
+    throw cip::ExceptionObject( __FILE__, __LINE__, "cipLabelIntensityStatistics::GetPercentile()",
+                                "Percentile must be in [0, 100]" );
+    }
+
+  unsigned long rank = static_cast< unsigned long >( std::floor( percentile*static_cast< double >( accumulator.count )/100.0 ) );
+  if ( rank >= accumulator.count )
+    {
+    rank = accumulator.count - 1;
+    }
+
+  // Walk the bins between the minimum and the maximum until more than
+  // 'rank' values have been counted
+  const unsigned int* histogram = this->GetHistogram( label );
+
+  unsigned long cumulativeCount = 0;
+  for ( int value=accumulator.min; value<accumulator.max; value++ )
+    {
+    cumulativeCount += histogram[value - SHRT_MIN];
+    if ( cumulativeCount > rank )
+      {
+      return static_cast< short >( value );
+      }
+    }
+
+  return accumulator.max;
+}
+
+
+short cipLabelIntensityStatistics::GetMedian( unsigned short label ) const
+{
+  return this->GetPercentile( label, 50.0 );
+}
+
+
+const unsigned int* cipLabelIntensityStatistics::GetHistogram( unsigned short label ) const
+{
+  int slot = this->Table.slots[label];
+  if ( slot < 0 )
+    {
+    throw cip::ExceptionObject( __FILE__, __LINE__, "cipLabelIntensityStatistics::GetHistogram()",
+                                "No voxel accumulated for label" );
+    }
+
+  return &this->Table.histograms[slot][0];
+}
@@ -0,0 +1,142 @@
+/**
+ *  \class cipLabelIntensityStatistics
+ *  \ingroup common
+ *  \brief This class accumulates intensity statistics for every label
+ *  value of a label map in a single pass over a CT image and the
+ *  label map.
+ *
+ *  Each label present in the label map gets an accumulator of the
+ *  voxel count, mean and sum of squared deviations from the mean
+ *  (updated with Welford's method), minimum and maximum, and a dense
+ *  histogram with one bin per short value. Labels are found through a
+ *  table indexed by label value, so the voxel loop does no searching,
+ *  and the medians and percentiles read from the histograms are
+ *  exact. The memory used depends on the number of labels only, not
+ *  on the size of the image.
+ *
+ *  The voxel accumulation is split into slabs along the z axis, each
+ *  processed by its own thread into its own accumulators and
+ *  histograms. These are merged at the end (the means and sums of
+ *  squared deviations with the pairwise update of Chan et al.), so
+ *  the results do not depend on the number of threads up to rounding.
+ *  'AddImage' can be called several times; the statistics then cover
+ *  all the images added. Voxels with label zero are ignored.
+ *
+ *  $Date$
+ *  $Revision$
+ *  $Author$
+ *
+ */
+
+#ifndef __cipLabelIntensityStatistics_h
+#define __cipLabelIntensityStatistics_h
+
+#include "cipHelper.h"
+#include "itkMultiThreader.h"
+#include <vector>
+
+class cipLabelIntensityStatistics
+{
+public:
+  cipLabelIntensityStatistics();
+  ~cipLabelIntensityStatistics();
+
+  /** Set the number of threads used by 'AddImage'. Defaults to the
+   *  ITK global default number of threads. */
+  void SetNumberOfThreads( unsigned int );
+  unsigned int GetNumberOfThreads() const
+    {
+      return NumberOfThreads;
+    };
+
+  /** Accumulate the CT values of all labeled voxels into the
+   *  statistics of their labels. The CT image and the label map must
+   *  have the same buffered region. */
+  void AddImage( cip::CTType::Pointer, cip::LabelMapType::Pointer );
+
+  /** Forget all the accumulated statistics */
+  void Reset();
+
+  /** The labels for which at least one voxel has been accumulated,
+   *  in increasing order */
+  const std::vector< unsigned short >& GetLabels() const
+    {
+      return Labels;
+    };
+
+  /** Whether at least one voxel has been accumulated for the
+   *  specified label */
+  bool HasLabel( unsigned short ) const;
+
+  /** Statistics of the specified label. An exception is thrown if no
+   *  voxel has been accumulated for the label. The STD is the
+   *  population standard deviation. */
+  unsigned long GetNumberOfVoxels( unsigned short ) const;
+  double GetMean( unsigned short ) const;
+  double GetVariance( unsigned short ) const;
+  double GetSTD( unsigned short ) const;
+  short GetMin( unsigned short ) const;
+  short GetMax( unsigned short ) const;
+
+  /** Get the specified percentile (in [0, 100]) of the CT values of
+   *  the specified label: the value of (zero-based) rank
+   *  floor(percentile*n/100) among the n sorted values, or the
+   *  largest value for the 100th percentile. */
+  short GetPercentile( unsigned short, double ) const;
+
+  /** The 50th percentile. For an even number of values this is the
+   *  upper of the two middle values. */
+  short GetMedian( unsigned short ) const;
+
+  /** Get a pointer to the dense histogram of the specified
+   *  label. Element 'i' holds the count for the CT value
+   *  SHRT_MIN+i. */
+  const unsigned int* GetHistogram( unsigned short ) const;
+
+private:
+  struct ACCUMULATOR
+  {
+    unsigned long count;
+    double        mean;
+    double        m2;          // sum of squared deviations from the mean
+    short         min;
+    short         max;
+  };
+
+  // The statistics of a set of labels. 'slots' maps every label value
+  // to the index of its accumulator and histogram, or -1.
+  struct LABELTABLE
+  {
+    std::vector< int >                          slots;
+    std::vector< unsigned short >               labels;
+    std::vector< ACCUMULATOR >                  accumulators;
+    std::vector< std::vector< unsigned int > >  histograms;
+  };
+
+  struct THREADSTRUCT
+  {
+    cipLabelIntensityStatistics* self;
+    const short*                 ctBuffer;
+    const unsigned short*        labelBuffer;
+    unsigned int                 sliceSize;
+    unsigned int                 numberOfSlices;
+    std::vector< LABELTABLE >*   slabTables;
+  };
+
+  static ITK_THREAD_RETURN_TYPE ThreaderCallback( void* );
+
+  static void InitializeTable( LABELTABLE& );
+  static int  AddLabel( unsigned short, LABELTABLE& );
+
+  void AccumulateSlab( const short*, const unsigned short*, unsigned int, LABELTABLE& ) const;
+  void MergeTable( const LABELTABLE& );
+
+  const ACCUMULATOR& GetAccumulator( unsigned short, const char* ) const;
+
+  unsigned int NumberOfThreads;
+
+  LABELTABLE                    Table;
+  std::vector< unsigned short > Labels;
+};
+
+#endif
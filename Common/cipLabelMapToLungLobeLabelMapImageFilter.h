@@ -106,6 +106,15 @@ public:
   itkSetMacro( ThinPlateSplineSurfaceFromPointsLambda, double );
   itkGetMacro( ThinPlateSplineSurfaceFromPointsLambda, double );
 
+  /** Set/Get the absolute error bound (in physical units) on the heights
+   *  of the TPS surfaces created from points. If greater than zero,
+   *  these surfaces (which can have many points) are evaluated with
+   *  the far-field approximation of cipThinPlateSplineSurface. The
+   *  surfaces set directly keep their own setting. Default is 0
+   *  (exact evaluation). */
+  itkSetMacro( ThinPlateSplineSurfaceApproximationTolerance, double );
+  itkGetMacro( ThinPlateSplineSurfaceApproximationTolerance, double );
+
   /** Thin plate spline model of the boundary between the left upper lobe and
    *  the left lower lobe. If a surface is specified AND a set of left oblique
    *  fissure points (indices) is specified, the surface that interpolates through
@@ -145,8 +154,12 @@ private:
   cipLabelMapToLungLobeLabelMapImageFilter(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
-  int GetBoundaryHeightIndex( cipThinPlateSplineSurface*, cipThinPlateSplineSurface*, BlendMapType::Pointer,
-			      unsigned int, unsigned int );
+  /** Compute the z index of the boundary for every (i, j) column of
+   *  the input image. The TPS heights are evaluated over the whole
+   *  grid at once. Element 'j*size[0] + i' holds the index of column
+   *  (i, j). */
+  void ComputeBoundaryHeightIndices( cipThinPlateSplineSurface*, cipThinPlateSplineSurface*, BlendMapType::Pointer,
+				     std::vector< int >& );
   void UpdateBlendMap( cipThinPlateSplineSurface*, BlendMapType::Pointer );
 
   unsigned short FissureSurfaceValue;
@@ -167,6 +180,7 @@ private:
   std::vector< cip::PointType >  RightHorizontalFissurePoints;
 
   double m_ThinPlateSplineSurfaceFromPointsLambda;
+  double m_ThinPlateSplineSurfaceApproximationTolerance;
 
   cipThinPlateSplineSurface* LeftObliqueThinPlateSplineSurface;
   cipThinPlateSplineSurface* RightObliqueThinPlateSplineSurface;
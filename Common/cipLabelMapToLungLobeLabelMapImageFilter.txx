@@ -14,7 +14,8 @@
 cipLabelMapToLungLobeLabelMapImageFilter
 ::cipLabelMapToLungLobeLabelMapImageFilter()
 {
-  this->m_ThinPlateSplineSurfaceFromPointsLambda = 0.1;
+  this->m_ThinPlateSplineSurfaceFromPointsLambda       = 0.1;
+  this->m_ThinPlateSplineSurfaceApproximationTolerance = 0.0;
 
   this->LeftObliqueThinPlateSplineSurface     = new cipThinPlateSplineSurface;
   this->RightObliqueThinPlateSplineSurface    = new cipThinPlateSplineSurface;
@@ -110,6 +111,40 @@ cipLabelMapToLungLobeLabelMapImageFilter
       this->UpdateBlendMap( this->RightHorizontalThinPlateSplineSurfaceFromPoints, this->RightHorizontalBlendMap );
     }
 
+  // The approximation tolerance only applies to the height evaluations
+  // of the labeling pass, so it is set on copies of the surfaces (the
+  // factorizations are shared, not copied) rather than on the
+  // caller's surfaces
+  cipThinPlateSplineSurface loSurfaceFromPoints( *this->LeftObliqueThinPlateSplineSurfaceFromPoints );
+  cipThinPlateSplineSurface roSurfaceFromPoints( *this->RightObliqueThinPlateSplineSurfaceFromPoints );
+  cipThinPlateSplineSurface rhSurfaceFromPoints( *this->RightHorizontalThinPlateSplineSurfaceFromPoints );
+    loSurfaceFromPoints.SetApproximationTolerance( this->m_ThinPlateSplineSurfaceApproximationTolerance );
+    roSurfaceFromPoints.SetApproximationTolerance( this->m_ThinPlateSplineSurfaceApproximationTolerance );
+    rhSurfaceFromPoints.SetApproximationTolerance( this->m_ThinPlateSplineSurfaceApproximationTolerance );
+
+  // The z index values for each of the fissures, for all the (i, j)
+  // columns
+  std::vector< int > loZIndices;
+  std::vector< int > roZIndices;
+  std::vector< int > rhZIndices;
+
+  if ( segmentLeftLobes )
+    {
+      this->ComputeBoundaryHeightIndices( this->LeftObliqueThinPlateSplineSurface,
+					  &loSurfaceFromPoints,
+					  this->LeftObliqueBlendMap, loZIndices );
+    }
+  if ( segmentRightLobes )
+    {
+      this->ComputeBoundaryHeightIndices( this->RightObliqueThinPlateSplineSurface,
+					  &roSurfaceFromPoints,
+					  this->RightObliqueBlendMap, roZIndices );
+
+      this->ComputeBoundaryHeightIndices( this->RightHorizontalThinPlateSplineSurface,
+					  &rhSurfaceFromPoints,
+					  this->RightHorizontalBlendMap, rhZIndices );
+    }
+
   int loZ, roZ, rhZ;  // The z index values for each of the fissures
   unsigned short newValue;
   unsigned char cipRegion, cipType;
@@ -118,22 +153,17 @@ cipLabelMapToLungLobeLabelMapImageFilter
     {
       for ( int j=0; j < int( size[1] ); j++ )
 	{
+	  unsigned int column = (unsigned int)( j )*size[0] + (unsigned int)( i );
+
 	  if ( segmentLeftLobes )
 	    {
-	      loZ = this->GetBoundaryHeightIndex( this->LeftObliqueThinPlateSplineSurface,
-						  this->LeftObliqueThinPlateSplineSurfaceFromPoints,
-						  this->LeftObliqueBlendMap, i, j );
+	      loZ = loZIndices[column];
 	    }
 
 	  if ( segmentRightLobes )
 	    {
-	      roZ = this->GetBoundaryHeightIndex( this->RightObliqueThinPlateSplineSurface,
-						  this->RightObliqueThinPlateSplineSurfaceFromPoints,
-						  this->RightObliqueBlendMap, i, j );
-
-	      rhZ = this->GetBoundaryHeightIndex( this->RightHorizontalThinPlateSplineSurface,
-						  this->RightHorizontalThinPlateSplineSurfaceFromPoints,
-						  this->RightHorizontalBlendMap, i, j );
+	      roZ = roZIndices[column];
+	      rhZ = rhZIndices[column];
 	    }
 
 	  for ( int z=0; z < int( size[2] ); z++ )
@@ -269,50 +299,77 @@ cipLabelMapToLungLobeLabelMapImageFilter
 }
 
 
-int
+void
 cipLabelMapToLungLobeLabelMapImageFilter
-::GetBoundaryHeightIndex( cipThinPlateSplineSurface* tps, cipThinPlateSplineSurface* tpsFromPoints, 
-			  BlendMapType::Pointer blendMap, unsigned int i, unsigned int j )
+::ComputeBoundaryHeightIndices( cipThinPlateSplineSurface* tps, cipThinPlateSplineSurface* tpsFromPoints, 
+				BlendMapType::Pointer blendMap, std::vector< int >& heightIndices )
 {
   InputImageType::SpacingType spacing = this->GetInput()->GetSpacing();
   InputImageType::PointType   origin  = this->GetInput()->GetOrigin();
+  InputImageType::SizeType    size    = this->GetInput()->GetBufferedRegion().GetSize();
 
-  double x = double(i)*spacing[0] + origin[0];
-  double y = double(j)*spacing[1] + origin[1];
-  double z;
+  double       gridOrigin[2]  = { origin[0], origin[1] };
+  double       gridSpacing[2] = { spacing[0], spacing[1] };
+  unsigned int gridSize[2]    = { (unsigned int)( size[0] ), (unsigned int)( size[1] ) };
+
+  unsigned int numberOfColumns = gridSize[0]*gridSize[1];
 
-  if ( tps->GetNumberSurfacePoints() > 0 &&
-       tpsFromPoints->GetNumberSurfacePoints() == 0 )
+  std::vector< double > heights;
+  std::vector< double > heightsFromPoints;
+  if ( tps->GetNumberSurfacePoints() > 0 )
     {
-      z = tps->GetSurfaceHeight( x, y );
+      heights.resize( numberOfColumns );
+      tps->GetSurfaceHeightGrid( gridOrigin, gridSpacing, gridSize, &heights[0] );
     }
-  else if ( tps->GetNumberSurfacePoints() == 0 &&
-	    tpsFromPoints->GetNumberSurfacePoints() > 0 )
+  if ( tpsFromPoints->GetNumberSurfacePoints() > 0 )
     {
-      z = tpsFromPoints->GetSurfaceHeight( x, y );
+      heightsFromPoints.resize( numberOfColumns );
+      tpsFromPoints->GetSurfaceHeightGrid( gridOrigin, gridSpacing, gridSize, &heightsFromPoints[0] );
     }
-  else
-    {
-      BlendMapType::IndexType index;
-        index[0] = i;
-	index[1] = j;
 
-      double blendVal = this->BlendSlope*blendMap->GetPixel( index ) + this->BlendIntercept;
-      if ( blendVal <= 0.0 )
-	{
-	  z = tpsFromPoints->GetSurfaceHeight( x, y );
-	}
-      else if ( blendVal >= 1.0 )
-	{
-	  z = tps->GetSurfaceHeight( x, y );
-	}
-      else
+  heightIndices.resize( numberOfColumns );
+
+  double z;
+  for ( unsigned int j=0; j<gridSize[1]; j++ )
+    {
+      for ( unsigned int i=0; i<gridSize[0]; i++ )
 	{
-	  z = blendVal*tps->GetSurfaceHeight( x, y ) + (1.0 - blendVal)*tpsFromPoints->GetSurfaceHeight( x, y );
+	  unsigned int column = j*gridSize[0] + i;
+
+	  if ( tps->GetNumberSurfacePoints() > 0 &&
+	       tpsFromPoints->GetNumberSurfacePoints() == 0 )
+	    {
+	      z = heights[column];
+	    }
+	  else if ( tps->GetNumberSurfacePoints() == 0 &&
+		    tpsFromPoints->GetNumberSurfacePoints() > 0 )
+	    {
+	      z = heightsFromPoints[column];
+	    }
+	  else
+	    {
+	      BlendMapType::IndexType index;
+	        index[0] = i;
+		index[1] = j;
+
+	      double blendVal = this->BlendSlope*blendMap->GetPixel( index ) + this->BlendIntercept;
+	      if ( blendVal <= 0.0 )
+		{
+		  z = heightsFromPoints[column];
+		}
+	      else if ( blendVal >= 1.0 )
+		{
+		  z = heights[column];
+		}
+	      else
+		{
+		  z = blendVal*heights[column] + (1.0 - blendVal)*heightsFromPoints[column];
+		}
+	    }
+
+	  heightIndices[column] = int( (z - origin[2])/spacing[2] );
 	}
     }
-
-  return int( (z - origin[2])/spacing[2] );
 }
 
 
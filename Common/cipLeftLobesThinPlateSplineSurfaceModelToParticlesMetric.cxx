@@ -99,52 +99,29 @@ double cipLeftLobesThinPlateSplineSurfaceModelToParticlesMetric::GetFissureTermV
 {
   double fissureTermValue = 0.0;
 
-  cip::PointType position(3);
-  cip::VectorType loNormal(3);
-  cip::VectorType orientation(3);
+  const cipThinPlateSplineSurface& loTPS = this->LeftObliqueNewtonOptimizer.GetMetric().GetThinPlateSplineSurface();
 
-  cipNewtonOptimizer< 2 >::PointType* loDomainParams  = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-  cipNewtonOptimizer< 2 >::PointType* loOptimalParams = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
+  // Determine the points on the left oblique surface that are closest
+  // to the particles (and the corresponding distances) for all the
+  // particles at once
+  std::vector< cip::Point3 > loClosestPoints;
+  std::vector< double > loDistances;
+  cip::GetClosestPointsOnThinPlateSplineSurface( loTPS, this->FissureParticlePositions, loClosestPoints, loDistances );
+
+  cip::Vector3 loNormal;
+  cip::Vector3 orientation;
 
   for ( unsigned int i=0; i<this->NumberOfFissureParticles; i++ )
     {
-    position[0] = this->FissureParticles->GetPoint(i)[0];
-    position[1] = this->FissureParticles->GetPoint(i)[1];
-    position[2] = this->FissureParticles->GetPoint(i)[2];
-
-    orientation[0] = this->FissureParticles->GetPointData()->GetArray( "hevec2" )->GetTuple(i)[0];
-    orientation[1] = this->FissureParticles->GetPointData()->GetArray( "hevec2" )->GetTuple(i)[1];
-    orientation[2] = this->FissureParticles->GetPointData()->GetArray( "hevec2" )->GetTuple(i)[2];
-
-    // Determine the domain locations for which the particle is closest
-    // to the left oblique
-    this->LeftObliqueNewtonOptimizer.GetMetric().SetParticle( position );
-
-    // The particle's x, and y location are a good place to initialize
-    // the search for the domain locations that result in the smallest
-    // distance between the particle and the TPS surfaces
-    (*loDomainParams)[0] = position[0]; 
-    (*loDomainParams)[1] = position[1]; 
-
-    // Perform Newton line search to determine the closest point on
-    // the current TPS surfaces
-    this->LeftObliqueNewtonOptimizer.SetInitialParameters( loDomainParams );
-    this->LeftObliqueNewtonOptimizer.Update();
-    this->LeftObliqueNewtonOptimizer.GetOptimalParameters( loOptimalParams );
-
-    // Get the distances between the particle and the TPS surfaces. This
-    // is just the square root of the objective function value
-    // optimized by the Newton method.
-    double loDistance = vcl_sqrt( this->LeftObliqueNewtonOptimizer.GetOptimalValue() );
+    orientation = cip::Vector3( this->FissureParticles->GetPointData()->GetArray( "hevec2" )->GetTuple(i) );
 
     // Get the TPS surface normals at the domain locations.
-    this->LeftObliqueNewtonOptimizer.GetMetric().GetThinPlateSplineSurface().
-      GetSurfaceNormal( (*loOptimalParams)[0], (*loOptimalParams)[1], loNormal );
+    loTPS.GetSurfaceNormal( loClosestPoints[i][0], loClosestPoints[i][1], loNormal );
     double loTheta = cip::GetAngleBetweenVectors( loNormal, orientation, true );
 
     // Now that we have the surface normals and distances, we can compute this 
     // particle's contribution to the overall objective function value. 
-    fissureTermValue -= this->FissureParticleWeights[i]*std::exp( -loDistance/this->FissureSigmaDistance )*
+    fissureTermValue -= this->FissureParticleWeights[i]*std::exp( -loDistances[i]/this->FissureSigmaDistance )*
       std::exp( -loTheta/this->FissureSigmaTheta );
     }
 
@@ -155,53 +132,30 @@ double cipLeftLobesThinPlateSplineSurfaceModelToParticlesMetric::GetVesselTermVa
 {
   double vesselTermValue = 0.0;
 
-  cip::PointType position(3);
-  cip::VectorType loNormal(3);
-  cip::VectorType orientation(3);
+  const cipThinPlateSplineSurface& loTPS = this->LeftObliqueNewtonOptimizer.GetMetric().GetThinPlateSplineSurface();
+
+  // Determine the points on the left oblique surface that are closest
+  // to the particles (and the corresponding distances) for all the
+  // particles at once
+  std::vector< cip::Point3 > loClosestPoints;
+  std::vector< double > loDistances;
+  cip::GetClosestPointsOnThinPlateSplineSurface( loTPS, this->VesselParticlePositions, loClosestPoints, loDistances );
 
-  cipNewtonOptimizer< 2 >::PointType* loDomainParams  = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-  cipNewtonOptimizer< 2 >::PointType* loOptimalParams = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
+  cip::Vector3 loNormal;
+  cip::Vector3 orientation;
 
   for ( unsigned int i=0; i<this->NumberOfVesselParticles; i++ )
     {
-    position[0] = this->VesselParticles->GetPoint(i)[0];
-    position[1] = this->VesselParticles->GetPoint(i)[1];
-    position[2] = this->VesselParticles->GetPoint(i)[2];
-
-    orientation[0] = this->VesselParticles->GetPointData()->GetArray( "hevec0" )->GetTuple(i)[0];
-    orientation[1] = this->VesselParticles->GetPointData()->GetArray( "hevec0" )->GetTuple(i)[1];
-    orientation[2] = this->VesselParticles->GetPointData()->GetArray( "hevec0" )->GetTuple(i)[2];
-
-    // Determine the domain locations for which the particle is closest
-    // to the left oblique TPS surfaces
-    this->LeftObliqueNewtonOptimizer.GetMetric().SetParticle( position );
-
-    // The particle's x, and y location are a good place to initialize
-    // the search for the domain locations that result in the smallest
-    // distance between the particle and the TPS surfaces
-    (*loDomainParams)[0] = position[0]; 
-    (*loDomainParams)[1] = position[1]; 
-
-    // Perform Newton line search to determine the closest point on
-    // the current TPS surfaces
-    this->LeftObliqueNewtonOptimizer.SetInitialParameters( loDomainParams );
-    this->LeftObliqueNewtonOptimizer.Update();
-    this->LeftObliqueNewtonOptimizer.GetOptimalParameters( loOptimalParams );
-
-    // Get the distances between the particle and the TPS surfaces. This
-    // is just the square root of the objective function value
-    // optimized by the Newton method.
-    double loDistance = vcl_sqrt( this->LeftObliqueNewtonOptimizer.GetOptimalValue() );
+    orientation = cip::Vector3( this->VesselParticles->GetPointData()->GetArray( "hevec0" )->GetTuple(i) );
 
     // Get the TPS surface normals at the domain locations.
-    this->LeftObliqueNewtonOptimizer.GetMetric().GetThinPlateSplineSurface().
-      GetSurfaceNormal( (*loOptimalParams)[0], (*loOptimalParams)[1], loNormal );
+    loTPS.GetSurfaceNormal( loClosestPoints[i][0], loClosestPoints[i][1], loNormal );
 
     double loTheta = cip::GetAngleBetweenVectors( loNormal, orientation, true );
 
     // Now that we have the surface normals and distances, we can compute this 
     // particle's contribution to the overall objective function value. 
-    vesselTermValue += this->VesselParticleWeights[i]*std::exp( -loDistance/this->VesselSigmaDistance )*
+    vesselTermValue += this->VesselParticleWeights[i]*std::exp( -loDistances[i]/this->VesselSigmaDistance )*
       std::exp( -loTheta/this->VesselSigmaTheta );
     }
 
@@ -45,6 +45,14 @@ public:
       Rho = contractionFactor;
     }
 
+  /** The backtracking routine gives up when the step length falls
+   *  below this value, in which case the optimizer stops at the
+   *  current parameters */
+  void SetMinimumStepLength( double stepLength )
+    {
+      MinimumStepLength = stepLength;
+    }
+
   /** The optimizer will continue to iterate until the gradient
    *  magnitude falls below the tolerance specified with this method */ 
   void SetGradientTolerance( double tolerance )
@@ -82,6 +90,7 @@ public:
 private:
   double SufficientDecreaseFactor;  // For evaluation of sufficient decrease condition 
   double Rho; // Contraction factor
+  double MinimumStepLength;  // Backtracking stopping criterion
   double GradientTolerance;  // Optimization stopping criterion
   double OptimalValue;
   
@@ -89,7 +98,7 @@ private:
   PointType* InitialParams;
   PointType* OptimalParams;
 
-  double LineSearch( PointType*, VectorType* );
+  double LineSearch( PointType*, VectorType*, double, VectorType* );
 };
 
 #include "cipNewtonOptimizer.txx"
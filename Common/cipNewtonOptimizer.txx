@@ -25,6 +25,7 @@ cipNewtonOptimizer< Dimension >
   this->GradientTolerance         = 0.5;
   this->SufficientDecreaseFactor  = 0.0001;
   this->Rho                       = 0.9;
+  this->MinimumStepLength         = 1e-10;
 }
 
 
@@ -103,7 +104,17 @@ void cipNewtonOptimizer< Dimension >::Update( bool verbose )
     //
     // Determine the step length
     //
-    a = this->LineSearch( params, p );
+    a = this->LineSearch( params, p, this->OptimalValue, g );
+
+    //
+    // No step along the search direction decreases the metric enough
+    // (e.g. because of rounding near the optimum), so the current
+    // parameters are the best we can do
+    //
+    if ( a == 0.0 )
+      {
+      break;
+      }
     
     (*params) = (*params) + a*(*p);
     
@@ -189,7 +200,17 @@ void cipNewtonOptimizer< Dimension >::Update()
     //
     // Determine the step length
     //
-    a = this->LineSearch( params, p );
+    a = this->LineSearch( params, p, this->OptimalValue, g );
+
+    //
+    // No step along the search direction decreases the metric enough
+    // (e.g. because of rounding near the optimum), so the current
+    // parameters are the best we can do
+    //
+    if ( a == 0.0 )
+      {
+      break;
+      }
     
     (*params) = (*params) + a*(*p);
     
@@ -216,52 +237,50 @@ void cipNewtonOptimizer< Dimension >::Update()
 // This function determines a step length, 'aOpt', along a search
 // direction, 'p', from initial position, 'a0', such that the
 // sufficient decrease condition is satisfied. The algorithm used is
-// backtracking.
+// backtracking. 'f0' and 'g' are the metric value and gradient at
+// 'x0', which the caller has already computed (the metric's
+// 'GetValue' must be consistent with them). If the step length falls
+// below 'MinimumStepLength' before the condition is satisfied, zero
+// is returned.
 //
 template < unsigned int Dimension >
-double cipNewtonOptimizer< Dimension >::LineSearch( PointType* x0, VectorType* p )
+double cipNewtonOptimizer< Dimension >::LineSearch( PointType* x0, VectorType* p, double f0, VectorType* g )
 {
   double a = 1.0;
 
-  VectorType* g = new VectorType( Dimension );
-
-  //
-  // Get the metric value, 'f0', and the gradient, 'g', at initial
-  // point, 'x0'.
-  //
-  double f0 = this->Metric.GetValueAndGradient( x0, g ); 
-
   //
   // Compute the following product to save a few computations 
   //
-  double gOrig[2];
-    gOrig[0] = (*g)[0];
-    gOrig[1] = (*g)[1];
-
   double g0p = dot_product(*g,*p);
 
   //
   // The first condition in the while loop below evaluates the sufficient
   // decrease condition. This is all that is needed for the
-  // backtracking algorithm
+  // backtracking algorithm, so only the metric value is computed at
+  // the trial points
   // 
   PointType* params = new PointType;
   (*params) = (*x0) + a*(*p);
 
-  double value = this->Metric.GetValueAndGradient( params, g );
+  double value = this->Metric.GetValue( params );
   
   while ( value > f0 + this->SufficientDecreaseFactor*a*g0p )
     {
     a *= this->Rho;   
 
+    if ( a < this->MinimumStepLength )
+      {
+      a = 0.0;
+      break;
+      }
+
     (*params) = (*x0) + a*(*p);
 
-    value = this->Metric.GetValueAndGradient( params, g );
+    value = this->Metric.GetValue( params );
     }
 
   double aOpt = a;
 
-  delete g;
   delete params;
 
   return aOpt;
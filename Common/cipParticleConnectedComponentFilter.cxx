@@ -10,24 +10,51 @@
 #include "vtkPointData.h"
 #include "vtkFloatArray.h"
 #include "vtkSmartPointer.h"
+#include "vtkIdList.h"
 #include <cfloat>
+#include <algorithm>
 #include "itkImageFileWriter.h"
 #include "vnl/algo/vnl_symmetric_eigensystem.h"
 
 
+// Orders data structure slots by the raster order (x fastest, then y,
+// then z) of the voxels they hold
+struct VOXELRASTERORDER
+{
+  const int* voxels;
+
+  bool operator()( unsigned int slot1, unsigned int slot2 ) const
+  {
+    const int* voxel1 = voxels + 3*slot1;
+    const int* voxel2 = voxels + 3*slot2;
+
+    for ( int d=2; d>=0; d-- )
+      {
+      if ( voxel1[d] != voxel2[d] )
+        {
+        return voxel1[d] < voxel2[d];
+        }
+      }
+
+    return false;
+  }
+};
+
+
 cipParticleConnectedComponentFilter::cipParticleConnectedComponentFilter()
 {
   this->OutputPolyData        = vtkPolyData::New();
   this->InternalInputPolyData = vtkPolyData::New();
-  this->DataStructureImage    = ImageType::New();
 
-  this->NumberInputParticles       = 0;
-  this->NumberOutputParticles      = 0;
-  this->InterParticleSpacing       = 0.0;
-  this->ComponentSizeThreshold     = 10;
-  this->SelectedComponent          = 0;
-  this->MaximumComponentSize       = USHRT_MAX;
-  this->ParticleDistanceThreshold  = this->InterParticleSpacing;
+  this->NumberInputParticles         = 0;
+  this->NumberInternalInputParticles = 0;
+  this->NumberOutputParticles        = 0;
+  this->InterParticleSpacing         = 0.0;
+  this->ComponentSizeThreshold       = 10;
+  this->SelectedComponent            = 0;
+  this->MaximumComponentSize         = USHRT_MAX;
+  this->ParticleDistanceThreshold    = this->InterParticleSpacing;
+  this->LargestComponentLabel        = 0;
 }
 
 
@@ -69,13 +96,20 @@ double cipParticleConnectedComponentFilter::GetParticleDistanceThreshold()
 
 unsigned int cipParticleConnectedComponentFilter::GetComponentLabelFromParticleID( unsigned int id )
 {
+  // Particles that are not in the internal poly data (or any particle
+  // before the filter has been executed) have no component
+  if ( id >= this->ParticleToComponentMap.size() )
+    {
+    return 0;
+    }
+
   return this->ParticleToComponentMap[id];
 }
 
 
 unsigned int cipParticleConnectedComponentFilter::GetComponentSizeFromParticleID( unsigned int id )
 {  
-  return this->ComponentSizeMap[this->ParticleToComponentMap[id]];
+  return this->GetComponentSize( this->GetComponentLabelFromParticleID( id ) );
 }
 
 
@@ -103,7 +137,7 @@ void cipParticleConnectedComponentFilter::SetInterParticleSpacing( double spacin
 
   if ( this->NumberInputParticles > 0 )
     {
-    this->InitializeDataStructureImageAndInternalInputPolyData();
+    this->InitializeDataStructureAndInternalInputPolyData();
     }
 }
 
@@ -122,12 +156,7 @@ void cipParticleConnectedComponentFilter::SetInput( vtkPolyData* polyData )
 
   if ( this->InterParticleSpacing != 0 )
     {
-    this->InitializeDataStructureImageAndInternalInputPolyData();
-    }
-
-  for ( unsigned int i=0; i<this->NumberInternalInputParticles; i++ )
-    {
-    this->ParticleToComponentMap[i] = 0;
+    this->InitializeDataStructureAndInternalInputPolyData();
     }
 }
 
@@ -204,12 +233,9 @@ double cipParticleConnectedComponentFilter::GetAngleBetweenVectors( double vec1[
 void cipParticleConnectedComponentFilter::ComputeComponentSizes()
 {
   //
-  // Start by setting the component map entries to zero.
+  // Start by setting the component sizes to zero.
   //
-  for ( unsigned int comp=1; comp<=this->LargestComponentLabel; comp++ )
-    {
-    this->ComponentSizeMap[comp] = 0;
-    }
+  this->ComponentSizeMap.assign( this->LargestComponentLabel+1, 0 );
 
   //
   // Now determine each component's size
@@ -218,12 +244,31 @@ void cipParticleConnectedComponentFilter::ComputeComponentSizes()
     {
     this->ComponentSizeMap[this->ParticleToComponentMap[i]]++;
     }
+
+  //
+  // Finally build the component index. The offsets are the running
+  // sums of the component sizes, and the particles are placed in
+  // increasing order within each component.
+  //
+  this->ComponentOffsets.assign( this->LargestComponentLabel+2, 0 );
+  for ( unsigned int comp=1; comp<=this->LargestComponentLabel; comp++ )
+    {
+    this->ComponentOffsets[comp+1] = this->ComponentOffsets[comp] + this->ComponentSizeMap[comp];
+    }
+
+  std::vector< unsigned int > nextPosition( this->ComponentOffsets.begin(), this->ComponentOffsets.end()-1 );
+
+  this->ComponentParticles.resize( this->ComponentOffsets.back() );
+  for ( unsigned int i=0; i<this->NumberInternalInputParticles; i++ )
+    {
+    this->ComponentParticles[nextPosition[this->ParticleToComponentMap[i]]++] = i;
+    }
 }
 
 
 unsigned int cipParticleConnectedComponentFilter::GetComponentSize( unsigned int comp )
 {
-  if ( comp > this->LargestComponentLabel )
+  if ( comp > this->LargestComponentLabel || comp == 0 )
     {
     return 0;
     }
@@ -234,86 +279,99 @@ unsigned int cipParticleConnectedComponentFilter::GetComponentSize( unsigned int
 }
 
 
+unsigned int cipParticleConnectedComponentFilter::GetNumberOfComponents()
+{
+  return this->LargestComponentLabel;
+}
 
-vtkPolyData* cipParticleConnectedComponentFilter::GetComponent( unsigned int comp )
+
+vtkPolyData* cipParticleConnectedComponentFilter::GetInternalInputPolyData()
 {
-  vtkPolyData* componentPolyData = vtkPolyData::New();
-  vtkPoints*   outputPoints      = vtkPoints::New();
-  
-  std::vector< vtkFloatArray* > arrayVec;
+  return this->InternalInputPolyData;
+}
 
-  for ( unsigned int i=0; i<this->NumberOfPointDataArrays; i++ )
-    {
-    vtkFloatArray* array = vtkFloatArray::New();
-      array->SetNumberOfComponents( this->InternalInputPolyData->GetPointData()->GetArray(i)->GetNumberOfComponents() );
-      array->SetName( this->InternalInputPolyData->GetPointData()->GetArray(i)->GetName() );
 
-    arrayVec.push_back( array );
-    }
-   
-  unsigned int inc = 0;
-  for ( unsigned int i=0; i<this->NumberInternalInputParticles; i++ )
+void cipParticleConnectedComponentFilter::GetComponentParticleIDs( unsigned int comp, vtkIdList* ids )
+{
+  ids->Reset();
+
+  if ( comp == 0 || comp > this->LargestComponentLabel )
     {
-    if ( this->ParticleToComponentMap[i] == comp )
-      {
-      outputPoints->InsertNextPoint( this->InternalInputPolyData->GetPoint(i) );
-      }
+    return;
+    }
 
-    for ( unsigned int j=0; j<this->NumberOfPointDataArrays; j++ )
-      {
-      arrayVec[j]->InsertTuple( inc, this->InternalInputPolyData->GetPointData()->GetArray(j)->GetTuple(i) );
-      }
+  ids->SetNumberOfIds( this->ComponentSizeMap[comp] );
 
-    inc++;
+  vtkIdType inc = 0;
+  for ( unsigned int k=this->ComponentOffsets[comp]; k<this->ComponentOffsets[comp+1]; k++ )
+    {
+    ids->SetId( inc++, this->ComponentParticles[k] );
     }
+}
+
+
+vtkPolyData* cipParticleConnectedComponentFilter::GetComponent( unsigned int comp )
+{
+  vtkPolyData* componentPolyData = vtkPolyData::New();
+
+  vtkIdList* ids = vtkIdList::New();
+
+  this->GetComponentParticleIDs( comp, ids );
+  this->ExtractParticles( ids, componentPolyData );
+
+  ids->Delete();
+
+  return componentPolyData;
+}
+
+
+// Copy the points and point data of the specified internal particles
+// to the poly data. The point data arrays are copied as float arrays.
+void cipParticleConnectedComponentFilter::ExtractParticles( vtkIdList* ids, vtkPolyData* polyData )
+{
+  vtkPoints* points = vtkPoints::New();
+
+  this->InternalInputPolyData->GetPoints()->GetPoints( ids, points );
+  polyData->SetPoints( points );
+  points->Delete();
 
-  componentPolyData->SetPoints( outputPoints );
   for ( unsigned int j=0; j<this->NumberOfPointDataArrays; j++ )
     {
-    componentPolyData->GetPointData()->AddArray( arrayVec[j] );    
-    }
+    vtkDataArray* inputArray = this->InternalInputPolyData->GetPointData()->GetArray(j);
 
-  return componentPolyData;
+    vtkFloatArray* array = vtkFloatArray::New();
+      array->SetNumberOfComponents( inputArray->GetNumberOfComponents() );
+      array->SetName( inputArray->GetName() );
+      array->SetNumberOfTuples( ids->GetNumberOfIds() );
+
+    inputArray->GetTuples( ids, array );
+
+    polyData->GetPointData()->AddArray( array );
+    array->Delete();
+    }
 }
 
 
 void cipParticleConnectedComponentFilter::GetComponentParticleIndices( unsigned int comp, std::vector< unsigned int >* indicesVec )
 {
-  for ( unsigned int i=0; i<this->NumberInternalInputParticles; i++ )
+  if ( comp == 0 || comp > this->LargestComponentLabel )
     {
-    if ( this->ParticleToComponentMap[i] == comp )
-      {
-      indicesVec->push_back( i );
-      }
-    }  
+    return;
+    }
+
+  indicesVec->insert( indicesVec->end(), this->ComponentParticles.begin() + this->ComponentOffsets[comp],
+                      this->ComponentParticles.begin() + this->ComponentOffsets[comp+1] );
 }
 
 
-void cipParticleConnectedComponentFilter::InitializeDataStructureImageAndInternalInputPolyData()
+void cipParticleConnectedComponentFilter::InitializeDataStructureAndInternalInputPolyData()
 {
   double xMin = DBL_MAX;
   double yMin = DBL_MAX;
   double zMin = DBL_MAX;
 
-  double xMax = -DBL_MAX;
-  double yMax = -DBL_MAX;
-  double zMax = -DBL_MAX;
-
   for ( unsigned int i=0; i<this->NumberInputParticles; i++ )
     {
-    if ( (this->InputPolyData->GetPoint(i))[0] > xMax )
-      {
-      xMax = (this->InputPolyData->GetPoint(i))[0];
-      }
-    if ( (this->InputPolyData->GetPoint(i))[1] > yMax )
-      {
-      yMax = (this->InputPolyData->GetPoint(i))[1];
-      }
-    if ( (this->InputPolyData->GetPoint(i))[2] > zMax )
-      {
-      zMax = (this->InputPolyData->GetPoint(i))[2];
-      }
-
     if ( (this->InputPolyData->GetPoint(i))[0] < xMin )
       {
       xMin = (this->InputPolyData->GetPoint(i))[0];
@@ -329,55 +387,75 @@ void cipParticleConnectedComponentFilter::InitializeDataStructureImageAndInterna
     }
 
   //
-  // The spacing of the data structure image is set to 1/2 of
-  // the inter-particle spacing. This is somewhat arbitrary, but is chosed to give
-  // (approximately) one voxel to each particle. In some cases,
+  // The spacing of the data structure is set to 1/2 of the
+  // inter-particle spacing. This is somewhat arbitrary, but is chosed
+  // to give (approximately) one voxel to each particle. In some cases,
   // multiple particles will get assigned to the same voxel. In this
   // case, the new particle will simply overwrite the old particle.
+  // Particles are assigned to the nearest voxel of a grid whose
+  // origin is the corner of the particles' bounding box.
   //
-  ImageType::PointType origin;
+  double origin[3];
     origin[0] = xMin;
     origin[1] = yMin;
     origin[2] = zMin;
 
-  ImageType::SpacingType spacing;
-    spacing[0] = this->InterParticleSpacing/2.0;
-    spacing[1] = this->InterParticleSpacing/2.0;
-    spacing[2] = this->InterParticleSpacing/2.0;
+  double spacing = this->InterParticleSpacing/2.0;
 
-  ImageType::SizeType  size;
-    size[0] = static_cast< unsigned int >( vcl_ceil( (xMax-xMin)/spacing[0] ) ) + 1;
-    size[1] = static_cast< unsigned int >( vcl_ceil( (yMax-yMin)/spacing[1] ) ) + 1;
-    size[2] = static_cast< unsigned int >( vcl_ceil( (zMax-zMin)/spacing[2] ) ) + 1;
+  //
+  // Only the occupied voxels are stored, in an open addressing hash
+  // table with at least twice as many slots as particles
+  //
+  unsigned int numberOfSlots = 2;
+  while ( numberOfSlots < 2*this->NumberInputParticles )
+    {
+    numberOfSlots *= 2;
+    }
 
-  this->DataStructureImage->SetRegions( size );
-  this->DataStructureImage->Allocate();
-  this->DataStructureImage->FillBuffer( 0 );
-  this->DataStructureImage->SetSpacing( spacing );
-  this->DataStructureImage->SetOrigin( origin );
+  this->DataStructureVoxels.assign( 3*numberOfSlots, 0 );
+  this->DataStructureParticles.assign( numberOfSlots, 0 );
 
-  ImageType::PointType point;
-  ImageType::IndexType index;
+  int voxel[3];
 
   for ( unsigned int i=0; i<this->NumberInputParticles; i++ )
-    {      
-    point[0] = this->InputPolyData->GetPoint(i)[0];
-    point[1] = this->InputPolyData->GetPoint(i)[1];
-    point[2] = this->InputPolyData->GetPoint(i)[2];
+    {
+    for ( unsigned int d=0; d<3; d++ )
+      {
+      voxel[d] = static_cast< int >( vcl_floor( (this->InputPolyData->GetPoint(i)[d] - origin[d])/spacing + 0.5 ) );
+      }
+
+    unsigned int slot = this->GetDataStructureSlot( voxel );
 
-    this->DataStructureImage->TransformPhysicalPointToIndex( point, index );
-    this->DataStructureImage->SetPixel( index, static_cast< unsigned int >( i+1 ) );
+    this->DataStructureVoxels[3*slot]     = voxel[0];
+    this->DataStructureVoxels[3*slot + 1] = voxel[1];
+    this->DataStructureVoxels[3*slot + 2] = voxel[2];
+    this->DataStructureParticles[slot]    = i+1;
     }
 
   //
-  // Now that the data structure image has been created, we can fill
+  // Now that the data structure has been created, we can fill
   // the internal input poly data to be used throughout the rest of
   // the filter. The need for doing this is that only a subset of the
   // input particles are actually registered in the data structure
-  // image (given that some particles overwrite old particles as the
-  // image is filled). So we need our InternalInputPolyData to
-  // refer to those particles that remain.
+  // (given that some particles overwrite old particles as the
+  // data structure is filled). So we need our InternalInputPolyData to
+  // refer to those particles that remain. The internal particles are
+  // ordered by the raster order of their voxels.
   //
+  std::vector< unsigned int > occupiedSlots;
+  for ( unsigned int slot=0; slot<numberOfSlots; slot++ )
+    {
+    if ( this->DataStructureParticles[slot] != 0 )
+      {
+      occupiedSlots.push_back( slot );
+      }
+    }
+
+  VOXELRASTERORDER rasterOrder;
+    rasterOrder.voxels = &this->DataStructureVoxels[0];
+
+  std::sort( occupiedSlots.begin(), occupiedSlots.end(), rasterOrder );
+
   vtkPoints* points  = vtkPoints::New();
 
   std::vector< vtkFloatArray* > arrayVec;
@@ -391,32 +469,34 @@ void cipParticleConnectedComponentFilter::InitializeDataStructureImageAndInterna
     arrayVec.push_back( array );
     }
 
-  IteratorType it( this->DataStructureImage, this->DataStructureImage->GetBufferedRegion() );
+  this->ParticleVoxels.resize( 3*occupiedSlots.size() );
 
   unsigned int inc = 0;
-  it.GoToBegin();
-  while ( !it.IsAtEnd() )
+  for ( unsigned int k=0; k<occupiedSlots.size(); k++ )
     {
-    if ( it.Get() != 0 )
-      {
-      unsigned int i = it.Get()-1;
+    unsigned int slot = occupiedSlots[k];
+    unsigned int i    = this->DataStructureParticles[slot]-1;
 
-      points->InsertNextPoint( this->InputPolyData->GetPoint(i) );
- 
-      for ( unsigned int j=0; j<this->NumberOfPointDataArrays; j++ )
-        {
-        arrayVec[j]->InsertTuple( inc, this->InputPolyData->GetPointData()->GetArray(j)->GetTuple(i) );
-        }
-      inc++;    
-      it.Set( inc ); // Ensures that image's voxel value points to new
-                     // particle structure, not the old one.
+    points->InsertNextPoint( this->InputPolyData->GetPoint(i) );
+
+    for ( unsigned int j=0; j<this->NumberOfPointDataArrays; j++ )
+      {
+      arrayVec[j]->InsertTuple( inc, this->InputPolyData->GetPointData()->GetArray(j)->GetTuple(i) );
       }
 
-    ++it;
+    this->ParticleVoxels[3*inc]     = this->DataStructureVoxels[3*slot];
+    this->ParticleVoxels[3*inc + 1] = this->DataStructureVoxels[3*slot + 1];
+    this->ParticleVoxels[3*inc + 2] = this->DataStructureVoxels[3*slot + 2];
+
+    inc++;
+    this->DataStructureParticles[slot] = inc; // Ensures that the voxel points to new
+                                              // particle structure, not the old one.
     }
 
   this->NumberInternalInputParticles = inc;
 
+  this->ParticleToComponentMap.assign( this->NumberInternalInputParticles, 0 );
+
   this->InternalInputPolyData->SetPoints( points );
   for ( unsigned int j=0; j<this->NumberOfPointDataArrays; j++ )
     {
@@ -425,59 +505,103 @@ void cipParticleConnectedComponentFilter::InitializeDataStructureImageAndInterna
 }
 
 
-void cipParticleConnectedComponentFilter::QueryNeighborhood( ImageType::IndexType index, unsigned int componentLabel, unsigned int* currentComponentSize )
+unsigned int cipParticleConnectedComponentFilter::GetDataStructureSlot( const int* voxel ) const
 {
-  int searchRadius = 3;
+  unsigned int mask = static_cast< unsigned int >( this->DataStructureParticles.size() ) - 1;
 
-  unsigned int particleIndex = this->DataStructureImage->GetPixel( index ) - 1;
+  unsigned int slot = ( (static_cast< unsigned int >( voxel[0] )*73856093u) ^
+                        (static_cast< unsigned int >( voxel[1] )*19349663u) ^
+                        (static_cast< unsigned int >( voxel[2] )*83492791u) ) & mask;
 
-  this->ParticleToComponentMap[particleIndex] = componentLabel;
+  // Linear probing: stop at the slot holding the voxel or at the
+  // first empty slot
+  while ( this->DataStructureParticles[slot] != 0 )
+    {
+    const int* slotVoxel = &this->DataStructureVoxels[3*slot];
+
+    if ( slotVoxel[0] == voxel[0] && slotVoxel[1] == voxel[1] && slotVoxel[2] == voxel[2] )
+      {
+      break;
+      }
+
+    slot = (slot + 1) & mask;
+    }
+
+  return slot;
+}
+
+
+unsigned int cipParticleConnectedComponentFilter::GetDataStructureParticle( const int* voxel ) const
+{
+  return this->DataStructureParticles[this->GetDataStructureSlot( voxel )];
+}
 
-  (*currentComponentSize)++;
 
+void cipParticleConnectedComponentFilter::QueryNeighborhood( unsigned int particleIndex, unsigned int componentLabel,
+                                                             std::vector< bool >* visited, std::vector< SEARCHFRAME >* stack )
+{
   //
-  // The ParticleToComponentMap will eventually get overwritten when
-  // the component merging stage takes place. We will use the
-  // following to keep a record of the unmerged component
-  // labeling. This will be useful when we write our final data, since
-  // we will want to indicate both the original component and the
-  // final component in the output
+  // This is a depth first search that visits the particles in the
+  // same order as the equivalent recursive search: a particle's
+  // neighborhood is scanned (x outermost, z innermost) and each
+  // connected, unvisited neighbor is searched before the scan
+  // continues. The order matters because components stop growing
+  // once they reach the maximum component size.
   //
+  const int searchRadius = 3;
+  const int searchWidth  = 2*searchRadius + 1;
+
+  const unsigned int numberOfOffsets = searchWidth*searchWidth*searchWidth;
+
+  unsigned int currentComponentSize = 1;
+
   this->ParticleToComponentMap[particleIndex] = componentLabel;
+  (*visited)[particleIndex] = true;
+
+  SEARCHFRAME frame;
+    frame.particleIndex = particleIndex;
+    frame.nextOffset    = 0;
 
-  this->DataStructureImage->SetPixel( index, 0 );
+  stack->push_back( frame );
 
-  ImageType::IndexType neighborIndex;
+  int neighborVoxel[3];
 
-  for ( int x=-searchRadius; x<=searchRadius; x++ )
+  while ( !stack->empty() && currentComponentSize < this->MaximumComponentSize )
     {
-    neighborIndex[0] = index[0] + x;
+    if ( stack->back().nextOffset == numberOfOffsets )
+      {
+      stack->pop_back();
+      continue;
+      }
+
+    unsigned int offset  = stack->back().nextOffset++;
+    unsigned int current = stack->back().particleIndex;
+
+    neighborVoxel[0] = this->ParticleVoxels[3*current]     + static_cast< int >( offset/(searchWidth*searchWidth) ) - searchRadius;
+    neighborVoxel[1] = this->ParticleVoxels[3*current + 1] + static_cast< int >( (offset/searchWidth)%searchWidth ) - searchRadius;
+    neighborVoxel[2] = this->ParticleVoxels[3*current + 2] + static_cast< int >( offset%searchWidth ) - searchRadius;
+
+    unsigned int neighbor = this->GetDataStructureParticle( neighborVoxel );
 
-    for ( int y=-searchRadius; y<=searchRadius; y++ )
+    if ( neighbor == 0 || (*visited)[neighbor-1] )
       {
-      neighborIndex[1] = index[1] + y;
+      continue;
+      }
 
-      for ( int z=-searchRadius; z<=searchRadius; z++ )
-        {
-        neighborIndex[2] = index[2] + z;
-
-        if ( this->DataStructureImage->GetBufferedRegion().IsInside( neighborIndex ) )
-          {
-          if ( this->DataStructureImage->GetPixel( neighborIndex ) != 0 )
-            {
-            unsigned int neighborParticleIndex = this->DataStructureImage->GetPixel( neighborIndex ) - 1;
-
-            bool connected = this->EvaluateParticleConnectedness( particleIndex, neighborParticleIndex );
-
-            if ( connected && (*currentComponentSize < this->MaximumComponentSize) )
-              {
-              this->QueryNeighborhood( neighborIndex, componentLabel, currentComponentSize );
-              }
-            }
-          }
-        }
+    if ( this->EvaluateParticleConnectedness( current, neighbor-1 ) )
+      {
+      this->ParticleToComponentMap[neighbor-1] = componentLabel;
+      (*visited)[neighbor-1] = true;
+      currentComponentSize++;
+
+      frame.particleIndex = neighbor-1;
+      frame.nextOffset    = 0;
+
+      stack->push_back( frame );
       }
     }
+
+  stack->clear();
 }
 
 
@@ -491,19 +615,19 @@ void cipParticleConnectedComponentFilter::Update()
 {
   unsigned int componentLabel = 1;
 
-  IteratorType it( this->DataStructureImage, this->DataStructureImage->GetBufferedRegion() );
+  // The internal particles are ordered by the raster order of their
+  // voxels, so components are labeled in raster order of their first
+  // particle
+  std::vector< bool >        visited( this->NumberInternalInputParticles, false );
+  std::vector< SEARCHFRAME > stack;
 
-  it.GoToBegin();
-  while ( !it.IsAtEnd() )
+  for ( unsigned int i=0; i<this->NumberInternalInputParticles; i++ )
     {
-    if ( it.Get() != 0 )
+    if ( !visited[i] )
       {
-      unsigned int componentSize = 0;
-      this->QueryNeighborhood( it.GetIndex(), componentLabel, &componentSize );
+      this->QueryNeighborhood( i, componentLabel, &visited, &stack );
       componentLabel++;
       }
-    
-    ++it;
     }
   this->LargestComponentLabel = componentLabel-1;
 
@@ -512,50 +636,38 @@ void cipParticleConnectedComponentFilter::Update()
 
   // At this point, we have a set of connected components, and we are
   // ready to create the output particles data
-  vtkPoints* outputPoints  = vtkPoints::New();  
-  std::vector< vtkSmartPointer< vtkFloatArray > > arrayVec;
+  vtkIdList* outputIds = vtkIdList::New();
 
-  for ( unsigned int i=0; i<this->NumberOfPointDataArrays; i++ )
+  if ( this->SelectedComponent != 0 )
     {
-    vtkFloatArray* array = vtkFloatArray::New();
-      array->SetNumberOfComponents( this->InternalInputPolyData->GetPointData()->GetArray(i)->GetNumberOfComponents() );
-      array->SetName( this->InternalInputPolyData->GetPointData()->GetArray(i)->GetName() );
-
-    arrayVec.push_back( array );
+    this->GetComponentParticleIDs( this->SelectedComponent, outputIds );
     }
-
-  vtkFloatArray* unmergedComponentsArray = vtkFloatArray::New();
-    unmergedComponentsArray->SetNumberOfComponents( 1 );
-    unmergedComponentsArray->SetName( "unmergedComponents" );
-
-  unsigned int inc = 0;
-  for ( unsigned int i=0; i<this->NumberInternalInputParticles; i++ )
+  else
     {
-    componentLabel = this->ParticleToComponentMap[i];
-
-    if ( (this->SelectedComponent != 0 && this->ParticleToComponentMap[i] == this->SelectedComponent) ||
-         (this->SelectedComponent == 0 && this->ComponentSizeMap[componentLabel] >=this->ComponentSizeThreshold) )
+    for ( unsigned int i=0; i<this->NumberInternalInputParticles; i++ )
       {
-      outputPoints->InsertNextPoint( this->InternalInputPolyData->GetPoint(i) );
-
-      for ( unsigned int j=0; j<this->NumberOfPointDataArrays; j++ )
+      if ( this->ComponentSizeMap[this->ParticleToComponentMap[i]] >= this->ComponentSizeThreshold )
         {
-        arrayVec[j]->InsertTuple( inc, this->InternalInputPolyData->GetPointData()->GetArray(j)->GetTuple(i) );
+        outputIds->InsertNextId( i );
         }
-
-      float temp = static_cast< float >( componentLabel );
-      unmergedComponentsArray->InsertTuple( inc, &temp );
-
-      inc++;
       }
     }
 
-  this->NumberOutputParticles = inc;
+  this->NumberOutputParticles = outputIds->GetNumberOfIds();
 
-  this->OutputPolyData->SetPoints( outputPoints );
-  for ( unsigned int j=0; j<this->NumberOfPointDataArrays; j++ )
+  vtkFloatArray* unmergedComponentsArray = vtkFloatArray::New();
+    unmergedComponentsArray->SetNumberOfComponents( 1 );
+    unmergedComponentsArray->SetName( "unmergedComponents" );
+    unmergedComponentsArray->SetNumberOfTuples( this->NumberOutputParticles );
+
+  for ( unsigned int i=0; i<this->NumberOutputParticles; i++ )
     {
-    this->OutputPolyData->GetPointData()->AddArray( arrayVec[j] );    
+    unmergedComponentsArray->SetValue( i, static_cast< float >( this->ParticleToComponentMap[outputIds->GetId(i)] ) );
     }
+
+  this->ExtractParticles( outputIds, this->OutputPolyData );
   this->OutputPolyData->GetPointData()->AddArray( unmergedComponentsArray );
+
+  unmergedComponentsArray->Delete();
+  outputIds->Delete();
 }
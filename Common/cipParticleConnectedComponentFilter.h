@@ -10,23 +10,27 @@
  *  made about the contents of this file -- see inherited class headers
  *  for further information.
  *
- *  The filter proceeds by first organizing the particle data in an
- *  image-based data structure. This facilitates traversal and access
+ *  The filter proceeds by first organizing the particle data in a
+ *  voxel-based data structure. This facilitates traversal and access
  *  of the data. In order to construct this dataset, a spacing value
  *  must be determined. The current implementation uses a spacing value
- *  of 1/2 the specified inter-particles distance. This data structure
- *  is common to all inherited classes.
+ *  of 1/2 the specified inter-particles distance. Only occupied voxels
+ *  are stored (in a hash table keyed by voxel index), so the memory
+ *  used is proportional to the number of particles rather than to the
+ *  volume of the particles' bounding box. This data structure is
+ *  common to all inherited classes.
  *
- *  In order to filter the particles, the data structure image is
- *  traversed until a particle is found. A small neighborhood around
- *  that particle is then searched, and if other particles are found,
- *  their connectivity to the first particle is checked. If connected,
- *  a small neighborhood around the second particle is checked for
- *  additional connections. This continues recursively until no more
- *  particles are found to be connected to that component. During this
- *  time, connected particles are removed from further consideration
- *  from the data structure image. See inherited classes for specific
- *  criteria used for connectivity decisions.
+ *  In order to filter the particles, the particles are traversed in
+ *  voxel raster order until an unlabeled particle is found. A small
+ *  neighborhood around that particle is then searched, and if other
+ *  particles are found, their connectivity to the first particle is
+ *  checked. If connected, a small neighborhood around the second
+ *  particle is checked for additional connections. This continues
+ *  (depth first, with an explicit stack rather than recursion) until
+ *  no more particles are found to be connected to that component.
+ *  During this time, connected particles are removed from further
+ *  consideration. See inherited classes for specific criteria used
+ *  for connectivity decisions.
  *
  *  $Date: 2012-08-28 17:54:18 -0400 (Tue, 28 Aug 2012) $
  *  $Revision: 212 $
@@ -39,8 +43,10 @@
 
 
 #include "vtkPolyData.h"
+#include "vtkIdList.h"
 #include "itkImage.h"
-#include "itkImageRegionIteratorWithIndex.h"
+#include <vector>
+#include <map>
 
 
 class cipParticleConnectedComponentFilter
@@ -72,7 +78,8 @@ public:
       component label and the size of that label. Note these methods
       can only be called after the filter has been executed. Also, the
       particle IDs are with respect to the internal poly data, which
-      could be different from the input poly data */
+      could be different from the input poly data. Out of range IDs
+      get the label 0 and the size 0. */
   unsigned int GetComponentSizeFromParticleID( unsigned int );
   unsigned int GetComponentLabelFromParticleID( unsigned int );
 
@@ -105,29 +112,78 @@ public:
 
   vtkPolyData* GetOutput();
 
+  /** Get the particles of the specified component as a new poly data
+      (owned by the caller) holding the component's points and point
+      data. The cost is proportional to the component size. */
   vtkPolyData* GetComponent( unsigned int );
 
-protected:
-  typedef itk::Image< unsigned int, 3 >                   ImageType;
-  typedef itk::ImageRegionIteratorWithIndex< ImageType >  IteratorType;
+  /** Get the number of components found by the filter. Component
+      labels range from 1 to this number. Note this method can only be
+      called after the filter has been executed */
+  unsigned int GetNumberOfComponents();
+
+  /** Fill the ID list with the IDs of the particles in the specified
+      component (in increasing order). The IDs refer to the internal
+      poly data (see 'GetInternalInputPolyData'), so the component can
+      be accessed or selected without copying any particle data. The
+      cost is proportional to the component size. Note this method can
+      only be called after the filter has been executed */
+  void GetComponentParticleIDs( unsigned int, vtkIdList* );
 
-  ImageType::Pointer DataStructureImage;
+  /** Get the internal poly data, i.e. the input particles that were
+      registered in the data structure. Particle IDs used by this
+      filter refer to this poly data. */
+  vtkPolyData* GetInternalInputPolyData();
+
+protected:
+  /** Stack frame of the depth first component search. 'nextOffset'
+      is the position of the next neighbor to visit in the search
+      neighborhood (x outermost, z innermost). */
+  struct SEARCHFRAME
+  {
+    unsigned int particleIndex;
+    unsigned int nextOffset;
+  };
 
   /** This is method needs to be overridden in inherint classes. By default it 
       simply returns true */
   virtual bool EvaluateParticleConnectedness( unsigned int, unsigned int );
 
-  std::map< unsigned int, unsigned int >   ParticleToComponentMap;
-  std::map< unsigned int, unsigned int >   ComponentSizeMap;
+  /** Component label of each internal particle and size of each
+      component (indexed by component label) */
+  std::vector< unsigned int >   ParticleToComponentMap;
+  std::vector< unsigned int >   ComponentSizeMap;
+
+  /** Component index: the internal particles of component 'c' are
+      ComponentParticles[ComponentOffsets[c]] to
+      ComponentParticles[ComponentOffsets[c+1]-1], in increasing
+      order. It is built by 'ComputeComponentSizes'. */
+  std::vector< unsigned int >   ComponentOffsets;
+  std::vector< unsigned int >   ComponentParticles;
 
   double        GetVectorMagnitude( double[3] );
   double        GetVectorMagnitude( double[3], double[3] );
   double        GetAngleBetweenVectors( double[3], double[3], bool );
   unsigned int  GetComponentSize( unsigned int );
-  void          InitializeDataStructureImageAndInternalInputPolyData();
+  void          InitializeDataStructureAndInternalInputPolyData();
   void          ComputeComponentSizes();
   void          GetComponentParticleIndices( unsigned int, std::vector< unsigned int >* );
-  void          QueryNeighborhood( ImageType::IndexType, unsigned int, unsigned int* );
+  void          ExtractParticles( vtkIdList*, vtkPolyData* );
+  void          QueryNeighborhood( unsigned int, unsigned int, std::vector< bool >*, std::vector< SEARCHFRAME >* );
+
+  /** Hash table of the occupied data structure voxels. Each slot
+      holds a voxel index (three entries of 'DataStructureVoxels') and
+      the internal particle index + 1 of the particle occupying it (0
+      for an empty slot). The number of slots is a power of two. */
+  unsigned int  GetDataStructureSlot( const int* ) const;
+  unsigned int  GetDataStructureParticle( const int* ) const;
+
+  std::vector< int >           DataStructureVoxels;
+  std::vector< unsigned int >  DataStructureParticles;
+
+  /** Voxel index of each internal particle (three entries per
+      particle) */
+  std::vector< int >           ParticleVoxels;
   
   vtkPolyData* InputPolyData;
   vtkPolyData* InternalInputPolyData;
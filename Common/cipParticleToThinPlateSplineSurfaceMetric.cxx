@@ -21,7 +21,15 @@ void cipParticleToThinPlateSplineSurfaceMetric::SetThinPlateSplineSurface( const
 }
 
 
-void cipParticleToThinPlateSplineSurfaceMetric::SetParticle( cip::PointType position )
+void cipParticleToThinPlateSplineSurfaceMetric::SetParticle( const cip::PointType& position )
+{
+  this->ParticlePosition[0] = position[0];
+  this->ParticlePosition[1] = position[1];
+  this->ParticlePosition[2] = position[2];
+}
+
+
+void cipParticleToThinPlateSplineSurfaceMetric::SetParticle( const cip::Point3& position )
 {
   this->ParticlePosition[0] = position[0];
   this->ParticlePosition[1] = position[1];
@@ -33,12 +41,14 @@ double cipParticleToThinPlateSplineSurfaceMetric::GetValue( PointType* params )
 {
   //
   // Compute the point on the surface, 's', given the params (domain
-  // location) 
+  // location). The height is evaluated exactly (even if the surface
+  // has an approximation tolerance) so that it is consistent with
+  // the values returned with the derivatives.
   //
   double s[3];
     s[0] = (*params)[0];
     s[1] = (*params)[1];
-    s[2] = this->ThinPlateSplineSurface.GetSurfaceHeight( s[0], s[1] );
+    s[2] = this->ThinPlateSplineSurface.GetExactSurfaceHeight( s[0], s[1] );
 
   double value = std::pow(this->ParticlePosition[0]-s[0],2) + std::pow(this->ParticlePosition[1]-s[1],2) + 
     std::pow(this->ParticlePosition[2]-s[2],2);
@@ -53,27 +63,26 @@ double cipParticleToThinPlateSplineSurfaceMetric::GetValueAndGradient( PointType
   // Define 'p' to hold the particle's position for notational
   // readability  
   //
-  cip::PointType p(3);    
-    p[0] = this->ParticlePosition[0];
-    p[1] = this->ParticlePosition[1];
-    p[2] = this->ParticlePosition[2];
+  const double* p = this->ParticlePosition;
 
   //
   // Compute the point on the surface, 's', given the params (domain
-  // location) 
+  // location), together with the surface derivatives at that location
   //
-  cip::PointType s(3);
+  double s[3];
     s[0] = (*params)[0];
     s[1] = (*params)[1];
-    s[2] = this->ThinPlateSplineSurface.GetSurfaceHeight( s[0], s[1] );
 
-  double value = std::pow(s[0]-p[0],2) + std::pow(s[1]-p[1],2) + std::pow(s[2]-p[2],2);
+  double dz[2];
+  double d2z[3];
+  this->ThinPlateSplineSurface.GetSurfaceHeightAndDerivatives( s[0], s[1], &s[2], dz, d2z );
+
+  double zDiff = s[2] - p[2];
 
-  cip::VectorType n(3);
-  this->ThinPlateSplineSurface.GetNonNormalizedSurfaceNormal( s[0], s[1], n );
+  double value = std::pow(s[0]-p[0],2) + std::pow(s[1]-p[1],2) + std::pow(zDiff,2);
 
-  (*gradient)[0] = 2.0*(s[0] - p[0] - n[0]*(s[2]-p[2])); 
-  (*gradient)[1] = 2.0*(s[1] - p[1] - n[1]*(s[2]-p[2]));  
+  (*gradient)[0] = 2.0*(s[0] - p[0] + dz[0]*zDiff); 
+  (*gradient)[1] = 2.0*(s[1] - p[1] + dz[1]*zDiff);  
 
   return value;
 }
@@ -85,74 +94,38 @@ double cipParticleToThinPlateSplineSurfaceMetric::GetValueGradientAndHessian( Po
   // Define 'p' to hold the particle's position for notational
   // readability  
   //
-  cip::PointType p(3);    
-    p[0] = this->ParticlePosition[0];
-    p[1] = this->ParticlePosition[1];
-    p[2] = this->ParticlePosition[2];
+  const double* p = this->ParticlePosition;
 
   //
   // Compute the point on the surface, 's', given the params (domain
-  // location) 
+  // location), together with the surface derivatives at that
+  // location. The height, normal and Hessian terms are all obtained
+  // in a single pass over the TPS control points.
   //
-  cip::PointType s(3);
+  double s[3];
     s[0] = (*params)[0];
     s[1] = (*params)[1];
-    s[2] = this->ThinPlateSplineSurface.GetSurfaceHeight( s[0], s[1] );
 
-  double value = std::pow(s[0]-p[0],2) + std::pow(s[1]-p[1],2) + std::pow(s[2]-p[2],2);
+  double dz[2];
+  double d2z[3];
+  this->ThinPlateSplineSurface.GetSurfaceHeightAndDerivatives( s[0], s[1], &s[2], dz, d2z );
+
+  double zDiff = s[2] - p[2];
+
+  double value = std::pow(s[0]-p[0],2) + std::pow(s[1]-p[1],2) + std::pow(zDiff,2);
 
   //
   // Compute the gradient
   //
-  cip::VectorType n(3);
-  this->ThinPlateSplineSurface.GetNonNormalizedSurfaceNormal( s[0], s[1], n );
-
-  (*gradient)[0] = 2.0*(s[0] - p[0] - n[0]*(s[2]-p[2])); 
-  (*gradient)[1] = 2.0*(s[1] - p[1] - n[1]*(s[2]-p[2]));  
+  (*gradient)[0] = 2.0*(s[0] - p[0] + dz[0]*zDiff); 
+  (*gradient)[1] = 2.0*(s[1] - p[1] + dz[1]*zDiff);  
 
   //
-  // Compute the Hessian. 'w' and 'surfPoints' are quantities
-  // associated with the TPS surface, and they are needed for the
-  // Hessian computation
+  // Compute the Hessian
   //
-  const std::vector< double > w = this->ThinPlateSplineSurface.GetWVector();
-  const std::vector< cip::PointType > surfPoints = this->ThinPlateSplineSurface.GetSurfacePoints();
-
-  double r, drdx, drdy;
-  double d3dx   = 0.0;
-  double d14dy  = 0.0;
-  double d19dy  = 0.0;
-  for ( unsigned int i=0; i<w.size(); i++ )
-    {
-    double xDiffi = s[0] - surfPoints[i][0];
-    double yDiffi = s[1] - surfPoints[i][1];
-
-    r    = vcl_sqrt( std::pow(xDiffi,2) + std::pow(yDiffi,2) );
-    drdx = xDiffi/r;
-    drdy = yDiffi/r;
-
-    double rln10   = r*vnl_math::ln10;
-    double rGroup  = 2.0*vcl_log10(r) + 1.0/vnl_math::ln10;
-    double rrGroup = r*rGroup;
-
-    double d11dx  = (r-drdx*xDiffi)/std::pow(r,2);
-    double d16dy  = (r-drdy*yDiffi)/std::pow(r,2);
-
-    double d10dx  = drdx*((2.0/rln10) + rGroup);
-    double d10dy  = 2.0*(yDiffi/(rln10)) + (yDiffi/r)*rGroup;
-
-    double d11dy = -xDiffi*(yDiffi/r)/std::pow(r,2);
-
-    d19dy -= w[i]*( rrGroup*d11dy + drdx*d10dy );
-    d3dx  -= w[i]*( rrGroup*d11dx + drdx*d10dx );
-    d14dy -= w[i]*( rrGroup*d16dy + (yDiffi/r)*d10dy );
-    }
-
-  double zDiff = (s[2]-p[2]);
-
-  double d2gdx2  =  2.0*(1.0 + n[0]*n[0] - zDiff*d3dx );
-  double d2gdy2  =  2.0*(1.0 + n[1]*n[1] - zDiff*d14dy );
-  double d2gdydx = -2.0*(-n[0]*n[1] + zDiff*d19dy);
+  double d2gdx2  = 2.0*(1.0 + dz[0]*dz[0] + zDiff*d2z[0]);
+  double d2gdy2  = 2.0*(1.0 + dz[1]*dz[1] + zDiff*d2z[2]);
+  double d2gdydx = 2.0*(dz[0]*dz[1] + zDiff*d2z[1]);
 
   (*hessian)[0][0] = d2gdx2;
   (*hessian)[1][1] = d2gdy2;
@@ -42,7 +42,8 @@ public:
   double GetValueGradientAndHessian( PointType*, VectorType*, MatrixType* ) const;
 
   /** Set the x, y, and z coordinates of the particle */
-  void SetParticle( cip::PointType );
+  void SetParticle( const cip::PointType& );
+  void SetParticle( const cip::Point3& );
 
   void SetThinPlateSplineSurface( const cipThinPlateSplineSurface& );
 
@@ -6,6 +6,15 @@
  *  map, but it is only used to retrieve the spacing, origin, and
  *  dimensions needed for the output label map.
  *
+ *  The stencil is first set up at every particle, in order, to find
+ *  the image region it covers. The image is then split into slabs of
+ *  slices, and each particle is assigned to the slabs its region
+ *  overlaps. The slabs are rasterized by several threads, each with
+ *  its own copy of the stencil and writing to its own slabs only. A
+ *  stencil pattern is filled one image row at a time, using the
+ *  analytic extent of the pattern along the row; only the voxels at
+ *  the ends of the extent are tested against the pattern.
+ *
  *  $Date: 2012-06-11 17:58:50 -0700 (Mon, 11 Jun 2012) $
  *  $Version$
  *  $Author: jross $
@@ -20,10 +29,12 @@
 
 #include "itkImageToImageFilter.h" 
 #include "itkImageRegionIteratorWithIndex.h"
+#include "itkMultiThreader.h"
 #include "vtkPolyData.h"
 #include "vtkSmartPointer.h"
 #include "cipChestConventions.h"
 #include "cipStencil.h"
+#include <vector>
 
 template < class TInputImage >
 class cipParticlesToStenciledLabelMapImageFilter :
@@ -100,6 +111,19 @@ public:
       ScaleStencilPatternByParticleScale = scale;
     }
 
+  /** Set/Get the number of slices of the slabs rasterized by the
+   *  threads. Thinner slabs balance the work better across the
+   *  threads, but particles overlapping several slabs are set up once
+   *  per slab. Defaults to 8. */
+  void SetNumberOfSlicesPerSlab( unsigned int numberOfSlices )
+    {
+      NumberOfSlicesPerSlab = numberOfSlices > 0 ? numberOfSlices : 1;
+    }
+  unsigned int GetNumberOfSlicesPerSlab() const
+    {
+      return NumberOfSlicesPerSlab;
+    }
+
 protected:
   void UpdateLabelMapRegion( vtkIdType );
 
@@ -114,6 +138,32 @@ private:
   cipParticlesToStenciledLabelMapImageFilter(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
+  // The stencil set up at a particle and the (clamped) image region
+  // covered by its bounding box
+  struct PARTICLESTENCIL
+  {
+    double                               center[3];
+    double                               orientation[3];
+    double                               radius;
+    typename OutputImageType::IndexType  startIndex;
+    typename OutputImageType::IndexType  endIndex;
+  };
+
+  struct THREADSTRUCT
+  {
+    Self*                                               filter;
+    const std::vector< PARTICLESTENCIL >*               particleStencils;
+    const std::vector< std::vector< unsigned int > >*   slabParticles;
+    std::vector< cipStencil* >*                         stencils;
+    bool                                                setOrientation;
+    bool                                                setRadius;
+    unsigned short                                      foregroundLabel;
+  };
+
+  static ITK_THREAD_RETURN_TYPE ThreaderCallback( void* );
+
+  void RasterizeSlab( const THREADSTRUCT*, unsigned int, cipStencil* );
+
   unsigned int ChestParticleType;
   unsigned int SelectedParticleType;
 
@@ -122,6 +172,8 @@ private:
   bool   ScaleStencilPatternByParticleScale;
   double CTPointSpreadFunctionSigma;
 
+  unsigned int NumberOfSlicesPerSlab;
+
   vtkSmartPointer< vtkPolyData > ParticlesData;
 };
 
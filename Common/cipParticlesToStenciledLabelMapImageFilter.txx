@@ -9,6 +9,8 @@
 #define __cipParticlesToStenciledLabelMapImageFilter_txx
 
 #include "cipParticlesToStenciledLabelMapImageFilter.h"
+#include "vtkPointData.h"
+#include "vtkDataArray.h"
 
 
 template < class TInputImage >
@@ -19,6 +21,7 @@ cipParticlesToStenciledLabelMapImageFilter< TInputImage >
   this->ParticlesData                      = vtkSmartPointer< vtkPolyData >::New();
   this->ScaleStencilPatternByParticleScale = false;
   this->CTPointSpreadFunctionSigma         = 0.0;
+  this->NumberOfSlicesPerSlab              = 8;
 }
 
 
@@ -75,83 +78,86 @@ cipParticlesToStenciledLabelMapImageFilter< TInputImage >
     outputPtr->SetSpacing( inputPtr->GetSpacing() );
     outputPtr->SetOrigin( inputPtr->GetOrigin() );
 
-  // Create an ITK region that will be modified for each of our
-  // particles   
-  typename InputImageType::RegionType imageRegion;
-  typename InputImageType::SizeType   regionSize;
-  typename InputImageType::IndexType  regionStartIndex;
-  typename InputImageType::IndexType  regionEndIndex;
-  
-  // The bounding box start and end points will be updated using the
-  // stencil  
-  double* boundingBoxStartPoint = new double[3];
-  double* boundingBoxEndPoint   = new double[3];
+  unsigned int numberOfParticles = this->ParticlesData->GetNumberOfPoints();
 
-  typename InputImageType::PointType itkPoint; //A temp container
+  //
+  // Handling of the stencil pattern is adjusted based on the type of
+  // structure represented (vessel, airway, or fissure). The stencil
+  // is oriented along the Hessian eigenvector that runs along the
+  // structure (this has no effect if the sphere stencil is used). For
+  // vessels, both the cylinder and sphere radii can be scaled using
+  // the particle scale according to an equation that relates the
+  // particle scale and CT point spread function to the actual vessel
+  // radius. 
+  //
+  //TODO: Need to properly define a function that converts particle
+  //scale to physical airway radius.
+  //
+  vtkDataArray* orientationArray = NULL;
+  vtkDataArray* scaleArray       = NULL;
 
-  // TODO: Can the following be multithreaded? By what mechanism?
-  for ( unsigned int i=0; i<this->ParticlesData->GetNumberOfPoints(); i++ ) 
-    {   
-    //
-    // Get the bounding box for the particle. We will create an ITK region
-    // based on the extent of this bounding box.
-    //
-    this->Stencil->SetCenter( this->ParticlesData->GetPoint(i)[0], this->ParticlesData->GetPoint(i)[1], 
-                              this->ParticlesData->GetPoint(i)[2] );
+  if ( this->ChestParticleType == cip::AIRWAY )
+    {
+    orientationArray = this->ParticlesData->GetPointData()->GetArray( "hevec2" );
+    }
+  if ( this->ChestParticleType == cip::FISSURE )
+    {
+    orientationArray = this->ParticlesData->GetPointData()->GetArray( "hevec1" );
+    }
+  if ( this->ChestParticleType == cip::VESSEL )
+    {
+    orientationArray = this->ParticlesData->GetPointData()->GetArray( "hevec0" );
 
-    //
-    // Handling of the stencil pattern is adjusted based on the type
-    // of structure represented (vessel, airway, or fissure).
-    // 
-    if ( this->ChestParticleType == cip::AIRWAY )
+    if ( this->ScaleStencilPatternByParticleScale )
       {
-      //
-      // Following call has no effect if sphere stencil is used, but
-      // is needed in case cylinder stencil is used
-      //
-      this->Stencil->SetOrientation( this->ParticlesData->GetPointData()->GetArray("hevec2")->GetTuple(i)[0], 
-                                     this->ParticlesData->GetPointData()->GetArray("hevec2")->GetTuple(i)[1], 
-                                     this->ParticlesData->GetPointData()->GetArray("hevec2")->GetTuple(i)[2] );
-
-      if ( this->ScaleStencilPatternByParticleScale )
-        {
-        //TODO: Need to properly define a function that converts
-        //particle scale to physical airway radius.
-        }
+      scaleArray = this->ParticlesData->GetPointData()->GetArray( "scale" );
       }
-    if ( this->ChestParticleType == cip::FISSURE )
+    }
+
+  //
+  // Every thread gets its own copy of the stencil, taken before the
+  // stencil is set up at any particle
+  //
+  unsigned int numberOfThreads = this->GetNumberOfThreads();
+
+  std::vector< cipStencil* > stencils( numberOfThreads );
+  for ( unsigned int t=0; t<numberOfThreads; t++ )
+    {
+    stencils[t] = this->Stencil->Clone();
+    }
+
+  //
+  // Set up the stencil at every particle to get the image region
+  // covered by its bounding box. This is done in particle order
+  // since the bounding box of some stencils depends on the order in
+  // which they are set up.
+  //
+  std::vector< PARTICLESTENCIL > particleStencils( numberOfParticles );
+
+  double boundingBoxStartPoint[3];
+  double boundingBoxEndPoint[3];
+
+  typename InputImageType::PointType itkPoint; //A temp container
+
+  for ( unsigned int i=0; i<numberOfParticles; i++ ) 
+    {   
+    PARTICLESTENCIL& particleStencil = particleStencils[i];
+
+    this->ParticlesData->GetPoint( i, particleStencil.center );
+    this->Stencil->SetCenter( particleStencil.center[0], particleStencil.center[1], particleStencil.center[2] );
+
+    if ( orientationArray != NULL )
       {
-      //
-      // Following call has no effect if sphere stencil is used, but
-      // is needed in case cylinder stencil is used
-      //
-      this->Stencil->SetOrientation( this->ParticlesData->GetPointData()->GetArray("hevec1")->GetTuple(i)[0], 
-                                     this->ParticlesData->GetPointData()->GetArray("hevec1")->GetTuple(i)[1], 
-                                     this->ParticlesData->GetPointData()->GetArray("hevec1")->GetTuple(i)[2] );
+      orientationArray->GetTuple( i, particleStencil.orientation );
+      this->Stencil->SetOrientation( particleStencil.orientation[0], particleStencil.orientation[1], 
+                                     particleStencil.orientation[2] );
       }
-    if ( this->ChestParticleType == cip::VESSEL )
+    if ( scaleArray != NULL )
       {
-      //
-      // Following call has no effect if sphere stencil is used, but
-      // is needed in case cylinder stencil is used
-      //
-      this->Stencil->SetOrientation( this->ParticlesData->GetPointData()->GetArray("hevec0")->GetTuple(i)[0], 
-                                     this->ParticlesData->GetPointData()->GetArray("hevec0")->GetTuple(i)[1], 
-                                     this->ParticlesData->GetPointData()->GetArray("hevec0")->GetTuple(i)[2] );        
-
-      //
-      // For vessels, both the cylinder and sphere radii can be scaled
-      // using the particle scale according to an equation that
-      // relates the particle scale and CT point spread function to
-      // the actual vessel radius
-      //
-      if ( this->ScaleStencilPatternByParticleScale )
-        {
-        double scale = this->ParticlesData->GetPointData()->GetArray("scale")->GetTuple(i)[0];
-        double tempRadius = vcl_sqrt(2.0)*vcl_sqrt( pow( scale, 2 ) + pow( this->CTPointSpreadFunctionSigma, 2 ) );
+      double scale = scaleArray->GetTuple1( i );
+      particleStencil.radius = vcl_sqrt(2.0)*vcl_sqrt( pow( scale, 2 ) + pow( this->CTPointSpreadFunctionSigma, 2 ) );
 
-        this->Stencil->SetRadius( tempRadius );
-        }
+      this->Stencil->SetRadius( particleStencil.radius );
       }
 
     //
@@ -166,62 +172,217 @@ cipParticlesToStenciledLabelMapImageFilter< TInputImage >
     itkPoint[1] = boundingBoxStartPoint[1];
     itkPoint[2] = boundingBoxStartPoint[2];
 
-    inputPtr->TransformPhysicalPointToIndex( itkPoint, regionStartIndex );     
+    inputPtr->TransformPhysicalPointToIndex( itkPoint, particleStencil.startIndex );     
 
     itkPoint[0] = boundingBoxEndPoint[0];
     itkPoint[1] = boundingBoxEndPoint[1];
     itkPoint[2] = boundingBoxEndPoint[2];
 
-    inputPtr->TransformPhysicalPointToIndex( itkPoint, regionEndIndex ); 
+    inputPtr->TransformPhysicalPointToIndex( itkPoint, particleStencil.endIndex ); 
 
-    regionStartIndex[0] >= size[0] ? regionStartIndex[0] = size[0]-1 : false;
-    regionStartIndex[1] >= size[1] ? regionStartIndex[1] = size[1]-1 : false;
-    regionStartIndex[2] >= size[2] ? regionStartIndex[2] = size[2]-1 : false;
+    for ( unsigned int d=0; d<3; d++ )
+      {
+      particleStencil.startIndex[d] >= static_cast< long >( size[d] ) ? particleStencil.startIndex[d] = size[d]-1 : false;
+      particleStencil.endIndex[d]   >= static_cast< long >( size[d] ) ? particleStencil.endIndex[d]   = size[d]-1 : false;
 
-    regionEndIndex[0] >= size[0] ? regionEndIndex[0] = size[0]-1 : false;
-    regionEndIndex[1] >= size[1] ? regionEndIndex[1] = size[1]-1 : false;
-    regionEndIndex[2] >= size[2] ? regionEndIndex[2] = size[2]-1 : false;
+      particleStencil.startIndex[d] < 0 ? particleStencil.startIndex[d] = 0 : false;
+      particleStencil.endIndex[d]   < 0 ? particleStencil.endIndex[d]   = 0 : false;
+      }
+    }
 
-    regionStartIndex[0] < 0 ? regionStartIndex[0] = 0 : false;
-    regionStartIndex[1] < 0 ? regionStartIndex[1] = 0 : false;
-    regionStartIndex[2] < 0 ? regionStartIndex[2] = 0 : false;
+  //
+  // Assign the particles to the slabs overlapped by their regions
+  //
+  unsigned int numberOfSlabs = (size[2] + this->NumberOfSlicesPerSlab - 1)/this->NumberOfSlicesPerSlab;
 
-    regionEndIndex[0] < 0 ? regionEndIndex[0] = 0 : false;
-    regionEndIndex[1] < 0 ? regionEndIndex[1] = 0 : false;
-    regionEndIndex[2] < 0 ? regionEndIndex[2] = 0 : false;
+  std::vector< std::vector< unsigned int > > slabParticles( numberOfSlabs );
+  for ( unsigned int i=0; i<numberOfParticles; i++ ) 
+    {
+    unsigned int firstSlab = particleStencils[i].startIndex[2]/this->NumberOfSlicesPerSlab;
+    unsigned int lastSlab  = particleStencils[i].endIndex[2]/this->NumberOfSlicesPerSlab;
 
-    //
-    // Set up the ITK region extent and start index
-    //
-    regionSize[0] = regionEndIndex[0]-regionStartIndex[0]+1;
-    regionSize[1] = regionEndIndex[1]-regionStartIndex[1]+1;
-    regionSize[2] = regionEndIndex[2]-regionStartIndex[2]+1;
-
-    // 
-    // Now create the ITK region of interest over which to perform
-    // local segmentation and connected component
-    // identification. We'll need to convert from the bounding box 
-    //
-    imageRegion.SetSize( regionSize );
-    imageRegion.SetIndex( regionStartIndex );
+    for ( unsigned int slab=firstSlab; slab<=lastSlab; slab++ )
+      {
+      slabParticles[slab].push_back( i );
+      }
+    }
 
-    //
-    // Now iterate over the region. If the physical point is inside
-    // the stencil pattern, set the foreground value
-    //
-    IteratorType it( outputPtr, imageRegion );
-
-    it.GoToBegin();
-    while ( !it.IsAtEnd() )
-      {     
-      inputPtr->TransformIndexToPhysicalPoint( it.GetIndex(), itkPoint );
-      
-      if ( this->Stencil->IsInsideStencilPattern( itkPoint[0], itkPoint[1], itkPoint[2] ) )
+  THREADSTRUCT str;
+    str.filter           = this;
+    str.particleStencils = &particleStencils;
+    str.slabParticles    = &slabParticles;
+    str.stencils         = &stencils;
+    str.setOrientation   = orientationArray != NULL;
+    str.setRadius        = scaleArray != NULL;
+    str.foregroundLabel  = foregroundLabel;
+
+  if ( numberOfThreads == 1 )
+    {
+    for ( unsigned int slab=0; slab<numberOfSlabs; slab++ )
+      {
+      this->RasterizeSlab( &str, slab, stencils[0] );
+      }
+    }
+  else
+    {
+    this->GetMultiThreader()->SetNumberOfThreads( numberOfThreads );
+    this->GetMultiThreader()->SetSingleMethod( Self::ThreaderCallback, &str );
+    this->GetMultiThreader()->SingleMethodExecute();
+    }
+
+  for ( unsigned int t=0; t<numberOfThreads; t++ )
+    {
+    delete stencils[t];
+    }
+}
+
+
+template< class TInputImage >
+ITK_THREAD_RETURN_TYPE
+cipParticlesToStenciledLabelMapImageFilter< TInputImage >
+::ThreaderCallback( void* arg )
+{
+  itk::MultiThreader::ThreadInfoStruct* info = static_cast< itk::MultiThreader::ThreadInfoStruct* >( arg );
+
+  unsigned int threadId        = info->ThreadID;
+  unsigned int numberOfThreads = info->NumberOfThreads;
+  THREADSTRUCT* str            = static_cast< THREADSTRUCT* >( info->UserData );
+
+  //
+  // The slabs are dealt out to the threads in turn. A thread only
+  // writes to the slices of its slabs.
+  //
+  for ( unsigned int slab=threadId; slab<str->slabParticles->size(); slab += numberOfThreads )
+    {
+    str->filter->RasterizeSlab( str, slab, (*str->stencils)[threadId] );
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+template< class TInputImage >
+void
+cipParticlesToStenciledLabelMapImageFilter< TInputImage >
+::RasterizeSlab( const THREADSTRUCT* str, unsigned int slab, cipStencil* stencil )
+{
+  typename Superclass::InputImageConstPointer inputPtr  = this->GetInput();
+  typename Superclass::OutputImagePointer     outputPtr = this->GetOutput(0);
+
+  OutputPixelType* outBuffer = outputPtr->GetBufferPointer();
+
+  long firstSlice = static_cast< long >( slab*this->NumberOfSlicesPerSlab );
+  long lastSlice  = firstSlice + static_cast< long >( this->NumberOfSlicesPerSlab ) - 1;
+  if ( lastSlice >= static_cast< long >( outputPtr->GetBufferedRegion().GetSize()[2] ) )
+    {
+    lastSlice = outputPtr->GetBufferedRegion().GetSize()[2] - 1;
+    }
+
+  //
+  // The physical step between two consecutive voxels of an image row
+  //
+  double rowStep[3];
+  for ( unsigned int d=0; d<3; d++ )
+    {
+    rowStep[d] = inputPtr->GetDirection()[d][0]*inputPtr->GetSpacing()[0];
+    }
+
+  typename InputImageType::PointType itkPoint; //A temp container
+  typename OutputImageType::IndexType index;
+  double rowStartPoint[3];
+  double tMin, tMax;
+
+  const std::vector< unsigned int >& particles = (*str->slabParticles)[slab];
+
+  for ( unsigned int p=0; p<particles.size(); p++ )
+    {
+    const PARTICLESTENCIL& particleStencil = (*str->particleStencils)[particles[p]];
+
+    stencil->SetCenter( particleStencil.center[0], particleStencil.center[1], particleStencil.center[2] );
+    if ( str->setOrientation )
+      {
+      stencil->SetOrientation( particleStencil.orientation[0], particleStencil.orientation[1], 
+                               particleStencil.orientation[2] );
+      }
+    if ( str->setRadius )
+      {
+      stencil->SetRadius( particleStencil.radius );
+      }
+
+    long zStart = particleStencil.startIndex[2] > firstSlice ? particleStencil.startIndex[2] : firstSlice;
+    long zEnd   = particleStencil.endIndex[2] < lastSlice ? particleStencil.endIndex[2] : lastSlice;
+
+    for ( long z=zStart; z<=zEnd; z++ )
+      {
+      for ( long y=particleStencil.startIndex[1]; y<=particleStencil.endIndex[1]; y++ )
         {
-        outputPtr->SetPixel( it.GetIndex(), foregroundLabel );
+        index[0] = particleStencil.startIndex[0];
+        index[1] = y;
+        index[2] = z;
+
+        inputPtr->TransformIndexToPhysicalPoint( index, itkPoint );
+        rowStartPoint[0] = itkPoint[0];
+        rowStartPoint[1] = itkPoint[1];
+        rowStartPoint[2] = itkPoint[2];
+
+        if ( !stencil->GetScanlineExtent( rowStartPoint, rowStep, &tMin, &tMax ) )
+          {
+          continue;
+          }
+
+        //
+        // The extent is widened to whole voxels and clipped to the
+        // bounding box region. The voxels at its ends are then tested
+        // against the pattern, so that the filled voxels are those a
+        // voxel by voxel test would have filled: the extent may be
+        // slightly wider than the pattern because of rounding, but
+        // never misses a voxel the test accepts, and the voxels
+        // between two accepted ones are inside since the patterns are
+        // convex.
+        //
+        if ( vcl_ceil( tMax ) < 0.0 || 
+             vcl_floor( tMin ) > static_cast< double >( particleStencil.endIndex[0] - particleStencil.startIndex[0] ) )
+          {
+          continue;
+          }
+
+        long xStart = particleStencil.startIndex[0] + static_cast< long >( vcl_floor( tMin ) );
+        long xEnd   = particleStencil.startIndex[0] + static_cast< long >( vcl_ceil( tMax ) );
+
+        xStart < particleStencil.startIndex[0] ? xStart = particleStencil.startIndex[0] : false;
+        xEnd   > particleStencil.endIndex[0]   ? xEnd   = particleStencil.endIndex[0]   : false;
+
+        for ( ; xStart <= xEnd; xStart++ )
+          {
+          index[0] = xStart;
+          inputPtr->TransformIndexToPhysicalPoint( index, itkPoint );
+          if ( stencil->IsInsideStencilPattern( itkPoint[0], itkPoint[1], itkPoint[2] ) )
+            {
+            break;
+            }
+          }
+        for ( ; xEnd >= xStart; xEnd-- )
+          {
+          index[0] = xEnd;
+          inputPtr->TransformIndexToPhysicalPoint( index, itkPoint );
+          if ( stencil->IsInsideStencilPattern( itkPoint[0], itkPoint[1], itkPoint[2] ) )
+            {
+            break;
+            }
+          }
+
+        if ( xStart > xEnd )
+          {
+          continue;
+          }
+
+        index[0] = xStart;
+        OutputPixelType* row = outBuffer + outputPtr->ComputeOffset( index );
+        for ( long x=xStart; x<=xEnd; x++ )
+          {
+          *row++ = str->foregroundLabel;
+          }
         }
-     
-      ++it;
       }
     }
 }
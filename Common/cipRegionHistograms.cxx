@@ -0,0 +1,312 @@
+/**
+ *
+ *  $Date$
+ *  $Revision$
+ *  $Author$
+ *
+ */
+
+#include "cipRegionHistograms.h"
+#include "cipExceptionObject.h"
+#include <algorithm>
+#include <cmath>
+
+cipRegionHistograms::cipRegionHistograms( short minBin, short maxBin, unsigned int numberOfHistograms )
+{
+  if ( maxBin < minBin )
+    {
+    throw cip::ExceptionObject( __FILE__, __LINE__, "cipRegionHistograms::cipRegionHistograms()",
+                                "Maximum bin is smaller than minimum bin" );
+    }
+  if ( numberOfHistograms == 0 || numberOfHistograms > 32 )
+    {
+    throw cip::ExceptionObject( __FILE__, __LINE__, "cipRegionHistograms::cipRegionHistograms()",
+                                "Number of histograms must be in [1, 32]" );
+    }
+
+  this->MinBin             = minBin;
+  this->MaxBin             = maxBin;
+  this->NumberOfBins       = static_cast< unsigned int >( static_cast< int >( maxBin ) - static_cast< int >( minBin ) + 1 );
+  this->NumberOfHistograms = numberOfHistograms;
+  this->NumberOfThreads    = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+
+  this->RegionMasks.resize( 256, 0 );
+  this->Bins.resize( this->NumberOfHistograms*this->NumberOfBins, 0 );
+  this->Counts.resize( this->NumberOfHistograms, 0 );
+}
+
+
+cipRegionHistograms::~cipRegionHistograms()
+{
+}
+
+
+void cipRegionHistograms::SetChestRegionHistogramMask( unsigned char region, unsigned int mask )
+{
+  if ( this->NumberOfHistograms < 32 )
+    {
+    mask &= ( 1u << this->NumberOfHistograms ) - 1u;
+    }
+
+  this->RegionMasks[region] = mask;
+}
+
+
+unsigned int cipRegionHistograms::GetChestRegionHistogramMask( unsigned char region ) const
+{
+  return this->RegionMasks[region];
+}
+
+
+void cipRegionHistograms::ClearChestRegionHistogramMasks()
+{
+  std::fill( this->RegionMasks.begin(), this->RegionMasks.end(), 0u );
+}
+
+
+void cipRegionHistograms::SetNumberOfThreads( unsigned int numberOfThreads )
+{
+  this->NumberOfThreads = numberOfThreads > 0 ? numberOfThreads : 1;
+}
+
+
+void cipRegionHistograms::Reset()
+{
+  std::fill( this->Bins.begin(), this->Bins.end(), 0u );
+  std::fill( this->Counts.begin(), this->Counts.end(), 0u );
+}
+
+
+void cipRegionHistograms::AddImage( cip::CTType::Pointer ctImage, cip::LabelMapType::Pointer labelMap )
+{
+  cip::CTType::RegionType       ctRegion = ctImage->GetBufferedRegion();
+  cip::LabelMapType::RegionType lmRegion = labelMap->GetBufferedRegion();
+
+  if ( ctRegion.GetSize() != lmRegion.GetSize() )
+    {
+    throw cip::ExceptionObject( __FILE__, __LINE__, "cipRegionHistograms::AddImage()",
+                                "CT image and label map sizes differ" );
+    }
+
+  // Map every possible label value to the mask of histograms it
+  // contributes to, so that the voxel loop is a single table lookup
+  const cip::ChestConventions& conventions = cip::ChestConventions::GetInstance();
+
+  std::vector< unsigned int > labelMasks( 65536 );
+  labelMasks[0] = 0;
+  for ( unsigned int v=1; v<65536; v++ )
+    {
+    labelMasks[v] = this->RegionMasks[conventions.GetChestRegionFromValue( static_cast< unsigned short >( v ) )];
+    }
+
+  unsigned int sliceSize      = ctRegion.GetSize()[0]*ctRegion.GetSize()[1];
+  unsigned int numberOfSlices = ctRegion.GetSize()[2];
+
+  unsigned int numberOfThreads = this->NumberOfThreads;
+  if ( numberOfThreads > numberOfSlices )
+    {
+    numberOfThreads = numberOfSlices > 0 ? numberOfSlices : 1;
+    }
+
+  // Each thread accumulates into its own counts (bins followed by the
+  // per-histogram totals), which are summed below
+  std::vector< std::vector< unsigned int > > threadHistograms( numberOfThreads );
+  for ( unsigned int t=0; t<numberOfThreads; t++ )
+    {
+    threadHistograms[t].resize( this->NumberOfHistograms*(this->NumberOfBins + 1), 0 );
+    }
+
+  THREADSTRUCT str;
+    str.self             = this;
+    str.ctBuffer         = ctImage->GetBufferPointer();
+    str.labelBuffer      = labelMap->GetBufferPointer();
+    str.sliceSize        = sliceSize;
+    str.numberOfSlices   = numberOfSlices;
+    str.labelMasks       = &labelMasks[0];
+    str.threadHistograms = &threadHistograms;
+
+  if ( numberOfThreads == 1 )
+    {
+    this->AccumulateSlab( str.ctBuffer, str.labelBuffer, sliceSize*numberOfSlices,
+                          str.labelMasks, &threadHistograms[0][0] );
+    }
+  else
+    {
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+      threader->SetNumberOfThreads( numberOfThreads );
+      threader->SetSingleMethod( cipRegionHistograms::ThreaderCallback, &str );
+      threader->SingleMethodExecute();
+    }
+
+  for ( unsigned int t=0; t<numberOfThreads; t++ )
+    {
+    const unsigned int* threadBins   = &threadHistograms[t][0];
+    const unsigned int* threadCounts = threadBins + this->NumberOfHistograms*this->NumberOfBins;
+
+    for ( unsigned int i=0; i<this->NumberOfHistograms*this->NumberOfBins; i++ )
+      {
+      this->Bins[i] += threadBins[i];
+      }
+    for ( unsigned int h=0; h<this->NumberOfHistograms; h++ )
+      {
+      this->Counts[h] += threadCounts[h];
+      }
+    }
+}
+
+
+ITK_THREAD_RETURN_TYPE cipRegionHistograms::ThreaderCallback( void* arg )
+{
+  itk::MultiThreader::ThreadInfoStruct* info = static_cast< itk::MultiThreader::ThreadInfoStruct* >( arg );
+
+  unsigned int threadId        = info->ThreadID;
+  unsigned int numberOfThreads = info->NumberOfThreads;
+  THREADSTRUCT* str            = static_cast< THREADSTRUCT* >( info->UserData );
+
+  // There is one slab per requested thread. The multithreader may run
+  // fewer threads than requested, in which case a thread processes
+  // several slabs (each slab has its own histograms).
+  unsigned int numberOfSlabs = static_cast< unsigned int >( str->threadHistograms->size() );
+
+  for ( unsigned int slab=threadId; slab<numberOfSlabs; slab += numberOfThreads )
+    {
+    unsigned int firstSlice = static_cast< unsigned int >( (static_cast< unsigned long >( slab )*str->numberOfSlices)/numberOfSlabs );
+    unsigned int lastSlice  = static_cast< unsigned int >( (static_cast< unsigned long >( slab + 1 )*str->numberOfSlices)/numberOfSlabs );
+    unsigned long offset    = static_cast< unsigned long >( firstSlice )*str->sliceSize;
+
+    str->self->AccumulateSlab( str->ctBuffer + offset, str->labelBuffer + offset,
+                               (lastSlice - firstSlice)*str->sliceSize, str->labelMasks,
+                               &(*str->threadHistograms)[slab][0] );
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+void cipRegionHistograms::AccumulateSlab( const short* ct, const unsigned short* labels, unsigned int numberOfVoxels,
+                                          const unsigned int* labelMasks, unsigned int* histograms ) const
+{
+  unsigned int* counts  = histograms + this->NumberOfHistograms*this->NumberOfBins;
+  int           minBin  = this->MinBin;
+  unsigned int  numBins = this->NumberOfBins;
+
+  for ( unsigned int v=0; v<numberOfVoxels; v++ )
+    {
+    unsigned int mask = labelMasks[labels[v]];
+    if ( mask == 0 )
+      {
+      continue;
+      }
+
+    // Unsigned arithmetic folds both range checks into one comparison
+    unsigned int bin = static_cast< unsigned int >( static_cast< int >( ct[v] ) - minBin );
+    if ( bin >= numBins )
+      {
+      continue;
+      }
+
+    for ( unsigned int h=0; mask != 0; h++, mask >>= 1 )
+      {
+      if ( mask & 1u )
+        {
+        histograms[h*numBins + bin]++;
+        counts[h]++;
+        }
+      }
+    }
+}
+
+
+unsigned int cipRegionHistograms::GetCount( unsigned int histogram, short value ) const
+{
+  if ( value < this->MinBin || value > this->MaxBin )
+    {
+    return 0;
+    }
+
+  return this->Bins[histogram*this->NumberOfBins + static_cast< unsigned int >( value - this->MinBin )];
+}
+
+
+const unsigned int* cipRegionHistograms::GetHistogram( unsigned int histogram ) const
+{
+  return &this->Bins[histogram*this->NumberOfBins];
+}
+
+
+unsigned int cipRegionHistograms::GetNumberOfCounts( unsigned int histogram ) const
+{
+  return this->Counts[histogram];
+}
+
+
+double cipRegionHistograms::GetMean( unsigned int histogram ) const
+{
+  const unsigned int* bins = this->GetHistogram( histogram );
+
+  double sum = 0.0;
+  for ( unsigned int i=0; i<this->NumberOfBins; i++ )
+    {
+    sum += static_cast< double >( bins[i] )*static_cast< double >( this->MinBin + static_cast< int >( i ) );
+    }
+
+  return sum/static_cast< double >( this->Counts[histogram] );
+}
+
+
+void cipRegionHistograms::ComputeCentralMoments( unsigned int histogram, double mean,
+                                                 double* sum2, double* sum3, double* sum4 ) const
+{
+  const unsigned int* bins = this->GetHistogram( histogram );
+
+  *sum2 = 0.0;
+  *sum3 = 0.0;
+  *sum4 = 0.0;
+
+  for ( unsigned int i=0; i<this->NumberOfBins; i++ )
+    {
+    if ( bins[i] == 0 )
+      {
+      continue;
+      }
+
+    double count = static_cast< double >( bins[i] );
+    double diff  = static_cast< double >( this->MinBin + static_cast< int >( i ) ) - mean;
+    double diff2 = diff*diff;
+
+    *sum2 += count*diff2;
+    *sum3 += count*diff2*diff;
+    *sum4 += count*diff2*diff2;
+    }
+}
+
+
+double cipRegionHistograms::GetSTD( unsigned int histogram, double mean ) const
+{
+  double sum2, sum3, sum4;
+  this->ComputeCentralMoments( histogram, mean, &sum2, &sum3, &sum4 );
+
+  return std::sqrt( sum2/static_cast< double >( this->Counts[histogram] ) );
+}
+
+
+double cipRegionHistograms::GetSkewness( unsigned int histogram, double mean ) const
+{
+  double sum2, sum3, sum4;
+  this->ComputeCentralMoments( histogram, mean, &sum2, &sum3, &sum4 );
+
+  double invCounts = 1.0/static_cast< double >( this->Counts[histogram] );
+
+  return (invCounts*sum3)/std::pow( invCounts*sum2, 1.5 );
+}
+
+
+double cipRegionHistograms::GetKurtosis( unsigned int histogram, double mean ) const
+{
+  double sum2, sum3, sum4;
+  this->ComputeCentralMoments( histogram, mean, &sum2, &sum3, &sum4 );
+
+  double invCounts = 1.0/static_cast< double >( this->Counts[histogram] );
+
+  return (invCounts*sum4)/std::pow( invCounts*sum2, 2 );
+}
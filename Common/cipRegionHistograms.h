@@ -0,0 +1,140 @@
+/**
+ *  \class cipRegionHistograms
+ *  \ingroup common
+ *  \brief This class accumulates intensity histograms for a set of
+ *  chest regions in a single pass over a CT image and a label map.
+ *
+ *  Each histogram is a dense array of counts indexed by HU value
+ *  (one bin per integer value in [minBin, maxBin]). The user
+ *  specifies which histograms a given chest region contributes to
+ *  with a bit mask: bit 'k' of the mask set for a region means that
+ *  voxels labeled with that region are counted in histogram 'k'. A
+ *  voxel therefore updates all of its super-regions at once (e.g. a
+ *  LEFTSUPERIORLOBE voxel can update the left superior lobe, left
+ *  lung and whole lung histograms). At most 32 histograms can be
+ *  accumulated.
+ *
+ *  The voxel accumulation is split into slabs along the z axis, each
+ *  processed by its own thread into its own histograms. The per-thread
+ *  histograms are summed at the end, so the counts do not depend on
+ *  the number of threads. 'AddImage' can be called several times
+ *  (e.g. with different label maps and region masks); counts are
+ *  added to the existing ones.
+ *
+ *  Moments (mean, standard deviation, skewness, kurtosis) are
+ *  computed in closed form from the bins.
+ *
+ *  $Date$
+ *  $Revision$
+ *  $Author$
+ *
+ */
+
+#ifndef __cipRegionHistograms_h
+#define __cipRegionHistograms_h
+
+#include "cipHelper.h"
+#include "itkMultiThreader.h"
+#include <vector>
+
+class cipRegionHistograms
+{
+public:
+  cipRegionHistograms( short minBin, short maxBin, unsigned int numberOfHistograms );
+  ~cipRegionHistograms();
+
+  /** Set the bit mask of histograms that voxels labeled with the
+   *  specified chest region contribute to. By default every region
+   *  has an empty mask. */
+  void SetChestRegionHistogramMask( unsigned char, unsigned int );
+  unsigned int GetChestRegionHistogramMask( unsigned char ) const;
+
+  /** Reset all the chest region masks to zero. The accumulated
+   *  counts are not affected. */
+  void ClearChestRegionHistogramMasks();
+
+  /** Set the number of threads used by 'AddImage'. Defaults to the
+   *  ITK global default number of threads. */
+  void SetNumberOfThreads( unsigned int );
+  unsigned int GetNumberOfThreads() const
+    {
+      return NumberOfThreads;
+    };
+
+  /** Accumulate the CT values of all labeled voxels into the
+   *  histograms according to the current chest region masks. CT
+   *  values outside [minBin, maxBin] and voxels with label zero are
+   *  ignored. The CT image and the label map must have the same
+   *  buffered region. */
+  void AddImage( cip::CTType::Pointer, cip::LabelMapType::Pointer );
+
+  /** Set all the counts to zero */
+  void Reset();
+
+  short GetMinBin() const
+    {
+      return MinBin;
+    };
+  short GetMaxBin() const
+    {
+      return MaxBin;
+    };
+  unsigned int GetNumberOfBins() const
+    {
+      return NumberOfBins;
+    };
+  unsigned int GetNumberOfHistograms() const
+    {
+      return NumberOfHistograms;
+    };
+
+  /** Get the count of the specified histogram for the specified HU
+   *  value. Values outside [minBin, maxBin] have a count of zero. */
+  unsigned int GetCount( unsigned int, short ) const;
+
+  /** Get a pointer to the dense counts of the specified
+   *  histogram. Element 'i' holds the count for HU value minBin+i. */
+  const unsigned int* GetHistogram( unsigned int ) const;
+
+  /** Get the total number of counts in the specified histogram */
+  unsigned int GetNumberOfCounts( unsigned int ) const;
+
+  /** Moments of the specified histogram. The STD, skewness and
+   *  kurtosis take the mean as second argument so that callers can
+   *  supply their own estimate. */
+  double GetMean( unsigned int ) const;
+  double GetSTD( unsigned int, double ) const;
+  double GetSkewness( unsigned int, double ) const;
+  double GetKurtosis( unsigned int, double ) const;
+
+private:
+  struct THREADSTRUCT
+  {
+    cipRegionHistograms*  self;
+    const short*          ctBuffer;
+    const unsigned short* labelBuffer;
+    unsigned int          sliceSize;
+    unsigned int          numberOfSlices;
+    const unsigned int*   labelMasks;
+    std::vector< std::vector< unsigned int > >* threadHistograms;
+  };
+
+  static ITK_THREAD_RETURN_TYPE ThreaderCallback( void* );
+
+  void AccumulateSlab( const short*, const unsigned short*, unsigned int,
+                       const unsigned int*, unsigned int* ) const;
+
+  void ComputeCentralMoments( unsigned int, double, double*, double*, double* ) const;
+
+  short        MinBin;
+  short        MaxBin;
+  unsigned int NumberOfBins;
+  unsigned int NumberOfHistograms;
+  unsigned int NumberOfThreads;
+
+  std::vector< unsigned int > RegionMasks;
+  std::vector< unsigned int > Bins;
+  std::vector< unsigned int > Counts;
+};
+
+#endif
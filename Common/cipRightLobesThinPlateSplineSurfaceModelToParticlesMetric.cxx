@@ -136,71 +136,36 @@ double cipRightLobesThinPlateSplineSurfaceModelToParticlesMetric::GetFissureTerm
 {
   double fissureTermValue = 0.0;
 
-  cip::PointType position(3);
-  cip::VectorType roNormal(3);
-  cip::VectorType rhNormal(3);
-  cip::VectorType orientation(3);
-
-  cipNewtonOptimizer< 2 >::PointType* roDomainParams  = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-  cipNewtonOptimizer< 2 >::PointType* roOptimalParams = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-
-  cipNewtonOptimizer< 2 >::PointType* rhDomainParams  = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-  cipNewtonOptimizer< 2 >::PointType* rhOptimalParams = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-
-  unsigned int ROtoRHcount = 0;
-  unsigned int ROtoROcount = 0;
-  unsigned int RHtoRHcount = 0;
-  unsigned int RHtoROcount = 0;
+  const cipThinPlateSplineSurface& roTPS = this->RightObliqueNewtonOptimizer.GetMetric().GetThinPlateSplineSurface();
+  const cipThinPlateSplineSurface& rhTPS = this->RightHorizontalNewtonOptimizer.GetMetric().GetThinPlateSplineSurface();
+
+  // Determine the points on the right oblique and right horizontal
+  // surfaces that are closest to the particles (and the corresponding
+  // distances) for all the particles at once
+  std::vector< cip::Point3 > roClosestPoints;
+  std::vector< cip::Point3 > rhClosestPoints;
+  std::vector< double > roDistances;
+  std::vector< double > rhDistances;
+  cip::GetClosestPointsOnThinPlateSplineSurface( roTPS, this->FissureParticlePositions, roClosestPoints, roDistances );
+  cip::GetClosestPointsOnThinPlateSplineSurface( rhTPS, this->FissureParticlePositions, rhClosestPoints, rhDistances );
+
+  cip::Vector3 roNormal;
+  cip::Vector3 rhNormal;
+  cip::Vector3 orientation;
 
   for ( unsigned int i=0; i<this->NumberOfFissureParticles; i++ )
     {
-    position[0] = this->FissureParticles->GetPoint(i)[0];
-    position[1] = this->FissureParticles->GetPoint(i)[1];
-    position[2] = this->FissureParticles->GetPoint(i)[2];
+    const cip::Point3& position = this->FissureParticlePositions[i];
 
-    orientation[0] = this->FissureParticles->GetPointData()->GetArray( "hevec2" )->GetTuple(i)[0];
-    orientation[1] = this->FissureParticles->GetPointData()->GetArray( "hevec2" )->GetTuple(i)[1];
-    orientation[2] = this->FissureParticles->GetPointData()->GetArray( "hevec2" )->GetTuple(i)[2];
+    orientation = cip::Vector3( this->FissureParticles->GetPointData()->GetArray( "hevec2" )->GetTuple(i) );
 
     float cipType = this->FissureParticles->GetPointData()->GetArray( "ChestType" )->GetTuple(i)[0];
 
-    // Determine the domain locations for which the particle is closest
-    // to the right oblique and right horizontal TPS surfaces
-    this->RightObliqueNewtonOptimizer.GetMetric().SetParticle( position );
-    this->RightHorizontalNewtonOptimizer.GetMetric().SetParticle( position );
-
-    // The particle's x, and y location are a good place to initialize
-    // the search for the domain locations that result in the smallest
-    // distance between the particle and the TPS surfaces
-    (*roDomainParams)[0] = position[0]; 
-    (*roDomainParams)[1] = position[1]; 
-
-    (*rhDomainParams)[0] = position[0]; 
-    (*rhDomainParams)[1] = position[1]; 
-
-    // Perform Newton line search to determine the closest point on
-    // the current TPS surfaces
-    this->RightObliqueNewtonOptimizer.SetInitialParameters( roDomainParams );
-    this->RightObliqueNewtonOptimizer.Update();
-    this->RightObliqueNewtonOptimizer.GetOptimalParameters( roOptimalParams );
-
-    this->RightHorizontalNewtonOptimizer.SetInitialParameters( rhDomainParams );
-    this->RightHorizontalNewtonOptimizer.Update();
-    this->RightHorizontalNewtonOptimizer.GetOptimalParameters( rhOptimalParams );
-
-    // Get the distances between the particle and the TPS surfaces. This
-    // is just the square root of the objective function value
-    // optimized by the Newton method.
-    double roDistance = vcl_sqrt( this->RightObliqueNewtonOptimizer.GetOptimalValue() );
-    double rhDistance = vcl_sqrt( this->RightHorizontalNewtonOptimizer.GetOptimalValue() );
-
     // Get the TPS surface normals at the domain locations.
-    this->RightObliqueNewtonOptimizer.GetMetric().GetThinPlateSplineSurface().
-      GetSurfaceNormal( (*roOptimalParams)[0], (*roOptimalParams)[1], roNormal );
+    roTPS.GetSurfaceNormal( roClosestPoints[i][0], roClosestPoints[i][1], roNormal );
     double roTheta = cip::GetAngleBetweenVectors( roNormal, orientation, true );
 
-    this->RightHorizontalNewtonOptimizer.GetMetric().GetThinPlateSplineSurface().
-      GetSurfaceNormal( (*rhOptimalParams)[0], (*rhOptimalParams)[1], rhNormal );
+    rhTPS.GetSurfaceNormal( rhClosestPoints[i][0], rhClosestPoints[i][1], rhNormal );
     double rhTheta = cip::GetAngleBetweenVectors( rhNormal, orientation, true );
 
     // A given particle can only contribute to the metric through association to either the
@@ -208,10 +173,10 @@ double cipRightLobesThinPlateSplineSurfaceModelToParticlesMetric::GetFissureTerm
     // the right horizontal term is more negative and if the right horizontal surface
     // is above the right oblique surface at this iteration, the the right horizontal
     // term will be used. Otherwise the right oblique term will be used.
-    double rhTerm = -this->FissureParticleWeights[i]*std::exp( -rhDistance/this->FissureSigmaDistance )*
+    double rhTerm = -this->FissureParticleWeights[i]*std::exp( -rhDistances[i]/this->FissureSigmaDistance )*
       std::exp( -rhTheta/this->FissureSigmaTheta );
 
-    double roTerm = -this->FissureParticleWeights[i]*std::exp( -roDistance/this->FissureSigmaDistance )*
+    double roTerm = -this->FissureParticleWeights[i]*std::exp( -roDistances[i]/this->FissureSigmaDistance )*
       std::exp( -roTheta/this->FissureSigmaTheta );    
 
     // Note that we only consider the right horizontal boundary surface provided that the
@@ -222,9 +187,7 @@ double cipRightLobesThinPlateSplineSurfaceModelToParticlesMetric::GetFissureTerm
 	fissureTermValue += roTerm;
       }
 
-    else if ( (this->RightHorizontalNewtonOptimizer.GetMetric().GetThinPlateSplineSurface().
-	       GetSurfaceHeight( position[0], position[1] ) > this->RightObliqueNewtonOptimizer.
-	       GetMetric().GetThinPlateSplineSurface().GetSurfaceHeight( position[0], position[1] ) &&
+    else if ( (rhTPS.GetSurfaceHeight( position[0], position[1] ) > roTPS.GetSurfaceHeight( position[0], position[1] ) &&
 	       rhTerm < roTerm) || cipType == float(cip::HORIZONTALFISSURE) )
       {
     	fissureTermValue += rhTerm;
@@ -242,64 +205,34 @@ double cipRightLobesThinPlateSplineSurfaceModelToParticlesMetric::GetVesselTermV
 {
   double vesselTermValue = 0.0;
 
-  cip::PointType position(3);
-  cip::VectorType roNormal(3);
-  cip::VectorType rhNormal(3);
-  cip::VectorType orientation(3);
+  const cipThinPlateSplineSurface& roTPS = this->RightObliqueNewtonOptimizer.GetMetric().GetThinPlateSplineSurface();
+  const cipThinPlateSplineSurface& rhTPS = this->RightHorizontalNewtonOptimizer.GetMetric().GetThinPlateSplineSurface();
 
-  cipNewtonOptimizer< 2 >::PointType* roDomainParams  = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-  cipNewtonOptimizer< 2 >::PointType* roOptimalParams = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
+  // Determine the points on the right oblique and right horizontal
+  // surfaces that are closest to the particles (and the corresponding
+  // distances) for all the particles at once
+  std::vector< cip::Point3 > roClosestPoints;
+  std::vector< cip::Point3 > rhClosestPoints;
+  std::vector< double > roDistances;
+  std::vector< double > rhDistances;
+  cip::GetClosestPointsOnThinPlateSplineSurface( roTPS, this->VesselParticlePositions, roClosestPoints, roDistances );
+  cip::GetClosestPointsOnThinPlateSplineSurface( rhTPS, this->VesselParticlePositions, rhClosestPoints, rhDistances );
 
-  cipNewtonOptimizer< 2 >::PointType* rhDomainParams  = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
-  cipNewtonOptimizer< 2 >::PointType* rhOptimalParams = new cipNewtonOptimizer< 2 >::PointType( 2, 2 );
+  cip::Vector3 roNormal;
+  cip::Vector3 rhNormal;
+  cip::Vector3 orientation;
 
   for ( unsigned int i=0; i<this->NumberOfVesselParticles; i++ )
     {
-    position[0] = this->VesselParticles->GetPoint(i)[0];
-    position[1] = this->VesselParticles->GetPoint(i)[1];
-    position[2] = this->VesselParticles->GetPoint(i)[2];
-
-    orientation[0] = this->VesselParticles->GetPointData()->GetArray( "hevec0" )->GetTuple(i)[0];
-    orientation[1] = this->VesselParticles->GetPointData()->GetArray( "hevec0" )->GetTuple(i)[1];
-    orientation[2] = this->VesselParticles->GetPointData()->GetArray( "hevec0" )->GetTuple(i)[2];
-
-    // Determine the domain locations for which the particle is closest
-    // to the right oblique and right horizontal TPS surfaces
-    this->RightObliqueNewtonOptimizer.GetMetric().SetParticle( position );
-    this->RightHorizontalNewtonOptimizer.GetMetric().SetParticle( position );
-
-    // The particle's x, and y location are a good place to initialize
-    // the search for the domain locations that result in the smallest
-    // distance between the particle and the TPS surfaces
-    (*roDomainParams)[0] = position[0]; 
-    (*roDomainParams)[1] = position[1]; 
-
-    (*rhDomainParams)[0] = position[0]; 
-    (*rhDomainParams)[1] = position[1]; 
-
-    // Perform Newton line search to determine the closest point on
-    // the current TPS surfaces
-    this->RightObliqueNewtonOptimizer.SetInitialParameters( roDomainParams );
-    this->RightObliqueNewtonOptimizer.Update();
-    this->RightObliqueNewtonOptimizer.GetOptimalParameters( roOptimalParams );
-
-    this->RightHorizontalNewtonOptimizer.SetInitialParameters( rhDomainParams );
-    this->RightHorizontalNewtonOptimizer.Update();
-    this->RightHorizontalNewtonOptimizer.GetOptimalParameters( rhOptimalParams );
-
-    // Get the distances between the particle and the TPS surfaces. This
-    // is just the square root of the objective function value
-    // optimized by the Newton method.
-    double roDistance = vcl_sqrt( this->RightObliqueNewtonOptimizer.GetOptimalValue() );
-    double rhDistance = vcl_sqrt( this->RightHorizontalNewtonOptimizer.GetOptimalValue() );
+    const cip::Point3& position = this->VesselParticlePositions[i];
+
+    orientation = cip::Vector3( this->VesselParticles->GetPointData()->GetArray( "hevec0" )->GetTuple(i) );
 
     // Get the TPS surface normals at the domain locations.
-    this->RightObliqueNewtonOptimizer.GetMetric().GetThinPlateSplineSurface().
-      GetSurfaceNormal( (*roOptimalParams)[0], (*roOptimalParams)[1], roNormal );
+    roTPS.GetSurfaceNormal( roClosestPoints[i][0], roClosestPoints[i][1], roNormal );
     double roTheta = cip::GetAngleBetweenVectors( roNormal, orientation, true );
 
-    this->RightHorizontalNewtonOptimizer.GetMetric().GetThinPlateSplineSurface().
-      GetSurfaceNormal( (*rhOptimalParams)[0], (*rhOptimalParams)[1], rhNormal );
+    rhTPS.GetSurfaceNormal( rhClosestPoints[i][0], rhClosestPoints[i][1], rhNormal );
     double rhTheta = cip::GetAngleBetweenVectors( rhNormal, orientation, true );
 
     // Now that we have the surface normals and distances, we can compute this 
@@ -307,15 +240,13 @@ double cipRightLobesThinPlateSplineSurfaceModelToParticlesMetric::GetVesselTermV
     // we only consider the right horizontal boundary surface provided that the
     // surface right horizontal surface point is above the right oblique surface
     // point.
-    if ( this->RightHorizontalNewtonOptimizer.GetMetric().GetThinPlateSplineSurface().
-	 GetSurfaceHeight( position[0], position[1] ) > this->RightObliqueNewtonOptimizer.GetMetric().
-	 GetThinPlateSplineSurface().GetSurfaceHeight( position[0], position[1] ) )
+    if ( rhTPS.GetSurfaceHeight( position[0], position[1] ) > roTPS.GetSurfaceHeight( position[0], position[1] ) )
       {
-	vesselTermValue += this->VesselParticleWeights[i]*std::exp( -rhDistance/this->VesselSigmaDistance )*
+	vesselTermValue += this->VesselParticleWeights[i]*std::exp( -rhDistances[i]/this->VesselSigmaDistance )*
 	  std::exp( -rhTheta/this->VesselSigmaTheta );
       }
     
-    vesselTermValue += this->VesselParticleWeights[i]*std::exp( -roDistance/this->VesselSigmaDistance )*
+    vesselTermValue += this->VesselParticleWeights[i]*std::exp( -roDistances[i]/this->VesselSigmaDistance )*
       std::exp( -roTheta/this->VesselSigmaTheta );
     }
 
@@ -17,6 +17,13 @@ cipSphereStencil::cipSphereStencil()
   this->Radius = 1.0;
 }
 
+
+cipStencil* cipSphereStencil::Clone() const
+{
+  return new cipSphereStencil( *this );
+}
+
+
 bool cipSphereStencil::IsInsideBoundingBox( double x, double y, double z ) const
 {
   if ( x >= this->BoundingBoxMin[0] && x <= this->BoundingBoxMax[0] &&
@@ -42,6 +49,48 @@ bool cipSphereStencil::IsInsideStencilPattern( double x, double y, double z ) co
 }
 
 
+//
+// The line is inside the sphere where |point + t*direction - center|^2
+// <= radius^2, a quadratic inequality in t. A line tangent to the
+// sphere can get a slightly negative discriminant from rounding; it
+// is given the single point closest to the center, so that callers
+// still test the voxels there against the pattern.
+//
+bool cipSphereStencil::GetScanlineExtent( const double* const point, const double* const direction, 
+                                          double* tMin, double* tMax ) const
+{
+  double w[3];
+    w[0] = point[0] - this->Center[0];
+    w[1] = point[1] - this->Center[1];
+    w[2] = point[2] - this->Center[2];
+
+  double a = direction[0]*direction[0] + direction[1]*direction[1] + direction[2]*direction[2];
+  double b = w[0]*direction[0] + w[1]*direction[1] + w[2]*direction[2];
+  double c = w[0]*w[0] + w[1]*w[1] + w[2]*w[2] - this->Radius*this->Radius;
+
+  if ( a == 0.0 )
+    {
+    return false;
+    }
+
+  double discriminant = b*b - a*c;
+  if ( discriminant < 0.0 )
+    {
+    double scale = b*b + a*(w[0]*w[0] + w[1]*w[1] + w[2]*w[2] + this->Radius*this->Radius);
+    if ( discriminant < -1e-10*scale )
+      {
+      return false;
+      }
+    discriminant = 0.0;
+    }
+
+  *tMin = (-b - sqrt( discriminant ))/a;
+  *tMax = (-b + sqrt( discriminant ))/a;
+
+  return true;
+}
+
+
 void cipSphereStencil::GetStencilBoundingBox( double* const bbMin, double* const bbMax ) const
 {
   bbMin[0] = this->BoundingBoxMin[0];
@@ -23,6 +23,10 @@ public:
   ~cipSphereStencil(){};
   cipSphereStencil();
 
+  /** Create a copy of this stencil. The caller is responsible for
+   *  deleting it. */
+  cipStencil* Clone() const;
+
   /** Given physical coordinates, x, y, and z, this method will
    *  indicate whether the point is inside the stencil's bounding box
    *  or not. Note that 'SetCenter' must be called before calling this
@@ -36,6 +40,13 @@ public:
    *  method. */
   bool IsInsideStencilPattern( double, double, double ) const; 
 
+  /** Given a line, defined by a physical point and a direction
+   *  vector, compute the range of the line parameter for which the
+   *  line is inside the sphere. Returns false if the line misses the
+   *  sphere. Note that 'SetCenter' must be called before calling this
+   *  method. */
+  bool GetScanlineExtent( const double* const, const double* const, double*, double* ) const;
+
   /** Get the bounding box of the stencil. The first argument should
    *  be a 3 element vector to hold the min x, y, and z physical
    *  coordinates of the bounding box. The second argument should be
@@ -26,9 +26,15 @@
 class cipStencil
 {
 public:
-  ~cipStencil(){};
+  virtual ~cipStencil(){};
   cipStencil(){};
 
+  /** Create a new stencil of the same type with the same center,
+   *  orientation, radius, etc. The caller is responsible for deleting
+   *  it. Copies allow several threads to set up the stencil pattern
+   *  at different points at the same time. */
+  virtual cipStencil* Clone() const = 0;
+
   /** Given physical coordinates, x, y, and z, this method will
    *  indicate whether the point is inside the stencil's bounding box
    *  or not. Note that 'SetCenter' must be called before calling this
@@ -41,6 +47,20 @@ public:
    *  method. */
   virtual bool IsInsideStencilPattern( double, double, double ) const = 0;
 
+  /** Given a line, defined by a physical point (first argument) and a
+   *  direction vector (second argument), this method computes the
+   *  range of the line parameter 't' for which 'point + t*direction'
+   *  is inside the stencil pattern. Returns false if the line misses
+   *  the pattern, in which case the range is not set. Stencil
+   *  patterns are convex, so the range is a single interval; it lets
+   *  callers fill the pattern one image row at a time instead of
+   *  testing every voxel of the bounding box. Because of rounding,
+   *  the range can be slightly wider than the pattern (a line that
+   *  grazes the pattern gets a single point), so callers should test
+   *  the points at its ends with 'IsInsideStencilPattern'. Note that
+   *  'SetCenter' must be called before calling this method. */
+  virtual bool GetScanlineExtent( const double* const, const double* const, double*, double* ) const = 0;
+
   /** Get the bounding box of the stencil. The first argument should
    *  be a 3 element vector to hold the min x, y, and z physical
    *  coordinates of the bounding box. The second argument should be
@@ -1,11 +1,76 @@
 #include "cipThinPlateSplineSurface.h"
+#include "cipExceptionObject.h"
 #include "itkNumericTraits.h"
+#include "itkSimpleFastMutexLock.h"
+#include <algorithm>
+#include <cmath>
+
+
+namespace
+{
+// Guards the reference counts of the factorizations shared between
+// copies of a surface, so that copies can be made, assigned and
+// destroyed from different threads
+itk::SimpleFastMutexLock FactorizationReferenceCountLock;
+
+// The TPS kernel, r^2*log10(r), with the convention that it is zero
+// for coincident points
+inline double ComputeKernel( const cip::PointType& p1, const cip::PointType& p2, double* r )
+{
+  double dx = p1[0] - p2[0];
+  double dy = p1[1] - p2[1];
+
+  *r = vcl_sqrt( dx*dx + dy*dy );
+
+  if ( *r == 0.0 )
+    {
+    return 0.0;
+    }
+
+  return (*r)*(*r)*vcl_log10( *r );
+}
+
+// Far-field approximation parameters: maximum expansion order, number of
+// complex moments stored per node, maximum number of points in a leaf,
+// minimum number of control points for which the tree is built, and
+// maximum tree depth
+const unsigned int FarFieldExpansionOrder        = 20;
+const unsigned int FarFieldMomentsPerNode        = 3*FarFieldExpansionOrder + 4;
+const unsigned int FarFieldLeafSize              = 32;
+const unsigned int FarFieldMinimumNumberOfPoints = 256;
+const unsigned int FarFieldMaximumDepth          = 24;
+
+// Partition predicate used to split the far-field quadtree nodes
+class FarFieldCoordinateLess
+{
+public:
+  FarFieldCoordinateLess( const std::vector< cip::PointType >& points, unsigned int dimension, double value )
+    : Points( &points ), Dimension( dimension ), Value( value )
+  {
+  }
+
+  bool operator()( unsigned int i ) const
+  {
+    return (*this->Points)[i][this->Dimension] < this->Value;
+  }
+
+private:
+  const std::vector< cip::PointType >* Points;
+  unsigned int Dimension;
+  double Value;
+};
+}
 
 
 cipThinPlateSplineSurface::cipThinPlateSplineSurface()
 {
   this->m_Lambda = 0.0;
   this->m_NumberSurfacePoints = 0;
+  this->m_MaximumNumberOfControlPoints = 0;
+  this->m_NumberInputPoints = 0;
+  this->m_Factorization = NULL;
+  this->m_NumberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  this->m_ApproximationTolerance = 0.0;
 }
 
 
@@ -15,17 +80,108 @@ cipThinPlateSplineSurface::cipThinPlateSplineSurface()
 //
 cipThinPlateSplineSurface::cipThinPlateSplineSurface( const std::vector< cip::PointType >& surfacePointsVec )
 {
-  this->m_NumberSurfacePoints = surfacePointsVec.size();
+  this->m_Lambda = 0.0;
+  this->m_NumberSurfacePoints = 0;
+  this->m_MaximumNumberOfControlPoints = 0;
+  this->m_NumberInputPoints = 0;
+  this->m_Factorization = NULL;
+  this->m_NumberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  this->m_ApproximationTolerance = 0.0;
+
   this->SetSurfacePoints( surfacePointsVec );
-  this->ComputeThinPlateSplineVectors();
 }
 
+
+cipThinPlateSplineSurface::cipThinPlateSplineSurface( const cipThinPlateSplineSurface& surface )
+{
+  this->m_a                            = surface.m_a;
+  this->m_w                            = surface.m_w;
+  this->m_SurfacePoints                = surface.m_SurfacePoints;
+  this->m_SurfacePointWeights          = surface.m_SurfacePointWeights;
+  this->m_Lambda                       = surface.m_Lambda;
+  this->m_NumberSurfacePoints          = surface.m_NumberSurfacePoints;
+  this->m_MaximumNumberOfControlPoints = surface.m_MaximumNumberOfControlPoints;
+  this->m_NumberInputPoints            = surface.m_NumberInputPoints;
+  this->m_ControlPointIndices          = surface.m_ControlPointIndices;
+  this->m_NumberOfThreads              = surface.m_NumberOfThreads;
+  this->m_ApproximationTolerance       = surface.m_ApproximationTolerance;
+  this->m_FarFieldNodes                = surface.m_FarFieldNodes;
+  this->m_FarFieldPoints               = surface.m_FarFieldPoints;
+  this->m_FarFieldMoments              = surface.m_FarFieldMoments;
+
+  // The factorization is shared until one of the copies modifies it
+  this->m_Factorization = surface.m_Factorization;
+  if ( this->m_Factorization != NULL )
+    {
+    FactorizationReferenceCountLock.Lock();
+    this->m_Factorization->ReferenceCount++;
+    FactorizationReferenceCountLock.Unlock();
+    }
+}
+
+
+cipThinPlateSplineSurface::~cipThinPlateSplineSurface()
+{
+  this->InvalidateFactorization();
+}
+
+
+cipThinPlateSplineSurface& cipThinPlateSplineSurface::operator=( const cipThinPlateSplineSurface& surface )
+{
+  if ( this == &surface )
+    {
+    return *this;
+    }
+
+  if ( surface.m_Factorization != NULL )
+    {
+    FactorizationReferenceCountLock.Lock();
+    surface.m_Factorization->ReferenceCount++;
+    FactorizationReferenceCountLock.Unlock();
+    }
+  this->InvalidateFactorization();
+  this->m_Factorization = surface.m_Factorization;
+
+  this->m_a                            = surface.m_a;
+  this->m_w                            = surface.m_w;
+  this->m_SurfacePoints                = surface.m_SurfacePoints;
+  this->m_SurfacePointWeights          = surface.m_SurfacePointWeights;
+  this->m_Lambda                       = surface.m_Lambda;
+  this->m_NumberSurfacePoints          = surface.m_NumberSurfacePoints;
+  this->m_MaximumNumberOfControlPoints = surface.m_MaximumNumberOfControlPoints;
+  this->m_NumberInputPoints            = surface.m_NumberInputPoints;
+  this->m_ControlPointIndices          = surface.m_ControlPointIndices;
+  this->m_NumberOfThreads              = surface.m_NumberOfThreads;
+  this->m_ApproximationTolerance       = surface.m_ApproximationTolerance;
+  this->m_FarFieldNodes                = surface.m_FarFieldNodes;
+  this->m_FarFieldPoints               = surface.m_FarFieldPoints;
+  this->m_FarFieldMoments              = surface.m_FarFieldMoments;
+
+  return *this;
+}
+
+
 void cipThinPlateSplineSurface::SetLambda( double lambda )
 {
   this->m_Lambda = lambda;
 
   if ( this->m_NumberSurfacePoints > 0 )
     {
+    // The reduced kernel matrix does not depend on lambda, so only
+    // the Cholesky factorization has to be recomputed
+    if ( this->m_Factorization != NULL )
+      {
+      this->DetachFactorization();
+      if ( this->FactorizeReducedMatrix() )
+        {
+        this->SolveFactorizedSystem();
+        return;
+        }
+      this->InvalidateFactorization();
+      this->ComputeThinPlateSplineVectorsWithSVD();
+      return;
+      }
+
     this->ComputeThinPlateSplineVectors();
     }
 }
@@ -36,46 +192,830 @@ void cipThinPlateSplineSurface::SetSurfacePointWeights( const std::vector< doubl
   // Clear any existing surface point weights first
   this->m_SurfacePointWeights.clear();
 
-  for ( unsigned int i=0; i<surfacePointWeights->size(); i++ )
+  // In decimated mode the weights can be given for all the input
+  // points, in which case we keep the weights of the control points
+  if ( surfacePointWeights->size() != this->m_NumberSurfacePoints &&
+       surfacePointWeights->size() == this->m_NumberInputPoints )
     {
-    this->m_SurfacePointWeights.push_back( (*surfacePointWeights)[i] );
+    for ( unsigned int i=0; i<this->m_ControlPointIndices.size(); i++ )
+      {
+      this->m_SurfacePointWeights.push_back( (*surfacePointWeights)[this->m_ControlPointIndices[i]] );
+      }
     }
-    
-  // Compute the TPS vectors given these new point weights
+  else
+    {
+    for ( unsigned int i=0; i<surfacePointWeights->size(); i++ )
+      {
+      this->m_SurfacePointWeights.push_back( (*surfacePointWeights)[i] );
+      }
+    }
+
+  // Compute the TPS vectors given these new point weights. As for
+  // lambda, only the Cholesky factorization has to be recomputed.
+  if ( this->m_Factorization != NULL )
+    {
+    this->DetachFactorization();
+    if ( this->FactorizeReducedMatrix() )
+      {
+      this->SolveFactorizedSystem();
+      return;
+      }
+    this->InvalidateFactorization();
+    this->ComputeThinPlateSplineVectorsWithSVD();
+    return;
+    }
+
   this->ComputeThinPlateSplineVectors();
 }
 
 
+void cipThinPlateSplineSurface::SetMaximumNumberOfControlPoints( unsigned int maximumNumberOfControlPoints )
+{
+  this->m_MaximumNumberOfControlPoints = maximumNumberOfControlPoints;
+}
+
+
 void cipThinPlateSplineSurface::SetSurfacePoints( const std::vector< cip::PointType >& surfacePointsVec )
 {
   // Make sure any old memory is freed up and the vector of surface
   // points is cleared before we add new points.
   this->m_SurfacePoints.clear();
+  this->m_ControlPointIndices.clear();
+
+  // We also assume that if new points are being added, any weights
+  // previously set are now irrelevant, so we clear this container to
+  // make sure they don't have an effect on the new TPS computation
+  this->m_SurfacePointWeights.clear();
+
+  this->m_NumberInputPoints = surfacePointsVec.size();
+
+  if ( this->m_MaximumNumberOfControlPoints > 0 &&
+       surfacePointsVec.size() > this->m_MaximumNumberOfControlPoints )
+    {
+    // Farthest point sampling in the xy plane. 'minDistance' holds
+    // the squared distance of each point to the current sample.
+    unsigned int numPoints = surfacePointsVec.size();
+
+    std::vector< double > minDistance( numPoints, itk::NumericTraits< double >::max() );
+
+    unsigned int next = 0;
+    while ( this->m_ControlPointIndices.size() < this->m_MaximumNumberOfControlPoints )
+      {
+      this->m_ControlPointIndices.push_back( next );
+
+      double maxDistance = 0.0;
+      for ( unsigned int i=0; i<numPoints; i++ )
+        {
+        double dx = surfacePointsVec[i][0] - surfacePointsVec[this->m_ControlPointIndices.back()][0];
+        double dy = surfacePointsVec[i][1] - surfacePointsVec[this->m_ControlPointIndices.back()][1];
+
+        minDistance[i] = std::min( minDistance[i], dx*dx + dy*dy );
+        if ( minDistance[i] > maxDistance )
+          {
+          maxDistance = minDistance[i];
+          next = i;
+          }
+        }
+
+      // Only coincident points are left
+      if ( maxDistance == 0.0 )
+        {
+        break;
+        }
+      }
+
+    // Keep the control points in input order
+    std::sort( this->m_ControlPointIndices.begin(), this->m_ControlPointIndices.end() );
+    }
+  else
+    {
+    for ( unsigned int i=0; i<surfacePointsVec.size(); i++ )
+      {
+      this->m_ControlPointIndices.push_back( i );
+      }
+    }
+
+  // Now we can add the new points
+  for ( unsigned int i=0; i<this->m_ControlPointIndices.size(); i++ )
+    {
+      cip::PointType point(3);
+        point[0] = surfacePointsVec[this->m_ControlPointIndices[i]][0];
+	point[1] = surfacePointsVec[this->m_ControlPointIndices[i]][1];
+	point[2] = surfacePointsVec[this->m_ControlPointIndices[i]][2];
+
+    this->m_SurfacePoints.push_back( point );
+    }
+
+  this->m_NumberSurfacePoints = this->m_SurfacePoints.size();
+
+  // Finally, compute the TPS vectors given these new points
+  this->ComputeThinPlateSplineVectors();
+}
+
+
+void cipThinPlateSplineSurface::AddSurfacePoints( const std::vector< cip::PointType >& surfacePointsVec,
+                                                  const std::vector< double >* const surfacePointWeights )
+{
+  bool usesWeights = this->m_NumberSurfacePoints > 0 &&
+    this->m_SurfacePointWeights.size() == this->m_NumberSurfacePoints;
+
+  if ( usesWeights && ( surfacePointWeights == NULL || surfacePointWeights->size() != surfacePointsVec.size() ) )
+    {
+    throw cip::ExceptionObject( __FILE__, __LINE__, "cipThinPlateSplineSurface::AddSurfacePoints()",
+                                "Surface point weights are in use but were not specified for the new points" );
+    }
+
+  if ( surfacePointsVec.size() == 0 )
+    {
+    return;
+    }
+
+  if ( this->m_Factorization != NULL )
+    {
+    this->DetachFactorization();
+    }
+  FACTORIZATION* f = this->m_Factorization;
+
+  // When the smoothing is uniform, it depends on the mean distance
+  // between points, which changes with every new point. In that case
+  // the factorization is recomputed once all the rows are added.
+  bool refactor = this->m_Lambda != 0.0 && !usesWeights;
+
+  for ( unsigned int i=0; i<surfacePointsVec.size(); i++ )
+    {
+    cip::PointType point(3);
+      point[0] = surfacePointsVec[i][0];
+      point[1] = surfacePointsVec[i][1];
+      point[2] = surfacePointsVec[i][2];
+
+    this->m_SurfacePoints.push_back( point );
+    this->m_ControlPointIndices.push_back( this->m_NumberInputPoints );
+    this->m_NumberInputPoints++;
+
+    if ( usesWeights )
+      {
+      this->m_SurfacePointWeights.push_back( (*surfacePointWeights)[i] );
+      }
+    this->m_NumberSurfacePoints = this->m_SurfacePoints.size();
+
+    if ( f == NULL )
+      {
+      continue;
+      }
+
+    unsigned int n = this->m_SurfacePoints.size() - 1;
+    unsigned int j = f->Basis.size();
+
+    f->Basis.push_back( n );
+
+    double r;
+    double c[3];
+    this->ComputeBarycentricCoordinates( point[0], point[1], c );
+    for ( unsigned int k=0; k<3; k++ )
+      {
+      f->C.push_back( c[k] );
+      f->U.push_back( ComputeKernel( point, this->m_SurfacePoints[f->Anchors[k]], &r ) );
+      f->RTotal += 2.0*r;
+      }
+
+    // New row of the reduced kernel matrix
+    const double* cj = &f->C[3*j];
+    const double* uj = &f->U[3*j];
+    for ( unsigned int l=0; l<=j; l++ )
+      {
+      const double* cl = &f->C[3*l];
+      const double* ul = &f->U[3*l];
+
+      double entry = 0.0;
+      if ( l < j )
+        {
+        entry = ComputeKernel( point, this->m_SurfacePoints[f->Basis[l]], &r );
+        f->RTotal += 2.0*r;
+        }
+      for ( unsigned int k=0; k<3; k++ )
+        {
+        entry -= cl[k]*uj[k] + cj[k]*ul[k];
+        for ( unsigned int m=0; m<3; m++ )
+          {
+          entry += cj[k]*f->UAA[3*k+m]*cl[m];
+          }
+        }
+
+      f->M0.push_back( entry );
+      }
+
+    if ( !refactor && !this->AppendFactorizationRow( j ) )
+      {
+      this->InvalidateFactorization();
+      f = NULL;
+      }
+    }
+
+  if ( f == NULL )
+    {
+    this->ComputeThinPlateSplineVectors();
+    return;
+    }
+
+  if ( refactor && !this->FactorizeReducedMatrix() )
+    {
+    this->InvalidateFactorization();
+    this->ComputeThinPlateSplineVectorsWithSVD();
+    return;
+    }
+
+  this->SolveFactorizedSystem();
+}
+
+
+void cipThinPlateSplineSurface::RemoveSurfacePoint( unsigned int index )
+{
+  if ( index >= this->m_NumberSurfacePoints )
+    {
+    throw cip::ExceptionObject( __FILE__, __LINE__, "cipThinPlateSplineSurface::RemoveSurfacePoint()",
+                                "Surface point index out of range" );
+    }
+
+  FACTORIZATION* f = this->m_Factorization;
+
+  // Removing an anchor changes the null space basis, so everything is
+  // recomputed
+  if ( f == NULL || index == f->Anchors[0] || index == f->Anchors[1] || index == f->Anchors[2] )
+    {
+    this->EraseSurfacePoint( index );
+
+    this->ComputeThinPlateSplineVectors();
+    return;
+    }
+
+  this->DetachFactorization();
+  f = this->m_Factorization;
+
+  // Uniform smoothing depends on all the distances between points, so
+  // in that case the factorization is recomputed instead of updated
+  bool usesWeights = this->m_SurfacePointWeights.size() == this->m_NumberSurfacePoints;
+  bool refactor    = this->m_Lambda != 0.0 && !usesWeights;
+
+  // The basis point indices are in increasing order
+  unsigned int p = std::lower_bound( f->Basis.begin(), f->Basis.end(), index ) - f->Basis.begin();
+  unsigned int n = f->Basis.size();
+
+  double r;
+  for ( unsigned int i=0; i<this->m_NumberSurfacePoints; i++ )
+    {
+    if ( i != index )
+      {
+      ComputeKernel( this->m_SurfacePoints[index], this->m_SurfacePoints[i], &r );
+      f->RTotal -= 2.0*r;
+      }
+    }
+
+  // Remove row and column 'p' from the packed matrices, keeping the
+  // removed column of the Cholesky factor below the diagonal
+  std::vector< double > x;
+  x.reserve( n - p - 1 );
+
+  unsigned int src = 0;
+  unsigned int dst = 0;
+  for ( unsigned int q=0; q<n; q++ )
+    {
+    for ( unsigned int l=0; l<=q; l++, src++ )
+      {
+      if ( q == p || l == p )
+        {
+        if ( q > p )
+          {
+          x.push_back( f->L[src] );
+          }
+        continue;
+        }
+      f->M0[dst] = f->M0[src];
+      f->L[dst]  = f->L[src];
+      dst++;
+      }
+    }
+  f->M0.resize( dst );
+  f->L.resize( dst );
+
+  // Rank one update of the trailing block with the removed column
+  for ( unsigned int k=0; !refactor && k<x.size(); k++ )
+    {
+    unsigned int row = p + k;
+    double& lkk = f->L[row*(row+1)/2 + row];
+
+    double rr = vcl_sqrt( lkk*lkk + x[k]*x[k] );
+    double c  = rr/lkk;
+    double s  = x[k]/lkk;
+    lkk = rr;
+
+    for ( unsigned int i=k+1; i<x.size(); i++ )
+      {
+      double& lik = f->L[(p+i)*(p+i+1)/2 + row];
+      lik  = ( lik + s*x[i] )/c;
+      x[i] = c*x[i] - s*lik;
+      }
+    }
+
+  f->Basis.erase( f->Basis.begin() + p );
+  f->C.erase( f->C.begin() + 3*p, f->C.begin() + 3*p + 3 );
+  f->U.erase( f->U.begin() + 3*p, f->U.begin() + 3*p + 3 );
+  for ( unsigned int i=p; i<f->Basis.size(); i++ )
+    {
+    f->Basis[i]--;
+    }
+  for ( unsigned int k=0; k<3; k++ )
+    {
+    if ( f->Anchors[k] > index )
+      {
+      f->Anchors[k]--;
+      }
+    }
+
+  this->EraseSurfacePoint( index );
+
+  if ( refactor && !this->FactorizeReducedMatrix() )
+    {
+    this->InvalidateFactorization();
+    this->ComputeThinPlateSplineVectorsWithSVD();
+    return;
+    }
+
+  this->SolveFactorizedSystem();
+}
+
+
+// Remove a surface point (and its weight, if any) from the point
+// data. The point is also removed from the input points, so the
+// control point indices past it are shifted down.
+void cipThinPlateSplineSurface::EraseSurfacePoint( unsigned int index )
+{
+  unsigned int inputIndex = this->m_ControlPointIndices[index];
+
+  if ( this->m_SurfacePointWeights.size() == this->m_NumberSurfacePoints )
+    {
+    this->m_SurfacePointWeights.erase( this->m_SurfacePointWeights.begin() + index );
+    }
+
+  this->m_SurfacePoints.erase( this->m_SurfacePoints.begin() + index );
+  this->m_ControlPointIndices.erase( this->m_ControlPointIndices.begin() + index );
+
+  for ( unsigned int i=0; i<this->m_ControlPointIndices.size(); i++ )
+    {
+    if ( this->m_ControlPointIndices[i] > inputIndex )
+      {
+      this->m_ControlPointIndices[i]--;
+      }
+    }
+
+  this->m_NumberSurfacePoints = this->m_SurfacePoints.size();
+  this->m_NumberInputPoints--;
+}
+
+
+void cipThinPlateSplineSurface::ComputeThinPlateSplineVectors()
+{
+  // First make sure the TPS vectors are clear
+  this->m_a.clear();
+  this->m_w.clear();
+
+  if ( this->BuildFactorization() )
+    {
+    this->SolveFactorizedSystem();
+    }
+  else
+    {
+    this->InvalidateFactorization();
+    this->ComputeThinPlateSplineVectorsWithSVD();
+    }
+}
+
+
+//
+// The TPS system is
+//
+//   [ K+D  P ] [ w ]   [ v ]
+//   [ P^T  0 ] [ a ] = [ 0 ]
+//
+// Picking three non-collinear "anchor" points A, every w satisfying
+// P^T w = 0 is w = Z g, where Z has a column per remaining ("basis")
+// point j equal to e_j - sum_k c_j[k] e_{A_k}, c_j being the
+// barycentric coordinates of point j with respect to the anchors.
+// Substituting gives the symmetric positive definite system
+// Z^T (K+D) Z g = Z^T v, which is solved with a Cholesky factorization.
+// 'a' is then recovered from the anchor rows of the first equation.
+//
+bool cipThinPlateSplineSurface::BuildFactorization()
+{
+  this->InvalidateFactorization();
+
+  unsigned int numPoints = this->m_SurfacePoints.size();
+  if ( numPoints < 4 )
+    {
+    return false;
+    }
+
+  // Choose the anchors: the point farthest from the centroid, the
+  // point farthest from it, and the point farthest from the line
+  // through both
+  double cx = 0.0;
+  double cy = 0.0;
+  for ( unsigned int i=0; i<numPoints; i++ )
+    {
+    cx += this->m_SurfacePoints[i][0];
+    cy += this->m_SurfacePoints[i][1];
+    }
+  cx /= static_cast< double >( numPoints );
+  cy /= static_cast< double >( numPoints );
+
+  unsigned int anchors[3] = { 0, 0, 0 };
+  double maxValue = -1.0;
+  for ( unsigned int i=0; i<numPoints; i++ )
+    {
+    double dx = this->m_SurfacePoints[i][0] - cx;
+    double dy = this->m_SurfacePoints[i][1] - cy;
+    if ( dx*dx + dy*dy > maxValue )
+      {
+      maxValue = dx*dx + dy*dy;
+      anchors[0] = i;
+      }
+    }
+
+  maxValue = -1.0;
+  for ( unsigned int i=0; i<numPoints; i++ )
+    {
+    double dx = this->m_SurfacePoints[i][0] - this->m_SurfacePoints[anchors[0]][0];
+    double dy = this->m_SurfacePoints[i][1] - this->m_SurfacePoints[anchors[0]][1];
+    if ( dx*dx + dy*dy > maxValue )
+      {
+      maxValue = dx*dx + dy*dy;
+      anchors[1] = i;
+      }
+    }
+
+  double ex = this->m_SurfacePoints[anchors[1]][0] - this->m_SurfacePoints[anchors[0]][0];
+  double ey = this->m_SurfacePoints[anchors[1]][1] - this->m_SurfacePoints[anchors[0]][1];
+  double baseLength2 = ex*ex + ey*ey;
+
+  maxValue = -1.0;
+  for ( unsigned int i=0; i<numPoints; i++ )
+    {
+    double dx = this->m_SurfacePoints[i][0] - this->m_SurfacePoints[anchors[0]][0];
+    double dy = this->m_SurfacePoints[i][1] - this->m_SurfacePoints[anchors[0]][1];
+    double cross = std::fabs( ex*dy - ey*dx );
+    if ( cross > maxValue )
+      {
+      maxValue = cross;
+      anchors[2] = i;
+      }
+    }
+
+  // Twice the anchor triangle area relative to the squared base
+  // length: the points are (nearly) collinear
+  if ( baseLength2 == 0.0 || maxValue <= 1e-10*baseLength2 )
+    {
+    return false;
+    }
+
+  FACTORIZATION* f = new FACTORIZATION;
+    f->ReferenceCount = 1;
+    f->RTotal         = 0.0;
+    f->AlphaLambda    = 0.0;
+  for ( unsigned int k=0; k<3; k++ )
+    {
+    f->Anchors[k] = anchors[k];
+    }
+  this->m_Factorization = f;
+
+  double r;
+  for ( unsigned int k=0; k<3; k++ )
+    {
+    for ( unsigned int m=0; m<3; m++ )
+      {
+      f->UAA[3*k+m] = ComputeKernel( this->m_SurfacePoints[anchors[k]], this->m_SurfacePoints[anchors[m]], &r );
+      f->RTotal += r;
+      }
+    }
+
+  for ( unsigned int i=0; i<numPoints; i++ )
+    {
+    if ( i == anchors[0] || i == anchors[1] || i == anchors[2] )
+      {
+      continue;
+      }
+
+    double c[3];
+    this->ComputeBarycentricCoordinates( this->m_SurfacePoints[i][0], this->m_SurfacePoints[i][1], c );
+
+    f->Basis.push_back( i );
+    for ( unsigned int k=0; k<3; k++ )
+      {
+      f->C.push_back( c[k] );
+      f->U.push_back( ComputeKernel( this->m_SurfacePoints[i], this->m_SurfacePoints[anchors[k]], &r ) );
+      f->RTotal += 2.0*r;
+      }
+    }
+
+  // Reduced kernel matrix, Z^T K Z, lower triangle packed by rows
+  unsigned int numBasis = f->Basis.size();
+  f->M0.resize( numBasis*(numBasis+1)/2 );
+
+  double* m0 = &f->M0[0];
+  for ( unsigned int j=0; j<numBasis; j++ )
+    {
+    const double* cj = &f->C[3*j];
+    const double* uj = &f->U[3*j];
+
+    double ucj[3];
+    for ( unsigned int k=0; k<3; k++ )
+      {
+      ucj[k] = f->UAA[3*k]*cj[0] + f->UAA[3*k+1]*cj[1] + f->UAA[3*k+2]*cj[2];
+      }
+
+    for ( unsigned int l=0; l<=j; l++ )
+      {
+      const double* cl = &f->C[3*l];
+      const double* ul = &f->U[3*l];
+
+      double entry = 0.0;
+      if ( l < j )
+        {
+        entry = ComputeKernel( this->m_SurfacePoints[f->Basis[j]], this->m_SurfacePoints[f->Basis[l]], &r );
+        f->RTotal += 2.0*r;
+        }
+
+      entry += cl[0]*( ucj[0] - uj[0] ) + cl[1]*( ucj[1] - uj[1] ) + cl[2]*( ucj[2] - uj[2] )
+        - cj[0]*ul[0] - cj[1]*ul[1] - cj[2]*ul[2];
+
+      *m0++ = entry;
+      }
+    }
+
+  return this->FactorizeReducedMatrix();
+}
+
+
+bool cipThinPlateSplineSurface::FactorizeReducedMatrix()
+{
+  FACTORIZATION* f = this->m_Factorization;
+
+  unsigned int numBasis = f->Basis.size();
+  f->L.clear();
+  f->L.reserve( numBasis*(numBasis+1)/2 );
+
+  if ( this->UsesUniformSmoothing() )
+    {
+    double alpha = f->RTotal/static_cast< double >( this->m_NumberSurfacePoints*this->m_NumberSurfacePoints );
+    f->AlphaLambda = this->m_Lambda*alpha*alpha;
+    }
+
+  for ( unsigned int j=0; j<numBasis; j++ )
+    {
+    if ( !this->AppendFactorizationRow( j ) )
+      {
+      return false;
+      }
+    }
+
+  return true;
+}
+
+
+//
+// Computes row 'j' of the Cholesky factor, given rows 0 to j-1. This
+// is the bordered Cholesky step, which costs O(j^2).
+//
+bool cipThinPlateSplineSurface::AppendFactorizationRow( unsigned int j )
+{
+  FACTORIZATION* f = this->m_Factorization;
+
+  unsigned int rowStart = j*(j+1)/2;
+  f->L.resize( rowStart + j + 1 );
+
+  double* lj = &f->L[rowStart];
+  for ( unsigned int l=0; l<=j; l++ )
+    {
+    const double* ll = &f->L[l*(l+1)/2];
+
+    double sum = this->GetReducedMatrixEntry( j, l );
+    for ( unsigned int k=0; k<l; k++ )
+      {
+      sum -= lj[k]*ll[k];
+      }
+
+    if ( l < j )
+      {
+      lj[l] = sum/ll[l];
+      }
+    else
+      {
+      // Not positive definite (up to round off): e.g. coincident
+      // points without smoothing
+      double diagonal = this->GetReducedMatrixEntry( j, j );
+      if ( sum <= 1e-12*std::fabs( diagonal ) || sum <= 0.0 )
+        {
+        return false;
+        }
+      lj[j] = vcl_sqrt( sum );
+      }
+    }
+
+  return true;
+}
+
+
+void cipThinPlateSplineSurface::SolveFactorizedSystem()
+{
+  FACTORIZATION* f = this->m_Factorization;
+
+  unsigned int numPoints = this->m_SurfacePoints.size();
+  unsigned int numBasis  = f->Basis.size();
+
+  double anchorHeights[3];
+  for ( unsigned int k=0; k<3; k++ )
+    {
+    anchorHeights[k] = this->m_SurfacePoints[f->Anchors[k]][2];
+    }
+
+  // Right hand side, Z^T v, then forward substitution
+  std::vector< double > g( numBasis );
+  for ( unsigned int j=0; j<numBasis; j++ )
+    {
+    const double* cj = &f->C[3*j];
+    const double* lj = &f->L[j*(j+1)/2];
+
+    double sum = this->m_SurfacePoints[f->Basis[j]][2] -
+      cj[0]*anchorHeights[0] - cj[1]*anchorHeights[1] - cj[2]*anchorHeights[2];
+    for ( unsigned int k=0; k<j; k++ )
+      {
+      sum -= lj[k]*g[k];
+      }
+    g[j] = sum/lj[j];
+    }
+
+  // Back substitution with the transposed factor, by rows of L
+  for ( unsigned int j=numBasis; j-- > 0; )
+    {
+    const double* lj = &f->L[j*(j+1)/2];
+
+    g[j] /= lj[j];
+    for ( unsigned int k=0; k<j; k++ )
+      {
+      g[k] -= lj[k]*g[j];
+      }
+    }
+
+  // w = Z g
+  this->m_w.assign( numPoints, 0.0 );
+  for ( unsigned int j=0; j<numBasis; j++ )
+    {
+    const double* cj = &f->C[3*j];
+
+    this->m_w[f->Basis[j]] = g[j];
+    for ( unsigned int k=0; k<3; k++ )
+      {
+      this->m_w[f->Anchors[k]] -= cj[k]*g[j];
+      }
+    }
+
+  // The anchor rows of the first equation give P_A a = v_A - ((K+D) w)_A
+  double rhs[3];
+  for ( unsigned int k=0; k<3; k++ )
+    {
+    rhs[k] = anchorHeights[k] - this->GetSmoothing( f->Anchors[k] )*this->m_w[f->Anchors[k]];
+    for ( unsigned int m=0; m<3; m++ )
+      {
+      rhs[k] -= f->UAA[3*k+m]*this->m_w[f->Anchors[m]];
+      }
+    }
+  for ( unsigned int j=0; j<numBasis; j++ )
+    {
+    const double* uj = &f->U[3*j];
+    for ( unsigned int k=0; k<3; k++ )
+      {
+      rhs[k] -= uj[k]*g[j];
+      }
+    }
+
+  // Plane through the three anchors with heights 'rhs'
+  const cip::PointType& p0 = this->m_SurfacePoints[f->Anchors[0]];
+  const cip::PointType& p1 = this->m_SurfacePoints[f->Anchors[1]];
+  const cip::PointType& p2 = this->m_SurfacePoints[f->Anchors[2]];
+
+  double det = (p1[0] - p0[0])*(p2[1] - p0[1]) - (p2[0] - p0[0])*(p1[1] - p0[1]);
+  double ax  = ( (rhs[1] - rhs[0])*(p2[1] - p0[1]) - (rhs[2] - rhs[0])*(p1[1] - p0[1]) )/det;
+  double ay  = ( (p1[0] - p0[0])*(rhs[2] - rhs[0]) - (p2[0] - p0[0])*(rhs[1] - rhs[0]) )/det;
+
+  this->m_a.resize( 3 );
+  this->m_a[0] = rhs[0] - ax*p0[0] - ay*p0[1];
+  this->m_a[1] = ax;
+  this->m_a[2] = ay;
+
+  this->UpdateFarField();
+}
+
+
+void cipThinPlateSplineSurface::InvalidateFactorization()
+{
+  if ( this->m_Factorization != NULL )
+    {
+    FactorizationReferenceCountLock.Lock();
+    unsigned int referenceCount = --this->m_Factorization->ReferenceCount;
+    FactorizationReferenceCountLock.Unlock();
+
+    if ( referenceCount == 0 )
+      {
+      delete this->m_Factorization;
+      }
+    this->m_Factorization = NULL;
+    }
+}
+
+
+void cipThinPlateSplineSurface::DetachFactorization()
+{
+  if ( this->m_Factorization == NULL )
+    {
+    return;
+    }
+
+  FactorizationReferenceCountLock.Lock();
+  bool shared = this->m_Factorization->ReferenceCount > 1;
+  FactorizationReferenceCountLock.Unlock();
+
+  // The shared factorization is only read by its owners, so it can be
+  // copied without holding the lock. Our reference is released after
+  // the copy, so no other owner can see it unshared (and modify it)
+  // while it is being copied.
+  if ( shared )
+    {
+    FACTORIZATION* factorization = new FACTORIZATION( *this->m_Factorization );
+      factorization->ReferenceCount = 1;
+
+    this->InvalidateFactorization();
+    this->m_Factorization = factorization;
+    }
+}
+
+
+void cipThinPlateSplineSurface::ComputeBarycentricCoordinates( double x, double y, double* c ) const
+{
+  const cip::PointType& p0 = this->m_SurfacePoints[this->m_Factorization->Anchors[0]];
+  const cip::PointType& p1 = this->m_SurfacePoints[this->m_Factorization->Anchors[1]];
+  const cip::PointType& p2 = this->m_SurfacePoints[this->m_Factorization->Anchors[2]];
+
+  double det = (p1[0] - p0[0])*(p2[1] - p0[1]) - (p2[0] - p0[0])*(p1[1] - p0[1]);
+
+  c[1] = ( (x - p0[0])*(p2[1] - p0[1]) - (p2[0] - p0[0])*(y - p0[1]) )/det;
+  c[2] = ( (p1[0] - p0[0])*(y - p0[1]) - (x - p0[0])*(p1[1] - p0[1]) )/det;
+  c[0] = 1.0 - c[1] - c[2];
+}
+
+
+double cipThinPlateSplineSurface::GetSmoothing( unsigned int i ) const
+{
+  if ( this->UsesUniformSmoothing() )
+    {
+    return this->m_Factorization->AlphaLambda;
+    }
+
+  return this->m_Lambda*this->m_SurfacePointWeights[i];
+}
+
+
+//
+// Entry (j, l) of Z^T (K+D) Z
+//
+double cipThinPlateSplineSurface::GetReducedMatrixEntry( unsigned int j, unsigned int l ) const
+{
+  const FACTORIZATION* f = this->m_Factorization;
 
-  // We also assume that if new points are being added, any weights
-  // previously set are now irrelevant, so we clear this container to
-  // make sure they don't have an effect on the new TPS computation
-  this->m_SurfacePointWeights.clear();
+  const double* cj = &f->C[3*j];
+  const double* cl = &f->C[3*l];
 
-  // Now we can add the new points
-  for ( unsigned int i=0; i<surfacePointsVec.size(); i++ )
+  double entry = f->M0[j*(j+1)/2 + l];
+  if ( this->m_Lambda != 0.0 )
     {
-      cip::PointType point(3);
-        point[0] = surfacePointsVec[i][0];
-	point[1] = surfacePointsVec[i][1];
-	point[2] = surfacePointsVec[i][2];
+    if ( j == l )
+      {
+      entry += this->GetSmoothing( f->Basis[j] );
+      }
+    for ( unsigned int k=0; k<3; k++ )
+      {
+      entry += cj[k]*cl[k]*this->GetSmoothing( f->Anchors[k] );
+      }
+    }
 
-    this->m_SurfacePoints.push_back( point );
-    }  
+  return entry;
+}
 
-  this->m_NumberSurfacePoints = this->m_SurfacePoints.size();
 
-  // Finally, compute the TPS vectors given these new points 
-  this->ComputeThinPlateSplineVectors();
+bool cipThinPlateSplineSurface::UsesUniformSmoothing() const
+{
+  return this->m_SurfacePointWeights.size() != this->m_NumberSurfacePoints;
 }
 
 
-void cipThinPlateSplineSurface::ComputeThinPlateSplineVectors()
+void cipThinPlateSplineSurface::ComputeThinPlateSplineVectorsWithSVD()
 {
   // First make sure the TPS vectors are clear
   this->m_a.clear();
@@ -225,10 +1165,23 @@ void cipThinPlateSplineSurface::ComputeThinPlateSplineVectors()
   this->m_a.push_back( x[numPoints] );
   this->m_a.push_back( x[numPoints+1] );
   this->m_a.push_back( x[numPoints+2] );
+
+  this->UpdateFarField();
 }
 
 
 double cipThinPlateSplineSurface::GetSurfaceHeight( double x, double y ) const
+{
+  if ( !this->m_FarFieldNodes.empty() )
+    {
+    return this->m_a[0] + x*this->m_a[1] + y*this->m_a[2] + this->GetFarFieldKernelSum( x, y )/vnl_math::ln10;
+    }
+
+  return this->GetExactSurfaceHeight( x, y );
+}
+
+
+double cipThinPlateSplineSurface::GetExactSurfaceHeight( double x, double y ) const
 {
   unsigned int numPoints = this->m_SurfacePoints.size();
 
@@ -252,10 +1205,21 @@ double cipThinPlateSplineSurface::GetSurfaceHeight( double x, double y ) const
 
 
 void cipThinPlateSplineSurface::GetSurfaceNormal( double x, double y, cip::VectorType& normal ) const
+{
+  cip::Vector3 fixedNormal;
+  this->GetSurfaceNormal( x, y, fixedNormal );
+
+  normal[0] = fixedNormal[0];
+  normal[1] = fixedNormal[1];
+  normal[2] = fixedNormal[2];
+}
+
+
+void cipThinPlateSplineSurface::GetSurfaceNormal( double x, double y, cip::Vector3& normal ) const
 {
   this->GetNonNormalizedSurfaceNormal( x, y, normal );
 
-  double mag = vcl_sqrt( std::pow( normal[0], 2 ) + std::pow( normal[1], 2 ) + std::pow( normal[2], 2 ) );
+  double mag = vcl_sqrt( normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2] );
 
   normal[0] = normal[0]/mag;
   normal[1] = normal[1]/mag;
@@ -264,6 +1228,17 @@ void cipThinPlateSplineSurface::GetSurfaceNormal( double x, double y, cip::Vecto
 
 
 void cipThinPlateSplineSurface::GetNonNormalizedSurfaceNormal( double x, double y, cip::VectorType& normal ) const
+{
+  cip::Vector3 fixedNormal;
+  this->GetNonNormalizedSurfaceNormal( x, y, fixedNormal );
+
+  normal[0] = fixedNormal[0];
+  normal[1] = fixedNormal[1];
+  normal[2] = fixedNormal[2];
+}
+
+
+void cipThinPlateSplineSurface::GetNonNormalizedSurfaceNormal( double x, double y, cip::Vector3& normal ) const
 {
   //
   // The normal will be computed using:
@@ -297,6 +1272,560 @@ void cipThinPlateSplineSurface::GetNonNormalizedSurfaceNormal( double x, double
 }
 
 
+void cipThinPlateSplineSurface::GetSurfaceHeightAndDerivatives( double x, double y, double* z,
+                                                                double* dz, double* d2z ) const
+{
+  //
+  // With U = r^2 log10(r) = r^2 ln(r^2)/(2 ln10), the derivatives of
+  // each term are:
+  //   dU/dx     = xDiff (ln(r^2) + 1)/ln10
+  //   d2U/dx2   = (ln(r^2) + 1 + 2 xDiff^2/r^2)/ln10
+  //   d2U/dxdy  = 2 xDiff yDiff/(r^2 ln10)
+  // (and symmetrically for y)
+  //
+  double total = 0.0;
+  double dx    = 0.0;
+  double dy    = 0.0;
+  double dxx   = 0.0;
+  double dxy   = 0.0;
+  double dyy   = 0.0;
+
+  for ( unsigned int i=0; i<this->m_w.size(); i++ )
+    {
+    double xDiff = x - this->m_SurfacePoints[i][0];
+    double yDiff = y - this->m_SurfacePoints[i][1];
+    double r2    = xDiff*xDiff + yDiff*yDiff;
+
+    if ( r2 == 0 )
+      {
+      continue;
+      }
+
+    double w      = this->m_w[i];
+    double logR2  = std::log( r2 );
+    double group  = w*(logR2 + 1.0);
+    double cross  = 2.0*w/r2;
+
+    total += w*r2*logR2;
+    dx    += group*xDiff;
+    dy    += group*yDiff;
+    dxx   += group + cross*xDiff*xDiff;
+    dxy   += cross*xDiff*yDiff;
+    dyy   += group + cross*yDiff*yDiff;
+    }
+
+  // The height comes from the same exact sum as the derivatives (the
+  // far-field approximation is not used here), so that the three are
+  // consistent for callers that step with them together
+  *z = this->m_a[0] + x*this->m_a[1] + y*this->m_a[2] + 0.5*total/vnl_math::ln10;
+
+  dz[0] = this->m_a[1] + dx/vnl_math::ln10;
+  dz[1] = this->m_a[2] + dy/vnl_math::ln10;
+
+  d2z[0] = dxx/vnl_math::ln10;
+  d2z[1] = dxy/vnl_math::ln10;
+  d2z[2] = dyy/vnl_math::ln10;
+}
+
+
+void cipThinPlateSplineSurface::GetSurfaceHeights( unsigned int numberOfPoints, const double* x, const double* y,
+                                                   double* z ) const
+{
+  EVALUATIONSTRUCT str;
+    str.numberOfQueries = numberOfPoints;
+    str.x  = x;
+    str.y  = y;
+    str.z  = z;
+    str.nx = NULL;
+    str.ny = NULL;
+    str.nz = NULL;
+
+  this->Evaluate( str );
+}
+
+
+void cipThinPlateSplineSurface::GetNonNormalizedSurfaceNormals( unsigned int numberOfPoints, const double* x, const double* y,
+                                                                double* nx, double* ny, double* nz ) const
+{
+  EVALUATIONSTRUCT str;
+    str.numberOfQueries = numberOfPoints;
+    str.x  = x;
+    str.y  = y;
+    str.z  = NULL;
+    str.nx = nx;
+    str.ny = ny;
+    str.nz = nz;
+
+  this->Evaluate( str );
+}
+
+
+void cipThinPlateSplineSurface::GetSurfaceHeightGrid( const double* origin, const double* spacing, const unsigned int* size,
+                                                      double* heights ) const
+{
+  EVALUATIONSTRUCT str;
+    str.numberOfQueries = size[0]*size[1];
+    str.x              = NULL;
+    str.y              = NULL;
+    str.gridOrigin[0]  = origin[0];
+    str.gridOrigin[1]  = origin[1];
+    str.gridSpacing[0] = spacing[0];
+    str.gridSpacing[1] = spacing[1];
+    str.gridSizeX      = size[0];
+    str.z              = heights;
+    str.nx             = NULL;
+    str.ny             = NULL;
+    str.nz             = NULL;
+
+  this->Evaluate( str );
+}
+
+
+void cipThinPlateSplineSurface::SetApproximationTolerance( double tolerance )
+{
+  this->m_ApproximationTolerance = tolerance > 0.0 ? tolerance : 0.0;
+
+  this->UpdateFarField();
+}
+
+
+void cipThinPlateSplineSurface::UpdateFarField()
+{
+  this->m_FarFieldNodes.clear();
+  this->m_FarFieldPoints.clear();
+  this->m_FarFieldMoments.clear();
+
+  unsigned int numPoints = this->m_w.size();
+  if ( this->m_ApproximationTolerance <= 0.0 || numPoints < FarFieldMinimumNumberOfPoints )
+    {
+    return;
+    }
+
+  std::vector< unsigned int > order( numPoints );
+  for ( unsigned int i=0; i<numPoints; i++ )
+    {
+    order[i] = i;
+    }
+
+  this->BuildFarFieldNode( order, 0, numPoints, 0 );
+
+  // Store the control points in tree order, so that the points of a
+  // leaf are contiguous
+  this->m_FarFieldPoints.resize( 3*numPoints );
+  for ( unsigned int i=0; i<numPoints; i++ )
+    {
+    this->m_FarFieldPoints[3*i]   = this->m_SurfacePoints[order[i]][0];
+    this->m_FarFieldPoints[3*i+1] = this->m_SurfacePoints[order[i]][1];
+    this->m_FarFieldPoints[3*i+2] = this->m_w[order[i]];
+    }
+}
+
+
+unsigned int cipThinPlateSplineSurface::BuildFarFieldNode( std::vector< unsigned int >& order, unsigned int begin,
+                                                           unsigned int end, unsigned int depth )
+{
+  const unsigned int order1 = FarFieldExpansionOrder + 1;
+
+  double minX = this->m_SurfacePoints[order[begin]][0];
+  double maxX = minX;
+  double minY = this->m_SurfacePoints[order[begin]][1];
+  double maxY = minY;
+  for ( unsigned int i=begin; i<end; i++ )
+    {
+    minX = std::min( minX, this->m_SurfacePoints[order[i]][0] );
+    maxX = std::max( maxX, this->m_SurfacePoints[order[i]][0] );
+    minY = std::min( minY, this->m_SurfacePoints[order[i]][1] );
+    maxY = std::max( maxY, this->m_SurfacePoints[order[i]][1] );
+    }
+
+  FARFIELDNODE node;
+    node.Center[0]      = 0.5*(minX + maxX);
+    node.Center[1]      = 0.5*(minY + maxY);
+    node.Radius         = 0.0;
+    node.AbsoluteWeight = 0.0;
+    node.Begin          = begin;
+    node.End            = end;
+  for ( unsigned int c=0; c<4; c++ )
+    {
+    node.Children[c] = -1;
+    }
+
+  // Moments of the weighted points relative to the node center:
+  // A_k = sum w zeta^k (k=0..P+1), B_k = sum w conj(zeta) zeta^k and
+  // C_k = sum w |zeta|^2 zeta^k (k=0..P)
+  unsigned int nodeIndex = this->m_FarFieldNodes.size();
+  this->m_FarFieldMoments.resize( (nodeIndex + 1)*FarFieldMomentsPerNode, std::complex< double >( 0.0, 0.0 ) );
+
+  std::complex< double >* a = &this->m_FarFieldMoments[nodeIndex*FarFieldMomentsPerNode];
+  std::complex< double >* b = a + order1 + 1;
+  std::complex< double >* c = b + order1;
+
+  for ( unsigned int i=begin; i<end; i++ )
+    {
+    std::complex< double > zeta( this->m_SurfacePoints[order[i]][0] - node.Center[0],
+                                 this->m_SurfacePoints[order[i]][1] - node.Center[1] );
+    double w = this->m_w[order[i]];
+
+    node.Radius          = std::max( node.Radius, std::abs( zeta ) );
+    node.AbsoluteWeight += std::fabs( w );
+
+    std::complex< double > power( w, 0.0 );
+    for ( unsigned int k=0; k<=order1; k++ )
+      {
+      a[k] += power;
+      if ( k < order1 )
+        {
+        b[k] += power*std::conj( zeta );
+        c[k] += power*std::norm( zeta );
+        }
+      power *= zeta;
+      }
+    }
+
+  this->m_FarFieldNodes.push_back( node );
+
+  if ( end - begin <= FarFieldLeafSize || depth >= FarFieldMaximumDepth || ( minX == maxX && minY == maxY ) )
+    {
+    return nodeIndex;
+    }
+
+  // Split the points into the four quadrants about the center
+  std::vector< unsigned int >::iterator first = order.begin();
+
+  unsigned int splitX  = std::partition( first + begin, first + end,
+                                         FarFieldCoordinateLess( this->m_SurfacePoints, 0, node.Center[0] ) ) - first;
+  unsigned int splitY0 = std::partition( first + begin, first + splitX,
+                                         FarFieldCoordinateLess( this->m_SurfacePoints, 1, node.Center[1] ) ) - first;
+  unsigned int splitY1 = std::partition( first + splitX, first + end,
+                                         FarFieldCoordinateLess( this->m_SurfacePoints, 1, node.Center[1] ) ) - first;
+
+  unsigned int bounds[5] = { begin, splitY0, splitX, splitY1, end };
+  for ( unsigned int q=0; q<4; q++ )
+    {
+    if ( bounds[q+1] > bounds[q] )
+      {
+      int child = this->BuildFarFieldNode( order, bounds[q], bounds[q+1], depth + 1 );
+      this->m_FarFieldNodes[nodeIndex].Children[q] = child;
+      }
+    }
+
+  return nodeIndex;
+}
+
+
+//
+// Returns sum_n w_n r_n^2 ln(r_n), evaluated with the far-field
+// expansions wherever their error bound allows it. Writing z and zeta
+// for the query and control point positions relative to a node center
+// (as complex numbers),
+//   |z-zeta|^2 ln|z-zeta| = |z-zeta|^2 Re( ln z - sum_k (zeta/z)^k/k ),
+// so the contribution of a node only depends on a few moments of its
+// weighted points. A node is used as a whole when the truncation error
+// of its expansion is below its share (proportional to its absolute
+// weight) of the tolerance; otherwise its children are visited, and
+// the points of leaves that are too close are summed exactly.
+//
+double cipThinPlateSplineSurface::GetFarFieldKernelSum( double x, double y ) const
+{
+  const unsigned int order = FarFieldExpansionOrder;
+
+  double totalWeight = this->m_FarFieldNodes[0].AbsoluteWeight;
+  if ( totalWeight == 0.0 )
+    {
+    return 0.0;
+    }
+
+  // Error allowed per unit of absolute weight, in the units of the
+  // sum (natural logarithm)
+  double tolerance = this->m_ApproximationTolerance*vnl_math::ln10/totalWeight;
+
+  double sum = 0.0;
+
+  unsigned int stack[4*FarFieldMaximumDepth + 4];
+  unsigned int stackSize = 0;
+  stack[stackSize++] = 0;
+
+  while ( stackSize > 0 )
+    {
+    unsigned int nodeIndex   = stack[--stackSize];
+    const FARFIELDNODE& node = this->m_FarFieldNodes[nodeIndex];
+
+    double dx = x - node.Center[0];
+    double dy = y - node.Center[1];
+    double r2 = dx*dx + dy*dy;
+
+    // The expansion converges for |z| > radius. Only nodes seen
+    // under a small enough angle are considered.
+    if ( r2 > 2.0*node.Radius*node.Radius )
+      {
+      double r = vcl_sqrt( r2 );
+      double q = node.Radius/r;
+
+      // |z - zeta|^2 <= (r + radius)^2 and the log series truncated
+      // after p terms has a tail of at most q^(p+1)/((p+1)(1-q)).
+      // Use the smallest number of terms that meets the tolerance.
+      double scale = (r + node.Radius)*(r + node.Radius)/(1.0 - q);
+      double qPower = q*q;
+
+      unsigned int numberOfTerms = 1;
+      while ( numberOfTerms < order && scale*qPower/double( numberOfTerms + 1 ) > tolerance )
+        {
+        qPower *= q;
+        numberOfTerms++;
+        }
+
+      if ( scale*qPower/double( numberOfTerms + 1 ) <= tolerance )
+        {
+        const std::complex< double >* a = &this->m_FarFieldMoments[nodeIndex*FarFieldMomentsPerNode];
+        const std::complex< double >* b = a + order + 2;
+        const std::complex< double >* c = b + order + 1;
+
+        std::complex< double > z( dx, dy );
+        std::complex< double > zConj( dx, -dy );
+        std::complex< double > inverse = 1.0/z;
+        std::complex< double > power   = inverse;
+
+        std::complex< double > sumA( 0.0, 0.0 );
+        std::complex< double > sumB( 0.0, 0.0 );
+        std::complex< double > sumC( 0.0, 0.0 );
+        for ( unsigned int k=1; k<=numberOfTerms; k++ )
+          {
+          double invK = 1.0/double( k );
+
+          sumA  += a[k]*power*invK;
+          sumB  += ( z*b[k] + zConj*a[k+1] )*power*invK;
+          sumC  += c[k]*power*invK;
+          power *= inverse;
+          }
+
+        double logR = 0.5*std::log( r2 );
+
+        // |z - zeta|^2 = |z|^2 - (z conj(zeta) + conj(z) zeta) + |zeta|^2
+        sum += r2*( a[0].real()*logR - sumA.real() )
+          - ( ( z*b[0] + zConj*a[1] ).real()*logR - sumB.real() )
+          + ( c[0].real()*logR - sumC.real() );
+
+        continue;
+        }
+      }
+
+    bool isLeaf = true;
+    for ( unsigned int q=0; q<4; q++ )
+      {
+      if ( node.Children[q] >= 0 )
+        {
+        stack[stackSize++] = static_cast< unsigned int >( node.Children[q] );
+        isLeaf = false;
+        }
+      }
+
+    if ( isLeaf )
+      {
+      const double* points = &this->m_FarFieldPoints[3*node.Begin];
+      for ( unsigned int i=node.Begin; i<node.End; i++, points += 3 )
+        {
+        double px = x - points[0];
+        double py = y - points[1];
+        double pr2 = px*px + py*py;
+
+        if ( pr2 > 0.0 )
+          {
+          sum += points[2]*0.5*pr2*std::log( pr2 );
+          }
+        }
+      }
+    }
+
+  return sum;
+}
+
+
+void cipThinPlateSplineSurface::SetNumberOfThreads( unsigned int numberOfThreads )
+{
+  this->m_NumberOfThreads = numberOfThreads > 0 ? numberOfThreads : 1;
+}
+
+
+void cipThinPlateSplineSurface::Evaluate( EVALUATIONSTRUCT& str ) const
+{
+  if ( str.numberOfQueries == 0 )
+    {
+    return;
+    }
+
+  str.self = this;
+
+  // Control points in SoA layout, so that the inner loops stream
+  // through contiguous arrays
+  unsigned int numPoints = this->m_w.size();
+
+  str.controlX.resize( numPoints );
+  str.controlY.resize( numPoints );
+  str.controlW.resize( numPoints );
+  for ( unsigned int n=0; n<numPoints; n++ )
+    {
+    str.controlX[n] = this->m_SurfacePoints[n][0];
+    str.controlY[n] = this->m_SurfacePoints[n][1];
+    str.controlW[n] = this->m_w[n];
+    }
+
+  // Threads are not worth starting for small amounts of work
+  unsigned int numberOfThreads = this->m_NumberOfThreads;
+  if ( static_cast< double >( str.numberOfQueries )*static_cast< double >( numPoints ) < 65536.0 )
+    {
+    numberOfThreads = 1;
+    }
+  if ( numberOfThreads > str.numberOfQueries )
+    {
+    numberOfThreads = str.numberOfQueries;
+    }
+
+  if ( numberOfThreads <= 1 )
+    {
+    this->EvaluateRange( str, 0, str.numberOfQueries );
+    return;
+    }
+
+  str.numberOfChunks = numberOfThreads;
+
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads( numberOfThreads );
+    threader->SetSingleMethod( cipThinPlateSplineSurface::EvaluationThreaderCallback, &str );
+    threader->SingleMethodExecute();
+}
+
+
+ITK_THREAD_RETURN_TYPE cipThinPlateSplineSurface::EvaluationThreaderCallback( void* arg )
+{
+  itk::MultiThreader::ThreadInfoStruct* info = static_cast< itk::MultiThreader::ThreadInfoStruct* >( arg );
+
+  unsigned int threadId        = info->ThreadID;
+  unsigned int numberOfThreads = info->NumberOfThreads;
+  EVALUATIONSTRUCT* str        = static_cast< EVALUATIONSTRUCT* >( info->UserData );
+
+  // The multithreader may run fewer threads than requested, in which
+  // case a thread processes several chunks of queries
+  for ( unsigned int chunk=threadId; chunk<str->numberOfChunks; chunk += numberOfThreads )
+    {
+    unsigned int begin = static_cast< unsigned int >( (static_cast< unsigned long >( chunk )*str->numberOfQueries)/str->numberOfChunks );
+    unsigned int end   = static_cast< unsigned int >( (static_cast< unsigned long >( chunk + 1 )*str->numberOfQueries)/str->numberOfChunks );
+
+    str->self->EvaluateRange( *str, begin, end );
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+//
+// The kernel terms are evaluated from the squared distance, which
+// avoids the square root: r^2*log10(r) = r^2*ln(r^2)/(2*ln(10)), and
+// the gradient of that term is (ln(r^2) + 1)/ln(10) times the
+// difference vector. Queries are processed in blocks, so that each
+// control point is loaded once per block and the block loop has no
+// dependencies between iterations (which lets the compiler vectorize
+// it).
+//
+void cipThinPlateSplineSurface::EvaluateRange( const EVALUATIONSTRUCT& str, unsigned int begin, unsigned int end ) const
+{
+  const unsigned int blockSize = 4;
+
+  unsigned int numPoints = str.controlX.size();
+
+  const double* cx = numPoints > 0 ? &str.controlX[0] : NULL;
+  const double* cy = numPoints > 0 ? &str.controlY[0] : NULL;
+  const double* cw = numPoints > 0 ? &str.controlW[0] : NULL;
+
+  const double invLn10 = 1.0/vnl_math::ln10;
+
+  double qx[blockSize];
+  double qy[blockSize];
+  double s0[blockSize];
+  double s1[blockSize];
+
+  for ( unsigned int q=begin; q<end; q += blockSize )
+    {
+    unsigned int count = std::min( blockSize, end - q );
+
+    // The last block is padded by repeating its last query
+    for ( unsigned int b=0; b<blockSize; b++ )
+      {
+      unsigned int query = q + std::min( b, count - 1 );
+      if ( str.x != NULL )
+        {
+        qx[b] = str.x[query];
+        qy[b] = str.y[query];
+        }
+      else
+        {
+        qx[b] = str.gridOrigin[0] + static_cast< double >( query % str.gridSizeX )*str.gridSpacing[0];
+        qy[b] = str.gridOrigin[1] + static_cast< double >( query / str.gridSizeX )*str.gridSpacing[1];
+        }
+      s0[b] = 0.0;
+      s1[b] = 0.0;
+      }
+
+    if ( str.z != NULL && !this->m_FarFieldNodes.empty() )
+      {
+      for ( unsigned int b=0; b<count; b++ )
+        {
+        str.z[q+b] = this->m_a[0] + qx[b]*this->m_a[1] + qy[b]*this->m_a[2] +
+          invLn10*this->GetFarFieldKernelSum( qx[b], qy[b] );
+        }
+      }
+    else if ( str.z != NULL )
+      {
+      for ( unsigned int n=0; n<numPoints; n++ )
+        {
+        for ( unsigned int b=0; b<blockSize; b++ )
+          {
+          double dx = qx[b] - cx[n];
+          double dy = qy[b] - cy[n];
+          double r2 = dx*dx + dy*dy;
+
+          s0[b] += r2 > 0.0 ? cw[n]*r2*std::log( r2 ) : 0.0;
+          }
+        }
+
+      for ( unsigned int b=0; b<count; b++ )
+        {
+        str.z[q+b] = this->m_a[0] + qx[b]*this->m_a[1] + qy[b]*this->m_a[2] + 0.5*invLn10*s0[b];
+        }
+      }
+
+    if ( str.nx != NULL )
+      {
+      for ( unsigned int b=0; b<blockSize; b++ )
+        {
+        s0[b] = 0.0;
+        }
+
+      for ( unsigned int n=0; n<numPoints; n++ )
+        {
+        for ( unsigned int b=0; b<blockSize; b++ )
+          {
+          double dx = qx[b] - cx[n];
+          double dy = qy[b] - cy[n];
+          double r2 = dx*dx + dy*dy;
+
+          double common = r2 > 0.0 ? cw[n]*( std::log( r2 ) + 1.0 ) : 0.0;
+
+          s0[b] += common*dx;
+          s1[b] += common*dy;
+          }
+        }
+
+      for ( unsigned int b=0; b<count; b++ )
+        {
+        str.nx[q+b] = -( this->m_a[1] + invLn10*s0[b] );
+        str.ny[q+b] = -( this->m_a[2] + invLn10*s1[b] );
+        str.nz[q+b] = 1.0;
+        }
+      }
+    }
+}
+
+
 double cipThinPlateSplineSurface::GetBendingEnergy() const
 {
   // Create the K matrix
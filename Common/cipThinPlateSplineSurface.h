@@ -8,6 +8,11 @@
  *  $Revision: 282 $
  *  $Author: jross $
  *
+ *  The coefficients are computed with a Cholesky factorization of the
+ *  system reduced to the null space of the affine constraints (with
+ *  an SVD fallback), which is updated when points are added or
+ *  removed and shared between copies of the surface.
+ *
  *  TODO:
  *  1) Needs commenting
  *  2) Should not need to include itkImage.h, but currently
@@ -18,7 +23,9 @@
 #define __cipThinPlateSplineSurface_h
 
 #include <vector>
+#include <complex>
 #include "itkImage.h"
+#include "itkMultiThreader.h"
 #include "cipChestConventions.h"
 
 class cipThinPlateSplineSurface
@@ -26,24 +33,116 @@ class cipThinPlateSplineSurface
 public:
   cipThinPlateSplineSurface();
   cipThinPlateSplineSurface( const std::vector< cip::PointType >& );
-  ~cipThinPlateSplineSurface() {};
+  cipThinPlateSplineSurface( const cipThinPlateSplineSurface& );
+  ~cipThinPlateSplineSurface();
+
+  cipThinPlateSplineSurface& operator=( const cipThinPlateSplineSurface& );
 
   double GetSurfaceHeight( double, double ) const;
 
+  /** Evaluate the surface height exactly, even when an approximation
+   *  tolerance is set. Callers that combine heights with the exact
+   *  derivatives of 'GetSurfaceHeightAndDerivatives' (e.g. optimizers)
+   *  should use this method. */
+  double GetExactSurfaceHeight( double, double ) const;
+
   /**  */
   void SetSurfacePoints( const std::vector< cip::PointType >& );
 
-  /**  */
+  /** Add points to the surface. The factorization is updated rather
+   *  than recomputed when possible. If surface point weights are in
+   *  use, the weights of the new points must be specified. */
+  void AddSurfacePoints( const std::vector< cip::PointType >&, const std::vector< double >* const weights = NULL );
+
+  /** Remove the specified surface point. The factorization is updated
+   *  rather than recomputed when possible. */
+  void RemoveSurfacePoint( unsigned int );
+
+  /** The weights are given per surface point. In decimated mode
+   *  (see 'SetMaximumNumberOfControlPoints'), the weights can also be
+   *  given for all the points passed to 'SetSurfacePoints', in which
+   *  case the weights of the control points are used. */
   void SetSurfacePointWeights( const std::vector< double >* const );
 
+  /** Bound the number of points used as TPS control points. If
+   *  greater than zero and more points are passed to
+   *  'SetSurfacePoints', a farthest point sample of the requested size
+   *  is used. Zero (the default) uses all the points. Must be set
+   *  before 'SetSurfacePoints'. */
+  void SetMaximumNumberOfControlPoints( unsigned int );
+  unsigned int GetMaximumNumberOfControlPoints() const
+    {
+      return m_MaximumNumberOfControlPoints;
+    };
+
+  /** Indices (in the vector passed to 'SetSurfacePoints') of the
+   *  points used as control points */
+  const std::vector< unsigned int >& GetControlPointIndices() const
+    {
+      return m_ControlPointIndices;
+    };
+
   /**  */
   void ComputeThinPlateSplineVectors();
 
   /**  */
   void GetSurfaceNormal( double x, double y, cip::VectorType& normal ) const;
+  void GetSurfaceNormal( double x, double y, cip::Vector3& normal ) const;
 
   /**  */
   void GetNonNormalizedSurfaceNormal( double, double, cip::VectorType& ) const;
+  void GetNonNormalizedSurfaceNormal( double, double, cip::Vector3& ) const;
+
+  /** Evaluate the surface height, its first derivatives (dz/dx, dz/dy)
+   *  and its second derivatives (d2z/dx2, d2z/dxdy, d2z/dy2) at the
+   *  specified location in one pass over the control points. The
+   *  height and derivatives are always evaluated exactly, even when an
+   *  approximation tolerance is set, so the height agrees with
+   *  'GetExactSurfaceHeight' up to rounding. A
+   *  control point that coincides with the location does not
+   *  contribute to the derivatives (its second derivatives are
+   *  singular). */
+  void GetSurfaceHeightAndDerivatives( double, double, double*, double*, double* ) const;
+
+  /** Evaluate the surface height at an array of query points. The x
+   *  and y coordinates are given as separate arrays, and 'z' must
+   *  hold one value per query point. */
+  void GetSurfaceHeights( unsigned int, const double*, const double*, double* ) const;
+
+  /** Evaluate the non-normalized surface normal at an array of query
+   *  points. The normal components are written to separate arrays.
+   *  Unlike 'GetNonNormalizedSurfaceNormal', a query point that
+   *  coincides with a control point gets the limit value of that
+   *  control point's term (zero) instead of NaN. */
+  void GetNonNormalizedSurfaceNormals( unsigned int, const double*, const double*,
+                                       double*, double*, double* ) const;
+
+  /** Evaluate the surface height over a regular grid in the xy
+   *  plane, given the grid origin, spacing and size (two values
+   *  each). 'heights[j*size[0] + i]' is set to the height at
+   *  (origin[0] + i*spacing[0], origin[1] + j*spacing[1]). */
+  void GetSurfaceHeightGrid( const double*, const double*, const unsigned int*, double* ) const;
+
+  /** Set the absolute error bound on the surface heights returned by
+   *  'GetSurfaceHeight', 'GetSurfaceHeights' and
+   *  'GetSurfaceHeightGrid'. Zero (the default) evaluates the heights
+   *  exactly. A positive value enables the far-field approximation for
+   *  surfaces with more than a few hundred control points. Normals and
+   *  'GetSurfaceHeightAndDerivatives' are always evaluated exactly. */
+  void SetApproximationTolerance( double );
+  double GetApproximationTolerance() const
+    {
+      return m_ApproximationTolerance;
+    };
+
+  /** Set the number of threads used by the batch evaluation
+   *  methods. Defaults to the ITK global default number of
+   *  threads. */
+  void SetNumberOfThreads( unsigned int );
+  unsigned int GetNumberOfThreads() const
+    {
+      return m_NumberOfThreads;
+    };
 
   /** lambda is a parameter that controls smoothing. If set to 0,
       interpolation will be exact. As lambda increases, the TPS
@@ -85,12 +184,91 @@ public:
     };
 
 private:
+  // Reduced system data. It is shared between copies of the surface
+  // (it holds two O(N^2) matrices) and copied before being modified.
+  // The reference count is only accessed under a lock (see the .cxx).
+  struct FACTORIZATION
+  {
+    unsigned int                ReferenceCount;
+    unsigned int                Anchors[3];
+    std::vector< unsigned int > Basis;      // Non-anchor point indices
+    std::vector< double >       C;          // Barycentric coordinates wrt the anchors, 3 per basis point
+    std::vector< double >       U;          // Kernel between basis points and anchors, 3 per basis point
+    double                      UAA[9];     // Kernel between anchors
+    std::vector< double >       M0;         // Packed lower triangle of the reduced kernel matrix
+    std::vector< double >       L;          // Packed lower triangle of the Cholesky factor
+    double                      RTotal;     // Sum of the distances between all point pairs
+    double                      AlphaLambda;// Smoothing used to compute 'L' (lambda*alpha^2), if no weights
+  };
+
+  struct EVALUATIONSTRUCT
+  {
+    const cipThinPlateSplineSurface* self;
+    unsigned int                     numberOfQueries;
+    unsigned int                     numberOfChunks;
+    const double*                    x;            // Query points, or NULL for a grid
+    const double*                    y;
+    double                           gridOrigin[2];
+    double                           gridSpacing[2];
+    unsigned int                     gridSizeX;
+    double*                          z;            // Heights, or NULL
+    double*                          nx;           // Normals, or NULL
+    double*                          ny;
+    double*                          nz;
+    std::vector< double >            controlX;     // Control points in SoA layout
+    std::vector< double >            controlY;
+    std::vector< double >            controlW;
+  };
+
+  // Quadtree node of the far-field approximation. The points of a
+  // node are the range [Begin, End) of the reordered control points.
+  struct FARFIELDNODE
+  {
+    double       Center[2];
+    double       Radius;
+    double       AbsoluteWeight;
+    unsigned int Begin;
+    unsigned int End;
+    int          Children[4];  // -1 if there is no child
+  };
+
+  void UpdateFarField();
+  unsigned int BuildFarFieldNode( std::vector< unsigned int >&, unsigned int, unsigned int, unsigned int );
+  double GetFarFieldKernelSum( double, double ) const;
+
+  static ITK_THREAD_RETURN_TYPE EvaluationThreaderCallback( void* );
+
+  void Evaluate( EVALUATIONSTRUCT& ) const;
+  void EvaluateRange( const EVALUATIONSTRUCT&, unsigned int, unsigned int ) const;
+
+  void ComputeThinPlateSplineVectorsWithSVD();
+  bool BuildFactorization();
+  bool FactorizeReducedMatrix();
+  bool AppendFactorizationRow( unsigned int );
+  void SolveFactorizedSystem();
+  void InvalidateFactorization();
+  void DetachFactorization();
+  void EraseSurfacePoint( unsigned int );
+  void ComputeBarycentricCoordinates( double, double, double* ) const;
+  double GetSmoothing( unsigned int ) const;
+  double GetReducedMatrixEntry( unsigned int, unsigned int ) const;
+  bool UsesUniformSmoothing() const;
+
   std::vector< double >         m_a;
   std::vector< double >         m_w;
   std::vector< cip::PointType > m_SurfacePoints;
   std::vector< double >         m_SurfacePointWeights;
   double m_Lambda;
   unsigned int m_NumberSurfacePoints;
+  unsigned int m_MaximumNumberOfControlPoints;
+  unsigned int m_NumberInputPoints;
+  std::vector< unsigned int > m_ControlPointIndices;
+  FACTORIZATION* m_Factorization;
+  unsigned int m_NumberOfThreads;
+  double m_ApproximationTolerance;
+  std::vector< FARFIELDNODE >           m_FarFieldNodes;
+  std::vector< double >                 m_FarFieldPoints;   // x, y and w of the reordered control points
+  std::vector< std::complex< double > > m_FarFieldMoments;  // Expansion moments, per node
 };
 
 #endif
@@ -48,6 +48,14 @@ void cipThinPlateSplineSurfaceModelToParticlesMetric::SetFissureParticles( vtkPo
   this->FissureParticles = particles;
   this->NumberOfFissureParticles = this->FissureParticles->GetNumberOfPoints();
 
+  // Keep the particle positions so that the closest points on the
+  // surfaces can be computed for all the particles at once
+  this->FissureParticlePositions.clear();
+  for ( unsigned int i=0; i<this->NumberOfFissureParticles; i++ )
+    {
+    this->FissureParticlePositions.push_back( cip::Point3( this->FissureParticles->GetPoint(i) ) );
+    }
+
   // If no particle weights have already been specified, set each
   // particle to have equal, unity weight
   if ( this->FissureParticleWeights.size() == 0 )
@@ -64,6 +72,12 @@ void cipThinPlateSplineSurfaceModelToParticlesMetric::SetVesselParticles( vtkPol
   this->VesselParticles = particles;
   this->NumberOfVesselParticles = this->VesselParticles->GetNumberOfPoints();
 
+  this->VesselParticlePositions.clear();
+  for ( unsigned int i=0; i<this->NumberOfVesselParticles; i++ )
+    {
+    this->VesselParticlePositions.push_back( cip::Point3( this->VesselParticles->GetPoint(i) ) );
+    }
+
   // If no particle weights have already been specified, set each
   // particle to have equal, unity weight
   if ( this->VesselParticleWeights.size() == 0 )
@@ -164,6 +164,8 @@ protected:
   std::vector< double >                 FissureParticleWeights;
   std::vector< double >                 AirwayParticleWeights;
   std::vector< double >                 VesselParticleWeights;
+  std::vector< cip::Point3 >            FissureParticlePositions;
+  std::vector< cip::Point3 >            VesselParticlePositions;
   std::vector< cip::PointType >         SurfacePoints;
   std::vector< std::vector< double > >  Eigenvectors;
   std::vector< double >                 Eigenvalues;
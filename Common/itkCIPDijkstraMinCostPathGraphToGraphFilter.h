@@ -4,6 +4,14 @@
  *  \brief Computes the minimum cost path between two specified points
  *  using Dijkstra's algorithm.
  *
+ *  The search itself is carried out by 'cipDijkstraMinCostPathFinder'
+ *  on a compact copy of the input graph, with the unvisited nodes kept
+ *  in a binary heap. The input graph's nodes and edges are updated
+ *  with the search results ('AccumulatedWeight', 'Visited', 'Added'
+ *  and 'OptimalEdge') as before. Since the search stops once the end
+ *  node is visited, nodes farther from the start node than the end
+ *  node are not visited.
+ *
  *  $Date: 2012-04-24 17:06:09 -0700 (Tue, 24 Apr 2012) $
  *  $Revision: 93 $
  *  $Author: jross $
@@ -14,6 +22,7 @@
 #define __itkCIPDijkstraMinCostPathGraphToGraphFilter_h
 
 #include "itkGraphToGraphFilter.h"
+#include "cipDijkstraMinCostPathFinder.h"
 
 namespace itk
 {
@@ -64,11 +73,11 @@ private:
   CIPDijkstraMinCostPathGraphToGraphFilter( const Self& ); //purposely not implemented
   void operator=( const Self& ); //purposely not implemented
 
-  bool GetIDOfLowestCostUnvisited( InputNodeIdentifierType&, std::vector< InputNodeIdentifierType >& );
-
   InputNodeIdentifierType m_StartNode;
   InputNodeIdentifierType m_EndNode;
 
+  cipDijkstraMinCostPathFinder< InputNodeWeightType > m_PathFinder;
+
 };
 
 } // end namespace itk
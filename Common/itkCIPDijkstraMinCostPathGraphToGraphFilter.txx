@@ -30,14 +30,32 @@ void
 CIPDijkstraMinCostPathGraphToGraphFilter< TInputGraph, TOutputGraph >
 ::GenerateData()
 {
+  //-------
+  // Copy the input graph into the path finder's compact adjacency
+  // structure and search it. The unvisited nodes are kept in a binary
+  // heap, and the search stops once the end node has been visited.
+  //
+  this->m_PathFinder.SetGraph( this->GetInput() );
+
+  if ( !this->m_PathFinder.FindMinCostPath( static_cast< unsigned int >( this->m_StartNode ),
+                                            static_cast< unsigned int >( this->m_EndNode ) ) )
+    {
+    itkExceptionMacro( << "End node cannot be reached from the start node" );
+    }
+
+  //-------
+  // Record the search results on the input graph's nodes and edges
+  //
   InputNodeIteratorType nIt( this->GetInput() );
 
   nIt.GoToBegin();
   while ( !nIt.IsAtEnd() )
     {
-    nIt.Get().AccumulatedWeight = itk::NumericTraits< InputNodeWeightType >::max();
-    nIt.Get().Visited = false;
-    nIt.Get().Added   = false;
+    unsigned int nodeID = static_cast< unsigned int >( nIt.Get().Identifier );
+
+    nIt.Get().AccumulatedWeight = this->m_PathFinder.GetAccumulatedWeight( nodeID );
+    nIt.Get().Visited = this->m_PathFinder.GetNodeVisited( nodeID );
+    nIt.Get().Added   = this->m_PathFinder.GetNodeAdded( nodeID );
 
     ++nIt;
     }
@@ -52,93 +70,22 @@ CIPDijkstraMinCostPathGraphToGraphFilter< TInputGraph, TOutputGraph >
     ++eIt;
     }
 
-  std::vector< InputNodeIdentifierType > nodeIDVec;
-
-  bool endNodeVisited = false;
-  
-  this->GetInput()->GetNode( this->m_StartNode ).Added = true;
-  this->GetInput()->GetNode( this->m_StartNode ).AccumulatedWeight = this->GetInput()->GetNode( this->m_StartNode ).Weight;
-
-  typename InputGraphType::NodeIdentifierType visitingNodeID = this->m_StartNode;
-
-  do 
+  unsigned int optimalEdgeID;
+  for ( unsigned int n=0; n<this->m_PathFinder.GetNumberOfNodes(); n++ )
     {
-    if ( visitingNodeID == this->m_EndNode )
+    if ( this->m_PathFinder.GetOptimalEdgeIdentifier( n, &optimalEdgeID ) )
       {
-      endNodeVisited = true;
+      this->GetInput()->GetEdge( optimalEdgeID ).OptimalEdge = true;
       }
-
-    //-------
-    // Get all the outgoing edges from the current node
-    //
-    typename InputGraphType::NodePointerType              visitingNodePointer = this->GetInput()->GetNodePointer( visitingNodeID );
-    typename InputGraphType::EdgeIdentifierContainerType  outgoingEdgeVec     = this->GetInput()->GetOutgoingEdges( visitingNodePointer );
-    
-    //-------
-    // Set the visiting node to 'Visited'.
-    //
-    this->GetInput()->GetNode( visitingNodeID ).Visited = true;
-    
-    //-------
-    // Now investigate all the nodes that the visiting node points
-    // to. If the visiting node accumulated value plus the pointed to
-    // node value is less than the pointed to's accumulated value,
-    // replace that accumulated value with this sum.  Otherwise, set
-    // the pointed to's 'OptimalEdge' value to false
-    //
-    InputNodeWeightType visitingAccumulatedWeight = visitingNodePointer->AccumulatedWeight;
-
-    for ( int i=0; i<outgoingEdgeVec.size(); i++ )
-      {
-      InputNodeType targetNode = this->GetInput()->GetTargetNode( outgoingEdgeVec[i] );
-              
-      InputNodeIdentifierType targetNodeID               = this->GetInput()->GetNodeIdentifier( targetNode );
-        
-      InputNodeWeightType     pointedToWeight            = targetNode.Weight;
-      InputNodeWeightType     pointedToAccumulatedWeight = targetNode.AccumulatedWeight;
-      InputNodeWeightType     weightSum                  = static_cast< InputNodeWeightType >( visitingAccumulatedWeight + pointedToWeight );
-
-      if ( !targetNode.Added )
-        {
-        this->GetInput()->GetNode( targetNodeID ).Added = true;
-
-        nodeIDVec.push_back( targetNodeID );
-        }
-
-      if ( weightSum < pointedToAccumulatedWeight )
-        {
-        //-------
-        // We have found the best current path to the target node.
-        // There might be an obsolete optimal path that we'll have
-        // to break.  Look through all the edges that sink into the
-        // target node and make sure those edges are set to
-        // non-optimal.  
-        //
-        typename InputGraphType::NodePointerType targetNodePointer = this->GetInput()->GetNodePointer( targetNodeID );
-
-        typename InputGraphType::EdgeIdentifierContainerType tempIncomingEdgeVec = this->GetInput()->GetIncomingEdges( targetNodePointer );
-        
-        for ( int e=0; e<tempIncomingEdgeVec.size(); e++ )
-          {
-          this->GetInput()->GetEdge( tempIncomingEdgeVec[e] ).OptimalEdge = false;
-          }
-        
-        //-------
-        // Now set the optimal edge and weight sum
-        //
-        this->GetInput()->GetNode( targetNodeID ).AccumulatedWeight = weightSum;
-        this->GetInput()->GetEdge( visitingNodeID, targetNodeID ).OptimalEdge = true;
-        }
-      }    
     }
-  while ( this->GetIDOfLowestCostUnvisited( visitingNodeID, nodeIDVec )  );
 
   //-------
   // Now that we have the optimal edges determined, we can back-track
   // from the end node to the start node to find all the indices along
-  // the minimum cost path between the endpoints
+  // the minimum cost path between the endpoints. The path finder
+  // stores the path nodes in that order.
   //  
-  typename InputGraphType::NodeIdentifierType currentNodeID = this->m_EndNode;
+  const std::vector< unsigned int >& pathNodes = this->m_PathFinder.GetPathNodes();
 
   //-------
   // Create a new node with the proper weight.  Set its image index,
@@ -147,110 +94,23 @@ CIPDijkstraMinCostPathGraphToGraphFilter< TInputGraph, TOutputGraph >
   OutputNodeIdentifierType currentOutputNodeID;
   OutputNodeIdentifierType previousOutputNodeID;
 
-  OutputNodePointerType outputEndNodePtr = this->GetOutput()->CreateNewNode();
-
-  currentOutputNodeID = this->GetOutput()->GetNodeIdentifier( outputEndNodePtr );
-
-  this->GetOutput()->GetNode( currentOutputNodeID ).ImageIndex = this->GetInput()->GetNode( currentNodeID ).ImageIndex;
-  this->GetOutput()->GetNode( currentOutputNodeID ).Weight     = this->GetInput()->GetNode( currentNodeID ).Weight;
-
-  previousOutputNodeID = currentOutputNodeID;
-
-  bool arrivedAtStart = false;
-  while ( !arrivedAtStart )
+  for ( unsigned int i=0; i<pathNodes.size(); i++ )
     {
-    //-------
-    // Get all the incoming edges to the current node
-    //
-    typename InputGraphType::NodePointerType currentNodePointer = this->GetInput()->GetNodePointer( currentNodeID );
-    typename InputGraphType::EdgeIdentifierContainerType incomingEdgeVec = this->GetInput()->GetIncomingEdges( currentNodePointer );
-
-    //-------
-    // Find out which one is the optimal edge
-    //
-    bool optimalEdgeFound = false;
-    for ( int i=0; i<incomingEdgeVec.size(); i++ )
-      {
-      if ( this->GetInput()->GetEdge( incomingEdgeVec[i] ).OptimalEdge == true )
-        {
-        optimalEdgeFound = true;
-
-        //-------
-        // Determine the optimal edge's source node
-        //
-        typename InputGraphType::NodeType sourceNode = this->GetInput()->GetSourceNode( incomingEdgeVec[i] );
-
-        //-------
-        // Now create the new output node and assign to it the proper
-        // image index and weight.  Also establish a link between the
-        // current and previous nodes
-        //
-        OutputNodePointerType outputNodePtr = this->GetOutput()->CreateNewNode();
-        currentOutputNodeID = this->GetOutput()->GetNodeIdentifier( outputNodePtr );
-
-        this->GetOutput()->GetNode( currentOutputNodeID ).ImageIndex = sourceNode.ImageIndex;
-        this->GetOutput()->GetNode( currentOutputNodeID ).Weight = sourceNode.Weight;
-        this->GetOutput()->CreateNewEdge( currentOutputNodeID, previousOutputNodeID );
+    InputNodeType& pathNode = this->GetInput()->GetNode( pathNodes[i] );
 
-        previousOutputNodeID = currentOutputNodeID;
+    OutputNodePointerType outputNodePtr = this->GetOutput()->CreateNewNode();
+    currentOutputNodeID = this->GetOutput()->GetNodeIdentifier( outputNodePtr );
 
-        //-------
-        // Set currentNodeID to be the ID of the source node
-        //
-        currentNodeID = this->GetInput()->GetNodeIdentifier( sourceNode );
+    this->GetOutput()->GetNode( currentOutputNodeID ).ImageIndex = pathNode.ImageIndex;
+    this->GetOutput()->GetNode( currentOutputNodeID ).Weight     = pathNode.Weight;
 
-        //-------
-        // Is the current node the startNode?  If so, set arrivedAtStart
-        // node to true
-        //
-        if ( this->GetInput()->GetNodeIdentifier( sourceNode ) == this->m_StartNode )
-          {
-          arrivedAtStart = true;
-          }
-
-        break;
-        }
-      }
-    }  
-}
-
-
-template < class TInputGraph, class TOutputGraph >
-bool
-CIPDijkstraMinCostPathGraphToGraphFilter< TInputGraph, TOutputGraph >
-::GetIDOfLowestCostUnvisited( InputNodeIdentifierType& nodeID, std::vector< InputNodeIdentifierType >&  nodeIDVec )
-{
-  bool nodeFound = false;
-
-  InputNodeWeightType minWeight = itk::NumericTraits< InputNodeWeightType >::max();
-
-  int whichElement;
-
-  for ( int i=0; i<nodeIDVec.size(); i++ )
-    {
-    if ( !this->GetInput()->GetNode( nodeIDVec[i] ).Visited )
+    if ( i > 0 )
       {
-      if ( this->GetInput()->GetNode( nodeIDVec[i] ).AccumulatedWeight < minWeight )
-        {
-        minWeight = this->GetInput()->GetNode( nodeIDVec[i] ).AccumulatedWeight;
-
-        nodeID = nodeIDVec[i];
-        
-        nodeFound = true;
-        
-        whichElement = i;
-        }
+      this->GetOutput()->CreateNewEdge( currentOutputNodeID, previousOutputNodeID );
       }
-    }
 
-  if ( nodeFound )
-    {
-    typename std::vector< InputNodeIdentifierType >::iterator vIt = nodeIDVec.begin() + whichElement;
-
-    nodeIDVec.erase( vIt );
+    previousOutputNodeID = currentOutputNodeID;
     }
-
-  return nodeFound;
 }
 
 
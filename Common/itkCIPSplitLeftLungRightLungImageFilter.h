@@ -4,6 +4,20 @@
  * itkLungConventions.h. The output of this filter is a lung label map
  * image with the left and right lungs split. No relabeling is
  * performed. 
+ *
+ * The slices are processed in chains. A slice's split depends on the
+ * slice before it: the previous split erases voxels in the slice and
+ * sets the local graph ROI and search indices used for it. A merged
+ * slice that follows more than 'm_MaxSlicesSinceLastSplit' + 1 unmerged
+ * slices is independent of everything before it, since by then the
+ * local graph ROI has been given up and no erasure reaches it, so it
+ * starts a new chain. (Erasing voxels never merges the lungs, so the
+ * slices that are merged when the filter starts are the only ones that
+ * can need a split.) The chains are split concurrently on
+ * 'NumberOfThreads' threads, largest first; the slices of a chain are
+ * split in order, as a wavefront moving through the volume. Each thread
+ * keeps its own graph buffers, which are reused from one search to the
+ * next. The output is the same for any number of threads.
  */
 
 #ifndef __itkCIPSplitLeftLungRightLungImageFilter_h
@@ -11,15 +25,12 @@
 
 #include "itkImageToImageFilter.h"
 #include "itkImage.h"
-#include "itkConnectedComponentImageFilter.h"
 #include "itkImageRegionIteratorWithIndex.h"
-#include "itkExtractImageFilter.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkMultiThreader.h"
+#include "itkSimpleFastMutexLock.h"
 #include "cipChestConventions.h"
-#include "itkCIPDijkstraGraphTraits.h"
-#include "itkGraph.h" 
-#include "itkImageToGraphFilter.h"
-#include "itkCIPDijkstraImageToGraphFunctor.h"
-#include "itkCIPDijkstraMinCostPathGraphToGraphFilter.h"
+#include "cipDijkstraMinCostPathFinder.h"
 
 namespace itk
 {
@@ -96,39 +107,64 @@ protected:
   typedef LabelMapSliceType::IndexType               LabelMapSliceIndexType;
 
   typedef itk::Image< InputPixelType, 2 >                                                        InputImageSliceType;
-  typedef itk::ConnectedComponentImageFilter< LabelMapSliceType, LabelMapSliceType >             ConnectedComponent2DType;
   typedef itk::ImageRegionIteratorWithIndex< LabelMapType >                                      LabelMapIteratorType;
   typedef itk::ImageRegionConstIterator< InputImageType >                                        InputIteratorType;
   typedef itk::ImageRegionIteratorWithIndex< LabelMapSliceType >                                 LabelMapSliceIteratorType;
-  typedef itk::ExtractImageFilter< InputImageType, InputImageSliceType >                         InputExtractorType;
-  typedef itk::ExtractImageFilter< LabelMapType, LabelMapSliceType >                             LabelMapExtractorType;
   typedef unsigned long                                                                          GraphTraitsScalarType;
-  typedef itk::CIPDijkstraGraphTraits< GraphTraitsScalarType, 2 >                                GraphTraitsType;
-  typedef itk::Graph< GraphTraitsType >                                                          GraphType;
-  typedef itk::ImageToGraphFilter< InputSliceType, GraphType >                                   GraphFilterType;
-  typedef itk::CIPDijkstraImageToGraphFunctor< InputSliceType, GraphType >                       FunctorType;
-  typedef itk::CIPDijkstraMinCostPathGraphToGraphFilter< GraphType, GraphType >                  MinPathType;
+  typedef cipDijkstraMinCostPathFinder< GraphTraitsScalarType >                                  PathFinderType;
+
+  /** The state of the splitting of a chain of slices, and the buffers
+   *  used to test and split them. Each thread has its own. */
+  struct SPLITWORKSPACE
+  {
+    std::vector< LabelMapSliceType::IndexType >  minCostPathIndices;
+    std::vector< LabelMapSliceType::IndexType >  erasedSliceIndices;
+    LabelMapType::IndexType                      startSearchIndex;
+    LabelMapType::IndexType                      endSearchIndex;
+    typename InputImageType::SizeType            graphROISize;
+    typename InputImageType::IndexType           graphROIStartIndex;
+    bool                                         useLocalGraphROI;
+    std::vector< GraphTraitsScalarType >         nodeWeights;
+    PathFinderType                               pathFinder;
+    std::vector< unsigned char >                 sliceMask;
+    std::vector< unsigned int >                  sliceQueue;
+  };
+
+  /** A chain of slices [firstSlice, lastSlice) that can be split
+   *  independently of the other chains */
+  struct SLICECHAIN
+  {
+    unsigned int firstSlice;
+    unsigned int lastSlice;
+    unsigned int numberOfMergedSlices;
+    bool         isFirstChain;
+  };
 
   CIPSplitLeftLungRightLungImageFilter();
   virtual ~CIPSplitLeftLungRightLungImageFilter() {}
 
   void ExtractLabelMapSlice( LabelMapType::Pointer, LabelMapSliceType::Pointer, int );
 
-  void FindMinCostPath();
+  /** Find the min cost path through the graph ROI between the search
+      indices. The graph is built in the workspace's buffers. */
+  void FindMinCostPath( SPLITWORKSPACE& );
 
-  bool GetLungsMergedInSliceRegion( int, int, int, int, int );
+  bool GetLungsMergedInSliceRegion( int, int, int, int, int, SPLITWORKSPACE& );
 
   /** Given a min cost path through a slice, this function will erase
       all pixels that fall on the path (including those with a specified
       radius of each path pixl). The function also records those slice
       indices that were actualy erased for later use. */
-  void EraseConnection( unsigned int );
+  void EraseConnection( unsigned int, SPLITWORKSPACE& );
 
   /** */
-  void SetDefaultGraphROIAndSearchIndices( unsigned int );
+  void SetDefaultGraphROIAndSearchIndices( unsigned int, SPLITWORKSPACE& );
 
   /** */
-  void SetLocalGraphROIAndSearchIndices( unsigned int );
+  void SetLocalGraphROIAndSearchIndices( unsigned int, SPLITWORKSPACE& );
+
+  /** Split the merged slices of a chain, in order */
+  void SplitChain( const SLICECHAIN&, SPLITWORKSPACE& );
 
   void GenerateData();
 
@@ -136,19 +172,27 @@ private:
   CIPSplitLeftLungRightLungImageFilter(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
+  struct SPLITTHREADSTRUCT
+  {
+    Self*                           filter;
+    std::vector< SPLITWORKSPACE >*  workspaces;
+    std::vector< SLICECHAIN >*      chains;
+    unsigned int                    nextChain;
+    itk::SimpleFastMutexLock        chainLock;
+  };
+
+  static ITK_THREAD_RETURN_TYPE MergedSlicesThreaderCallback( void* );
+  static ITK_THREAD_RETURN_TYPE SplitThreaderCallback( void* );
+
   LabelMapType::Pointer  m_LungLabelMap;
 
   double  m_ExponentialCoefficient;
   double  m_ExponentialTimeConstant;
   int     m_LeftRightLungSplitRadius;
 
-  std::vector< LabelMapSliceType::IndexType >  m_MinCostPathIndices;
-  std::vector< LabelMapSliceType::IndexType >  m_ErasedSliceIndices;
-  LabelMapType::IndexType                      m_StartSearchIndex;
-  LabelMapType::IndexType                      m_EndSearchIndex;
-  typename InputImageType::SizeType            m_GraphROISize;
-  typename InputImageType::IndexType           m_GraphROIStartIndex;
-  bool                                         m_UseLocalGraphROI;
+  bool                          m_UseLocalGraphROI;
+  unsigned int                  m_MaxSlicesSinceLastSplit;
+  std::vector< unsigned char >  m_MergedSlices;
 };
   
 } // end namespace itk
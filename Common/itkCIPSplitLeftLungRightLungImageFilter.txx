@@ -3,6 +3,8 @@
 
 #include "itkCIPSplitLeftLungRightLungImageFilter.h"
 #include "cipExceptionObject.h"
+#include <algorithm>
+#include <cmath>
 
 namespace itk
 {
@@ -15,6 +17,7 @@ CIPSplitLeftLungRightLungImageFilter< TInputImage >
   this->m_ExponentialTimeConstant     = -700;
   this->m_LeftRightLungSplitRadius    = 1;
   this->m_UseLocalGraphROI            = true;
+  this->m_MaxSlicesSinceLastSplit     = 10;
 }
 
 
@@ -52,10 +55,198 @@ CIPSplitLeftLungRightLungImageFilter< TInputImage >
 
   LabelMapType::SizeType size = this->GetOutput()->GetBufferedRegion().GetSize();
 
-  int minX = size[0]/3;
-  int maxX = size[0]-size[0]/3;
-  int minY = 0;
-  int maxY = size[1]-1;
+  unsigned int numberOfThreads = this->GetNumberOfThreads();
+  if ( numberOfThreads > size[2] )
+    {
+      numberOfThreads = size[2];
+    }
+  if ( numberOfThreads < 1 )
+    {
+      numberOfThreads = 1;
+    }
+
+  // Each thread gets its own workspace. The graph buffers are sized
+  // for the default graph ROI and grow if a local graph ROI is larger.
+  std::vector< SPLITWORKSPACE > workspaces( numberOfThreads );
+  for ( unsigned int t=0; t<numberOfThreads; t++ )
+    {
+      workspaces[t].nodeWeights.reserve( (size[0] - 2*(size[0]/3) + 20)*size[1] );
+      workspaces[t].sliceMask.reserve( (size[0]/3)*size[1] );
+    }
+
+  SPLITTHREADSTRUCT str;
+    str.filter     = this;
+    str.workspaces = &workspaces;
+    str.nextChain  = 0;
+
+  // Find the slices in which the lungs are merged. Erasing voxels can
+  // only split the lungs further, so these are the only slices that
+  // can need a split.
+  this->m_MergedSlices.assign( size[2], 0 );
+
+  if ( numberOfThreads == 1 )
+    {
+      for ( unsigned int i=0; i<size[2]; i++ )
+	{
+	  this->m_MergedSlices[i] = this->GetLungsMergedInSliceRegion( size[0]/3, 0, size[0]/3, size[1], i, workspaces[0] );
+	}
+    }
+  else
+    {
+      this->GetMultiThreader()->SetNumberOfThreads( numberOfThreads );
+      this->GetMultiThreader()->SetSingleMethod( CIPSplitLeftLungRightLungImageFilter::MergedSlicesThreaderCallback, &str );
+      this->GetMultiThreader()->SingleMethodExecute();
+    }
+
+  // Divide the slices into chains. A new chain starts at a merged
+  // slice that follows enough unmerged slices for the local graph ROI
+  // to have been given up (see 'SplitChain'). A split erases voxels in
+  // the slices next to it only, so chains never touch the same slices.
+  std::vector< SLICECHAIN > slicesChains;
+
+  SLICECHAIN chain;
+    chain.firstSlice           = 0;
+    chain.numberOfMergedSlices = 0;
+    chain.isFirstChain         = true;
+
+  unsigned int slicesSinceMerged = 0;
+  for ( unsigned int i=0; i<size[2]; i++ )
+    {
+      if ( !this->m_MergedSlices[i] )
+	{
+	  slicesSinceMerged++;
+	  continue;
+	}
+
+      if ( chain.numberOfMergedSlices > 0 && slicesSinceMerged > this->m_MaxSlicesSinceLastSplit + 1 )
+	{
+	  chain.lastSlice = i;
+	  slicesChains.push_back( chain );
+
+	  chain.firstSlice           = i;
+	  chain.numberOfMergedSlices = 0;
+	  chain.isFirstChain         = false;
+	}
+
+      chain.numberOfMergedSlices++;
+      slicesSinceMerged = 0;
+    }
+  if ( chain.numberOfMergedSlices > 0 )
+    {
+      chain.lastSlice = size[2];
+      slicesChains.push_back( chain );
+    }
+
+  // Split the largest chains first so that the threads finish at about
+  // the same time
+  std::vector< std::pair< unsigned int, unsigned int > > chainOrder;
+  for ( unsigned int c=0; c<slicesChains.size(); c++ )
+    {
+      chainOrder.push_back( std::pair< unsigned int, unsigned int >( slicesChains[c].numberOfMergedSlices, c ) );
+    }
+  std::sort( chainOrder.rbegin(), chainOrder.rend() );
+
+  std::vector< SLICECHAIN > chains;
+  for ( unsigned int c=0; c<chainOrder.size(); c++ )
+    {
+      chains.push_back( slicesChains[chainOrder[c].second] );
+    }
+
+  str.chains = &chains;
+
+  if ( numberOfThreads == 1 || chains.size() < 2 )
+    {
+      for ( unsigned int c=0; c<chains.size(); c++ )
+	{
+	  this->SplitChain( chains[c], workspaces[0] );
+	}
+    }
+  else
+    {
+      this->GetMultiThreader()->SetNumberOfThreads( numberOfThreads );
+      this->GetMultiThreader()->SetSingleMethod( CIPSplitLeftLungRightLungImageFilter::SplitThreaderCallback, &str );
+      this->GetMultiThreader()->SingleMethodExecute();
+    }
+}
+
+
+template< class TInputImage >
+ITK_THREAD_RETURN_TYPE
+CIPSplitLeftLungRightLungImageFilter< TInputImage >
+::MergedSlicesThreaderCallback( void* arg )
+{
+  itk::MultiThreader::ThreadInfoStruct* info = static_cast< itk::MultiThreader::ThreadInfoStruct* >( arg );
+
+  unsigned int threadId        = info->ThreadID;
+  unsigned int numberOfThreads = info->NumberOfThreads;
+  SPLITTHREADSTRUCT* str       = static_cast< SPLITTHREADSTRUCT* >( info->UserData );
+
+  LabelMapType::SizeType size = str->filter->GetOutput()->GetBufferedRegion().GetSize();
+
+  for ( unsigned int i=threadId; i<size[2]; i += numberOfThreads )
+    {
+      str->filter->m_MergedSlices[i] = 
+	str->filter->GetLungsMergedInSliceRegion( size[0]/3, 0, size[0]/3, size[1], i, (*str->workspaces)[threadId] );
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+template< class TInputImage >
+ITK_THREAD_RETURN_TYPE
+CIPSplitLeftLungRightLungImageFilter< TInputImage >
+::SplitThreaderCallback( void* arg )
+{
+  itk::MultiThreader::ThreadInfoStruct* info = static_cast< itk::MultiThreader::ThreadInfoStruct* >( arg );
+
+  unsigned int threadId  = info->ThreadID;
+  SPLITTHREADSTRUCT* str = static_cast< SPLITTHREADSTRUCT* >( info->UserData );
+
+  while ( true )
+    {
+      str->chainLock.Lock();
+      unsigned int c = str->nextChain++;
+      str->chainLock.Unlock();
+
+      if ( c >= str->chains->size() )
+	{
+	  break;
+	}
+
+      str->filter->SplitChain( (*str->chains)[c], (*str->workspaces)[threadId] );
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+template< class TInputImage >
+void
+CIPSplitLeftLungRightLungImageFilter< TInputImage >
+::SplitChain( const SLICECHAIN& chain, SPLITWORKSPACE& workspace )
+{
+  LabelMapType::SizeType size = this->GetOutput()->GetBufferedRegion().GetSize();
+
+  // The first chain starts from the filter's initial state. Any other
+  // chain starts after enough unmerged slices for the local graph ROI
+  // to have been given up.
+  workspace.graphROISize.Fill( 0 );
+  workspace.graphROIStartIndex.Fill( 0 );
+  workspace.startSearchIndex.Fill( 0 );
+  workspace.endSearchIndex.Fill( 0 );
+
+  unsigned int slicesSinceLastSplit;
+  if ( chain.isFirstChain )
+    {
+      workspace.useLocalGraphROI = this->m_UseLocalGraphROI;
+      slicesSinceLastSplit = size[2];
+    }
+  else
+    {
+      workspace.useLocalGraphROI = false;
+      slicesSinceLastSplit = this->m_MaxSlicesSinceLastSplit + 1;
+    }
 
   // We will look through each slice, test whether or not there appears to be
   // a connection and, if so, we will split. The region to consider for a given
@@ -64,28 +255,22 @@ CIPSplitLeftLungRightLungImageFilter< TInputImage >
   // a split, we will initiate the min cost path search at the top middle of 
   // the ROI and designate as the endpoint of the path the lower middle of
   // the ROI.
-  typename InputImageSliceType::IndexType searchStartIndex;
-    searchStartIndex[0] = (maxX + minX)/2;
-    searchStartIndex[1] = minY;
-
-  typename InputImageSliceType::IndexType searchEndIndex;        
-    searchEndIndex[0] = (maxX + minX)/2;
-    searchEndIndex[1] = maxY;
-
-  unsigned int slicesSinceLastSplit = size[2];
-
-  for ( unsigned int i=0; i<size[2]; i++ )
+  for ( unsigned int i=chain.firstSlice; i<chain.lastSlice; i++ )
     {
-    bool merged = this->GetLungsMergedInSliceRegion( size[0]/3, 0, size[0]/3, size[1], i ); 
+    bool merged = false;
+    if ( this->m_MergedSlices[i] )
+      {
+	merged = this->GetLungsMergedInSliceRegion( size[0]/3, 0, size[0]/3, size[1], i, workspace ); 
+      }
 
     // We will only use the local search region provided that 
     // we're relatively near the slice where we had our last
     // split
     if ( !merged )
       {
-	if ( slicesSinceLastSplit > 10 )
+	if ( slicesSinceLastSplit > this->m_MaxSlicesSinceLastSplit )
 	  {
-	    this->m_UseLocalGraphROI = false;
+	    workspace.useLocalGraphROI = false;
 	  }
 	else
 	  {
@@ -96,27 +281,27 @@ CIPSplitLeftLungRightLungImageFilter< TInputImage >
     // If the current slice is merged and we're not supposed to use the
     // local search region, then set the default search region for
     // this slice.
-    if ( merged && !this->m_UseLocalGraphROI ) 
+    if ( merged && !workspace.useLocalGraphROI ) 
       {
-	this->SetDefaultGraphROIAndSearchIndices( i );
+	this->SetDefaultGraphROIAndSearchIndices( i, workspace );
       }
 
     bool attemptSplit = true;
     while ( merged && attemptSplit )
       {
-	this->FindMinCostPath();
-	this->EraseConnection( i );
-	merged = this->GetLungsMergedInSliceRegion( size[0]/3, 0, size[0]/3, size[1], i );
+	this->FindMinCostPath( workspace );
+	this->EraseConnection( i, workspace );
+	merged = this->GetLungsMergedInSliceRegion( size[0]/3, 0, size[0]/3, size[1], i, workspace );
 
 	if ( !merged )
 	  {
 	    // Set the local search region for the next slice
-	    this->SetLocalGraphROIAndSearchIndices( i+1 );
+	    this->SetLocalGraphROIAndSearchIndices( i+1, workspace );
 	    slicesSinceLastSplit = 0;
 	  }
-	else if ( merged && this->m_UseLocalGraphROI )
+	else if ( merged && workspace.useLocalGraphROI )
 	  {
-	    this->SetDefaultGraphROIAndSearchIndices( i );
+	    this->SetDefaultGraphROIAndSearchIndices( i, workspace );
 	  }
 	else
 	  {
@@ -137,90 +322,65 @@ CIPSplitLeftLungRightLungImageFilter< TInputImage >
 template< class TInputImage >
 bool
 CIPSplitLeftLungRightLungImageFilter< TInputImage >
-::GetLungsMergedInSliceRegion( int startX, int startY, int sizeX, int sizeY, int whichSlice )
+::GetLungsMergedInSliceRegion( int startX, int startY, int sizeX, int sizeY, int whichSlice, SPLITWORKSPACE& workspace )
 {
-  LabelMapType::SizeType sliceSize;
-    sliceSize[0] = sizeX;
-    sliceSize[1] = sizeY;
-    sliceSize[2] = 0;
-
-  LabelMapType::IndexType sliceStartIndex;
-    sliceStartIndex[0] = startX;
-    sliceStartIndex[1] = startY;
-    sliceStartIndex[2] = whichSlice;
-  
-  LabelMapType::RegionType sliceRegion;
-    sliceRegion.SetSize( sliceSize );
-    sliceRegion.SetIndex( sliceStartIndex );
-
-  LabelMapExtractorType::Pointer sliceROI = LabelMapExtractorType::New();
-    sliceROI->SetInput( this->GetOutput() );
-    sliceROI->SetDirectionCollapseToIdentity();
-    sliceROI->SetExtractionRegion( sliceRegion );
-    sliceROI->Update();
-
-  LabelMapSliceType::SizeType roiSize = sliceROI->GetOutput()->GetBufferedRegion().GetSize();
-
-  LabelMapSliceIteratorType sIt( sliceROI->GetOutput(), sliceROI->GetOutput()->GetBufferedRegion() );
-
-  sIt.GoToBegin();
-  LabelMapSliceType::IndexType startIndex = sIt.GetIndex();
-
-  // Perform connected components on the region
-  ConnectedComponent2DType::Pointer connectedComponent = ConnectedComponent2DType::New();
-    connectedComponent->SetInput( sliceROI->GetOutput() );
-    connectedComponent->FullyConnectedOn();
-    connectedComponent->Update();
+  if ( sizeX <= 0 || sizeY <= 0 )
+    {
+    return false;
+    }
 
-  // If there is an object that touches both the left border and the
-  // right border, then the lungs are merged in this slice.  Test this
-  // condition
-  std::list< unsigned short >  lefthandLabelList;
-  std::list< unsigned short >  righthandLabelList;
+  // Mark the foreground pixels of the region
+  workspace.sliceMask.assign( sizeX*sizeY, 0 );
 
-  LabelMapSliceType::IndexType index;
+  LabelMapType::IndexType index;
+    index[2] = whichSlice;
 
-  for ( unsigned int i=0; i<roiSize[1]; i++ )
+  for ( int y=0; y<sizeY; y++ )
     {
-    index[1] = i;
-    index[0] = startIndex[0];
-
-    unsigned short value = connectedComponent->GetOutput()->GetPixel( index );
-
-    if ( value != (unsigned short)( 0 ) )
+    index[1] = startY + y;
+    for ( int x=0; x<sizeX; x++ )
       {
-      lefthandLabelList.push_back( value );
+      index[0] = startX + x;
+      if ( this->GetOutput()->GetPixel( index ) != 0 )
+        {
+        workspace.sliceMask[y*sizeX + x] = 1;
+        }
       }
+    }
 
-     index[0] = startIndex[0] + roiSize[0] - 1;
-
-     value = connectedComponent->GetOutput()->GetPixel( index );
-
-    if ( value != 0 )
+  // If there is an object (8-connected) that touches both the left
+  // border and the right border, then the lungs are merged in this
+  // slice. Grow the objects touching the left border and test
+  // whether any of them reaches the right border.
+  workspace.sliceQueue.clear();
+  for ( int y=0; y<sizeY; y++ )
+    {
+    if ( workspace.sliceMask[y*sizeX] == 1 )
       {
-      righthandLabelList.push_back( value );
+      workspace.sliceMask[y*sizeX] = 2;
+      workspace.sliceQueue.push_back( y*sizeX );
       }
     }
 
-  lefthandLabelList.unique();
-  lefthandLabelList.sort();
-  lefthandLabelList.unique();
-
-  righthandLabelList.unique();
-  righthandLabelList.sort();
-  righthandLabelList.unique();
+  for ( unsigned int q=0; q<workspace.sliceQueue.size(); q++ )
+    {
+    int x = workspace.sliceQueue[q]%sizeX;
+    int y = workspace.sliceQueue[q]/sizeX;
 
-  std::list< unsigned short >::iterator leftIt   = lefthandLabelList.begin();
-  std::list< unsigned short >::iterator rightIt  = righthandLabelList.begin();
+    if ( x == sizeX - 1 )
+      {
+      return true;
+      }
 
-  for ( unsigned int i=0; i<lefthandLabelList.size(); i++, leftIt++ )
-    {
-    rightIt  = righthandLabelList.begin();
-    for ( unsigned int j=0; j<righthandLabelList.size(); j++, rightIt++ )
+    for ( int ny=y-1; ny<=y+1; ny++ )
       {
-      if ( *leftIt == *rightIt )
+      for ( int nx=x-1; nx<=x+1; nx++ )
         {
-        return true;
+        if ( nx >= 0 && ny >= 0 && nx < sizeX && ny < sizeY && workspace.sliceMask[ny*sizeX + nx] == 1 )
+          {
+          workspace.sliceMask[ny*sizeX + nx] = 2;
+          workspace.sliceQueue.push_back( ny*sizeX + nx );
+          }
         }
       }
     }
@@ -231,9 +391,9 @@ CIPSplitLeftLungRightLungImageFilter< TInputImage >
 
 template< class TInputImage >
 void CIPSplitLeftLungRightLungImageFilter< TInputImage >
-::SetDefaultGraphROIAndSearchIndices( unsigned int z )
+::SetDefaultGraphROIAndSearchIndices( unsigned int z, SPLITWORKSPACE& workspace )
 {
-  this->m_UseLocalGraphROI = false;
+  workspace.useLocalGraphROI = false;
 
   LabelMapType::SizeType size = this->GetOutput()->GetBufferedRegion().GetSize();
 
@@ -243,81 +403,81 @@ void CIPSplitLeftLungRightLungImageFilter< TInputImage >
   int maxY = size[1]-1;
 
   // Set the start and end search indices
-  this->m_StartSearchIndex[0] = (maxX + minX)/2;
-  this->m_StartSearchIndex[1] = minY;
-  this->m_StartSearchIndex[2] = 0; // Value not used except for assert statements below
+  workspace.startSearchIndex[0] = (maxX + minX)/2;
+  workspace.startSearchIndex[1] = minY;
+  workspace.startSearchIndex[2] = 0; // Value not used except for assert statements below
 
-  this->m_EndSearchIndex[0] = (maxX + minX)/2;
-  this->m_EndSearchIndex[1] = maxY;
-  this->m_EndSearchIndex[2] = 0; // Value not used except for assert statements below
+  workspace.endSearchIndex[0] = (maxX + minX)/2;
+  workspace.endSearchIndex[1] = maxY;
+  workspace.endSearchIndex[2] = 0; // Value not used except for assert statements below
 
   // Set the start index of the graph ROI
   int tmp;
   tmp = minX - 10;
   if ( tmp < 0 )
     {
-      this->m_GraphROIStartIndex[0] = 0;
+      workspace.graphROIStartIndex[0] = 0;
     }
   else
     {
-      this->m_GraphROIStartIndex[0] = tmp;
+      workspace.graphROIStartIndex[0] = tmp;
     }
   tmp  = minY - 10;
   if ( tmp < 0 )
     {
-      this->m_GraphROIStartIndex[1] = 0;
+      workspace.graphROIStartIndex[1] = 0;
     }
   else
     {
-      this->m_GraphROIStartIndex[1] = tmp;
+      workspace.graphROIStartIndex[1] = tmp;
     }
-  this->m_GraphROIStartIndex[2] = z;
+  workspace.graphROIStartIndex[2] = z;
 
-  assert( this->GetOutput()->GetBufferedRegion().IsInside( this->m_GraphROIStartIndex ) );
+  assert( this->GetOutput()->GetBufferedRegion().IsInside( workspace.graphROIStartIndex ) );
 
   // Now set the size of the graph ROI
   tmp  = maxX - minX + 20;
   if ( tmp < 0 )
     {
-      this->m_GraphROISize[0] = 0;
+      workspace.graphROISize[0] = 0;
     }	  
   else if ( tmp > size[0] )
     {
-      this->m_GraphROISize[0] = size[0];
+      workspace.graphROISize[0] = size[0];
     }
   else
     {
-      this->m_GraphROISize[0] = tmp;
+      workspace.graphROISize[0] = tmp;
     }
 
   tmp  = maxY - minY + 20;
   if ( tmp < 0 )
     {
-      this->m_GraphROISize[1] = 0;
+      workspace.graphROISize[1] = 0;
     }
   else if ( tmp > size[1] )
     {
-      this->m_GraphROISize[1] = size[1];
+      workspace.graphROISize[1] = size[1];
     }
   else
     {
-      this->m_GraphROISize[1] = tmp;
+      workspace.graphROISize[1] = tmp;
     }
   
-  assert( this->GetOutput()->GetBufferedRegion().IsInside( this->m_StartSearchIndex ) );
-  assert( this->GetOutput()->GetBufferedRegion().IsInside( this->m_EndSearchIndex ) );
-  assert( this->m_GraphROIStartIndex[0] + this->m_GraphROISize[0] <= size[0] );
-  assert( this->m_GraphROIStartIndex[1] + this->m_GraphROISize[1] <= size[1] );
+  assert( this->GetOutput()->GetBufferedRegion().IsInside( workspace.startSearchIndex ) );
+  assert( this->GetOutput()->GetBufferedRegion().IsInside( workspace.endSearchIndex ) );
+  assert( workspace.graphROIStartIndex[0] + workspace.graphROISize[0] <= size[0] );
+  assert( workspace.graphROIStartIndex[1] + workspace.graphROISize[1] <= size[1] );
 
-  this->m_GraphROISize[2] = 0;        
+  workspace.graphROISize[2] = 0;        
 }
 
 
 template< class TInputImage >
 void CIPSplitLeftLungRightLungImageFilter< TInputImage >
-::SetLocalGraphROIAndSearchIndices( unsigned int z )
+::SetLocalGraphROIAndSearchIndices( unsigned int z, SPLITWORKSPACE& workspace )
 {
-  this->m_UseLocalGraphROI = true;
+  workspace.useLocalGraphROI = true;
 
   LabelMapType::SizeType size = this->GetOutput()->GetBufferedRegion().GetSize();
 
@@ -326,25 +486,25 @@ void CIPSplitLeftLungRightLungImageFilter< TInputImage >
   int minY = size[1];
   int maxY = 0;
 
-  for ( unsigned int i=0; i<this->m_ErasedSliceIndices.size(); i++ )
+  for ( unsigned int i=0; i<workspace.erasedSliceIndices.size(); i++ )
     {
-      if ( this->m_ErasedSliceIndices[i][0] > maxX )
+      if ( workspace.erasedSliceIndices[i][0] > maxX )
 	{
-	  maxX = this->m_ErasedSliceIndices[i][0];
+	  maxX = workspace.erasedSliceIndices[i][0];
 	}
-      if ( this->m_ErasedSliceIndices[i][0] < minX )
+      if ( workspace.erasedSliceIndices[i][0] < minX )
 	{
-	  minX = this->m_ErasedSliceIndices[i][0];
+	  minX = workspace.erasedSliceIndices[i][0];
 	}
-      if ( this->m_ErasedSliceIndices[i][1] > maxY )
+      if ( workspace.erasedSliceIndices[i][1] > maxY )
 	{
-	  maxY = this->m_ErasedSliceIndices[i][1];
-	  this->m_EndSearchIndex[0] = this->m_ErasedSliceIndices[i][0];
+	  maxY = workspace.erasedSliceIndices[i][1];
+	  workspace.endSearchIndex[0] = workspace.erasedSliceIndices[i][0];
 	}
-      if ( this->m_ErasedSliceIndices[i][1] < minY )
+      if ( workspace.erasedSliceIndices[i][1] < minY )
 	{
-	  minY = this->m_ErasedSliceIndices[i][1];
-	  this->m_StartSearchIndex[0] = this->m_ErasedSliceIndices[i][0];
+	  minY = workspace.erasedSliceIndices[i][1];
+	  workspace.startSearchIndex[0] = workspace.erasedSliceIndices[i][0];
 	}
     }
 
@@ -353,65 +513,65 @@ void CIPSplitLeftLungRightLungImageFilter< TInputImage >
   tmp = minX - 10;
   if ( tmp < 0 )
     {
-      this->m_GraphROIStartIndex[0] = 0;
+      workspace.graphROIStartIndex[0] = 0;
     }
   else
     {
-      this->m_GraphROIStartIndex[0] = tmp;
+      workspace.graphROIStartIndex[0] = tmp;
     }
   tmp = minY - 10;
   if ( tmp < 0 )
     {
-      this->m_GraphROIStartIndex[1] = 0;
+      workspace.graphROIStartIndex[1] = 0;
     }
   else
     {
-      this->m_GraphROIStartIndex[1] = tmp;
+      workspace.graphROIStartIndex[1] = tmp;
     }
-  this->m_GraphROIStartIndex[2] = z;
+  workspace.graphROIStartIndex[2] = z;
 
-  assert( this->GetOutput()->GetBufferedRegion().IsInside( this->m_GraphROIStartIndex ) );
+  assert( this->GetOutput()->GetBufferedRegion().IsInside( workspace.graphROIStartIndex ) );
 
-  this->m_StartSearchIndex[1] = this->m_GraphROIStartIndex[1];
+  workspace.startSearchIndex[1] = workspace.graphROIStartIndex[1];
 
   // Now set the size of the graph ROI
-  this->m_GraphROISize[0] = maxX - minX + 20;
+  workspace.graphROISize[0] = maxX - minX + 20;
   if ( maxX - minX + 20 < 0 )
     {
-      this->m_GraphROISize[0] = 0;
+      workspace.graphROISize[0] = 0;
     }
-  if ( this->m_GraphROISize[0] >= size[0] )
+  if ( workspace.graphROISize[0] >= size[0] )
     {
-      this->m_GraphROISize[0] = size[0] - 1;
+      workspace.graphROISize[0] = size[0] - 1;
     }
   
-  this->m_GraphROISize[1] = maxY - minY + 20;
+  workspace.graphROISize[1] = maxY - minY + 20;
   if ( maxY - minY + 20 < 0 )
     {
-      this->m_GraphROISize[1] = 0;
+      workspace.graphROISize[1] = 0;
     }
-  if ( this->m_GraphROISize[1] >= size[1] )
+  if ( workspace.graphROISize[1] >= size[1] )
     {
-      this->m_GraphROISize[1] = size[1] - 1;
+      workspace.graphROISize[1] = size[1] - 1;
     }   
-  this->m_EndSearchIndex[1] = this->m_GraphROIStartIndex[1] + this->m_GraphROISize[1] - 1;
+  workspace.endSearchIndex[1] = workspace.graphROIStartIndex[1] + workspace.graphROISize[1] - 1;
 
-  assert( this->GetOutput()->GetBufferedRegion().IsInside( this->m_StartSearchIndex ) );
-  assert( this->GetOutput()->GetBufferedRegion().IsInside( this->m_EndSearchIndex ) );
-  assert( this->m_GraphROIStartIndex[0] + this->m_GraphROISize[0] < size[0] );
-  assert( this->m_GraphROIStartIndex[1] + this->m_GraphROISize[1] < size[1] );
+  assert( this->GetOutput()->GetBufferedRegion().IsInside( workspace.startSearchIndex ) );
+  assert( this->GetOutput()->GetBufferedRegion().IsInside( workspace.endSearchIndex ) );
+  assert( workspace.graphROIStartIndex[0] + workspace.graphROISize[0] < size[0] );
+  assert( workspace.graphROIStartIndex[1] + workspace.graphROISize[1] < size[1] );
 
-  this->m_GraphROISize[2] = 0;
+  workspace.graphROISize[2] = 0;
 }
 
 
 template< class TInputImage >
 void CIPSplitLeftLungRightLungImageFilter< TInputImage >
-::EraseConnection( unsigned int slice )
+::EraseConnection( unsigned int slice, SPLITWORKSPACE& workspace )
 {
-  if ( this->m_ErasedSliceIndices.size() > 0 )
+  if ( workspace.erasedSliceIndices.size() > 0 )
     {
-      this->m_ErasedSliceIndices.clear();
+      workspace.erasedSliceIndices.clear();
     }
 
   LabelMapSliceType::IndexType erasedIndex;  
@@ -419,17 +579,17 @@ void CIPSplitLeftLungRightLungImageFilter< TInputImage >
   typename OutputImageType::IndexType tmpIndex;
     tmpIndex[2] = slice;
 
-  for ( unsigned int i=0; i<this->m_MinCostPathIndices.size(); i++ )
+  for ( unsigned int i=0; i<workspace.minCostPathIndices.size(); i++ )
     {
       for ( int y=-this->m_LeftRightLungSplitRadius; y<=this->m_LeftRightLungSplitRadius; y++ )
 	{
-	  tmpIndex[1] = this->m_MinCostPathIndices[i][1] + y;
-	  erasedIndex[1] = this->m_MinCostPathIndices[i][1];
+	  tmpIndex[1] = workspace.minCostPathIndices[i][1] + y;
+	  erasedIndex[1] = workspace.minCostPathIndices[i][1];
 	  
 	  for ( int x=-this->m_LeftRightLungSplitRadius; x<=this->m_LeftRightLungSplitRadius; x++ )
 	    {
-	      tmpIndex[0] = this->m_MinCostPathIndices[i][0] + x;
-	      erasedIndex[0] = this->m_MinCostPathIndices[i][0];
+	      tmpIndex[0] = workspace.minCostPathIndices[i][0] + x;
+	      erasedIndex[0] = workspace.minCostPathIndices[i][0];
 	      
 	      for ( int z=-1; z<=1; z++ )
 		{
@@ -440,7 +600,7 @@ void CIPSplitLeftLungRightLungImageFilter< TInputImage >
 		      if ( this->GetOutput()->GetPixel( tmpIndex ) != 0 )
 			{
 			  this->GetOutput()->SetPixel( tmpIndex, 0 );
-			  this->m_ErasedSliceIndices.push_back( erasedIndex );	  
+			  workspace.erasedSliceIndices.push_back( erasedIndex );	  
 			}
 		    }
 		}
@@ -455,77 +615,80 @@ void CIPSplitLeftLungRightLungImageFilter< TInputImage >
  */
 template< class TInputImage >
 void CIPSplitLeftLungRightLungImageFilter< TInputImage >
-::FindMinCostPath()
+::FindMinCostPath( SPLITWORKSPACE& workspace )
 {
-  if ( this->m_MinCostPathIndices.size() > 0 )
+  if ( workspace.minCostPathIndices.size() > 0 )
     {
-      this->m_MinCostPathIndices.clear();
+      workspace.minCostPathIndices.clear();
     }  
 
+  // The graph ROI has to lie within the image (it is a single slice).
+  // If it does not, no path is found.
+  typename InputImageType::SizeType roiSize = workspace.graphROISize;
+    roiSize[2] = 1;
+
   typename InputImageType::RegionType roiRegion;
-    roiRegion.SetSize( this->m_GraphROISize );
-    roiRegion.SetIndex( this->m_GraphROIStartIndex );
+    roiRegion.SetSize( roiSize );
+    roiRegion.SetIndex( workspace.graphROIStartIndex );
 
-  typename InputExtractorType::Pointer roiExtractor = InputExtractorType::New();
-    roiExtractor->SetInput( this->GetInput() );
-    roiExtractor->SetDirectionCollapseToIdentity();
-    roiExtractor->SetExtractionRegion( roiRegion );
-    roiExtractor->Update();
+  unsigned int sizeX = workspace.graphROISize[0];
+  unsigned int sizeY = workspace.graphROISize[1];
 
-  InputPixelType lowerThreshold = itk::NumericTraits< InputPixelType >::NonpositiveMin();
-  InputPixelType upperThreshold = itk::NumericTraits< InputPixelType >::max();
+  if ( sizeX == 0 || sizeY == 0 || !this->GetInput()->GetBufferedRegion().IsInside( roiRegion ) )
+    {
+    return;
+    }
 
-  typename FunctorType::Pointer graphFunctor = FunctorType::New();
-    graphFunctor->SetRadius( 1 );
-    graphFunctor->SetLowerThreshold( lowerThreshold );
-    graphFunctor->SetUpperThreshold( upperThreshold );
-    graphFunctor->SetExponentialCoefficient( this->m_ExponentialCoefficient );
-    graphFunctor->SetExponentialTimeConstant( this->m_ExponentialTimeConstant );
-    graphFunctor->ActivateAllNeighbors();
+  // Each pixel of the ROI is a graph node. Its weight is an
+  // exponential function of its intensity (see
+  // 'itk::CIPDijkstraImageToGraphFunctor').
+  workspace.nodeWeights.resize( sizeX*sizeY );
 
-  typename GraphFilterType::Pointer graphFilter = GraphFilterType::New();
-    graphFilter->SetInput( roiExtractor->GetOutput() );
-    graphFilter->SetImageToGraphFunctor( graphFunctor );
-    graphFilter->Update();
+  typename InputImageType::IndexType index;
+    index[2] = workspace.graphROIStartIndex[2];
 
-  LabelMapSliceType::IndexType index;
+  for ( unsigned int y=0; y<sizeY; y++ )
+    {
+    index[1] = workspace.graphROIStartIndex[1] + y;
+    for ( unsigned int x=0; x<sizeX; x++ )
+      {
+      index[0] = workspace.graphROIStartIndex[0] + x;
 
-  GraphType::NodeIdentifierType startNodeID;
-  GraphType::NodeIdentifierType endNodeID;
+      double pixelValue = static_cast< double >( this->GetInput()->GetPixel( index ) );
 
-  GraphType::NodeIterator nIt( graphFilter->GetOutput() );
-  
-  nIt.GoToBegin();
-  while ( !nIt.IsAtEnd() )
+      workspace.nodeWeights[y*sizeX + x] = 
+        static_cast< GraphTraitsScalarType >( this->m_ExponentialCoefficient*std::exp( pixelValue/this->m_ExponentialTimeConstant ) );
+      }
+    }
+
+  long startX = workspace.startSearchIndex[0] - workspace.graphROIStartIndex[0];
+  long startY = workspace.startSearchIndex[1] - workspace.graphROIStartIndex[1];
+  long endX   = workspace.endSearchIndex[0] - workspace.graphROIStartIndex[0];
+  long endY   = workspace.endSearchIndex[1] - workspace.graphROIStartIndex[1];
+
+  if ( startX < 0 || startY < 0 || startX >= long(sizeX) || startY >= long(sizeY) ||
+       endX < 0 || endY < 0 || endX >= long(sizeX) || endY >= long(sizeY) )
     {
-    index = nIt.Get().ImageIndex;
+    return;
+    }
 
-    if ( index[0] == this->m_StartSearchIndex[0] && index[1] == this->m_StartSearchIndex[1] )
-      {
-      startNodeID = nIt.Get().Identifier;
-      }
-    if ( index[0] == this->m_EndSearchIndex[0] && index[1] == this->m_EndSearchIndex[1] )
-      {
-      endNodeID = nIt.Get().Identifier;
-      }
+  workspace.pathFinder.SetGridGraph( sizeX, sizeY, &workspace.nodeWeights[0] );
 
-    ++nIt;
+  if ( !workspace.pathFinder.FindMinCostPath( startY*sizeX + startX, endY*sizeX + endX ) )
+    {
+    return;
     }
 
-  MinPathType::Pointer minPathFilter = MinPathType::New();
-    minPathFilter->SetInput( graphFilter->GetOutput() );
-    minPathFilter->SetStartNode( startNodeID );
-    minPathFilter->SetEndNode( endNodeID );
-    minPathFilter->Update();
+  // The path nodes run from the end index to the start index
+  const std::vector< unsigned int >& pathNodes = workspace.pathFinder.GetPathNodes();
 
-  GraphType::NodeIterator onIt( minPathFilter->GetOutput() );
-  
-  onIt.GoToBegin();
-  while ( !onIt.IsAtEnd() )
+  LabelMapSliceType::IndexType pathIndex;
+  for ( unsigned int i=0; i<pathNodes.size(); i++ )
     {
-    this->m_MinCostPathIndices.push_back( onIt.Get().ImageIndex );
+    pathIndex[0] = workspace.graphROIStartIndex[0] + pathNodes[i]%sizeX;
+    pathIndex[1] = workspace.graphROIStartIndex[1] + pathNodes[i]/sizeX;
 
-    ++onIt;
+    workspace.minCostPathIndices.push_back( pathIndex );
     }
 }
 
@@ -23,7 +23,6 @@
 //#include "vtkGraphLayoutView.h"
 #include "vtkRenderWindow.h"
 #include "vtkRenderWindowInteractor.h"
-#include "vtkBoostKruskalMinimumSpanningTree.h"
 #include "vtkRenderer.h"
 #include "vtkPolyDataMapper.h"
 #include "vtkEdgeListIterator.h"
@@ -31,7 +30,7 @@
 #include "vtkGraphToPolyData.h"
 #include "vtkSphereSource.h"
 #include "vtkGlyph3D.h"
-#include "vtkMutableUndirectedGraph.h"
+#include "cipHelper.h"
 #include <cfloat>
 #include <math.h>
 
@@ -85,49 +84,21 @@ int vtkCIPAirwayParticlesToConnectedAirwayParticlesFilter::RequestData(vtkInform
 
 
   //
-  // Now create the weighted graph that will be passed to the minimum 
-  // spanning tree filter
+  // Now create the edges of the weighted graph (node IDs are particle
+  // IDs) that will be passed to the minimum spanning tree
+  // computation. Only particles within the distance threshold of each
+  // other are connected.
   // 
-  std::map< unsigned int, unsigned int > particleIDToNodeIDMap;
-  std::map< unsigned int, unsigned int > nodeIDToParticleIDMap;
+  std::vector< unsigned int > edgeParticles;
+  std::vector< double >       edgeWeights;
 
-  vtkSmartPointer< vtkMutableUndirectedGraph > weightedGraph =  
-    vtkSmartPointer< vtkMutableUndirectedGraph >::New();
-
-  for ( unsigned int i=0; i<this->NumberInputParticles; i++ )
-    {
-      vtkIdType nodeID = weightedGraph->AddVertex();
-
-      particleIDToNodeIDMap[i]      = nodeID;
-      nodeIDToParticleIDMap[nodeID] = i;
-    }
-
-  vtkSmartPointer< vtkDoubleArray > edgeWeights = vtkSmartPointer<vtkDoubleArray>::New();
-    edgeWeights->SetNumberOfComponents( 1 );
-    edgeWeights->SetName( "Weights" );
-
-  for ( unsigned int i=0; i<this->NumberInputParticles; i++ )
-    {
-      for ( unsigned int j=i+1; j<this->NumberInputParticles; j++ )
-	{
-	  double weight;
-	  
-	  if ( GetEdgeWeight( i, j, inputParticles, &weight ) )
-	    {
-	      weightedGraph->AddEdge( particleIDToNodeIDMap[i], particleIDToNodeIDMap[j] );
-	      edgeWeights->InsertNextValue( weight );
-	    }
-	}
-    }
-
-  weightedGraph->GetEdgeData()->AddArray( edgeWeights );
+  cip::GetParticleGraphEdges( inputParticles, "hevec2", this->ParticleDistanceThreshold, this->EdgeWeightAngleSigma,
+                              &edgeParticles, &edgeWeights );
 
   std::cout << "Computing minimum spanning tree..." << std::endl;
-  vtkSmartPointer< vtkBoostKruskalMinimumSpanningTree > minimumSpanningTreeFilter = 
-    vtkSmartPointer< vtkBoostKruskalMinimumSpanningTree >::New();
-    minimumSpanningTreeFilter->SetInputData( weightedGraph );
-    minimumSpanningTreeFilter->SetEdgeWeightArrayName( "Weights" );
-    minimumSpanningTreeFilter->Update();
+  std::vector< unsigned int > minimumSpanningTreeEdges;
+
+  cip::GetMinimumSpanningForestEdges( this->NumberInputParticles, edgeParticles, edgeWeights, &minimumSpanningTreeEdges );
 
   //------------------------------------
   // std::cout << "Querying..." << std::endl;
@@ -559,58 +530,6 @@ int vtkCIPAirwayParticlesToConnectedAirwayParticlesFilter::RequestData(vtkInform
 // }
  
 
-bool vtkCIPAirwayParticlesToConnectedAirwayParticlesFilter::GetEdgeWeight( unsigned int particleID1, unsigned int particleID2, 
-									   vtkSmartPointer< vtkPolyData > particles, double* weight )
-{
-  //
-  // Determine the vector connecting the two particles
-  //
-  double point1[3];
-    point1[0] = particles->GetPoint( particleID1 )[0];
-    point1[1] = particles->GetPoint( particleID1 )[1];
-    point1[2] = particles->GetPoint( particleID1 )[2];
-
-  double point2[3];
-    point2[0] = particles->GetPoint( particleID2 )[0];
-    point2[1] = particles->GetPoint( particleID2 )[1];
-    point2[2] = particles->GetPoint( particleID2 )[2];
-
-  double connectingVec[3];
-    connectingVec[0] = point1[0] - point2[0];
-    connectingVec[1] = point1[1] - point2[1];
-    connectingVec[2] = point1[2] - point2[2];
-
-  double connectorMagnitude = this->GetVectorMagnitude( connectingVec );
-
-  if ( connectorMagnitude > this->ParticleDistanceThreshold )
-    {
-    return false;
-    }
-
-  double particle1Hevec2[3];
-    particle1Hevec2[0] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID1 )[0];
-    particle1Hevec2[1] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID1 )[1];
-    particle1Hevec2[2] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID1 )[2];
-
-  double particle2Hevec2[3];
-    particle2Hevec2[0] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID2 )[0];
-    particle2Hevec2[1] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID2 )[1];
-    particle2Hevec2[2] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID2 )[2];
-
-  double angle1 =  this->GetAngleBetweenVectors( particle1Hevec2, connectingVec, true );
-  double angle2 =  this->GetAngleBetweenVectors( particle2Hevec2, connectingVec, true );
-
-  if ( angle1 < angle2 )
-    {
-      *weight = connectorMagnitude*(1.0 + exp(-pow( (90.0 - angle1)/this->EdgeWeightAngleSigma, 2 )));
-    }
-  else
-    {
-      *weight = connectorMagnitude*(1.0 + exp(-pow( (90.0 - angle2)/this->EdgeWeightAngleSigma, 2 )));
-    }
-
-  return true;
-}
 
 //
 // This method initializes the data structure image. Each voxel in the
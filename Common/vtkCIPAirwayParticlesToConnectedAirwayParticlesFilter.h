@@ -330,7 +330,6 @@ private:
 
   /* std::map< unsigned int, unsigned int > ParticleIDToSubGraphMap; */
 
-  bool GetEdgeWeight( unsigned int, unsigned int, vtkSmartPointer< vtkPolyData >, double* );
 
   double       ParticleDistanceThreshold;
   /* double       ParticleAngleThreshold; */
@@ -11,7 +11,6 @@
 #include "cipChestConventions.h"
 #include "vtkMath.h"
 #include "vtkIdTypeArray.h"
-#include "vtkSelectionNode.h"
 #include "vtkIndent.h"
 #include "vtkExtractSelectedGraph.h"
 #include "vtkObjectFactory.h"
@@ -23,17 +22,14 @@
 #include "vtkFloatArray.h"
 #include "vtkPointData.h"
 #include "vtkBoostKruskalMinimumSpanningTree.h"
-#include "vtkVertexListIterator.h"
 #include "vtkMutableUndirectedGraph.h"
-#include "vtkBoostConnectedComponents.h"
-#include "vtkUnsignedIntArray.h"
 #include "vtkOutEdgeIterator.h"
 #include "vtkEdgeListIterator.h"
-#include "vtkInEdgeIterator.h"
+#include "vtkCriticalSection.h"
 #include "cipHelper.h"
 #include <cfloat>
 #include <math.h>
-#include <list>
+#include <algorithm>
 
 
 vtkStandardNewMacro( vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter );
@@ -47,6 +43,8 @@ vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::vtkCIPAirwayParti
 
   this->HMTMMode = true;
 
+  this->NumberOfThreads = vtkMultiThreader::GetGlobalDefaultNumberOfThreads();
+
   this->ParticleRootNodeID = -1; // Negative indicates no root node has been specified.
 
   // The values for computing the emission probabilities. These values were learned
@@ -265,6 +263,16 @@ void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::SetParticleR
   this->ParticleRootNodeID = int(nodeID);
 }
 
+double vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::GetParticleLabelingScore( unsigned int particleID ) const
+{
+  if ( particleID >= this->ParticleLabelingScores.size() )
+    {
+      return -DBL_MAX;
+    }
+
+  return this->ParticleLabelingScores[particleID];
+}
+
 vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::~vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter()
 {  
 }
@@ -297,12 +305,15 @@ int vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::RequestData(v
   // this function will fill 'this->ParticleIDToAirwayGenerationMap'
   // for subsequent use.
   this->InitializeAirwayGenerationAssignments( this->NumberInputParticles );
+  this->ParticleLabelingScores.assign( this->NumberInputParticles, -DBL_MAX );
   
   // Compute the emission probabilities. We only need to do this once. 
   // The emission probabilites are independent of the graph structure
   // of the particles. Calling this function will fill out
-  // 'this->ParticleIDToEmissionProbabilitiesMap' for subsequent use.
+  // 'this->EmissionProbabilities' and 'this->EmissionWeights' for
+  // subsequent use.
   std::cout << "---Initializing emission probs..." << std::endl;
+  this->InitializeParticleData( inputParticles );
   this->InitializeEmissionProbabilites( inputParticles );
   std::cout << "---DONE." << std::endl;  
 
@@ -325,84 +336,24 @@ int vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::RequestData(v
       this->InitializeSubGraphs( this->MinimumSpanningTree, inputParticles );
       std::cout << "---DONE." << std::endl;
 
+      // Compute, for every edge of every subgraph and in both directions,
+      // the transition weights between the states of its two particles.
+      // They only depend on the particles, so they are shared by all the
+      // trellises of a subgraph. Calling this function will fill out the
+      // compact representation of each subgraph for subsequent use.
+      std::cout << "---Initializing transition weights..." << std::endl;
+      this->InitializeTransitionWeights();
+      std::cout << "---DONE." << std::endl;
+
       // Now for each subgraph, consider each leaf node in turn, assume
       // it is the root node, and perform the labeling. Whichever leaf node
       // acts as the most probable root node (based on the greatest likelihood)
       // will be considered the true root node for that subtree, and the 
-      // corresponding generation labels will be used.
-      for ( unsigned int i=0; i<this->Subgraphs.size(); i++ )
-	{
-	  // If the root node is known and specified, use it. Otherwise, find the leaf node most likely
-	  // to the root node
-	  bool rootNodeFound = false;
-	  if ( this->ParticleRootNodeID >= 0 )
-	    {
-	      // Do a quick check to see if the specified root node is in fact a valid
-	      // leaf node for the subgraph being considered
-	      for ( unsigned int j=0; j<this->Subgraphs[i].leafNodeIDs.size(); j++ )
-		{
-		  vtkIdType nodeId = this->Subgraphs[i].leafNodeIDs[j];
-		  unsigned int particleID = this->Subgraphs[i].nodeIDToParticleIDMap[nodeId];
-
-		  if ( particleID == this->ParticleRootNodeID )
-		    {
-		      rootNodeFound = true;
-		      break;
-		    }
-		}
-
-	      if ( rootNodeFound )
-		{
-		  vtkIdType rootNodeID = this->Subgraphs[i].particleIDToNodeIDMap[this->ParticleRootNodeID];		  
-		  vtkSmartPointer< vtkMutableDirectedGraph > trellisGraph = vtkSmartPointer< vtkMutableDirectedGraph >::New();
-		  
-		  std::cout << "---Getting trellis graph from subgraph..." << std::endl;
-		  this->GetTrellisGraphFromSubgraph( &this->Subgraphs[i], rootNodeID, trellisGraph, inputParticles );
-		  //cip::ViewGraph( trellisGraph );
-		  std::cout << "---DONE." << std::endl;
-
-		  std::map< unsigned int, unsigned char > tmpParticleIDToGenerationLabelMap;
-	      
-		  std::cout << "---Computing generation labels from trellis graph..." << std::endl;
-		  this->ComputeGenerationLabelsFromTrellisGraph( trellisGraph, &tmpParticleIDToGenerationLabelMap );
-		  std::cout << "---DONE." << std::endl;
-
-		  std::cout << "---Updating airway generation assignments..." << std::endl;
-		  this->UpdateAirwayGenerationAssignments( &tmpParticleIDToGenerationLabelMap );	    	
-		  std::cout << "---DONE." << std::endl;
-		}
-	      else
-		{
-		  std::cout << "WARNING: Root node specified, but not found" << std::endl;
-		}
-	    }
-	  else if ( !rootNodeFound )
-	    {
-	      double maxScore = -DBL_MAX;     
-	      for ( unsigned int j=0; j<this->Subgraphs[i].leafNodeIDs.size(); j++ )
-	        {
-	          vtkSmartPointer< vtkMutableDirectedGraph > trellisGraph = vtkSmartPointer< vtkMutableDirectedGraph >::New();
-	      
-	          std::cout << "---Getting trellis graph from subgraph..." << std::endl;
-	          this->GetTrellisGraphFromSubgraph( &this->Subgraphs[i], this->Subgraphs[i].leafNodeIDs[j], trellisGraph, inputParticles );
-	          std::cout << "---DONE." << std::endl;
-	      
-	          // If the labeling that the following function call determines is best so 
-	          // far, record the labels in 'this->ParticleIDToGenerationLabel'
-	          std::map< unsigned int, unsigned char > tmpParticleIDToGenerationLabelMap;
-	      
-	          std::cout << "---Computing generation labels from trellis graph..." << std::endl;
-	          double score = this->ComputeGenerationLabelsFromTrellisGraph( trellisGraph, &tmpParticleIDToGenerationLabelMap );
-	          std::cout << "---DONE." << std::endl;
-
-	          if ( score > maxScore )
-		    {
-		      maxScore = score;		      
-		      this->UpdateAirwayGenerationAssignments( &tmpParticleIDToGenerationLabelMap );
-		    }
-	        }
-	    }
-	}      
+      // corresponding generation labels will be used. If the root node is
+      // known and specified, it is used instead.
+      std::cout << "---Decoding subgraphs..." << std::endl;
+      this->DecodeSubgraphs();
+      std::cout << "---DONE." << std::endl;
     }
 
   // At this point, 'ParticleIDToAirwayGenerationMap' should be up to date, either by applying KDE based
@@ -463,123 +414,172 @@ void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::InitializeAi
     }
 }
 
-void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::InitializeEmissionProbabilites( vtkSmartPointer< vtkPolyData > inputParticles )
+// Data shared by the threads that compute the emission probabilities.
+// 'points', 'scales', 'directions' and 'directionMagnitudes' hold the
+// input particle quantities as they are used by the kernel density
+// estimation, and 'probabilities' receives 'NumberOfStates' values per
+// particle.
+struct EMISSIONTHREADSTRUCT
 {
-  const double PI = 3.141592653589793238462;
-  float  state;
-  double mean, std, tmp; //Used for Kernel density estimation computation
+  const vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter* filter;
+  const double*  points;
+  const float*   scales;
+  const double*  directions;
+  const double*  directionMagnitudes;
+  unsigned int   numberOfParticles;
+  unsigned int   numberOfStates;
+  double*        probabilities;
+};
+
+
+// Orders atlas particle IDs by one of the coordinates of their points
+struct ATLASPOINTORDER
+{
+  ATLASPOINTORDER( const double* points, unsigned int dimension ) : points( points ), dimension( dimension ) {}
 
-  // For every particle in the unlabeled dataset, we'll compute the kernel
-  // density estimated probability that it belongs to each airway generation 
-  for ( unsigned int p=0; p<this->NumberInputParticles; p++ )
-    {
-      std::map< unsigned char, double > probabilities;
-      for ( unsigned int i=0; i<this->NumberOfStates; i++ )
-	{
-	  probabilities[this->States[i]] = 1e-100;//DBL_MIN;
-	}
+  bool operator()( unsigned int particle1, unsigned int particle2 ) const
+  {
+    return this->points[3*particle1 + this->dimension] < this->points[3*particle2 + this->dimension];
+  }
 
-      std::map< float, double >       probabilityAccumulatorMap;
-      std::map< float, unsigned int > counterMap;
+  const double* points;
+  unsigned int  dimension;
+};
 
-      for ( unsigned int i=0; i<this->NumberOfStates; i++ )
-	{
-	  probabilityAccumulatorMap[static_cast< float >( this->States[i] )]  = 1e-100;//DBL_MIN;
-	  counterMap[static_cast< float >( this->States[i] )]                 = 0;
-	}
 
-      float scale1 = inputParticles->GetPointData()->GetArray( "scale" )->GetTuple( p )[0];
+// Same computation as 'cip::GetAngleBetweenVectors' (with the angle
+// returned in degrees) for vectors whose magnitudes are known
+static double GetAngleInDegreesBetweenVectors( const double* vec1, double vec1Mag, const double* vec2, double vec2Mag )
+{
+  double arg = (vec1[0]*vec2[0] + vec1[1]*vec2[1] + vec1[2]*vec2[2])/(vec1Mag*vec2Mag);
 
-      float point1[3];
-        point1[0] = inputParticles->GetPoint( p )[0];
-	point1[1] = inputParticles->GetPoint( p )[1];
-	point1[2] = inputParticles->GetPoint( p )[2];
+  if ( vcl_abs( arg ) > 1.0 )
+    {
+      arg = 1.0;
+    }
 
-      cip::VectorType particle1Hevec2(3);
-        particle1Hevec2[0] = inputParticles->GetPointData()->GetArray( "hevec2" )->GetTuple( p )[0];
-	particle1Hevec2[1] = inputParticles->GetPointData()->GetArray( "hevec2" )->GetTuple( p )[1];
-	particle1Hevec2[2] = inputParticles->GetPointData()->GetArray( "hevec2" )->GetTuple( p )[2];
+  double angleInDegrees = (180.0/vnl_math::pi)*vcl_acos( arg );
 
-      for ( unsigned int a=0; a<this->AirwayGenerationLabeledAtlases.size(); a++ )
-	{
-	  for ( unsigned int g=0; g<this->AirwayGenerationLabeledAtlases[a]->GetNumberOfPoints(); g++ )
-	    {
-	      state = this->AirwayGenerationLabeledAtlases[a]->GetPointData()->GetArray( "ChestType" )->GetTuple( g )[0];
-	      
-	      float scale2 = this->AirwayGenerationLabeledAtlases[a]->GetPointData()->GetArray( "scale" )->GetTuple( g )[0];
-	      
-	      cip::PointType point2(3);
-	        point2[0] = this->AirwayGenerationLabeledAtlases[a]->GetPoint( g )[0];
-		point2[1] = this->AirwayGenerationLabeledAtlases[a]->GetPoint( g )[1];
-		point2[2] = this->AirwayGenerationLabeledAtlases[a]->GetPoint( g )[2];
+  if ( angleInDegrees > 90.0 )
+    {
+      angleInDegrees = 180.0 - angleInDegrees;
+    }
 
-	      cip::VectorType connectingVec(3);
-                connectingVec[0] = point1[0] - point2[0];
-		connectingVec[1] = point1[1] - point2[1];
-		connectingVec[2] = point1[2] - point2[2];
+  return angleInDegrees;
+}
 
-	      double distance = cip::GetVectorMagnitude( connectingVec );
 
-	      cip::VectorType particle2Hevec2(3);
-  	        particle2Hevec2[0] = this->AirwayGenerationLabeledAtlases[a]->GetPointData()->GetArray( "hevec2" )->GetTuple( g )[0];
-		particle2Hevec2[1] = this->AirwayGenerationLabeledAtlases[a]->GetPointData()->GetArray( "hevec2" )->GetTuple( g )[1];
-		particle2Hevec2[2] = this->AirwayGenerationLabeledAtlases[a]->GetPointData()->GetArray( "hevec2" )->GetTuple( g )[2];
+// Gathers the input particle quantities that are used to compute the
+// emission and transition probabilities
+void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::InitializeParticleData( vtkSmartPointer< vtkPolyData > inputParticles )
+{
+  this->ParticleScales.resize( this->NumberInputParticles );
+  this->ParticleDirections.resize( 3*this->NumberInputParticles );
+  this->ParticleDirectionMagnitudes.resize( this->NumberInputParticles );
 
-	      double angle =  cip::GetAngleBetweenVectors( particle1Hevec2, particle2Hevec2, true );
+  vtkDataArray* scaleArray  = inputParticles->GetPointData()->GetArray( "scale" );
+  vtkDataArray* hevec2Array = inputParticles->GetPointData()->GetArray( "hevec2" );
 
-	      // Compute the kernel density estimation contribution. Note that it is the
-	      // product of Guassians (for scale, position, and direction)
-	      if ( distance < this->KernelDensityEstimationROIRadius )
-		{		  
-		  tmp  = 1.0;
+  for ( unsigned int p=0; p<this->NumberInputParticles; p++ )
+    {
+      this->ParticleScales[p] = scaleArray->GetTuple( p )[0];
 
-		  // Compute the scale contribution
-		  tmp  *= 1.0/(sqrt(2.0*PI)*this->EmissionScaleSigma)*exp(-0.5*pow((scale1-scale2-this->EmissionScaleMu)/this->EmissionScaleSigma, 2.0));
+      hevec2Array->GetTuple( p, &this->ParticleDirections[3*p] );
 
-		  // Compute the distance contribution
-		  tmp *= this->EmissionDistanceLambda*exp( -this->EmissionDistanceLambda*angle );
+      this->ParticleDirectionMagnitudes[p] = cip::GetVectorMagnitude( cip::Vector3( &this->ParticleDirections[3*p] ) );
+    }
+}
 
-		  // Compute the angle contribution
-		  tmp *= this->EmissionAngleLambda*exp( -this->EmissionAngleLambda*angle );
 
-		  probabilityAccumulatorMap[state] += tmp;
-		  counterMap[state] += 1;
-		}
-	    }
+void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::InitializeEmissionProbabilites( vtkSmartPointer< vtkPolyData > inputParticles )
+{
+  this->InitializeAtlasIndices();
+
+  // Gather the input particle points and scales as they are used by the
+  // kernel density estimation. They are stored with single precision,
+  // as they always have been for the estimation.
+  std::vector< double > points( 3*this->NumberInputParticles );
+  std::vector< float >  scales( this->NumberInputParticles );
+
+  for ( unsigned int p=0; p<this->NumberInputParticles; p++ )
+    {
+      double point[3];
+      inputParticles->GetPoint( p, point );
+      for ( unsigned int d=0; d<3; d++ )
+	{
+	  points[3*p + d] = static_cast< float >( point[d] );
 	}
-    
-      //probabilities[this->States[0]] = 1e-200;//this->NoiseProbability;
-      for ( unsigned int i=0; i<this->NumberOfStates; i++ )
-      	{      
-      	  state = static_cast< float >( this->States[i] );
-      	  if ( counterMap[state] > 0 )
-      	    {
-      	      probabilities[state] = probabilityAccumulatorMap[state]/static_cast< double >( counterMap[state] );	 
-      	    }
-      	}
-      
-      // Now normalize the probabilities so that they sum to one
-      double sum = 0.0;
-      for ( unsigned int i=0; i<this->NumberOfStates; i++ )
+
+      scales[p] = this->ParticleScales[p];
+    }
+
+  // For every particle in the unlabeled dataset, we'll compute the kernel
+  // density estimated probability that it belongs to each airway generation.
+  // The particles are independent of each other, so they are split
+  // across threads.
+  this->EmissionProbabilities.assign( this->NumberInputParticles*this->NumberOfStates, 0.0 );
+  this->EmissionWeights.assign( this->NumberInputParticles*this->NumberOfStates, 0.0 );
+
+  EMISSIONTHREADSTRUCT str;
+    str.filter              = this;
+    str.points              = points.empty() ? 0 : &points[0];
+    str.scales              = scales.empty() ? 0 : &scales[0];
+    str.directions          = this->ParticleDirections.empty() ? 0 : &this->ParticleDirections[0];
+    str.directionMagnitudes = this->ParticleDirectionMagnitudes.empty() ? 0 : &this->ParticleDirectionMagnitudes[0];
+    str.numberOfParticles   = this->NumberInputParticles;
+    str.numberOfStates      = this->NumberOfStates;
+    str.probabilities       = this->EmissionProbabilities.empty() ? 0 : &this->EmissionProbabilities[0];
+
+  unsigned int numberOfThreads = static_cast< unsigned int >( this->NumberOfThreads );
+  if ( numberOfThreads > this->NumberInputParticles )
+    {
+      numberOfThreads = this->NumberInputParticles;
+    }
+
+  if ( numberOfThreads <= 1 )
+    {
+      std::vector< unsigned int > atlasParticles;
+      for ( unsigned int p=0; p<this->NumberInputParticles; p++ )
 	{
-	  sum += probabilities[this->States[i]];
+	  this->ComputeEmissionProbabilities( &points[3*p], scales[p], str.directions + 3*p, str.directionMagnitudes[p],
+					      &atlasParticles, &this->EmissionProbabilities[p*this->NumberOfStates] );
 	}
+    }
+  else
+    {
+      vtkMultiThreader* threader = vtkMultiThreader::New();
+        threader->SetNumberOfThreads( numberOfThreads );
+	threader->SetSingleMethod( vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::EmissionProbabilitiesThreaderCallback, &str );
+	threader->SingleMethodExecute();
+	threader->Delete();
+    }
+
+  for ( unsigned int p=0; p<this->NumberInputParticles; p++ )
+    {
+      const double* probabilities = &this->EmissionProbabilities[p*this->NumberOfStates];
+
+      // The decoding works with the logs of the emission probabilities
       for ( unsigned int i=0; i<this->NumberOfStates; i++ )
 	{
-	  probabilities[this->States[i]] = probabilities[this->States[i]]/sum;
+	  if ( probabilities[i] < 1e-200 )
+	    {
+	      this->EmissionWeights[p*this->NumberOfStates + i] = -1e100;
+	    }
+	  else
+	    {
+	      this->EmissionWeights[p*this->NumberOfStates + i] = log( probabilities[i] );
+	    }
 	}
 
-      this->ParticleIDToEmissionProbabilitiesMap[p] = probabilities;
-
       // Now update 'ParticleIDToAirwayGenerationMap' in case the user wants to assign 
       // generation labels based only on KDE-based classification      
       double maxProb = 0.0;
       unsigned int best;
       for ( unsigned int i=0; i<this->NumberOfStates; i++ )
 	{
-	  if ( probabilities[this->States[i]] > maxProb )
+	  if ( probabilities[i] > maxProb )
 	    {
-	      maxProb = probabilities[this->States[i]];
+	      maxProb = probabilities[i];
 	      best = this->States[i];
 	    }
 	}
@@ -588,92 +588,365 @@ void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::InitializeEm
 }
 
 
-void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::InitializeSubGraphs( vtkSmartPointer< vtkMutableUndirectedGraph > spanningTree,
-											 vtkSmartPointer< vtkPolyData > particles )
+VTK_THREAD_RETURN_TYPE vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::EmissionProbabilitiesThreaderCallback( void* arg )
 {
-  vtkSmartPointer< vtkBoostConnectedComponents > connectedComponents = vtkSmartPointer< vtkBoostConnectedComponents >::New();
-    connectedComponents->SetInputData( spanningTree );
-    connectedComponents->Update();
-  
-  vtkSmartPointer< vtkIntArray > components = 
-    vtkIntArray::SafeDownCast( connectedComponents->GetOutput()->GetVertexData()->GetArray("component") );
-      
-  // Get a unique list of the component numbers
-  std::list< unsigned int > componentNumberList;
-  for( unsigned int i = 0; i < components->GetNumberOfTuples(); i++ )
+  unsigned int threadId        = ((ThreadInfoStruct *)(arg))->ThreadID;
+  unsigned int numberOfThreads = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  EMISSIONTHREADSTRUCT* str    = (EMISSIONTHREADSTRUCT *)(((ThreadInfoStruct *)(arg))->UserData);
+
+  std::vector< unsigned int > atlasParticles;
+  for ( unsigned int p=threadId; p<str->numberOfParticles; p += numberOfThreads )
     {
-      componentNumberList.push_back( components->GetValue(i) ); 
+      str->filter->ComputeEmissionProbabilities( str->points + 3*p, str->scales[p], str->directions + 3*p, str->directionMagnitudes[p],
+						 &atlasParticles, str->probabilities + p*str->numberOfStates );
     }
-  componentNumberList.unique();
-  componentNumberList.sort();
-  componentNumberList.unique();
 
-  // Now fill out the subgraphs
-  std::list< unsigned int >::iterator it;
-  for ( it = componentNumberList.begin(); it != componentNumberList.end(); it++ )
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+
+void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::ComputeEmissionProbabilities( const double* point, float scale1,
+												  const double* direction, double directionMagnitude,
+												  std::vector< unsigned int >* atlasParticles,
+												  double* probabilities ) const
+{
+  const double PI = 3.141592653589793238462;
+  double tmp; //Used for Kernel density estimation computation
+
+  // Only atlas particles closer than the ROI radius contribute to the
+  // estimate. When a radius is set, they are found with the atlas k-d
+  // trees and visited in ID order, so that the contributions are summed
+  // in the same order as when every atlas particle is tested.
+  bool useROI = this->KernelDensityEstimationROIRadius < DBL_MAX;
+
+  std::vector< double >       probabilityAccumulators( this->NumberOfStates, 1e-100 );
+  std::vector< unsigned int > counters( this->NumberOfStates, 0 );
+
+  double scaleNormalization = 1.0/(sqrt(2.0*PI)*this->EmissionScaleSigma);
+
+  for ( unsigned int a=0; a<this->AtlasIndices.size(); a++ )
     {
-      SUBGRAPH tempSubgraph;
+      const ATLASINDEX& atlas = this->AtlasIndices[a];
 
-      vtkSmartPointer< vtkIdTypeArray > ids = vtkSmartPointer<vtkIdTypeArray>::New();
+      unsigned int numberOfAtlasParticles = static_cast< unsigned int >( atlas.scales.size() );
+      if ( useROI )
+	{
+	  atlasParticles->clear();
+	  this->GetAtlasParticlesInROI( atlas, 0, numberOfAtlasParticles, point, atlasParticles );
+	  std::sort( atlasParticles->begin(), atlasParticles->end() );
 
-      for( vtkIdType i = 0; i < components->GetNumberOfTuples(); i++ )
+	  numberOfAtlasParticles = static_cast< unsigned int >( atlasParticles->size() );
+	}
+
+      for ( unsigned int i=0; i<numberOfAtlasParticles; i++ )
 	{
-	  if ( components->GetValue( i ) == *it )
+	  unsigned int g = useROI ? (*atlasParticles)[i] : i;
+
+	  int state = atlas.stateIndices[g];
+	  if ( state < 0 )
+	    {
+	      continue;
+	    }
+
+	  const double* point2 = &atlas.points[3*g];
+
+	  double distance = vcl_sqrt( std::pow( point[0] - point2[0], 2 ) + std::pow( point[1] - point2[1], 2 ) +
+				     std::pow( point[2] - point2[2], 2 ) );
+
+	  // Compute the kernel density estimation contribution. Note that it is the
+	  // product of Guassians (for scale, position, and direction)
+	  if ( distance < this->KernelDensityEstimationROIRadius )
 	    {
-	      ids->InsertNextValue( i );
+	      double angle = GetAngleInDegreesBetweenVectors( direction, directionMagnitude,
+							      &atlas.directions[3*g], atlas.directionMagnitudes[g] );
+
+	      float scale2 = atlas.scales[g];
+
+	      tmp  = 1.0;
+
+	      // Compute the scale contribution
+	      tmp  *= scaleNormalization*exp(-0.5*pow((scale1-scale2-this->EmissionScaleMu)/this->EmissionScaleSigma, 2.0));
+
+	      // Compute the distance contribution
+	      tmp *= this->EmissionDistanceLambda*exp( -this->EmissionDistanceLambda*angle );
+
+	      // Compute the angle contribution
+	      tmp *= this->EmissionAngleLambda*exp( -this->EmissionAngleLambda*angle );
+
+	      probabilityAccumulators[state] += tmp;
+	      counters[state] += 1;
 	    }
 	}
-  
-      vtkSmartPointer< vtkSelectionNode > nodes = vtkSmartPointer< vtkSelectionNode >::New();
-        nodes->SetSelectionList( ids );
-	nodes->SetContentType( vtkSelectionNode::INDICES );
-	nodes->SetFieldType( vtkSelectionNode::VERTEX );
-
-      vtkSmartPointer< vtkSelection > selection = vtkSmartPointer< vtkSelection >::New();
-        selection->AddNode( nodes );
-      
-      vtkSmartPointer< vtkExtractSelectedGraph > extractSelectedGraph = vtkSmartPointer< vtkExtractSelectedGraph >::New();
-        extractSelectedGraph->SetInputData( 0, spanningTree );
-	extractSelectedGraph->SetInputData( 1, selection );
-	extractSelectedGraph->Update();
-     
-      vtkSmartPointer< vtkMutableUndirectedGraph > subgraph = vtkSmartPointer< vtkMutableUndirectedGraph >::New();
-	subgraph->ShallowCopy( extractSelectedGraph->GetOutput() );
-
-      tempSubgraph.undirectedGraph = subgraph;
-
-      this->Subgraphs.push_back( tempSubgraph );
     }
 
-  // For each subgraph, we want to associate the subgraphs node IDs to
-  // the particle IDs. Do this by comparing the physical points associated
-  // with the nodes in the subgraphs to the particle points. Also, determine
-  // the leaf node IDs for each subgraph, as indicated by a vertex degree being
-  // equal to 1.
-  for ( unsigned int i=0; i<this->Subgraphs.size(); i++ )
-    {     
-      for ( unsigned int j=0; j<this->Subgraphs[i].undirectedGraph->GetPoints()->GetNumberOfPoints(); j++ )
-	{	
-	  // Test if current subgraph node is leaf node
-	  if ( this->Subgraphs[i].undirectedGraph->GetDegree(j) == 1 )
+  for ( unsigned int i=0; i<this->NumberOfStates; i++ )
+    {
+      probabilities[i] = 1e-100;//DBL_MIN;
+      if ( counters[i] > 0 )
+	{
+	  probabilities[i] = probabilityAccumulators[i]/static_cast< double >( counters[i] );
+	}
+    }
+
+  // Now normalize the probabilities so that they sum to one
+  double sum = 0.0;
+  for ( unsigned int i=0; i<this->NumberOfStates; i++ )
+    {
+      sum += probabilities[i];
+    }
+  for ( unsigned int i=0; i<this->NumberOfStates; i++ )
+    {
+      probabilities[i] = probabilities[i]/sum;
+    }
+}
+
+
+void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::InitializeAtlasIndices()
+{
+  this->AtlasIndices.clear();
+  this->AtlasIndices.resize( this->AirwayGenerationLabeledAtlases.size() );
+
+  for ( unsigned int a=0; a<this->AirwayGenerationLabeledAtlases.size(); a++ )
+    {
+      vtkSmartPointer< vtkPolyData > atlasParticles = this->AirwayGenerationLabeledAtlases[a];
+      ATLASINDEX& atlas = this->AtlasIndices[a];
+
+      unsigned int numberOfAtlasParticles = atlasParticles->GetNumberOfPoints();
+
+      atlas.points.resize( 3*numberOfAtlasParticles );
+      atlas.scales.resize( numberOfAtlasParticles );
+      atlas.directions.resize( 3*numberOfAtlasParticles );
+      atlas.directionMagnitudes.resize( numberOfAtlasParticles );
+      atlas.stateIndices.resize( numberOfAtlasParticles );
+      atlas.treeParticles.resize( numberOfAtlasParticles );
+      atlas.treeSplitDimensions.resize( numberOfAtlasParticles );
+
+      vtkDataArray* chestTypeArray = atlasParticles->GetPointData()->GetArray( "ChestType" );
+      vtkDataArray* scaleArray     = atlasParticles->GetPointData()->GetArray( "scale" );
+      vtkDataArray* hevec2Array    = atlasParticles->GetPointData()->GetArray( "hevec2" );
+
+      for ( unsigned int g=0; g<numberOfAtlasParticles; g++ )
+	{
+	  atlasParticles->GetPoint( g, &atlas.points[3*g] );
+
+	  atlas.scales[g] = scaleArray->GetTuple( g )[0];
+
+	  hevec2Array->GetTuple( g, &atlas.directions[3*g] );
+
+	  atlas.directionMagnitudes[g] = cip::GetVectorMagnitude( cip::Vector3( &atlas.directions[3*g] ) );
+
+	  // Atlas particles whose type is not one of the states do not
+	  // contribute to any of the state probabilities
+	  float state = chestTypeArray->GetTuple( g )[0];
+
+	  atlas.stateIndices[g] = -1;
+	  for ( unsigned int i=0; i<this->NumberOfStates; i++ )
 	    {
-	      this->Subgraphs[i].leafNodeIDs.push_back(j);
+	      if ( state == static_cast< float >( this->States[i] ) )
+		{
+		  atlas.stateIndices[g] = i;
+		  break;
+		}
 	    }
 
-	  // Find mapping between particle IDs and subgraph node IDs
-	  for ( unsigned int k=0; k<this->NumberInputParticles; k++ )
+	  atlas.treeParticles[g] = g;
+	}
+
+      this->BuildAtlasTree( &atlas, 0, numberOfAtlasParticles );
+    }
+}
+
+
+// Builds the k-d tree of the atlas particles in the range [first, last)
+// of 'treeParticles'. The particles are split at the median of the
+// coordinate with the largest extent in the range.
+void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::BuildAtlasTree( ATLASINDEX* atlas, unsigned int first, unsigned int last )
+{
+  if ( first >= last )
+    {
+      return;
+    }
+
+  double minPoint[3];
+  double maxPoint[3];
+  for ( unsigned int d=0; d<3; d++ )
+    {
+      minPoint[d] = DBL_MAX;
+      maxPoint[d] = -DBL_MAX;
+    }
+  for ( unsigned int i=first; i<last; i++ )
+    {
+      const double* point = &atlas->points[3*atlas->treeParticles[i]];
+      for ( unsigned int d=0; d<3; d++ )
+	{
+	  minPoint[d] = std::min( minPoint[d], point[d] );
+	  maxPoint[d] = std::max( maxPoint[d], point[d] );
+	}
+    }
+
+  unsigned int splitDimension = 0;
+  for ( unsigned int d=1; d<3; d++ )
+    {
+      if ( maxPoint[d] - minPoint[d] > maxPoint[splitDimension] - minPoint[splitDimension] )
+	{
+	  splitDimension = d;
+	}
+    }
+
+  unsigned int middle = first + (last - first)/2;
+
+  std::nth_element( atlas->treeParticles.begin() + first, atlas->treeParticles.begin() + middle,
+		    atlas->treeParticles.begin() + last, ATLASPOINTORDER( &atlas->points[0], splitDimension ) );
+
+  atlas->treeSplitDimensions[middle] = static_cast< unsigned char >( splitDimension );
+
+  this->BuildAtlasTree( atlas, first, middle );
+  this->BuildAtlasTree( atlas, middle + 1, last );
+}
+
+
+// Appends to 'atlasParticles' the atlas particles of the subtree for the
+// range [first, last) of 'treeParticles' that may be closer to 'point'
+// than the ROI radius. Subtrees that lie entirely on the far side of a
+// splitting plane are skipped; the distances of the returned particles
+// still need to be tested.
+void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::GetAtlasParticlesInROI( const ATLASINDEX& atlas, unsigned int first,
+											    unsigned int last, const double* point,
+											    std::vector< unsigned int >* atlasParticles ) const
+{
+  if ( first >= last )
+    {
+      return;
+    }
+
+  unsigned int middle         = first + (last - first)/2;
+  unsigned int particle       = atlas.treeParticles[middle];
+  unsigned int splitDimension = atlas.treeSplitDimensions[middle];
+
+  atlasParticles->push_back( particle );
+
+  double difference = point[splitDimension] - atlas.points[3*particle + splitDimension];
+
+  if ( difference < this->KernelDensityEstimationROIRadius )
+    {
+      this->GetAtlasParticlesInROI( atlas, first, middle, point, atlasParticles );
+    }
+  if ( -difference < this->KernelDensityEstimationROIRadius )
+    {
+      this->GetAtlasParticlesInROI( atlas, middle + 1, last, point, atlasParticles );
+    }
+}
+
+
+void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::InitializeSubGraphs( vtkSmartPointer< vtkMutableUndirectedGraph > spanningTree,
+											 vtkSmartPointer< vtkPolyData > particles )
+{
+  this->Subgraphs.clear();
+
+  // The spanning tree vertices carry the IDs of the particles they
+  // represent as pedigree IDs (see 'InitializeMinimumSpanningTree'). If
+  // they are missing, the vertex IDs are the particle IDs.
+  vtkIdTypeArray* particleIDs = vtkIdTypeArray::SafeDownCast( spanningTree->GetVertexData()->GetPedigreeIds() );
+
+  vtkIdType numberOfVertices = spanningTree->GetNumberOfVertices();
+
+  // Partition the spanning tree into its connected components with a
+  // breadth first search from every vertex that has not been reached
+  // yet. The components are numbered in order of their lowest vertex
+  // ID, as 'vtkBoostConnectedComponents' does.
+  std::vector< int >       vertexComponents( numberOfVertices, -1 );
+  std::vector< vtkIdType > vertexQueue;
+  int                      numberOfComponents = 0;
+
+  vtkSmartPointer< vtkOutEdgeIterator > eIt = vtkSmartPointer< vtkOutEdgeIterator >::New();
+
+  for ( vtkIdType v=0; v<numberOfVertices; v++ )
+    {
+      if ( vertexComponents[v] >= 0 )
+	{
+	  continue;
+	}
+
+      vertexComponents[v] = numberOfComponents;
+      vertexQueue.clear();
+      vertexQueue.push_back( v );
+
+      for ( unsigned int q=0; q<vertexQueue.size(); q++ )
+	{
+	  spanningTree->GetOutEdges( vertexQueue[q], eIt );
+	  while ( eIt->HasNext() )
 	    {
-	      if ( this->Subgraphs[i].undirectedGraph->GetPoint(j)[0] == particles->GetPoint(k)[0] &&
-		   this->Subgraphs[i].undirectedGraph->GetPoint(j)[1] == particles->GetPoint(k)[1] &&
-		   this->Subgraphs[i].undirectedGraph->GetPoint(j)[2] == particles->GetPoint(k)[2] )
+	      vtkIdType target = eIt->Next().Target;
+	      if ( vertexComponents[target] < 0 )
 		{
-		  this->Subgraphs[i].nodeIDToParticleIDMap[j] = k;
-		  this->Subgraphs[i].particleIDToNodeIDMap[k] = j;
-
-		  break;
+		  vertexComponents[target] = numberOfComponents;
+		  vertexQueue.push_back( target );
 		}
 	    }
 	}
+
+      numberOfComponents++;
+    }
+
+  // Now fill out all the subgraphs in a single pass over the vertices and
+  // the edges of the spanning tree. Vertices are added to their subgraph in
+  // vertex ID order and edges in edge order, which is how they would be
+  // extracted with 'vtkExtractSelectedGraph'.
+  this->Subgraphs.resize( numberOfComponents );
+
+  std::vector< vtkSmartPointer< vtkPoints > >      subgraphPoints( numberOfComponents );
+  std::vector< vtkSmartPointer< vtkIdTypeArray > > subgraphParticleIDs( numberOfComponents );
+  for ( int c=0; c<numberOfComponents; c++ )
+    {
+      this->Subgraphs[c].undirectedGraph = vtkSmartPointer< vtkMutableUndirectedGraph >::New();
+
+      subgraphPoints[c] = vtkSmartPointer< vtkPoints >::New();
+
+      subgraphParticleIDs[c] = vtkSmartPointer< vtkIdTypeArray >::New();
+      subgraphParticleIDs[c]->SetNumberOfComponents( 1 );
+      subgraphParticleIDs[c]->SetName( "ParticleID" );
+    }
+
+  std::vector< vtkIdType > subgraphNodeIDs( numberOfVertices );
+  for ( vtkIdType v=0; v<numberOfVertices; v++ )
+    {
+      SUBGRAPH& subgraph = this->Subgraphs[vertexComponents[v]];
+
+      vtkIdType nodeID   = subgraph.undirectedGraph->AddVertex();
+      vtkIdType particle = particleIDs ? particleIDs->GetValue( v ) : v;
+
+      subgraphNodeIDs[v] = nodeID;
+      subgraph.nodeIDToParticleIDMap[nodeID]   = static_cast< unsigned int >( particle );
+      subgraph.particleIDToNodeIDMap[static_cast< unsigned int >( particle )] = nodeID;
+
+      subgraphParticleIDs[vertexComponents[v]]->InsertNextValue( particle );
+      subgraphPoints[vertexComponents[v]]->InsertNextPoint( particles->GetPoint( particle ) );
+    }
+
+  vtkSmartPointer< vtkEdgeListIterator > edgeIt = vtkSmartPointer< vtkEdgeListIterator >::New();
+  spanningTree->GetEdges( edgeIt );
+
+  while ( edgeIt->HasNext() )
+    {
+      vtkEdgeType edge = edgeIt->Next();
+
+      this->Subgraphs[vertexComponents[edge.Source]].undirectedGraph->AddEdge( subgraphNodeIDs[edge.Source], subgraphNodeIDs[edge.Target] );
+    }
+
+  // Determine the leaf node IDs for each subgraph, as indicated by a vertex
+  // degree being equal to 1.
+  for ( int c=0; c<numberOfComponents; c++ )
+    {
+      this->Subgraphs[c].undirectedGraph->SetPoints( subgraphPoints[c] );
+      this->Subgraphs[c].undirectedGraph->GetVertexData()->SetPedigreeIds( subgraphParticleIDs[c] );
+
+      for ( vtkIdType j=0; j<this->Subgraphs[c].undirectedGraph->GetNumberOfVertices(); j++ )
+	{
+	  if ( this->Subgraphs[c].undirectedGraph->GetDegree( j ) == 1 )
+	    {
+	      this->Subgraphs[c].leafNodeIDs.push_back( j );
+	    }
+	}
     }
 }
 
@@ -688,14 +961,25 @@ void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::InitializeMi
   vtkSmartPointer< vtkMutableUndirectedGraph > weightedGraph =  
     vtkSmartPointer< vtkMutableUndirectedGraph >::New();
 
+  // The particle IDs are attached to the vertices as pedigree IDs so
+  // that they are carried through the extraction of the spanning tree
+  // and of the subgraphs
+  vtkSmartPointer< vtkIdTypeArray > particleIDs = vtkSmartPointer< vtkIdTypeArray >::New();
+    particleIDs->SetNumberOfComponents( 1 );
+    particleIDs->SetName( "ParticleID" );
+
   for ( unsigned int i=0; i<this->NumberInputParticles; i++ )
     {
       vtkIdType nodeID = weightedGraph->AddVertex();
 
       particleIDToNodeIDMap[i]      = nodeID;
       nodeIDToParticleIDMap[nodeID] = i;
+
+      particleIDs->InsertNextValue( i );
     }
 
+  weightedGraph->GetVertexData()->SetPedigreeIds( particleIDs );
+
   vtkSmartPointer< vtkDoubleArray > edgeWeights = vtkSmartPointer<vtkDoubleArray>::New();
     edgeWeights->SetNumberOfComponents( 1 );
     edgeWeights->SetName( "Weights" );
@@ -746,10 +1030,7 @@ bool vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::GetEdgeWeigh
     point2[1] = particles->GetPoint( particleID2 )[1];
     point2[2] = particles->GetPoint( particleID2 )[2];
 
-  cip::VectorType connectingVec(3);
-    connectingVec[0] = point1[0] - point2[0];
-    connectingVec[1] = point1[1] - point2[1];
-    connectingVec[2] = point1[2] - point2[2];
+  cip::Vector3 connectingVec = cip::Vector3( point1 ) - cip::Vector3( point2 );
 
   double connectorMagnitude = cip::GetVectorMagnitude( connectingVec );
 
@@ -758,15 +1039,8 @@ bool vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::GetEdgeWeigh
     return false;
     }
 
-  cip::VectorType particle1Hevec2(3);
-    particle1Hevec2[0] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID1 )[0];
-    particle1Hevec2[1] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID1 )[1];
-    particle1Hevec2[2] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID1 )[2];
-
-  cip::VectorType particle2Hevec2(3);
-    particle2Hevec2[0] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID2 )[0];
-    particle2Hevec2[1] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID2 )[1];
-    particle2Hevec2[2] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID2 )[2];
+  cip::Vector3 particle1Hevec2( particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID1 ) );
+  cip::Vector3 particle2Hevec2( particles->GetPointData()->GetArray( "hevec2" )->GetTuple( particleID2 ) );
 
   double angle1 =  cip::GetAngleBetweenVectors( particle1Hevec2, connectingVec, true );
   double angle2 =  cip::GetAngleBetweenVectors( particle2Hevec2, connectingVec, true );
@@ -787,682 +1061,552 @@ bool vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::GetEdgeWeigh
 void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os,indent);
+  os << indent << "Number Of Threads: " << this->NumberOfThreads << "\n";
 }
 
 
-// See Bishop's 'Pattern Recognition and Machine Learning', Chpt. 13.2 for a discussion
-// of HMMs. Fig. 13.7 illustrates a trellis structure. It's through the trellis graph
-// that we'll find the optimal path that determines the best assignment of airway
-// generation states. We first need to create the trellis graph from a given
-// (undirected) subgraph. The trellis is computed with respect to the specified leaf
-// node ID. Each node in the trellis graph represents a hidden state (airway generation
-// or noise). Edges represent transitions from one state to the next.
-void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::GetTrellisGraphFromSubgraph( SUBGRAPH* graph, vtkIdType leafNodeID, 
-												 vtkSmartPointer< vtkMutableDirectedGraph > trellisGraph,
-												 vtkSmartPointer< vtkPolyData > particles )
+// Data shared by the threads that compute the transition weights. Each
+// task is a (directed) edge of a subgraph: the particle IDs of its
+// source and target nodes and where its 'NumberOfStates' x
+// 'NumberOfStates' weights go.
+struct TRANSITIONTHREADSTRUCT
 {
-  const double PI = 3.141592653589793238462;
+  const vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter* filter;
+  std::vector< unsigned int > sourceParticles;
+  std::vector< unsigned int > targetParticles;
+  std::vector< double* >      weights;
+};
+
+
+// Data shared by the threads that decode the subgraphs. Each task is a
+// subgraph and the index (in 'leafNodeIDs') of the leaf node used as
+// root. The threads take the tasks in turn, protected by 'lock', and
+// keep the best labeling of every subgraph: the one with the greatest
+// score, and among those the one with the lowest leaf index, as when
+// the leaf nodes are considered one after another.
+struct DECODINGTHREADSTRUCT
+{
+  const vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter* filter;
+  std::vector< unsigned int >                 taskSubgraphs;
+  std::vector< unsigned int >                 taskLeaves;
+  unsigned int                                nextTask;
+  bool                                        rootNodeSpecified;
+  vtkSimpleCriticalSection*                   lock;
+  std::vector< double >                       bestScores;
+  std::vector< int >                          bestLeaves;
+  std::vector< std::vector< unsigned char > > bestStates;
+};
+
+
+// Orders subgraph indices by decreasing number of nodes so that the
+// longest decoding tasks are started first
+struct SUBGRAPHSIZEORDER
+{
+  SUBGRAPHSIZEORDER( const std::vector< unsigned int >& sizes ) : sizes( sizes ) {}
 
-  // For every node in the subgraph, we'll want 'N' nodes in the trellis
-  // graph, where 'N' is the number of states. We need to keep track of 
-  // which nodes have been "expanded" into trellis nodes
-  std::map< unsigned int, bool > graphNodeVisited;
-  vtkSmartPointer< vtkVertexListIterator > vIt = vtkSmartPointer< vtkVertexListIterator >::New();
-    graph->undirectedGraph->GetVertices( vIt );
+  bool operator()( unsigned int subgraph1, unsigned int subgraph2 ) const
+  {
+    return this->sizes[subgraph1] > this->sizes[subgraph2];
+  }
 
-  while ( vIt->HasNext() )
-    {
-      graphNodeVisited[vIt->Next()] = false;
-    }
-
-  // To each of these 'N' nodes, we want to associate the corresponding 
-  // particle ID (same particle ID corresponding to the node in the subgraph) 
-  // and a label indicating the latent state the trellis node represents. The 
-  // particle IDs will be recorded in the trellis graphs 'particleIDArray', and 
-  // the states will be recorded in the 'stateArray'. Furthermore, for every node 
-  // in the trellis graph, we need to keep a record of the "best" parent node 
-  // (keeping in mind that a node in the subgraph may have more than one
-  // parent, and in that case we want to record the best trellis node
-  // parent for each parent node in the subgraph), where "best" means
-  // minimum cost incurred from the parent node and corresponding edge.
-  // We'll keep a record of whether or not an edge emitting from a 
-  // parent node is the "best" edge using a boolean valued array,
-  // 'bestEdgeArray'. For a given parent node in the subgraph, there
-  // should be one and only one 'true' valued edge from a parent node
-  // in the trellis graph to a child node in the trellis graph.
-  vtkSmartPointer< vtkUnsignedCharArray > bestEdgeArray = vtkSmartPointer< vtkUnsignedCharArray >::New();
-    bestEdgeArray->SetNumberOfComponents( 1 );
-    bestEdgeArray->SetName( "bestEdgeArray" );
-
-  vtkSmartPointer< vtkUnsignedIntArray > particleIDArray = vtkSmartPointer< vtkUnsignedIntArray >::New();
-    particleIDArray->SetNumberOfComponents( 1 );
-    particleIDArray->SetName( "particleIDArray" );
-
-  vtkSmartPointer< vtkUnsignedCharArray > stateArray = vtkSmartPointer< vtkUnsignedCharArray >::New();
-    stateArray->SetNumberOfComponents( 1 );
-    stateArray->SetName( "stateArray" );
-
-  vtkSmartPointer< vtkFloatArray > edgeWeightArray = vtkSmartPointer< vtkFloatArray >::New();
-    edgeWeightArray->SetNumberOfComponents( 1 );
-    edgeWeightArray->SetName( "edgeWeightArray" );
-
-  // The following array will keep a record of whether or not a given trellis node has an
-  // accumulated weight amount that is up to date (that is, all possible incoming paths
-  // have been considered)
-  vtkSmartPointer< vtkFloatArray > upToDateForForwardSearchArray = vtkSmartPointer< vtkFloatArray >::New();
-    upToDateForForwardSearchArray->SetNumberOfComponents( 1 );
-    upToDateForForwardSearchArray->SetName( "upToDateForForwardSearchArray" );
-
-  // During the modified Viterbi algorithm, we perform a forward search in
-  // order to find the most probable path through the trellis graph. Along the
-  // way we compute accumulated weights at each node. The 'accumulatedWeightArray'
-  // keeps track of these weights
-  vtkSmartPointer< vtkDoubleArray > accumulatedWeightArray = vtkSmartPointer< vtkDoubleArray >::New();
-    accumulatedWeightArray->SetNumberOfComponents( 1 );
-    accumulatedWeightArray->SetName( "accumulatedWeightArray" );
-
-  trellisGraph->GetVertexData()->AddArray( particleIDArray );
-  trellisGraph->GetVertexData()->AddArray( stateArray );
-  trellisGraph->GetVertexData()->AddArray( accumulatedWeightArray );
-  trellisGraph->GetVertexData()->AddArray( upToDateForForwardSearchArray );
-  trellisGraph->GetEdgeData()->AddArray( bestEdgeArray );
-  trellisGraph->GetEdgeData()->AddArray( edgeWeightArray );
-
-  // This variable will be used below by the recursive routine 
-  // 'AddStateNodesToTrellisGraph' to manage the connections 
-  // (new edges) between parent nodes (held by this variable)
-  // and the newly created state nodes.
-  std::vector< vtkIdType > trellisNodeIDGroup;
+  const std::vector< unsigned int >& sizes;
+};
 
-  for ( unsigned int i=0; i<this->NumberOfStates; i++ )
-    {     
-      vtkIdType id = trellisGraph->AddVertex();
 
-      trellisNodeIDGroup.push_back( id );
+// Orders subgraph nodes by the IDs of their particles
+struct NODEPARTICLEORDER
+{
+  NODEPARTICLEORDER( const std::vector< unsigned int >& particleIDs ) : particleIDs( particleIDs ) {}
 
-      float tmpState      = static_cast< float >( this->States[i] );
-      float tmpParticleID = static_cast< float >( (*graph).nodeIDToParticleIDMap[leafNodeID] );
-      float tmpWeight     = 0.0;
-      float tmpVisited    = 0.0;
-      float tmpUpToDate   = 0.0;
+  bool operator()( unsigned int node1, unsigned int node2 ) const
+  {
+    return this->particleIDs[node1] < this->particleIDs[node2];
+  }
 
-      trellisGraph->GetVertexData()->GetArray( "particleIDArray" )->InsertTuple( id, &tmpParticleID );
-      trellisGraph->GetVertexData()->GetArray( "stateArray" )->InsertTuple( id, &tmpState );
-      trellisGraph->GetVertexData()->GetArray( "accumulatedWeightArray" )->InsertTuple( id, &tmpWeight );
-      trellisGraph->GetVertexData()->GetArray( "upToDateForForwardSearchArray" )->InsertTuple( id, &tmpUpToDate );
+  const std::vector< unsigned int >& particleIDs;
+};
 
-      graphNodeVisited[leafNodeID] = true;
-    }
 
-  vtkSmartPointer< vtkOutEdgeIterator > eIt = vtkSmartPointer< vtkOutEdgeIterator >::New();
-  graph->undirectedGraph->GetOutEdges( leafNodeID, eIt );
+// See Bishop's 'Pattern Recognition and Machine Learning', Chpt. 13.2 for a discussion
+// of HMMs. Fig. 13.7 illustrates a trellis structure. It's through the trellis that
+// we find the optimal path that determines the best assignment of airway generation
+// states. The trellis of a subgraph with respect to a given root (leaf) node has
+// 'NumberOfStates' nodes per subgraph node, and every state node of a subgraph node
+// is connected to every state node of its parent. Rather than building the trellis
+// as a graph, we store the subgraph as adjacency arrays (see 'SUBGRAPH'), and the
+// weights of the trellis edges between two neighboring nodes, in both directions,
+// as 'NumberOfStates' x 'NumberOfStates' matrices. The weights do not depend on the
+// root node, so they are computed once per subgraph.
+void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::InitializeTransitionWeights()
+{
+  unsigned int numberOfWeights = this->NumberOfStates*this->NumberOfStates;
 
-  while( eIt->HasNext() )
-    { 
-      vtkOutEdgeType edge = eIt->Next();
-      if ( !graphNodeVisited[edge.Target] )
+  this->TransitionPriors.resize( numberOfWeights );
+  for ( unsigned int i=0; i<this->NumberOfStates; i++ )
+    {
+      for ( unsigned int j=0; j<this->NumberOfStates; j++ )
 	{
-	  this->AddStateNodesToTrellisGraph( trellisGraph, trellisNodeIDGroup, edge.Target, graph, &graphNodeVisited );
+	  double prior = 0.0;
+	  for ( unsigned int k=0; k<this->TransitionProbabilityPriors.size(); k++ )
+	    {
+	      if ( this->TransitionProbabilityPriors[k].sourceState == this->States[i] &&
+		   this->TransitionProbabilityPriors[k].targetState == this->States[j] )
+		{
+		  prior = this->TransitionProbabilityPriors[k].probability;
+		  break;
+		}
+	    }
+
+	  this->TransitionPriors[i*this->NumberOfStates + j] = prior;
 	}
     }
 
-  // Now that we have the trellis graph constructed, we need to 
-  // compute weights for each of the edges indicating the 
-  // transition probability from one state to the next
-  vtkSmartPointer< vtkEdgeListIterator > trellisEdgeIt = vtkSmartPointer< vtkEdgeListIterator >::New();
+  TRANSITIONTHREADSTRUCT str;
+    str.filter = this;
 
-  trellisGraph->GetEdges( trellisEdgeIt );
-
-  double weight;
-  while( trellisEdgeIt->HasNext() )
-    {
-      vtkEdgeType edge = trellisEdgeIt->Next();
-
-      // Get the particle ID of the source and target nodes
-      float sourceParticleID = trellisGraph->GetVertexData()->GetArray( "particleIDArray" )->GetTuple( edge.Source )[0];
-      float targetParticleID = trellisGraph->GetVertexData()->GetArray( "particleIDArray" )->GetTuple( edge.Target )[0];
-     
-      // Get the states of the source and target nodes
-      unsigned char sourceState = static_cast< unsigned char >( trellisGraph->GetVertexData()->GetArray( "stateArray" )->GetTuple( edge.Source )[0] );
-      unsigned char targetState = static_cast< unsigned char >( trellisGraph->GetVertexData()->GetArray( "stateArray" )->GetTuple( edge.Target )[0] );
-
-      // Get the probability to assign to the edge     
-      vtkIdType targetGraphNodeID = graph->particleIDToNodeIDMap[targetParticleID];
-      double probability = this->GetTransitionProbability( sourceParticleID, targetParticleID, sourceState, targetState, particles );
-      trellisGraph->GetEdgeData()->GetArray( "edgeWeightArray" )->InsertTuple( edge.Id, &probability );
-    }
-
-  // The 'while' loop just executed sets preliminary probabilities for each of
-  // the edges in the trellis graph. These must now be normalized. The probability
-  // of a given node (state) in the trellis diagram transitioning to *something* is
-  // 1.0. Thus, we must loop over all edges emanating from each node and normalize
-  // their values so they add up to 1.0.
-  vtkSmartPointer< vtkVertexListIterator > trellisVertexIt = vtkSmartPointer< vtkVertexListIterator >::New();
-  trellisGraph->GetVertices( trellisVertexIt );
+  vtkSmartPointer< vtkOutEdgeIterator > eIt = vtkSmartPointer< vtkOutEdgeIterator >::New();
 
-  while ( trellisVertexIt->HasNext() )
+  for ( unsigned int s=0; s<this->Subgraphs.size(); s++ )
     {
-      vtkIdType stateNodeID = trellisVertexIt->Next();
-
-      // Loop over all the edges emanating from this node
-      vtkSmartPointer< vtkOutEdgeIterator > outEdgeIt = vtkSmartPointer< vtkOutEdgeIterator >::New();
-      trellisGraph->GetOutEdges( stateNodeID, outEdgeIt );
+      SUBGRAPH& subgraph = this->Subgraphs[s];
 
-      double accum = 0.0;
-      while ( outEdgeIt->HasNext() )
-	{	 
-	  vtkOutEdgeType edge = outEdgeIt->Next();
+      unsigned int numberOfNodes = static_cast< unsigned int >( subgraph.undirectedGraph->GetNumberOfVertices() );
 
-	  accum += trellisGraph->GetEdgeData()->GetArray( "edgeWeightArray" )->GetTuple( edge.Id )[0];
-	}
+      subgraph.particleIDs.resize( numberOfNodes );
+      subgraph.neighborOffsets.resize( numberOfNodes + 1 );
+      subgraph.neighbors.clear();
 
-      // Now loop over the edges again, and normalize the weights so that
-      // they add up to one 
-      trellisGraph->GetOutEdges( stateNodeID, outEdgeIt );
-      while ( outEdgeIt->HasNext() )
+      for ( unsigned int n=0; n<numberOfNodes; n++ )
 	{
-	  vtkOutEdgeType edge = outEdgeIt->Next();
+	  subgraph.particleIDs[n]     = subgraph.nodeIDToParticleIDMap[n];
+	  subgraph.neighborOffsets[n] = static_cast< unsigned int >( subgraph.neighbors.size() );
 
-	  double newWeight;
-	  if ( accum == 0.0 )
+	  subgraph.undirectedGraph->GetOutEdges( n, eIt );
+	  while ( eIt->HasNext() )
 	    {
-	      newWeight = 1.0/double(this->NumberOfStates);
+	      subgraph.neighbors.push_back( static_cast< unsigned int >( eIt->Next().Target ) );
 	    }
-	  else
+	}
+      subgraph.neighborOffsets[numberOfNodes] = static_cast< unsigned int >( subgraph.neighbors.size() );
+
+      subgraph.transitionWeights.resize( subgraph.neighbors.size()*numberOfWeights );
+    }
+
+  // The weight matrices are only filled once every subgraph has been
+  // allocated, so that the pointers handed to the threads stay valid
+  for ( unsigned int s=0; s<this->Subgraphs.size(); s++ )
+    {
+      SUBGRAPH& subgraph = this->Subgraphs[s];
+
+      for ( unsigned int n=0; n+1<subgraph.neighborOffsets.size(); n++ )
+	{
+	  for ( unsigned int k=subgraph.neighborOffsets[n]; k<subgraph.neighborOffsets[n+1]; k++ )
 	    {
-	      newWeight = trellisGraph->GetEdgeData()->GetArray( "edgeWeightArray" )->GetTuple( edge.Id )[0]/accum;
+	      str.sourceParticles.push_back( subgraph.particleIDs[n] );
+	      str.targetParticles.push_back( subgraph.particleIDs[subgraph.neighbors[k]] );
+	      str.weights.push_back( &subgraph.transitionWeights[k*numberOfWeights] );
 	    }
+	}
+    }
 
-	  trellisGraph->GetEdgeData()->GetArray( "edgeWeightArray" )->SetTuple( edge.Id, &newWeight );
+  unsigned int numberOfThreads = static_cast< unsigned int >( this->NumberOfThreads );
+  if ( numberOfThreads > str.weights.size() )
+    {
+      numberOfThreads = static_cast< unsigned int >( str.weights.size() );
+    }
+
+  if ( numberOfThreads <= 1 )
+    {
+      for ( unsigned int e=0; e<str.weights.size(); e++ )
+	{
+	  this->ComputeTransitionWeights( str.sourceParticles[e], str.targetParticles[e], str.weights[e] );
 	}
     }
+  else
+    {
+      vtkMultiThreader* threader = vtkMultiThreader::New();
+        threader->SetNumberOfThreads( numberOfThreads );
+	threader->SetSingleMethod( vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::TransitionWeightsThreaderCallback, &str );
+	threader->SingleMethodExecute();
+	threader->Delete();
+    }
 }
 
-double vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::ComputeGenerationLabelsFromTrellisGraph( vtkSmartPointer< vtkMutableDirectedGraph > trellisGraph, 
-													       std::map< unsigned int, unsigned char >* particleIDToGenerationLabel )
+
+VTK_THREAD_RETURN_TYPE vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::TransitionWeightsThreaderCallback( void* arg )
 {
-  // Loop through all nodes and collect node IDs for those that have
-  // no parents. This is the set of non-root leaf nodes, and it's where we
-  // begin the forward search
-  vtkSmartPointer< vtkVertexListIterator > vIt = vtkSmartPointer< vtkVertexListIterator >::New();
-  trellisGraph->GetVertices( vIt );
-
-  std::vector< vtkIdType > nodeVec;
-  while ( vIt->HasNext() )
-    {
-      vtkIdType nodeID = vIt->Next();
-      if ( this->IsNonRootLeafNode( nodeID, trellisGraph ) )
-  	{
-  	  nodeVec.push_back( nodeID );
-
-  	  // The "accumulatedWeight" at these root nodes will just be the log of the
-  	  // emission probabilities
-  	  unsigned char state               = trellisGraph->GetVertexData()->GetArray( "stateArray" )->GetTuple( nodeID )[0];
-  	  float         particleID          = trellisGraph->GetVertexData()->GetArray( "particleIDArray" )->GetTuple( nodeID )[0];
-  	  float         visited             = 1.0;
-  	  float         upToDate            = 1.0;
-  	  double        emissionProbability = this->ParticleIDToEmissionProbabilitiesMap[static_cast< unsigned int >( particleID )][state];
-
-  	  double weight;
-  	  if ( emissionProbability < 1e-200 )
-  	    {
-  	      weight = -1e100;//-DBL_MAX;
-  	    }
-  	  else
-  	    {
-  	      weight = log( emissionProbability );
-  	    }
+  unsigned int threadId        = ((ThreadInfoStruct *)(arg))->ThreadID;
+  unsigned int numberOfThreads = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  TRANSITIONTHREADSTRUCT* str  = (TRANSITIONTHREADSTRUCT *)(((ThreadInfoStruct *)(arg))->UserData);
 
-  	  trellisGraph->GetVertexData()->GetArray( "accumulatedWeightArray" )->SetTuple( nodeID, &weight );
-  	  trellisGraph->GetVertexData()->GetArray( "upToDateForForwardSearchArray" )->SetTuple( nodeID, &upToDate );
-  	}
+  for ( unsigned int e=threadId; e<str->weights.size(); e += numberOfThreads )
+    {
+      str->filter->ComputeTransitionWeights( str->sourceParticles[e], str->targetParticles[e], str->weights[e] );
     }
 
-  // Now get all nodes pointed to by the leaf nodes
-  std::list< vtkIdType > nodeList;
-  for ( unsigned int i=0; i<nodeVec.size(); i++ )
-    {
-      vtkSmartPointer< vtkOutEdgeIterator > it = vtkSmartPointer< vtkOutEdgeIterator >::New();
-      trellisGraph->GetOutEdges( nodeVec[i], it );
-      
-      while( it->HasNext() )
-      	{
-      	  vtkIdType tmpID = it->Next().Target;
-      	  nodeList.push_back( tmpID );
-      	}
-    }  
-  nodeList.unique();
-  nodeList.sort();
-  nodeList.unique();
-
-  // The 'bestFinalStateNodeID' will be set to the best root state node
-  // in the trellis graph. It will be the terminal node at the end of the
-  // path representing the most probable sequence of states, and it will
-  // be used to initiate the backtracking procedure below.
-  vtkIdType bestFinalStateNodeID;
-
-  while ( nodeList.size() > 0 )
-    {
-      // Now for each node in 'nodeList', we want to update the trellis graph
-      // with accumulated weights along various paths through trellis. This
-      // is accomplished by considering one node at a time: for a given node
-      // we consider all incoming edges (grouping edges according to their 
-      // association with distinct particles). For a given edge group, we
-      // identify the edge that incurs the greatest probability amongst all
-      // other edges in the group. Once the best edge has been identified
-      // for each edge group, we mark those edges as being "optimal", and
-      // we update the weight at the node under consideration.      
-      std::list< vtkIdType >::iterator listIt = nodeList.begin();
-
-      // Keep a list of trellis node IDs that need to be considered for the 
-      // next go around
-      std::list< vtkIdType > tmpNodeList;
-
-      while ( listIt != nodeList.end() )
-  	{
-  	  // If the call to 'UpdateTrellisGraphWithViterbiStep' returns true, that means that all
-  	  // incoming edges to the query node have associated source nodes that are all up to date.
-  	  // This means that after the call to this function, the query node itself is made up
-  	  // to date. In that case, we can collect all the nodes being pointed to by this query
-  	  // node. If, on the other hand, the funtion returns false, that means that the query node
-  	  // has not been made up to date because it is waiting on other nodes on which it 
-  	  // depends to be made up to date. In that case, we want to add the query node back into
-  	  // the basket of nodes that needs to be considered again for the next go around.
-  	  if ( this->UpdateTrellisGraphWithViterbiStep( *listIt, trellisGraph ) )
-  	    {
-  	      vtkSmartPointer< vtkOutEdgeIterator > it = vtkSmartPointer< vtkOutEdgeIterator >::New();
-  	      trellisGraph->GetOutEdges( *listIt, it );
-
-  	      while( it->HasNext() )
-  		{
-  		  vtkIdType tmpID = it->Next().Target;
-  		  tmpNodeList.push_back( tmpID );
-  		}
-  	    }
-	  
-  	  listIt++;
-  	}
-      tmpNodeList.unique();
-      tmpNodeList.sort();
-      tmpNodeList.unique();
-
-      // If 'tmpNodeList' is empty, that means we have reached the root node of 
-      // the trellis. At this point we have everything we need to back-track through
-      // the trellis to identify the most probable states. First we identify the 
-      // state node that has the greatest accumulated weight. This node is at the
-      // end of the best path through the trellis, and its weight is the highest
-      // accumulated weight of all paths through the trellis. We will use this
-      // node ID to initiate the back-tracking below.
-      if ( tmpNodeList.size() == 0 )
-  	{
-  	  double maxPathWeight = -DBL_MAX;
+  return VTK_THREAD_RETURN_VALUE;
+}
 
-  	  listIt = nodeList.begin();
-  	  while ( listIt != nodeList.end() )
-  	    {
-  	      double pathWeight = trellisGraph->GetVertexData()->GetArray( "accumulatedWeightArray" )->GetTuple( *listIt )[0];
 
-  	      if ( pathWeight > maxPathWeight )
-  		{
-  		  maxPathWeight        = pathWeight;
-  		  bestFinalStateNodeID = *listIt;
-  		}
+// Computes the weights of the trellis edges from the states of the source
+// particle (rows) to the states of the target particle (columns). The
+// probability of a transition is proportional to the product of its prior
+// and of the likelihood of the scale difference and of the angle between
+// the particles. The probabilities of the transitions from a given state
+// are normalized so that they add up to one, and the weights are their
+// logs. The probabilities are rounded to single precision, as they were
+// when the trellis was stored as a graph with float edge data, so that
+// the labels are unchanged.
+void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::ComputeTransitionWeights( unsigned int sourceParticleID, unsigned int targetParticleID,
+											      double* weights ) const
+{
+  const double PI = 3.141592653589793238462;
 
-  	      listIt++;
-  	    }
-  	}
+  double angle = GetAngleInDegreesBetweenVectors( &this->ParticleDirections[3*sourceParticleID], this->ParticleDirectionMagnitudes[sourceParticleID],
+						  &this->ParticleDirections[3*targetParticleID], this->ParticleDirectionMagnitudes[targetParticleID] );
 
-      // Copy the contents of 'tmpNodeList' into the 'nodeList' container
-      nodeList.clear();
-      listIt = tmpNodeList.begin();
-      while ( listIt != tmpNodeList.end() )
-  	{
-  	  nodeList.push_back( *listIt );
-	  
-  	  listIt++;
-  	}
-    }
+  double scaleDiff = this->ParticleScales[sourceParticleID] - this->ParticleScales[targetParticleID];
 
-  // Finally, backtrack through the trellis graph to identify the 
-  // the best states for each of the particles. Also compute the score 
-  // corresponding to this path. Note that the score we compute is different
-  // than the simple accumulated weight along the path. 
-  double score = 0;
+  // We use different likelihood functions depending on whether it is a "same state" transition or
+  // a "different state" transition (learned from data).
+  double sameLikelihood = 1.0;
 
-  this->BackTrack( bestFinalStateNodeID, trellisGraph, particleIDToGenerationLabel, &score );
+  // Compute the scale contribution
+  sameLikelihood *= 1.0/(sqrt(2.0*PI)*this->SameTransitionScaleSigma)*exp(-0.5*pow((scaleDiff - this->SameTransitionScaleMu)/this->SameTransitionScaleSigma, 2.0));
 
-  return score;
-}
+  // Compute the angle contribution
+  sameLikelihood *= this->SameTransitionAngleLambda*exp( -this->SameTransitionAngleLambda*angle );
 
-// This is a recursive routine to back-track through the trellis graph
-// along the most probable path (paths, in the case of bifurcation occurencs),
-// to identify the most probable state sequence
-void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::BackTrack( vtkIdType nodeID, vtkSmartPointer< vtkMutableDirectedGraph > trellisGraph, 
-									       std::map< unsigned int, unsigned char >* particleIDToGenerationLabel, double* score )
-{
-  unsigned int  particleID = trellisGraph->GetVertexData()->GetArray( "particleIDArray" )->GetTuple( nodeID )[0];
-  unsigned char state      = trellisGraph->GetVertexData()->GetArray( "stateArray" )->GetTuple( nodeID )[0];
-  double        emissionProbability = this->ParticleIDToEmissionProbabilitiesMap[particleID][state];
+  // Compute the scale contribution
+  double comp1 = 1.0/(sqrt(2.0*PI)*this->DiffTransitionScaleSigma1)*exp(-0.5*pow((scaleDiff - this->DiffTransitionScaleMu1)/this->DiffTransitionScaleSigma1, 2.0));
+  double comp2 = 1.0/(sqrt(2.0*PI)*this->DiffTransitionScaleSigma2)*exp(-0.5*pow((scaleDiff - this->DiffTransitionScaleMu2)/this->DiffTransitionScaleSigma2, 2.0));
+  double diffLikelihood = this->DiffTransitionScaleWeight1*comp1 + this->DiffTransitionScaleWeight2*comp2;
 
-  if ( emissionProbability < 1e-200 )
+  // Compute the angle contribution
+  if ( angle < 20 )
     {
-      *score += -1e100;
+      diffLikelihood *= this->DiffTransitionAngleSlope1*angle + this->DiffTransitionAngleIntercept1;
     }
   else
     {
-      *score += log( emissionProbability );
+      diffLikelihood *= this->DiffTransitionAngleSlope2*angle + this->DiffTransitionAngleIntercept2;
     }
 
-  (*particleIDToGenerationLabel)[particleID] = state;
+  for ( unsigned int i=0; i<this->NumberOfStates; i++ )
+    {
+      double* rowWeights = weights + i*this->NumberOfStates;
+
+      double accum = 0.0;
+      for ( unsigned int j=0; j<this->NumberOfStates; j++ )
+	{
+	  double likelihood = (i == j) ? sameLikelihood : diffLikelihood;
 
-  vtkSmartPointer< vtkInEdgeIterator > it = vtkSmartPointer< vtkInEdgeIterator >::New();
-  trellisGraph->GetInEdges( nodeID, it );
+	  rowWeights[j] = static_cast< float >( likelihood*this->TransitionPriors[i*this->NumberOfStates + j] );
+	  accum += rowWeights[j];
+	}
 
-  while ( it->HasNext() )
-    {
-      vtkInEdgeType edge = it->Next();
-      if ( trellisGraph->GetEdgeData()->GetArray( "bestEdgeArray" )->GetTuple( edge.Id )[0] == 1.0 )
+      for ( unsigned int j=0; j<this->NumberOfStates; j++ )
 	{
-	  double edgeProbability = trellisGraph->GetEdgeData()->GetArray( "edgeWeightArray" )->GetTuple( edge.Id )[0];
-	  if ( edgeProbability < 1e-200 )
+	  double probability;
+	  if ( accum == 0.0 )
+	    {
+	      probability = static_cast< float >( 1.0/double(this->NumberOfStates) );
+	    }
+	  else
 	    {
-	      *score += -1e100;
+	      probability = static_cast< float >( rowWeights[j]/accum );
+	    }
+
+	  if ( probability < 1e-200 )
+	    {
+	      rowWeights[j] = -1e100;
 	    }
 	  else
 	    {
-	      *score += log( edgeProbability );
+	      rowWeights[j] = log( probability );
 	    }
-	  this->BackTrack( edge.Source, trellisGraph, particleIDToGenerationLabel, score );
 	}
     }
 }
 
-// The Viterbi algorithm is used to find the most probable sequence of states.
-// We march through trellis graph updating the accumulated weights at each state
-// node and keep track of the incoming edges to a given state that have the
-// greatest weight. This function does this update at a single state node location.
-bool vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::UpdateTrellisGraphWithViterbiStep( vtkIdType nodeID, vtkSmartPointer< vtkMutableDirectedGraph > graph )
+
+// Decodes the trellis of a subgraph with respect to the specified root
+// node with the Viterbi algorithm (max-product on the tree) and returns
+// the score of the most probable labeling. The states of the subgraph
+// nodes are written to 'states'. The search goes from the leaves of the
+// rooted subgraph to the root: the accumulated weight of a state node is
+// the log of its emission probability plus, for every child, the best
+// weight over the child's state nodes of the edge weight plus the child
+// accumulated weight. Ties go to the lowest state. The score is the sum
+// of the logs of the emission and transition probabilities along the
+// best path.
+double vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::DecodeSubgraph( const SUBGRAPH& graph, unsigned int rootNodeID,
+										      std::vector< unsigned char >* states ) const
 {
-  // First check that the source node for every incoming edge into the query node
-  // is up to date. If any one of them is not, do nothing and return false (we will
-  // come back to this node later when all the nodes on which it depends are up to
-  // date).
-  vtkSmartPointer< vtkInEdgeIterator > itCheck = vtkSmartPointer< vtkInEdgeIterator >::New();
-  graph->GetInEdges( nodeID, itCheck );
-
-  while ( itCheck->HasNext() )
+  unsigned int numberOfStates  = this->NumberOfStates;
+  unsigned int numberOfWeights = numberOfStates*numberOfStates;
+  unsigned int numberOfNodes   = static_cast< unsigned int >( graph.particleIDs.size() );
+
+  // Order the nodes depth first from the root, with the children of
+  // every node in the order of its out edges. 'parentSlots' holds, for
+  // every node but the root, the index in 'neighbors' of its parent,
+  // which is also the index of the weights of the edge to its parent.
+  std::vector< unsigned int > order;
+  std::vector< unsigned int > parents( numberOfNodes, rootNodeID );
+  std::vector< unsigned int > parentSlots( numberOfNodes, 0 );
+  std::vector< bool >         visited( numberOfNodes, false );
+  std::vector< unsigned int > nodeStack;
+
+  order.reserve( numberOfNodes );
+  visited[rootNodeID] = true;
+  nodeStack.push_back( rootNodeID );
+  while ( !nodeStack.empty() )
     {
-      vtkInEdgeType edge = itCheck->Next();
-      double upToDate = graph->GetVertexData()->GetArray( "upToDateForForwardSearchArray" )->GetTuple( edge.Source )[0];
+      unsigned int node = nodeStack.back();
+      nodeStack.pop_back();
+      order.push_back( node );
 
-      if ( upToDate == 0.0 )
+      for ( unsigned int k=graph.neighborOffsets[node+1]; k>graph.neighborOffsets[node]; k-- )
 	{
-	  return false;
+	  unsigned int child = graph.neighbors[k-1];
+	  if ( !visited[child] )
+	    {
+	      visited[child] = true;
+	      parents[child] = node;
+	      for ( unsigned int c=graph.neighborOffsets[child]; c<graph.neighborOffsets[child+1]; c++ )
+		{
+		  if ( graph.neighbors[c] == node )
+		    {
+		      parentSlots[child] = c;
+		      break;
+		    }
+		}
+	      nodeStack.push_back( child );
+	    }
 	}
     }
 
-  // Get all edges incoming. We want to consider the weight we will
-  // incur by "choosing" a given edge: that weight is the sum of the
-  // ln transition probability associated with the edge and the weight
-  // already accumulated at the source state node. Note in general we
-  // may have more than one particle "flowing into" the current node.
-  // Thus, we want to keep track of the optimal weight and the best
-  // edge for each particle. The "best edge" is the one, for a given
-  // particle, that contributes the highest weight. Recording these
-  // edges will allow us to backtrack through the trellis graph once
-  // we reach the end of the forward search in order to identify the
-  // most probable sequence of states.
-  vtkSmartPointer< vtkInEdgeIterator > it = vtkSmartPointer< vtkInEdgeIterator >::New();
-  graph->GetInEdges( nodeID, it );
-
-  // These maps allow us to distinguish from possibly
-  // multiple particles "flowing into" a given node
-  std::map< float, double >     weightMap;
-  std::map< float, vtkIdType >  bestEdgeMap;
-
-  while ( it->HasNext() )
-    {
-      vtkInEdgeType edge = it->Next();
+  // Forward search. Children are visited before their parents, and
+  // the contributions of the children of a node are added in order of
+  // their particle IDs. 'bestChildStates' holds, for every node and
+  // state of its parent, the best state of the node.
+  std::vector< double >        accumulatedWeights( numberOfNodes*numberOfStates );
+  std::vector< unsigned char > bestChildStates( numberOfNodes*numberOfStates, 0 );
+  std::vector< unsigned int >  children;
 
-      float best = 0.0;
-      graph->GetEdgeData()->GetArray( "bestEdgeArray" )->SetTuple( edge.Id, &best );
-
-      float particleID = graph->GetVertexData()->GetArray( "particleIDArray" )->GetTuple( edge.Source )[0];
-
-      double edgeProbability   = graph->GetEdgeData()->GetArray( "edgeWeightArray" )->GetTuple( edge.Id )[0];
-      double accumulatedWeight = graph->GetVertexData()->GetArray( "accumulatedWeightArray" )->GetTuple( edge.Source )[0];
+  for ( unsigned int o=static_cast< unsigned int >( order.size() ); o>0; o-- )
+    {
+      unsigned int node        = order[o-1];
+      double*      nodeWeights = &accumulatedWeights[node*numberOfStates];
 
-      double totWeight;
-      if ( edgeProbability < 1e-200 )
+      for ( unsigned int t=0; t<numberOfStates; t++ )
 	{
-	  //totWeight = -DBL_MAX + accumulatedWeight;
-	  totWeight = -1e100 + accumulatedWeight;
+	  nodeWeights[t] = this->EmissionWeights[graph.particleIDs[node]*numberOfStates + t];
 	}
-      else
+
+      children.clear();
+      for ( unsigned int k=graph.neighborOffsets[node]; k<graph.neighborOffsets[node+1]; k++ )
 	{
-	  totWeight = log( edgeProbability ) + accumulatedWeight;
+	  unsigned int child = graph.neighbors[k];
+	  if ( child != rootNodeID && parents[child] == node )
+	    {
+	      children.push_back( child );
+	    }
 	}
+      std::sort( children.begin(), children.end(), NODEPARTICLEORDER( graph.particleIDs ) );
 
-      bool found = false;
-      std::map< float, double >::iterator mIt = weightMap.begin();
-      while ( mIt != weightMap.end() )
+      for ( unsigned int c=0; c<children.size(); c++ )
 	{
-	  if ( mIt->first == particleID )
-	    {
-	      found = true;
+	  const double* edgeWeights  = &graph.transitionWeights[parentSlots[children[c]]*numberOfWeights];
+	  const double* childWeights = &accumulatedWeights[children[c]*numberOfStates];
 
-	      if ( totWeight > weightMap[particleID] )
+	  for ( unsigned int t=0; t<numberOfStates; t++ )
+	    {
+	      unsigned int bestState  = 0;
+	      double       bestWeight = edgeWeights[t] + childWeights[0];
+	      for ( unsigned int s=1; s<numberOfStates; s++ )
 		{
-		  weightMap[particleID]   = totWeight;
-		  bestEdgeMap[particleID] = edge.Id;
+		  double weight = edgeWeights[s*numberOfStates + t] + childWeights[s];
+		  if ( weight > bestWeight )
+		    {
+		      bestWeight = weight;
+		      bestState  = s;
+		    }
 		}
-	    }
 
-	  mIt++;
-	}
-      
-      if ( !found )
-	{
-	  weightMap[particleID]   = totWeight;
-	  bestEdgeMap[particleID] = edge.Id;
+	      nodeWeights[t] += bestWeight;
+	      bestChildStates[children[c]*numberOfStates + t] = static_cast< unsigned char >( bestState );
+	    }
 	}
     }
 
-  // At this point we have identified the best weights and edges. We 
-  // now want to update the current node's weight, which is the sum 
-  // of the ln of the emission probability and the weights we found above
-  unsigned char state                  = graph->GetVertexData()->GetArray( "stateArray" )->GetTuple( nodeID )[0];
-  float         particleID             = graph->GetVertexData()->GetArray( "particleIDArray" )->GetTuple( nodeID )[0];
-  double        emissionProbability    = this->ParticleIDToEmissionProbabilitiesMap[static_cast< unsigned int >( particleID )][state];
-
-  double weightAccumulator = 0.0;
-  if ( emissionProbability < 1e-200 )
+  // The best root state node is at the end of the most probable path
+  unsigned int bestRootState = 0;
+  double       maxPathWeight = -DBL_MAX;
+  for ( unsigned int t=0; t<numberOfStates; t++ )
     {
-      weightAccumulator = -1e100;
-    }
-  else
-    {
-      weightAccumulator = log( emissionProbability );
+      if ( accumulatedWeights[rootNodeID*numberOfStates + t] > maxPathWeight )
+	{
+	  maxPathWeight = accumulatedWeights[rootNodeID*numberOfStates + t];
+	  bestRootState = t;
+	}
     }
 
-  std::map< float, double >::iterator wIt = weightMap.begin();
-  while ( wIt != weightMap.end() )
-    {
-      weightAccumulator += wIt->second;
-      wIt++;
-    }
-  
-  graph->GetVertexData()->GetArray( "accumulatedWeightArray" )->SetTuple( nodeID, &weightAccumulator );
-  
-  // Mark the "best" edges as being the best. This will be used in the back-tracking stage later.
-  std::map< float, vtkIdType >::iterator bIt = bestEdgeMap.begin();
-  while ( bIt != bestEdgeMap.end() )
+  // Finally, backtrack from the root to identify the best states for each
+  // of the particles, and compute the score corresponding to this path.
+  // Note that the score is different than the accumulated weight of the
+  // root. The terms are added in depth first order, as the path is
+  // traversed.
+  std::vector< unsigned char > stateIndices( numberOfNodes, 0 );
+  states->resize( numberOfNodes );
+
+  double score = 0.0;
+  for ( unsigned int o=0; o<order.size(); o++ )
     {
-      float best = 1.0;
+      unsigned int node = order[o];
 
-      graph->GetEdgeData()->GetArray( "bestEdgeArray" )->SetTuple( bIt->second, &best );
-      
-      bIt++;
-    }  
+      if ( node == rootNodeID )
+	{
+	  stateIndices[node] = static_cast< unsigned char >( bestRootState );
+	}
+      else
+	{
+	  unsigned int parentState = stateIndices[parents[node]];
 
-  // Lastly, mark this node as being up to date
-  double upToDate = 1.0;
-  graph->GetVertexData()->GetArray( "upToDateForForwardSearchArray" )->SetTuple( nodeID, &upToDate );
+	  stateIndices[node] = bestChildStates[node*numberOfStates + parentState];
+	  score += graph.transitionWeights[parentSlots[node]*numberOfWeights + stateIndices[node]*numberOfStates + parentState];
+	}
 
-  return true;
-}
+      score += this->EmissionWeights[graph.particleIDs[node]*numberOfStates + stateIndices[node]];
 
-// Leaf nodes should have no incoming edges
-bool vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::IsNonRootLeafNode( vtkIdType nodeID, vtkSmartPointer< vtkMutableDirectedGraph > graph )
-{
-  vtkSmartPointer< vtkInEdgeIterator > it = vtkSmartPointer< vtkInEdgeIterator >::New();
-  graph->GetInEdges( nodeID, it );
- 
-  bool nonRootLeafNode = true;
-  while( it->HasNext() )
-    { 
-      nonRootLeafNode = false;
-      break;
+      (*states)[node] = this->States[stateIndices[node]];
     }
 
-  return nonRootLeafNode;
+  return score;
 }
 
-double vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::GetTransitionProbability( unsigned int sourceParticleID, unsigned int targetParticleID,
-												unsigned char sourceState, unsigned int targetState,
-												vtkSmartPointer< vtkPolyData > particles ) 
+
+// Decodes every subgraph with respect to each of its leaf nodes (or to
+// the specified root node) and keeps the most probable labeling of each
+// subgraph. The decodings are independent of each other: they are
+// distributed over the threads, which take the next one as soon as they
+// are done, and the largest subgraphs go first. The labels do not depend
+// on the number of threads or on the order in which the decodings finish.
+void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::DecodeSubgraphs()
 {
-  const double PI = 3.141592653589793238462;
+  unsigned int numberOfSubgraphs = static_cast< unsigned int >( this->Subgraphs.size() );
 
-  double prior = 0.0;
-  for ( unsigned int i=0; i<this->TransitionProbabilityPriors.size(); i++ )
+  std::vector< unsigned int > subgraphSizes( numberOfSubgraphs );
+  std::vector< unsigned int > subgraphOrder( numberOfSubgraphs );
+  for ( unsigned int s=0; s<numberOfSubgraphs; s++ )
+    {
+      subgraphSizes[s] = static_cast< unsigned int >( this->Subgraphs[s].particleIDs.size() );
+      subgraphOrder[s] = s;
+    }
+  std::stable_sort( subgraphOrder.begin(), subgraphOrder.end(), SUBGRAPHSIZEORDER( subgraphSizes ) );
+
+  DECODINGTHREADSTRUCT str;
+    str.filter            = this;
+    str.nextTask          = 0;
+    str.rootNodeSpecified = this->ParticleRootNodeID >= 0;
+    str.lock              = new vtkSimpleCriticalSection;
+    str.bestScores.assign( numberOfSubgraphs, -DBL_MAX );
+    str.bestLeaves.assign( numberOfSubgraphs, -1 );
+    str.bestStates.resize( numberOfSubgraphs );
+
+  for ( unsigned int i=0; i<numberOfSubgraphs; i++ )
     {
-      if ( this->TransitionProbabilityPriors[i].sourceState == sourceState &&
-	   this->TransitionProbabilityPriors[i].targetState == targetState )
+      unsigned int s = subgraphOrder[i];
+
+      for ( unsigned int j=0; j<this->Subgraphs[s].leafNodeIDs.size(); j++ )
 	{
-	  prior = this->TransitionProbabilityPriors[i].probability;
-	  break;
+	  unsigned int particleID = this->Subgraphs[s].particleIDs[this->Subgraphs[s].leafNodeIDs[j]];
+
+	  // If the root node is known and specified, it must be a leaf
+	  // node of the subgraph for the subgraph to be labeled
+	  if ( !str.rootNodeSpecified || particleID == static_cast< unsigned int >( this->ParticleRootNodeID ) )
+	    {
+	      str.taskSubgraphs.push_back( s );
+	      str.taskLeaves.push_back( j );
+	    }
 	}
     }
 
-  // Now that we have the prior, compute the likelihood. The posterior (transition given scale and
-  // angle) will then be proportional to the product of the two.
-  cip::VectorType sourceDirection(3);
-    sourceDirection[0] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( sourceParticleID )[0];
-    sourceDirection[1] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( sourceParticleID )[1];
-    sourceDirection[2] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( sourceParticleID )[2];
-	  
-  cip::VectorType targetDirection(3);
-    targetDirection[0] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( targetParticleID )[0];
-    targetDirection[1] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( targetParticleID )[1];
-    targetDirection[2] = particles->GetPointData()->GetArray( "hevec2" )->GetTuple( targetParticleID )[2];
-	  
-  double angle = cip::GetAngleBetweenVectors( sourceDirection, targetDirection, true );
-	  
-  double scaleDiff = particles->GetPointData()->GetArray( "scale" )->GetTuple( sourceParticleID )[0] -
-    particles->GetPointData()->GetArray( "scale" )->GetTuple( targetParticleID )[0];
-
-  // We use different likelihood functions depending on whether it is a "same state" transition or
-  // a "different state" transition (learned from data).
-  double likelihood = 1.0;
-  if ( sourceState == targetState )
+  if ( str.rootNodeSpecified )
     {
-      // Compute the scale contribution
-      likelihood *= 1.0/(sqrt(2.0*PI)*this->SameTransitionScaleSigma)*exp(-0.5*pow((scaleDiff - this->SameTransitionScaleMu)/this->SameTransitionScaleSigma, 2.0));
+      for ( unsigned int s=0; s<numberOfSubgraphs; s++ )
+	{
+	  if ( std::find( str.taskSubgraphs.begin(), str.taskSubgraphs.end(), s ) == str.taskSubgraphs.end() )
+	    {
+	      std::cout << "WARNING: Root node specified, but not found" << std::endl;
+	    }
+	}
+    }
 
-      // Compute the angle contribution
-      likelihood *= this->SameTransitionAngleLambda*exp( -this->SameTransitionAngleLambda*angle );
+  unsigned int numberOfThreads = static_cast< unsigned int >( this->NumberOfThreads );
+  if ( numberOfThreads > str.taskSubgraphs.size() )
+    {
+      numberOfThreads = static_cast< unsigned int >( str.taskSubgraphs.size() );
     }
-  else
+
+  if ( numberOfThreads > 0 )
     {
-      // Compute the scale contribution
-      double comp1 = 1.0/(sqrt(2.0*PI)*this->DiffTransitionScaleSigma1)*exp(-0.5*pow((scaleDiff - this->DiffTransitionScaleMu1)/this->DiffTransitionScaleSigma1, 2.0));
-      double comp2 = 1.0/(sqrt(2.0*PI)*this->DiffTransitionScaleSigma2)*exp(-0.5*pow((scaleDiff - this->DiffTransitionScaleMu2)/this->DiffTransitionScaleSigma2, 2.0));
-      likelihood = this->DiffTransitionScaleWeight1*comp1 + this->DiffTransitionScaleWeight2*comp2;
+      vtkMultiThreader* threader = vtkMultiThreader::New();
+        threader->SetNumberOfThreads( numberOfThreads );
+	threader->SetSingleMethod( vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::DecodingThreaderCallback, &str );
+	threader->SingleMethodExecute();
+	threader->Delete();
+    }
 
-      // Compute the angle contribution
-      if ( angle < 20 )
-	{
-	  likelihood *= this->DiffTransitionAngleSlope1*angle + this->DiffTransitionAngleIntercept1;
-	}
-      else
+  delete str.lock;
+
+  for ( unsigned int s=0; s<numberOfSubgraphs; s++ )
+    {
+      if ( str.bestLeaves[s] >= 0 )
 	{
-	  likelihood *= this->DiffTransitionAngleSlope2*angle + this->DiffTransitionAngleIntercept2;
+	  for ( unsigned int n=0; n<str.bestStates[s].size(); n++ )
+	    {
+	      this->ParticleIDToAirwayGenerationMap[this->Subgraphs[s].particleIDs[n]] = str.bestStates[s][n];
+	      this->ParticleLabelingScores[this->Subgraphs[s].particleIDs[n]]          = str.bestScores[s];
+	    }
 	}
     }
-
-  double tmp = likelihood*prior;
-
-  return tmp;
 }
 
-void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::AddStateNodesToTrellisGraph( vtkSmartPointer< vtkMutableDirectedGraph > trellisGraph, 
-												 std::vector< vtkIdType > trellisNodeIDGroup, vtkIdType subgraphID,
-												 SUBGRAPH* graph, std::map< unsigned int, bool >* graphNodeVisited )
-{
-  std::vector< vtkIdType > tmpTrellisNodeIDGroup;
 
-  for ( unsigned int i=0; i<this->NumberOfStates; i++ )
-    {     
-      vtkIdType id = trellisGraph->AddVertex();
-      
-      tmpTrellisNodeIDGroup.push_back( id );
-
-      float tmpState      = static_cast< float >( this->States[i] );
-      float tmpParticleID = static_cast< float >( (*graph).nodeIDToParticleIDMap[subgraphID] );
-      float tmpWeight     = 0.0;
-      float tmpVisited    = 0.0;
-      float tmpUpToDate   = 0.0;
-
-      trellisGraph->GetVertexData()->GetArray( "particleIDArray" )->InsertTuple( id, &tmpParticleID );
-      trellisGraph->GetVertexData()->GetArray( "stateArray" )->InsertTuple( id, &tmpState );
-      trellisGraph->GetVertexData()->GetArray( "accumulatedWeightArray" )->InsertTuple( id, &tmpWeight );     
-      trellisGraph->GetVertexData()->GetArray( "upToDateForForwardSearchArray" )->InsertTuple( id, &tmpUpToDate ); 
-
-      (*graphNodeVisited)[subgraphID] = true;
-    }
+VTK_THREAD_RETURN_TYPE vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::DecodingThreaderCallback( void* arg )
+{
+  DECODINGTHREADSTRUCT* str = (DECODINGTHREADSTRUCT *)(((ThreadInfoStruct *)(arg))->UserData);
 
-  // Now create directed edges from all newly created nodes to the 
-  // nodes in the group passed to this function
-  for ( unsigned int i=0; i<this->NumberOfStates; i++ )
+  std::vector< unsigned char > states;
+  while ( true )
     {
-      vtkIdType pID = tmpTrellisNodeIDGroup[i];
+      str->lock->Lock();
+      unsigned int task = str->nextTask++;
+      str->lock->Unlock();
 
-      for ( unsigned int j=0; j<this->NumberOfStates; j++ )
+      if ( task >= str->taskSubgraphs.size() )
 	{
-	  vtkIdType cID = trellisNodeIDGroup[j];
-	  vtkEdgeType edge = trellisGraph->AddEdge( pID, cID );
-
-	  float best = 0;
-	  trellisGraph->GetEdgeData()->GetArray( "bestEdgeArray" )->InsertTuple( edge.Id, &best );
+	  break;
 	}
-    }
 
-  // Now loop over all the edges emanating from this node. If
-  // a node in the subgraph hasn't been visited, it is a child
-  // node of the current node and needs to be "expanded" in
-  // the trellis graph
-  vtkSmartPointer< vtkOutEdgeIterator > eIt = vtkSmartPointer< vtkOutEdgeIterator >::New();
-  graph->undirectedGraph->GetOutEdges( subgraphID, eIt );
+      unsigned int     s        = str->taskSubgraphs[task];
+      int              leaf     = static_cast< int >( str->taskLeaves[task] );
+      const SUBGRAPH&  subgraph = str->filter->Subgraphs[s];
+
+      double score = str->filter->DecodeSubgraph( subgraph, static_cast< unsigned int >( subgraph.leafNodeIDs[leaf] ), &states );
 
-  while( eIt->HasNext() )
-    { 
-      vtkOutEdgeType edge = eIt->Next();
-      if ( !(*graphNodeVisited)[edge.Target] )
+      // A specified root node is used whatever its score
+      str->lock->Lock();
+      if ( (str->rootNodeSpecified && str->bestLeaves[s] < 0) || score > str->bestScores[s] ||
+	   (score == str->bestScores[s] && str->bestLeaves[s] >= 0 && leaf < str->bestLeaves[s]) )
 	{
-	  this->AddStateNodesToTrellisGraph( trellisGraph, tmpTrellisNodeIDGroup, edge.Target, graph, graphNodeVisited );
+	  str->bestScores[s] = score;
+	  str->bestLeaves[s] = leaf;
+	  str->bestStates[s].swap( states );
 	}
+      str->lock->Unlock();
     }
-}
-
-
-void vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter::UpdateAirwayGenerationAssignments( std::map< unsigned int, unsigned char >* tmpParticleIDToGenerationLabelMap )
-{
-  std::map< unsigned int, unsigned char >::iterator mIt = (*tmpParticleIDToGenerationLabelMap).begin();
-  while ( mIt != (*tmpParticleIDToGenerationLabelMap).end() )
-    {
-      this->ParticleIDToAirwayGenerationMap[mIt->first] = mIt->second;
 
-      ++mIt;
-    }
+  return VTK_THREAD_RETURN_VALUE;
 }
@@ -19,6 +19,7 @@
 #include "vtkSmartPointer.h"
 #include "vtkMutableDirectedGraph.h" 
 #include "vtkMutableUndirectedGraph.h" 
+#include "vtkMultiThreader.h"
 #include <map>
 #include <vector>
 #include "vtkCIPCommonConfigure.h"
@@ -57,6 +58,15 @@ public:
   vtkGetMacro( KernelDensityEstimationROIRadius, double ); 
   vtkSetMacro( KernelDensityEstimationROIRadius, double );
 
+  /** The number of threads used to compute the emission probabilities
+   *  of the input particles and to decode the subgraphs (in HMTM mode).
+   *  By default, the global default number of threads of
+   *  'vtkMultiThreader' is used. The labels do not depend on the number
+   *  of threads.
+   */
+  vtkSetClampMacro( NumberOfThreads, int, 1, VTK_MAX_THREADS );
+  vtkGetMacro( NumberOfThreads, int );
+
   /** You must specify at least one airway-generation labeled atlas for the
    *  filter to work properly. An airway generation labeled atlas is a 
    *  particles data set that has field data array field named 'ChestType' that,
@@ -76,6 +86,15 @@ public:
    */
   void SetParticleRootNodeID( unsigned int );
 
+  /** Get the score of the labeling of the subgraph that the specified
+   *  particle belongs to, as computed by the last update in HMTM mode.
+   *  The score is the sum of the logs of the emission and transition
+   *  probabilities along the most probable path through the trellis of
+   *  the subgraph. It is -DBL_MAX for particles whose subgraph was not
+   *  labeled by the HMTM.
+   */
+  double GetParticleLabelingScore( unsigned int ) const;
+
   /** The airway label assignment algorithm works in one of two modes: KDE or
    *  HMTM. If the mode is set to HMTM (Hidden Markov Tree Model), the complete
    *  probabilistic model will be applied. By default this is set to true. */
@@ -105,6 +124,16 @@ private:
     std::vector< vtkIdType >                     leafNodeIDs;
     std::map< vtkIdType, unsigned int >          nodeIDToParticleIDMap;
     std::map< unsigned int, vtkIdType >          particleIDToNodeIDMap;
+
+    // Compact copy of the subgraph used for decoding: the particle ID
+    // of every node, the neighbors of every node (in the order of its
+    // out edges) and, for every node and neighbor, the log of the
+    // normalized probabilities of the transitions from the node's
+    // states (rows) to the neighbor's states (columns).
+    std::vector< unsigned int >                  particleIDs;
+    std::vector< unsigned int >                  neighborOffsets;
+    std::vector< unsigned int >                  neighbors;
+    std::vector< double >                        transitionWeights;
   };
 
   // The structure 'TRANSITIONPROBABILITY' is used to facilitate
@@ -118,37 +147,78 @@ private:
     double        probability;
   };
 
+  // The atlas particles are preprocessed once per update so that
+  // the kernel density estimation does not query the atlas point
+  // data arrays by name for every pair of particles. 'ATLASINDEX'
+  // holds, for one atlas, the particle points, scales, 'hevec2'
+  // directions (and their magnitudes) and state indices (-1 for
+  // particles whose type is not a state) in separate arrays. It
+  // also holds a balanced k-d tree over the points that is used to
+  // find the atlas particles within the ROI radius. The tree is
+  // stored implicitly: the node of a range of 'treeParticles' is
+  // the particle in the middle of the range, and the ranges on
+  // either side of it are its subtrees.
+  struct ATLASINDEX
+  {
+    std::vector< double >        points;
+    std::vector< float >         scales;
+    std::vector< double >        directions;
+    std::vector< double >        directionMagnitudes;
+    std::vector< int >           stateIndices;
+    std::vector< unsigned int >  treeParticles;
+    std::vector< unsigned char > treeSplitDimensions;
+  };
+
   vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter(const vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter&);  // Not implemented.
   void operator=(const vtkCIPAirwayParticlesToGenerationLabeledAirwayParticlesFilter&);  // Not implemented.
 
-  double GetTransitionProbability( unsigned int, unsigned int, unsigned char, unsigned int, vtkSmartPointer< vtkPolyData > );
-  double ComputeGenerationLabelsFromTrellisGraph( vtkSmartPointer< vtkMutableDirectedGraph >, std::map< unsigned int, unsigned char >* );
+  void ComputeTransitionWeights( unsigned int, unsigned int, double* ) const;
+  double DecodeSubgraph( const SUBGRAPH&, unsigned int, std::vector< unsigned char >* ) const;
+  void DecodeSubgraphs();
+  static VTK_THREAD_RETURN_TYPE TransitionWeightsThreaderCallback( void* );
+  static VTK_THREAD_RETURN_TYPE DecodingThreaderCallback( void* );
 
+  void InitializeParticleData( vtkSmartPointer< vtkPolyData > );
   void InitializeEmissionProbabilites( vtkSmartPointer< vtkPolyData > );
+  void InitializeAtlasIndices();
+  void BuildAtlasTree( ATLASINDEX*, unsigned int, unsigned int );
+  void GetAtlasParticlesInROI( const ATLASINDEX&, unsigned int, unsigned int, const double*, std::vector< unsigned int >* ) const;
+  void ComputeEmissionProbabilities( const double*, float, const double*, double, std::vector< unsigned int >*, double* ) const;
+  static VTK_THREAD_RETURN_TYPE EmissionProbabilitiesThreaderCallback( void* );
   void InitializeSubGraphs( vtkSmartPointer< vtkMutableUndirectedGraph >, vtkSmartPointer< vtkPolyData > );
   void InitializeMinimumSpanningTree( vtkSmartPointer< vtkPolyData > );
   void InitializeAirwayGenerationAssignments( unsigned int );
-  void GetTrellisGraphFromSubgraph( SUBGRAPH*, vtkIdType, vtkSmartPointer< vtkMutableDirectedGraph >, vtkSmartPointer< vtkPolyData > );
-  void AddStateNodesToTrellisGraph( vtkSmartPointer< vtkMutableDirectedGraph >, std::vector< vtkIdType >, vtkIdType,
-				    SUBGRAPH*, std::map< unsigned int, bool >* );
-  void UpdateAirwayGenerationAssignments( std::map< unsigned int, unsigned char >* );
-  bool UpdateTrellisGraphWithViterbiStep( vtkIdType, vtkSmartPointer< vtkMutableDirectedGraph > );
-  void BackTrack( vtkIdType, vtkSmartPointer< vtkMutableDirectedGraph >, std::map< unsigned int, unsigned char >*, double* );
+  void InitializeTransitionWeights();
 
   double EdgeWeightAngleSigma;
 
-  bool IsNonRootLeafNode( vtkIdType, vtkSmartPointer< vtkMutableDirectedGraph > );
   bool GetEdgeWeight( unsigned int, unsigned int, vtkSmartPointer< vtkPolyData >, double* );
 
   vtkSmartPointer< vtkMutableUndirectedGraph > MinimumSpanningTree;
 
   std::map< unsigned int, unsigned char >                    ParticleIDToAirwayGenerationMap;
-  std::map< unsigned int, std::map<unsigned char, double> >  ParticleIDToEmissionProbabilitiesMap;
   std::vector< SUBGRAPH >                                    Subgraphs;
   std::vector< unsigned char >                               States;
   std::vector< TRANSITIONPROBABILITY >                       TransitionProbabilities;
   std::vector< TRANSITIONPROBABILITY >                       TransitionProbabilityPriors;
   std::vector< vtkSmartPointer< vtkPolyData > >              AirwayGenerationLabeledAtlases;
+  std::vector< ATLASINDEX >                                  AtlasIndices;
+
+  // The input particle scales and 'hevec2' directions (and their
+  // magnitudes), the emission probabilities of every particle for
+  // every state and their logs ('EmissionWeights'), and the transition
+  // probability priors as a 'NumberOfStates' x 'NumberOfStates' matrix
+  // (source state rows, target state columns). States are referred to
+  // by their index in 'States'.
+  std::vector< double >                                      ParticleScales;
+  std::vector< double >                                      ParticleDirections;
+  std::vector< double >                                      ParticleDirectionMagnitudes;
+  std::vector< double >                                      EmissionProbabilities;
+  std::vector< double >                                      EmissionWeights;
+  std::vector< double >                                      TransitionPriors;
+
+  // The score of the labeling of the subgraph of every input particle
+  std::vector< double >                                      ParticleLabelingScores;
 
   // For computation of the emissision probabilities, we use kernel density estimation.
   // Specifically, we use exponential distributions for both distance and angle, and
@@ -184,6 +254,7 @@ private:
   double DiffTransitionAngleIntercept2;
 
   bool         HMTMMode;
+  int          NumberOfThreads;
   int          ParticleRootNodeID;
   double       ParticleDistanceThreshold;
   double       KernelDensityEstimationROIRadius;
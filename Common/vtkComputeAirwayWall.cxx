@@ -81,6 +81,9 @@ this->OuterContour = vtkPolyData::New();
 
 this->NumberOfQuantities = 21;
 
+this->UseRayKernel = 1;
+this->RaySampler = vtkImageReformatAlongRay::New();
+
 }
 
 //----------------------------------------------------------------------------
@@ -91,6 +94,7 @@ this->StatsMean->Delete();
 this->StatsMinMax->Delete();
 this->InnerContour->Delete();
 this->OuterContour->Delete();
+this->RaySampler->Delete();
 }
 
 //----------------------------------------------------------------------------
@@ -190,7 +194,12 @@ void vtkComputeAirwayWall::ExecuteDataWithInformation(vtkDataObject *out,
  vtkImageReformatAlongRay *ray;
  vtkImageExtractComponents *extract;
 
- for (int i= 0; i<numKernels;i++)
+ // The ray kernel samples all the rays in one pass and works on plain
+ // arrays. The multiple kernels method still goes through one reformat
+ // filter per kernel and ray.
+ int useKernel = (this->UseRayKernel && numKernels == 1 && this->Method != 3);
+
+ for (int i= 0; i<numKernels && !useKernel;i++)
    {
    ray = vtkImageReformatAlongRay::New();
    rayCollection->AddItem(ray);
@@ -421,34 +430,167 @@ vtkDoubleArray *angleInner = vtkDoubleArray::New();
 vtkDoubleArray *angleOuter = vtkDoubleArray::New();
 
 vtkDoubleArray *lumenA = vtkDoubleArray::New();
-int idx=0;
- for (double th =0 ; th < 2*vtkMath::Pi()-dth/2; th +=dth,idx++) {
-    signalCollection->RemoveAllItems();
-    for (int i=0; i<numKernels; i++) {
-      ray = static_cast<vtkImageReformatAlongRay*> (rayCollection->GetItemAsObject(i));
-      ray->SetTheta(th);
-      ray->Update();
-      signal = (vtkDoubleArray *)ray->GetOutput()->GetPointData()->GetScalars();
-      ray->GetOutput()->GetSpacing(sp);
-      signalCollection->AddItem(signal);
-    }
+
+// Ray angles
+std::vector<double> thetas;
+for (double th =0 ; th < 2*vtkMath::Pi()-dth/2; th +=dth) {
+  thetas.push_back(th);
+}
+int nrays = thetas.size();
+
+// Ray kernel: sample all the rays into the SoA scratch buffers
+int stride = 0;
+vtkDoubleArray *pcSignal = NULL;
+vtkImageData *pcInput = NULL;
+vtkGeneralizedPhaseCongruency *pcFilter = NULL;
+if (useKernel) {
+  double insp[3];
+  input->GetSpacing(insp);
+  this->RaySampler->SetCenter(center);
+  this->RaySampler->SetRMin(this->RMin);
+  this->RaySampler->SetRMax(this->RMax);
+  this->RaySampler->SetScale(this->Scale);
+  this->RaySampler->SetDelta(delta);
+  for (int r=0; r<nrays; r++) {
+    int n = this->RaySampler->GetNumberOfSamples(insp,thetas[r]);
+    if (n > stride)
+      stride = n;
+  }
+  // One extra sample so that reads one past the end of the last ray stay
+  // inside the buffer
+  size_t bufferSize = static_cast<size_t>(nrays)*stride + 1;
+  if (this->RayValues.size() < bufferSize) {
+    this->RayValues.resize(bufferSize);
+    this->RayGradient.resize(bufferSize);
+    this->RayHessian.resize(bufferSize);
+  }
+  this->RayNumberOfSamples.resize(nrays);
+  this->RaySpacing.resize(nrays);
+  if (!this->RaySampler->SampleRays(input,&thetas[0],nrays,stride,&this->RayValues[0],
+                                    &this->RayGradient[0],&this->RayHessian[0],
+                                    &this->RayNumberOfSamples[0],&this->RaySpacing[0])) {
+    vtkErrorMacro(<< "ExecuteData: Ray sampling failed.");
+    useKernel = 0;
+    for (int i= 0; i<numKernels;i++)
+      {
+      ray = vtkImageReformatAlongRay::New();
+      rayCollection->AddItem(ray);
+      extract = vtkImageExtractComponents::New();
+      extract->SetInputData(input);
+      extract->SetComponents(i);
+      extract->Update();
+      ray->SetInputData(extract->GetOutput());
+      ray->SetCenter(center);
+      ray->SetRMin(this->RMin);
+      ray->SetRMax(this->RMax);
+      ray->SetScale(this->Scale);
+      ray->SetDelta(delta);
+      extractCollection->AddItem(extract);
+      }
+  }
+
+  if (useKernel && this->Method == 2) {
+    // Phase congruency pipeline reused for all the rays
+    pcSignal = vtkDoubleArray::New();
+    pcInput = vtkImageData::New();
+    pcInput->SetSpacing(1,1,1);
+    pcFilter = vtkGeneralizedPhaseCongruency::New();
+    pcFilter->SetInputData(pcInput);
+    pcFilter->SetNumberOfScales(this->NumberOfScales);
+    pcFilter->SetBandwidth(this->Bandwidth);
+    pcFilter->SetMultiplicativeFactor(this->MultiplicativeFactor);
+    pcFilter->SetMinimumWavelength(this->MinimumWavelength);
+    pcFilter->SetUseWeights(this->UseWeights);
+    pcFilter->SetWeights(this->Weights);
+  }
+}
+
+// Current ray: value and first derivative and number of samples
+const double *sigValue = NULL;
+const double *sigGrad = NULL;
+int nsig = 0;
+
+for (int idx=0; idx<nrays; idx++) {
+    double th = thetas[idx];
+    if (useKernel) {
+      nsig = this->RayNumberOfSamples[idx];
+      sigValue = &this->RayValues[static_cast<size_t>(idx)*stride];
+      sigGrad = &this->RayGradient[static_cast<size_t>(idx)*stride];
+      const double *sigHess = &this->RayHessian[static_cast<size_t>(idx)*stride];
+      sp[0] = this->RaySpacing[idx];
+
+      switch(this->Method) {
+         case 0:
+            this->FWHM(sigValue,sigGrad,sigHess,nsig,loc1,loc2);
+            break;
+         case 1:
+            this->ZeroCrossing(sigValue,sigGrad,sigHess,nsig,loc1,loc2);
+            break;
+         case 2:
+            {
+            pcSignal->SetArray(const_cast<double *>(sigValue),nsig,1);
+            pcInput->SetExtent(0,nsig-1,0,0,0,0);
+            pcInput->GetPointData()->SetScalars(pcSignal);
+            pcInput->Modified();
+            pcFilter->Update();
+            vtkDoubleArray *pcV = (vtkDoubleArray *) (pcFilter->GetOutput()->GetPointData()->GetScalars());
+            int npc = pcV->GetNumberOfTuples();
+            int ncomp = pcV->GetNumberOfComponents();
+            if (npc < 3) {
+              loc1 = -1;
+              loc2 = -1;
+              break;
+            }
+            const double *pcPtr = pcV->GetPointer(0);
+            this->PC1.resize(npc);
+            this->PC2.resize(npc);
+            for (int k=0; k<npc; k++) {
+              this->PC1[k] = pcPtr[k*ncomp+1];
+              this->PC2[k] = pcPtr[k*ncomp+2];
+            }
+            this->PhaseCongruency(sigValue,sigGrad,&this->PC1[0],&this->PC2[0],npc,loc1,loc2);
+            }
+            break;
+      }
+    } else {
+      signalCollection->RemoveAllItems();
+      for (int i=0; i<numKernels; i++) {
+        ray = static_cast<vtkImageReformatAlongRay*> (rayCollection->GetItemAsObject(i));
+        ray->SetTheta(th);
+        ray->Update();
+        signal = (vtkDoubleArray *)ray->GetOutput()->GetPointData()->GetScalars();
+        ray->GetOutput()->GetSpacing(sp);
+        signalCollection->AddItem(signal);
+      }
     
-    switch(this->Method) {
-       case 0:
-          this->FWHM(signal,samples);
-          break;
-       case 1:
-          this->ZeroCrossing(signal,samples);
-          break;
-       case 2:
-          this->PhaseCongruency(signal,samples);
-          break;
-       case 3:
-          this->PhaseCongruencyMultipleKernels(signalCollection,samples,sp[0]);
-          break;
+      switch(this->Method) {
+         case 0:
+            this->FWHM(signal,samples);
+            break;
+         case 1:
+            this->ZeroCrossing(signal,samples);
+            break;
+         case 2:
+            this->PhaseCongruency(signal,samples);
+            break;
+         case 3:
+            this->PhaseCongruencyMultipleKernels(signalCollection,samples,sp[0]);
+            break;
+      }
+      loc1 = samples->GetValue(0);
+      loc2 = samples->GetValue(1);
+
+      // Copy the value and first derivative of the ray for the statistics
+      nsig = signal->GetNumberOfTuples();
+      this->RayValues.resize(nsig+1);
+      this->RayGradient.resize(nsig+1);
+      for (int k=0; k<nsig; k++) {
+        this->RayValues[k] = signal->GetComponent(k,0);
+        this->RayGradient[k] = signal->GetComponent(k,1);
+      }
+      sigValue = &this->RayValues[0];
+      sigGrad = &this->RayGradient[0];
     }
-    loc1 = samples->GetValue(0);
-    loc2 = samples->GetValue(1);
    
     if (loc1>loc2 && loc2!= -1) {
       cout<<"WARNING: Inner radius (loc1="<<loc1<<") is greater than outer radius (loc2="<<loc2<<")."<<endl;
@@ -491,7 +633,7 @@ int idx=0;
         tmpMax = -5000;
         tmpMin = 5000;
         for(int k= (int) loc1; k< (int) loc2; k++) {
-            tmp = signal->GetComponent(k,0);
+            tmp = sigValue[k];
             meanI += tmp;
             stdI += tmp*tmp;
             if (tmp>tmpMax)
@@ -516,14 +658,14 @@ int idx=0;
         if (tmpMax< tmpPeakMin)
           tmpPeakMin = tmpMax;
         // Inner and Outer: Mean and Min-Max
-        tmp = signal->GetComponent((int) loc1,0);
+        tmp = sigValue[(int) loc1];
         meanInnerI += tmp;
         stdInnerI += tmp*tmp;
         if (tmp > tmpInnerMax)
           tmpInnerMax = tmp;
         if (tmp < tmpInnerMin)
           tmpInnerMin = tmp;
-        tmp = signal->GetComponent((int) loc2,0);
+        tmp = sigValue[(int) loc2];
         meanOuterI += tmp;
         stdOuterI += tmp*tmp;
         if (tmp > tmpOuterMax)
@@ -558,8 +700,8 @@ int idx=0;
          // Insert values in the lumen Array: The stats should be computed outside the loop
          tmpLA = 10000;
          for (int k=0; k< (int) (loc1/4.0); k++) {
-            if (signal->GetComponent(k,0)<tmpLA)
-              tmpLA = signal->GetComponent(k,0);
+            if (sigValue[k]<tmpLA)
+              tmpLA = sigValue[k];
          }
          lumenA->InsertNextValue(tmpLA);
 
@@ -567,14 +709,14 @@ int idx=0;
         // The parenchyma region is defined as the mean attenuation between
         // the first zero and lumen+alpha*(wall thickness)
         int gradsign = 1;
-        if (signal->GetComponent((int) loc2,1) >= 0)
+        if (sigGrad[(int) loc2] >= 0)
           gradsign = 1;
         else
           gradsign = -1;
        int zeroLoc = -1;
-        for (int k=(int) loc2; k<signal->GetNumberOfTuples();k++)
+        for (int k=(int) loc2; k<nsig;k++)
           {
-          if(signal->GetComponent(k,1) >= 0)
+          if(sigGrad[k] >= 0)
             {
             if (gradsign == -1)
               {
@@ -594,20 +736,25 @@ int idx=0;
         double Tpa = (loc1 + this->Alpha * (loc2-loc1));
         tmpPA = 0;
         int tmpSamples = 0;
-        if ((int)Tpa > signal->GetNumberOfTuples())
-          Tpa = signal->GetNumberOfTuples();
+        if ((int)Tpa > nsig)
+          Tpa = nsig;
+        // Single sample reads stop at the last sample of the ray: in the
+        // ray kernel buffers the next sample belongs to the next ray
+        int paLoc = (int) (Tpa);
+        if (paLoc > nsig-1)
+          paLoc = nsig-1;
         if (zeroLoc > loc2) {
           for (int k = (int) zeroLoc ; k<(int) (Tpa); k++) {
-            tmpPA += signal->GetComponent(k,0);
+            tmpPA += sigValue[k];
             tmpSamples++;
           }
           if (tmpSamples == 0)
            {
-           tmpPA = signal->GetComponent((int) (Tpa),0);
+           tmpPA = sigValue[paLoc];
            tmpSamples++;
            }
         } else {
-          tmpPA = signal->GetComponent((int) (Tpa),0);
+          tmpPA = sigValue[paLoc];
           tmpSamples++;
         }
         tmpPA=tmpPA/tmpSamples;
@@ -673,7 +820,7 @@ int idx=0;
           tmpMax = -5000;
           tmpMin = 5000;
           for(int k= (int) loc1; k< (int) loc2; k++) {
-            tmp = signal->GetComponent(k,0);
+            tmp = sigValue[k];
             meanIS += tmp;
             stdIS += tmp*tmp;
             if (tmp>tmpMax)
@@ -699,14 +846,14 @@ int idx=0;
             tmpPeakMinS = tmpMax;
 
           // Inner and Outer: Mean and Min-Max
-          tmp = signal->GetComponent((int) loc1,0);
+          tmp = sigValue[(int) loc1];
           meanInnerIS += tmp;
           stdInnerIS += tmp*tmp;
           if (tmp > tmpInnerMaxS)
             tmpInnerMaxS = tmp;
           if (tmp < tmpInnerMinS)
             tmpInnerMinS = tmp;
-          tmp = signal->GetComponent((int) loc2,0);
+          tmp = sigValue[(int) loc2];
           meanOuterIS += tmp;
           stdOuterIS += tmp*tmp;
           if (tmp > tmpOuterMaxS)
@@ -776,8 +923,8 @@ int idx=0;
  }
  
  //Remove outlier
- this->RemoveOutliers(radiusInner);
- this->RemoveOutliers(radiusOuter);
+ this->RemoveOutliers(radiusInner->GetPointer(0),radiusInner->GetNumberOfTuples());
+ this->RemoveOutliers(radiusOuter->GetPointer(0),radiusOuter->GetNumberOfTuples());
 
 // Interpolate points that have not been computed
 /*
@@ -1375,19 +1522,31 @@ signalCollection->Delete();
 rayCollection->Delete();
 extractCollection->Delete();
 lumenA->Delete();
+if (pcFilter)
+  {
+  pcFilter->Delete();
+  pcInput->Delete();
+  pcSignal->Delete();
+  }
 }
 
 
 void vtkComputeAirwayWall::RemoveOutliers(vtkDoubleArray *r) {
+
+  this->RemoveOutliers(r->GetPointer(0),r->GetNumberOfTuples());
+
+}
+
+void vtkComputeAirwayWall::RemoveOutliers(double *r, int n) {
   
   double mean=0;
   double std=0;
   double e2=0;
   int tt = 0;
-  for (int k=0; k < r->GetNumberOfTuples(); k++) {
-    if ( r->GetValue(k) > 0) {
-      mean += r->GetValue(k);
-      e2 += r->GetValue(k) * r->GetValue(k);
+  for (int k=0; k < n; k++) {
+    if ( r[k] > 0) {
+      mean += r[k];
+      e2 += r[k] * r[k];
       tt++;
     }  
   }
@@ -1401,11 +1560,11 @@ void vtkComputeAirwayWall::RemoveOutliers(vtkDoubleArray *r) {
   double e2r =0;
   double stdr = 0;
   tt = 0;
-  for (int k=0;k<r->GetNumberOfTuples(); k++) {
-    if (r->GetValue(k)>0) {
-      if (fabs((r->GetValue(k)-mean)) < 2*std) {
-	meanr += r->GetValue(k);
-	e2r += r->GetValue(k) * r->GetValue(k);
+  for (int k=0;k<n; k++) {
+    if (r[k]>0) {
+      if (fabs((r[k]-mean)) < 2*std) {
+	meanr += r[k];
+	e2r += r[k] * r[k];
         tt++;
       }
     }
@@ -1415,12 +1574,11 @@ void vtkComputeAirwayWall::RemoveOutliers(vtkDoubleArray *r) {
   e2r = e2r/tt;
   
   stdr = sqrt(e2r-meanr*meanr);
-  //cout<<"Robust mean = "<<meanr<<" Robust std = "<<stdr<<endl;
  
   //Set points to -1 that fall beyond the criteria
-  for (int k=0; k<r->GetNumberOfTuples(); k++) {
-    if (fabs(r->GetValue(k)-meanr) >= 2*stdr) {
-      r->SetValue(k,-1);
+  for (int k=0; k<n; k++) {
+    if (fabs(r[k]-meanr) >= 2*stdr) {
+      r[k] = -1;
     }
   }
   
@@ -2150,6 +2308,389 @@ while (initIdx < np-1) {
 
 }
 
+//----------------------------------------------------------------------------
+// Ray kernel versions of the wall detection methods. They work on plain
+// arrays holding the samples of one ray (value c, first derivative cp and
+// second derivative cpp) and use the object scratch buffers instead of
+// allocating arrays for every ray. They follow the vtkDoubleArray versions
+// step by step and return the same locations.
+
+void vtkComputeAirwayWall::FWHM(const double *c, const double *cp, const double *cpp, int ntuples, double &rmin, double &rmax) {
+
+std::vector<double> &gzeros = this->Zeros1;
+this->FindZeros(cp,cpp,NULL,ntuples,gzeros);
+vtkDebugMacro("FWHM: Num zeros: "<<gzeros.size());
+
+int nzeros = gzeros.size();
+double loc,loc1,loc2;
+double val,val1,val2;
+double valg;
+
+if (nzeros<1)
+  {
+  rmin=-1;
+  rmax=-1;
+  return;
+  }
+
+//Auto adjust wall threhold if the current one is lower that a mean of the estimated luminal samples
+int wallTh;
+int meanLuminalI = 0;
+int lumenloc = 15;
+//Find mean intensity in lumen based on first zero
+if (gzeros[0]<lumenloc && gzeros[0]>=1)
+  lumenloc = (int) gzeros[0];
+
+for (int k=0;k< (int) lumenloc;k++)
+  {
+  if (k>=ntuples-1)
+    break;
+  meanLuminalI += (int) (c[k]);
+  }
+meanLuminalI = (int) (meanLuminalI/lumenloc);
+
+if(this->WallThreshold <= meanLuminalI )
+  {
+  wallTh = this->WallThreshold + meanLuminalI;
+  }
+else
+  {
+  wallTh = this->WallThreshold;
+  }
+
+for (int k=0; k<nzeros; k++) {
+  loc=gzeros[k];
+  //Check loc is in the allowed range
+  if (int(loc)>=ntuples-1 || int(loc)<0)
+    continue;
+  //Wall Candidate
+  val = c[(int) loc];
+  if (val>wallTh ) {
+    //Wall center point (loc) has to be a maxima (cpp =< 0). We let inflection points pass.
+    if (cpp[(int) loc] > 0) {
+      continue;
+    }
+    // Get valley locations at both size of the wall maxima.
+    if (k==0)
+      {
+      loc1=1;
+      }
+    else
+      {
+      loc1 = gzeros[k-1];
+      }
+    if (k>=nzeros-1)
+      {
+      loc2 = ntuples-1;
+      }
+    else
+      {
+      loc2 = gzeros[k+1];
+      }
+
+    //Check loc1 is in the allowed range
+    if (int(loc1) >=ntuples || int(loc1) <0) {
+      //Loc1 is out of range
+      break;
+    } else {
+      val1 = c[(int) loc1];
+      rmin=this->FindValue(c,ntuples,(int) loc1,(val+val1)/2);
+      // A value that was not found (rmin = -1) does not qualify
+      valg = (rmin >= 0) ? cp[(int) rmin] : 0;
+      // Check that the inner wall location gradient is above the threshold.
+      if (fabs(valg)<this->GradientThreshold)
+        {
+        cout<<" Gradient= "<<fabs(valg)<<" at rmin="<<rmin<<endl;
+        continue;
+        }
+    }
+    //Check loc2 is in the allowed range
+    if (int(loc2) >=ntuples || int(loc2) <0) {
+      // Loc2 is out of range but loc1 was assigned, set rmax to -1 and let it finish.
+      rmax = -1;
+    } else {
+      val2 = c[(int) loc2];
+      rmax=this->FindValue(c,ntuples,(int) loc,(val+val2)/2);
+    }
+    return;
+    }
+}
+
+//We did not find a wall
+rmin = -1;
+rmax = -1;
+}
+
+void vtkComputeAirwayWall::ZeroCrossing(const double *c, const double *cp, const double *cpp, int nc, double &rmin, double &rmax) {
+
+std::vector<double> &gzeros = this->Zeros1;
+std::vector<double> &hzeros = this->Zeros2;
+this->FindZeros(cp,cpp,NULL,nc,gzeros);
+this->FindZeros(cpp,NULL,NULL,nc,hzeros);
+
+int ngzeros = gzeros.size();
+int nhzeros = hzeros.size();
+double loc,loc1,loc2;
+double val,valg;
+rmin=-1;
+rmax=-1;
+if (nc<3)
+ {
+ return;
+ }
+
+//Auto adjust wall threhold if the current one is lower that a mean of the first samples
+int wallTh;
+if(this->WallThreshold < (c[0] + c[1])/2)
+  wallTh = this->WallThreshold + (int) ((c[0] + c[1])/2);
+else
+  wallTh = this->WallThreshold;
+
+for (int k=0; k<ngzeros; k++) {
+
+  loc=gzeros[k];
+  //Check loc is in the allowed range
+  if ((int)(loc) >= nc-1 || (int)(loc) < 0)
+    continue;
+
+  //Wall center point (loc) has to be a maxima (cpp <= 0). We let inflection points pass.
+  if (cpp[(int) loc] > 0) {
+    continue;
+  }
+  //Wall Candidate
+  val = c[(int) loc];
+  if (val>wallTh) {
+    for (int j=0;j<nhzeros-1;j++) {
+      loc1=hzeros[j];
+      loc2=hzeros[j+1];
+      valg = cp[(int) loc1];
+      //Zero crossing is beyond zero gradient
+      if (loc1> loc) {
+        break;
+      }
+
+      // Check zero crossing is between gradient zero and
+      // that inner wall location gradient is above the threshold
+      if(loc1<=loc && loc2>=loc && fabs(valg)>=this->GradientThreshold) {
+        rmin=loc1;
+        rmax=loc2;
+        return;
+      }
+    }
+  }
+}
+
+}
+
+void vtkComputeAirwayWall::PhaseCongruency(const double *c, const double *cp, const double *pc1, const double *pc2, int ntuples, double &rmin, double &rmax)
+{
+
+int nc = ntuples;
+rmin=-1;
+rmax=-1;
+if (nc<3)
+ {
+ return;
+ }
+
+this->DPC1.resize(ntuples);
+this->DPC2.resize(ntuples);
+double *dpc1 = &this->DPC1[0];
+double *dpc2 = &this->DPC2[0];
+
+//Finite differences using five-point method. The loop has no dependencies
+//between iterations and is vectorized by the compiler.
+for (int k=2;k<ntuples-2;k++) {
+   dpc1[k] = (-pc1[k+2]+8*pc1[k+1]-8*pc1[k-1]+pc1[k-2])/12;
+   dpc2[k] = (-pc2[k+2]+8*pc2[k+1]-8*pc2[k-1]+pc2[k-2])/12;
+}
+//For points close to the boundaries use central finite differences
+int boundaries[2];
+boundaries[0]=1;
+boundaries[1]=ntuples-2;
+for (int bb=0;bb<2;bb++) {
+  int k = boundaries[bb];
+  dpc1[k] = (pc1[k+1]-pc1[k-1])*0.5;
+  dpc2[k] = (pc2[k+1]-pc2[k-1])*0.5;
+}
+dpc1[0] = dpc1[1];
+dpc2[0] = dpc2[1];
+dpc1[ntuples-1] = dpc1[ntuples-2];
+dpc2[ntuples-1] = dpc2[ntuples-2];
+
+std::vector<double> &pczeros = this->Zeros1;
+int npczeros;
+double loc=0;
+double val, valg, pcval;
+
+this->FindZeros(dpc1,NULL,NULL,ntuples,pczeros);
+npczeros = pczeros.size();
+
+//Auto adjust wall threhold if the current one is lower that a mean of the estimated luminal samples
+double wallTh;
+int meanLuminalI=0;
+int zeroLoc=-1;
+//Find first location where pc correspondig to pczero is greater than zero (or PCThreshold to avoid noisy areas)
+for (int k=0; k< npczeros;k++) {
+  loc = pczeros[k];
+  if (loc<nc)
+    {
+    if (pc1[(int) loc] > this->PCThreshold)
+      {
+      zeroLoc = k;
+      break;
+      }
+    }
+}
+
+if (zeroLoc >= 0)
+{
+  for (int k=0; k< (int) (pczeros[zeroLoc]);k++)
+    {
+      if (k>=nc-1)
+        break;
+      meanLuminalI += (int) (c[k]);
+    }
+  meanLuminalI = (int) (meanLuminalI/pczeros[zeroLoc]);
+} else {
+  meanLuminalI = (int) (c[0] + c[1])/2;
+}
+
+// For PC, wallTh is used to probe the pixel value at the boundary
+//point, no like FWHM and ZeroCrossing.
+if(this->WallThreshold < meanLuminalI)
+  {
+  wallTh = meanLuminalI;
+  }
+else
+  {
+  //Threalhold at airway wall is taken as FWHM value
+  wallTh = (this->WallThreshold + (meanLuminalI))*0.5;
+  }
+
+double dc_offset=0;
+if (wallTh < 0 )
+  dc_offset = 1000;
+
+//Gradient threshold
+double wallGradTh = this->GradientThreshold;
+
+// Find Inner Wall
+for (int k=0; k<npczeros; k++) {
+  loc=pczeros[k];
+
+  //Check loc is in the allowed range
+  if ( loc >=nc-1 || loc >=ntuples-1 || loc<2)
+    continue;
+
+  //Wall Candidate
+  val = c[(int) loc];
+  valg = cp[(int) loc];
+  pcval = pc1[(int) loc];
+  if ((val - wallTh)/(wallTh+dc_offset) > -0.10*pcval && (fabs(valg) - wallGradTh)/wallGradTh > -0.10*pcval && pcval > this->PCThreshold) {
+    rmin = loc;
+    break;
+  }
+}
+
+// Find Outer Wall
+this->FindZeros(dpc2,NULL,NULL,ntuples,pczeros);
+npczeros = pczeros.size();
+
+for (int k=0; k<npczeros; k++) {
+  loc=pczeros[k];
+  //Wall Candidate
+  val = c[(int) loc];
+  pcval = pc2[(int) loc];
+  if ((val - wallTh)/(wallTh+dc_offset) > -0.20*pcval && pcval > this->PCThreshold && loc>rmin) {
+    rmax = loc;
+    break;
+  }
+}
+
+}
+
+double vtkComputeAirwayWall::FindValue(const double *c, int ntuples, int loc, double target) {
+double val0 = c[loc];
+int up;
+if (val0<target) {
+ up = 1;
+} else {
+ up =0;
+}
+for (int k=loc; k< ntuples; k++) {
+  val0=c[k];
+  if (up == 1 && val0 > target) {
+    return (k+(k-1))/2;
+  }
+  if (up == 0 && val0 < target) {
+    return (k+(k-1))/2;
+  }
+}
+// If we do not find the value return -1.
+return -1;
+}
+
+// Zeros of a signal given as a plain array of np samples. The zeros are
+// returned in the reusable vector zeros as 0-based coordinates.
+void vtkComputeAirwayWall::FindZeros(const double *c, const double *cp, const double *cpp, int np, std::vector<double> &zeros) {
+
+zeros.clear();
+
+int derivatives =0;
+if (cp != NULL) {
+   derivatives++;
+   if (cpp != NULL)
+     derivatives++;
+}
+int initIdx =0;
+int err = 0;
+double val0,val1,zero;
+int k=0;
+while (initIdx < np-1) {
+   val0 = c[initIdx];
+
+   //Check if we are in a zero
+   if (val0 ==0)
+     {
+     zeros.push_back(initIdx);
+     initIdx++;
+     continue;
+     }
+
+   for (k =initIdx+1; k<np; k++) {
+      val1 = c[k];
+      //Check for a change of sign
+      if (val0*val1 <0) {
+        val0 = c[k-1];
+         switch (derivatives) {
+             case 0:
+                err =this->FindZeroLocation(val0,val1,1,zero);
+                break;
+            case 1:
+                err =this->FindZeroLocation(val0,cp[k-1],val1,cp[k],1,zero);
+                break;
+            case 2:
+                err =this->FindZeroLocation(val0,cp[k-1],cpp[k-1],
+                                        val1,cp[k],cpp[k],1,zero);
+                break;
+          }
+         if(err == 1) {
+           zeros.push_back(k-1+zero);
+         }
+         //Break to while loop starting from initIdx
+         // val1 becomes val0
+         initIdx= k;
+         break;
+      }
+
+    }
+   if (k>=np)
+    break;
+}
+
+}
+
 // Finds the coordinate of the zero crossing based on the bracket points around the zero.
 // First and second order derivative are known.
 // fm1 = f(x_1): point left to the zero
@@ -2222,5 +2763,6 @@ return 1;
 void vtkComputeAirwayWall::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os, indent);
+  os << indent << "UseRayKernel: " << this->UseRayKernel << "\n";
 }
 
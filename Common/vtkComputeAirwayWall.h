@@ -28,6 +28,10 @@
 #include "vtkPolyData.h"
 #include "vtkDataArrayCollection.h"
 
+#include <vector>
+
+class vtkImageReformatAlongRay;
+
 // VTK6 migration note:
 // Replaced suplerclass vtkImageToImageFilter with vtkImageAlgorithm
 // instead of vtkThreadedImageAlgorithm since this class did not provide
@@ -118,6 +122,15 @@ public:
 
   vtkGetMacro(NumberOfQuantities,int);
 
+  // Description: Use the ray kernel (default on). All the rays of the
+  // input cross section are sampled in one pass into a reusable buffer
+  // and the wall is located on plain arrays, giving the same radii as the
+  // one-filter-per-ray path. The multiple kernels method (Method 3) always
+  // uses the one-filter-per-ray path.
+  vtkSetMacro(UseRayKernel,int);
+  vtkGetMacro(UseRayKernel,int);
+  vtkBooleanMacro(UseRayKernel,int);
+
   vtkGetObjectMacro(StatsMean,vtkDoubleArray);
   vtkGetObjectMacro(StatsMinMax,vtkDoubleArray);
   vtkGetObjectMacro(InnerContour,vtkPolyData);
@@ -134,6 +147,13 @@ public:
   void PhaseCongruency(vtkDoubleArray *c, vtkDoubleArray *cp, vtkDoubleArray *pcV,vtkDoubleArray *values);
   void PhaseCongruencyMultipleKernels(vtkDataArrayCollection *signalCollection, vtkDoubleArray *values,double sp);
 
+  // Description: Ray kernel versions working on the n samples of a ray
+  // stored in plain arrays.
+  void RemoveOutliers(double *r, int n);
+  void FWHM(const double *c, const double *cp, const double *cpp, int n, double &rmin, double &rmax);
+  void ZeroCrossing(const double *c, const double *cp, const double *cpp, int n, double &rmin, double &rmax);
+  void PhaseCongruency(const double *c, const double *cp, const double *pc1, const double *pc2, int n, double &rmin, double &rmax);
+
 protected:
   vtkComputeAirwayWall();
   ~vtkComputeAirwayWall();
@@ -154,6 +174,8 @@ protected:
   int FindZeroLocation(double fm1, double fm1p, double f1, double f1p,
                         double delta, double & zero);
   int FindZeroLocation(double fm1, double f1, double delta, double & zero);
+  double FindValue(const double *c, int n, int loc, double target);
+  void FindZeros(const double *c, const double *cp, const double *cpp, int n, std::vector<double> &zeros);
   int Method;
   int WallThreshold;
   double GradientThreshold;
@@ -186,6 +208,23 @@ protected:
   int ActivateSector;
 
   int NumberOfQuantities;
+
+  // Ray kernel sampler and scratch buffers. The ray buffers hold one row
+  // of samples per ray (structure of arrays); they are kept between
+  // executions so that they are only allocated once.
+  int UseRayKernel;
+  vtkImageReformatAlongRay *RaySampler;
+  std::vector<double> RayValues;
+  std::vector<double> RayGradient;
+  std::vector<double> RayHessian;
+  std::vector<double> RaySpacing;
+  std::vector<int> RayNumberOfSamples;
+  std::vector<double> PC1;
+  std::vector<double> PC2;
+  std::vector<double> DPC1;
+  std::vector<double> DPC2;
+  std::vector<double> Zeros1;
+  std::vector<double> Zeros2;
 private:
   vtkComputeAirwayWall(const vtkComputeAirwayWall&);  // Not implemented.
   void operator=(const vtkComputeAirwayWall&);  // Not implemented.
@@ -29,6 +29,10 @@
 
 #include "vtkNRRDWriterCIP.h"
 #include "vtkSmartPointer.h"
+#include "vtkMultiThreader.h"
+#include "vtkCriticalSection.h"
+
+#include <vector>
 
 
 #ifdef WIN32
@@ -59,6 +63,9 @@ vtkComputeAirwayWallPolyData::vtkComputeAirwayWallPolyData()
   this->AirwayImagePrefix= NULL;
   this->SaveAirwayImage=0;
 
+  this->NumberOfThreads = 1;
+  this->BlockSize = 16;
+
 }
 
 vtkComputeAirwayWallPolyData::~vtkComputeAirwayWallPolyData()
@@ -218,54 +225,31 @@ int vtkComputeAirwayWallPolyData::RequestData(vtkInformation *request,
   vtkPolyData *output = this->GetOutput();
   vtkImageData *im = this->GetImage();
   double orig[3];
-  int dim[3];
-  double sp[3], p[3],ijk[3];
-  double x[3],y[3],z[3];
+  double sp[3];
   im->GetOrigin(orig);
   im->GetSpacing(sp);
-  im->GetDimensions(dim);
   
   output->DeepCopy(input);
   
   cout<<"Spacing: "<<sp[0]<<" "<<sp[1]<<" "<<sp[2]<<endl;
   cout<<"Origin: "<<orig[0]<<" "<<orig[1]<<" "<<orig[2]<<endl;
   
-  double resolution = this->Resolution;
-
-  //Create helper objects
-  vtkImageResliceWithPlane *reslicer = vtkImageResliceWithPlane::New();
-  // Set up options
-  if (this->GetReformat()){
-    reslicer->InPlaneOff();
-  } else {
-    reslicer->InPlaneOn();
-  }
-  reslicer->SetInputData(this->GetImage());
-  reslicer->SetInterpolationModeToCubic();
-  reslicer->ComputeCenterOff();
-  reslicer->SetDimensions(256,256,1);
-  reslicer->SetSpacing(resolution,resolution,resolution);
-
+  // Resolve the axis computation mode
   switch(this->GetAxisMode()) {
     case VTK_HESSIAN:
-      reslicer->ComputeAxesOn();
       break;
     case VTK_POLYDATA:
       if (input->GetLines() == NULL) {
-        reslicer->ComputeAxesOn();
         this->SetAxisMode(VTK_HESSIAN);
       } else {
         this->ComputeAirwayAxisFromLines();
-        reslicer->ComputeAxesOff();
       }
       break;
     case VTK_VECTOR:
       if (input->GetPointData()->GetVectors() == NULL)
        {
-        reslicer->ComputeAxesOn();
         this->SetAxisMode(VTK_HESSIAN);
        } else {
-        reslicer->ComputeAxesOff();
 	cout<<"Using vectors"<<endl;
        }
       break;
@@ -369,25 +353,100 @@ int vtkComputeAirwayWallPolyData::RequestData(vtkInformation *request,
   ellipse->SetNumberOfComponents(6);
   ellipse->SetNumberOfTuples(np);
 
-  
-  vtkEllipseFitting *eifit = vtkEllipseFitting::New();
-  vtkEllipseFitting *eofit = vtkEllipseFitting::New();
-  
-  // Loop through each point
+  // Per point results: nc means, nc stds, nc mins, nc maxs and the ellipse parameters
+  int resultSize = 4*nc + 6;
   int npts = input->GetNumberOfPoints();
-  for (vtkIdType k=0; k<npts; k++) {
-  //for (vtkIdType k=63; k<67; k++) {
-    input->GetPoints()->GetPoint(k,p);
-    cout<<"Processing point "<<k<<" out of "<<npts<<endl;
-    
-   
+  std::vector<double> results;
+
+  if (this->NumberOfThreads <= 1)
+    {
+    results.resize(resultSize);
+
+    //Create helper objects
+    vtkImageResliceWithPlane *reslicer = vtkImageResliceWithPlane::New();
+    this->SetupReslicer(reslicer,this->GetImage());
+    vtkEllipseFitting *eifit = vtkEllipseFitting::New();
+    vtkEllipseFitting *eofit = vtkEllipseFitting::New();
+
+    // Loop through each point
+    for (vtkIdType k=0; k<npts; k++) {
+      cout<<"Processing point "<<k<<" out of "<<npts<<endl;
+      this->ComputeAirwayWallForPoint(k,reslicer,this->WallSolver,eifit,eofit,&results[0]);
+      this->StoreResults(k,&results[0],mean,std,min,max,ellipse);
+    }
+    eifit->Delete();
+    eofit->Delete();
+    reslicer->Delete();
+    }
+  else
+    {
+    results.resize(static_cast<size_t>(npts)*resultSize);
+    this->ThreadedExecute(npts,resultSize,&results[0]);
+
+    cout<<"Processed "<<npts<<" points using "<<this->NumberOfThreads<<" threads"<<endl;
+    // Assign results in point order so the output does not depend on the
+    // thread scheduling
+    for (vtkIdType k=0; k<npts; k++) {
+      this->StoreResults(k,&results[static_cast<size_t>(k)*resultSize],mean,std,min,max,ellipse);
+    }
+    }
+
+
+  //Compute stats for each line if lines are available
+  if (input->GetLines()) {
+    this->ComputeCellData();
+  }
+  
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkComputeAirwayWallPolyData::SetupReslicer(vtkImageResliceWithPlane *reslicer, vtkImageData *image)
+{
+  // Set up options
+  if (this->GetReformat()){
+    reslicer->InPlaneOff();
+  } else {
+    reslicer->InPlaneOn();
+  }
+  reslicer->SetInputData(image);
+  reslicer->SetInterpolationModeToCubic();
+  reslicer->ComputeCenterOff();
+  reslicer->SetDimensions(256,256,1);
+  reslicer->SetSpacing(this->Resolution,this->Resolution,this->Resolution);
+
+  if (this->GetAxisMode() == VTK_HESSIAN) {
+    reslicer->ComputeAxesOn();
+  } else {
+    reslicer->ComputeAxesOff();
+  }
+}
+
+//----------------------------------------------------------------------------
+void vtkComputeAirwayWallPolyData::ComputeAirwayWallForPoint(vtkIdType k, vtkImageResliceWithPlane *reslicer,
+                                                             vtkComputeAirwayWall *worker, vtkEllipseFitting *eifit,
+                                                             vtkEllipseFitting *eofit, double *result)
+{
+  vtkPolyData *input= vtkPolyData::SafeDownCast(this->GetInput());
+  vtkImageData *im = this->GetImage();
+  double orig[3];
+  int dim[3];
+  double sp[3], p[3],ijk[3];
+  double x[3],y[3],z[3];
+  im->GetOrigin(orig);
+  im->GetSpacing(sp);
+  im->GetDimensions(dim);
+  double resolution = this->Resolution;
+
+  input->GetPoints()->GetPoint(k,p);
+
   //reslicer->SetCenter(0.5+(p[0]+orig[0])/sp[0],511-((p[1]+orig[1])/sp[1])+0.5,(p[2]-orig[2])/sp[2]);
   ijk[0]=(p[0]-orig[0])/sp[0] ;
   ijk[1]= (dim[1]-1) - (p[1]-orig[1])/sp[1];  // j coordinate has to be reflected (vtk origin is lower left and DICOM origing is upper left).
   ijk[2]=(p[2]-orig[2])/sp[2];
   //std::cout<<"point id: "<<k<<"Ijk: "<<ijk[0]<<" "<<ijk[1]<<" "<<ijk[2]<<std::endl;
   reslicer->SetCenter(ijk[0],ijk[1],ijk[2]);
-   
+
    switch(this->GetAxisMode()) {
      case VTK_HESSIAN:
        reslicer->ComputeAxesOn();
@@ -418,11 +477,9 @@ int vtkComputeAirwayWallPolyData::RequestData(vtkInformation *request,
    //cout<<"Before reslice"<<endl;
    reslicer->Update();
    //cout<<"After reslice"<<endl;
-   
-   vtkComputeAirwayWall *worker = this->WallSolver;
+
    worker->SetInputData(reslicer->GetOutput());
 
-   //this->WallSolver->SetInputData(reslicer->GetOutput());
    //Maybe we have to update the threshold depending on the center value.
    if (worker->GetMethod()==2) {
      // Use self tune phase congruency
@@ -459,14 +516,16 @@ int vtkComputeAirwayWallPolyData::RequestData(vtkInformation *request,
      ml = exp(factors[0]*pow(log(wt*factors[1]),factors[2]));
      worker->SetMultiplicativeFactor(ml);
    }
-   
+
    //cout<<"Update solver"<<endl;
    worker->Update();
    //cout<<"Done solver"<<endl;
-   
+
    // Fit ellipse model to obtain those parameters ->Move this to compute airway wall
-   vtkEllipseFitting *eifit = vtkEllipseFitting::New();
-   vtkEllipseFitting *eofit = vtkEllipseFitting::New();
+   // The fitters are reused from point to point: a contour with too few
+   // points leaves the parameters at zero, as for a new fitter
+   eifit->ResetParameters();
+   eofit->ResetParameters();
    //cout<<"Ellipse fitting 1: "<<this->WallSolver->GetInnerContour()->GetNumberOfPoints()<<endl;
    if (worker->GetInnerContour()->GetNumberOfPoints() >= 3)
    {
@@ -480,22 +539,23 @@ int vtkComputeAirwayWallPolyData::RequestData(vtkInformation *request,
       eofit->Update();
     }
    //cout<<"Done ellipse fitting"<<endl;
-   
-   // Collect results and assign them to polydata
-   for (int c = 0; c < worker->GetNumberOfQuantities();c++) {
-     mean->SetComponent(k,c,worker->GetStatsMean()->GetComponent(2*c,0));
-     std->SetComponent(k,c,worker->GetStatsMean()->GetComponent((2*c)+1,0));
-     min->SetComponent(k,c,worker->GetStatsMinMax()->GetComponent(2*c,0));
-     max->SetComponent(k,c,worker->GetStatsMinMax()->GetComponent((2*c)+1,0));
+
+   // Collect results
+   int nc = worker->GetNumberOfQuantities();
+   for (int c = 0; c < nc;c++) {
+     result[c] = worker->GetStatsMean()->GetComponent(2*c,0);
+     result[nc+c] = worker->GetStatsMean()->GetComponent((2*c)+1,0);
+     result[2*nc+c] = worker->GetStatsMinMax()->GetComponent(2*c,0);
+     result[3*nc+c] = worker->GetStatsMinMax()->GetComponent((2*c)+1,0);
    }
-   
-   ellipse->SetComponent(k,0,eifit->GetMinorAxisLength()*resolution);
-   ellipse->SetComponent(k,1,eifit->GetMajorAxisLength()*resolution);
-   ellipse->SetComponent(k,2,eifit->GetAngle());
-   ellipse->SetComponent(k,3,eofit->GetMinorAxisLength()*resolution);
-   ellipse->SetComponent(k,4,eofit->GetMajorAxisLength()*resolution);
-   ellipse->SetComponent(k,5,eofit->GetAngle());
-   
+
+   result[4*nc+0] = eifit->GetMinorAxisLength()*resolution;
+   result[4*nc+1] = eifit->GetMajorAxisLength()*resolution;
+   result[4*nc+2] = eifit->GetAngle();
+   result[4*nc+3] = eofit->GetMinorAxisLength()*resolution;
+   result[4*nc+4] = eofit->GetMajorAxisLength()*resolution;
+   result[4*nc+5] = eofit->GetAngle();
+
    if (this->SaveAirwayImage) {
      char fileName[10*256];
      vtkPNGWriter *writer = vtkPNGWriter::New();
@@ -508,18 +568,141 @@ int vtkComputeAirwayWallPolyData::RequestData(vtkInformation *request,
      airwayImage->Delete();
      writer->Delete();
   }
-  
-    eifit->Delete();
-    eofit->Delete();
-  }
-  
+}
 
-  //Compute stats for each line if lines are available
-  if (input->GetLines()) {
-    this->ComputeCellData();
+//----------------------------------------------------------------------------
+void vtkComputeAirwayWallPolyData::StoreResults(vtkIdType k, double *result, vtkDoubleArray *mean,
+                                                vtkDoubleArray *std, vtkDoubleArray *min,
+                                                vtkDoubleArray *max, vtkDoubleArray *ellipse)
+{
+  int nc = mean->GetNumberOfComponents();
+  for (int c = 0; c < nc;c++) {
+    mean->SetComponent(k,c,result[c]);
+    std->SetComponent(k,c,result[nc+c]);
+    min->SetComponent(k,c,result[2*nc+c]);
+    max->SetComponent(k,c,result[3*nc+c]);
   }
-  
-  return 1;
+  for (int c = 0; c < 6; c++) {
+    ellipse->SetComponent(k,c,result[4*nc+c]);
+  }
+}
+
+//----------------------------------------------------------------------------
+// Data shared by the worker threads. Each thread owns its image copy,
+// reslicer, wall solver and ellipse fitters; the only shared mutable state
+// is the index of the next block of particles, protected by Lock.
+struct vtkComputeAirwayWallPolyDataThreadStruct
+{
+  vtkComputeAirwayWallPolyData *Filter;
+  vtkImageResliceWithPlane **Reslicers;
+  vtkComputeAirwayWall **Workers;
+  vtkEllipseFitting **InnerFits;
+  vtkEllipseFitting **OuterFits;
+  vtkSimpleCriticalSection *Lock;
+  vtkIdType NextPoint;
+  vtkIdType NumberOfPoints;
+  int BlockSize;
+  int ResultSize;
+  double *Results;
+};
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkComputeAirwayWallPolyDataThreadedExecute( void *arg )
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  vtkComputeAirwayWallPolyDataThreadStruct *str =
+    (vtkComputeAirwayWallPolyDataThreadStruct *)(((ThreadInfoStruct *)(arg))->UserData);
+
+  while (true)
+    {
+    str->Lock->Lock();
+    vtkIdType first = str->NextPoint;
+    str->NextPoint += str->BlockSize;
+    str->Lock->Unlock();
+
+    if (first >= str->NumberOfPoints)
+      {
+      break;
+      }
+    vtkIdType last = first + str->BlockSize;
+    if (last > str->NumberOfPoints)
+      {
+      last = str->NumberOfPoints;
+      }
+    for (vtkIdType k=first; k<last; k++)
+      {
+      str->Filter->ComputeAirwayWallForPoint(k, str->Reslicers[threadId], str->Workers[threadId],
+                                             str->InnerFits[threadId], str->OuterFits[threadId],
+                                             str->Results + static_cast<size_t>(k)*str->ResultSize);
+      }
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkComputeAirwayWallPolyData::ThreadedExecute(vtkIdType npts, int resultSize, double *results)
+{
+  int numThreads = this->NumberOfThreads;
+
+  // The helper objects of each thread (image, reslicer, wall solver and
+  // ellipse fitters) are created here, in the calling thread. The images
+  // are shallow copies of the input image: they all share its scalar
+  // array, whose reference count only changes here (ShallowCopy and
+  // Delete) while the threads just read the voxels. In the threads,
+  // SetInputData is called on the thread's wall solver and on the
+  // temporary solver the self tuned phase congruency method creates for
+  // each particle. Both take a reference to the output of the thread's
+  // own reslicer, and the temporary solver also to the thread's copy of
+  // the weights (see CopyWallSolver), so no reference count is changed
+  // by two threads.
+  std::vector<vtkImageData*> images(numThreads);
+  std::vector<vtkImageResliceWithPlane*> reslicers(numThreads);
+  std::vector<vtkComputeAirwayWall*> workers(numThreads);
+  std::vector<vtkEllipseFitting*> innerFits(numThreads);
+  std::vector<vtkEllipseFitting*> outerFits(numThreads);
+  for (int t=0; t<numThreads; t++)
+    {
+    images[t] = vtkImageData::New();
+    images[t]->ShallowCopy(this->GetImage());
+    reslicers[t] = vtkImageResliceWithPlane::New();
+    this->SetupReslicer(reslicers[t],images[t]);
+    workers[t] = vtkComputeAirwayWall::New();
+    this->CopyWallSolver(this->WallSolver,workers[t]);
+    innerFits[t] = vtkEllipseFitting::New();
+    outerFits[t] = vtkEllipseFitting::New();
+    }
+
+  vtkSimpleCriticalSection *lock = new vtkSimpleCriticalSection;
+
+  vtkComputeAirwayWallPolyDataThreadStruct str;
+  str.Filter = this;
+  str.Reslicers = &reslicers[0];
+  str.Workers = &workers[0];
+  str.InnerFits = &innerFits[0];
+  str.OuterFits = &outerFits[0];
+  str.Lock = lock;
+  str.NextPoint = 0;
+  str.NumberOfPoints = npts;
+  str.BlockSize = this->BlockSize;
+  str.ResultSize = resultSize;
+  str.Results = results;
+
+  vtkMultiThreader *threader = vtkMultiThreader::New();
+  threader->SetNumberOfThreads(numThreads);
+  threader->SetSingleMethod(vtkComputeAirwayWallPolyDataThreadedExecute, &str);
+  threader->SingleMethodExecute();
+  threader->Delete();
+
+  delete lock;
+  for (int t=0; t<numThreads; t++)
+    {
+    outerFits[t]->Delete();
+    innerFits[t]->Delete();
+    workers[t]->Delete();
+    reslicers[t]->Delete();
+    images[t]->Delete();
+    }
 }
 
 void vtkComputeAirwayWallPolyData::ComputeCellData()
@@ -661,6 +844,39 @@ void vtkComputeAirwayWallPolyData::SetWallSolver(vtkComputeAirwayWall *ref, vtkC
 }
 
 
+//----------------------------------------------------------------------------
+// Full copy of the solver parameters used to create the per thread solvers.
+// The weights are deep copied so that threads do not share reference counted
+// objects.
+void vtkComputeAirwayWallPolyData::CopyWallSolver(vtkComputeAirwayWall *ref, vtkComputeAirwayWall *out) {
+
+  out->SetMethod(ref->GetMethod());
+  out->SetWallThreshold(ref->GetWallThreshold());
+  out->SetGradientThreshold(ref->GetGradientThreshold());
+  out->SetPCThreshold(ref->GetPCThreshold());
+  out->SetNumberOfScales(ref->GetNumberOfScales());
+  out->SetBandwidth(ref->GetBandwidth());
+  out->SetMinimumWavelength(ref->GetMinimumWavelength());
+  out->SetMultiplicativeFactor(ref->GetMultiplicativeFactor());
+  out->SetUseWeights(ref->GetUseWeights());
+  vtkDoubleArray *weights = vtkDoubleArray::New();
+  weights->DeepCopy(ref->GetWeights());
+  out->SetWeights(weights);
+  weights->Delete();
+  out->SetThetaMax(ref->GetThetaMax());
+  out->SetThetaMin(ref->GetThetaMin());
+  out->SetRMin(ref->GetRMin());
+  out->SetRMax(ref->GetRMax());
+  out->SetDelta(ref->GetDelta());
+  out->SetScale(ref->GetScale());
+  out->SetNumberOfThetaSamples(ref->GetNumberOfThetaSamples());
+  out->SetAlpha(ref->GetAlpha());
+  out->SetT(ref->GetT());
+  out->SetActivateSector(ref->GetActivateSector());
+  out->SetUseRayKernel(ref->GetUseRayKernel());
+
+}
+
 void vtkComputeAirwayWallPolyData::CreateAirwayImage(vtkImageData *resliceCT,vtkEllipseFitting *eifit,vtkEllipseFitting *eofit,vtkImageData *airwayImage)
 {
   vtkImageMapToColors *rgbFilter = vtkImageMapToColors::New();
@@ -736,4 +952,6 @@ void vtkComputeAirwayWallPolyData::PrintSelf(ostream& os, vtkIndent indent)
 
   os << indent << "Reforma: " << this->Reformat << "\n";
   os << indent << "Axis Mode: " << this->AxisMode << "\n";
+  os << indent << "Number Of Threads: " << this->NumberOfThreads << "\n";
+  os << indent << "Block Size: " << this->BlockSize << "\n";
 }
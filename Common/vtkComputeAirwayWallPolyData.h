@@ -25,6 +25,9 @@
 #include "vtkImageData.h"
 #include "vtkDoubleArray.h"
 #include "vtkEllipseFitting.h"
+#include "vtkMultiThreader.h"
+
+class vtkImageResliceWithPlane;
 
 #define VTK_HESSIAN 0
 #define VTK_POLYDATA 1
@@ -93,7 +96,31 @@ public:
   // File prefix for the airway image
   vtkSetStringMacro(AirwayImagePrefix);
   vtkGetStringMacro(AirwayImagePrefix);
-  
+
+  // Description:
+  // Number of threads used to process the particles. Each thread owns its
+  // reslicer, wall solver and ellipse fitters and processes blocks of
+  // particles. The default (1) runs the original serial loop. Results are
+  // identical regardless of the number of threads.
+  vtkSetClampMacro(NumberOfThreads,int,1,VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads,int);
+
+  // Description:
+  // Number of consecutive particles handed to a thread at a time.
+  vtkSetClampMacro(BlockSize,int,1,VTK_INT_MAX);
+  vtkGetMacro(BlockSize,int);
+
+  // Description:
+  // Compute the wall metrics of particle k with the given helper
+  // objects (reslicer, wall solver and inner and outer ellipse
+  // fitters). The results are stored in 'result' as nc means, nc stds,
+  // nc mins, nc maxs and the 6 ellipse parameters (nc being the number
+  // of quantities of the wall solver). Used by both the serial and the
+  // threaded execution paths.
+  void ComputeAirwayWallForPoint(vtkIdType k, vtkImageResliceWithPlane *reslicer,
+                                 vtkComputeAirwayWall *worker, vtkEllipseFitting *eifit,
+                                 vtkEllipseFitting *eofit, double *result);
+
 protected:
   vtkComputeAirwayWallPolyData();
   ~vtkComputeAirwayWallPolyData();
@@ -116,6 +143,8 @@ protected:
   double SegmentPercentage;
   int SaveAirwayImage;
   char *AirwayImagePrefix;
+  int NumberOfThreads;
+  int BlockSize;
   
   //array names variables for the wall metrics
   char arrayNameMean[256];
@@ -125,6 +154,11 @@ protected:
   char arrayNameEllipse[256];
   
   void SetWallSolver(vtkComputeAirwayWall *ref, vtkComputeAirwayWall *out);
+  void CopyWallSolver(vtkComputeAirwayWall *ref, vtkComputeAirwayWall *out);
+  void SetupReslicer(vtkImageResliceWithPlane *reslicer, vtkImageData *image);
+  void ThreadedExecute(vtkIdType npts, int resultSize, double *results);
+  void StoreResults(vtkIdType k, double *result, vtkDoubleArray *mean, vtkDoubleArray *std,
+                    vtkDoubleArray *min, vtkDoubleArray *max, vtkDoubleArray *ellipse);
   void ComputeAirwayAxisFromLines();
   void CreateAirwayImage(vtkImageData *resliceCT,vtkEllipseFitting *eifit,vtkEllipseFitting *eofit,vtkImageData *airwayImage);
   
@@ -26,6 +26,12 @@ vtkStandardNewMacro(vtkEllipseFitting);
 //---------------------------------------------------------------------------
 // Construct object with initial Tolerance of 0.0
 vtkEllipseFitting::vtkEllipseFitting()
+{
+  this->ResetParameters();
+}
+
+//--------------------------------------------------------------------------
+void vtkEllipseFitting::ResetParameters()
 {
   this->MajorAxisLength = 0;
   this->MinorAxisLength = 0;
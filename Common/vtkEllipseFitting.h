@@ -28,6 +28,12 @@ public:
   vtkGetVector2Macro(MajorAxis,double);
   vtkGetVector2Macro(MinorAxis,double);
 
+  // Description:
+  // Set the ellipse parameters back to their initial (zero) values, so
+  // that a fitter reused for another set of points does not report the
+  // previous ellipse when the new set cannot be fitted.
+  void ResetParameters();
+
 protected:
   vtkEllipseFitting();
  ~vtkEllipseFitting();
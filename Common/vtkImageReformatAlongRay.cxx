@@ -216,6 +216,133 @@ void vtkImageReformatAlongRay::ExecuteDataWithInformation(vtkDataObject *out,
 }
 
 
+//----------------------------------------------------------------------------
+double vtkImageReformatAlongRay::GetSampleSpacing(double *insp, double theta)
+{
+  return sqrt(insp[0]*insp[0] * cos(theta) * cos(theta) +
+              insp[1]*insp[1] * sin(theta) * sin(theta));
+}
+
+//----------------------------------------------------------------------------
+int vtkImageReformatAlongRay::GetNumberOfSamples(double *insp, double theta)
+{
+  double sp = this->GetSampleSpacing(insp,theta);
+  return int ((this->RMax/sp - this->RMin/sp + 1)/this->Delta);
+}
+
+//----------------------------------------------------------------------------
+int vtkImageReformatAlongRay::SampleRays(vtkImageData *input, const double *thetas,
+                                         int numberOfRays, int stride, double *values,
+                                         double *gradient, double *hessian,
+                                         int *numberOfSamples, double *spacing)
+{
+  if ( input == NULL )
+    {
+    vtkErrorMacro(<< "SampleRays: Input is not set.");
+    return 0;
+    }
+
+  // Convert input to nrrd
+  int dims[3];
+  double Spacing[3];
+  input->GetDimensions(dims);
+  input->GetSpacing(Spacing);
+  void *data =  (void *) input->GetScalarPointer();
+  if (data == NULL) {
+     vtkErrorMacro("Input does not have Scalars");
+     return 0;
+  }
+  const int type = this->VTKToNrrdPixelType(input->GetScalarType());
+  size_t size[3];
+  size[0]=dims[0];
+  size[1]=dims[1];
+  size[2]=dims[2];
+
+  if(nrrdWrap_nva(this->nin,data,type,3,size)) {
+	cout<<"Error with nrrdWrap"<<endl;
+  }
+  nrrdAxisInfoSet_nva(this->nin, nrrdAxisInfoSpacing, Spacing);
+  this->nin->axis[0].center = nrrdCenterCell;
+  this->nin->axis[1].center = nrrdCenterCell;
+  this->nin->axis[2].center = nrrdCenterCell;
+
+  // One gage context for all the rays
+  int E = 0;
+  gageContext *ctx = gageContextNew();
+  gageParmSet(ctx, gageParmRenormalize, AIR_TRUE);
+  gagePerVolume *pvl;
+  if (!E) E |= !(pvl = gagePerVolumeNew(ctx, this->nin, gageKindScl));
+  if (!E) E |= gagePerVolumeAttach(ctx, pvl);
+  if (E) {
+    fprintf(stderr, "%s: trouble:\n%s\n",this->GetClassName(), biffGetDone(GAGE));
+    gageContextNix(ctx);
+    return 0;
+  }
+
+  double kparm[3];
+  kparm[0] = this->Scale;
+  kparm[1] = 0.5;
+  kparm[2] = 0.25;
+
+  if (!E) E |= gageKernelSet(ctx, gageKernel00, nrrdKernelBCCubic, kparm);
+  if (!E) E |= gageKernelSet(ctx, gageKernel11, nrrdKernelBCCubicD, kparm);
+  if (!E) E |= gageKernelSet(ctx, gageKernel22, nrrdKernelBCCubicDD, kparm);
+  if (!E) E |= gageQueryItemOn(ctx, pvl, gageSclValue);
+  if (!E) E |= gageQueryItemOn(ctx, pvl, gageSclGradVec);
+  if (!E) E |= gageQueryItemOn(ctx, pvl, gageSclHessian);
+  if (!E) E |= gageUpdate(ctx);
+  if (E) {
+    fprintf(stderr, "%s: trouble:\n%s\n",this->GetClassName(), biffGetDone(GAGE));
+    gageContextNix(ctx);
+    return 0;
+  }
+  const double *valu = gageAnswerPointer(ctx, pvl, gageSclValue);
+  const double *grad = gageAnswerPointer(ctx, pvl, gageSclGradVec);
+  const double *hess = gageAnswerPointer(ctx, pvl, gageSclHessian);
+
+  double dp[3],vp[3],xp[3];
+  double hessvp[3];
+  for (int r = 0; r < numberOfRays; r++)
+    {
+    double theta = thetas[r];
+    int nsamples = this->GetNumberOfSamples(Spacing,theta);
+    if (nsamples > stride)
+      {
+      vtkErrorMacro("SampleRays: stride is smaller than the number of samples");
+      gageContextNix(ctx);
+      return 0;
+      }
+    numberOfSamples[r] = nsamples;
+    spacing[r] = this->Delta*this->GetSampleSpacing(Spacing,theta);
+
+    vp[0] =  cos(theta);
+    vp[1] =  sin(theta);
+    vp[2] = 0;
+
+    // Initial point
+    for (int i=0; i<3 ; i++) {
+      dp[i] = this->Delta * vp[i];
+      xp[i] = this->Center[i] + vp[i] * this->RMin;
+    }
+
+    double *v = values + r*stride;
+    double *g = gradient + r*stride;
+    double *h = hessian + r*stride;
+    for (int k = 0; k < nsamples ; k++ ) {
+      gageProbe(ctx,xp[0],xp[1],xp[2]);
+      v[k] = (double) valu[0];
+      g[k] = (double) (vp[0]*grad[0] + vp[1]*grad[1] + vp[2]*grad[2]);
+      ELL_3MV_MUL(hessvp,hess,vp);
+      h[k] = (double) (hessvp[0]*vp[0]+hessvp[1]*vp[1]+hessvp[2]*vp[2]);
+      for (int i=0; i<3; i++)
+        xp[i]=xp[i] + dp[i];
+    }
+    }
+
+  gageContextNix(ctx);
+  return 1;
+}
+
 int vtkImageReformatAlongRay::VTKToNrrdPixelType( const int vtkPixelType )
   {
   switch( vtkPixelType )
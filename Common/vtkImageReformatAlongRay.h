@@ -68,6 +68,25 @@ public:
   vtkSetMacro(Scale,double);
   vtkGetMacro(Scale,double);
 
+  // Description:
+  // Number of samples and sample spacing of a ray cast at angle theta
+  // through an image with the given spacing. These are the extent and
+  // spacing of the output of the filter for that angle.
+  int GetNumberOfSamples(double *inputSpacing, double theta);
+  double GetSampleSpacing(double *inputSpacing, double theta);
+
+  // Description:
+  // Sample numberOfRays rays cast at the angles in thetas using a single
+  // gage context. The value, first and second directional derivatives of
+  // ray r are written to values, gradient and hessian starting at r*stride
+  // (stride has to be at least the number of samples of every ray). The
+  // number of samples and the sample spacing of every ray are returned in
+  // numberOfSamples and spacing. The samples are the same ones computed by
+  // the filter for each individual angle. Returns 0 on failure.
+  int SampleRays(vtkImageData *input, const double *thetas, int numberOfRays,
+                 int stride, double *values, double *gradient, double *hessian,
+                 int *numberOfSamples, double *spacing);
+
 protected:
   vtkImageReformatAlongRay();
   ~vtkImageReformatAlongRay();
@@ -91,6 +91,7 @@ vtkSimpleLungMask::vtkSimpleLungMask()
   this->RightDMTable = vtkIntArray::New();
   this->RasToVtk=NULL;
   this->AirIntensityBaseline = 0;
+  this->NumberOfThreads = vtkMultiThreader::GetGlobalDefaultNumberOfThreads();
 
   for (int i=0; i<3;i++)
     {
@@ -631,43 +632,23 @@ void vtkSimpleLungMask::ExecuteDataWithInformation(vtkDataObject *output, vtkInf
   //preMask->UnRegister(this);
   preMask->Delete();
 
-// Remove holes
-  vtkImageData *tmp = vtkImageData::New();
-  tmp->ShallowCopy(outData);
-
-  vtkImageConnectivity *con  = vtkImageConnectivity::New();
-  con->SetInputData(tmp);
-  con->SetBackground(this->WholeLungLabel);
-  con->SetMinForeground(-256);
-  con->SetMaxForeground(256);
-  con->SetFunctionToRemoveIslands();
-  con->SetMinSize(1000);
-  con->SliceBySliceOn();
+// Remove holes: islands of fewer than 1000 pixels are removed slice by slice
   cout<<"Removing Island"<<endl;
-  con->Update();
+  this->RemoveIslands(outData, this->WholeLungLabel, -256, 256, 1000);
 
   this->UpdateProgress(0.6);
 
-  //Clean potential crap from Image Connectivity
-  short *conPtr = (short *) con->GetOutput()->GetScalarPointer();
+  //Clean potential crap from the island removal
   cout<<"Cleaning Remove Islands"<<endl;
   outPtr = (short *) outData->GetScalarPointer();
   for (int i=0; i<outData->GetNumberOfPoints();i++) {
-    if (*conPtr == this->WholeLungLabel || *conPtr == this->TracheaLabel)
-      {
-      *outPtr = *conPtr;
-      }
-    else
+    if (*outPtr != this->WholeLungLabel && *outPtr != this->TracheaLabel)
       {
       *outPtr =0;
       }
     outPtr++;
-    conPtr++;
   }
 
-  con->Delete();
-  tmp->Delete();
-
   // Extract Upper trachea
   //this->ExtractUpperTrachea(outData);
 
@@ -761,6 +742,166 @@ void vtkSimpleLungMask::ExecuteDataWithInformation(vtkDataObject *output, vtkInf
   this->UpdateProgress(1);
 }
 
+//----------------------------------------------------------------------------
+struct ISLANDSTHREADSTRUCT
+{
+  vtkSimpleLungMask *self;
+  short *maskPtr;
+  int dims[3];
+  short background;
+  short minForeground;
+  short maxForeground;
+  int minSize;
+  std::vector< std::vector<int> > *labels;
+  std::vector< std::vector<int> > *stacks;
+  std::vector< std::vector<int> > *census;
+};
+
+//----------------------------------------------------------------------------
+// Removes, slice by slice, the islands of a short mask in place, like
+// vtkImageConnectivity with SetFunctionToRemoveIslands and SliceBySliceOn:
+// pixels that are not the background and are within
+// [minForeground,maxForeground] are foreground, and foreground
+// 4-connected islands of fewer than minSize pixels are set to the
+// background. The slices are independent, so they are split into one
+// batch per thread.
+void vtkSimpleLungMask::RemoveIslands(vtkImageData *mask, short background, short minForeground, short maxForeground, int minSize)
+{
+  int dims[3];
+  mask->GetDimensions(dims);
+
+  int numberOfThreads = this->NumberOfThreads;
+  if (numberOfThreads > dims[2])
+    numberOfThreads = dims[2] > 0 ? dims[2] : 1;
+
+  // Scratch buffers are allocated once per thread and reused for all the
+  // slices of its batches
+  std::vector< std::vector<int> > labels(numberOfThreads);
+  std::vector< std::vector<int> > stacks(numberOfThreads);
+  std::vector< std::vector<int> > census(numberOfThreads);
+  for (int t=0; t<numberOfThreads; t++) {
+    labels[t].resize(dims[0]*dims[1]);
+    stacks[t].resize(dims[0]*dims[1]);
+  }
+
+  ISLANDSTHREADSTRUCT str;
+  str.self = this;
+  str.maskPtr = (short *) mask->GetScalarPointer();
+  str.dims[0] = dims[0];
+  str.dims[1] = dims[1];
+  str.dims[2] = dims[2];
+  str.background = background;
+  str.minForeground = minForeground;
+  str.maxForeground = maxForeground;
+  str.minSize = minSize;
+  str.labels = &labels;
+  str.stacks = &stacks;
+  str.census = &census;
+
+  if (numberOfThreads == 1) {
+    for (int z=0; z<dims[2]; z++) {
+      this->RemoveSliceIslands(str.maskPtr + z*dims[0]*dims[1], dims[0], dims[1], background, minForeground,
+                               maxForeground, minSize, &labels[0][0], &stacks[0][0], census[0]);
+    }
+  } else {
+    vtkMultiThreader* threader = vtkMultiThreader::New();
+    threader->SetNumberOfThreads(numberOfThreads);
+    threader->SetSingleMethod(vtkSimpleLungMask::RemoveIslandsThreaderCallback, &str);
+    threader->SingleMethodExecute();
+    threader->Delete();
+  }
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkSimpleLungMask::RemoveIslandsThreaderCallback(void *arg)
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  int numberOfThreads = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  ISLANDSTHREADSTRUCT* str = (ISLANDSTHREADSTRUCT *)(((ThreadInfoStruct *)(arg))->UserData);
+
+  // One batch of consecutive slices per requested thread. The threader may
+  // run fewer threads than requested, in which case a thread processes
+  // several batches.
+  int numberOfBatches = (int) str->labels->size();
+  int sliceSize = str->dims[0]*str->dims[1];
+
+  for (int batch=threadId; batch<numberOfBatches; batch += numberOfThreads) {
+    int firstSlice = (int) (((long) batch*str->dims[2])/numberOfBatches);
+    int lastSlice = (int) (((long) (batch+1)*str->dims[2])/numberOfBatches);
+
+    for (int z=firstSlice; z<lastSlice; z++) {
+      str->self->RemoveSliceIslands(str->maskPtr + (long) z*sliceSize, str->dims[0], str->dims[1], str->background,
+                                    str->minForeground, str->maxForeground, str->minSize,
+                                    &(*str->labels)[threadId][0], &(*str->stacks)[threadId][0],
+                                    (*str->census)[threadId]);
+    }
+  }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Label 0 holds all the pixels that are not foreground; census[l] is the
+// number of pixels with label l.
+void vtkSimpleLungMask::RemoveSliceIslands(short *slice, int nx, int ny, short background, short minForeground,
+                                           short maxForeground, int minSize, int *labels, int *stack,
+                                           std::vector<int> &census)
+{
+  int numPoints = nx*ny;
+
+  census.clear();
+  census.push_back(0);
+  for (int i=0; i<numPoints; i++) {
+    if (slice[i] != background && slice[i] >= minForeground && slice[i] <= maxForeground) {
+      labels[i] = -1;
+    } else {
+      labels[i] = 0;
+      census[0]++;
+    }
+  }
+
+  // Flood fill every island from its first pixel
+  for (int i=0; i<numPoints; i++) {
+    if (labels[i] != -1)
+      continue;
+
+    int label = (int) census.size();
+    int count = 0;
+    int top = 0;
+    stack[top++] = i;
+    labels[i] = label;
+
+    while (top > 0) {
+      int idx = stack[--top];
+      int x = idx % nx;
+      count++;
+
+      if (x > 0 && labels[idx-1] == -1) {
+        labels[idx-1] = label;
+        stack[top++] = idx-1;
+      }
+      if (x < nx-1 && labels[idx+1] == -1) {
+        labels[idx+1] = label;
+        stack[top++] = idx+1;
+      }
+      if (idx >= nx && labels[idx-nx] == -1) {
+        labels[idx-nx] = label;
+        stack[top++] = idx-nx;
+      }
+      if (idx < numPoints-nx && labels[idx+nx] == -1) {
+        labels[idx+nx] = label;
+        stack[top++] = idx+nx;
+      }
+    }
+    census.push_back(count);
+  }
+
+  for (int i=0; i<numPoints; i++) {
+    if (census[labels[i]] < minSize)
+      slice[i] = background;
+  }
+}
+
 void vtkSimpleLungMask::CopyToBuffer(vtkImageData *in, vtkImageData *out, int copyext[6]) {
   //out->SetWholeExtent(copyext);
   out->SetExtent(copyext);
@@ -838,17 +979,19 @@ void vtkSimpleLungMask::FindTracheaTopCoordinates(vtkImageData *in,int initZ, in
   slice2->AllocateScalars(this->GetInformation());
 
   int *hist = new int[500];
+  // The islands of slice k+sign are those of slice k in the next iteration,
+  // so only the first slice has its islands identified on its own.
+  testext[4]=k;
+  testext[5]=k;
+  //cout<<"Ready to copy buffer to slice "<<k<<endl;
+  this->CopyToBuffer(in,slice1,testext);
+  testext[4]=0;
+  testext[5]=0;
+  slice1->SetExtent(testext);
+  conk->SetInputData(slice1);
+  //cout<<"Updating Identify island"<<endl;
+  conk->Update();
   do {
-      testext[4]=k;
-      testext[5]=k;
-      //cout<<"Ready to copy buffer to slice "<<k<<endl;
-      this->CopyToBuffer(in,slice1,testext);
-      testext[4]=0;
-      testext[5]=0;
-      slice1->SetExtent(testext);
-      conk->SetInputData(slice1);
-      //cout<<"Updating Identify island"<<endl;
-      conk->Update();
       testext[4]=k+sign;
       testext[5]=k+sign;
       //cout<<"Ready to copy buffer to slice "<<k+sign<<endl;
@@ -924,6 +1067,12 @@ void vtkSimpleLungMask::FindTracheaTopCoordinates(vtkImageData *in,int initZ, in
 	  return;
 	}
       }
+  vtkImageData *tmpSlice = slice1;
+  slice1 = slice2;
+  slice2 = tmpSlice;
+  vtkImageConnectivity *tmpCon = conk;
+  conk = conkp1;
+  conkp1 = tmpCon;
   k = k + sign;
   } while(k!=(endZ-sign));
 
@@ -1039,6 +1188,31 @@ void vtkSimpleLungMask::ExtractTrachea(vtkImageData *in) {
 
     k = C[2];
 
+    // The seed of a slice is the centroid of the trachea in the previous one,
+    // so the slices are walked in order. The per-slice pipeline is set up once
+    // and re-executed for every slice.
+    // Initial eroding to avoid connectivity between trachea and lung lobes
+    // (good for low res scans). We could put a low res conditions in here to avoid
+    // this step.
+    vtkImageErode *di_er = vtkImageErode::New();
+    di_er->SetInputData(slice);
+    di_er->SetBackground(0);
+    di_er->SetForeground(this->WholeLungLabel);
+    di_er->SetNeighborTo4();
+
+    vtkImageSeedConnectivity *cc = vtkImageSeedConnectivity::New();
+    cc->SetInputConnection(di_er->GetOutputPort());
+    cc->SetInputConnectValue(this->WholeLungLabel);
+    cc->SetOutputConnectedValue(this->WholeLungLabel);
+    cc->SetOutputUnconnectedValue(0);
+
+    // Dilate to compensate for the erosion
+    vtkImageErode *di_er2 = vtkImageErode::New();
+    di_er2->SetForeground(0);
+    di_er2->SetBackground(this->WholeLungLabel);
+    di_er2->SetNeighborTo8();
+    di_er2->SetInputConnection(cc->GetOutputPort());
+
     do {
         testext[4] = k;
         testext[5] = k;
@@ -1058,25 +1232,12 @@ void vtkSimpleLungMask::ExtractTrachea(vtkImageData *in) {
                 inPtr++;
                 slicePtr++;
             }
-           // Do initial eroding to avoid connectivity between trachea and lung lobes
-           // (good for low res scans). We could put a low res conditions in here to avoid
-           // this step.
-           vtkImageErode *di_er = vtkImageErode::New();
-           di_er->SetInputData(slice);
-           di_er->SetBackground(0);
-           di_er->SetForeground(this->WholeLungLabel);
-           di_er->SetNeighborTo4();
-           di_er->Update();
+            slice->Modified();
 
-            vtkImageSeedConnectivity *cc = vtkImageSeedConnectivity::New();
-            cc->SetInputData(di_er->GetOutput());
+            cc->RemoveAllSeeds();
             cc->AddSeed(C[0],C[1]);
-            cc->SetInputConnectValue(this->WholeLungLabel);
-            cc->SetOutputConnectedValue(this->WholeLungLabel);
-            cc->SetOutputUnconnectedValue(0);
             //cout<<"Doing CC"<<endl;
             cc->Update();
-	          di_er->Delete();
             //cout<<"CC done"<<endl;
             //cout<<"Getting inPtr"<<endl;
             inPtr = (unsigned char *)cc->GetOutput()->GetScalarPointer(0,0,0);
@@ -1093,17 +1254,9 @@ void vtkSimpleLungMask::ExtractTrachea(vtkImageData *in) {
 
 	    if (count > this->TracheaAreaTh) {
         cout<<"We walk into the lung at "<<k<<endl;
-        cc->Delete();
         break;
 	    }
-              // Dilate to compensate for the erosion:
-	    vtkImageErode *di_er2 = vtkImageErode::New();
-      di_er2->SetForeground(0);
-      di_er2->SetBackground(this->WholeLungLabel);
-      di_er2->SetNeighborTo8();
-      di_er2->SetInputConnection(cc->GetOutputPort());
       di_er2->Update();
-	    cc->Delete();
       
 	    inPtr = (unsigned char *)di_er2->GetOutput()->GetScalarPointer(0,0,0);
 	    outPtr = (unsigned char *)in->GetScalarPointerForExtent(testext);
@@ -1121,11 +1274,12 @@ void vtkSimpleLungMask::ExtractTrachea(vtkImageData *in) {
 	    testext[5]=0;
       this->ComputeCentroid(di_er2->GetOutput(),testext,C);
       //cout<<"New seed: "<<C[0]<<" "<<C[1]<<" "<<C[2]<<endl;
-      // Delete Objects
-      di_er2->Delete();
 
     k = k + sign;
     } while(k != endZ);
+  di_er->Delete();
+  cc->Delete();
+  di_er2->Delete();
   slice->Delete();
 
   this->TracheaInitZ = initZ;
@@ -1521,6 +1675,7 @@ void vtkSimpleLungMask::PrintSelf(ostream& os, vtkIndent indent)
   this->Superclass::PrintSelf(os, indent);
   os << indent << "Whole Lung Label:  " << this->GetWholeLungLabel() << "\n";
   os << indent << "Left Lung Label:  " << this->GetLeftLungLabel() << "\n";
-  os << indent << "Right Lung Label: " << (this->GetRightLungLabel() );
+  os << indent << "Right Lung Label: " << (this->GetRightLungLabel() ) << "\n";
+  os << indent << "Number Of Threads: " << this->NumberOfThreads << "\n";
 }
 
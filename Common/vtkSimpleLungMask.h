@@ -19,6 +19,8 @@
 #include "vtkMatrix4x4.h"
 #include "vtkIntArray.h"
 #include "vtkShortArray.h"
+#include "vtkMultiThreader.h"
+#include <vector>
 
 class VTK_CIP_COMMON_EXPORT vtkSimpleLungMask : public vtkImageAlgorithm
 {
@@ -76,6 +78,14 @@ public:
   vtkSetObjectMacro(RasToVtk,vtkMatrix4x4);
   vtkGetObjectMacro(RasToVtk,vtkMatrix4x4);
 
+  // Description:
+  // Set/Get the number of threads used to remove the islands slice by
+  // slice. The slices are split into batches processed in parallel, each
+  // thread with its own scratch buffers. The mask does not depend on the
+  // number of threads.
+  vtkSetClampMacro(NumberOfThreads,int,1,VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads,int);
+
 protected:
   vtkSimpleLungMask();
   ~vtkSimpleLungMask();
@@ -97,6 +107,10 @@ protected:
   void Histogram(vtkImageData *in, int *hist, int minbin, int maxbin);
   void CopyToBuffer(vtkImageData *in, vtkImageData *out, int copyext[6]);
   void ExtractTracheaOLD(vtkImageData *in);
+  void RemoveIslands(vtkImageData *mask, short background, short minForeground, short maxForeground, int minSize);
+  void RemoveSliceIslands(short *slice, int nx, int ny, short background, short minForeground, short maxForeground,
+                          int minSize, int *labels, int *stack, std::vector<int> &census);
+  static VTK_THREAD_RETURN_TYPE RemoveIslandsThreaderCallback(void *arg);
 
   int LungThreshold;
   int LCentroid[3];
@@ -142,6 +156,8 @@ protected:
 
   int AirIntensityBaseline;
 
+  int NumberOfThreads;
+
 private:
   vtkSimpleLungMask(const vtkSimpleLungMask&);  // Not implemented.
   void operator=(const vtkSimpleLungMask&);  // Not implemented.
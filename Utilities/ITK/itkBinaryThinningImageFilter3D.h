@@ -5,6 +5,8 @@
 #include <itkImageToImageFilter.h>
 #include <itkImageRegionIteratorWithIndex.h>
 #include <itkConstantBoundaryCondition.h>
+#include <itkMultiThreader.h>
+#include <vector>
 
 namespace itk
 {
@@ -32,7 +34,16 @@ namespace itk
 * Building skeleton models via 3-D medial surface/axis thinning algorithms.
 * Computer Vision, Graphics, and Image Processing, 56(6):462--478, 1994.
 * 
-* To do: Make use of multi-threading.
+* Only border points (foreground points with a background 6-neighbor)
+* can be deleted, so rather than scanning the image the filter keeps a
+* list of the border points in raster order, which grows as points are
+* deleted. A border point is not tested again for a border type until
+* a point in its 3x3x3 neighborhood is deleted. Neighborhoods are
+* packed into 26-bit masks; the Euler invariance is looked up per
+* octant and the simple point test is a bit-parallel connected
+* component search. The candidates of each border type are found on
+* several threads; they are re-checked sequentially, in raster order,
+* so the skeleton is the same as the one found by scanning the image.
 *
 * \author Hanno Homann, Oxford University, Wolfson Medical Vision Lab, UK.
 * 
@@ -133,19 +144,53 @@ protected:
   /**  Compute thinning Image. */
   void ComputeThinImage();
   
+  /** The 26 neighbors of a point (in neighborhood order, without the
+   *  center point) as the bits of a mask */
+  unsigned int getNeighborhoodMask(SizeValueType point) const;
+
   /**  isEulerInvariant [Lee94] */
-  bool isEulerInvariant(NeighborhoodType neighbors, int *LUT);
+  bool isEulerInvariant(unsigned int neighbors) const;
   void fillEulerLUT(int *LUT);  
   /**  isSimplePoint [Lee94] */
-  bool isSimplePoint(NeighborhoodType neighbors);
-  /**  Octree_labeling [Lee94] */
-  void Octree_labeling(int octant, int label, int *cube);
-
+  bool isSimplePoint(unsigned int neighbors) const;
+  /** Fill the tables used to grow a component of a neighborhood mask
+   *  by one step of 26-adjacency, eight neighbors at a time */
+  void fillAdjacencyLUT();
+
+  /** Find the border points of the slices [first, last) */
+  void findBorderPoints(unsigned int first, unsigned int last, std::vector< SizeValueType >& points);
+  /** Find the deletable points of the specified border type among the
+   *  border points [first, last) */
+  void findSimpleBorderPoints(const SizeValueType* first, const SizeValueType* last, int border,
+                              std::vector< SizeValueType >& points);
 
 private:   
   BinaryThinningImageFilter3D(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
+  struct ThreadStruct
+  {
+    Self*                                        Filter;
+    const std::vector< SizeValueType >*          BorderPoints;
+    int                                          Border;
+    std::vector< std::vector< SizeValueType > >* Points;
+  };
+
+  static ITK_THREAD_RETURN_TYPE BorderPointsThreaderCallback(void *arg);
+  static ITK_THREAD_RETURN_TYPE SimpleBorderPointsThreaderCallback(void *arg);
+
+  // The image, padded with a background point on every side, the
+  // state of each point (bits 0-5: the point is known not to be
+  // deletable for border types 1-6; bit 7: the point is in the border
+  // list) and the offsets of the 27 points of a neighborhood
+  std::vector< unsigned char > m_Image;
+  std::vector< unsigned char > m_PointStates;
+  OffsetValueType              m_NeighborOffsets[27];
+  SizeValueType                m_PaddedSize[3];
+
+  int                          m_EulerLUT[256];
+  unsigned int                 m_AdjacencyLUT[4][256];
+
 }; // end of BinaryThinningImageFilter3D class
 
 } //end namespace itk
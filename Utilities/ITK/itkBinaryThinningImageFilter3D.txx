@@ -7,6 +7,8 @@
 #include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIterator.h"
 #include "itkNeighborhoodIterator.h"
+#include <algorithm>
+#include <cstdlib>
 #include <vector>
 
 namespace itk
@@ -25,6 +27,12 @@ BinaryThinningImageFilter3D<TInputImage,TOutputImage>
   OutputImagePointer thinImage = OutputImageType::New();
   this->SetNthOutput( 0, thinImage.GetPointer() );
 
+  // prepare Euler LUT [Lee94] and the adjacency LUT of the simple
+  // point check
+  std::fill( m_EulerLUT, m_EulerLUT + 256, 0 );
+  fillEulerLUT( m_EulerLUT );
+  fillAdjacencyLUT();
+
 }
 
 /**
@@ -102,30 +110,84 @@ BinaryThinningImageFilter3D<TInputImage,TOutputImage>
   OutputImagePointer thinImage = GetThinning();
 
   typename OutputImageType::RegionType region = thinImage->GetRequestedRegion();
-  
-  ConstBoundaryConditionType boundaryCondition;
-  boundaryCondition.SetConstant( 0 );
-
-  typename NeighborhoodIteratorType::RadiusType radius;
-  radius.Fill(1);
-  NeighborhoodIteratorType ot( radius, thinImage, region );
-  ot.SetBoundaryCondition( boundaryCondition );
-
-  std::vector < IndexType > simpleBorderPoints;
-  typename std::vector < IndexType >::iterator simpleBorderPointsIt;
-
-  // Define offsets
-  typedef typename NeighborhoodIteratorType::OffsetType OffsetType;
-  OffsetType N   = {{ 0,-1, 0}};  // north
-  OffsetType S   = {{ 0, 1, 0}};  // south
-  OffsetType E   = {{ 1, 0, 0}};  // east
-  OffsetType W   = {{-1, 0, 0}};  // west
-  OffsetType U   = {{ 0, 0, 1}};  // up
-  OffsetType B   = {{ 0, 0,-1}};  // bottom
-
-  // prepare Euler LUT [Lee94]
-  int eulerLUT[256]; 
-  fillEulerLUT( eulerLUT );
+  SizeType size = region.GetSize();
+
+  // Copy the image into a buffer with a background point on every
+  // side, so that the neighborhoods of the image points never need a
+  // boundary check (the boundary condition was a constant 0)
+  for( unsigned int i = 0; i < 3; i++ )
+  {
+    m_PaddedSize[i] = size[i] + 2;
+  }
+  m_Image.assign( m_PaddedSize[0]*m_PaddedSize[1]*m_PaddedSize[2], 0 );
+  m_PointStates.assign( m_Image.size(), 0 );
+
+  ImageRegionConstIterator< TOutputImage > it( thinImage, region );
+  it.GoToBegin();
+  for( SizeValueType z = 1; z <= size[2]; z++ )
+  {
+    for( SizeValueType y = 1; y <= size[1]; y++ )
+    {
+      SizeValueType point = (z*m_PaddedSize[1] + y)*m_PaddedSize[0] + 1;
+      for( SizeValueType x = 0; x < size[0]; x++, point++, ++it )
+      {
+        if( it.Get() == 1 )
+        {
+          m_Image[point] = 1;
+        }
+      }
+    }
+  }
+
+  // Neighborhood offsets, in the order of the neighborhood iterator
+  for( int n = 0; n < 27; n++ )
+  {
+    m_NeighborOffsets[n] = 
+      ( static_cast< OffsetValueType >( n/9 - 1 )*static_cast< OffsetValueType >( m_PaddedSize[1] ) + 
+        static_cast< OffsetValueType >( (n/3)%3 - 1 ) )*static_cast< OffsetValueType >( m_PaddedSize[0] ) + 
+      static_cast< OffsetValueType >( n%3 - 1 );
+  }
+  // Neighborhood positions of the 6-neighbors: north, south, east,
+  // west, up and bottom
+  const int faces[6] = { 10, 16, 14, 12, 22, 4 };
+
+  unsigned int numberOfThreads = this->GetNumberOfThreads();
+  if( numberOfThreads < 1 )
+  {
+    numberOfThreads = 1;
+  }
+
+  // Find the initial border points, in raster order
+  std::vector< SizeValueType > borderPoints;
+  std::vector< std::vector< SizeValueType > > threadPoints( numberOfThreads );
+
+  ThreadStruct str;
+  str.Filter       = this;
+  str.BorderPoints = &borderPoints;
+  str.Border       = 0;
+  str.Points       = &threadPoints;
+
+  if( numberOfThreads == 1 || size[2] < 2 )
+  {
+    findBorderPoints( 1, static_cast< unsigned int >( size[2] ) + 1, borderPoints );
+  }
+  else
+  {
+    this->GetMultiThreader()->SetNumberOfThreads( numberOfThreads );
+    this->GetMultiThreader()->SetSingleMethod( BinaryThinningImageFilter3D::BorderPointsThreaderCallback, &str );
+    this->GetMultiThreader()->SingleMethodExecute();
+
+    for( unsigned int t = 0; t < numberOfThreads; t++ )
+    {
+      borderPoints.insert( borderPoints.end(), threadPoints[t].begin(), threadPoints[t].end() );
+      threadPoints[t].clear();
+    }
+  }
+
+  std::vector < SizeValueType > simpleBorderPoints;
+  std::vector < SizeValueType > newBorderPoints;
+  typename std::vector < SizeValueType >::iterator simpleBorderPointsIt;
+
   // Loop through the image several times until there is no change.
   int unchangedBorders = 0;
   while( unchangedBorders < 6 )  // loop until no change for all the six border types
@@ -133,88 +195,261 @@ BinaryThinningImageFilter3D<TInputImage,TOutputImage>
     unchangedBorders = 0;
     for( int currentBorder = 1; currentBorder <= 6; currentBorder++)
     {
-      // Loop through the image.
-      for ( ot.GoToBegin(); !ot.IsAtEnd(); ++ot )
-      { 
-        // check if point is foreground
-        if ( ot.GetCenterPixel() != 1 )
-        {
-          continue;         // current point is already background 
-        }
-        // check 6-neighbors if point is a border point of type currentBorder
-        bool isBorderPoint = false;
-        if( currentBorder == 1 && ot.GetPixel(N)<=0 )
-          isBorderPoint = true;
-        if( currentBorder == 2 && ot.GetPixel(S)<=0 )
-          isBorderPoint = true;
-        if( currentBorder == 3 && ot.GetPixel(E)<=0 )
-          isBorderPoint = true;
-        if( currentBorder == 4 && ot.GetPixel(W)<=0 )
-          isBorderPoint = true;
-        if( currentBorder == 5 && ot.GetPixel(U)<=0 )
-          isBorderPoint = true;
-        if( currentBorder == 6 && ot.GetPixel(B)<=0 )
-          isBorderPoint = true;
-        if( !isBorderPoint )
-        {
-          continue;         // current point is not deletable
-        }        
-        // check if point is the end of an arc
-        int numberOfNeighbors = -1;   // -1 and not 0 because the center pixel will be counted as well  
-        for( int i = 0; i < 27; i++ ) // i =  0..26
-          if( ot.GetPixel(i)==1 )
-            numberOfNeighbors++;
-
-        if( numberOfNeighbors == 1 )
-        {
-          continue;         // current point is not deletable
-        }
-
-        // check if point is Euler invariant
-        if( !isEulerInvariant( ot.GetNeighborhood(), eulerLUT ) )
+      // Find the simple border points of type currentBorder. Only the
+      // border points need to be checked, and the lists of the threads
+      // are concatenated in order so that the points stay in raster
+      // order.
+      str.Border = currentBorder;
+      if( numberOfThreads == 1 || borderPoints.size() < 1024*numberOfThreads )
+      {
+        if( !borderPoints.empty() )
         {
-          continue;         // current point is not deletable
+          findSimpleBorderPoints( &borderPoints[0], &borderPoints[0] + borderPoints.size(), currentBorder, 
+                                  simpleBorderPoints );
         }
+      }
+      else
+      {
+        this->GetMultiThreader()->SetNumberOfThreads( numberOfThreads );
+        this->GetMultiThreader()->SetSingleMethod( BinaryThinningImageFilter3D::SimpleBorderPointsThreaderCallback, &str );
+        this->GetMultiThreader()->SingleMethodExecute();
 
-        // check if point is simple (deletion does not change connectivity in the 3x3x3 neighborhood)
-        if( !isSimplePoint( ot.GetNeighborhood() ) )
+        for( unsigned int t = 0; t < numberOfThreads; t++ )
         {
-          continue;         // current point is not deletable
+          simpleBorderPoints.insert( simpleBorderPoints.end(), threadPoints[t].begin(), threadPoints[t].end() );
+          threadPoints[t].clear();
         }
-
-        // add all simple border points to a list for sequential re-checking
-        simpleBorderPoints.push_back( ot.GetIndex() );
-      } // end image iteration loop
+      }
 
       // sequential re-checking to preserve connectivity when
       // deleting in a parallel way
       bool noChange = true;
       for( simpleBorderPointsIt=simpleBorderPoints.begin(); simpleBorderPointsIt!=simpleBorderPoints.end(); simpleBorderPointsIt++)
       {
+        SizeValueType point = *simpleBorderPointsIt;
       	// 1. Set simple border point to 0
-        thinImage->SetPixel( *simpleBorderPointsIt, NumericTraits<OutputImagePixelType>::Zero);
+        m_Image[point] = 0;
         // 2. Check if neighborhood is still connected
-        ot.SetLocation( *simpleBorderPointsIt );
-        if( !isSimplePoint( ot.GetNeighborhood() ) )
+        if( !isSimplePoint( getNeighborhoodMask( point ) ) )
         {
           // we cannot delete current point, so reset
-          thinImage->SetPixel( *simpleBorderPointsIt, NumericTraits<OutputImagePixelType>::One );
+          m_Image[point] = 1;
+          continue;
         }
-        else
+        noChange = false;
+
+        // The neighbors of the deleted point have to be checked again,
+        // and its foreground 6-neighbors are now border points
+        for( int n = 0; n < 27; n++ )
         {
-          noChange = false;
+          m_PointStates[point + m_NeighborOffsets[n]] &= 128;
+        }
+        for( int f = 0; f < 6; f++ )
+        {
+          SizeValueType neighbor = point + m_NeighborOffsets[faces[f]];
+          if( m_Image[neighbor] == 1 && !( m_PointStates[neighbor] & 128 ) )
+          {
+            m_PointStates[neighbor] |= 128;
+            newBorderPoints.push_back( neighbor );
+          }
         }
       }
       if( noChange )
         unchangedBorders++;
 
       simpleBorderPoints.clear();
+
+      if( !noChange )
+      {
+        // Remove the deleted points from the border points and add the
+        // new ones, keeping the raster order
+        SizeValueType numberOfBorderPoints = 0;
+        for( SizeValueType i = 0; i < borderPoints.size(); i++ )
+        {
+          if( m_Image[borderPoints[i]] == 1 )
+          {
+            borderPoints[numberOfBorderPoints++] = borderPoints[i];
+          }
+        }
+        borderPoints.resize( numberOfBorderPoints );
+
+        std::sort( newBorderPoints.begin(), newBorderPoints.end() );
+        borderPoints.insert( borderPoints.end(), newBorderPoints.begin(), newBorderPoints.end() );
+        std::inplace_merge( borderPoints.begin(), borderPoints.begin() + numberOfBorderPoints, borderPoints.end() );
+        newBorderPoints.clear();
+      }
     } // end currentBorder for loop
   } // end unchangedBorders while loop
 
+  // Copy the thinned image back
+  ImageRegionIterator< TOutputImage > ot( thinImage, region );
+  ot.GoToBegin();
+  for( SizeValueType z = 1; z <= size[2]; z++ )
+  {
+    for( SizeValueType y = 1; y <= size[1]; y++ )
+    {
+      SizeValueType point = (z*m_PaddedSize[1] + y)*m_PaddedSize[0] + 1;
+      for( SizeValueType x = 0; x < size[0]; x++, point++, ++ot )
+      {
+        if( m_Image[point] == 1 )
+        {
+          ot.Set( NumericTraits<OutputImagePixelType>::One );
+        }
+        else
+        {
+          ot.Set( NumericTraits<OutputImagePixelType>::Zero );
+        }
+      }
+    }
+  }
+
+  m_Image.clear();
+  m_PointStates.clear();
+
   itkDebugMacro( << "ComputeThinImage End");
 }
 
+/**
+ *  Find the border points (foreground points with a background
+ *  6-neighbor) of the slices [first, last) of the padded image, in
+ *  raster order, and mark them as being in the border list.
+ */
+template <class TInputImage,class TOutputImage>
+void 
+BinaryThinningImageFilter3D<TInputImage,TOutputImage>
+::findBorderPoints(unsigned int first, unsigned int last, std::vector< SizeValueType >& points)
+{
+  const int faces[6] = { 10, 16, 14, 12, 22, 4 };
+
+  for( SizeValueType z = first; z < last; z++ )
+  {
+    for( SizeValueType y = 1; y < m_PaddedSize[1] - 1; y++ )
+    {
+      SizeValueType point = (z*m_PaddedSize[1] + y)*m_PaddedSize[0] + 1;
+      for( SizeValueType x = 1; x < m_PaddedSize[0] - 1; x++, point++ )
+      {
+        if( m_Image[point] != 1 )
+        {
+          continue;
+        }
+        for( int f = 0; f < 6; f++ )
+        {
+          if( m_Image[point + m_NeighborOffsets[faces[f]]] == 0 )
+          {
+            m_PointStates[point] |= 128;
+            points.push_back( point );
+            break;
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ *  Find the simple border points of the specified type among the
+ *  border points [first, last). The points that are found not to be
+ *  deletable are marked, so that they are not checked again until one
+ *  of their neighbors is deleted.
+ */
+template <class TInputImage,class TOutputImage>
+void 
+BinaryThinningImageFilter3D<TInputImage,TOutputImage>
+::findSimpleBorderPoints(const SizeValueType* first, const SizeValueType* last, int border,
+                         std::vector< SizeValueType >& points)
+{
+  const int faces[6] = { 10, 16, 14, 12, 22, 4 };
+  const unsigned char borderBit = static_cast< unsigned char >( 1 << (border - 1) );
+  const OffsetValueType faceOffset = m_NeighborOffsets[faces[border - 1]];
+
+  for( const SizeValueType* pointIt = first; pointIt != last; ++pointIt )
+  {
+    SizeValueType point = *pointIt;
+    if( m_PointStates[point] & borderBit )
+    {
+      continue;         // current point is known not to be deletable
+    }
+    // check 6-neighbor if point is a border point of type border
+    if( m_Image[point + faceOffset] != 0 )
+    {
+      m_PointStates[point] |= borderBit;
+      continue;         // current point is not deletable
+    }
+
+    unsigned int neighbors = getNeighborhoodMask( point );
+
+    // check if point is the end of an arc (exactly one neighbor)
+    if( ( neighbors & ( neighbors - 1 ) ) == 0 && neighbors != 0 )
+    {
+      m_PointStates[point] |= borderBit;
+      continue;         // current point is not deletable
+    }
+
+    // check if point is Euler invariant and simple (deletion does not
+    // change connectivity in the 3x3x3 neighborhood)
+    if( !isEulerInvariant( neighbors ) || !isSimplePoint( neighbors ) )
+    {
+      m_PointStates[point] |= borderBit;
+      continue;         // current point is not deletable
+    }
+
+    // add all simple border points to a list for sequential re-checking
+    points.push_back( point );
+  }
+}
+
+/**
+ *  Find the border points of a block of slices
+ */
+template <class TInputImage,class TOutputImage>
+ITK_THREAD_RETURN_TYPE
+BinaryThinningImageFilter3D<TInputImage,TOutputImage>
+::BorderPointsThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct* info = static_cast< MultiThreader::ThreadInfoStruct* >( arg );
+  ThreadStruct* str = static_cast< ThreadStruct* >( info->UserData );
+
+  unsigned int threadId        = info->ThreadID;
+  unsigned int numberOfThreads = info->NumberOfThreads;
+
+  SizeValueType numberOfSlices = str->Filter->m_PaddedSize[2] - 2;
+  unsigned int first = static_cast< unsigned int >( 1 + numberOfSlices*threadId/numberOfThreads );
+  unsigned int last  = static_cast< unsigned int >( 1 + numberOfSlices*(threadId + 1)/numberOfThreads );
+
+  str->Filter->findBorderPoints( first, last, (*str->Points)[threadId] );
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+/**
+ *  Find the simple border points of a contiguous block of the border
+ *  points
+ */
+template <class TInputImage,class TOutputImage>
+ITK_THREAD_RETURN_TYPE
+BinaryThinningImageFilter3D<TInputImage,TOutputImage>
+::SimpleBorderPointsThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct* info = static_cast< MultiThreader::ThreadInfoStruct* >( arg );
+  ThreadStruct* str = static_cast< ThreadStruct* >( info->UserData );
+
+  unsigned int threadId        = info->ThreadID;
+  unsigned int numberOfThreads = info->NumberOfThreads;
+
+  const std::vector< SizeValueType >& borderPoints = *str->BorderPoints;
+  SizeValueType first = borderPoints.size()*threadId/numberOfThreads;
+  SizeValueType last  = borderPoints.size()*(threadId + 1)/numberOfThreads;
+
+  if( first < last )
+  {
+    str->Filter->findSimpleBorderPoints( &borderPoints[0] + first, &borderPoints[0] + last, str->Border,
+                                         (*str->Points)[threadId] );
+  }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
 /**
  *  Generate ThinImage
  */
@@ -372,153 +607,64 @@ BinaryThinningImageFilter3D<TInputImage,TOutputImage>
   LUT[255] = -1;
 }
 
+
+/** 
+ * The neighbors of a point as a mask: bit i is set if neighbor i of
+ * the 3x3x3 neighborhood (center excluded, so neighbors 14..26 are
+ * bits 13..25) is foreground.
+ */
+template <class TInputImage,class TOutputImage>
+unsigned int 
+BinaryThinningImageFilter3D<TInputImage,TOutputImage>
+::getNeighborhoodMask(SizeValueType point) const
+{
+  const unsigned char* center = &m_Image[point];
+  unsigned int neighbors = 0;
+  for( int n = 0; n < 13; n++ )
+  {
+    neighbors |= static_cast< unsigned int >( center[m_NeighborOffsets[n]] ) << n;
+  }
+  for( int n = 14; n < 27; n++ )
+  {
+    neighbors |= static_cast< unsigned int >( center[m_NeighborOffsets[n]] ) << (n - 1);
+  }
+  return neighbors;
+}
+
 /** 
  * Check for Euler invariance. (see [Lee94])
  */
 template <class TInputImage,class TOutputImage>
 bool 
 BinaryThinningImageFilter3D<TInputImage,TOutputImage>
-::isEulerInvariant(NeighborhoodType neighbors, int *LUT)
+::isEulerInvariant(unsigned int neighbors) const
 {
+  // The neighborhood positions of the seven neighbors of each octant
+  // (SWU, SEU, NWU, NEU, SWB, SEB, NWB, NEB), from the LUT index bit
+  // 128 down to bit 2
+  static const int octants[8][7] = {
+    { 24, 25, 15, 16, 21, 22, 12 },
+    { 26, 23, 17, 14, 25, 22, 16 },
+    { 18, 21,  9, 12, 19, 22, 10 },
+    { 20, 23, 19, 22, 11, 14, 10 },
+    {  6, 15,  7, 16,  3, 12,  4 },
+    {  8,  7, 17, 16,  5,  4, 14 },
+    {  0,  9,  3, 12,  1, 10,  4 },
+    {  2,  1, 11, 10,  5,  4, 14 } };
+
   // calculate Euler characteristic for each octant and sum up
   int EulerChar = 0;
-  unsigned char n;
-  // Octant SWU
-  n = 1;
-  if( neighbors[24]==1 )
-    n |= 128;
-  if( neighbors[25]==1 )
-    n |=  64;
-  if( neighbors[15]==1 )
-    n |=  32;
-  if( neighbors[16]==1 )
-    n |=  16;
-  if( neighbors[21]==1 )
-    n |=   8;
-  if( neighbors[22]==1 )
-    n |=   4;
-  if( neighbors[12]==1 )
-    n |=   2;
-  EulerChar += LUT[n];
-  // Octant SEU
-  n = 1;
-  if( neighbors[26]==1 )
-    n |= 128;
-  if( neighbors[23]==1 )
-    n |=  64;
-  if( neighbors[17]==1 )
-    n |=  32;
-  if( neighbors[14]==1 )
-    n |=  16;
-  if( neighbors[25]==1 )
-    n |=   8;
-  if( neighbors[22]==1 )
-    n |=   4;
-  if( neighbors[16]==1 )
-    n |=   2;
-  EulerChar += LUT[n];
-  // Octant NWU
-  n = 1;
-  if( neighbors[18]==1 )
-    n |= 128;
-  if( neighbors[21]==1 )
-    n |=  64;
-  if( neighbors[9]==1 )
-    n |=  32;
-  if( neighbors[12]==1 )
-    n |=  16;
-  if( neighbors[19]==1 )
-    n |=   8;
-  if( neighbors[22]==1 )
-    n |=   4;
-  if( neighbors[10]==1 )
-    n |=   2;
-  EulerChar += LUT[n];
-  // Octant NEU
-  n = 1;
-  if( neighbors[20]==1 )
-    n |= 128;
-  if( neighbors[23]==1 )
-    n |=  64;
-  if( neighbors[19]==1 )
-    n |=  32;
-  if( neighbors[22]==1 )
-    n |=  16;
-  if( neighbors[11]==1 )
-    n |=   8;
-  if( neighbors[14]==1 )
-    n |=   4;
-  if( neighbors[10]==1 )
-    n |=   2;
-  EulerChar += LUT[n];
-  // Octant SWB
-  n = 1;
-  if( neighbors[6]==1 )
-    n |= 128;
-  if( neighbors[15]==1 )
-    n |=  64;
-  if( neighbors[7]==1 )
-    n |=  32;
-  if( neighbors[16]==1 )
-    n |=  16;
-  if( neighbors[3]==1 )
-    n |=   8;
-  if( neighbors[12]==1 )
-    n |=   4;
-  if( neighbors[4]==1 )
-    n |=   2;
-  EulerChar += LUT[n];
-  // Octant SEB
-  n = 1;
-  if( neighbors[8]==1 )
-    n |= 128;
-  if( neighbors[7]==1 )
-    n |=  64;
-  if( neighbors[17]==1 )
-    n |=  32;
-  if( neighbors[16]==1 )
-    n |=  16;
-  if( neighbors[5]==1 )
-    n |=   8;
-  if( neighbors[4]==1 )
-    n |=   4;
-  if( neighbors[14]==1 )
-    n |=   2;
-  EulerChar += LUT[n];
-  // Octant NWB
-  n = 1;
-  if( neighbors[0]==1 )
-    n |= 128;
-  if( neighbors[9]==1 )
-    n |=  64;
-  if( neighbors[3]==1 )
-    n |=  32;
-  if( neighbors[12]==1 )
-    n |=  16;
-  if( neighbors[1]==1 )
-    n |=   8;
-  if( neighbors[10]==1 )
-    n |=   4;
-  if( neighbors[4]==1 )
-    n |=   2;
-  EulerChar += LUT[n];
-  // Octant NEB
-  n = 1;
-  if( neighbors[2]==1 )
-    n |= 128;
-  if( neighbors[1]==1 )
-    n |=  64;
-  if( neighbors[11]==1 )
-    n |=  32;
-  if( neighbors[10]==1 )
-    n |=  16;
-  if( neighbors[5]==1 )
-    n |=   8;
-  if( neighbors[4]==1 )
-    n |=   4;
-  if( neighbors[14]==1 )
-    n |=   2;
-  EulerChar += LUT[n];
+  for( int o = 0; o < 8; o++ )
+  {
+    unsigned int n = 1;
+    for( int i = 0; i < 7; i++ )
+    {
+      int bit = octants[o][i] < 13 ? octants[o][i] : octants[o][i] - 1;
+      if( neighbors & ( 1u << bit ) )
+        n |= 128 >> i;
+    }
+    EulerChar += m_EulerLUT[n];
+  }
   if( EulerChar == 0 )
     return true;
   else
@@ -527,432 +673,80 @@ BinaryThinningImageFilter3D<TInputImage,TOutputImage>
 
 /** 
  * Check if current point is a Simple Point.
- * This method is named 'N(v)_labeling' in [Lee94].
- * Outputs the number of connected objects in a neighborhood of a point
- * after this point would have been removed.
+ * This method is named 'N(v)_labeling' in [Lee94], where the number
+ * of connected objects in a neighborhood of a point after this point
+ * would have been removed is found by recursive octree labeling.
+ * Here the component of the first neighbor is grown by 26-adjacency,
+ * all its points at once, until it stops growing; the point is simple
+ * if that component holds all the neighbors.
  */
 template <class TInputImage,class TOutputImage>
 bool 
 BinaryThinningImageFilter3D<TInputImage,TOutputImage>
-::isSimplePoint(NeighborhoodType neighbors)
+::isSimplePoint(unsigned int neighbors) const
 {
-  // copy neighbors for labeling
-  int cube[26];
-  int i;
-  for( i = 0; i < 13; i++ )  // i =  0..12 -> cube[0..12]
-    cube[i] = neighbors[i];
-  // i != 13 : ignore center pixel when counting (see [Lee94])
-  for( i = 14; i < 27; i++ ) // i = 14..26 -> cube[13..25]
-    cube[i-1] = neighbors[i];
-  // set initial label
-  int label = 2;
-  // for all points in the neighborhood
-  for( int i = 0; i < 26; i++ )
+  if( neighbors == 0 )
   {
-    if( cube[i]==1 )     // voxel has not been labelled yet
+    return true;
+  }
+
+  unsigned int component = neighbors & ( ~neighbors + 1 );
+  while( true )
+  {
+    unsigned int grown = component | ( neighbors & 
+      ( m_AdjacencyLUT[0][component & 255] | m_AdjacencyLUT[1][(component >> 8) & 255] | 
+        m_AdjacencyLUT[2][(component >> 16) & 255] | m_AdjacencyLUT[3][component >> 24] ) );
+    if( grown == component )
     {
-      // start recursion with any octant that contains the point i
-      switch( i )
-      {
-      case 0:
-      case 1:
-      case 3:
-      case 4:
-      case 9:
-      case 10:
-      case 12:
-        Octree_labeling(1, label, cube );
-        break;
-      case 2:
-      case 5:
-      case 11:
-      case 13:
-        Octree_labeling(2, label, cube );
-        break;
-      case 6:
-      case 7:
-      case 14:
-      case 15:
-        Octree_labeling(3, label, cube );
-        break;
-      case 8:
-      case 16:
-        Octree_labeling(4, label, cube );
-        break;
-      case 17:
-      case 18:
-      case 20:
-      case 21:
-        Octree_labeling(5, label, cube );
-        break;
-      case 19:
-      case 22:
-        Octree_labeling(6, label, cube );
-        break;
-      case 23:
-      case 24:
-        Octree_labeling(7, label, cube );
-        break;
-      case 25:
-        Octree_labeling(8, label, cube );
-        break;
-      }
-      label++;
-      if( label-2 >= 2 )
-      {
-        return false;
-      }
+      break;
     }
+    component = grown;
   }
-  //return label-2; in [Lee94] if the number of connected compontents would be needed
-  return true;
+  return component == neighbors;
 }
 
 /** 
- * Octree_labeling [Lee94]
- * This is a recursive method that calulates the number of connected
- * components in the 3D neighbourhood after the center pixel would
- * have been removed.
+ * Fill the adjacency look-up tables: m_AdjacencyLUT[k][b] is the mask
+ * of the neighbors that are 26-adjacent to at least one of the
+ * neighbors 8k..8k+7 selected by the bits of b (neighbor positions as
+ * in getNeighborhoodMask).
  */
 template <class TInputImage,class TOutputImage>
 void 
 BinaryThinningImageFilter3D<TInputImage,TOutputImage>
-::Octree_labeling(int octant, int label, int *cube)
+::fillAdjacencyLUT()
 {
-  // check if there are points in the octant with value 1
-  if( octant==1 )
-  {
-  	// set points in this octant to current label
-  	// and recurseive labeling of adjacent octants
-    if( cube[0] == 1 )
-      cube[0] = label;
-    if( cube[1] == 1 )
-    {
-      cube[1] = label;        
-      Octree_labeling( 2, label, cube);
-    }
-    if( cube[3] == 1 )
-    {
-      cube[3] = label;        
-      Octree_labeling( 3, label, cube);
-    }
-    if( cube[4] == 1 )
-    {
-      cube[4] = label;        
-      Octree_labeling( 2, label, cube);
-      Octree_labeling( 3, label, cube);
-      Octree_labeling( 4, label, cube);
-    }
-    if( cube[9] == 1 )
-    {
-      cube[9] = label;        
-      Octree_labeling( 5, label, cube);
-    }
-    if( cube[10] == 1 )
-    {
-      cube[10] = label;        
-      Octree_labeling( 2, label, cube);
-      Octree_labeling( 5, label, cube);
-      Octree_labeling( 6, label, cube);
-    }
-    if( cube[12] == 1 )
-    {
-      cube[12] = label;        
-      Octree_labeling( 3, label, cube);
-      Octree_labeling( 5, label, cube);
-      Octree_labeling( 7, label, cube);
-    }
-  }
-  if( octant==2 )
-  {
-    if( cube[1] == 1 )
-    {
-      cube[1] = label;
-      Octree_labeling( 1, label, cube);
-    }
-    if( cube[4] == 1 )
-    {
-      cube[4] = label;        
-      Octree_labeling( 1, label, cube);
-      Octree_labeling( 3, label, cube);
-      Octree_labeling( 4, label, cube);
-    }
-    if( cube[10] == 1 )
-    {
-      cube[10] = label;        
-      Octree_labeling( 1, label, cube);
-      Octree_labeling( 5, label, cube);
-      Octree_labeling( 6, label, cube);
-    }
-    if( cube[2] == 1 )
-      cube[2] = label;        
-    if( cube[5] == 1 )
-    {
-      cube[5] = label;        
-      Octree_labeling( 4, label, cube);
-    }
-    if( cube[11] == 1 )
-    {
-      cube[11] = label;        
-      Octree_labeling( 6, label, cube);
-    }
-    if( cube[13] == 1 )
-    {
-      cube[13] = label;        
-      Octree_labeling( 4, label, cube);
-      Octree_labeling( 6, label, cube);
-      Octree_labeling( 8, label, cube);
-    }
-  }
-  if( octant==3 )
-  {
-    if( cube[3] == 1 )
-    {
-      cube[3] = label;        
-      Octree_labeling( 1, label, cube);
-    }
-    if( cube[4] == 1 )
-    {
-      cube[4] = label;        
-      Octree_labeling( 1, label, cube);
-      Octree_labeling( 2, label, cube);
-      Octree_labeling( 4, label, cube);
-    }
-    if( cube[12] == 1 )
-    {
-      cube[12] = label;        
-      Octree_labeling( 1, label, cube);
-      Octree_labeling( 5, label, cube);
-      Octree_labeling( 7, label, cube);
-    }
-    if( cube[6] == 1 )
-      cube[6] = label;        
-    if( cube[7] == 1 )
-    {
-      cube[7] = label;        
-      Octree_labeling( 4, label, cube);
-    }
-    if( cube[14] == 1 )
-    {
-      cube[14] = label;        
-      Octree_labeling( 7, label, cube);
-    }
-    if( cube[15] == 1 )
-    {
-      cube[15] = label;        
-      Octree_labeling( 4, label, cube);
-      Octree_labeling( 7, label, cube);
-      Octree_labeling( 8, label, cube);
-    }
-  }
-  if( octant==4 )
-  {
-  	if( cube[4] == 1 )
-    {
-      cube[4] = label;        
-      Octree_labeling( 1, label, cube);
-      Octree_labeling( 2, label, cube);
-      Octree_labeling( 3, label, cube);
-    }
-  	if( cube[5] == 1 )
-    {
-      cube[5] = label;        
-      Octree_labeling( 2, label, cube);
-    }
-    if( cube[13] == 1 )
-    {
-      cube[13] = label;        
-      Octree_labeling( 2, label, cube);
-      Octree_labeling( 6, label, cube);
-      Octree_labeling( 8, label, cube);
-    }
-    if( cube[7] == 1 )
-    {
-      cube[7] = label;        
-      Octree_labeling( 3, label, cube);
-    }
-    if( cube[15] == 1 )
-    {
-      cube[15] = label;        
-      Octree_labeling( 3, label, cube);
-      Octree_labeling( 7, label, cube);
-      Octree_labeling( 8, label, cube);
-    }
-    if( cube[8] == 1 )
-      cube[8] = label;        
-    if( cube[16] == 1 )
-    {
-      cube[16] = label;        
-      Octree_labeling( 8, label, cube);
-    }
-  }
-  if( octant==5 )
-  {
-  	if( cube[9] == 1 )
-    {
-      cube[9] = label;        
-      Octree_labeling( 1, label, cube);
-    }
-    if( cube[10] == 1 )
-    {
-      cube[10] = label;        
-      Octree_labeling( 1, label, cube);
-      Octree_labeling( 2, label, cube);
-      Octree_labeling( 6, label, cube);
-    }
-    if( cube[12] == 1 )
-    {
-      cube[12] = label;        
-      Octree_labeling( 1, label, cube);
-      Octree_labeling( 3, label, cube);
-      Octree_labeling( 7, label, cube);
-    }
-    if( cube[17] == 1 )
-      cube[17] = label;        
-    if( cube[18] == 1 )
-    {
-      cube[18] = label;        
-      Octree_labeling( 6, label, cube);
-    }
-    if( cube[20] == 1 )
-    {
-      cube[20] = label;        
-      Octree_labeling( 7, label, cube);
-    }
-    if( cube[21] == 1 )
-    {
-      cube[21] = label;        
-      Octree_labeling( 6, label, cube);
-      Octree_labeling( 7, label, cube);
-      Octree_labeling( 8, label, cube);
-    }
-  }
-  if( octant==6 )
+  unsigned int adjacent[26];
+  for( int i = 0; i < 26; i++ )
   {
-  	if( cube[10] == 1 )
-    {
-      cube[10] = label;        
-      Octree_labeling( 1, label, cube);
-      Octree_labeling( 2, label, cube);
-      Octree_labeling( 5, label, cube);
-    }
-    if( cube[11] == 1 )
-    {
-      cube[11] = label;        
-      Octree_labeling( 2, label, cube);
-    }
-    if( cube[13] == 1 )
-    {
-      cube[13] = label;        
-      Octree_labeling( 2, label, cube);
-      Octree_labeling( 4, label, cube);
-      Octree_labeling( 8, label, cube);
-    }
-    if( cube[18] == 1 )
-    {
-      cube[18] = label;        
-      Octree_labeling( 5, label, cube);
-    }
-    if( cube[21] == 1 )
-    {
-      cube[21] = label;        
-      Octree_labeling( 5, label, cube);
-      Octree_labeling( 7, label, cube);
-      Octree_labeling( 8, label, cube);
-    }
-    if( cube[19] == 1 )
-      cube[19] = label;        
-    if( cube[22] == 1 )
+    int n = i < 13 ? i : i + 1;
+    adjacent[i] = 0;
+    for( int j = 0; j < 26; j++ )
     {
-      cube[22] = label;        
-      Octree_labeling( 8, label, cube);
+      int m = j < 13 ? j : j + 1;
+      if( i != j && std::abs( n%3 - m%3 ) <= 1 && std::abs( (n/3)%3 - (m/3)%3 ) <= 1 && std::abs( n/9 - m/9 ) <= 1 )
+      {
+        adjacent[i] |= 1u << j;
+      }
     }
   }
-  if( octant==7 )
+
+  for( int k = 0; k < 4; k++ )
   {
-  	if( cube[12] == 1 )
-    {
-      cube[12] = label;        
-      Octree_labeling( 1, label, cube);
-      Octree_labeling( 3, label, cube);
-      Octree_labeling( 5, label, cube);
-    }
-  	if( cube[14] == 1 )
+    for( int b = 0; b < 256; b++ )
     {
-      cube[14] = label;        
-      Octree_labeling( 3, label, cube);
-    }
-    if( cube[15] == 1 )
-    {
-      cube[15] = label;        
-      Octree_labeling( 3, label, cube);
-      Octree_labeling( 4, label, cube);
-      Octree_labeling( 8, label, cube);
-    }
-    if( cube[20] == 1 )
-    {
-      cube[20] = label;        
-      Octree_labeling( 5, label, cube);
-    }
-    if( cube[21] == 1 )
-    {
-      cube[21] = label;        
-      Octree_labeling( 5, label, cube);
-      Octree_labeling( 6, label, cube);
-      Octree_labeling( 8, label, cube);
-    }
-    if( cube[23] == 1 )
-      cube[23] = label;        
-    if( cube[24] == 1 )
-    {
-      cube[24] = label;        
-      Octree_labeling( 8, label, cube);
+      m_AdjacencyLUT[k][b] = 0;
+      for( int i = 0; i < 8 && 8*k + i < 26; i++ )
+      {
+        if( b & ( 1 << i ) )
+        {
+          m_AdjacencyLUT[k][b] |= adjacent[8*k + i];
+        }
+      }
     }
   }
-  if( octant==8 )
-  {
-  	if( cube[13] == 1 )
-    {
-      cube[13] = label;        
-      Octree_labeling( 2, label, cube);
-      Octree_labeling( 4, label, cube);
-      Octree_labeling( 6, label, cube);
-    }
-  	if( cube[15] == 1 )
-    {
-      cube[15] = label;        
-      Octree_labeling( 3, label, cube);
-      Octree_labeling( 4, label, cube);
-      Octree_labeling( 7, label, cube);
-    }
-  	if( cube[16] == 1 )
-    {
-      cube[16] = label;        
-      Octree_labeling( 4, label, cube);
-    }
-  	if( cube[21] == 1 )
-    {
-      cube[21] = label;        
-      Octree_labeling( 5, label, cube);
-      Octree_labeling( 6, label, cube);
-      Octree_labeling( 7, label, cube);
-    }
-  	if( cube[22] == 1 )
-    {
-      cube[22] = label;        
-      Octree_labeling( 6, label, cube);
-    }
-  	if( cube[24] == 1 )
-    {
-      cube[24] = label;        
-      Octree_labeling( 7, label, cube);
-    }
-  	if( cube[25] == 1 )
-      cube[25] = label;        
-  } 
 }
 
-
 /**
  *  Print Self
  */
@@ -19,6 +19,7 @@
 #define __itkMultiScaleGaussianEnhancementImageFilter_h
 
 #include "itkGaussianEnhancementImageFilter.h"
+#include "itkRegionOfInterestImageFilter.h"
 
 namespace itk
 {
@@ -34,6 +35,19 @@ namespace itk
  * The filter computes a second output image (accessed by the GetScalesOutput method)
  * containing the scales at which each pixel gave the best response.
  *
+ * By default every scale is computed by a GaussianEnhancementImageFilter,
+ * which holds the Hessian and eigenvalue images of the whole volume. When
+ * UseFusedComputation is on, the volume is instead processed in slabs of
+ * NumberOfSlicesPerSlab slices along the last dimension: for every slab the
+ * Hessian is computed on the slab padded with enough slices for the recursive
+ * Gaussian to settle, and the eigenvalues (in closed form), the functor and
+ * the running maximum are evaluated voxel by voxel without intermediate images.
+ * Only the slab images are held in memory. The output matches the single scale
+ * pipeline up to the truncation of the Gaussian at the slab borders. If a
+ * mask image is set, only the voxels inside it (non-zero) are evaluated, and
+ * slabs without such voxels are skipped. With Rescale on, each scale is
+ * computed twice, first to find the range of the response.
+ *
  * \sa GaussianEnhancementImageFilter
  * \sa HessianRecursiveGaussianImageFilter
  * \sa SymmetricEigenAnalysisImageFilter
@@ -96,6 +110,13 @@ public:
   typedef typename SingleScaleFilterType::UnaryFunctorBaseType          UnaryFunctorBaseType;
   typedef typename SingleScaleFilterType::BinaryFunctorImageFilterType  BinaryFunctorImageFilterType;
   typedef typename SingleScaleFilterType::BinaryFunctorBaseType         BinaryFunctorBaseType;
+  typedef typename HessianTensorImageType::PixelType                   HessianPixelType;
+
+  /** Types for the fused computation. */
+  typedef Image< unsigned short,
+    itkGetStaticConstMacro( ImageDimension ) >            MaskImageType;
+  typedef RegionOfInterestImageFilter<
+    InputImageType, InputImageType >                      SlabExtractorType;
 
   /** Set/Get unary functor */
   virtual void SetUnaryFunctor( UnaryFunctorBaseType * _arg );
@@ -172,6 +193,23 @@ public:
   void SetNormalizeAcrossScale( bool normalize );
   bool GetNormalizeAcrossScale() const;
 
+  /** Methods to turn on/off the fused, slab by slab computation of the
+   * scales. Off by default. */
+  itkSetMacro( UseFusedComputation, bool );
+  itkGetConstMacro( UseFusedComputation, bool );
+  itkBooleanMacro( UseFusedComputation );
+
+  /** Set/Get the number of slices of the slabs of the fused computation. */
+  itkSetClampMacro( NumberOfSlicesPerSlab, unsigned int, 1, NumericTraits<unsigned int>::max() );
+  itkGetConstMacro( NumberOfSlicesPerSlab, unsigned int );
+
+  /** Set/Get the mask restricting the fused computation. Voxels outside
+   * the mask keep the initial value of the output (see
+   * NonNegativeHessianBasedMeasure) and a zero scale. The mask should cover
+   * the output region. Not used by the default computation. */
+  itkSetConstObjectMacro( MaskImage, MaskImageType );
+  itkGetConstObjectMacro( MaskImage, MaskImageType );
+
   /** Set the number of threads to create when executing. */
   void SetNumberOfThreads( ThreadIdType nt );
 
@@ -212,6 +250,49 @@ private:
   /** Compute the current sigma. */
   double ComputeSigmaValue( const unsigned int & scaleLevel );
 
+  /** Computes the maximum response of all scales slab by slab. */
+  void GenerateDataFused( void );
+
+  /** Computes the response of one scale slab by slab, either to find its
+   * range or to update the maximum response with it, rescaled by scale
+   * and shift. */
+  void ComputeFusedResponse(
+    const unsigned int & scaleLevel,
+    const bool & updateMaximum,
+    const double & scale, const double & shift,
+    double & minimum, double & maximum );
+
+  /** Struct to pass a slab to the threads of the fused computation. */
+  struct FusedThreadStruct
+  {
+    Self *                              Filter;
+    const HessianTensorImageType *      Hessian;
+    const GradientMagnitudeImageType *  GradientMagnitude;
+    UnaryFunctorBaseType *              UnaryFunctor;
+    BinaryFunctorBaseType *             BinaryFunctor;
+    OutputRegionType                    Region;       // slab, without padding
+    typename OutputRegionType::IndexType SlabIndex;   // index of the padded slab
+    bool                                UpdateMaximum;
+    double                              Scale;
+    double                              Shift;
+    ScalesPixelType                     Sigma;
+    std::vector< double >               Minima;       // per thread
+    std::vector< double >               Maxima;       // per thread
+  };
+
+  /** Evaluates the functor over the part of the slab of a thread. */
+  void ThreadedComputeFusedResponse( FusedThreadStruct * str,
+    ThreadIdType threadId, ThreadIdType numberOfThreads );
+
+  /** Static function used as a "callback" by the MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE FusedThreaderCallback( void * arg );
+
+  /** Computes the eigenvalues of a symmetric 3x3 matrix in closed form,
+   * ordered by value as SymmetricEigenAnalysisImageFilter does. */
+  static void ComputeEigenValues(
+    const HessianPixelType & hessian,
+    EigenValueArrayType & eigenValues );
+
   /** Single scale filter */
   typename SingleScaleFilterType::Pointer m_GaussianEnhancementFilter;
 
@@ -225,6 +306,10 @@ private:
   unsigned int         m_NumberOfSigmaSteps;
   SigmaStepMethodType  m_SigmaStepMethod;
 
+  bool                 m_UseFusedComputation;
+  unsigned int         m_NumberOfSlicesPerSlab;
+  typename MaskImageType::ConstPointer m_MaskImage;
+
 }; // end class MultiScaleGaussianEnhancementImageFilter
 
 } // end namespace itk
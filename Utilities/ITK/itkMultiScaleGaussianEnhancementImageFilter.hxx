@@ -24,6 +24,9 @@
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
 #include "itkMaximumImageFilter.h"
+#include "vnl/vnl_math.h"
+
+#include <algorithm>
 
 namespace itk
 {
@@ -47,6 +50,10 @@ MultiScaleGaussianEnhancementImageFilter< TInputImage, TOutputImage >
   this->m_GenerateScalesOutput = false;
   this->m_Rescale = true;
 
+  this->m_UseFusedComputation = false;
+  this->m_NumberOfSlicesPerSlab = 32;
+  this->m_MaskImage = NULL;
+
   typename ScalesImageType::Pointer scalesImage = ScalesImageType::New();
   this->ProcessObject::SetNumberOfRequiredOutputs( 2 );
   this->ProcessObject::SetNthOutput( 1, scalesImage.GetPointer() );
@@ -197,6 +204,12 @@ MultiScaleGaussianEnhancementImageFilter< TInputImage, TOutputImage >
       << " cannot be greater than SigmaMaximum: " << this->m_SigmaMaximum );
   }
 
+  if ( this->m_UseFusedComputation )
+  {
+    this->GenerateDataFused();
+    return;
+  }
+
   typename InputImageType::ConstPointer input = this->GetInput();
 
   // Set filter input
@@ -273,6 +286,374 @@ MultiScaleGaussianEnhancementImageFilter< TInputImage, TOutputImage >
 } // end UpdateMaximumResponse()
 
 
+/**
+ * ********************* GenerateDataFused ****************************
+ */
+
+template< typename TInputImage, typename TOutputImage >
+void
+MultiScaleGaussianEnhancementImageFilter< TInputImage, TOutputImage >
+::GenerateDataFused( void )
+{
+  if ( this->m_GaussianEnhancementFilter->GetUnaryFunctor() == NULL
+    && this->m_GaussianEnhancementFilter->GetBinaryFunctor() == NULL )
+  {
+    itkExceptionMacro( << "ERROR: Missing Functor. "
+      << "Please provide functor for multi scale framework." );
+  }
+
+  if ( this->m_MaskImage.IsNotNull()
+    && !this->m_MaskImage->GetBufferedRegion().IsInside( this->GetOutput()->GetBufferedRegion() ) )
+  {
+    itkExceptionMacro( << "ERROR: The mask image does not cover the output region." );
+  }
+
+  for ( unsigned int scaleLevel = 0; scaleLevel < this->m_NumberOfSigmaSteps; scaleLevel++ )
+  {
+    double minimum = 0.0;
+    double maximum = 0.0;
+    double scale = 1.0;
+    double shift = 0.0;
+
+    // Rescale the response to [0,1] the way RescaleIntensityImageFilter does,
+    // which takes a first pass to find its range.
+    if ( this->m_Rescale )
+    {
+      this->ComputeFusedResponse( scaleLevel, false, scale, shift, minimum, maximum );
+
+      if ( minimum != maximum )
+      {
+        scale = 1.0 / ( maximum - minimum );
+      }
+      else if ( maximum != 0.0 )
+      {
+        scale = 1.0 / maximum;
+      }
+      else
+      {
+        scale = 0.0;
+      }
+      shift = -minimum * scale;
+    }
+
+    this->ComputeFusedResponse( scaleLevel, true, scale, shift, minimum, maximum );
+  }
+
+} // end GenerateDataFused()
+
+
+/**
+ * ********************* ComputeFusedResponse ****************************
+ */
+
+template< typename TInputImage, typename TOutputImage >
+void
+MultiScaleGaussianEnhancementImageFilter< TInputImage, TOutputImage >
+::ComputeFusedResponse(
+  const unsigned int & scaleLevel,
+  const bool & updateMaximum,
+  const double & scale, const double & shift,
+  double & minimum, double & maximum )
+{
+  const double sigma = this->ComputeSigmaValue( scaleLevel );
+  const unsigned int slabDimension = ImageDimension - 1;
+
+  const InputImageType * input = this->GetInput();
+  const typename InputImageType::RegionType inputRegion = input->GetBufferedRegion();
+  const OutputRegionType outputRegion = this->GetOutput()->GetBufferedRegion();
+
+  const long inputStart  = inputRegion.GetIndex()[ slabDimension ];
+  const long inputEnd    = inputStart + static_cast<long>( inputRegion.GetSize()[ slabDimension ] );
+  const long outputStart = outputRegion.GetIndex()[ slabDimension ];
+  const long outputEnd   = outputStart + static_cast<long>( outputRegion.GetSize()[ slabDimension ] );
+
+  // The slabs are padded by four sigmas, beyond which the Gaussian is
+  // negligible, and by at least four slices, the minimum the recursive
+  // Gaussian filters accept.
+  const long margin = vnl_math_max( 4L, static_cast<long>(
+    vcl_ceil( 4.0 * sigma / input->GetSpacing()[ slabDimension ] ) ) );
+
+  // Set up the single scale pipeline on the slabs
+  typename SlabExtractorType::Pointer extractor = SlabExtractorType::New();
+  extractor->SetInput( input );
+
+  typename HessianFilterType::Pointer hessianFilter = HessianFilterType::New();
+  hessianFilter->SetInput( extractor->GetOutput() );
+  hessianFilter->SetSigma( sigma );
+  hessianFilter->SetNormalizeAcrossScale( this->m_GaussianEnhancementFilter->GetNormalizeAcrossScale() );
+  hessianFilter->SetNumberOfThreads( this->GetNumberOfThreads() );
+
+  typename GradientMagnitudeFilterType::Pointer gradientMagnitudeFilter;
+  if ( this->m_GaussianEnhancementFilter->GetBinaryFunctor() != NULL )
+  {
+    gradientMagnitudeFilter = GradientMagnitudeFilterType::New();
+    gradientMagnitudeFilter->SetInput( extractor->GetOutput() );
+    gradientMagnitudeFilter->SetSigma( sigma );
+    gradientMagnitudeFilter->SetNormalizeAcrossScale( this->m_GaussianEnhancementFilter->GetNormalizeAcrossScale() );
+    gradientMagnitudeFilter->SetNumberOfThreads( this->GetNumberOfThreads() );
+  }
+
+  FusedThreadStruct str;
+  str.Filter        = this;
+  str.UnaryFunctor  = this->m_GaussianEnhancementFilter->GetUnaryFunctor();
+  str.BinaryFunctor = this->m_GaussianEnhancementFilter->GetBinaryFunctor();
+  str.UpdateMaximum = updateMaximum;
+  str.Scale = scale;
+  str.Shift = shift;
+  str.Sigma = static_cast<ScalesPixelType>( sigma );
+  str.Minima.assign( this->GetNumberOfThreads(), NumericTraits<double>::max() );
+  str.Maxima.assign( this->GetNumberOfThreads(), NumericTraits<double>::NonpositiveMin() );
+
+  for ( long slabStart = outputStart; slabStart < outputEnd;
+    slabStart += static_cast<long>( this->m_NumberOfSlicesPerSlab ) )
+  {
+    const long slabEnd = vnl_math_min( outputEnd,
+      slabStart + static_cast<long>( this->m_NumberOfSlicesPerSlab ) );
+
+    OutputRegionType slabRegion = outputRegion;
+    slabRegion.SetIndex( slabDimension, slabStart );
+    slabRegion.SetSize( slabDimension, slabEnd - slabStart );
+
+    // Skip the slabs without any voxel in the mask
+    if ( this->m_MaskImage.IsNotNull() )
+    {
+      ImageRegionConstIterator<MaskImageType> maskIter( this->m_MaskImage, slabRegion );
+      maskIter.GoToBegin();
+      while ( !maskIter.IsAtEnd() && maskIter.Get() == 0 )
+      {
+        ++maskIter;
+      }
+      if ( maskIter.IsAtEnd() )
+      {
+        continue;
+      }
+    }
+
+    // Compute the Hessian (and gradient magnitude) of the padded slab
+    typename InputImageType::RegionType paddedRegion = inputRegion;
+    const long paddedStart = vnl_math_max( inputStart, slabStart - margin );
+    const long paddedEnd   = vnl_math_min( inputEnd, slabEnd + margin );
+    paddedRegion.SetIndex( slabDimension, paddedStart );
+    paddedRegion.SetSize( slabDimension, paddedEnd - paddedStart );
+
+    // The last slab may be thinner, so the whole slab is requested every time
+    extractor->SetRegionOfInterest( paddedRegion );
+    hessianFilter->UpdateLargestPossibleRegion();
+    if ( gradientMagnitudeFilter.IsNotNull() )
+    {
+      gradientMagnitudeFilter->UpdateLargestPossibleRegion();
+    }
+
+    // Evaluate the functor over the slab
+    str.Hessian = hessianFilter->GetOutput();
+    str.GradientMagnitude = gradientMagnitudeFilter.IsNotNull()
+      ? gradientMagnitudeFilter->GetOutput() : NULL;
+    str.Region = slabRegion;
+    str.SlabIndex = paddedRegion.GetIndex();
+
+    this->GetMultiThreader()->SetNumberOfThreads( this->GetNumberOfThreads() );
+    this->GetMultiThreader()->SetSingleMethod( Self::FusedThreaderCallback, &str );
+    this->GetMultiThreader()->SingleMethodExecute();
+  }
+
+  minimum = *std::min_element( str.Minima.begin(), str.Minima.end() );
+  maximum = *std::max_element( str.Maxima.begin(), str.Maxima.end() );
+
+} // end ComputeFusedResponse()
+
+
+/**
+ * ********************* FusedThreaderCallback ****************************
+ */
+
+template< typename TInputImage, typename TOutputImage >
+ITK_THREAD_RETURN_TYPE
+MultiScaleGaussianEnhancementImageFilter< TInputImage, TOutputImage >
+::FusedThreaderCallback( void * arg )
+{
+  MultiThreader::ThreadInfoStruct * info
+    = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  FusedThreadStruct * str = static_cast<FusedThreadStruct *>( info->UserData );
+
+  str->Filter->ThreadedComputeFusedResponse( str, info->ThreadID, info->NumberOfThreads );
+
+  return ITK_THREAD_RETURN_VALUE;
+} // end FusedThreaderCallback()
+
+
+/**
+ * ********************* ThreadedComputeFusedResponse ****************************
+ */
+
+template< typename TInputImage, typename TOutputImage >
+void
+MultiScaleGaussianEnhancementImageFilter< TInputImage, TOutputImage >
+::ThreadedComputeFusedResponse( FusedThreadStruct * str,
+  ThreadIdType threadId, ThreadIdType numberOfThreads )
+{
+  const unsigned int slabDimension = ImageDimension - 1;
+
+  // Split the slab along its slices
+  OutputRegionType region = str->Region;
+  const unsigned long numberOfSlices = region.GetSize()[ slabDimension ];
+  const unsigned long slicesPerThread = ( numberOfSlices + numberOfThreads - 1 ) / numberOfThreads;
+  const unsigned long firstSlice = threadId * slicesPerThread;
+  if ( firstSlice >= numberOfSlices )
+  {
+    return;
+  }
+  region.SetIndex( slabDimension, region.GetIndex()[ slabDimension ] + firstSlice );
+  region.SetSize( slabDimension, vnl_math_min( slicesPerThread, numberOfSlices - firstSlice ) );
+
+  // The same region in the frame of the slab images, which start at zero
+  OutputRegionType slabRegion = region;
+  for ( unsigned int i = 0; i < ImageDimension; i++ )
+  {
+    slabRegion.SetIndex( i, region.GetIndex()[ i ] - str->SlabIndex[ i ] );
+  }
+
+  typename ScalesImageType::Pointer scalesImage
+    = static_cast<ScalesImageType*>( this->ProcessObject::GetOutput( 1 ) );
+  const bool useScales = str->UpdateMaximum && this->m_GenerateScalesOutput;
+  const bool useMask = this->m_MaskImage.IsNotNull();
+  const bool useGradientMagnitude = str->BinaryFunctor != NULL;
+
+  ImageRegionConstIterator<HessianTensorImageType> hessianIter( str->Hessian, slabRegion );
+  ImageRegionIterator<OutputImageType> outputIter( this->GetOutput(), region );
+  ImageRegionConstIterator<GradientMagnitudeImageType> gradientMagnitudeIter;
+  ImageRegionIterator<ScalesImageType> scalesIter;
+  ImageRegionConstIterator<MaskImageType> maskIter;
+  if ( useGradientMagnitude )
+  {
+    gradientMagnitudeIter = ImageRegionConstIterator<GradientMagnitudeImageType>(
+      str->GradientMagnitude, slabRegion );
+  }
+  if ( useScales )
+  {
+    scalesIter = ImageRegionIterator<ScalesImageType>( scalesImage, region );
+  }
+  if ( useMask )
+  {
+    maskIter = ImageRegionConstIterator<MaskImageType>( this->m_MaskImage, region );
+  }
+
+  double minimum = str->Minima[ threadId ];
+  double maximum = str->Maxima[ threadId ];
+  EigenValueArrayType eigenValues;
+
+  while ( !outputIter.IsAtEnd() )
+  {
+    if ( !useMask || maskIter.Get() != 0 )
+    {
+      Self::ComputeEigenValues( hessianIter.Get(), eigenValues );
+
+      OutputPixelType response;
+      if ( useGradientMagnitude )
+      {
+        response = str->BinaryFunctor->Evaluate( gradientMagnitudeIter.Get(), eigenValues );
+      }
+      else
+      {
+        response = str->UnaryFunctor->Evaluate( eigenValues );
+      }
+
+      minimum = vnl_math_min( minimum, static_cast<double>( response ) );
+      maximum = vnl_math_max( maximum, static_cast<double>( response ) );
+
+      if ( str->UpdateMaximum )
+      {
+        const OutputPixelType value
+          = static_cast<OutputPixelType>( str->Scale * response + str->Shift );
+        if ( outputIter.Get() < value )
+        {
+          outputIter.Set( value );
+          if ( useScales )
+          {
+            scalesIter.Set( str->Sigma );
+          }
+        }
+      }
+    }
+
+    ++hessianIter; ++outputIter;
+    if ( useGradientMagnitude ) { ++gradientMagnitudeIter; }
+    if ( useScales ) { ++scalesIter; }
+    if ( useMask ) { ++maskIter; }
+  }
+
+  str->Minima[ threadId ] = minimum;
+  str->Maxima[ threadId ] = maximum;
+
+} // end ThreadedComputeFusedResponse()
+
+
+/**
+ * ********************* ComputeEigenValues ****************************
+ */
+
+template< typename TInputImage, typename TOutputImage >
+void
+MultiScaleGaussianEnhancementImageFilter< TInputImage, TOutputImage >
+::ComputeEigenValues(
+  const HessianPixelType & hessian,
+  EigenValueArrayType & eigenValues )
+{
+  // Trigonometric solution of the characteristic equation, see
+  // O.K. Smith, "Eigenvalues of a symmetric 3x3 matrix",
+  // Communications of the ACM 4(4), p. 168, 1961.
+  const double a00 = hessian[ 0 ];
+  const double a01 = hessian[ 1 ];
+  const double a02 = hessian[ 2 ];
+  const double a11 = hessian[ 3 ];
+  const double a12 = hessian[ 4 ];
+  const double a22 = hessian[ 5 ];
+
+  double l1, l2, l3; // l1 <= l2 <= l3
+
+  const double offDiagonal = a01 * a01 + a02 * a02 + a12 * a12;
+  if ( offDiagonal == 0.0 )
+  {
+    // Diagonal matrix: sort the diagonal
+    l1 = vnl_math_min( a00, vnl_math_min( a11, a22 ) );
+    l3 = vnl_math_max( a00, vnl_math_max( a11, a22 ) );
+    l2 = a00 + a11 + a22 - l1 - l3;
+  }
+  else
+  {
+    // B = ( A - q I ) / p has eigenvalues 2 cos( phi + 2 k pi / 3 ),
+    // with cos( 3 phi ) = det( B ) / 2
+    const double q = ( a00 + a11 + a22 ) / 3.0;
+    const double b00 = a00 - q;
+    const double b11 = a11 - q;
+    const double b22 = a22 - q;
+    const double p = vcl_sqrt( ( b00 * b00 + b11 * b11 + b22 * b22 + 2.0 * offDiagonal ) / 6.0 );
+
+    const double r = ( b00 * ( b11 * b22 - a12 * a12 )
+      - a01 * ( a01 * b22 - a12 * a02 )
+      + a02 * ( a01 * a12 - b11 * a02 ) ) / ( 2.0 * p * p * p );
+
+    double phi = 0.0;
+    if ( r <= -1.0 )
+    {
+      phi = vnl_math::pi / 3.0;
+    }
+    else if ( r < 1.0 )
+    {
+      phi = vcl_acos( r ) / 3.0;
+    }
+
+    l3 = q + 2.0 * p * vcl_cos( phi );
+    l1 = q + 2.0 * p * vcl_cos( phi + 2.0 * vnl_math::pi / 3.0 );
+    l2 = 3.0 * q - l1 - l3;
+  }
+
+  eigenValues[ 0 ] = static_cast<typename EigenValueArrayType::ValueType>( l1 );
+  eigenValues[ 1 ] = static_cast<typename EigenValueArrayType::ValueType>( l2 );
+  eigenValues[ 2 ] = static_cast<typename EigenValueArrayType::ValueType>( l3 );
+
+} // end ComputeEigenValues()
+
+
 /**
  * ********************* ComputeSigmaValue ****************************
  */
@@ -370,6 +751,9 @@ MultiScaleGaussianEnhancementImageFilter< TInputImage, TOutputImage >
   os << indent << "Rescale: " << this->m_Rescale << std::endl;
   os << indent << "NormalizeAcrossScale: "
     << this->m_GaussianEnhancementFilter->GetNormalizeAcrossScale() << std::endl;
+  os << indent << "UseFusedComputation: " << this->m_UseFusedComputation << std::endl;
+  os << indent << "NumberOfSlicesPerSlab: " << this->m_NumberOfSlicesPerSlab << std::endl;
+  os << indent << "MaskImage: " << this->m_MaskImage.GetPointer() << std::endl;
 
 } // end PrintSelf()
 
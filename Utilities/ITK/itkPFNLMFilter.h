@@ -29,6 +29,14 @@ namespace itk
  * DO NOT assume a particular image or pixel type, which is, the input image
  * may be a VectorImage as well as an Image obeject with vectorial pixel type.
  *
+ * The search windows are swept in blocks (see ThreadedGenerateData), which
+ * gives the same output as a voxel by voxel search: every weight and sum is
+ * computed with the same floating point operations in the same order. Only
+ * compiler options that fuse or reorder floating point operations (e.g.
+ * -ffast-math) may change the result, by a few units in the last place.
+ * itkPFNLMFilterTEST checks the output against a voxel by voxel search
+ * with a relative tolerance of 1e-5.
+ *
  * \sa Image
  */
 template <class TInputImage, class TOutputImage>
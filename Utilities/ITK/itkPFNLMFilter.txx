@@ -21,6 +21,7 @@
 #include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkImageRegionIterator.h"
 #include "math.h"
+#include <vector>
 
 namespace itk
 {
@@ -111,22 +112,9 @@ void PFNLMFilter< TInputImage, TOutputImage >
 #endif
 {
 	//================================================================================================================================
-	// Iterators:
-	ImageRegionConstIteratorWithIndex<FeaturesMapType> mit;     // Iterator for the map of local featrues
-	ImageRegionIterator<OutputImageType>               it;      // Iterator for the output image
-	ImageRegionConstIterator<InputImageType>           search;  // Search iterator
-	ImageRegionConstIterator<FeaturesMapType>          msit;    // Iterator for search in the map of local features
 	// Input and output
 	InputImageConstPointer   input   =  this->GetInput();
 	OutputImagePointer       output  =  this->GetOutput();
-	//================================================================================================================================
-	unsigned int numNeighbours = 1;
-	InputImageSizeType baseSearchSize, searchSize;
-	for( unsigned int d=0; d<TInputImage::ImageDimension; ++d ){ // The number of voxels which are going to be accounted in the WA
-		numNeighbours    *= ( 2*m_RSearch[d] + 1 );
-		baseSearchSize[d] = ( 2*m_RSearch[d] + 1 );
-	}
-	InputImageRegionType searchRegion;
 	//==================================================================================================================================
 	float normNoise   = ( m_H * m_Sigma * m_Sigma ) * ComputeTraceMO1( this->GetRComp() );
 	normNoise         = 1.0f/normNoise;
@@ -152,97 +140,158 @@ void PFNLMFilter< TInputImage, TOutputImage >
 		lsnorm[k]  = 1.0f/lsnorm[k];
 	}
 	//==================================================================================================================================
-	mit = ImageRegionConstIteratorWithIndex<FeaturesMapType>( m_Features, outputRegionForThread );
-	it  = ImageRegionIterator<OutputImageType>(              output,     outputRegionForThread );
-	InputImageIndexType originR;
-	InputImageSizeType  radiusR;
-	radiusR = m_RSearch;
+	// The output region is filtered by segments of rows of at most
+	// BLOCKLENGTH voxels. The features of a segment, and the features
+	// and intensities of each row of its search window, are first
+	// copied to separate arrays, one per feature, which fit in cache.
+	// The search window is then swept offset by offset, and the
+	// weights of the whole segment for a given offset are computed in
+	// a single loop with no branches (the weights that fail the
+	// preselection thresholds are replaced by 0 with a select, which
+	// leaves the sums unchanged even when the rejected weight is not
+	// finite, e.g. for h=0), which the compiler can vectorize. Since
+	// the offsets are swept in raster order, each voxel accumulates its
+	// weights in the same order as in a raster scan of its own search
+	// window, so the output is the same as when filtering voxel by voxel.
+	const long BLOCKLENGTH = 64;
+	const float centerWeight = 0.367879441171442f;
+	const LSGradientsL2*  features = m_Features->GetBufferPointer();
+	const InputPixelType* values   = input->GetBufferPointer();
+	// Strides of the features and input buffers, and the position of
+	// the origin of the image in them
+	long fStride[TInputImage::ImageDimension];
+	long iStride[TInputImage::ImageDimension];
+	long fOrigin = 0;
+	long iOrigin = 0;
+	long fs = 1;
+	long is = 1;
+	long size[TInputImage::ImageDimension];
+	long rsearch[TInputImage::ImageDimension];
+	for( unsigned int d=0; d<TInputImage::ImageDimension; ++d ){
+		fStride[d] = fs;
+		iStride[d] = is;
+		fOrigin   -= m_Features->GetBufferedRegion().GetIndex()[d]*fs;
+		iOrigin   -= input->GetBufferedRegion().GetIndex()[d]*is;
+		fs        *= m_Features->GetBufferedRegion().GetSize()[d];
+		is        *= input->GetBufferedRegion().GetSize()[d];
+		size[d]    = input->GetLargestPossibleRegion().GetSize()[d];
+		rsearch[d] = m_RSearch[d];
+	}
+	// Accumulators and features of the segment, and features and
+	// intensities of a row of its search window (the element j of a
+	// row corresponds to the voxel j-rsearch[0] of the segment)
+	float filtered[BLOCKLENGTH];
+	float norm[BLOCKLENGTH];
+	float cLLL[BLOCKLENGTH];
+	float cHLL[BLOCKLENGTH];
+	float cLHL[BLOCKLENGTH];
+	float cLLH[BLOCKLENGTH];
+	const long rowLength = BLOCKLENGTH + 2*rsearch[0];
+	std::vector<float> row( 5*rowLength );
+	float* sLLL     = &row[0];
+	float* sHLL     = sLLL + rowLength;
+	float* sLHL     = sHLL + rowLength;
+	float* sLLH     = sLHL + rowLength;
+	float* sValue   = sLLH + rowLength;
 	//==================================================================================================================================
-	for( it.GoToBegin(),mit.GoToBegin(); !mit.IsAtEnd(); ++it,++mit ){
-		//-------------------------------------------------------------------------------------------------------------
-		// CREATE THE REGION TO SEARCH AND THE ITERATORS:
-		searchSize = baseSearchSize;
-		originR    = mit.GetIndex() - radiusR;
-		bool         needToComputeCenter = false;
-		unsigned int midPosition         = numNeighbours/2;
-		for( unsigned int d=0; d<TInputImage::ImageDimension; ++d ){
-			if( originR[d]<0 ){
-				searchSize[d] += originR[d];
-				originR[d]     = 0;
-				needToComputeCenter = true;
-			}
-			if( originR[d]+searchSize[d] > input->GetLargestPossibleRegion().GetSize()[d] ){
-				searchSize[d]       = input->GetLargestPossibleRegion().GetSize()[d] - originR[d];
-				needToComputeCenter = true;
-			}
-		}
-		// ---------------------
-		// Compute the index corresponding to the original center:
-		if( needToComputeCenter ){
-			unsigned int aux = 1;
-			for( unsigned int d=0; d<TInputImage::ImageDimension; ++d )
-				aux *= searchSize[d];
-			midPosition = 0;
-			if( aux>0 ){
-				for( int d=(int)TInputImage::ImageDimension-1; d>=0; --d ){
-					aux /= searchSize[d];
-					midPosition += ( mit.GetIndex()[d] - originR[d] )*aux;
+	ImageRegionIterator<OutputImageType> it( output, outputRegionForThread );
+	it.GoToBegin();
+	InputImageIndexType start = outputRegionForThread.GetIndex();
+	long end[TInputImage::ImageDimension];
+	for( unsigned int d=0; d<TInputImage::ImageDimension; ++d )
+		end[d] = start[d] + outputRegionForThread.GetSize()[d];
+	//==================================================================================================================================
+	for( long z=start[2]; z<end[2]; ++z ){
+		for( long y=start[1]; y<end[1]; ++y ){
+			for( long x0=start[0]; x0<end[0]; x0+=BLOCKLENGTH ){
+				long length = ( end[0]-x0 < BLOCKLENGTH ? end[0]-x0 : BLOCKLENGTH );
+				const LSGradientsL2* center = features + fOrigin + x0*fStride[0] + y*fStride[1] + z*fStride[2];
+				for( long i=0; i<length; ++i ){
+					filtered[i] = itk::NumericTraits<float>::Zero;
+					norm[i]     = itk::NumericTraits<float>::Zero;
+					cLLL[i]     = center[i*fStride[0]].LLL;
+					cHLL[i]     = center[i*fStride[0]].HLL;
+					cLHL[i]     = center[i*fStride[0]].LHL;
+					cLLH[i]     = center[i*fStride[0]].LLH;
 				}
-			}
-		}
-		// ---------------------
-		searchRegion.SetIndex( originR );
-		searchRegion.SetSize( searchSize );
-		search = ImageRegionConstIterator<InputImageType>(   input,      searchRegion  );
-		msit   = ImageRegionConstIterator<FeaturesMapType>(  m_Features, searchRegion  );
-		//-------------------------------------------------------------------------------------------------------------
-		// FILTER THE PIXEL
-		LSGradientsL2    center = mit.Get();
-		float norm     = itk::NumericTraits<float>::Zero;    // To normalize the weights to sum to 1
-		float filtered = itk::NumericTraits<float>::Zero;
-		float weight;
-		unsigned int pos; // Auxiliar variable
-		for( pos=0,search.GoToBegin(),msit.GoToBegin(); !search.IsAtEnd(); ++search,++msit,++pos ){
-			if( pos!=midPosition ){
-				LSGradientsL2 value  = msit.Get();
-				weight               = (center.LLL-value.LLL)*(value.LLL-center.LLL);
-				if( weight > -tho0 ){
-					weight              += (center.HLL-value.HLL)*(value.HLL-center.HLL)*lsnorm[0];
-					weight              += (center.LHL-value.LHL)*(value.LHL-center.LHL)*lsnorm[1];
-					weight              += (center.LLH-value.LLH)*(value.LLH-center.LLH)*lsnorm[2];
-					if( weight > -tho1 ){
-						weight          *= normNoise;
-						//==========================================================================
-						// Computing the exponential is painfully slow; instead, a rational approxima-
-						// tion may be taken that very closely fits the exponential curve in the range
-						// [0,1.6]. Far from this range, the error between the curves can reach 0.04,
-						// but fortunately the exponential curve vanish to 0.1 from 2.3, so the overall
-						// error is relatively small. As an example, the RMSD between the curves in the
-						// range [0,2.7] is 0.0391. The RMSD between two exponential curves with h=1.0
-						// and h=0.8 in this same range is 0.1021. Hence, this error is negligible.
-						//
-						//weight           = exp( weight );
-						float temp       = 1.0f/(1.0f-weight);
-						weight           = temp*(0.5f*(2.0f+weight)) - temp*temp*(0.5f*weight);
-						//==========================================================================
-						//filtered        += ( (float)(search.Get()) ) * ( (float)(search.Get()) ) * weight;  //Rician noise
-            filtered  += ( (float)(search.Get()) ) * weight;
-						norm            += weight;
+				// The row elements that are inside the image
+				long jFirst = ( rsearch[0]-x0 > 0 ? rsearch[0]-x0 : 0 );
+				long jLast  = ( size[0]-x0+rsearch[0] < length+2*rsearch[0] ? size[0]-x0+rsearch[0] : length+2*rsearch[0] );
+				//-------------------------------------------------------------------------------------------------------------
+				// SWEEP THE SEARCH WINDOW (CROPPED TO THE IMAGE):
+				long dzFirst = ( z-rsearch[2] < 0         ? -z          : -rsearch[2] );
+				long dzLast  = ( z+rsearch[2] > size[2]-1 ? size[2]-1-z : rsearch[2]  );
+				long dyFirst = ( y-rsearch[1] < 0         ? -y          : -rsearch[1] );
+				long dyLast  = ( y+rsearch[1] > size[1]-1 ? size[1]-1-y : rsearch[1]  );
+				for( long dz=dzFirst; dz<=dzLast; ++dz ){
+					for( long dy=dyFirst; dy<=dyLast; ++dy ){
+						long                  x       = x0 - rsearch[0];
+						const LSGradientsL2*  msearch = features + fOrigin + x*fStride[0] + (y+dy)*fStride[1] + (z+dz)*fStride[2];
+						const InputPixelType* search  = values   + iOrigin + x*iStride[0] + (y+dy)*iStride[1] + (z+dz)*iStride[2];
+						for( long j=jFirst; j<jLast; ++j ){
+							sLLL[j]   = msearch[j*fStride[0]].LLL;
+							sHLL[j]   = msearch[j*fStride[0]].HLL;
+							sLHL[j]   = msearch[j*fStride[0]].LHL;
+							sLLH[j]   = msearch[j*fStride[0]].LLH;
+							sValue[j] = (float)( search[j*iStride[0]] );
+						}
+						for( long dx=-rsearch[0]; dx<=rsearch[0]; ++dx ){
+							// The voxels of the segment whose neighbour at this offset is inside the image
+							long first = jFirst - dx - rsearch[0];
+							long last  = jLast  - dx - rsearch[0];
+							first = ( first > 0 ? first : 0 );
+							last  = ( last < length ? last : length );
+							const float* vLLL   = sLLL   + dx + rsearch[0];
+							const float* vHLL   = sHLL   + dx + rsearch[0];
+							const float* vLHL   = sLHL   + dx + rsearch[0];
+							const float* vLLH   = sLLH   + dx + rsearch[0];
+							const float* vValue = sValue + dx + rsearch[0];
+							if( dx==0 && dy==0 && dz==0 ){
+								for( long i=first; i<last; ++i ){
+									// filtered[i] += vValue[i] * vValue[i] * centerWeight; // Rician noise
+									filtered[i] += vValue[i] * centerWeight;
+									norm[i]     += centerWeight;
+								}
+								continue;
+							}
+							for( long i=first; i<last; ++i ){
+								float weight0 = (cLLL[i]-vLLL[i])*(vLLL[i]-cLLL[i]);
+								float weight  = weight0;
+								weight       += (cHLL[i]-vHLL[i])*(vHLL[i]-cHLL[i])*lsnorm[0];
+								weight       += (cLHL[i]-vLHL[i])*(vLHL[i]-cLHL[i])*lsnorm[1];
+								weight       += (cLLH[i]-vLLH[i])*(vLLH[i]-cLLH[i])*lsnorm[2];
+								bool  accept  = ( weight0 > -tho0 ) & ( weight > -tho1 );
+								weight       *= normNoise;
+								//==========================================================================
+								// Computing the exponential is painfully slow; instead, a rational approxima-
+								// tion may be taken that very closely fits the exponential curve in the range
+								// [0,1.6]. Far from this range, the error between the curves can reach 0.04,
+								// but fortunately the exponential curve vanish to 0.1 from 2.3, so the overall
+								// error is relatively small. As an example, the RMSD between the curves in the
+								// range [0,2.7] is 0.0391. The RMSD between two exponential curves with h=1.0
+								// and h=0.8 in this same range is 0.1021. Hence, this error is negligible.
+								//
+								//weight           = exp( weight );
+								float temp    = 1.0f/(1.0f-weight);
+								weight        = temp*(0.5f*(2.0f+weight)) - temp*temp*(0.5f*weight);
+								//==========================================================================
+								weight        = ( accept ? weight : 0.0f );
+								//filtered[i] += vValue[i] * vValue[i] * weight;  //Rician noise
+								filtered[i]  += vValue[i] * weight;
+								norm[i]      += weight;
+							}
+						}
 					}
 				}
-			}
-			else{
-				weight   = 0.367879441171442f;
-				// filtered += ( (float)(search.Get()) ) * ( (float)(search.Get()) ) * weight; // Rician noise
-        filtered  += ( (float)(search.Get()) ) * weight;
-				norm     += weight;
+				//-------------------------------------------------------------------------------------------------------------
+				// Set the output pixels
+				for( long i=0; i<length; ++i,++it ){
+					// filtered = filtered/norm - 2.0f*m_Sigma*m_Sigma;
+					// filtered = ( filtered>0.0f ? ::sqrt(filtered) : 0.0f );
+					it.Set(   static_cast<OutputPixelType>( filtered[i]/norm[i] )   );
+				}
 			}
 		}
-		// filtered = filtered/norm - 2.0f*m_Sigma*m_Sigma;
-		// filtered = ( filtered>0.0f ? ::sqrt(filtered) : 0.0f );
-    filtered = filtered/norm;
-		// Set the output pixel
-		it.Set(   static_cast<OutputPixelType>( filtered )   );
 	}
 }
 
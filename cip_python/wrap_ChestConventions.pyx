@@ -16,7 +16,7 @@ cdef extern from "cipChestConventions.h" namespace "cip":
         unsigned short GetValueFromChestRegionAndType(unsigned char region, unsigned char type) const
         unsigned char GetChestRegionValueFromName(string regionString) const
         unsigned char GetChestTypeValueFromName(string typeString) const
-        bool CheckSubordinateSuperiorChestRegionRelationship(unsigned char subordinate, unsigned char superior)
+        bool CheckSubordinateSuperiorChestRegionRelationship(unsigned char subordinate, unsigned char superior) const
         bool IsPhenotypeName(string) const
         bool IsChestRegion(string) const
         bool IsChestType(string) const